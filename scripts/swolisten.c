@@ -20,30 +20,55 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * The trace flows through three stages, so that none of them can hold up
+ * the one before it:
+ *
+ *  - the feeder keeps several asynchronous USB transfers in flight (or reads
+ *    the serial port) and puts the raw trace into a single producer, single
+ *    consumer ring,
+ *  - a decoder thread takes the trace from the ring and sorts the stimulus
+ *    port data into a bounded queue for each channel,
+ *  - every channel has a writer thread that drains its queue into a fifo, a
+ *    file or a TCP socket.
+ *
+ * Whatever does not fit into a ring or queue is dropped and counted, the
+ * counts are reported on exit.
+ */
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
+#include <netinet/in.h>
 #include <stdio.h>
 #include <string.h>
 #include <libusb.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <limits.h>
 #include <termios.h>
 #include <signal.h>
+#include <pthread.h>
 
 #define VID       (0x1d50)
 #define PID       (0x6018)
 #define INTERFACE (5)
 #define ENDPOINT  (0x85)
 
-#define TRANSFER_SIZE (64)
+#define TRANSFER_SIZE     (64)
+#define USB_TRANSFER_SIZE (1024)     /* a multiple of the 64 byte trace packets */
+#define USB_TRANSFERS     (8)        /* asynchronous transfers kept in flight */
+#define USB_TIMEOUT_MS    (10)
+#define RAW_RING_SIZE     (1 << 20)  /* raw trace between feeder and decoder */
+#define CHAN_QUEUE_SIZE   (1 << 16)  /* decoded data per channel */
+#define IDLE_WAIT_US      (1000)
+
 #define NUM_FIFOS     32
 #define MAX_FIFOS     128
 
@@ -53,6 +78,8 @@
 #define FALSE      (0)
 #define TRUE       (!FALSE)
 
+enum _sinkType {SINK_FIFO, SINK_FILE, SINK_TCP};
+
 // Record for options, either defaults or from command line
 struct
 {
@@ -62,12 +89,37 @@ struct
   char *chanPath;
   char *port;
   int speed;
-} options = {.nChannels=NUM_FIFOS, .chanPath="", .speed=115200};
+  enum _sinkType sink;
+  int tcpPort;
+} options = {.nChannels=NUM_FIFOS, .chanPath="", .speed=115200, .sink=SINK_FIFO};
+
+// Single producer, single consumer byte ring, size a power of 2
+struct ring
+{
+  _Atomic size_t head;   /* only written by the producer */
+  _Atomic size_t tail;   /* only written by the consumer */
+  size_t size;
+  uint8_t *buf;
+  uint64_t dropped;      /* bytes the producer found no space for */
+};
+
+// A channel output with its queue and writer thread
+struct consumer
+{
+  int chan;
+  char name[PATH_MAX];
+  int listenHandle;
+  struct ring q;
+  _Atomic uint64_t written;
+  _Atomic uint64_t lost;  /* bytes taken from the queue that the output refused */
+};
 
 // Runtime state
 struct
 {
-  int fifo[MAX_FIFOS];
+  struct ring raw;
+  struct consumer chan[MAX_FIFOS];
+  int nConsumers;
 } _r;
 
 // ====================================================================================================
@@ -77,104 +129,213 @@ struct
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-static BOOL _runFifo(int portNo, int listenHandle, char *fifoName)
+static BOOL _ringInit(struct ring *r, size_t size)
+
+{
+  r->buf=malloc(size);
+  r->size=size;
+  r->dropped=0;
+  atomic_init(&r->head,0);
+  atomic_init(&r->tail,0);
+  return r->buf!=NULL;
+}
+// ====================================================================================================
+static void _ringPut(struct ring *r, const uint8_t *d, size_t len)
+
+/* Producer side, whatever does not fit is dropped */
 
 {
-  int pid,fifo;
-  int readDataLen, writeDataLen;
+  size_t head=atomic_load_explicit(&r->head,memory_order_relaxed);
+  size_t tail=atomic_load_explicit(&r->tail,memory_order_acquire);
+  size_t space=r->size-(head-tail);
 
-  if (mkfifo(fifoName,0666)<0)
+  if (len>space)
     {
-      return FALSE;
+      r->dropped+=len-space;
+      len=space;
     }
 
-  pid=fork();
+  for (size_t i=0; i<len; i++)
+    r->buf[(head+i)&(r->size-1)]=d[i];
+
+  atomic_store_explicit(&r->head,head+len,memory_order_release);
+}
+// ====================================================================================================
+static size_t _ringGet(struct ring *r, uint8_t *d, size_t len)
+
+/* Consumer side, returns the number of bytes taken */
+
+{
+  size_t tail=atomic_load_explicit(&r->tail,memory_order_relaxed);
+  size_t head=atomic_load_explicit(&r->head,memory_order_acquire);
+
+  if (len>head-tail)
+    len=head-tail;
+
+  for (size_t i=0; i<len; i++)
+    d[i]=r->buf[(tail+i)&(r->size-1)];
+
+  atomic_store_explicit(&r->tail,tail+len,memory_order_release);
+  return len;
+}
+// ====================================================================================================
+static int _consumerOpen(struct consumer *c)
+
+/* Blocks until the output can take data: a fifo has a reader, a socket a client */
 
-  if (pid==0)
+{
+  switch (options.sink)
     {
-      char rxdata[TRANSFER_SIZE];
-      int fifo;
+    case SINK_FIFO:
+      return open(c->name,O_WRONLY);
 
-      /* Don't kill this sub-process when any reader or writer evaporates */
-      signal(SIGPIPE, SIG_IGN);
+    case SINK_FILE:
+      return open(c->name,O_WRONLY|O_CREAT|O_APPEND,0666);
 
-      while (1)
-	{
-	  /* This is the child */
-	  fifo=open(fifoName,O_WRONLY);
+    case SINK_TCP:
+      return accept(c->listenHandle,NULL,NULL);
+    }
+  return -1;
+}
+// ====================================================================================================
+static void *_consumerThread(void *arg)
 
-	  while (1)
+{
+  struct consumer *c=arg;
+  uint8_t d[4096];
+  int fd=-1;
+
+  while (1)
+    {
+      if (fd<0)
+	{
+	  fd=_consumerOpen(c);
+	  if (fd<0)
 	    {
-	      readDataLen=read(listenHandle,rxdata,TRANSFER_SIZE);
-	      if (readDataLen<=0)
-		{
-		  exit(0);
-		}
-
-	      writeDataLen=write(fifo,rxdata,readDataLen);
-	      if (writeDataLen<=0)
-		{
-		  break;
-		}
+	      usleep(500000);
+	      continue;
 	    }
-	  close(fifo);
+	}
+
+      size_t len=_ringGet(&c->q,d,sizeof(d));
+      if (!len)
+	{
+	  usleep(IDLE_WAIT_US);
+	  continue;
+	}
+
+      size_t done=0;
+      while (done<len)
+	{
+	  ssize_t w=write(fd,d+done,len-done);
+	  if (w<=0)
+	    break;
+	  done+=w;
+	}
+      atomic_fetch_add(&c->written,done);
+      if (done<len)
+	{
+	  /* Reader went away, wait for the next one */
+	  atomic_fetch_add(&c->lost,len-done);
+	  close(fd);
+	  fd=-1;
 	}
     }
-  else if (pid<0)
+  return NULL;
+}
+// ====================================================================================================
+static BOOL _makeConsumer(struct consumer *c, int chan)
+
+/* Create the output of a channel, its queue and writer thread */
+
+{
+  pthread_t thread;
+
+  c->chan=chan;
+  c->listenHandle=-1;
+  sprintf(c->name,"%s%s%02X",options.chanPath,CHANNELNAME,chan);
+
+  if (!_ringInit(&c->q,CHAN_QUEUE_SIZE))
+    return FALSE;
+
+  switch (options.sink)
     {
-      /* The fork failed */
-      return FALSE;
+    case SINK_FIFO:
+      if (mkfifo(c->name,0666)<0)
+	return FALSE;
+      break;
+
+    case SINK_FILE:
+      break;
+
+    case SINK_TCP:
+      {
+	struct sockaddr_in addr;
+	int opt=1;
+
+	c->listenHandle=socket(PF_INET,SOCK_STREAM,0);
+	if (c->listenHandle<0)
+	  return FALSE;
+	setsockopt(c->listenHandle,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt));
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_port=htons(options.tcpPort+chan);
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	if ((bind(c->listenHandle,(struct sockaddr *)&addr,sizeof(addr))<0) || (listen(c->listenHandle,1)<0))
+	  {
+	    fprintf(stderr,"Can't listen on port %d: %s\n",options.tcpPort+chan,strerror(errno));
+	    return FALSE;
+	  }
+      }
+      break;
     }
+
+  if (pthread_create(&thread,NULL,_consumerThread,c))
+    return FALSE;
+  pthread_detach(thread);
   return TRUE;
 }
 // ====================================================================================================
 static BOOL _makeFifoTasks(void)
 
-/* Create each sub-process that will handle a port */
+/* Create the output of each channel */
 
 {
-  char fifoName[PATH_MAX];
-
-  int f[2];
+  /* Don't get killed when any reader evaporates */
+  signal(SIGPIPE, SIG_IGN);
 
   for (int t=0; t<options.nChannels; t++)
     {
-      if (pipe(f)<0)
-	  return FALSE;
-      fcntl(f[1],F_SETFL,O_NONBLOCK);
-      _r.fifo[t]=f[1];
-      sprintf(fifoName,"%s%s%02X",options.chanPath,CHANNELNAME,t);
-      if (!_runFifo(t,f[0],fifoName))
+      if (!_makeConsumer(&_r.chan[t],t))
 	{
 	  return FALSE;
 	}
+      _r.nConsumers++;
     }
   return TRUE;
 }
 // ====================================================================================================
 static void _removeFifoTasks(void)
 
-/* Destroy the per-port sub-processes */
+/* Remove the channel fifos and report what was lost */
 
 {
-  int statloc;
-  int remainingProcesses=0;
-  char fifoName[PATH_MAX];
+  if (_r.raw.dropped)
+    fprintf(stderr,"Decoder did not keep up, %llu trace bytes dropped\n",(unsigned long long)_r.raw.dropped);
 
-  for (int t=0; t<options.nChannels; t++)
+  for (int t=0; t<_r.nConsumers; t++)
     {
-      if (_r.fifo[t]>0)
-	{
-	  close(_r.fifo[t]);
-	  sprintf(fifoName,"%s%s%02X",options.chanPath,CHANNELNAME,t);
-	  unlink(fifoName);
-	  remainingProcesses++;
-	}
-    }
+      struct consumer *c=&_r.chan[t];
 
-  while (remainingProcesses--)
-    {
-      waitpid(-1,&statloc,0);
+      if (options.sink==SINK_FIFO)
+	unlink(c->name);
+      if (c->listenHandle>=0)
+	close(c->listenHandle);
+
+      uint64_t lost=atomic_load(&c->lost);
+      if ((options.verbose) || (c->q.dropped) || (lost))
+	fprintf(stderr,"%s%02X: %llu bytes written, %llu dropped, %llu lost on write\n",CHANNELNAME,t,
+		(unsigned long long)atomic_load(&c->written),(unsigned long long)c->q.dropped,(unsigned long long)lost);
     }
 }
 // ====================================================================================================
@@ -187,8 +348,8 @@ static void _removeFifoTasks(void)
 void _handleSWIT(uint8_t addr, uint8_t length, uint8_t *d)
 
 {
-  if (addr<options.nChannels)
-    write(_r.fifo[addr],d,length);
+  if (addr<_r.nConsumers)
+    _ringPut(&_r.chan[addr].q,d,length);
 
   //  if (addr==0)
   //  fprintf(stdout,"%c",*d);
@@ -337,6 +498,35 @@ void _protocolPump(uint8_t *c)
 #endif
 }
 // ====================================================================================================
+static void *_decoderThread(void *arg)
+
+/* Take the raw trace from the ring and hand it to the protocol pump */
+
+{
+  uint8_t d[4096];
+
+  (void)arg;
+  while (1)
+    {
+      size_t len=_ringGet(&_r.raw,d,sizeof(d));
+      if (!len)
+	{
+	  usleep(IDLE_WAIT_US);
+	  continue;
+	}
+
+      if (options.dump)
+	{
+	  fwrite(d,1,len,stdout);
+	  fflush(stdout);
+	}
+      else
+	for (size_t i=0; i<len; i++)
+	  _protocolPump(&d[i]);
+    }
+  return NULL;
+}
+// ====================================================================================================
 void intHandler(int dummy)
 
 {
@@ -346,13 +536,15 @@ void intHandler(int dummy)
 void _printHelp(char *progName)
 
 {
-  printf("Useage: %s <dhnv> <b basedir> <p port> <s speed>\n",progName);
+  printf("Useage: %s <dfhnv> <b basedir> <p port> <s speed> <t tcpport>\n",progName);
   printf("        b: <basedir> for channels\n");
   printf("        h: This help\n");
   printf("        d: Dump received data without further processing\n");
+  printf("        f: Write channels to files rather than fifos\n");
   printf("        n: <Number> of channels to populate\n");
   printf("        p: <serialPort> to use\n");
   printf("        s: <serialSpeed> to use\n");
+  printf("        t: Serve channel n on localhost <tcpPort>+n rather than fifos\n");
   printf("        v: Verbose mode\n");
 }
 // ====================================================================================================
@@ -360,7 +552,7 @@ int _processOptions(int argc, char *argv[])
 
 {
   int c;
-  while ((c = getopt (argc, argv, "vdn:b:hp:s:")) != -1)
+  while ((c = getopt (argc, argv, "vdfn:b:hp:s:t:")) != -1)
     switch (c)
       {
       case 'v':
@@ -369,12 +561,24 @@ int _processOptions(int argc, char *argv[])
       case 'd':
         options.dump = 1;
         break;
+      case 'f':
+        options.sink = SINK_FILE;
+        break;
       case 'p':
 	options.port=optarg;
 	break;
       case 's':
 	options.speed=atoi(optarg);
 	break;
+      case 't':
+	options.sink=SINK_TCP;
+	options.tcpPort=atoi(optarg);
+	if ((options.tcpPort<1) || (options.tcpPort>65535-MAX_FIFOS))
+	  {
+	    fprintf(stderr,"TCP port out of range\n");
+	    return FALSE;
+	  }
+	break;
       case 'h':
 	_printHelp(argv[0]);
 	return FALSE;
@@ -406,51 +610,96 @@ int _processOptions(int argc, char *argv[])
 	{
 	  fprintf(stdout,"Serial Port: %s\nSerial Speed: %d\n",options.port,options.speed);
 	}
+      if (options.sink==SINK_TCP)
+	{
+	  fprintf(stdout,"TCP Ports: %d-%d\n",options.tcpPort,options.tcpPort+options.nChannels-1);
+	}
     }
   return TRUE;
 }
 // ====================================================================================================
-int usbFeeder(void)
+static void LIBUSB_CALL _usbCallback(struct libusb_transfer *t)
+
+/* A transfer that timed out still carries the data received until then */
 
 {
+  int *active=t->user_data;
 
-  unsigned char cbw[TRANSFER_SIZE];
+  if ((t->status==LIBUSB_TRANSFER_COMPLETED) || (t->status==LIBUSB_TRANSFER_TIMED_OUT))
+    {
+      _ringPut(&_r.raw,t->buffer,t->actual_length);
+      if (!libusb_submit_transfer(t))
+	return;
+    }
+  (*active)--;
+}
+// ====================================================================================================
+int usbFeeder(void)
+
+{
+  static unsigned char buf[USB_TRANSFERS][USB_TRANSFER_SIZE];
+  struct libusb_transfer *transfer[USB_TRANSFERS];
   libusb_device_handle *handle;
   libusb_device *dev;
-  int size;
+  int active;
+
+  if (libusb_init(NULL) < 0)
+    {
+      fprintf(stderr,"Failed to initalise USB interface\n");
+      return (-1);
+    }
 
   while (1)
     {
-      if (libusb_init(NULL) < 0)
+      while (!(handle = libusb_open_device_with_vid_pid(NULL, VID, PID)))
 	{
-	  fprintf(stderr,"Failed to initalise USB interface\n");
-	  return (-1);
+	  usleep(500000);
 	}
 
-      while (!(handle = libusb_open_device_with_vid_pid(NULL, VID, PID)))
+      if ((!(dev = libusb_get_device(handle))) || (libusb_claim_interface (handle, INTERFACE)<0))
 	{
+	  libusb_close(handle);
 	  usleep(500000);
+	  continue;
 	}
 
-      if (!(dev = libusb_get_device(handle)))
-	continue;
+      active=0;
+      memset(transfer,0,sizeof(transfer));
+      for (int t=0; t<USB_TRANSFERS; t++)
+	{
+	  if (!(transfer[t] = libusb_alloc_transfer(0)))
+	    break;
+	  libusb_fill_bulk_transfer(transfer[t], handle, ENDPOINT, buf[t], USB_TRANSFER_SIZE,
+				    _usbCallback, &active, USB_TIMEOUT_MS);
+	  if (libusb_submit_transfer(transfer[t]))
+	    {
+	      libusb_free_transfer(transfer[t]);
+	      transfer[t]=NULL;
+	      break;
+	    }
+	  active++;
+	}
 
-      if (libusb_claim_interface (handle, INTERFACE)<0)
-	continue;
+      if (options.verbose)
+	{
+	  fprintf(stderr,"Probe opened, %d transfers in flight\n",active);
+	}
 
-      while (0==libusb_bulk_transfer(handle, ENDPOINT, cbw, TRANSFER_SIZE, &size, 10))
+      /* Transfers are resubmitted from the callback until one fails, then the rest are taken down */
+      int inFlight=active;
+      while (active)
 	{
-	  unsigned char *c=cbw;
-          if (options.dump)
-          {
-              cbw[size] = 0;
-              printf("%s", (char*)cbw);
-          }
-          else
-              while (size--)
-                  _protocolPump(c++);
+	  libusb_handle_events(NULL);
+	  if (active<inFlight)
+	    {
+	      for (int t=0; t<inFlight; t++)
+		libusb_cancel_transfer(transfer[t]);
+	      inFlight=0;
+	    }
 	}
 
+      for (int t=0; t<USB_TRANSFERS && transfer[t]; t++)
+	libusb_free_transfer(transfer[t]);
       libusb_close(handle);
     }
 }
@@ -507,9 +756,7 @@ int serialFeeder(void)
 
       while ((t=read(f,cbw,TRANSFER_SIZE))>0)
 	{
-	  unsigned char *c=cbw;
-	  while (t--)
-	    _protocolPump(c++);
+	  _ringPut(&_r.raw,cbw,t);
 	}
       if (options.verbose)
 	{
@@ -522,6 +769,8 @@ int serialFeeder(void)
 int main(int argc, char *argv[])
 
 {
+  pthread_t decoder;
+
   if (!_processOptions(argc,argv))
     {
       exit(-1);
@@ -536,6 +785,12 @@ int main(int argc, char *argv[])
       exit(-1);
     }
 
+  if ((!_ringInit(&_r.raw,RAW_RING_SIZE)) || (pthread_create(&decoder,NULL,_decoderThread,NULL)))
+    {
+      fprintf(stderr,"Failed to start decoder\n");
+      exit(-1);
+    }
+
   /* Using the exit construct rather than return ensures the atexit gets called */
   if (!options.port)
     exit(usbFeeder());
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+#
+# wire_trace.py: Latency report for a Black Magic Debug App wire trace
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Reads the file written by 'blackmagic -W FILE' and prints, for each kind
+# of operation, a histogram of how long it took, then the longest gaps in
+# which nothing crossed the wire at all.
+#
+# Latencies are measured as:
+#  usb     submission to completion, per endpoint, in submission order
+#  dap     CMSIS-DAP command to its response, in command order
+#  remote  the last thing sent, or received, to each response received
+#  gdb     a packet from GDB to the first packet sent back
+
+from argparse import ArgumentParser
+from collections import defaultdict, deque
+import struct
+import sys
+
+# Keep in step with platforms/hosted/wire_trace.h
+USB_SUBMIT, USB_COMPLETE, REMOTE_TX, REMOTE_RX, DAP_CMD, DAP_RESP, GDB_RX, GDB_TX = range(8)
+OP_NAMES = ["usb submit", "usb complete", "remote tx", "remote rx", "dap cmd", "dap resp", "gdb rx", "gdb tx"]
+
+HEADER = struct.Struct("=8sIIQ")
+RECORD = struct.Struct("=QIBBH")
+MAGIC = b"BMPWIRE\0"
+
+def read_trace(path):
+	"""Return the records of a trace file as (time_ns, op, tag, len) tuples"""
+	with open(path, "rb") as f:
+		data = f.read()
+	if len(data) < HEADER.size:
+		sys.exit("%s: too short for a wire trace" % path)
+	magic, version, record_size, recorded = HEADER.unpack_from(data)
+	if magic != MAGIC or version != 1 or record_size != RECORD.size:
+		sys.exit("%s: not a version 1 wire trace" % path)
+	records = [(t, op, tag, length) for t, length, op, tag, _ in RECORD.iter_unpack(data[HEADER.size:])]
+	if recorded > len(records):
+		print("%u of %u records, the oldest were overwritten" % (len(records), recorded))
+	return records
+
+def tag_name(tag):
+	return chr(tag) if 0x20 < tag < 0x7f else "0x%02x" % tag
+
+def latencies(records):
+	"""Return a dict of operation name to a list of latencies in ns"""
+	result = defaultdict(list)
+	usb = defaultdict(deque)
+	dap = deque()
+	remote_last = None
+	remote_tag = None
+	gdb = None
+	for t, op, tag, length in records:
+		if op == USB_SUBMIT:
+			usb[tag].append(t)
+		elif op == USB_COMPLETE and usb[tag]:
+			direction = "in" if tag & 0x80 else "out"
+			result["usb %s ep 0x%02x" % (direction, tag)].append(t - usb[tag].popleft())
+		elif op == DAP_CMD:
+			dap.append((t, tag))
+		elif op == DAP_RESP and dap:
+			start, cmd = dap.popleft()
+			result["dap 0x%02x" % cmd].append(t - start)
+		elif op == REMOTE_TX:
+			remote_last = t
+			remote_tag = tag
+		elif op == REMOTE_RX and remote_last is not None:
+			result["remote %s" % tag_name(remote_tag)].append(t - remote_last)
+			remote_last = t
+		elif op == GDB_RX:
+			gdb = (t, tag)
+		elif op == GDB_TX and gdb:
+			result["gdb %s" % tag_name(gdb[1])].append(t - gdb[0])
+			gdb = None
+	return result
+
+def bucket(ns):
+	"""Power of two microsecond bucket a latency falls in"""
+	us = ns // 1000
+	return us.bit_length()
+
+def bucket_name(b):
+	if b == 0:
+		return "<1us"
+	return "<%sus" % (1 << b)
+
+def print_histogram(name, values):
+	values = sorted(values)
+	total = sum(values)
+	print("%s: %u, total %.3fms, min %.1fus, median %.1fus, max %.1fus" % (name, len(values), total / 1e6,
+		values[0] / 1e3, values[len(values) // 2] / 1e3, values[-1] / 1e3))
+	counts = defaultdict(int)
+	for v in values:
+		counts[bucket(v)] += 1
+	width = max(counts.values())
+	for b in range(min(counts), max(counts) + 1):
+		n = counts.get(b, 0)
+		print("  %8s %8u %s" % (bucket_name(b), n, "#" * ((n * 50 + width - 1) // width)))
+
+def print_gaps(records, count, threshold_us):
+	gaps = []
+	for prev, cur in zip(records, records[1:]):
+		gaps.append((cur[0] - prev[0], prev, cur))
+	idle = sum(g for g, _, _ in gaps if g >= threshold_us * 1000)
+	span = records[-1][0] - records[0][0]
+	print("Idle gaps of %uus or more: %.3fms of %.3fms" % (threshold_us, idle / 1e6, span / 1e6))
+	for gap, prev, cur in sorted(gaps, key=lambda g: g[0], reverse=True)[:count]:
+		print("  %10.1fus at %12.3fms after %s %s, before %s %s" % (gap / 1e3, (prev[0] - records[0][0]) / 1e6,
+			OP_NAMES[prev[1]], tag_name(prev[2]), OP_NAMES[cur[1]], tag_name(cur[2])))
+
+def main():
+	parser = ArgumentParser(description="Latency report for a blackmagic -W wire trace")
+	parser.add_argument("trace", help="file written by blackmagic -W")
+	parser.add_argument("-g", "--gaps", type=int, default=10, help="longest idle gaps to list")
+	parser.add_argument("-t", "--threshold", type=int, default=1000, help="idle gap threshold in us")
+	args = parser.parse_args()
+
+	records = read_trace(args.trace)
+	if not records:
+		sys.exit("%s: no records" % args.trace)
+	for name, values in sorted(latencies(records).items()):
+		print_histogram(name, values)
+	print_gaps(records, args.gaps, args.threshold)
+
+if __name__ == "__main__":
+	main()
@@ -28,6 +28,7 @@
 #include "exception.h"
 #include "command.h"
 #include "gdb_packet.h"
+#include "gdb_rtos.h"
 #include "target.h"
 #include "target_internal.h"
 #include "morse.h"
@@ -43,6 +44,20 @@
 #include "traceswo.h"
 #endif
 
+#include "cortexm.h"
+
+#ifdef ENABLE_PERF
+#include "perf.h"
+#endif
+
+#ifdef PLATFORM_HAS_STANDALONE
+#include "standalone.h"
+#endif
+
+#if PC_HOSTED == 1
+#include "snapshot.h"
+#endif
+
 #if defined(_WIN32) || defined(__CYGWIN__)
 #include <malloc.h>
 #else
@@ -59,19 +74,40 @@ static bool cmd_frequency(target *t, int argc, const char **argv);
 static bool cmd_targets(target *t, int argc, const char **argv);
 static bool cmd_morse(target *t, int argc, const char **argv);
 static bool cmd_halt_timeout(target *t, int argc, const char **argv);
+#if PC_HOSTED == 1
+static bool cmd_halt_prefetch(target *t, int argc, const char **argv);
+#endif
 static bool cmd_connect_reset(target *t, int argc, const char **argv);
+static bool cmd_scan_cache(target *t, int argc, const char **argv);
+static bool cmd_rtos(target *t, int argc, const char **argv);
 static bool cmd_reset(target *t, int argc, const char **argv);
 static bool cmd_tdi_low_reset(target *t, int argc, const char **argv);
+static bool cmd_flash_stats(target *t, int argc, const char **argv);
+#if PC_HOSTED == 0
+static bool cmd_bench(target *t, int argc, const char **argv);
+#endif
+#ifdef ENABLE_PERF
+static bool cmd_perf(target *t, int argc, const char **argv);
+#endif
 #ifdef PLATFORM_HAS_POWER_SWITCH
 static bool cmd_target_power(target *t, int argc, const char **argv);
 #endif
 #ifdef PLATFORM_HAS_TRACESWO
 static bool cmd_traceswo(target *t, int argc, const char **argv);
+static bool cmd_swo_stats(target *t, int argc, const char **argv);
+static bool cmd_isrstats(target *t, int argc, const char **argv);
 #endif
 static bool cmd_heapinfo(target *t, int argc, const char **argv);
+#if PC_HOSTED == 1
+static bool cmd_poll_pace(target *t, int argc, const char **argv);
+static bool cmd_snapshot(target *t, int argc, const char **argv);
+#endif
 #ifdef ENABLE_RTT
 static bool cmd_rtt(target *t, int argc, const char **argv);
 #endif
+#ifdef PLATFORM_HAS_STANDALONE
+static bool cmd_standalone(target *t, int argc, const char **argv);
+#endif
 #if defined(PLATFORM_HAS_DEBUG) && (PC_HOSTED == 0)
 static bool cmd_debug_bmp(target *t, int argc, const char **argv);
 #endif
@@ -82,27 +118,50 @@ const command_t cmd_list[] = {
 	{"jtag_scan", cmd_jtag_scan, "Scan JTAG chain for devices"},
 	{"swdp_scan", cmd_swdp_scan, "Scan SW-DP for devices"},
 	{"auto_scan", cmd_auto_scan, "Automatically scan all chain types for devices"},
-	{"frequency", cmd_frequency, "set minimum high and low times"},
+	{"frequency", cmd_frequency, "set minimum high and low times: (<freq>[k|M] | auto [max])"},
 	{"targets", cmd_targets, "Display list of available targets"},
 	{"morse", cmd_morse, "Display morse error message"},
 	{"halt_timeout", cmd_halt_timeout, "Timeout (ms) to wait until Cortex-M is halted: (Default 2000)"},
+#if PC_HOSTED == 1
+	{"halt_prefetch", cmd_halt_prefetch, "Bytes around SP and PC read with the registers at each Cortex-M halt: (Default 128, 0 disables)"},
+#endif
 	{"connect_rst", cmd_connect_reset, "Configure connect under reset: (enable|disable)"},
+	{"scan_cache", cmd_scan_cache, "Reuse the last SW-DP scan's targets when the same part is found: (enable|disable|flush)"},
+	{"rtos", cmd_rtos, "Threads of the RTOS found in the program GDB loaded: (enable|disable)"},
 	{"reset", cmd_reset, "Pulse the nRST line - disconnects target"},
 	{"tdi_low_reset", cmd_tdi_low_reset, "Pulse nRST with TDI set low to attempt to wake certain targets up (eg LPC82x)"},
+	{"flash_stats", cmd_flash_stats, "Display timing and throughput of the last flash session"},
+#if PC_HOSTED == 0
+	{"bench", cmd_bench, "Measure the debug link to the attached target from the probe itself"},
+#endif
+#ifdef ENABLE_PERF
+	{"perf", cmd_perf, "Display probe performance counters: (reset)"},
+#endif
 #ifdef PLATFORM_HAS_POWER_SWITCH
 	{"tpwr", cmd_target_power, "Supplies power to the target: (enable|disable)"},
 #endif
 #ifdef ENABLE_RTT
-	{"rtt", cmd_rtt, "enable|disable|status|channel 0..15|ident (str)|cblock|poll maxms minms maxerr"},
+	{"rtt", cmd_rtt, "enable|disable|status|stats|channel 0..15|ident (str)|cblock|ram [start end]|poll maxms minms maxerr|watch [addr [size]|clear|rate hz]"},
+#endif
+#ifdef PLATFORM_HAS_STANDALONE
+	{"standalone", cmd_standalone, "Program a stored image on target power up or the button: (capture [addr size]|erase|run)"},
 #endif
 #ifdef PLATFORM_HAS_TRACESWO
-#if defined TRACESWO_PROTOCOL && TRACESWO_PROTOCOL == 2
+#if PC_HOSTED == 1
+	{"traceswo", cmd_traceswo, "Start trace capture through the probe: (manchester) (baudrate) (decode channel ...)"},
+#elif defined TRACESWO_PROTOCOL && TRACESWO_PROTOCOL == 2
 	{"traceswo", cmd_traceswo, "Start trace capture, NRZ mode: (baudrate) (decode channel ...)"},
 #else
 	{"traceswo", cmd_traceswo, "Start trace capture, Manchester mode: (decode channel ...)"},
 #endif
+	{"swo_stats", cmd_swo_stats, "Show decoded trace packet counts and the PC sample histogram: (clear)"},
+	{"isrstats", cmd_isrstats, "Show exception counts and durations from the exception trace: (enable|clear)"},
 #endif
 	{"heapinfo", cmd_heapinfo, "Set semihosting heapinfo"},
+#if PC_HOSTED == 1
+	{"poll_pace", cmd_poll_pace, "Halt polling while running: (burst ms) (max pause ms) (Default 50 8)"},
+	{"snapshot", cmd_snapshot, "Keep target RAM and registers in host memory: (save|restore) <slot> (dirty) | drop <slot> | list"},
+#endif
 #if defined(PLATFORM_HAS_DEBUG) && (PC_HOSTED == 0)
 	{"debug_bmp", cmd_debug_bmp, "Output BMP \"debug\" strings to the second vcom: (enable|disable)"},
 #endif
@@ -114,6 +173,9 @@ bool connect_assert_nrst;
 bool debug_bmp;
 #endif
 unsigned cortexm_wait_timeout = 2000; /* Timeout to wait for Cortex to react on halt command. */
+#if PC_HOSTED == 1
+unsigned cortexm_prefetch_size = 128; /* Read ahead around SP and PC at each halt, see cortexm_halt_poll() */
+#endif
 
 int command_process(target *t, char *cmd)
 {
@@ -150,18 +212,46 @@ int command_process(target *t, char *cmd)
 
 #define BOARD_IDENT "Black Magic Probe" PLATFORM_IDENT FIRMWARE_VERSION
 
+/* The buffer budget the platform's memory profile gave this build, see memory_profile.h */
+static void version_memory_profile(char *buf, size_t size)
+{
+	unsigned int trace = 0;
+#if PC_HOSTED == 0 && defined(PLATFORM_HAS_TRACESWO)
+#if defined(TRACESWO_PROTOCOL) && TRACESWO_PROTOCOL == 2
+	trace = NUM_TRACE_PACKETS * 64U; /* USB transfer sized packets */
+#else
+	trace = TRACE_CAPTURE_PAIRS * 4U; /* two 16 bit captures each */
+#endif
+#endif
+	unsigned int aux_uart = 0;
+#if PC_HOSTED == 0
+	aux_uart = AUX_UART_RX_BUFFER_SIZE + AUX_UART_TX_BUFFER_SIZE;
+#endif
+	const unsigned int total = GDB_PACKET_BUFFER_SIZE + FLASH_WRITEBUF_MAX_SIZE + RTT_UP_BUF_SIZE +
+		RTT_DOWN_BUF_SIZE + trace + SCRATCH_BUF_SIZE + aux_uart;
+	snprintf(buf, size,
+		"Memory profile %s: packet %u, flash write %u, RTT %u/%u, trace %u, scratch %u, aux UART %u, "
+		"%u bytes in all\n",
+		PLATFORM_MEMORY_NAME, GDB_PACKET_BUFFER_SIZE, FLASH_WRITEBUF_MAX_SIZE, (unsigned int)RTT_UP_BUF_SIZE,
+		(unsigned int)RTT_DOWN_BUF_SIZE, trace, SCRATCH_BUF_SIZE, aux_uart, total);
+}
+
 bool cmd_version(target *t, int argc, const char **argv)
 {
 	(void)t;
 	(void)argc;
 	(void)argv;
+	char profile[128];
+	version_memory_profile(profile, sizeof(profile));
 #if PC_HOSTED == 1
 	char ident[256];
 	gdb_ident(ident, sizeof(ident));
 	DEBUG_WARN("%s\n", ident);
+	DEBUG_WARN("%s", profile);
 #else
 	gdb_out(BOARD_IDENT);
 	gdb_outf(", Hardware Version %d\n", platform_hwversion());
+	gdb_out(profile);
 	gdb_out("Copyright (C) 2022 Black Magic Debug Project\n");
 	gdb_out("License GPLv3+: GNU GPL version 3 or later "
 		"<http://gnu.org/licenses/gpl.html>\n\n");
@@ -334,23 +424,124 @@ bool cmd_auto_scan(target *t, int argc, const char **argv)
 	return true;
 }
 
-bool cmd_frequency(target *t, int argc, const char **argv)
+static uint32_t parse_frequency(const char *const value)
 {
-	(void)t;
-	if (argc == 2) {
-		char *multiplier = NULL;
-		uint32_t frequency = strtoul(argv[1], &multiplier, 10);
-		if (!multiplier) {
-			gdb_outf("Frequency must be an integral value possibly followed by 'k' or 'M'");
-			return false;
+	char *multiplier = NULL;
+	uint32_t frequency = strtoul(value, &multiplier, 10);
+	switch (*multiplier) {
+	case 'k':
+		frequency *= 1000U;
+		break;
+	case 'M':
+		frequency *= 1000U * 1000U;
+		break;
+	}
+	return frequency;
+}
+
+/* Write and read back patterns through a RAM word of the target, as a test of the link */
+#define FREQUENCY_AUTO_PATTERNS 64U
+/* Passes each frequency must make in a row */
+#define FREQUENCY_AUTO_ROUNDS 3U
+#define FREQUENCY_AUTO_MIN    100000U
+#define FREQUENCY_AUTO_MAX    24000000U
+
+static bool frequency_pattern_once(target *t, target_addr_t addr, uint32_t pattern)
+{
+	volatile bool ok = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		uint32_t value = ~pattern;
+		ok = !target_mem_write(t, addr, &pattern, sizeof(pattern)) &&
+			!target_mem_read(t, &value, addr, sizeof(value)) && value == pattern;
+	}
+	if (e.type)
+		return false;
+	return ok;
+}
+
+static bool frequency_pattern_test(target *t, target_addr_t addr, uint32_t frequency)
+{
+	platform_max_frequency_set(frequency);
+	for (uint32_t round = 0; round < FREQUENCY_AUTO_ROUNDS; ++round) {
+		for (uint32_t i = 0; i < FREQUENCY_AUTO_PATTERNS; ++i) {
+			/* Walking ones and their inverse, so every bit line toggles both ways */
+			const uint32_t bit = 1U << (i & 31U);
+			if (!frequency_pattern_once(t, addr, i & 32U ? ~bit : bit)) {
+				/* Leave the link in a state the next, slower, attempt can use */
+				target_check_error(t);
+				return false;
+			}
 		}
-		switch (*multiplier) {
-		case 'k':
-			frequency *= 1000U;
-			break;
-		case 'M':
-			frequency *= 1000U * 1000U;
-			break;
+	}
+	return true;
+}
+
+/*
+ * Binary search the highest SWJ clock, up to max, at which writing and reading
+ * back RAM still passes, then back off by a quarter for margin and use that.
+ * Returns the frequency set, 0 if even the slowest one failed.
+ */
+uint32_t command_frequency_auto(target *t, uint32_t max)
+{
+	if (!t || !t->ram) {
+		gdb_out("Attach to a target with RAM first\n");
+		return 0;
+	}
+	const uint32_t initial = platform_max_frequency_get();
+	if (initial == FREQ_FIXED) {
+		gdb_out("SWJ freq fixed\n");
+		return 0;
+	}
+	/* Bypass the halted memory cache, every read back must cross the link */
+	const bool cache_enabled = t->mem_cache_enabled;
+	t->mem_cache_enabled = false;
+	target_mem_cache_drop(t);
+	const target_addr_t addr = t->ram->start;
+	uint32_t saved = 0;
+	target_mem_read(t, &saved, addr, sizeof(saved));
+
+	uint32_t low = initial;
+	uint32_t high = max ? max : FREQUENCY_AUTO_MAX;
+	if (low > high || !frequency_pattern_test(t, addr, low)) {
+		low = FREQUENCY_AUTO_MIN;
+		if (!frequency_pattern_test(t, addr, low))
+			low = 0;
+	}
+	if (low) {
+		/* Search to within a sixteenth, finer than the clock dividers of most probes */
+		while (high - low > low / 16U) {
+			const uint32_t mid = low + (high - low) / 2U;
+			if (frequency_pattern_test(t, addr, mid))
+				low = mid;
+			else
+				high = mid;
+		}
+		low -= low / 4U;
+		if (low < FREQUENCY_AUTO_MIN || !frequency_pattern_test(t, addr, low))
+			low = MAX(low / 2U, FREQUENCY_AUTO_MIN);
+		platform_max_frequency_set(low);
+	} else
+		platform_max_frequency_set(initial);
+
+	target_mem_write(t, addr, &saved, sizeof(saved));
+	t->mem_cache_enabled = cache_enabled;
+	if (!low)
+		gdb_out("No working SWJ frequency found\n");
+	return low ? platform_max_frequency_get() : 0;
+}
+
+static bool cmd_frequency(target *t, int argc, const char **argv)
+{
+	if (argc >= 2 && !strcmp(argv[1], "auto")) {
+		const uint32_t max = argc > 2 ? parse_frequency(argv[2]) : 0;
+		if (!command_frequency_auto(t, max))
+			return false;
+	} else if (argc == 2) {
+		const uint32_t frequency = parse_frequency(argv[1]);
+		if (!frequency) {
+			gdb_outf("Frequency must be an integral value possibly followed by 'k' or 'M'\n");
+			return false;
 		}
 		platform_max_frequency_set(frequency);
 	}
@@ -435,6 +626,86 @@ static bool cmd_connect_reset(target *t, int argc, const char **argv)
 	return true;
 }
 
+static bool cmd_scan_cache(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 2) {
+		if (!strcmp(argv[1], "flush")) {
+			adiv5_scan_cache_flush();
+			gdb_out("Scan cache flushed\n");
+			return true;
+		}
+		if (!parse_enable_or_disable(argv[1], &adiv5_scan_cache_enabled))
+			return false;
+		if (!adiv5_scan_cache_enabled)
+			adiv5_scan_cache_flush();
+	} else if (argc > 2) {
+		gdb_out("usage: monitor scan_cache [enable|disable|flush]\n");
+		return false;
+	}
+	gdb_outf("Scan cache: %s\n", adiv5_scan_cache_enabled ? "enabled" : "disabled");
+	return true;
+}
+
+static bool cmd_rtos(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 2) {
+		if (!parse_enable_or_disable(argv[1], &gdb_rtos_enabled))
+			return false;
+		/* Symbols GDB offered while disabled are looked up when it next loads the program */
+		gdb_rtos_invalidate();
+	} else if (argc > 2) {
+		gdb_out("usage: monitor rtos [enable|disable]\n");
+		return false;
+	}
+	gdb_rtos_status();
+	return true;
+}
+
+#ifdef PLATFORM_HAS_STANDALONE
+static bool cmd_standalone(target *t, int argc, const char **argv)
+{
+	if (argc == 1) {
+		standalone_status();
+		return true;
+	}
+	if (!strcmp(argv[1], "capture")) {
+		if (!t) {
+			gdb_out("Attach to the target holding the image first\n");
+			return false;
+		}
+		/* Without a range the whole of the lowest Flash region is taken */
+		uint32_t addr = UINT32_MAX;
+		uint32_t size = 0;
+		for (target_flash_s *f = t->flash; f; f = f->next) {
+			if (f->start < addr) {
+				addr = f->start;
+				size = f->length;
+			}
+		}
+		if (argc == 4) {
+			addr = strtoul(argv[2], NULL, 0);
+			size = strtoul(argv[3], NULL, 0);
+		}
+		return size && standalone_capture(t, addr, size);
+	}
+	if (!strcmp(argv[1], "erase"))
+		return standalone_erase();
+	if (!strcmp(argv[1], "run")) {
+		if (t) {
+			gdb_out("Detach from the target first\n");
+			return false;
+		}
+		const bool passed = standalone_program();
+		standalone_status();
+		return passed;
+	}
+	gdb_out("usage: monitor standalone [capture [addr size]|erase|run]\n");
+	return false;
+}
+#endif
+
 static bool cmd_halt_timeout(target *t, int argc, const char **argv)
 {
 	(void)t;
@@ -444,6 +715,85 @@ static bool cmd_halt_timeout(target *t, int argc, const char **argv)
 	return true;
 }
 
+#if PC_HOSTED == 1
+static bool cmd_halt_prefetch(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1)
+		cortexm_prefetch_size = strtoul(argv[1], NULL, 0);
+	gdb_outf("Cortex-M halt prefetch around SP and PC: %u bytes\n", cortexm_prefetch_size);
+	return true;
+}
+#endif
+
+#if PC_HOSTED == 1
+static bool cmd_poll_pace(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1)
+		pace_poll_burst_ms = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		pace_poll_max_ms = strtoul(argv[2], NULL, 0);
+	gdb_outf("Halt polling: no pause for %" PRIu32 " ms after resume, then pauses up to %" PRIu32 " ms\n",
+		pace_poll_burst_ms, pace_poll_max_ms);
+	return true;
+}
+
+static void snapshot_print(const uint32_t slot, const snapshot_stats_s *const stats)
+{
+	gdb_outf("Snapshot %" PRIu32 ": %" PRIu32 " bytes of RAM, %" PRIu32 " stored", slot, stats->ram_bytes,
+		stats->stored_bytes);
+}
+
+static bool cmd_snapshot(target *t, int argc, const char **argv)
+{
+	snapshot_stats_s stats;
+	if (argc == 2 && !strcmp(argv[1], "list")) {
+		for (uint32_t slot = 0; slot < SNAPSHOT_SLOTS; ++slot) {
+			if (snapshot_info(slot, &stats)) {
+				snapshot_print(slot, &stats);
+				gdb_out("\n");
+			}
+		}
+		return true;
+	}
+	if (argc < 3) {
+		gdb_out("usage: monitor snapshot (save|restore) <slot> (dirty) | drop <slot> | list\n");
+		return false;
+	}
+	const uint32_t slot = strtoul(argv[2], NULL, 0);
+	if (slot >= SNAPSHOT_SLOTS) {
+		gdb_outf("Slot must be below %u\n", SNAPSHOT_SLOTS);
+		return false;
+	}
+	if (!strcmp(argv[1], "drop")) {
+		snapshot_drop(slot);
+		return true;
+	}
+	if (!t) {
+		gdb_out("Not attached to a target\n");
+		return false;
+	}
+	const bool dirty = argc > 3 && !strcmp(argv[3], "dirty");
+	bool ok;
+	if (!strcmp(argv[1], "save"))
+		ok = snapshot_save(t, slot, dirty, &stats);
+	else if (!strcmp(argv[1], "restore"))
+		ok = snapshot_restore(t, slot, dirty, &stats);
+	else {
+		gdb_out("usage: monitor snapshot (save|restore) <slot> (dirty) | drop <slot> | list\n");
+		return false;
+	}
+	if (!ok) {
+		gdb_outf("Snapshot %s failed\n", argv[1]);
+		return false;
+	}
+	snapshot_print(slot, &stats);
+	gdb_outf(", %" PRIu32 " transferred in %" PRIu32 " ms\n", stats.transferred_bytes, stats.ms);
+	return true;
+}
+#endif
+
 static bool cmd_reset(target *t, int argc, const char **argv)
 {
 	(void)t;
@@ -465,6 +815,180 @@ static bool cmd_tdi_low_reset(target *t, int argc, const char **argv)
 	return true;
 }
 
+static bool cmd_flash_stats(target *t, int argc, const char **argv)
+{
+	(void)argc;
+	(void)argv;
+	if (t == NULL) {
+		gdb_out("not attached\n");
+		return true;
+	}
+
+	for (const target_flash_s *f = t->flash; f; f = f->next) {
+		const flash_stats_s *const stats = &f->stats;
+		if (!stats->bytes_received && !stats->sectors_erased && !stats->sectors_blank)
+			continue;
+		gdb_outf("Flash 0x%08" PRIx32 ": %" PRIu32 " bytes received, %" PRIu32 " programmed, %" PRIu32
+				 " sectors erased, %" PRIu32 " found blank\n",
+			f->start, stats->bytes_received, stats->bytes_programmed, stats->sectors_erased, stats->sectors_blank);
+		gdb_outf("  erase %" PRIu32 " ms, write %" PRIu32 " ms, prepare/done %" PRIu32 " ms, waiting on host %" PRIu32
+				 " ms\n",
+			stats->erase_ms, stats->write_ms, stats->prepare_done_ms, stats->host_wait_ms);
+		if (stats->status_polls)
+			gdb_outf("  %" PRIu32 " status reads, longest operation %" PRIu32 " ms\n", stats->status_polls,
+				stats->busy_max_ms);
+		if (stats->sectors_cached)
+			gdb_outf("  %" PRIu32 " sectors known unchanged from the host cache\n", stats->sectors_cached);
+		if (stats->erase_wait_ms)
+			gdb_outf("  writes waited %" PRIu32 " ms for the background erase\n", stats->erase_wait_ms);
+	}
+	return true;
+}
+
+#if PC_HOSTED == 0
+/* Each measurement repeats for this long, the block is taken from the start of the first RAM region */
+#define BENCH_MS         250U
+#define BENCH_BLOCK_SIZE 1024U
+/* Clock cycles of an SW-DP read: request, turnaround, ACK, data, parity and turnaround */
+#define BENCH_SWD_READ_CYCLES 46U
+
+typedef enum bench_op {
+	BENCH_DP_READ,
+	BENCH_MEM_READ,
+	BENCH_MEM_WRITE,
+	BENCH_HALT_RESUME,
+} bench_op_e;
+
+typedef struct bench_ctx {
+	target *t;
+	ADIv5_DP_t *dp;
+	uint8_t *buf;
+	size_t len;
+} bench_ctx_s;
+
+static bool bench_halt_resume(target *const t)
+{
+	target_halt_resume(t, false);
+	target_halt_request(t);
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, cortexm_wait_timeout);
+	enum target_halt_reason reason;
+	while ((reason = target_halt_poll(t, NULL)) == TARGET_HALT_RUNNING) {
+		if (platform_timeout_is_expired(&timeout))
+			return false;
+	}
+	return reason != TARGET_HALT_ERROR;
+}
+
+/* Repeat op for BENCH_MS, returns how often it ran then, 0 if it failed */
+static uint32_t bench_run(const bench_ctx_s *const ctx, const bench_op_e op)
+{
+	volatile uint32_t iterations = 0;
+	volatile bool ok = true;
+	volatile struct exception e;
+	const uint32_t start = platform_time_ms();
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		while (ok && platform_time_ms() - start < BENCH_MS) {
+			switch (op) {
+			case BENCH_DP_READ:
+				ctx->dp->dp_read(ctx->dp, ADIV5_DP_CTRLSTAT);
+				break;
+			case BENCH_MEM_READ:
+				/* The block is read back into the buffer it was saved in, writes put the same data back */
+				ok = !target_mem_read(ctx->t, ctx->buf, ctx->t->ram->start, ctx->len);
+				break;
+			case BENCH_MEM_WRITE:
+				ok = !target_mem_write(ctx->t, ctx->t->ram->start, ctx->buf, ctx->len);
+				break;
+			case BENCH_HALT_RESUME:
+				ok = bench_halt_resume(ctx->t);
+				break;
+			}
+			++iterations;
+		}
+	}
+	if (e.type || !ok || (ctx->dp && ctx->dp->fault)) {
+		if (ctx->dp)
+			ctx->dp->fault = 0;
+		return 0;
+	}
+	return iterations;
+}
+
+static bool cmd_bench(target *t, int argc, const char **argv)
+{
+	(void)argc;
+	(void)argv;
+	if (t == NULL) {
+		gdb_out("not attached\n");
+		return true;
+	}
+
+	bench_ctx_s ctx = {.t = t};
+	/* DP transactions are only timed on ADIv5 Cortex-M */
+	if (t->core && t->core[0] == 'M')
+		ctx.dp = cortexm_ap(t)->dp;
+	const bool swd = ctx.dp && ctx.dp->dp_read == firmware_swdp_read;
+	gdb_outf("Link: %s, frequency set to %" PRIu32 " Hz\n", ctx.dp ? (swd ? "SWD" : "JTAG") : "unknown",
+		platform_max_frequency_get());
+
+	uint32_t count;
+	if (ctx.dp) {
+		count = bench_run(&ctx, BENCH_DP_READ);
+		const uint32_t per_s = count * (1000U / BENCH_MS);
+		if (!count)
+			gdb_out("DP reads: failed\n");
+		else if (swd)
+			gdb_outf("DP reads: %" PRIu32 "/s, about %" PRIu32 " Hz of SWCLK achieved\n", per_s,
+				per_s * BENCH_SWD_READ_CYCLES);
+		else
+			gdb_outf("DP reads: %" PRIu32 "/s\n", per_s);
+	}
+
+	if (t->ram) {
+		ctx.len = MIN(t->ram->length, BENCH_BLOCK_SIZE);
+		ctx.buf = malloc(ctx.len);
+		/* The cache would answer the reads without them crossing the link */
+		const bool cache_enabled = t->mem_cache_enabled;
+		t->mem_cache_enabled = false;
+		target_mem_cache_drop(t);
+		if (!ctx.buf || target_mem_read(t, ctx.buf, t->ram->start, ctx.len))
+			gdb_out("Memory: failed to save the block\n");
+		else {
+			const uint32_t reads = bench_run(&ctx, BENCH_MEM_READ);
+			const uint32_t writes = bench_run(&ctx, BENCH_MEM_WRITE);
+			gdb_outf("Memory at 0x%08" PRIx32 ", %u byte blocks: read %" PRIu32 " B/s, write %" PRIu32 " B/s\n",
+				t->ram->start, (unsigned)ctx.len, (uint32_t)(reads * ctx.len * (1000U / BENCH_MS)),
+				(uint32_t)(writes * ctx.len * (1000U / BENCH_MS)));
+			/* Put it back in case a failed write left it half done */
+			target_mem_write(t, t->ram->start, ctx.buf, ctx.len);
+		}
+		free(ctx.buf);
+		t->mem_cache_enabled = cache_enabled;
+	}
+
+	count = bench_run(&ctx, BENCH_HALT_RESUME);
+	if (count)
+		gdb_outf("Halt/resume: %" PRIu32 " us per round trip\n", BENCH_MS * 1000U / count);
+	else
+		gdb_out("Halt/resume: failed\n");
+	return true;
+}
+#endif
+
+#ifdef ENABLE_PERF
+static bool cmd_perf(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1 && !strncmp(argv[1], "reset", strlen(argv[1]))) {
+		perf_reset();
+		return true;
+	}
+	perf_print();
+	return true;
+}
+#endif
+
 #ifdef PLATFORM_HAS_POWER_SWITCH
 static bool cmd_target_power(target *t, int argc, const char **argv)
 {
@@ -495,6 +1019,45 @@ static const char *on_or_off(const bool value)
 	return value ? "on" : "off";
 }
 
+/* mon rtt watch lists the variables sampled while the target runs
+   mon rtt watch addr [size] adds a variable of 4 or size bytes
+   mon rtt watch clear drops all variables
+   mon rtt watch rate hz sets the sample rate */
+static bool cmd_rtt_watch(int argc, const char **argv)
+{
+	if (argc == 1) {
+		gdb_outf("live watch: %" PRIu32 " variables, %" PRIu32 " reads every %" PRIu32 " ms\n", live_watch_count,
+			live_watch_blocks, live_watch_period_ms);
+		gdb_outf("samples: %" PRIu32 " dropped: %" PRIu32 " errs: %" PRIu32 "\n", live_watch_samples,
+			live_watch_dropped, live_watch_errs);
+		for (size_t i = 0; i < live_watch_count; ++i)
+			gdb_outf("0x%08" PRIx32 " %" PRIu32 "\n", live_watch[i].addr, live_watch[i].size);
+		return true;
+	}
+	const size_t command_len = strlen(argv[1]);
+	if (argc == 2 && !strncmp(argv[1], "clear", command_len))
+		live_watch_clear();
+	else if (argc == 3 && !strncmp(argv[1], "rate", command_len)) {
+		const uint32_t rate = strtoul(argv[2], NULL, 0);
+		if (rate == 0 || rate > 1000U) {
+			gdb_out("rate must be 1..1000 samples a second\n");
+			return false;
+		}
+		live_watch_period_ms = 1000U / rate;
+	} else if (argc <= 3 && argv[1][0] >= '0' && argv[1][0] <= '9') {
+		const uint32_t addr = strtoul(argv[1], NULL, 0);
+		const uint32_t size = argc == 3 ? strtoul(argv[2], NULL, 0) : 4U;
+		if (!live_watch_add(addr, size)) {
+			gdb_outf("can not watch more than %u variables, of 1, 2, 4 or 8 bytes\n", MAX_LIVE_WATCH);
+			return false;
+		}
+	} else {
+		gdb_out("what?\n");
+		return false;
+	}
+	return true;
+}
+
 static bool cmd_rtt(target *t, int argc, const char **argv)
 {
 	(void)t;
@@ -502,6 +1065,7 @@ static bool cmd_rtt(target *t, int argc, const char **argv)
 	if (argc == 1 || (argc == 2 && !strncmp(argv[1], "enabled", command_len))) {
 		rtt_enabled = true;
 		rtt_found = false;
+		memset(rtt_stats, 0, sizeof(rtt_stats));
 	} else if ((argc == 2) && !strncmp(argv[1], "disabled", command_len)) {
 		rtt_enabled = false;
 		rtt_found = false;
@@ -518,6 +1082,18 @@ static bool cmd_rtt(target *t, int argc, const char **argv)
 		}
 		gdb_outf(
 			"\nmax poll ms: %u min poll ms: %u max errs: %u\n", rtt_max_poll_ms, rtt_min_poll_ms, rtt_max_poll_errs);
+		if (rtt_ram_end > rtt_ram_start)
+			gdb_outf("search ram: 0x%08" PRIx32 "-0x%08" PRIx32 "\n", rtt_ram_start, rtt_ram_end);
+	} else if (argc == 2 && !strncmp(argv[1], "stats", command_len)) {
+		gdb_outf("poll ms: %" PRIu32 " errs: %" PRIu32 "\n", rtt_poll_ms, rtt_poll_errs);
+		gdb_out("ch i/o      bytes      polls      empty    dropped\n");
+		for (size_t i = 0; i < MAX_RTT_CHAN; ++i) {
+			if (!rtt_stats[i].polls)
+				continue;
+			gdb_outf("%2" PRIu32 " %s %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n", (uint32_t)i,
+				rtt_channel[i].is_output ? "out" : "in ", rtt_stats[i].bytes, rtt_stats[i].polls,
+				rtt_stats[i].empty_polls, rtt_stats[i].dropped);
+		}
 	} else if (argc >= 2 && !strncmp(argv[1], "channel", command_len)) {
 		/* mon rtt channel switches to auto rtt channel selection
 		   mon rtt channel number... selects channels given */
@@ -555,12 +1131,23 @@ static bool cmd_rtt(target *t, int argc, const char **argv)
 			if (rtt_ident[i] == '_')
 				rtt_ident[i] = ' ';
 		}
+	} else if (argc == 2 && !strncmp(argv[1], "ram", command_len)) {
+		/* search all target ram for the control block */
+		rtt_ram_start = 0;
+		rtt_ram_end = 0;
+	} else if (argc == 4 && !strncmp(argv[1], "ram", command_len)) {
+		/* restrict the control block search, e.g. to the .bss section holding _SEGGER_RTT */
+		rtt_ram_start = strtoul(argv[2], NULL, 0);
+		rtt_ram_end = strtoul(argv[3], NULL, 0);
+		rtt_found = false;
 	} else if (argc == 5 && !strncmp(argv[1], "poll", command_len)) {
 		/* set polling params */
 		rtt_max_poll_ms = strtoul(argv[2], NULL, 0);
 		rtt_min_poll_ms = strtoul(argv[3], NULL, 0);
 		rtt_max_poll_errs = strtoul(argv[4], NULL, 0);
-	} else
+	} else if (argc >= 2 && !strncmp(argv[1], "watch", command_len))
+		return cmd_rtt_watch(argc - 1, argv + 1);
+	else
 		gdb_out("what?\n");
 	return true;
 }
@@ -570,18 +1157,28 @@ static bool cmd_rtt(target *t, int argc, const char **argv)
 static bool cmd_traceswo(target *t, int argc, const char **argv)
 {
 	(void)t;
-#if TRACESWO_PROTOCOL == 2
+#if TRACESWO_PROTOCOL == 2 || PC_HOSTED == 1
 	uint32_t baudrate = SWO_DEFAULT_BAUD;
+#endif
+#if PC_HOSTED == 1
+	traceswo_mode_e mode = SWO_MODE_UART;
 #endif
 	uint32_t swo_channelmask = 0; /* swo decoding off */
 	uint8_t decode_arg = 1;
-#if TRACESWO_PROTOCOL == 2
+#if PC_HOSTED == 1
+	/* argument: optional 'manchester' literal, the probe captures NRZ otherwise */
+	if (argc > decode_arg && !strncmp(argv[decode_arg], "manchester", strlen(argv[decode_arg]))) {
+		mode = SWO_MODE_MANCHESTER;
+		++decode_arg;
+	}
+#endif
+#if TRACESWO_PROTOCOL == 2 || PC_HOSTED == 1
 	/* argument: optional baud rate for async mode */
-	if (argc > 1 && argv[1][0] >= '0' && argv[1][0] <= '9') {
-		baudrate = strtoul(argv[1], NULL, 0);
+	if (argc > decode_arg && argv[decode_arg][0] >= '0' && argv[decode_arg][0] <= '9') {
+		baudrate = strtoul(argv[decode_arg], NULL, 0);
 		if (baudrate == 0)
 			baudrate = SWO_DEFAULT_BAUD;
-		decode_arg = 2;
+		++decode_arg;
 	}
 #endif
 	/* argument: 'decode' literal */
@@ -598,8 +1195,8 @@ static bool cmd_traceswo(target *t, int argc, const char **argv)
 		}
 	}
 
-#if TRACESWO_PROTOCOL == 2
-	gdb_outf("Baudrate: %lu ", baudrate);
+#if TRACESWO_PROTOCOL == 2 || PC_HOSTED == 1
+	gdb_outf("Baudrate: %" PRIu32 " ", baudrate);
 #endif
 	gdb_outf("Channel mask: ");
 	for (size_t i = 0; i < 32; ++i) {
@@ -608,6 +1205,13 @@ static bool cmd_traceswo(target *t, int argc, const char **argv)
 	}
 	gdb_outf("\n");
 
+#if PC_HOSTED == 1
+	if (!traceswo_init(mode, baudrate, swo_channelmask)) {
+		gdb_out("Trace capture failed, see the probe log\n");
+		return false;
+	}
+	gdb_outf("Trace enabled, %s mode\n", mode == SWO_MODE_MANCHESTER ? "Manchester" : "NRZ");
+#else
 #if TRACESWO_PROTOCOL == 2
 	traceswo_init(baudrate, swo_channelmask);
 #else
@@ -615,6 +1219,96 @@ static bool cmd_traceswo(target *t, int argc, const char **argv)
 #endif
 
 	gdb_outf("Trace enabled for BMP serial %s, USB EP 5\n", serial_no);
+#endif
+	return true;
+}
+
+static bool cmd_swo_stats(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1 && !strncmp(argv[1], "clear", strlen(argv[1]))) {
+		traceswo_stats_clear();
+		return true;
+	}
+	/* packets are only decoded while 'traceswo decode' is active */
+	const traceswo_stats_s *const stats = &traceswo_stats;
+	gdb_outf("sync: %" PRIu32 " overflow: %" PRIu32 " timestamp: %" PRIu32 " extension: %" PRIu32 "\n",
+		stats->syncs, stats->overflows, stats->timestamps, stats->extensions);
+	gdb_outf("stimulus: %" PRIu32 " event: %" PRIu32 " data trace: %" PRIu32 "\n", stats->stimulus,
+		stats->events, stats->data_trace);
+	gdb_outf("exception entry: %" PRIu32 " exit: %" PRIu32 " return: %" PRIu32 "\n", stats->exception_entries,
+		stats->exception_exits, stats->exception_returns);
+	gdb_outf("pc samples: %" PRIu32 " sleeping: %" PRIu32 " not binned: %" PRIu32 "\n", stats->pc_samples,
+		stats->sleep_samples, stats->pc_other);
+	gdb_outf("lost packets: %" PRIu32 "\n", stats->lost_packets);
+
+	traceswo_pc_count_s top[16];
+	const size_t count = traceswo_pc_histogram(top, ARRAY_LENGTH(top));
+	for (size_t i = 0; i < count; ++i)
+		gdb_outf("  0x%08" PRIx32 " %10" PRIu32 "\n", top[i].pc, top[i].count);
+	return true;
+}
+
+static const char *const cortexm_exception_names[16] = {
+	[1] = "Reset",
+	[2] = "NMI",
+	[3] = "HardFault",
+	[4] = "MemManage",
+	[5] = "BusFault",
+	[6] = "UsageFault",
+	[7] = "SecureFault",
+	[11] = "SVCall",
+	[12] = "DebugMon",
+	[14] = "PendSV",
+	[15] = "SysTick",
+};
+
+static bool cmd_isrstats(target *t, int argc, const char **argv)
+{
+	if (argc > 1 && !strncmp(argv[1], "clear", strlen(argv[1]))) {
+		traceswo_stats_clear();
+		return true;
+	}
+	if (argc > 1 && !strncmp(argv[1], "enable", strlen(argv[1]))) {
+		if (!t) {
+			gdb_out("Attach to the target first\n");
+			return false;
+		}
+		/* Exception trace with local timestamps, routed out through the ITM */
+		target_mem_write32(t, CORTEXM_DEMCR, target_mem_read32(t, CORTEXM_DEMCR) | CORTEXM_DEMCR_TRCENA);
+		target_mem_write32(t, CORTEXM_ITM_LAR, CORTEXM_ITM_LAR_UNLOCK);
+		target_mem_write32(t, CORTEXM_ITM_TCR,
+			target_mem_read32(t, CORTEXM_ITM_TCR) | CORTEXM_ITM_TCR_ITMENA | CORTEXM_ITM_TCR_TSENA |
+				CORTEXM_ITM_TCR_TXENA);
+		target_mem_write32(t, CORTEXM_DWT_CTRL, target_mem_read32(t, CORTEXM_DWT_CTRL) | CORTEXM_DWT_CTRL_EXCTRCENA);
+		return !target_check_error(t);
+	}
+	/* exceptions are only timed while 'traceswo decode' is active, in local timestamp ticks */
+	const traceswo_isr_stats_s *stats;
+	const size_t count = traceswo_isr_stats(&stats);
+	if (!count) {
+		gdb_out("No exception trace decoded\n");
+		return true;
+	}
+	gdb_out("exception        count        min        avg        max  preempted depth\n");
+	for (size_t i = 0; i < count; ++i) {
+		const traceswo_isr_stats_s *const isr = &stats[i];
+		char name[12];
+		if (isr->exception >= 16U)
+			snprintf(name, sizeof(name), "IRQ%u", isr->exception - 16U);
+		else
+			snprintf(name, sizeof(name), "%s",
+				cortexm_exception_names[isr->exception] ? cortexm_exception_names[isr->exception] : "reserved");
+		if (!isr->count) {
+			gdb_outf("%-12s %9" PRIu32 "\n", name, isr->count);
+			continue;
+		}
+		gdb_outf("%-12s %9" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %5u\n", name, isr->count,
+			isr->min_ticks, (uint32_t)(isr->total_ticks / isr->count), isr->max_ticks, isr->max_preempted,
+			isr->max_depth);
+	}
+	if (traceswo_stats.isr_unmatched)
+		gdb_outf("exits without their entry: %" PRIu32 "\n", traceswo_stats.isr_unmatched);
 	return true;
 }
 #endif
@@ -20,7 +20,9 @@
 
 #include "general.h"
 #include "target.h"
+#include "target_internal.h"
 #include "gdb_if.h"
+#include "crc32.h"
 
 #if !defined(STM32F0) && !defined(STM32F1) && !defined(STM32F2) && \
 	!defined(STM32F3) && !defined(STM32F4) && !defined(STM32F7) && \
@@ -98,17 +100,59 @@ static uint32_t crc32_calc(uint32_t crc, uint8_t data)
 	return (crc << 8) ^ crc32_table[((crc >> 24) ^ data) & 255];
 }
 
+#if PC_HOSTED == 1
+/*
+ * Slice-by-8: crc32_slice[n][i] is the CRC of byte i followed by n zero bytes, which lets
+ * eight bytes be folded in with independent lookups. The tables are built on first use.
+ */
+static uint32_t crc32_slice[8][256];
+static bool crc32_slice_ready;
+
+static void crc32_slice_init(void)
+{
+	for (size_t i = 0; i < 256U; ++i) {
+		crc32_slice[0][i] = crc32_table[i];
+		for (size_t n = 1; n < 8U; ++n)
+			crc32_slice[n][i] = crc32_calc(crc32_slice[n - 1U][i], 0);
+	}
+	crc32_slice_ready = true;
+}
+
+uint32_t crc32_buffer(uint32_t crc, const void *data, size_t len)
+{
+	if (!crc32_slice_ready)
+		crc32_slice_init();
+	const uint8_t *bytes = data;
+	for (; len >= 8U; len -= 8U, bytes += 8U) {
+		crc ^= ((uint32_t)bytes[0] << 24U) | ((uint32_t)bytes[1] << 16U) | ((uint32_t)bytes[2] << 8U) | bytes[3];
+		crc = crc32_slice[7][crc >> 24U] ^ crc32_slice[6][(crc >> 16U) & 0xffU] ^
+			crc32_slice[5][(crc >> 8U) & 0xffU] ^ crc32_slice[4][crc & 0xffU] ^ crc32_slice[3][bytes[4]] ^
+			crc32_slice[2][bytes[5]] ^ crc32_slice[1][bytes[6]] ^ crc32_slice[0][bytes[7]];
+	}
+	for (size_t i = 0; i < len; ++i)
+		crc = crc32_calc(crc, bytes[i]);
+	return crc;
+}
+#else
+uint32_t crc32_buffer(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < len; ++i)
+		crc = crc32_calc(crc, bytes[i]);
+	return crc;
+}
+#endif
+
 int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 {
+	if (t->crc32 && t->crc32(t, crc_res, base, len))
+		return 0;
+
 	uint32_t crc = -1;
-#if PC_HOSTED == 1
 	/* Reading a 2 MByte on a H743 takes about 80 s@128, 28s @ 1k,
-	 * 22 s @ 4k and 21 s @ 64k
+	 * 22 s @ 4k and 21 s @ 64k, so this is as large as the memory profile allows
 	 */
-	uint8_t bytes[0x1000];
-#else
-	uint8_t bytes[128];
-#endif
+	uint8_t bytes[SCRATCH_BUF_SIZE];
 #if defined(ENABLE_DEBUG)
 	uint32_t start_time = platform_time_ms();
 #endif
@@ -126,13 +170,12 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 			return -1;
 		}
 
-		for (unsigned i = 0; i < read_len; i++)
-			crc = crc32_calc(crc, bytes[i]);
+		crc = crc32_buffer(crc, bytes, read_len);
 
 		base += read_len;
 		len -= read_len;
 	}
-	DEBUG_WARN("%" PRIu32 " ms\n", platform_time_ms() - start_time);
+	DEBUG_INFO("%" PRIu32 " ms\n", platform_time_ms() - start_time);
 	*crc_res = crc;
 	return 0;
 }
@@ -140,7 +183,14 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 #include <libopencm3/stm32/crc.h>
 int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 {
-	uint8_t bytes[128];
+	if (t->crc32 && t->crc32(t, crc_res, base, len))
+		return 0;
+
+	/*
+	 * Reading in larger chunks amortises the setup of each target_mem_read(), which costs far
+	 * more than feeding the CRC unit. Kept off the stack as it is sizable for a probe.
+	 */
+	static uint32_t words[256];
 	uint32_t crc;
 
 	CRC_CR |= CRC_CR_RESET;
@@ -152,15 +202,15 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 			last_time = actual_time;
 			gdb_if_putchar(0, true);
 		}
-		size_t read_len = MIN(sizeof(bytes), len) & ~3;
-		if (target_mem_read(t, bytes, base, read_len)) {
+		size_t read_len = MIN(sizeof(words), len) & ~3;
+		if (target_mem_read(t, words, base, read_len)) {
 			DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n",
 					   base);
 			return -1;
 		}
 
-		for (unsigned i = 0; i < read_len; i += 4)
-			CRC_DR = __builtin_bswap32(*(uint32_t*)(bytes+i));
+		for (size_t i = 0; i < read_len / 4U; ++i)
+			CRC_DR = __builtin_bswap32(words[i]);
 
 		base += read_len;
 		len -= read_len;
@@ -168,23 +218,61 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 
 	crc = CRC_DR;
 
-	if (target_mem_read(t, bytes, base, len)) {
+	if (target_mem_read(t, words, base, len)) {
 		DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n",
 				   base);
 		return -1;
 	}
-	uint8_t *data = bytes;
-	while (len--) {
-		crc ^= *data++ << 24;
-		for (int i = 0; i < 8; i++) {
-			if (crc & 0x80000000)
-				crc = (crc << 1) ^ 0x4C11DB7;
-			else
-				crc <<= 1;
-		}
-	}
-	*crc_res = crc;
+	*crc_res = crc32_buffer(crc, words, len);
 	return 0;
 }
+
+/* Without the table, the probe's own CRC unit does the bulk of the work */
+uint32_t crc32_buffer(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < len; ++i) {
+		crc ^= (uint32_t)bytes[i] << 24U;
+		for (size_t bit = 0; bit < 8U; ++bit)
+			crc = (crc & 0x80000000U) ? (crc << 1U) ^ 0x04c11db7U : crc << 1U;
+	}
+	return crc;
+}
 #endif
 
+/* Reflected polynomial 0xedb88320 a nibble at a time, which keeps the table small */
+static const uint32_t crc32_ieee_table[16] = {
+	0x00000000U, 0x1db71064U, 0x3b6e20c8U, 0x26d930acU, 0x76dc4190U, 0x6b6b51f4U, 0x4db26158U, 0x5005713cU,
+	0xedb88320U, 0xf00f9344U, 0xd6d6a3e8U, 0xcb61b38cU, 0x9b64c2b0U, 0x86d3d2d4U, 0xa00ae278U, 0xbdbdf21cU,
+};
+
+uint32_t crc32_ieee_buffer(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < len; ++i) {
+		crc ^= bytes[i];
+		crc = (crc >> 4U) ^ crc32_ieee_table[crc & 0xfU];
+		crc = (crc >> 4U) ^ crc32_ieee_table[crc & 0xfU];
+	}
+	return crc;
+}
+
+bool target_crc32(target *t, target_addr_t base, size_t len, uint32_t *crc, crc32_kind_e *kind)
+{
+	/* A hardware unit is preferred, it needs neither a halted core nor RAM for a stub */
+	if (t->crc32_ieee && t->crc32_ieee(t, crc, base, len)) {
+		*kind = CRC32_IEEE;
+		return true;
+	}
+	if (t->crc32 && t->crc32(t, crc, base, len)) {
+		*kind = CRC32_GDB;
+		return true;
+	}
+	return false;
+}
+
+uint32_t crc32_kind_buffer(crc32_kind_e kind, uint32_t crc, const void *data, size_t len)
+{
+	return kind == CRC32_IEEE ? crc32_ieee_buffer(crc, data, len) : crc32_buffer(crc, data, len);
+}
+
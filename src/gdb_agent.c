@@ -0,0 +1,406 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Breakpoint conditions evaluated on the probe. GDB compiles a condition to
+ * an agent expression, bytecode for a small stack machine, and sends it with
+ * the Z packet. When the target stops at the breakpoint, the expression is
+ * run here against the registers and target memory, and a false condition
+ * lets the target run on without GDB ever hearing of the stop.
+ * See "Agent Expressions" in the GDB manual.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "hex_utils.h"
+#include "gdb_agent.h"
+
+#define GDB_AGENT_STACK_DEPTH 32U
+/* bytecode may loop, give up on it after this many operations */
+#define GDB_AGENT_MAX_STEPS 4096U
+
+enum gdb_agent_op {
+	AGENT_OP_ADD = 0x02,
+	AGENT_OP_SUB = 0x03,
+	AGENT_OP_MUL = 0x04,
+	AGENT_OP_DIV_SIGNED = 0x05,
+	AGENT_OP_DIV_UNSIGNED = 0x06,
+	AGENT_OP_REM_SIGNED = 0x07,
+	AGENT_OP_REM_UNSIGNED = 0x08,
+	AGENT_OP_LSH = 0x09,
+	AGENT_OP_RSH_SIGNED = 0x0a,
+	AGENT_OP_RSH_UNSIGNED = 0x0b,
+	AGENT_OP_LOG_NOT = 0x0e,
+	AGENT_OP_BIT_AND = 0x0f,
+	AGENT_OP_BIT_OR = 0x10,
+	AGENT_OP_BIT_XOR = 0x11,
+	AGENT_OP_BIT_NOT = 0x12,
+	AGENT_OP_EQUAL = 0x13,
+	AGENT_OP_LESS_SIGNED = 0x14,
+	AGENT_OP_LESS_UNSIGNED = 0x15,
+	AGENT_OP_EXT = 0x16,
+	AGENT_OP_REF8 = 0x17,
+	AGENT_OP_REF16 = 0x18,
+	AGENT_OP_REF32 = 0x19,
+	AGENT_OP_REF64 = 0x1a,
+	AGENT_OP_IF_GOTO = 0x20,
+	AGENT_OP_GOTO = 0x21,
+	AGENT_OP_CONST8 = 0x22,
+	AGENT_OP_CONST16 = 0x23,
+	AGENT_OP_CONST32 = 0x24,
+	AGENT_OP_CONST64 = 0x25,
+	AGENT_OP_REG = 0x26,
+	AGENT_OP_END = 0x27,
+	AGENT_OP_DUP = 0x28,
+	AGENT_OP_POP = 0x29,
+	AGENT_OP_ZERO_EXT = 0x2a,
+	AGENT_OP_SWAP = 0x2b,
+	AGENT_OP_PICK = 0x32,
+	AGENT_OP_ROT = 0x33,
+};
+
+static gdb_agent_breakpoint_s gdb_agent_bp[GDB_AGENT_MAX_BREAKPOINTS];
+static size_t gdb_agent_bp_count;
+
+const gdb_agent_breakpoint_s *gdb_agent_find(const enum target_breakwatch type, const target_addr_t addr)
+{
+	for (size_t i = 0; i < gdb_agent_bp_count; ++i) {
+		if (gdb_agent_bp[i].type == type && gdb_agent_bp[i].addr == addr)
+			return &gdb_agent_bp[i];
+	}
+	return NULL;
+}
+
+const gdb_agent_breakpoint_s *gdb_agent_lookup(const target_addr_t addr)
+{
+	for (size_t i = 0; i < gdb_agent_bp_count; ++i) {
+		if (gdb_agent_bp[i].addr == addr)
+			return &gdb_agent_bp[i];
+	}
+	return NULL;
+}
+
+bool gdb_agent_set(
+	const enum target_breakwatch type, const target_addr_t addr, const size_t len, const char *conditions)
+{
+	gdb_agent_breakpoint_s bp = {
+		.type = type,
+		.addr = addr,
+		.len = len,
+	};
+	/* ";Xlen,bytecode" for each condition, up to the end or the ";cmds:" list we do not support */
+	while (conditions[0] == ';' && conditions[1] == 'X') {
+		char *end;
+		const size_t code_len = strtoul(conditions + 2, &end, 16);
+		if (*end != ',' || !code_len || strspn(end + 1, "0123456789abcdefABCDEF") < code_len * 2U ||
+			bp.code_len + 2U + code_len > sizeof(bp.code))
+			return false;
+		bp.code[bp.code_len++] = code_len & 0xffU;
+		bp.code[bp.code_len++] = code_len >> 8U;
+		unhexify(bp.code + bp.code_len, end + 1, code_len);
+		bp.code_len += code_len;
+		conditions = end + 1 + code_len * 2U;
+	}
+	if (!bp.code_len)
+		return false;
+
+	gdb_agent_breakpoint_s *slot = (gdb_agent_breakpoint_s *)gdb_agent_find(type, addr);
+	if (!slot) {
+		if (gdb_agent_bp_count == GDB_AGENT_MAX_BREAKPOINTS)
+			return false;
+		slot = &gdb_agent_bp[gdb_agent_bp_count++];
+	}
+	memcpy(slot, &bp, sizeof(bp));
+	return true;
+}
+
+bool gdb_agent_clear(const enum target_breakwatch type, const target_addr_t addr)
+{
+	gdb_agent_breakpoint_s *const bp = (gdb_agent_breakpoint_s *)gdb_agent_find(type, addr);
+	if (!bp)
+		return false;
+	/* keep the table packed */
+	memcpy(bp, &gdb_agent_bp[--gdb_agent_bp_count], sizeof(*bp));
+	return true;
+}
+
+void gdb_agent_clear_all(void)
+{
+	gdb_agent_bp_count = 0;
+}
+
+static uint64_t gdb_agent_fetch(const uint8_t *const code, const size_t bytes)
+{
+	/* operands are big endian */
+	uint64_t value = 0;
+	for (size_t i = 0; i < bytes; ++i)
+		value = (value << 8U) | code[i];
+	return value;
+}
+
+static uint64_t gdb_agent_le(const uint8_t *const data, const size_t bytes)
+{
+	uint64_t value = 0;
+	for (size_t i = bytes; i > 0; --i)
+		value = (value << 8U) | data[i - 1U];
+	return value;
+}
+
+/* run one expression, false if it is malformed or touches memory or registers it can not read */
+static bool gdb_agent_eval(target *const t, const uint8_t *const code, const size_t len, uint64_t *const result)
+{
+	uint64_t stack[GDB_AGENT_STACK_DEPTH];
+	size_t sp = 0;
+	size_t pc = 0;
+
+/* operands needed on the stack, and bytes of operand following the opcode */
+#define NEED(n)                     \
+	do {                            \
+		if (sp < (n))               \
+			return false;           \
+	} while (0)
+#define OPERAND(n)                  \
+	do {                            \
+		if (pc + (n) > len)         \
+			return false;           \
+	} while (0)
+#define TOP  stack[sp - 1U]
+#define NEXT stack[sp - 2U]
+#define PUSH(v)                             \
+	do {                                    \
+		if (sp == GDB_AGENT_STACK_DEPTH)    \
+			return false;                   \
+		stack[sp++] = (v);                  \
+	} while (0)
+
+	for (size_t steps = 0; steps < GDB_AGENT_MAX_STEPS && pc < len; ++steps) {
+		const uint8_t op = code[pc++];
+		switch (op) {
+		case AGENT_OP_ADD:
+			NEED(2);
+			NEXT += TOP;
+			--sp;
+			break;
+		case AGENT_OP_SUB:
+			NEED(2);
+			NEXT -= TOP;
+			--sp;
+			break;
+		case AGENT_OP_MUL:
+			NEED(2);
+			NEXT *= TOP;
+			--sp;
+			break;
+		case AGENT_OP_DIV_SIGNED:
+		case AGENT_OP_REM_SIGNED: {
+			NEED(2);
+			const int64_t a = (int64_t)NEXT;
+			const int64_t b = (int64_t)TOP;
+			if (b == 0 || (a == INT64_MIN && b == -1))
+				return false;
+			NEXT = op == AGENT_OP_DIV_SIGNED ? (uint64_t)(a / b) : (uint64_t)(a % b);
+			--sp;
+			break;
+		}
+		case AGENT_OP_DIV_UNSIGNED:
+		case AGENT_OP_REM_UNSIGNED:
+			NEED(2);
+			if (TOP == 0)
+				return false;
+			NEXT = op == AGENT_OP_DIV_UNSIGNED ? NEXT / TOP : NEXT % TOP;
+			--sp;
+			break;
+		case AGENT_OP_LSH:
+			NEED(2);
+			NEXT = TOP < 64U ? NEXT << TOP : 0;
+			--sp;
+			break;
+		case AGENT_OP_RSH_SIGNED:
+			NEED(2);
+			NEXT = (uint64_t)((int64_t)NEXT >> (TOP < 64U ? TOP : 63U));
+			--sp;
+			break;
+		case AGENT_OP_RSH_UNSIGNED:
+			NEED(2);
+			NEXT = TOP < 64U ? NEXT >> TOP : 0;
+			--sp;
+			break;
+		case AGENT_OP_LOG_NOT:
+			NEED(1);
+			TOP = !TOP;
+			break;
+		case AGENT_OP_BIT_AND:
+			NEED(2);
+			NEXT &= TOP;
+			--sp;
+			break;
+		case AGENT_OP_BIT_OR:
+			NEED(2);
+			NEXT |= TOP;
+			--sp;
+			break;
+		case AGENT_OP_BIT_XOR:
+			NEED(2);
+			NEXT ^= TOP;
+			--sp;
+			break;
+		case AGENT_OP_BIT_NOT:
+			NEED(1);
+			TOP = ~TOP;
+			break;
+		case AGENT_OP_EQUAL:
+			NEED(2);
+			NEXT = NEXT == TOP;
+			--sp;
+			break;
+		case AGENT_OP_LESS_SIGNED:
+			NEED(2);
+			NEXT = (int64_t)NEXT < (int64_t)TOP;
+			--sp;
+			break;
+		case AGENT_OP_LESS_UNSIGNED:
+			NEED(2);
+			NEXT = NEXT < TOP;
+			--sp;
+			break;
+		case AGENT_OP_EXT:
+		case AGENT_OP_ZERO_EXT: {
+			NEED(1);
+			OPERAND(1U);
+			const uint8_t bits = code[pc++];
+			if (bits == 0 || bits >= 64U)
+				break;
+			const uint64_t mask = (UINT64_C(1) << bits) - 1U;
+			if (op == AGENT_OP_EXT && (TOP >> (bits - 1U)) & 1U)
+				TOP |= ~mask;
+			else
+				TOP &= mask;
+			break;
+		}
+		case AGENT_OP_REF8:
+		case AGENT_OP_REF16:
+		case AGENT_OP_REF32:
+		case AGENT_OP_REF64: {
+			NEED(1);
+			const size_t bytes = 1U << (op - AGENT_OP_REF8);
+			uint8_t data[8];
+			if (target_mem_read(t, data, (target_addr_t)TOP, bytes))
+				return false;
+			TOP = gdb_agent_le(data, bytes);
+			break;
+		}
+		case AGENT_OP_IF_GOTO:
+			NEED(1);
+			OPERAND(2U);
+			if (stack[--sp])
+				pc = gdb_agent_fetch(code + pc, 2U);
+			else
+				pc += 2U;
+			break;
+		case AGENT_OP_GOTO:
+			OPERAND(2U);
+			pc = gdb_agent_fetch(code + pc, 2U);
+			break;
+		case AGENT_OP_CONST8:
+		case AGENT_OP_CONST16:
+		case AGENT_OP_CONST32:
+		case AGENT_OP_CONST64: {
+			const size_t bytes = 1U << (op - AGENT_OP_CONST8);
+			OPERAND(bytes);
+			PUSH(gdb_agent_fetch(code + pc, bytes));
+			pc += bytes;
+			break;
+		}
+		case AGENT_OP_REG: {
+			OPERAND(2U);
+			uint8_t data[8];
+			const ssize_t bytes = target_reg_read(t, gdb_agent_fetch(code + pc, 2U), data, sizeof(data));
+			if (bytes <= 0)
+				return false;
+			PUSH(gdb_agent_le(data, bytes));
+			pc += 2U;
+			break;
+		}
+		case AGENT_OP_END:
+			NEED(1);
+			*result = TOP;
+			return true;
+		case AGENT_OP_DUP: {
+			NEED(1);
+			const uint64_t value = TOP;
+			PUSH(value);
+			break;
+		}
+		case AGENT_OP_POP:
+			NEED(1);
+			--sp;
+			break;
+		case AGENT_OP_SWAP: {
+			NEED(2);
+			const uint64_t value = TOP;
+			TOP = NEXT;
+			NEXT = value;
+			break;
+		}
+		case AGENT_OP_PICK: {
+			OPERAND(1U);
+			const size_t depth = code[pc++];
+			NEED(depth + 1U);
+			const uint64_t value = stack[sp - 1U - depth];
+			PUSH(value);
+			break;
+		}
+		case AGENT_OP_ROT: {
+			/* a b c => c a b */
+			NEED(3);
+			const uint64_t value = NEXT;
+			NEXT = stack[sp - 3U];
+			stack[sp - 3U] = TOP;
+			TOP = value;
+			break;
+		}
+		default:
+			/* floating point, tracing, trace state variables and printf have no place in a condition */
+			return false;
+		}
+	}
+#undef NEED
+#undef OPERAND
+#undef TOP
+#undef NEXT
+#undef PUSH
+	return false;
+}
+
+bool gdb_agent_expression_true(target *const t, const uint8_t *const code, const size_t len)
+{
+	uint64_t result;
+	/* like gdbserver, a condition that can not be evaluated stops the target */
+	return !gdb_agent_eval(t, code, len, &result) || result;
+}
+
+bool gdb_agent_condition_true(target *const t, const gdb_agent_breakpoint_s *const bp)
+{
+	for (size_t offset = 0; offset < bp->code_len;) {
+		const size_t len = bp->code[offset] | (bp->code[offset + 1U] << 8U);
+		offset += 2U;
+		if (gdb_agent_expression_true(t, bp->code + offset, len))
+			return true;
+		offset += len;
+	}
+	return false;
+}
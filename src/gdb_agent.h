@@ -0,0 +1,54 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GDB_AGENT_H
+#define GDB_AGENT_H
+
+#include "target.h"
+
+/* breakpoints with conditions, the FPB has no more than this */
+#define GDB_AGENT_MAX_BREAKPOINTS 8U
+
+#if PC_HOSTED == 1
+#define GDB_AGENT_MAX_CODE 1024U
+#else
+#define GDB_AGENT_MAX_CODE 128U
+#endif
+
+typedef struct gdb_agent_breakpoint {
+	enum target_breakwatch type;
+	target_addr_t addr;
+	size_t len;
+	uint16_t code_len;
+	/* bytecode of the conditions back to back, each after a 16 bit length */
+	uint8_t code[GDB_AGENT_MAX_CODE];
+} gdb_agent_breakpoint_s;
+
+/* parse the ";Xlen,bytecode..." condition list of a Z packet and attach it to the breakpoint */
+bool gdb_agent_set(enum target_breakwatch type, target_addr_t addr, size_t len, const char *conditions);
+/* drop the conditions of a breakpoint, false if it had none */
+bool gdb_agent_clear(enum target_breakwatch type, target_addr_t addr);
+void gdb_agent_clear_all(void);
+const gdb_agent_breakpoint_s *gdb_agent_find(enum target_breakwatch type, target_addr_t addr);
+/* the breakpoint with conditions at addr, NULL if none */
+const gdb_agent_breakpoint_s *gdb_agent_lookup(target_addr_t addr);
+/* true if the expression is non-zero, or can not be evaluated */
+bool gdb_agent_expression_true(target *t, const uint8_t *code, size_t len);
+/* true if any condition of the breakpoint holds, or can not be evaluated */
+bool gdb_agent_condition_true(target *t, const gdb_agent_breakpoint_s *bp);
+
+#endif /* GDB_AGENT_H */
@@ -31,13 +31,23 @@
 #include "gdb_packet.h"
 #include "gdb_main.h"
 #include "gdb_hostio.h"
+#include "gdb_agent.h"
+#include "gdb_trace.h"
+#include "gdb_rtos.h"
 #include "target.h"
 #include "command.h"
 #include "crc32.h"
 #include "morse.h"
+#include "perf.h"
 #ifdef ENABLE_RTT
 #include "rtt.h"
 #endif
+#if PC_HOSTED == 1
+#include "traceswo.h"
+#endif
+#ifdef PLATFORM_HAS_STANDALONE
+#include "standalone.h"
+#endif
 
 #if defined(_WIN32) || defined(__CYGWIN__)
 #include <malloc.h>
@@ -46,16 +56,25 @@
 #endif
 
 enum gdb_signal {
+	GDB_SIG0 = 0,
 	GDB_SIGINT = 2,
 	GDB_SIGTRAP = 5,
 	GDB_SIGSEGV = 11,
 	GDB_SIGLOST = 29,
 };
 
-#define BUF_SIZE	1024U
+/* GDB_PACKET_BUFFER_SIZE comes from the platform's memory profile, see memory_profile.h */
+#define BUF_SIZE	GDB_PACKET_BUFFER_SIZE
 
 #define ERROR_IF_NO_TARGET()	\
-	if(!cur_target) { gdb_putpacketz("EFF"); break; }
+	if(!session->cur_target) { gdb_putpacketz("EFF"); break; }
+
+/* In non-stop mode registers are only there while the target is stopped, memory if it can be read running */
+#define ERROR_IF_RUNNING()	\
+	if (!in_syscall && session->target_running) { gdb_putpacketz("E01"); break; }
+#define ERROR_IF_NO_BACKGROUND_ACCESS()	\
+	if (!in_syscall && session->target_running && target_no_background_memory_access(session->cur_target)) { \
+		gdb_putpacketz("E01"); break; }
 
 typedef struct
 {
@@ -63,29 +82,96 @@ typedef struct
 	void (*func)(const char *packet, size_t len);
 } cmd_executer;
 
-static char pbuf[BUF_SIZE + 1U];
+/* See gdb_buffer_alloc() */
+static char *pbuf;
+
+/*
+ * What GDB has attached to and how it runs it, one per GDB connection. PC-Hosted serves several
+ * GDBs, see gdb_main(), the probe firmware has the one.
+ */
+typedef struct gdb_session {
+	target *cur_target;
+	target *last_target;
+	bool needs_detach_notify;
+	/*
+	 * Non-stop mode, set with QNonStop:1. Resuming replies OK at once and GDB goes on sending
+	 * packets while the target runs, the stop is sent later as a %Stop notification.
+	 */
+	bool non_stop;
+	/* Resumed and not seen to stop yet, in all-stop mode the stop reply is still owed */
+	bool target_running;
+	uint32_t run_start;
+	/* The stop was asked for by vCont;t or vAttach, which GDB expects reported as signal 0 */
+	bool stop_requested;
+	/* Last stop, for '?' in non-stop mode */
+	enum target_halt_reason last_reason;
+	target_addr_t last_watch;
+} gdb_session_s;
+
+static gdb_session_s gdb_sessions[GDB_IF_SESSIONS] = {
+	[0 ... GDB_IF_SESSIONS - 1U] = {.last_reason = TARGET_HALT_REQUEST},
+};
+/* The session whose packet is being handled, or whose target is polled */
+static gdb_session_s *session = gdb_sessions;
+
+/*
+ * Contiguous M and X writes are gathered here and go to the target as one block write, before
+ * any other packet is handled or once GDB goes quiet. Each is acknowledged as it is gathered,
+ * so a block write that fails is reported as the error of the packet that came next.
+ */
+#define GDB_WRITE_COMBINE_SIZE BUF_SIZE
+/* How long GDB has to send the next write of a run before the gathered ones go out */
+#define GDB_WRITE_COMBINE_IDLE_MS 5U
+
+typedef struct gdb_write_combine {
+	target *target;
+	size_t session;
+	target_addr_t addr;
+	size_t len;
+	bool failed;
+	uint8_t *data;
+} gdb_write_combine_s;
 
-static target *cur_target;
-static target *last_target;
-static bool gdb_needs_detach_notify = false;
+static gdb_write_combine_s write_combine;
 
 static void handle_q_packet(char *packet, size_t len);
 static void handle_v_packet(char *packet, size_t len);
 static void handle_z_packet(char *packet, size_t len);
 static void handle_kill_target(void);
 
+static void gdb_session_select(const size_t index)
+{
+	session = &gdb_sessions[index];
+	gdb_if_select(index);
+}
+
+/* Every session that has the target loses it, the notices go out on their own connections */
 static void gdb_target_destroy_callback(struct target_controller *tc, target *t)
 {
 	(void)tc;
-	if (cur_target == t) {
-		gdb_put_notificationz("%Stop:W00");
-		gdb_out("You are now detached from the previous target.\n");
-		cur_target = NULL;
-		gdb_needs_detach_notify = true;
+	/* Writes gathered for the target can not go out any more */
+	if (write_combine.target == t) {
+		write_combine.len = 0;
+		write_combine.target = NULL;
 	}
+	const size_t current = session - gdb_sessions;
+	for (size_t i = 0; i < gdb_if_session_count(); ++i) {
+		gdb_session_select(i);
+		if (session->cur_target == t) {
+			gdb_put_notificationz("%Stop:W00");
+			gdb_out("You are now detached from the previous target.\n");
+			session->cur_target = NULL;
+			gdb_agent_clear_all();
+			gdb_trace_reset(NULL);
+			gdb_rtos_invalidate();
+			session->target_running = false;
+			session->needs_detach_notify = true;
+		}
 
-	if (last_target == t)
-		last_target = NULL;
+		if (session->last_target == t)
+			session->last_target = NULL;
+	}
+	gdb_session_select(current);
 }
 
 static void gdb_target_printf(struct target_controller *tc,
@@ -95,6 +181,120 @@ static void gdb_target_printf(struct target_controller *tc,
 	gdb_voutf(fmt, ap);
 }
 
+/* sp, lr, pc and xpsr as GDB numbers them on Cortex-M, sent along with each stop reply */
+#define GDB_EXPEDITE_FIRST_REG 13U
+#define GDB_EXPEDITE_LAST_REG  16U
+#define GDB_PC_REG             15U
+
+/*
+ * Stop reply expediting sp, lr, pc and xpsr, which is all GDB needs for
+ * most stops. It saves the register read that would follow. Non-stop mode
+ * wants the thread named as well, as does GDB once there are RTOS threads.
+ */
+static size_t gdb_stop_reply_regs(
+	target *t, char *const reply, const size_t size, const enum gdb_signal signal, const char *const info)
+{
+	size_t offset = snprintf(reply, size, "T%02X%s", signal, info);
+	const uint32_t thread = gdb_rtos_current_thread(t);
+	if (session->non_stop || thread != GDB_RTOS_NO_THREAD)
+		offset += snprintf(reply + offset, size - offset, "thread:%" PRIx32 ";", thread);
+	for (uint32_t reg = GDB_EXPEDITE_FIRST_REG; reg <= GDB_EXPEDITE_LAST_REG; ++reg) {
+		uint8_t val[4];
+		if (target_reg_read(t, reg, val, sizeof(val)) != sizeof(val))
+			break;
+		offset += snprintf(reply + offset, size - offset, "%02" PRIX32 ":", reg);
+		hexify(reply + offset, val, sizeof(val));
+		offset += sizeof(val) * 2U;
+		reply[offset++] = ';';
+	}
+	return offset;
+}
+
+/* Report a stop, as a %Stop notification if notify is set */
+static void gdb_report_stop(target *t, const enum target_halt_reason reason, const target_addr_t watch, const bool notify)
+{
+	char reply[112];
+	const size_t prefix = notify ? snprintf(reply, sizeof(reply), "Stop:") : 0;
+	char *const stop = reply + prefix;
+	const size_t size = sizeof(reply) - prefix;
+	size_t len;
+
+	/* Translate reason to GDB signal */
+	switch (reason) {
+	case TARGET_HALT_ERROR:
+		len = snprintf(stop, size, "X%02X", GDB_SIGLOST);
+		morse("TARGET LOST.", true);
+		break;
+	case TARGET_HALT_REQUEST:
+		len = gdb_stop_reply_regs(t, stop, size, session->stop_requested ? GDB_SIG0 : GDB_SIGINT, "");
+		break;
+	case TARGET_HALT_WATCHPOINT: {
+		char watch_info[16];
+		snprintf(watch_info, sizeof(watch_info), "watch:%08" PRIX32 ";", (uint32_t)watch);
+		len = gdb_stop_reply_regs(t, stop, size, GDB_SIGTRAP, watch_info);
+		break;
+	}
+	case TARGET_HALT_FAULT:
+		len = gdb_stop_reply_regs(t, stop, size, GDB_SIGSEGV, "");
+		break;
+	default:
+		len = gdb_stop_reply_regs(t, stop, size, GDB_SIGTRAP, "");
+	}
+
+	if (notify)
+		gdb_put_notification(reply, prefix + len);
+	else
+		gdb_putpacket(reply, len);
+}
+
+/*
+ * Breakpoint stop the probe deals with itself: a tracepoint, which is
+ * collected, or a breakpoint whose conditions are all false. Step off it with
+ * the breakpoints there out of the way and run on, returning
+ * TARGET_HALT_RUNNING. Otherwise the stop is for GDB, and the reason to report
+ * is returned.
+ */
+static enum target_halt_reason gdb_breakpoint_check(target *t, target_addr_t *watch)
+{
+	uint8_t val[4];
+	if (target_reg_read(t, GDB_PC_REG, val, sizeof(val)) != sizeof(val))
+		return TARGET_HALT_BREAKPOINT;
+	const target_addr_t pc = val[0] | (val[1] << 8U) | (val[2] << 16U) | ((uint32_t)val[3] << 24U);
+	const bool traced = gdb_trace_hit(t, pc);
+	const gdb_agent_breakpoint_s *const bp = gdb_agent_lookup(pc);
+	if (bp ? gdb_agent_condition_true(t, bp) : !traced)
+		return TARGET_HALT_BREAKPOINT;
+
+	struct {
+		enum target_breakwatch type;
+		size_t len;
+	} off[2];
+	size_t count = 0;
+	if (bp && target_breakwatch_present(t, bp->type, pc, bp->len)) {
+		off[count].type = bp->type;
+		off[count++].len = bp->len;
+	}
+	if (traced && target_breakwatch_present(t, TARGET_BREAK_HARD, pc, GDB_TRACE_BREAK_KIND) &&
+		!(count && off[0].type == TARGET_BREAK_HARD && off[0].len == GDB_TRACE_BREAK_KIND)) {
+		off[count].type = TARGET_BREAK_HARD;
+		off[count++].len = GDB_TRACE_BREAK_KIND;
+	}
+	for (size_t i = 0; i < count; ++i)
+		target_breakwatch_clear(t, off[i].type, pc, off[i].len);
+	enum target_halt_reason reason;
+	target_halt_resume(t, true);
+	while ((reason = target_halt_poll(t, watch)) == TARGET_HALT_RUNNING)
+		continue;
+	for (size_t i = 0; i < count; ++i) {
+		if (target_breakwatch_set(t, off[i].type, pc, off[i].len))
+			DEBUG_WARN("breakpoint at 0x%08" PRIx32 " lost stepping past it\n", (uint32_t)pc);
+	}
+	if (reason != TARGET_HALT_STEPPING)
+		return reason;
+	target_halt_resume(t, false);
+	return TARGET_HALT_RUNNING;
+}
+
 static struct target_controller gdb_controller = {
 	.destroy_callback = gdb_target_destroy_callback,
 	.printf = gdb_target_printf,
@@ -113,254 +313,550 @@ static struct target_controller gdb_controller = {
 	.system = hostio_system,
 };
 
-int gdb_main_loop(struct target_controller *tc, bool in_syscall)
+/*
+ * One poll of the running target, servicing RTT, SWO and semihosted output while it
+ * runs. Returns TARGET_HALT_RUNNING until there is a stop to report.
+ */
+static enum target_halt_reason gdb_poll_target(target *t, target_addr_t *watch)
+{
+	enum target_halt_reason reason = target_halt_poll(t, watch);
+	if (reason == TARGET_HALT_RUNNING) {
+		platform_pace_poll(platform_time_ms() - session->run_start);
+		#ifdef ENABLE_RTT
+		if (rtt_enabled || live_watch_count) {
+			PERF_BEGIN(rtt_start);
+			poll_rtt(t);
+			PERF_END(PERF_POLL_RTT, rtt_start);
+		}
+		#endif
+		#if PC_HOSTED == 1
+		traceswo_poll();
+		#else
+		target_stdout_drain(t);
+		#endif
+		return reason;
+	}
+	/* tracepoints and breakpoints whose conditions are false are not reported, the target runs on */
+	if (reason == TARGET_HALT_BREAKPOINT)
+		reason = gdb_breakpoint_check(t, watch);
+	return reason;
+}
+
+static void gdb_target_stopped(const enum target_halt_reason reason, const target_addr_t watch, const bool notify)
+{
+	session->target_running = false;
+	SET_RUN_STATE(0);
+	/* Thread lists read while it ran, in non-stop mode, are stale */
+	gdb_rtos_invalidate();
+	#if PC_HOSTED == 0
+	/* Semihosted output the target wrote before it stopped goes out ahead of the stop reply */
+	target_stdout_drain(session->cur_target);
+	#endif
+	session->last_reason = reason;
+	session->last_watch = watch;
+	gdb_report_stop(session->cur_target, reason, watch, notify);
+}
+
+/*
+ * One round for the session's running target: ^C in all-stop mode, a poll, and once it has
+ * stopped the stop reply owed, or notification in non-stop mode.
+ */
+static void gdb_session_poll(void)
+{
+	if (!session->non_stop) {
+		const char c = (char)gdb_if_getchar_to(0);
+		if (c == '\x03' || c == '\x04')
+			target_halt_request(session->cur_target);
+	}
+	target_addr_t watch = 0;
+	const enum target_halt_reason reason = gdb_poll_target(session->cur_target, &watch);
+	if (reason != TARGET_HALT_RUNNING)
+		gdb_target_stopped(reason, watch, session->non_stop);
+}
+
+/* Poll the running target until it stops, in non-stop mode only until GDB sends something */
+static void gdb_running_wait(void)
+{
+	while (session->target_running && !(session->non_stop && gdb_getpacket_ready()))
+		gdb_session_poll();
+}
+
+/* In all-stop mode the stop reply follows once the target halts, non-stop mode replies at once */
+static void gdb_resume(const bool step)
+{
+	if (!session->target_running) {
+		gdb_rtos_invalidate();
+		target_halt_resume(session->cur_target, step);
+		SET_RUN_STATE(1);
+		session->target_running = true;
+		session->run_start = platform_time_ms();
+		session->stop_requested = false;
+	}
+	if (session->non_stop)
+		gdb_putpacketz("OK");
+}
+
+#if defined(PLATFORM_HAS_CCM) && PC_HOSTED == 0
+static char pbuf_ccm[BUF_SIZE + 1U] CCM_BSS;
+#endif
+
+/*
+ * Allocated on first use, BUF_SIZE + 1 bytes, shared by the sessions as they take turns.
+ * Where there is core coupled memory it is used for this instead of the heap.
+ */
+static bool gdb_buffer_alloc(void)
+{
+#if defined(PLATFORM_HAS_CCM) && PC_HOSTED == 0
+	pbuf = pbuf_ccm;
+#endif
+	if (!pbuf) {
+		pbuf = malloc(BUF_SIZE + 1U);
+		if (!pbuf) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void gdb_write_combine_flush(void)
+{
+	if (!write_combine.len)
+		return;
+	if (target_mem_write(write_combine.target, write_combine.addr, write_combine.data, write_combine.len)) {
+		DEBUG_WARN("Deferred write of %" PRIu32 " bytes to 0x%08" PRIx32 " failed\n", (uint32_t)write_combine.len,
+			write_combine.addr);
+		write_combine.failed = true;
+	}
+	write_combine.len = 0;
+}
+
+/* A failed deferred write, reported once */
+static bool gdb_write_combine_failed(void)
+{
+	const bool failed = write_combine.failed;
+	write_combine.failed = false;
+	return failed;
+}
+
+/* Write or gather the data of an M or X packet, false if it or a write gathered before failed */
+static bool gdb_mem_write(target *const t, const target_addr_t addr, const void *const src, const size_t len)
+{
+	gdb_rtos_invalidate();
+	const size_t current = session - gdb_sessions;
+	if (write_combine.len &&
+		(write_combine.target != t || write_combine.session != current ||
+			write_combine.addr + write_combine.len != addr || write_combine.len + len > GDB_WRITE_COMBINE_SIZE))
+		gdb_write_combine_flush();
+	if (gdb_write_combine_failed())
+		return false;
+
+	if (!write_combine.data && len) {
+		write_combine.data = malloc(GDB_WRITE_COMBINE_SIZE);
+		if (!write_combine.data) /* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+	}
+	/* Without a buffer, and for the zero length X GDB probes with, write at once */
+	if (!write_combine.data || !len || len > GDB_WRITE_COMBINE_SIZE)
+		return !target_mem_write(t, addr, src, len);
+
+	if (!write_combine.len) {
+		write_combine.target = t;
+		write_combine.session = current;
+		write_combine.addr = addr;
+	}
+	memcpy(write_combine.data + write_combine.len, src, len);
+	write_combine.len += len;
+	return true;
+}
+
+/* Give the session that gathered writes a moment to send the next, sending them out if it does not */
+static void gdb_write_combine_idle(void)
+{
+	if (!write_combine.len)
+		return;
+	const size_t current = session - gdb_sessions;
+	gdb_session_select(write_combine.session);
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, GDB_WRITE_COMBINE_IDLE_MS);
+	while (!gdb_getpacket_ready()) {
+		if (platform_timeout_is_expired(&timeout)) {
+			gdb_write_combine_flush();
+			break;
+		}
+#if PC_HOSTED == 1
+		gdb_if_wait(1U);
+#endif
+	}
+	gdb_session_select(current);
+}
+
+/* Keep a background erase going while the next packet is on its way */
+static void gdb_flash_idle(void)
+{
+	target *const t = session->cur_target;
+	if (!t)
+		return;
+	while (!gdb_getpacket_ready() && target_flash_background(t)) {
+#if PC_HOSTED == 1
+		gdb_if_wait(1U);
+#endif
+	}
+}
+
+static size_t gdb_read_packet(void)
+{
+	gdb_write_combine_idle();
+	gdb_flash_idle();
+	SET_IDLE_STATE(1);
+	PERF_BEGIN(getpacket_start);
+	const size_t size = gdb_getpacket(pbuf, BUF_SIZE);
+	PERF_END(PERF_GDB_GETPACKET, getpacket_start);
+	PERF_GDB_PACKET(pbuf[0]);
+	// If port closed and target detached, stay idle
+	if ((pbuf[0] != 0x04) || session->cur_target) {
+		SET_IDLE_STATE(0);
+	}
+#ifdef PLATFORM_HAS_STANDALONE
+	/* Without a debugger the probe programs the stored image on its own */
+	else
+		standalone_poll();
+#endif
+	return size;
+}
+
+/* Handle the packet in pbuf, true if it was the F reply a semihosting call waits for */
+static bool gdb_handle_packet(struct target_controller *tc, const bool in_syscall, const size_t size, int *syscall_ret)
 {
 	bool single_step = false;
 
-	/* GDB protocol main loop */
-	while (1) {
-		SET_IDLE_STATE(1);
-		size_t size = gdb_getpacket(pbuf, BUF_SIZE);
-		// If port closed and target detached, stay idle
-		if ((pbuf[0] != 0x04) || cur_target) {
-			SET_IDLE_STATE(0);
+	/* Anything but another write sees the gathered writes done first */
+	if (pbuf[0] != 'M' && pbuf[0] != 'X') {
+		gdb_write_combine_flush();
+		/* The semihosting reply and a closed connection are still handled, the error only logged */
+		if (gdb_write_combine_failed() && pbuf[0] != 'F' && pbuf[0] != 0x04) {
+			gdb_putpacketz("E01");
+			return false;
 		}
-		switch(pbuf[0]) {
-		/* Implementation of these is mandatory! */
-		case 'g': { /* 'g': Read general registers */
-			ERROR_IF_NO_TARGET();
-			uint8_t gp_regs[target_regs_size(cur_target)];
-			target_regs_read(cur_target, gp_regs);
-			gdb_putpacket(hexify(pbuf, gp_regs, sizeof(gp_regs)), sizeof(gp_regs) * 2U);
+	}
+
+	switch(pbuf[0]) {
+	/* Implementation of these is mandatory! */
+	case 'g': { /* 'g': Read general registers */
+		ERROR_IF_NO_TARGET();
+		ERROR_IF_RUNNING();
+		if (gdb_trace_frame_selected()) {
+			gdb_putpacket(pbuf, gdb_trace_frame_regs(session->cur_target, pbuf, BUF_SIZE));
 			break;
 		}
-		case 'm': {	/* 'm addr,len': Read len bytes from addr */
-			uint32_t addr, len;
-			ERROR_IF_NO_TARGET();
-			sscanf(pbuf, "m%" SCNx32 ",%" SCNx32, &addr, &len);
-			if (len > sizeof(pbuf) / 2) {
-				gdb_putpacketz("E02");
-				break;
-			}
-			DEBUG_GDB("m packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
-					  addr, len);
-			uint8_t mem[len];
-			if (target_mem_read(cur_target, mem, addr, len))
-				gdb_putpacketz("E01");
-			else
-				gdb_putpacket(hexify(pbuf, mem, len), len * 2U);
+		if (gdb_rtos_thread_selected()) {
+			gdb_putpacket(pbuf, gdb_rtos_thread_regs(session->cur_target, pbuf, BUF_SIZE));
 			break;
 		}
-		case 'G': {	/* 'G XX': Write general registers */
-			ERROR_IF_NO_TARGET();
-			uint8_t gp_regs[target_regs_size(cur_target)];
-			unhexify(gp_regs, &pbuf[1], sizeof(gp_regs));
-			target_regs_write(cur_target, gp_regs);
-			gdb_putpacketz("OK");
+		uint8_t gp_regs[target_regs_size(session->cur_target)];
+		target_regs_read(session->cur_target, gp_regs);
+		gdb_putpacket(hexify(pbuf, gp_regs, sizeof(gp_regs)), sizeof(gp_regs) * 2U);
+		break;
+	}
+	case 'm': {	/* 'm addr,len': Read len bytes from addr */
+		uint32_t addr, len;
+		ERROR_IF_NO_TARGET();
+		ERROR_IF_NO_BACKGROUND_ACCESS();
+		sscanf(pbuf, "m%" SCNx32 ",%" SCNx32, &addr, &len);
+		if (len > BUF_SIZE / 2U) {
+			gdb_putpacketz("E02");
 			break;
 		}
-		case 'M': { /* 'M addr,len:XX': Write len bytes to addr */
-			uint32_t addr = 0;
-			uint32_t len = 0;
-			int hex;
-			ERROR_IF_NO_TARGET();
-			sscanf(pbuf, "M%" SCNx32 ",%" SCNx32 ":%n", &addr, &len, &hex);
-			if (len > (unsigned)(size - hex) / 2) {
-				gdb_putpacketz("E02");
-				break;
-			}
-			DEBUG_GDB("M packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
-					  addr, len);
-			uint8_t mem[len];
-			unhexify(mem, pbuf + hex, len);
-			if (target_mem_write(cur_target, addr, mem, len))
-				gdb_putpacketz("E01");
+		DEBUG_GDB("m packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
+				  addr, len);
+		/* Read into the back half of pbuf, hexify() never overtakes the bytes it has yet to read */
+		uint8_t *const mem = (uint8_t *)pbuf + len;
+		if (gdb_trace_frame_selected()) {
+			/* memory the frame did not collect is not available */
+			const size_t count = gdb_trace_frame_mem(mem, addr, len);
+			if (count)
+				gdb_putpacket(hexify(pbuf, mem, count), count * 2U);
 			else
-				gdb_putpacketz("OK");
+				gdb_putpacketz("E01");
+		} else if (target_mem_read(session->cur_target, mem, addr, len))
+			gdb_putpacketz("E01");
+		else
+			gdb_putpacket(hexify(pbuf, mem, len), len * 2U);
+		break;
+	}
+	case 'x': {	/* 'x addr,len': Read len bytes from addr, replying in binary */
+		uint32_t addr, len;
+		ERROR_IF_NO_TARGET();
+		ERROR_IF_NO_BACKGROUND_ACCESS();
+		sscanf(pbuf, "x%" SCNx32 ",%" SCNx32, &addr, &len);
+		if (len > BUF_SIZE) {
+			gdb_putpacketz("E02");
 			break;
 		}
-		/* '[m|M|g|G|c][thread-id]' : Set the thread ID for the given subsequent operation
-		 * (we don't actually care which as we only care about the TID for whether to send OK or an error)
-		 */
-		case 'H': {
-			char operation = 0;
-			uint32_t thread_id = 0;
-			sscanf(pbuf, "H%c%" SCNx32, &operation, &thread_id);
-			if (thread_id <= 1)
-				gdb_putpacketz("OK");
+		DEBUG_GDB("x packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
+				  addr, len);
+		/* The request has been parsed, so pbuf is free to hold the data.
+		 * gdb_putpacket2() escapes it the same as any other reply. */
+		if (gdb_trace_frame_selected()) {
+			const size_t count = gdb_trace_frame_mem(pbuf, addr, len);
+			if (count)
+				gdb_putpacket2("b", 1U, pbuf, count);
 			else
 				gdb_putpacketz("E01");
+		} else if (target_mem_read(session->cur_target, pbuf, addr, len))
+			gdb_putpacketz("E01");
+		else
+			gdb_putpacket2("b", 1U, pbuf, len);
+		break;
+	}
+	case 'G': {	/* 'G XX': Write general registers */
+		ERROR_IF_NO_TARGET();
+		ERROR_IF_RUNNING();
+		/* The registers of threads that are switched out are not written back */
+		if (gdb_rtos_thread_selected()) {
+			gdb_putpacketz("E01");
 			break;
 		}
-		case 's':	/* 's [addr]': Single step [start at addr] */
-			single_step = true;
-			/* fall through */
-		case 'c':	/* 'c [addr]': Continue [at addr] */
-			if (!cur_target) {
-				gdb_putpacketz("X1D");
-				break;
-			}
-
-			target_halt_resume(cur_target, single_step);
-			SET_RUN_STATE(1);
-			single_step = false;
-			/* fall through */
-		case '?': {	/* '?': Request reason for target halt */
-			/* This packet isn't documented as being mandatory,
-			 * but GDB doesn't work without it. */
-			target_addr_t watch;
-			enum target_halt_reason reason;
-
-			if (!cur_target) {
-				/* Report "target exited" if no target */
-				gdb_putpacketz("W00");
-				break;
-			}
-
-			/* Wait for target halt */
-			while(!(reason = target_halt_poll(cur_target, &watch))) {
-				char c = (char)gdb_if_getchar_to(0);
-				if(c == '\x03' || c == '\x04')
-					target_halt_request(cur_target);
-				platform_pace_poll();
-				#ifdef ENABLE_RTT
-				if (rtt_enabled)
-					poll_rtt(cur_target);
-				#endif
-			}
-			SET_RUN_STATE(0);
-
-			/* Translate reason to GDB signal */
-			switch (reason) {
-			case TARGET_HALT_ERROR:
-				gdb_putpacket_f("X%02X", GDB_SIGLOST);
-				morse("TARGET LOST.", true);
-				break;
-			case TARGET_HALT_REQUEST:
-				gdb_putpacket_f("T%02X", GDB_SIGINT);
-				break;
-			case TARGET_HALT_WATCHPOINT:
-				gdb_putpacket_f("T%02Xwatch:%08X;", GDB_SIGTRAP, watch);
-				break;
-			case TARGET_HALT_FAULT:
-				gdb_putpacket_f("T%02X", GDB_SIGSEGV);
-				break;
-			default:
-				gdb_putpacket_f("T%02X", GDB_SIGTRAP);
-			}
+		uint8_t gp_regs[target_regs_size(session->cur_target)];
+		unhexify(gp_regs, &pbuf[1], sizeof(gp_regs));
+		target_regs_write(session->cur_target, gp_regs);
+		gdb_putpacketz("OK");
+		break;
+	}
+	case 'M': { /* 'M addr,len:XX': Write len bytes to addr */
+		uint32_t addr = 0;
+		uint32_t len = 0;
+		int hex;
+		ERROR_IF_NO_TARGET();
+		ERROR_IF_NO_BACKGROUND_ACCESS();
+		sscanf(pbuf, "M%" SCNx32 ",%" SCNx32 ":%n", &addr, &len, &hex);
+		if (len > (unsigned)(size - hex) / 2) {
+			gdb_putpacketz("E02");
+			break;
+		}
+		DEBUG_GDB("M packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
+				  addr, len);
+		/* Decode in place, each byte lands before the digits it came from */
+		unhexify(pbuf, pbuf + hex, len);
+		if (!gdb_mem_write(session->cur_target, addr, pbuf, len))
+			gdb_putpacketz("E01");
+		else
+			gdb_putpacketz("OK");
+		break;
+	}
+	/* '[m|M|g|G|c][thread-id]' : Set the thread ID for the given subsequent operation
+	 * Hg picks the thread registers are read from, the others only need the thread to exist
+	 * as the core runs whichever thread the RTOS schedules.
+	 */
+	case 'H': {
+		char operation = 0;
+		uint32_t thread_id = 0;
+		sscanf(pbuf, "H%c%" SCNx32, &operation, &thread_id);
+		const bool known = operation == 'g' ? gdb_rtos_select(session->cur_target, thread_id) :
+			gdb_rtos_thread_alive(session->cur_target, thread_id);
+		gdb_putpacketz(known ? "OK" : "E01");
+		break;
+	}
+	case 'T': { /* 'T thread-id': Is the thread alive */
+		uint32_t thread_id = 0;
+		sscanf(pbuf, "T%" SCNx32, &thread_id);
+		gdb_putpacketz(gdb_rtos_thread_alive(session->cur_target, thread_id) ? "OK" : "E01");
+		break;
+	}
+	case 's':	/* 's [addr]': Single step [start at addr] */
+		single_step = true;
+		/* fall through */
+	case 'c':	/* 'c [addr]': Continue [at addr] */
+		if (!session->cur_target) {
+			gdb_putpacketz("X1D");
 			break;
 		}
+		gdb_resume(single_step);
+		single_step = false;
+		break;
 
-		/* Optional GDB packet support */
-		case 'p': { /* Read single register */
-			ERROR_IF_NO_TARGET();
-			uint32_t reg;
-			sscanf(pbuf, "p%" SCNx32, &reg);
-			uint8_t val[8];
-			size_t s = target_reg_read(cur_target, reg, val, sizeof(val));
-			if (s > 0)
-				gdb_putpacket(hexify(pbuf, val, s), s * 2);
+	case '?':	/* '?': Request reason for target halt */
+		/* This packet isn't documented as being mandatory,
+		 * but GDB doesn't work without it. */
+		if (!session->cur_target) {
+			/* Report "target exited" if no target */
+			gdb_putpacketz("W00");
+		} else if (!session->non_stop) {
+			/* A halted target reports at the first poll, a running one once it stops */
+			if (!session->target_running) {
+				session->target_running = true;
+				session->run_start = platform_time_ms();
+			}
+		} else if (session->target_running)
+			gdb_putpacketz("OK");
+		else
+			gdb_report_stop(session->cur_target, session->last_reason, session->last_watch, false);
+		break;
+
+	/* Optional GDB packet support */
+	case 'p': { /* Read single register */
+		ERROR_IF_NO_TARGET();
+		ERROR_IF_RUNNING();
+		uint32_t reg;
+		sscanf(pbuf, "p%" SCNx32, &reg);
+		if (gdb_trace_frame_selected()) {
+			const size_t count = gdb_trace_frame_reg(session->cur_target, reg, pbuf);
+			if (count)
+				gdb_putpacket(pbuf, count);
 			else
 				gdb_putpacketz("EFF");
 			break;
 		}
-		case 'P': { /* Write single register */
-			ERROR_IF_NO_TARGET();
-			uint32_t reg;
-			int n;
-			sscanf(pbuf, "P%" SCNx32 "=%n", &reg, &n);
-			// TODO: FIXME, VLAs considered harmful.
-			uint8_t val[strlen(&pbuf[n]) / 2];
-			unhexify(val, pbuf + n, sizeof(val));
-			if (target_reg_write(cur_target, reg, val, sizeof(val)) > 0)
-				gdb_putpacketz("OK");
+		if (gdb_rtos_thread_selected()) {
+			const size_t count = gdb_rtos_thread_reg(session->cur_target, reg, pbuf);
+			if (count)
+				gdb_putpacket(pbuf, count);
 			else
 				gdb_putpacketz("EFF");
 			break;
 		}
-
-		case 'F':	/* Semihosting call finished */
-			if (in_syscall)
-				return hostio_reply(tc, pbuf, size);
-			else {
-				DEBUG_GDB("*** F packet when not in syscall! '%s'\n", pbuf);
-				gdb_putpacketz("");
-			}
+		uint8_t val[8];
+		size_t s = target_reg_read(session->cur_target, reg, val, sizeof(val));
+		if (s > 0)
+			gdb_putpacket(hexify(pbuf, val, s), s * 2);
+		else
+			gdb_putpacketz("EFF");
+		break;
+	}
+	case 'P': { /* Write single register */
+		ERROR_IF_NO_TARGET();
+		ERROR_IF_RUNNING();
+		if (gdb_rtos_thread_selected()) {
+			gdb_putpacketz("EFF");
 			break;
-
-		case '!':	/* Enable Extended GDB Protocol. */
-			/* This doesn't do anything, we support the extended
-			 * protocol anyway, but GDB will never send us a 'R'
-			 * packet unless we answer 'OK' here.
-			 */
+		}
+		uint32_t reg;
+		int n;
+		sscanf(pbuf, "P%" SCNx32 "=%n", &reg, &n);
+		// TODO: FIXME, VLAs considered harmful.
+		uint8_t val[strlen(&pbuf[n]) / 2];
+		unhexify(val, pbuf + n, sizeof(val));
+		if (target_reg_write(session->cur_target, reg, val, sizeof(val)) > 0)
 			gdb_putpacketz("OK");
-			break;
+		else
+			gdb_putpacketz("EFF");
+		break;
+	}
 
-		case 0x04:
-		case 'D':	/* GDB 'detach' command. */
-			if(cur_target) {
-				SET_RUN_STATE(1);
-				target_detach(cur_target);
-				last_target = cur_target;
-				cur_target = NULL;
-			}
-			if (pbuf[0] == 'D')
-				gdb_putpacketz("OK");
-			break;
+	case 'F':	/* Semihosting call finished */
+		if (in_syscall) {
+			*syscall_ret = hostio_reply(tc, pbuf, size);
+			return true;
+		}
+		else {
+			DEBUG_GDB("*** F packet when not in syscall! '%s'\n", pbuf);
+			gdb_putpacketz("");
+		}
+		break;
 
-		case 'k':	/* Kill the target */
-			handle_kill_target();
-			break;
+	case '!':	/* Enable Extended GDB Protocol. */
+		/* This doesn't do anything, we support the extended
+		 * protocol anyway, but GDB will never send us a 'R'
+		 * packet unless we answer 'OK' here.
+		 */
+		gdb_putpacketz("OK");
+		break;
 
-		case 'r':	/* Reset the target system */
-		case 'R':	/* Restart the target program */
-			if (cur_target)
-				target_reset(cur_target);
-			else if (last_target) {
-				cur_target = target_attach(last_target, &gdb_controller);
-				if (cur_target)
-					morse(NULL, false);
-				target_reset(cur_target);
-			}
-			break;
+	case 0x04:
+	case 'D':	/* GDB 'detach' command. */
+		if(session->cur_target) {
+			SET_RUN_STATE(1);
+			session->target_running = false;
+			gdb_trace_reset(session->cur_target);
+			target_detach(session->cur_target);
+			gdb_agent_clear_all();
+			gdb_rtos_invalidate();
+			session->last_target = session->cur_target;
+			session->cur_target = NULL;
+		}
+		if (pbuf[0] == 'D')
+			gdb_putpacketz("OK");
+		/* GDB went away in the middle of a semihosting call, it fails */
+		else if (in_syscall) {
+			*syscall_ret = -1;
+			return true;
+		}
+		break;
 
-		case 'X': { /* 'X addr,len:XX': Write binary data to addr */
-			uint32_t addr, len;
-			int bin;
-			ERROR_IF_NO_TARGET();
-			sscanf(pbuf, "X%" SCNx32 ",%" SCNx32 ":%n", &addr, &len, &bin);
-			if (len > (unsigned)(size - bin)) {
-				gdb_putpacketz("E02");
-				break;
-			}
-			DEBUG_GDB("X packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
-					  addr, len);
-			if (target_mem_write(cur_target, addr, pbuf + bin, len))
-				gdb_putpacketz("E01");
-			else
-				gdb_putpacketz("OK");
-			break;
+	case 'k':	/* Kill the target */
+		handle_kill_target();
+		break;
+
+	case 'r':	/* Reset the target system */
+	case 'R':	/* Restart the target program */
+		gdb_rtos_invalidate();
+		if (session->cur_target)
+			target_reset(session->cur_target);
+		else if (session->last_target) {
+			session->cur_target = target_attach(session->last_target, &gdb_controller);
+			if (session->cur_target)
+				morse(NULL, false);
+			target_reset(session->cur_target);
 		}
+		break;
 
-		case 'q':	/* General query packet */
-			handle_q_packet(pbuf, size);
+	case 'X': { /* 'X addr,len:XX': Write binary data to addr */
+		uint32_t addr, len;
+		int bin;
+		ERROR_IF_NO_TARGET();
+		ERROR_IF_NO_BACKGROUND_ACCESS();
+		sscanf(pbuf, "X%" SCNx32 ",%" SCNx32 ":%n", &addr, &len, &bin);
+		if (len > (unsigned)(size - bin)) {
+			gdb_putpacketz("E02");
 			break;
+		}
+		DEBUG_GDB("X packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
+				  addr, len);
+		if (!gdb_mem_write(session->cur_target, addr, pbuf + bin, len))
+			gdb_putpacketz("E01");
+		else
+			gdb_putpacketz("OK");
+		break;
+	}
 
-		case 'v':	/* Verbose command packet */
-			handle_v_packet(pbuf, size);
-			break;
+	case 'q':	/* General query packet */
+	case 'Q':	/* General set packet */
+		handle_q_packet(pbuf, size);
+		break;
 
-		/* These packet implement hardware break-/watchpoints */
-		case 'Z':	/* Z type,addr,len: Set breakpoint packet */
-		case 'z':	/* z type,addr,len: Clear breakpoint packet */
-			ERROR_IF_NO_TARGET();
-			handle_z_packet(pbuf, size);
-			break;
+	case 'v':	/* Verbose command packet */
+		handle_v_packet(pbuf, size);
+		break;
 
-		default: 	/* Packet not implemented */
-			DEBUG_GDB("*** Unsupported packet: %s\n", pbuf);
-			gdb_putpacketz("");
-		}
+	/* These packet implement hardware break-/watchpoints */
+	case 'Z':	/* Z type,addr,len: Set breakpoint packet */
+	case 'z':	/* z type,addr,len: Clear breakpoint packet */
+		ERROR_IF_NO_TARGET();
+		handle_z_packet(pbuf, size);
+		break;
+
+	default: 	/* Packet not implemented */
+		DEBUG_GDB("*** Unsupported packet: %s\n", pbuf);
+		gdb_putpacketz("");
+
+	}
+	return false;
+}
+
+int gdb_main_loop(struct target_controller *tc, bool in_syscall)
+{
+	if (!gdb_buffer_alloc())
+		return 0;
+
+	/* GDB protocol main loop */
+	while (1) {
+		/* A semihosting call is served with the target halted in it */
+		if (!in_syscall)
+			gdb_running_wait();
+		const size_t size = gdb_read_packet();
+		int syscall_ret;
+		if (gdb_handle_packet(tc, in_syscall, size, &syscall_ret))
+			return syscall_ret;
 	}
 }
 
@@ -388,7 +884,7 @@ static void exec_q_rcmd(const char *packet, const size_t length)
 	unhexify(data, packet, datalen);
 	data[datalen] = 0;	/* add terminating null */
 
-	const int c = command_process(cur_target, data);
+	const int c = command_process(session->cur_target, data);
 	if (c < 0)
 		gdb_putpacketz("");
 	else if (c == 0)
@@ -426,7 +922,29 @@ static void exec_q_supported(const char *packet, const size_t length)
 {
 	(void)packet;
 	(void)length;
-	gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+", BUF_SIZE);
+	gdb_putpacket_f(
+		"PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+;binary-upload+;QStartNoAckMode+;"
+		"ConditionalBreakpoints+;ConditionalTracepoints+;QNonStop+", BUF_SIZE);
+}
+
+static void exec_q_start_noackmode(const char *packet, const size_t length)
+{
+	(void)packet;
+	(void)length;
+	/* GDB still acks this reply, gdb_putpacket() waits for that before the switch */
+	gdb_putpacketz("OK");
+	gdb_set_noackmode(true);
+}
+
+static void exec_q_non_stop(const char *packet, const size_t length)
+{
+	(void)length;
+	if ((packet[0] != '0' && packet[0] != '1') || packet[1] != '\0' || session->target_running) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	session->non_stop = packet[0] == '1';
+	gdb_putpacketz("OK");
 }
 
 static void exec_q_memory_map(const char *packet, const size_t length)
@@ -434,33 +952,36 @@ static void exec_q_memory_map(const char *packet, const size_t length)
 	(void)packet;
 	(void)length;
 	/* Read target XML memory map */
-	if ((!cur_target) && last_target) {
+	if ((!session->cur_target) && session->last_target) {
 		/* Attach to last target if detached. */
-		cur_target = target_attach(last_target,
+		session->cur_target = target_attach(session->last_target,
 				   &gdb_controller);
 	}
-	if (!cur_target) {
+	if (!session->cur_target) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	const char *const map = target_mem_map(session->cur_target);
+	if (!map) {
 		gdb_putpacketz("E01");
 		return;
 	}
-	char buf[1024];
-	target_mem_map(cur_target, buf, sizeof(buf)); /* Fixme: Check size!*/
-	handle_q_string_reply(buf, packet);
+	handle_q_string_reply(map, packet);
 }
 
 static void exec_q_feature_read(const char *packet, const size_t length)
 {
 	(void)length;
 	/* Read target description */
-	if ((!cur_target) && last_target) {
+	if ((!session->cur_target) && session->last_target) {
 	  /* Attach to last target if detached. */
-	  cur_target = target_attach(last_target, &gdb_controller);
+	  session->cur_target = target_attach(session->last_target, &gdb_controller);
 	}
-	if (!cur_target) {
+	if (!session->cur_target) {
 	  gdb_putpacketz("E01");
 	  return;
 	}
-	handle_q_string_reply(target_tdesc(cur_target), packet);
+	handle_q_string_reply(target_tdesc(session->cur_target), packet);
 }
 
 static void exec_q_crc(const char *packet, const size_t length)
@@ -469,45 +990,18 @@ static void exec_q_crc(const char *packet, const size_t length)
 	uint32_t addr;
 	uint32_t addr_length;
 	if (sscanf(packet, "%" PRIx32 ",%" PRIx32, &addr, &addr_length) == 2) {
-		if (!cur_target) {
+		if (!session->cur_target) {
 			gdb_putpacketz("E01");
 			return;
 		}
 		uint32_t crc;
-		if (generic_crc32(cur_target, &crc, addr, addr_length))
+		if (generic_crc32(session->cur_target, &crc, addr, addr_length))
 			gdb_putpacketz("E03");
 		else
 			gdb_putpacket_f("C%lx", crc);
 	}
 }
 
-/*
- * qC queries are for the current thread. We don't support threads but GDB 11 and 12 require this,
- * so we always answer that the current thread is thread 1.
- */
-static void exec_q_c(const char *packet, const size_t length)
-{
-	(void)packet;
-	(void)length;
-	gdb_putpacketz("QC1");
-}
-
-/*
- * qfThreadInfo queries are required in GDB 11 and 12 as these GDBs require the server to support
- * threading even when there's only the possiblity for one thread to exist. In this instance,
- * we have to tell GDB that there is a single active thread so it doesn't think the "thread" died.
- * qsThreadInfo will always follow qfThreadInfo when we reply as we have to specify 'l' at the
- * end to terminate the list.. GDB doesn't like this not happening.
- */
-static void exec_q_thread_info(const char *packet, const size_t length)
-{
-	(void)length;
-	if (packet[-11] == 'f')
-		gdb_putpacketz("m1");
-	else
-		gdb_putpacketz("l");
-}
-
 static const cmd_executer q_commands[]=
 {
 	{"qRcmd,",                         exec_q_rcmd},
@@ -515,30 +1009,94 @@ static const cmd_executer q_commands[]=
 	{"qXfer:memory-map:read::",        exec_q_memory_map},
 	{"qXfer:features:read:target.xml:",exec_q_feature_read},
 	{"qCRC:",                          exec_q_crc},
-	{"qC",                             exec_q_c},
-	{"qfThreadInfo",                   exec_q_thread_info},
-	{"qsThreadInfo",                   exec_q_thread_info},
+	{"QStartNoAckMode",                exec_q_start_noackmode},
+	{"QNonStop:",                      exec_q_non_stop},
 	{NULL, NULL},
 };
 
 static void handle_kill_target(void)
 {
-	if (cur_target) {
-		target_reset(cur_target);
-		target_detach(cur_target);
-		last_target = cur_target;
-		cur_target = NULL;
+	if (session->cur_target) {
+		session->target_running = false;
+		gdb_trace_reset(session->cur_target);
+		target_reset(session->cur_target);
+		target_detach(session->cur_target);
+		gdb_agent_clear_all();
+		gdb_rtos_invalidate();
+		session->last_target = session->cur_target;
+		session->cur_target = NULL;
 	}
 }
 
 static void handle_q_packet(char *packet, const size_t length)
 {
+	if (gdb_trace_packet(session->cur_target, packet, length))
+		return;
+	if (gdb_rtos_packet(session->cur_target, packet, length))
+		return;
 	if (exec_command(packet, length, q_commands))
 		return;
 	DEBUG_GDB("*** Unsupported packet: %s\n", packet);
 	gdb_putpacket("", 0);
 }
 
+/* True if the thread-id of a vCont action names a thread of the core, or all of them */
+static bool gdb_thread_is_ours(const char *const thread_id)
+{
+	return gdb_rtos_thread_alive(session->cur_target, strtoul(thread_id, NULL, 16));
+}
+
+/*
+ * vCont;action[:thread-id]...: the first action for thread 1 is taken, signals are not passed
+ * on. vCont;t stops the target in non-stop mode, reported with a %Stop notification even if it
+ * was stopped already.
+ */
+static void handle_v_cont(const char *actions)
+{
+	if (!session->cur_target) {
+		gdb_putpacketz("X1D");
+		return;
+	}
+	for (const char *action = actions; action; action = strchr(action, ';')) {
+		if (*action == ';')
+			++action;
+		const char *const thread_id = strchr(action, ':');
+		const char *const next = strchr(action, ';');
+		if (thread_id && (!next || thread_id < next) && !gdb_thread_is_ours(thread_id + 1))
+			continue;
+
+		switch (action[0]) {
+		case 'c':
+		case 'C':
+			gdb_resume(false);
+			return;
+		case 's':
+		case 'S':
+			gdb_resume(true);
+			return;
+		case 't':
+			if (!session->non_stop)
+				break;
+			session->stop_requested = true;
+			if (session->target_running) {
+				target_halt_request(session->cur_target);
+				gdb_putpacketz("OK");
+			} else {
+				gdb_putpacketz("OK");
+				session->last_reason = TARGET_HALT_REQUEST;
+				gdb_report_stop(session->cur_target, session->last_reason, session->last_watch, true);
+			}
+			return;
+		default:
+			break;
+		}
+		gdb_putpacketz("E01");
+		return;
+	}
+	/* Nothing to do for our thread */
+	gdb_putpacketz("OK");
+}
+
 static void handle_v_packet(char *packet, const size_t plen)
 {
 	uint32_t addr = 0;
@@ -547,8 +1105,9 @@ static void handle_v_packet(char *packet, const size_t plen)
 
 	if (sscanf(packet, "vAttach;%08" PRIx32, &addr) == 1) {
 		/* Attach to remote target processor */
-		cur_target = target_attach_n(addr, &gdb_controller);
-		if(cur_target) {
+		gdb_rtos_invalidate();
+		session->cur_target = target_attach_n(addr, &gdb_controller);
+		if(session->cur_target) {
 			morse(NULL, false);
 			/*
 			 * We don't actually support threads, but GDB 11 and 12 can't work without
@@ -558,8 +1117,16 @@ static void handle_v_packet(char *packet, const size_t plen)
 			 * https://sourceware.org/pipermail/gdb-patches/2021-December/184171.html
 			 * https://sourceware.org/pipermail/gdb-patches/2022-April/188058.html
 			 * https://sourceware.org/pipermail/gdb-patches/2022-July/190869.html
+			 *
+			 * In non-stop mode the stop is not part of the reply, GDB asks for it with '?' or vCont;t.
 			 */
-			gdb_putpacketz("T05thread:1;");
+			session->target_running = false;
+			session->stop_requested = true;
+			session->last_reason = TARGET_HALT_REQUEST;
+			if (session->non_stop)
+				gdb_putpacketz("OK");
+			else
+				gdb_putpacketz("T05thread:1;");
 		} else
 			gdb_putpacketz("E01");
 
@@ -603,18 +1170,19 @@ static void handle_v_packet(char *packet, const size_t plen)
 		rtt_found = false;
 		#endif
 		/* Run target program. For us (embedded) this means reset. */
-		if (cur_target) {
-			target_set_cmdline(cur_target, cmdline);
-			target_reset(cur_target);
+		gdb_rtos_invalidate();
+		if (session->cur_target) {
+			target_set_cmdline(session->cur_target, cmdline);
+			target_reset(session->cur_target);
 			gdb_putpacketz("T05");
-		} else if (last_target) {
-			cur_target = target_attach(last_target,
+		} else if (session->last_target) {
+			session->cur_target = target_attach(session->last_target,
 						   &gdb_controller);
 
 			/* If we were able to attach to the target again */
-			if (cur_target) {
-				target_set_cmdline(cur_target, cmdline);
-				target_reset(cur_target);
+			if (session->cur_target) {
+				target_set_cmdline(session->cur_target, cmdline);
+				target_reset(session->cur_target);
 				morse(NULL, false);
 				gdb_putpacketz("T05");
 			} else
@@ -626,15 +1194,15 @@ static void handle_v_packet(char *packet, const size_t plen)
 	} else if (sscanf(packet, "vFlashErase:%08" PRIx32 ",%08" PRIx32, &addr, &len) == 2) {
 		/* Erase Flash Memory */
 		DEBUG_GDB("Flash Erase %08" PRIX32 " %08" PRIX32 "\n", addr, len);
-		if (!cur_target) {
+		if (!session->cur_target) {
 			gdb_putpacketz("EFF");
 			return;
 		}
 
-		if (target_flash_erase(cur_target, addr, len))
+		if (target_flash_erase(session->cur_target, addr, len))
 			gdb_putpacketz("OK");
 		else {
-			target_flash_complete(cur_target);
+			target_flash_complete(session->cur_target);
 			gdb_putpacketz("EFF");
 		}
 
@@ -642,24 +1210,30 @@ static void handle_v_packet(char *packet, const size_t plen)
 		/* Write Flash Memory */
 		const uint32_t count = plen - bin;
 		DEBUG_GDB("Flash Write %08" PRIX32 " %08" PRIX32 "\n", addr, count);
-		if (cur_target && target_flash_write(cur_target, addr, (void*)packet + bin, count))
+		if (session->cur_target && target_flash_write(session->cur_target, addr, (void*)packet + bin, count))
 			gdb_putpacketz("OK");
 		else {
-			target_flash_complete(cur_target);
+			target_flash_complete(session->cur_target);
 			gdb_putpacketz("EFF");
 		}
 
 	} else if (!strcmp(packet, "vFlashDone")) {
 		/* Commit flash operations. */
-		if (target_flash_complete(cur_target))
+		if (target_flash_complete(session->cur_target))
 			gdb_putpacketz("OK");
 		else
 			gdb_putpacketz("EFF");
 
+	} else if (!strcmp(packet, "vCont?")) {
+		gdb_putpacketz("vCont;c;C;s;S;t");
+
+	} else if (!strncmp(packet, "vCont;", 6)) {
+		handle_v_cont(packet + 6);
+
 	} else if (!strcmp(packet, "vStopped")) {
-		if (gdb_needs_detach_notify) {
+		if (session->needs_detach_notify) {
 			gdb_putpacketz("W00");
-			gdb_needs_detach_notify = false;
+			session->needs_detach_notify = false;
 		} else
 			gdb_putpacketz("OK");
 
@@ -680,12 +1254,31 @@ static void handle_z_packet(char *packet, const size_t plen)
 	uint32_t len;
 	uint32_t addr;
 	sscanf(packet, "%*[zZ]%" PRIu32 ",%08" PRIx32 ",%" PRIu32, &type, &addr, &len);
+	/* breakpoint conditions for the probe to evaluate follow the kind, ";Xlen,bytecode..." */
+	const char *const conditions = strchr(packet, ';');
+	const bool is_break = type == TARGET_BREAK_SOFT || type == TARGET_BREAK_HARD;
 
 	int ret = 0;
-	if (packet[0] == 'Z')
-		ret = target_breakwatch_set(cur_target, type, addr, len);
-	else
-		ret = target_breakwatch_clear(cur_target, type, addr, len);
+	if (packet[0] == 'Z') {
+		/* GDB inserts a breakpoint again when its conditions change */
+		const bool present = target_breakwatch_present(session->cur_target, type, addr, len);
+		if (!present)
+			ret = target_breakwatch_set(session->cur_target, type, addr, len);
+		if (ret == 0 && is_break) {
+			if (!conditions)
+				gdb_agent_clear(type, addr);
+			else if (!gdb_agent_set(type, addr, len, conditions)) {
+				/* no room for the conditions, a breakpoint that always stops would be wrong */
+				if (!present)
+					target_breakwatch_clear(session->cur_target, type, addr, len);
+				ret = -1;
+			}
+		}
+	} else {
+		if (is_break)
+			gdb_agent_clear(type, addr);
+		ret = target_breakwatch_clear(session->cur_target, type, addr, len);
+	}
 
 	if (ret < 0)
 		gdb_putpacketz("E01");
@@ -695,7 +1288,39 @@ static void handle_z_packet(char *packet, const size_t plen)
 		gdb_putpacketz("OK");
 }
 
+#if PC_HOSTED == 1
+/*
+ * One round over the GDB sessions: each running target is polled, and each GDB that can be
+ * answered has a packet handled. The probe and its link are shared, the sessions take turns
+ * and none waits on another's target. Run over and over by main().
+ */
+void gdb_main(void)
+{
+	if (!gdb_buffer_alloc())
+		return;
+
+	bool running = false;
+	for (size_t i = 0; i < gdb_if_session_count(); ++i) {
+		gdb_session_select(i);
+		if (session->target_running)
+			gdb_session_poll();
+		/* In all-stop mode GDB waits for the stop reply before it sends more */
+		if ((!session->target_running || session->non_stop) && gdb_getpacket_ready()) {
+			const size_t size = gdb_read_packet();
+			int syscall_ret;
+			gdb_handle_packet(&gdb_controller, false, size, &syscall_ret);
+		}
+		running |= session->target_running;
+	}
+	/* Gathered writes wait only a moment for the next, the next round handles it if it comes */
+	if (write_combine.len)
+		gdb_write_combine_idle();
+	else
+		gdb_if_wait(running ? 0U : 100U);
+}
+#else
 void gdb_main(void)
 {
 	gdb_main_loop(&gdb_controller, false);
 }
+#endif
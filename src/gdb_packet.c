@@ -27,10 +27,62 @@
 #include "gdb_packet.h"
 #include "hex_utils.h"
 #include "remote.h"
+#if PC_HOSTED == 1
+#include "wire_trace.h"
+#else
+#define WIRE_TRACE(op, tag, len) do {} while (0)
+#endif
 
 #include <stdarg.h>
 
-size_t gdb_getpacket(char *packet, size_t size)
+/* Per GDB session, see gdb_if_select() */
+typedef struct gdb_packet_state {
+	/* Set once GDB negotiates QStartNoAckMode, packets are then neither acked nor retransmitted */
+	bool noackmode;
+	/* First character of the next packet, already taken by gdb_getpacket_ready(), -1 if none */
+	int pending_char;
+} gdb_packet_state_s;
+
+static gdb_packet_state_s gdb_packet_states[GDB_IF_SESSIONS] = {
+	[0 ... GDB_IF_SESSIONS - 1U] = {.noackmode = false, .pending_char = -1},
+};
+
+static gdb_packet_state_s *gdb_packet_state(void)
+{
+	return &gdb_packet_states[gdb_if_session()];
+}
+
+void gdb_set_noackmode(const bool enable)
+{
+	gdb_packet_state_s *const state = gdb_packet_state();
+	state->noackmode = enable;
+	state->pending_char = -1;
+}
+
+static char gdb_packet_getchar(void)
+{
+	gdb_packet_state_s *const state = gdb_packet_state();
+	if (state->pending_char < 0)
+		return (char)gdb_if_getchar();
+	const char c = (char)state->pending_char;
+	state->pending_char = -1;
+	return c;
+}
+
+/* True if GDB has sent anything gdb_getpacket() would return, without waiting for it */
+bool gdb_getpacket_ready(void)
+{
+	gdb_packet_state_s *const state = gdb_packet_state();
+	if (state->pending_char < 0) {
+		const unsigned char c = gdb_if_getchar_to(0);
+		if (c == 0xffU)
+			return false;
+		state->pending_char = c;
+	}
+	return true;
+}
+
+RAMFUNC size_t gdb_getpacket(char *packet, size_t size)
 {
 	unsigned char csum;
 	char recv_csum[3];
@@ -39,14 +91,21 @@ size_t gdb_getpacket(char *packet, size_t size)
 	while (1) {
 	    /* Wait for packet start */
 		do {
+#if PC_HOSTED == 0
+			/* The remote protocol may have work for the probe in between */
+			remote_idle();
+#endif
 			/* Spin waiting for a start of packet character - either a gdb
              * start ('$') or a BMP remote packet start ('!').
 			 */
 			do {
 				/* Smells like bad code */
-				packet[0] = (char)gdb_if_getchar();
-				if (packet[0] == 0x04)
+				packet[0] = gdb_packet_getchar();
+				if (packet[0] == 0x04) {
+					/* The next GDB to connect starts over in ack mode */
+					gdb_packet_state()->noackmode = false;
 					return 1;
+				}
 			} while ((packet[0] != '$') && (packet[0] != REMOTE_SOM));
 #if PC_HOSTED == 0
 			if (packet[0] == REMOTE_SOM) {
@@ -73,6 +132,13 @@ size_t gdb_getpacket(char *packet, size_t size)
 						gettingRemotePacket = false;
 						break;
 
+					case REMOTE_ESC: /* Escaped byte in a binary payload */
+						if (offset < size)
+							packet[offset++] = (char)(gdb_if_getchar() ^ REMOTE_ESC_XOR);
+						else
+							gettingRemotePacket = false;
+						break;
+
 					default:
 						if (offset < size) {
 							packet[offset++] = c;
@@ -95,27 +161,39 @@ size_t gdb_getpacket(char *packet, size_t size)
 
 		offset = 0;
 		csum = 0;
-		char c;
-		/* Capture packet data into buffer */
-		while ((c = (char)gdb_if_getchar()) != '#') {
-
-			/* If we run out of buffer space, exit early */
-			if (offset == size)
-				break;
-
-			if (c == '$') { /* Restart capture */
-				offset = 0;
-				csum = 0;
-				continue;
-			}
-			if (c == '}') { /* escaped char */
-				c = gdb_if_getchar();
-				csum += c + '}';
-				packet[offset++] = c ^ 0x20;
-				continue;
+		bool escaped = false;
+		bool captured = false;
+		/* Capture packet data into buffer, a whole received span at a time */
+		while (!captured) {
+			const unsigned char *span;
+			const size_t len = gdb_if_getspan(&span);
+			size_t used = 0;
+			while (used < len) {
+				const char c = (char)span[used++];
+				if (escaped) { /* second half of an escaped char */
+					csum += c + '}';
+					packet[offset++] = c ^ 0x20;
+					escaped = false;
+					continue;
+				}
+				/* End of packet, or out of buffer space so exit early */
+				if (c == '#' || offset == size) {
+					captured = true;
+					break;
+				}
+				if (c == '$') { /* Restart capture */
+					offset = 0;
+					csum = 0;
+					continue;
+				}
+				if (c == '}') { /* escaped char */
+					escaped = true;
+					continue;
+				}
+				csum += c;
+				packet[offset++] = c;
 			}
-			csum += c;
-			packet[offset++] = c;
+			gdb_if_consume(used);
 		}
 		recv_csum[0] = (char)gdb_if_getchar();
 		recv_csum[1] = (char)gdb_if_getchar();
@@ -126,11 +204,14 @@ size_t gdb_getpacket(char *packet, size_t size)
 			break;
 
 		/* get here if checksum fails */
-		gdb_if_putchar('-', 1); /* send nack */
+		if (!gdb_packet_state()->noackmode)
+			gdb_if_putchar('-', 1); /* send nack */
 	}
-	gdb_if_putchar('+', 1); /* send ack */
+	if (!gdb_packet_state()->noackmode)
+		gdb_if_putchar('+', GDB_IF_FLUSH_MORE); /* send ack */
 	packet[offset] = 0;
 
+	WIRE_TRACE(WIRE_TRACE_GDB_RX, packet[0], offset);
 #if PC_HOSTED == 1
 	DEBUG_GDB_WIRE("%s : ", __func__);
 	for (size_t j = 0; j < offset; j++) {
@@ -145,81 +226,109 @@ size_t gdb_getpacket(char *packet, size_t size)
 	return offset;
 }
 
-static void gdb_next_char(char c, unsigned char *csum)
+/* Bytes sent escaped, '*' as GDB would otherwise take it for run length encoding */
+static const bool gdb_escaped[256] = {['$'] = true, ['#'] = true, ['}'] = true, ['*'] = true};
+
+/* Packets are encoded into this and handed to gdb_if_write() a chunk at a time */
+#define GDB_TX_CHUNK_SIZE 64U
+
+typedef struct gdb_tx {
+	uint8_t buf[GDB_TX_CHUNK_SIZE];
+	size_t len;
+	uint8_t csum;
+} gdb_tx_s;
+
+static void gdb_tx_start(gdb_tx_s *const tx, const char start)
+{
+	tx->buf[0] = start;
+	tx->len = 1U;
+	tx->csum = 0;
+}
+
+/* Escape and checksum the body in one pass */
+static RAMFUNC void gdb_tx_body(gdb_tx_s *const tx, const char *const data, const size_t size)
 {
 #if PC_HOSTED == 1
-	if ((c >= 32) && (c < 127))
-		DEBUG_GDB_WIRE("%c", c);
-	else
-		DEBUG_GDB_WIRE("\\x%02X", c);
+	for (size_t i = 0; i < size; ++i) {
+		const char c = data[i];
+		if (c >= ' ' && c < 0x7F)
+			DEBUG_GDB_WIRE("%c", c);
+		else
+			DEBUG_GDB_WIRE("\\x%02X", c);
+	}
 #endif
-	if ((c == '$') || (c == '#') || (c == '}') || (c == '*')) {
-		gdb_if_putchar('}', 0);
-		gdb_if_putchar(c ^ 0x20, 0);
-		*csum += '}' + (c ^ 0x20);
+	size_t len = tx->len;
+	uint8_t csum = tx->csum;
+	for (size_t i = 0; i < size; ++i) {
+		if (len > sizeof(tx->buf) - 2U) {
+			gdb_if_write(tx->buf, len, 0);
+			len = 0;
+		}
+		const uint8_t c = data[i];
+		if (gdb_escaped[c]) {
+			tx->buf[len++] = '}';
+			tx->buf[len++] = c ^ 0x20U;
+			csum += '}' + (c ^ 0x20U);
+		} else {
+			tx->buf[len++] = c;
+			csum += c;
+		}
 	}
-	else {
-		gdb_if_putchar(c, 0);
-		*csum += c;
+	tx->len = len;
+	tx->csum = csum;
+}
+
+static void gdb_tx_end(gdb_tx_s *const tx)
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+	if (tx->len > sizeof(tx->buf) - 3U) {
+		gdb_if_write(tx->buf, tx->len, 0);
+		tx->len = 0;
 	}
+	tx->buf[tx->len++] = '#';
+	tx->buf[tx->len++] = hex_digits[tx->csum >> 4U];
+	tx->buf[tx->len++] = hex_digits[tx->csum & 0xfU];
+	gdb_if_write(tx->buf, tx->len, 1);
+	DEBUG_GDB_WIRE("\n");
 }
 
-void gdb_putpacket2(const char *packet1, size_t size1, const char *packet2, size_t size2)
+RAMFUNC void gdb_putpacket2(const char *packet1, size_t size1, const char *packet2, size_t size2)
 {
-	char xmit_csum[3];
 	size_t tries = 0;
 
+	WIRE_TRACE(WIRE_TRACE_GDB_TX, size1 ? packet1[0] : 0, size1 + size2);
 	do {
 		DEBUG_GDB_WIRE("%s: ", __func__);
-		unsigned char csum = 0;
-		gdb_if_putchar('$', 0);
-
-		for (size_t i = 0; i < size1; ++i)
-			gdb_next_char(packet1[i], &csum);
-		for (size_t i = 0; i < size2; ++i)
-			gdb_next_char(packet2[i], &csum);
-
-		gdb_if_putchar('#', 0);
-		snprintf(xmit_csum, sizeof(xmit_csum), "%02X", csum);
-		gdb_if_putchar(xmit_csum[0], 0);
-		gdb_if_putchar(xmit_csum[1], 1);
-		DEBUG_GDB_WIRE("\n");
-	} while (gdb_if_getchar_to(2000) != '+' && tries++ < 3);
+		gdb_tx_s tx;
+		gdb_tx_start(&tx, '$');
+		gdb_tx_body(&tx, packet1, size1);
+		gdb_tx_body(&tx, packet2, size2);
+		gdb_tx_end(&tx);
+	} while (!gdb_packet_state()->noackmode && gdb_if_getchar_to(2000) != '+' && tries++ < 3);
 }
 
-void gdb_putpacket(const char *packet, size_t size)
+RAMFUNC void gdb_putpacket(const char *packet, size_t size)
 {
-	char xmit_csum[3];
 	size_t tries = 0;
 
+	WIRE_TRACE(WIRE_TRACE_GDB_TX, size ? packet[0] : 0, size);
 	do {
 		DEBUG_GDB_WIRE("%s: ", __func__);
-		unsigned char csum = 0;
-		gdb_if_putchar('$', 0);
-		for (size_t i = 0; i < size; ++i)
-			gdb_next_char(packet[i], &csum);
-		gdb_if_putchar('#', 0);
-		snprintf(xmit_csum, sizeof(xmit_csum), "%02X", csum);
-		gdb_if_putchar(xmit_csum[0], 0);
-		gdb_if_putchar(xmit_csum[1], 1);
-		DEBUG_GDB_WIRE("\n");
-	} while (gdb_if_getchar_to(2000) != '+' && tries++ < 3);
+		gdb_tx_s tx;
+		gdb_tx_start(&tx, '$');
+		gdb_tx_body(&tx, packet, size);
+		gdb_tx_end(&tx);
+	} while (!gdb_packet_state()->noackmode && gdb_if_getchar_to(2000) != '+' && tries++ < 3);
 }
 
 void gdb_put_notification(const char *const packet, const size_t size)
 {
-	char xmit_csum[3];
-
+	WIRE_TRACE(WIRE_TRACE_GDB_TX, '%', size);
 	DEBUG_GDB_WIRE("%s: ", __func__);
-	uint8_t csum = 0;
-	gdb_if_putchar('%', 0);
-	for (size_t i = 0; i < size; ++i)
-		gdb_next_char(packet[i], &csum);
-	gdb_if_putchar('#', 0);
-	snprintf(xmit_csum, sizeof(xmit_csum), "%02X", csum);
-	gdb_if_putchar(xmit_csum[0], 0);
-	gdb_if_putchar(xmit_csum[1], 1);
-	DEBUG_GDB_WIRE("\n");
+	gdb_tx_s tx;
+	gdb_tx_start(&tx, '%');
+	gdb_tx_body(&tx, packet, size);
+	gdb_tx_end(&tx);
 }
 
 void gdb_putpacket_f(const char *fmt, ...)
@@ -237,6 +346,13 @@ void gdb_putpacket_f(const char *fmt, ...)
 
 void gdb_out(const char *buf)
 {
+#if PC_HOSTED == 1
+	/* Commands run from the command line or libblackmagic have no GDB to send output to */
+	if (!gdb_if_connected()) {
+		fputs(buf, stdout);
+		return;
+	}
+#endif
 	int l = strlen(buf);
 	char *hexdata = calloc(1, 2 * l + 1);
 	if (!hexdata)
@@ -0,0 +1,951 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTOS thread awareness for FreeRTOS, Zephyr and ThreadX on ARMv6-M and
+ * ARMv7-M cores. GDB is asked for the kernel's symbols with qSymbol once it
+ * has loaded the program, and the RTOS whose symbols are all there is used.
+ *
+ * The thread list is read once per halt, on the first packet that needs it,
+ * and dropped when the target resumes. Each thread control block is fetched
+ * in a single read as the kernel lists are walked, and list heads lying
+ * close together are read as one block. The registers a thread saved when it
+ * was switched out are only read once GDB selects it with Hg; the thread the
+ * core was running has its live registers.
+ *
+ * The core is thread GDB_RTOS_NO_THREAD while no RTOS is found, and also
+ * while the RTOS has no thread running, before the scheduler starts.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "hex_utils.h"
+#include "gdb_packet.h"
+#include "gdb_rtos.h"
+
+#if PC_HOSTED == 1
+#define GDB_RTOS_MAX_THREADS 256U
+#define GDB_RTOS_NAME_LEN    32U
+#else
+#define GDB_RTOS_MAX_THREADS 24U
+#define GDB_RTOS_NAME_LEN    16U
+#endif
+/* thread-ids in one qfThreadInfo or qsThreadInfo reply */
+#define GDB_RTOS_IDS_PER_REPLY 32U
+/* kernel data closer together than this is read as one block */
+#define GDB_RTOS_SPAN_MAX 256U
+
+/* r0-r12, sp, lr, pc and xpsr, numbered as in the Cortex-M target description */
+#define RTOS_CONTEXT_REGS 17U
+#define RTOS_REG_R4       4U
+#define RTOS_REG_SP       13U
+#define RTOS_REG_XPSR     16U
+
+/* EXC_RETURN values have the top bits set, which saved registers rarely do */
+#define RTOS_EXC_RETURN_MASK     0xffffff00U
+#define RTOS_EXC_RETURN_STD_FRAME (1U << 4U) /* clear when the FPU state was stacked too */
+#define RTOS_XPSR_STACK_ALIGNED  (1U << 9U)  /* the core padded the frame to 8 bytes */
+#define RTOS_HW_FRAME_WORDS      8U          /* r0-r3, r12, lr, pc, xpsr */
+#define RTOS_HW_FP_FRAME_WORDS   18U         /* s0-s15, fpscr and a reserved word after those */
+#define RTOS_CALLEE_WORDS        8U          /* r4-r11 */
+#define RTOS_CALLEE_FP_WORDS     16U         /* s16-s31 */
+/* EXC_RETURN, s16-s31, r4-r11 and the hardware frame */
+#define RTOS_FRAME_MAX_WORDS (1U + RTOS_CALLEE_FP_WORDS + RTOS_CALLEE_WORDS + RTOS_HW_FRAME_WORDS)
+#define RTOS_FRAME_MIN_WORDS (1U + RTOS_CALLEE_WORDS + RTOS_HW_FRAME_WORDS)
+
+typedef enum rtos_symbol {
+	SYM_FREERTOS_CURRENT_TCB,
+	SYM_FREERTOS_READY_LISTS,
+	SYM_FREERTOS_PENDING_READY,
+	SYM_FREERTOS_DELAYED_LIST1,
+	SYM_FREERTOS_DELAYED_LIST2,
+	SYM_FREERTOS_SUSPENDED,
+	SYM_FREERTOS_TERMINATION,
+	SYM_FREERTOS_TOP_PRIORITY,
+	SYM_ZEPHYR_KERNEL,
+	SYM_ZEPHYR_OFFSETS,
+	SYM_ZEPHYR_OFFSET_COUNT,
+	SYM_THREADX_CURRENT,
+	SYM_THREADX_CREATED,
+	SYM_THREADX_CREATED_COUNT,
+	SYM_COUNT,
+} rtos_symbol_e;
+
+typedef struct rtos_symbol_info {
+	const char *name;
+	bool optional;
+} rtos_symbol_info_s;
+
+static const rtos_symbol_info_s rtos_symbols[SYM_COUNT] = {
+	[SYM_FREERTOS_CURRENT_TCB] = {"pxCurrentTCB", false},
+	[SYM_FREERTOS_READY_LISTS] = {"pxReadyTasksLists", false},
+	[SYM_FREERTOS_PENDING_READY] = {"xPendingReadyList", false},
+	[SYM_FREERTOS_DELAYED_LIST1] = {"xDelayedTaskList1", false},
+	[SYM_FREERTOS_DELAYED_LIST2] = {"xDelayedTaskList2", false},
+	/* left out by builds without vTaskSuspend() or vTaskDelete() */
+	[SYM_FREERTOS_SUSPENDED] = {"xSuspendedTaskList", true},
+	[SYM_FREERTOS_TERMINATION] = {"xTasksWaitingTermination", true},
+	/* kept by FreeRTOS for debuggers, it sizes pxReadyTasksLists */
+	[SYM_FREERTOS_TOP_PRIORITY] = {"uxTopUsedPriority", false},
+	/* built with CONFIG_DEBUG_THREAD_INFO */
+	[SYM_ZEPHYR_KERNEL] = {"_kernel", false},
+	[SYM_ZEPHYR_OFFSETS] = {"_kernel_thread_info_offsets", false},
+	[SYM_ZEPHYR_OFFSET_COUNT] = {"_kernel_thread_info_num_offsets", false},
+	[SYM_THREADX_CURRENT] = {"_tx_thread_current_ptr", false},
+	[SYM_THREADX_CREATED] = {"_tx_thread_created_ptr", false},
+	[SYM_THREADX_CREATED_COUNT] = {"_tx_thread_created_count", false},
+};
+
+typedef enum rtos_thread_state {
+	THREAD_READY,
+	THREAD_BLOCKED,
+	THREAD_SUSPENDED,
+	THREAD_DELETED,
+	THREAD_UNKNOWN,
+} rtos_thread_state_e;
+
+static const char *const rtos_state_names[] = {
+	[THREAD_READY] = "Ready",
+	[THREAD_BLOCKED] = "Blocked",
+	[THREAD_SUSPENDED] = "Suspended",
+	[THREAD_DELETED] = "Deleted",
+	[THREAD_UNKNOWN] = "Unknown",
+};
+
+typedef struct rtos_thread {
+	uint32_t id;             /* control block address, the thread-id GDB is given */
+	target_addr_t stack;     /* saved stack pointer */
+	target_addr_t name_addr; /* name read on first use, 0 once it is in name */
+	int32_t priority;
+	rtos_thread_state_e state;
+	char name[GDB_RTOS_NAME_LEN + 1U];
+} rtos_thread_s;
+
+typedef struct rtos_driver {
+	const char *name;
+	rtos_symbol_e first_symbol;
+	rtos_symbol_e last_symbol;
+	/* control block of the thread the core is running, 0 for none */
+	bool (*current)(target *t, uint32_t *current);
+	/* add the threads with rtos_thread_add() */
+	bool (*list)(target *t);
+	bool (*context)(target *t, const rtos_thread_s *thread, uint32_t *regs);
+} rtos_driver_s;
+
+bool gdb_rtos_enabled = true;
+
+static target_addr_t symbol_addr[SYM_COUNT];
+static size_t symbol_next;
+static const rtos_driver_s *rtos;
+
+/* read out of the kernel once per lookup of its symbols, these do not change as it runs */
+static uint32_t freertos_priorities;
+static bool zephyr_offsets_read;
+
+/* the thread list of this halt */
+static bool threads_valid;
+static bool current_valid;
+static uint32_t current_thread;
+static size_t thread_count;
+static size_t thread_iter;
+static rtos_thread_s threads[GDB_RTOS_MAX_THREADS];
+
+/* the thread Hg selected, 0 for the one running, and its registers once read */
+static uint32_t selected_thread;
+static bool context_valid;
+static bool context_read;
+static uint32_t context[RTOS_CONTEXT_REGS];
+
+static struct {
+	uint32_t reads;
+	uint32_t ms;
+} list_stats;
+
+static uint32_t rtos_get32(const uint8_t *const data, const size_t offset)
+{
+	return data[offset] | (data[offset + 1U] << 8U) | (data[offset + 2U] << 16U) |
+		((uint32_t)data[offset + 3U] << 24U);
+}
+
+static bool rtos_read(target *const t, void *const dest, const target_addr_t src, const size_t len)
+{
+	++list_stats.reads;
+	return !target_mem_read(t, dest, src, len);
+}
+
+static bool rtos_read32(target *const t, const target_addr_t addr, uint32_t *const value)
+{
+	uint8_t data[4];
+	if (!rtos_read(t, data, addr, sizeof(data)))
+		return false;
+	*value = rtos_get32(data, 0);
+	return true;
+}
+
+typedef struct rtos_span {
+	target_addr_t addr;
+	size_t len;
+	uint8_t *data;
+} rtos_span_s;
+
+/* Read the spans as one block when they lie close together, each on its own otherwise */
+static bool rtos_read_spans(target *const t, const rtos_span_s *const spans, const size_t count)
+{
+	if (!count)
+		return true;
+	target_addr_t low = UINT32_MAX;
+	target_addr_t high = 0;
+	for (size_t i = 0; i < count; ++i) {
+		low = MIN(low, spans[i].addr);
+		high = MAX(high, spans[i].addr + spans[i].len);
+	}
+	if (high - low <= GDB_RTOS_SPAN_MAX) {
+		uint8_t block[GDB_RTOS_SPAN_MAX];
+		if (!rtos_read(t, block, low, high - low))
+			return false;
+		for (size_t i = 0; i < count; ++i)
+			memcpy(spans[i].data, block + (spans[i].addr - low), spans[i].len);
+		return true;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (!rtos_read(t, spans[i].data, spans[i].addr, spans[i].len))
+			return false;
+	}
+	return true;
+}
+
+/* NULL once the list is full, so walks stop */
+static rtos_thread_s *rtos_thread_add(const uint32_t id, const rtos_thread_state_e state)
+{
+	if (thread_count == GDB_RTOS_MAX_THREADS)
+		return NULL;
+	rtos_thread_s *const thread = &threads[thread_count++];
+	memset(thread, 0, sizeof(*thread));
+	thread->id = id;
+	thread->state = state;
+	return thread;
+}
+
+static void rtos_thread_name(rtos_thread_s *const thread, const uint8_t *const name, const size_t max)
+{
+	size_t len = 0;
+	while (len < MIN(max, GDB_RTOS_NAME_LEN) && name[len])
+		++len;
+	memcpy(thread->name, name, len);
+	thread->name[len] = '\0';
+}
+
+/*
+ * r0-r3, r12, lr, pc and xpsr as the core stacks them on exception entry, at addr.
+ * Returns the stack pointer from before the exception.
+ */
+static target_addr_t rtos_hw_frame(
+	const uint8_t *const frame, const target_addr_t addr, const bool fp_frame, uint32_t *const regs)
+{
+	static const uint8_t hw_regs[RTOS_HW_FRAME_WORDS] = {0, 1, 2, 3, 12, 14, 15, 16};
+	for (size_t i = 0; i < RTOS_HW_FRAME_WORDS; ++i)
+		regs[hw_regs[i]] = rtos_get32(frame, i * 4U);
+	target_addr_t sp = addr + RTOS_HW_FRAME_WORDS * 4U;
+	if (fp_frame)
+		sp += RTOS_HW_FP_FRAME_WORDS * 4U;
+	if (regs[RTOS_REG_XPSR] & RTOS_XPSR_STACK_ALIGNED)
+		sp += 4U;
+	return sp;
+}
+
+/*
+ * Context a switched out thread left on its stack at top: r4-r11 then the hardware frame,
+ * FPU ports putting EXC_RETURN and, if the FPU was in use, s16-s31 in between. With
+ * exc_return_first, EXC_RETURN and s16-s31 come ahead of r4-r11 instead.
+ */
+static bool rtos_stacked_context(
+	target *const t, const target_addr_t top, const bool exc_return_first, uint32_t *const regs)
+{
+	uint8_t frame[RTOS_FRAME_MAX_WORDS * 4U];
+	size_t words = RTOS_FRAME_MAX_WORDS;
+	/* A thread that never ran has its frame right at the end of its stack, which may be the end of RAM */
+	if (!rtos_read(t, frame, top, sizeof(frame))) {
+		words = RTOS_FRAME_MIN_WORDS;
+		if (!rtos_read(t, frame, top, words * 4U))
+			return false;
+	}
+	const size_t exc_return_pos = exc_return_first ? 0U : RTOS_CALLEE_WORDS;
+	const uint32_t exc_return = rtos_get32(frame, exc_return_pos * 4U);
+	const bool has_exc_return = (exc_return & RTOS_EXC_RETURN_MASK) == RTOS_EXC_RETURN_MASK;
+	const bool fp_frame = has_exc_return && !(exc_return & RTOS_EXC_RETURN_STD_FRAME);
+	const size_t extra = has_exc_return ? 1U + (fp_frame ? RTOS_CALLEE_FP_WORDS : 0U) : 0U;
+	const size_t callee = exc_return_first ? extra : 0U;
+	const size_t hw_frame = RTOS_CALLEE_WORDS + extra;
+	if (hw_frame + RTOS_HW_FRAME_WORDS > words)
+		return false;
+	for (size_t i = 0; i < RTOS_CALLEE_WORDS; ++i)
+		regs[RTOS_REG_R4 + i] = rtos_get32(frame, (callee + i) * 4U);
+	regs[RTOS_REG_SP] = rtos_hw_frame(frame + hw_frame * 4U, top + hw_frame * 4U, fp_frame, regs);
+	return true;
+}
+
+/*********************************************************************
+ *
+ *       FreeRTOS
+ *
+ *********************************************************************
+ */
+
+/* 32 bit ports without configUSE_LIST_DATA_INTEGRITY_CHECK_BYTES */
+#define FREERTOS_LIST_SIZE       20U
+#define FREERTOS_LIST_ITEMS      0U  /* uxNumberOfItems */
+#define FREERTOS_LIST_END        8U  /* xListEnd, the list's own item */
+#define FREERTOS_LIST_FIRST      12U /* xListEnd.pxNext */
+#define FREERTOS_ITEM_NEXT       4U
+#define FREERTOS_ITEM_OWNER      12U
+/* pxTopOfStack, then xStateListItem, in ports without MPU wrappers */
+#define FREERTOS_TCB_STATE_ITEM  4U
+#define FREERTOS_TCB_PRIORITY    44U
+#define FREERTOS_TCB_NAME        52U
+#define FREERTOS_TCB_READ        (FREERTOS_TCB_NAME + GDB_RTOS_NAME_LEN)
+#define FREERTOS_MAX_PRIORITIES  256U
+#define FREERTOS_LIST_PER_READ   (GDB_RTOS_SPAN_MAX / FREERTOS_LIST_SIZE)
+
+static bool freertos_current(target *const t, uint32_t *const current)
+{
+	return rtos_read32(t, symbol_addr[SYM_FREERTOS_CURRENT_TCB], current);
+}
+
+static bool freertos_walk(target *const t, const target_addr_t list, const uint8_t *const header,
+	const rtos_thread_state_e state)
+{
+	uint32_t items = rtos_get32(header, FREERTOS_LIST_ITEMS);
+	target_addr_t item = rtos_get32(header, FREERTOS_LIST_FIRST);
+	for (; items && item != list + FREERTOS_LIST_END; --items) {
+		const target_addr_t tcb_addr = item - FREERTOS_TCB_STATE_ITEM;
+		uint8_t tcb[FREERTOS_TCB_READ];
+		if (!rtos_read(t, tcb, tcb_addr, sizeof(tcb)))
+			return false;
+		if (rtos_get32(tcb, FREERTOS_TCB_STATE_ITEM + FREERTOS_ITEM_OWNER) != tcb_addr) {
+			DEBUG_WARN("FreeRTOS: task control block at 0x%08" PRIx32 " not laid out as expected\n", tcb_addr);
+			return false;
+		}
+		rtos_thread_s *const thread = rtos_thread_add(tcb_addr, state);
+		if (!thread)
+			return true;
+		thread->stack = rtos_get32(tcb, 0);
+		thread->priority = (int32_t)rtos_get32(tcb, FREERTOS_TCB_PRIORITY);
+		rtos_thread_name(thread, tcb + FREERTOS_TCB_NAME, GDB_RTOS_NAME_LEN);
+		item = rtos_get32(tcb, FREERTOS_TCB_STATE_ITEM + FREERTOS_ITEM_NEXT);
+	}
+	return true;
+}
+
+static bool freertos_list(target *const t)
+{
+	if (!freertos_priorities) {
+		uint32_t top_priority;
+		if (!rtos_read32(t, symbol_addr[SYM_FREERTOS_TOP_PRIORITY], &top_priority))
+			return false;
+		if (top_priority >= FREERTOS_MAX_PRIORITIES) {
+			DEBUG_WARN("FreeRTOS: uxTopUsedPriority of %" PRIu32 " is not plausible\n", top_priority);
+			return false;
+		}
+		freertos_priorities = top_priority + 1U;
+	}
+
+	/* The ready lists, highest priority first, in blocks of as many as fit a read */
+	for (uint32_t end = freertos_priorities; end;) {
+		const uint32_t begin = end > FREERTOS_LIST_PER_READ ? end - FREERTOS_LIST_PER_READ : 0U;
+		const target_addr_t base = symbol_addr[SYM_FREERTOS_READY_LISTS] + begin * FREERTOS_LIST_SIZE;
+		uint8_t lists[FREERTOS_LIST_PER_READ * FREERTOS_LIST_SIZE];
+		if (!rtos_read(t, lists, base, (end - begin) * FREERTOS_LIST_SIZE))
+			return false;
+		for (uint32_t priority = end; priority-- > begin;) {
+			const size_t offset = (priority - begin) * FREERTOS_LIST_SIZE;
+			if (!freertos_walk(t, base + offset, lists + offset, THREAD_READY))
+				return false;
+		}
+		end = begin;
+	}
+
+	static const struct {
+		rtos_symbol_e symbol;
+		rtos_thread_state_e state;
+	} other_lists[] = {
+		{SYM_FREERTOS_PENDING_READY, THREAD_READY},
+		{SYM_FREERTOS_DELAYED_LIST1, THREAD_BLOCKED},
+		{SYM_FREERTOS_DELAYED_LIST2, THREAD_BLOCKED},
+		/* tasks blocked without a timeout are kept with the suspended ones */
+		{SYM_FREERTOS_SUSPENDED, THREAD_SUSPENDED},
+		{SYM_FREERTOS_TERMINATION, THREAD_DELETED},
+	};
+	uint8_t headers[ARRAY_LENGTH(other_lists)][FREERTOS_LIST_SIZE];
+	rtos_span_s spans[ARRAY_LENGTH(other_lists)];
+	size_t span_count = 0;
+	for (size_t i = 0; i < ARRAY_LENGTH(other_lists); ++i) {
+		if (!symbol_addr[other_lists[i].symbol])
+			continue;
+		spans[span_count].addr = symbol_addr[other_lists[i].symbol];
+		spans[span_count].len = FREERTOS_LIST_SIZE;
+		spans[span_count++].data = headers[i];
+	}
+	if (!rtos_read_spans(t, spans, span_count))
+		return false;
+	for (size_t i = 0; i < ARRAY_LENGTH(other_lists); ++i) {
+		const target_addr_t list = symbol_addr[other_lists[i].symbol];
+		if (list && !freertos_walk(t, list, headers[i], other_lists[i].state))
+			return false;
+	}
+	return true;
+}
+
+/* ARM_CM0, ARM_CM3, ARM_CM4F and ARM_CM7 ports stack r4-r11, then EXC_RETURN if they have an FPU */
+static bool freertos_context(target *const t, const rtos_thread_s *const thread, uint32_t *const regs)
+{
+	return rtos_stacked_context(t, thread->stack, false, regs);
+}
+
+/*********************************************************************
+ *
+ *       Zephyr
+ *
+ *********************************************************************
+ */
+
+/* Indices into _kernel_thread_info_offsets, as subsys/debug/thread_info.c has them */
+#define ZEPHYR_OFFSET_VERSION     0U
+#define ZEPHYR_OFFSET_CURRENT     1U
+#define ZEPHYR_OFFSET_THREADS     2U
+#define ZEPHYR_OFFSET_NEXT_THREAD 4U
+#define ZEPHYR_OFFSET_STATE       5U
+#define ZEPHYR_OFFSET_PRIO        7U
+#define ZEPHYR_OFFSET_STACK_PTR   8U /* callee_saved.psp, right after r4-r11 */
+#define ZEPHYR_OFFSET_NAME        9U
+#define ZEPHYR_OFFSET_COUNT       10U
+#define ZEPHYR_UNIMPLEMENTED      0xffffffffU
+
+#define ZEPHYR_THREAD_PENDING   0x02U
+#define ZEPHYR_THREAD_PRESTART  0x04U
+#define ZEPHYR_THREAD_DEAD      0x08U
+#define ZEPHYR_THREAD_SUSPENDED 0x10U
+
+#define ZEPHYR_NAME_SIZE 32U
+
+static uint32_t zephyr_offsets[ZEPHYR_OFFSET_COUNT];
+
+static bool zephyr_read_offsets(target *const t)
+{
+	if (zephyr_offsets_read)
+		return true;
+	uint32_t count;
+	if (!rtos_read32(t, symbol_addr[SYM_ZEPHYR_OFFSET_COUNT], &count))
+		return false;
+	if (count < ZEPHYR_OFFSET_COUNT) {
+		DEBUG_WARN("Zephyr: %" PRIu32 " thread info offsets are too few\n", count);
+		return false;
+	}
+	uint8_t data[ZEPHYR_OFFSET_COUNT * 4U];
+	if (!rtos_read(t, data, symbol_addr[SYM_ZEPHYR_OFFSETS], sizeof(data)))
+		return false;
+	for (size_t i = 0; i < ZEPHYR_OFFSET_COUNT; ++i)
+		zephyr_offsets[i] = rtos_get32(data, i * 4U);
+	const uint32_t required[] = {ZEPHYR_OFFSET_CURRENT, ZEPHYR_OFFSET_THREADS, ZEPHYR_OFFSET_NEXT_THREAD,
+		ZEPHYR_OFFSET_STATE, ZEPHYR_OFFSET_PRIO, ZEPHYR_OFFSET_STACK_PTR};
+	for (size_t i = 0; i < ARRAY_LENGTH(required); ++i) {
+		if (zephyr_offsets[required[i]] == ZEPHYR_UNIMPLEMENTED || zephyr_offsets[required[i]] > 0xffffU) {
+			DEBUG_WARN("Zephyr: no thread list, is CONFIG_THREAD_MONITOR set?\n");
+			return false;
+		}
+	}
+	zephyr_offsets_read = true;
+	return true;
+}
+
+static bool zephyr_current(target *const t, uint32_t *const current)
+{
+	if (!zephyr_read_offsets(t))
+		return false;
+	return rtos_read32(t, symbol_addr[SYM_ZEPHYR_KERNEL] + zephyr_offsets[ZEPHYR_OFFSET_CURRENT], current);
+}
+
+static bool zephyr_list(target *const t)
+{
+	if (!zephyr_read_offsets(t))
+		return false;
+	target_addr_t addr;
+	if (!rtos_read32(t, symbol_addr[SYM_ZEPHYR_KERNEL] + zephyr_offsets[ZEPHYR_OFFSET_THREADS], &addr))
+		return false;
+
+	/* The fields of k_thread listed, read together when they are close enough */
+	const uint32_t next = zephyr_offsets[ZEPHYR_OFFSET_NEXT_THREAD];
+	const uint32_t state = zephyr_offsets[ZEPHYR_OFFSET_STATE];
+	const uint32_t prio = zephyr_offsets[ZEPHYR_OFFSET_PRIO];
+	const uint32_t name = zephyr_offsets[ZEPHYR_OFFSET_NAME];
+	const bool has_name = name != ZEPHYR_UNIMPLEMENTED;
+	uint32_t low = MIN(next, MIN(state, prio));
+	uint32_t high = MAX(next + 4U, MAX(state, prio) + 1U);
+	/* A name too far from the rest is read on its own, when first asked for */
+	const bool name_read =
+		has_name && MAX(high, name + GDB_RTOS_NAME_LEN) - MIN(low, name) <= GDB_RTOS_SPAN_MAX;
+	if (name_read) {
+		low = MIN(low, name);
+		high = MAX(high, name + GDB_RTOS_NAME_LEN);
+	}
+	if (high - low > GDB_RTOS_SPAN_MAX) {
+		DEBUG_WARN("Zephyr: k_thread layout not supported\n");
+		return false;
+	}
+
+	while (addr) {
+		uint8_t fields[GDB_RTOS_SPAN_MAX];
+		if (!rtos_read(t, fields, addr + low, high - low))
+			return false;
+		const uint8_t thread_state = fields[state - low];
+		rtos_thread_state_e rtos_state = THREAD_READY;
+		if (thread_state & ZEPHYR_THREAD_DEAD)
+			rtos_state = THREAD_DELETED;
+		else if (thread_state & ZEPHYR_THREAD_SUSPENDED)
+			rtos_state = THREAD_SUSPENDED;
+		else if (thread_state & (ZEPHYR_THREAD_PENDING | ZEPHYR_THREAD_PRESTART))
+			rtos_state = THREAD_BLOCKED;
+		rtos_thread_s *const thread = rtos_thread_add(addr, rtos_state);
+		if (!thread)
+			return true;
+		thread->priority = (int8_t)fields[prio - low];
+		if (name_read)
+			rtos_thread_name(thread, fields + (name - low), ZEPHYR_NAME_SIZE);
+		else if (has_name)
+			thread->name_addr = addr + name;
+		addr = rtos_get32(fields, next - low);
+	}
+	return true;
+}
+
+/* r4-r11 and psp are kept in the thread, the hardware frame is on its stack */
+static bool zephyr_context(target *const t, const rtos_thread_s *const thread, uint32_t *const regs)
+{
+	uint8_t callee[(RTOS_CALLEE_WORDS + 1U) * 4U];
+	const target_addr_t callee_addr =
+		thread->id + zephyr_offsets[ZEPHYR_OFFSET_STACK_PTR] - RTOS_CALLEE_WORDS * 4U;
+	if (!rtos_read(t, callee, callee_addr, sizeof(callee)))
+		return false;
+	for (size_t i = 0; i < RTOS_CALLEE_WORDS; ++i)
+		regs[RTOS_REG_R4 + i] = rtos_get32(callee, i * 4U);
+	const target_addr_t psp = rtos_get32(callee, RTOS_CALLEE_WORDS * 4U);
+	uint8_t frame[RTOS_HW_FRAME_WORDS * 4U];
+	if (!rtos_read(t, frame, psp, sizeof(frame)))
+		return false;
+	regs[RTOS_REG_SP] = rtos_hw_frame(frame, psp, false, regs);
+	return true;
+}
+
+/*********************************************************************
+ *
+ *       ThreadX
+ *
+ *********************************************************************
+ */
+
+/* TX_THREAD as the Cortex-M ports lay it out */
+#define THREADX_THREAD_ID           0x54485244U /* "THRD" */
+#define THREADX_THREAD_STACK_PTR    8U
+#define THREADX_THREAD_NAME         40U
+#define THREADX_THREAD_PRIORITY     44U
+#define THREADX_THREAD_STATE        48U
+#define THREADX_THREAD_CREATED_NEXT 136U
+#define THREADX_THREAD_READ         (THREADX_THREAD_CREATED_NEXT + 4U)
+
+#define THREADX_READY      0U
+#define THREADX_COMPLETED  1U
+#define THREADX_TERMINATED 2U
+#define THREADX_SUSPENDED  3U
+
+static bool threadx_current(target *const t, uint32_t *const current)
+{
+	return rtos_read32(t, symbol_addr[SYM_THREADX_CURRENT], current);
+}
+
+static bool threadx_list(target *const t)
+{
+	uint8_t created[4];
+	uint8_t created_count[4];
+	const rtos_span_s spans[] = {
+		{symbol_addr[SYM_THREADX_CREATED], sizeof(created), created},
+		{symbol_addr[SYM_THREADX_CREATED_COUNT], sizeof(created_count), created_count},
+	};
+	if (!rtos_read_spans(t, spans, ARRAY_LENGTH(spans)))
+		return false;
+	const target_addr_t first = rtos_get32(created, 0);
+	target_addr_t addr = first;
+	/* The created list is circular */
+	for (uint32_t count = rtos_get32(created_count, 0); addr && count; --count) {
+		uint8_t tx_thread[THREADX_THREAD_READ];
+		if (!rtos_read(t, tx_thread, addr, sizeof(tx_thread)))
+			return false;
+		if (rtos_get32(tx_thread, 0) != THREADX_THREAD_ID) {
+			DEBUG_WARN("ThreadX: no thread at 0x%08" PRIx32 "\n", addr);
+			return false;
+		}
+		const uint32_t state = rtos_get32(tx_thread, THREADX_THREAD_STATE);
+		rtos_thread_state_e rtos_state = THREAD_BLOCKED;
+		if (state == THREADX_READY)
+			rtos_state = THREAD_READY;
+		else if (state == THREADX_COMPLETED || state == THREADX_TERMINATED)
+			rtos_state = THREAD_DELETED;
+		else if (state == THREADX_SUSPENDED)
+			rtos_state = THREAD_SUSPENDED;
+		rtos_thread_s *const thread = rtos_thread_add(addr, rtos_state);
+		if (!thread)
+			return true;
+		thread->stack = rtos_get32(tx_thread, THREADX_THREAD_STACK_PTR);
+		thread->priority = (int32_t)rtos_get32(tx_thread, THREADX_THREAD_PRIORITY);
+		/* The name is a pointer, it is only followed when GDB asks for it */
+		thread->name_addr = rtos_get32(tx_thread, THREADX_THREAD_NAME);
+		addr = rtos_get32(tx_thread, THREADX_THREAD_CREATED_NEXT);
+		if (addr == first)
+			break;
+	}
+	return true;
+}
+
+/* The Cortex-M ports stack EXC_RETURN and, if the FPU was in use, s16-s31 ahead of r4-r11 */
+static bool threadx_context(target *const t, const rtos_thread_s *const thread, uint32_t *const regs)
+{
+	return rtos_stacked_context(t, thread->stack, true, regs);
+}
+
+static const rtos_driver_s rtos_drivers[] = {
+	{"FreeRTOS", SYM_FREERTOS_CURRENT_TCB, SYM_FREERTOS_TOP_PRIORITY, freertos_current, freertos_list,
+		freertos_context},
+	{"Zephyr", SYM_ZEPHYR_KERNEL, SYM_ZEPHYR_OFFSET_COUNT, zephyr_current, zephyr_list, zephyr_context},
+	{"ThreadX", SYM_THREADX_CURRENT, SYM_THREADX_CREATED_COUNT, threadx_current, threadx_list, threadx_context},
+};
+
+/*********************************************************************
+ *
+ *       threads
+ *
+ *********************************************************************
+ */
+
+/* Thread contexts are decoded the way the ARMv6-M and ARMv7-M ports stack them */
+static bool rtos_core_supported(target *const t)
+{
+	static const char *const cores[] = {"M0", "M0+", "M3", "M4", "M7"};
+	const char *const core = target_core_name(t);
+	if (!core)
+		return false;
+	for (size_t i = 0; i < ARRAY_LENGTH(cores); ++i) {
+		if (!strcmp(core, cores[i]))
+			return true;
+	}
+	return false;
+}
+
+static bool rtos_active(target *const t)
+{
+	return gdb_rtos_enabled && rtos && t && rtos_core_supported(t);
+}
+
+void gdb_rtos_invalidate(void)
+{
+	threads_valid = false;
+	current_valid = false;
+	selected_thread = 0;
+	context_valid = false;
+}
+
+uint32_t gdb_rtos_current_thread(target *const t)
+{
+	if (!rtos_active(t))
+		return GDB_RTOS_NO_THREAD;
+	if (!current_valid) {
+		if (!rtos->current(t, &current_thread) || !current_thread)
+			current_thread = GDB_RTOS_NO_THREAD;
+		current_valid = true;
+	}
+	return current_thread;
+}
+
+static rtos_thread_s *rtos_find(const uint32_t id)
+{
+	for (size_t i = 0; i < thread_count; ++i) {
+		if (threads[i].id == id)
+			return &threads[i];
+	}
+	return NULL;
+}
+
+/* The thread list always holds the thread the core runs, the core itself if no RTOS thread is */
+static void rtos_threads_read(target *const t)
+{
+	if (threads_valid)
+		return;
+	threads_valid = true;
+	thread_count = 0;
+	const uint32_t current = gdb_rtos_current_thread(t);
+	if (!rtos_active(t)) {
+		rtos_thread_add(GDB_RTOS_NO_THREAD, THREAD_READY);
+		return;
+	}
+	const uint32_t start_time = platform_time_ms();
+	list_stats.reads = 0;
+	if (!rtos->list(t)) {
+		DEBUG_WARN("%s: thread list could not be read\n", rtos->name);
+		thread_count = 0;
+	}
+	list_stats.ms = platform_time_ms() - start_time;
+	if (thread_count == GDB_RTOS_MAX_THREADS)
+		DEBUG_WARN("%s: only the first %u threads are listed\n", rtos->name, GDB_RTOS_MAX_THREADS);
+	if (!rtos_find(current)) {
+		if (thread_count == GDB_RTOS_MAX_THREADS)
+			--thread_count;
+		memmove(threads + 1U, threads, thread_count * sizeof(*threads));
+		++thread_count;
+		memset(threads, 0, sizeof(*threads));
+		threads[0].id = current;
+		threads[0].state = THREAD_UNKNOWN;
+	}
+}
+
+bool gdb_rtos_thread_alive(target *const t, const uint32_t thread_id)
+{
+	if (thread_id == 0 || thread_id == UINT32_MAX)
+		return true;
+	rtos_threads_read(t);
+	return rtos_find(thread_id) != NULL;
+}
+
+bool gdb_rtos_select(target *const t, const uint32_t thread_id)
+{
+	if (!gdb_rtos_thread_alive(t, thread_id))
+		return false;
+	const uint32_t thread = thread_id == 0 || thread_id == UINT32_MAX ? 0 : thread_id;
+	/* The thread the core runs has the live registers */
+	selected_thread = thread == gdb_rtos_current_thread(t) ? 0 : thread;
+	context_valid = false;
+	return true;
+}
+
+bool gdb_rtos_thread_selected(void)
+{
+	return selected_thread != 0;
+}
+
+static bool rtos_context(target *const t)
+{
+	if (!context_valid) {
+		const rtos_thread_s *const thread = rtos_find(selected_thread);
+		context_read = thread && rtos->context(t, thread, context);
+		context_valid = true;
+	}
+	return context_read;
+}
+
+static size_t rtos_hex_reg(char *const hex, const uint32_t *const value, const size_t size)
+{
+	if (value)
+		hexify(hex, value, size);
+	else
+		memset(hex, 'x', size * 2U);
+	return size * 2U;
+}
+
+size_t gdb_rtos_thread_regs(target *const t, char *const hex, const size_t max)
+{
+	const bool read = rtos_context(t);
+	const size_t size = MIN(target_regs_size(t), max / 2U);
+	const size_t known = read ? MIN(size, sizeof(context)) : 0;
+	hexify(hex, context, known);
+	memset(hex + known * 2U, 'x', (size - known) * 2U);
+	return size * 2U;
+}
+
+size_t gdb_rtos_thread_reg(target *const t, const uint32_t reg, char *const hex)
+{
+	uint8_t val[8];
+	const ssize_t size = target_reg_read(t, reg, val, sizeof(val));
+	if (size <= 0)
+		return 0;
+	const bool read = rtos_context(t);
+	return rtos_hex_reg(hex, read && reg < RTOS_CONTEXT_REGS ? &context[reg] : NULL, size);
+}
+
+/*********************************************************************
+ *
+ *       packets
+ *
+ *********************************************************************
+ */
+
+static void rtos_symbol_request(void)
+{
+	if (symbol_next == SYM_COUNT) {
+		gdb_putpacketz("OK");
+		return;
+	}
+	const char *const name = rtos_symbols[symbol_next].name;
+	char reply[8U + 2U * 32U + 1U];
+	const size_t len = strlen(name);
+	memcpy(reply, "qSymbol:", 8U);
+	hexify(reply + 8U, name, len);
+	gdb_putpacket(reply, 8U + len * 2U);
+}
+
+/* The RTOS whose symbols are all known, the first of them if several are */
+static const rtos_driver_s *rtos_from_symbols(void)
+{
+	for (size_t i = 0; i < ARRAY_LENGTH(rtos_drivers); ++i) {
+		const rtos_driver_s *const driver = &rtos_drivers[i];
+		bool found = true;
+		for (size_t sym = driver->first_symbol; sym <= driver->last_symbol; ++sym)
+			found &= symbol_addr[sym] || rtos_symbols[sym].optional;
+		if (found)
+			return driver;
+	}
+	return NULL;
+}
+
+/*
+ * qSymbol:: is sent by GDB once it has loaded symbols, to which we reply with the first symbol we
+ * want, "qSymbol:name". It answers "qSymbol:value:name", or "qSymbol::name" when it has no such
+ * symbol, and we ask for the next until there are none left, then reply OK.
+ */
+static void rtos_symbol_packet(const char *const packet)
+{
+	if (!gdb_rtos_enabled) {
+		gdb_putpacketz("OK");
+		return;
+	}
+	const char *const name = strchr(packet, ':');
+	if (!name) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	if (packet[0] == ':' && name[1] == '\0') {
+		/* A new lookup, GDB has loaded another program */
+		memset(symbol_addr, 0, sizeof(symbol_addr));
+		symbol_next = 0;
+		rtos = NULL;
+		freertos_priorities = 0;
+		zephyr_offsets_read = false;
+		gdb_rtos_invalidate();
+		rtos_symbol_request();
+		return;
+	}
+	if (symbol_next < SYM_COUNT) {
+		const char *const expected = rtos_symbols[symbol_next].name;
+		const size_t len = strlen(name + 1);
+		char reply_name[33];
+		if (len == strlen(expected) * 2U && len < sizeof(reply_name) * 2U) {
+			unhexify(reply_name, name + 1, len / 2U);
+			reply_name[len / 2U] = '\0';
+			if (!strcmp(reply_name, expected) && packet[0] != ':')
+				symbol_addr[symbol_next] = strtoul(packet, NULL, 16);
+		}
+		++symbol_next;
+	}
+	if (symbol_next == SYM_COUNT) {
+		rtos = rtos_from_symbols();
+		if (rtos)
+			DEBUG_INFO("RTOS: %s\n", rtos->name);
+		gdb_rtos_invalidate();
+	}
+	rtos_symbol_request();
+}
+
+/*
+ * qfThreadInfo starts the thread list and qsThreadInfo continues it, until 'l' ends it. GDB 11 and 12
+ * need this even when there's only the possibility for one thread to exist, they are given
+ * GDB_RTOS_NO_THREAD so they don't think the "thread" died.
+ */
+static void rtos_thread_info(target *const t, const bool first)
+{
+	if (first) {
+		rtos_threads_read(t);
+		thread_iter = 0;
+	}
+	if (thread_iter >= thread_count) {
+		gdb_putpacketz("l");
+		return;
+	}
+	char reply[1U + GDB_RTOS_IDS_PER_REPLY * 9U + 1U];
+	size_t len = 0;
+	for (size_t i = 0; i < GDB_RTOS_IDS_PER_REPLY && thread_iter < thread_count; ++i, ++thread_iter)
+		len += snprintf(reply + len, sizeof(reply) - len, "%c%" PRIx32, i ? ',' : 'm', threads[thread_iter].id);
+	gdb_putpacket(reply, len);
+}
+
+static void rtos_thread_extra_info(target *const t, const char *const packet)
+{
+	const uint32_t thread_id = strtoul(packet, NULL, 16);
+	rtos_threads_read(t);
+	rtos_thread_s *const thread = rtos_find(thread_id);
+	if (!thread) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	if (thread->name_addr) {
+		uint8_t name[GDB_RTOS_NAME_LEN];
+		if (rtos_read(t, name, thread->name_addr, sizeof(name)))
+			rtos_thread_name(thread, name, sizeof(name));
+		thread->name_addr = 0;
+	}
+	char info[GDB_RTOS_NAME_LEN + 48U];
+	const char *const state = thread_id == gdb_rtos_current_thread(t) ? "Running" : rtos_state_names[thread->state];
+	size_t len;
+	if (thread_id == GDB_RTOS_NO_THREAD)
+		len = snprintf(info, sizeof(info), "No %s thread", rtos->name);
+	else
+		len = snprintf(info, sizeof(info), "%s, %s, priority %" PRId32, thread->name[0] ? thread->name : "(no name)",
+			state, thread->priority);
+	len = MIN(len, sizeof(info) - 1U);
+	char hex[sizeof(info) * 2U];
+	gdb_putpacket(hexify(hex, info, len), len * 2U);
+}
+
+bool gdb_rtos_packet(target *const t, const char *const packet, const size_t len)
+{
+	(void)len;
+	if (!strncmp(packet, "qSymbol:", 8U))
+		rtos_symbol_packet(packet + 8U);
+	else if (!strcmp(packet, "qfThreadInfo"))
+		rtos_thread_info(t, true);
+	else if (!strcmp(packet, "qsThreadInfo"))
+		rtos_thread_info(t, false);
+	else if (!strcmp(packet, "qC"))
+		/* GDB 11 and 12 need this even without threads */
+		gdb_putpacket_f("QC%" PRIx32, gdb_rtos_current_thread(t));
+	else if (!strncmp(packet, "qThreadExtraInfo,", 17U) && rtos_active(t))
+		rtos_thread_extra_info(t, packet + 17U);
+	else
+		return false;
+	return true;
+}
+
+void gdb_rtos_status(void)
+{
+	if (!gdb_rtos_enabled) {
+		gdb_out("RTOS awareness disabled\n");
+		return;
+	}
+	if (!rtos) {
+		gdb_out("No RTOS found in the symbols GDB looked up\n");
+		return;
+	}
+	gdb_outf("RTOS: %s", rtos->name);
+	if (threads_valid)
+		gdb_outf(", %u threads listed with %" PRIu32 " reads in %" PRIu32 " ms", (unsigned)thread_count,
+			list_stats.reads, list_stats.ms);
+	gdb_out("\n");
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GDB_RTOS_H
+#define GDB_RTOS_H
+
+#include "target.h"
+
+/* the thread-id of the core itself, while no RTOS thread is running on it */
+#define GDB_RTOS_NO_THREAD 1U
+
+/* RTOS awareness, on unless turned off with "monitor rtos disable" */
+extern bool gdb_rtos_enabled;
+
+/* handle a qSymbol, qfThreadInfo, qsThreadInfo, qThreadExtraInfo or qC packet, false if it is not one */
+bool gdb_rtos_packet(target *t, const char *packet, size_t len);
+/* the thread list read is stale once the target runs or its memory is written */
+void gdb_rtos_invalidate(void);
+/* "monitor rtos" report of the RTOS found and the last thread list read */
+void gdb_rtos_status(void);
+
+/* thread the core was running when it stopped */
+uint32_t gdb_rtos_current_thread(target *t);
+/* thread_id names a thread, or is 0 or -1 for any thread */
+bool gdb_rtos_thread_alive(target *t, uint32_t thread_id);
+/* Hg: register reads come from the thread's saved context until the target resumes */
+bool gdb_rtos_select(target *t, uint32_t thread_id);
+
+/* a thread other than the one running is selected */
+bool gdb_rtos_thread_selected(void);
+/* 'g' reply for the selected thread into hex, registers it has not saved as 'x' */
+size_t gdb_rtos_thread_regs(target *t, char *hex, size_t max);
+/* 'p' reply for the selected thread into hex, 0 for no such register */
+size_t gdb_rtos_thread_reg(target *t, uint32_t reg, char *hex);
+
+#endif /* GDB_RTOS_H */
@@ -0,0 +1,609 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * GDB tracepoints, collected by the probe. Each tracepoint is a hardware
+ * breakpoint; when the target stops on one, the registers and memory ranges
+ * it collects are stored as a frame in the trace buffer and the target is
+ * resumed at once, without a round trip to GDB. Afterwards GDB selects
+ * frames with tfind (QTFrame), and register and memory reads are answered
+ * from the selected frame.
+ *
+ * Frames are packed in the trace buffer back to back: a 16 bit tracepoint
+ * number and a 16 bit frame size, then blocks of
+ *   'R', register count, then each register as its size and value
+ *   'M', 32 bit address, 16 bit length, then the bytes
+ * all little endian. While-stepping actions and trace state variables are not
+ * supported, and collection expressions ('X' actions) are accepted but not
+ * collected.
+ */
+
+#include "general.h"
+#include <ctype.h>
+#include "target.h"
+#include "hex_utils.h"
+#include "gdb_packet.h"
+#include "gdb_agent.h"
+#include "gdb_trace.h"
+
+#if PC_HOSTED == 1
+#define GDB_TRACE_BUF_SIZE (1024U * 1024U)
+#define GDB_TRACE_MAX_COND 1024U
+#else
+#define GDB_TRACE_BUF_SIZE 1024U
+#define GDB_TRACE_MAX_COND 64U
+#endif
+/* tracepoints take breakpoints, the FPB has no more than this */
+#define GDB_TRACE_MAX_TRACEPOINTS 8U
+#define GDB_TRACE_MAX_RANGES      4U
+#define GDB_TRACE_MAX_RANGE_LEN   8192U
+#define GDB_TRACE_MAX_REGS        64U
+/* GDB's basereg for a memory range at an absolute address */
+#define GDB_TRACE_ABSOLUTE 0xffffffffU
+
+#define GDB_TRACE_FRAME_HEADER 4U
+
+typedef struct gdb_trace_range {
+	uint32_t basereg;
+	uint32_t offset;
+	uint32_t len;
+} gdb_trace_range_s;
+
+typedef struct gdb_tracepoint {
+	uint32_t number;
+	target_addr_t addr;
+	bool enabled;
+	bool inserted; /* the breakpoint is ours, not one GDB set at the same place */
+	bool collect_regs;
+	uint32_t step_count;
+	uint32_t pass_count;
+	uint32_t hits;
+	uint32_t range_count;
+	gdb_trace_range_s range[GDB_TRACE_MAX_RANGES];
+	uint16_t cond_len;
+	uint8_t cond[GDB_TRACE_MAX_COND];
+} gdb_tracepoint_s;
+
+typedef enum gdb_trace_state {
+	TRACE_NOT_RUN,
+	TRACE_RUNNING,
+	TRACE_STOPPED,
+	TRACE_FULL,
+	TRACE_PASSCOUNT,
+} gdb_trace_state_e;
+
+static gdb_tracepoint_s tracepoints[GDB_TRACE_MAX_TRACEPOINTS];
+static size_t tracepoint_count;
+static size_t tracepoint_iter;
+
+static gdb_trace_state_e trace_state = TRACE_NOT_RUN;
+static uint32_t trace_stop_tracepoint;
+static uint8_t trace_buf[GDB_TRACE_BUF_SIZE];
+static size_t trace_used;
+static uint32_t trace_frames;
+
+static uint32_t frame_selected = UINT32_MAX;
+static size_t frame_offset;
+
+static uint32_t trace_get16(const uint8_t *const data)
+{
+	return data[0] | (data[1] << 8U);
+}
+
+static void trace_put16(uint8_t *const data, const uint32_t value)
+{
+	data[0] = value & 0xffU;
+	data[1] = (value >> 8U) & 0xffU;
+}
+
+static gdb_tracepoint_s *trace_find(const uint32_t number)
+{
+	for (size_t i = 0; i < tracepoint_count; ++i) {
+		if (tracepoints[i].number == number)
+			return &tracepoints[i];
+	}
+	return NULL;
+}
+
+static void trace_stop(target *const t, const gdb_trace_state_e reason)
+{
+	for (size_t i = 0; i < tracepoint_count; ++i) {
+		gdb_tracepoint_s *const tp = &tracepoints[i];
+		if (tp->inserted && t)
+			target_breakwatch_clear(t, TARGET_BREAK_HARD, tp->addr, GDB_TRACE_BREAK_KIND);
+		tp->inserted = false;
+	}
+	if (trace_state == TRACE_RUNNING)
+		trace_state = reason;
+}
+
+void gdb_trace_reset(target *const t)
+{
+	trace_stop(t, TRACE_STOPPED);
+	trace_state = TRACE_NOT_RUN;
+	tracepoint_count = 0;
+	trace_used = 0;
+	trace_frames = 0;
+	frame_selected = UINT32_MAX;
+}
+
+/*********************************************************************
+ *
+ *       collection
+ *
+ *********************************************************************
+ */
+
+static bool trace_collect_regs(target *const t, size_t *const used)
+{
+	if (*used + 2U > sizeof(trace_buf))
+		return false;
+	trace_buf[(*used)++] = 'R';
+	uint8_t *const count = &trace_buf[(*used)++];
+	*count = 0;
+	for (uint32_t reg = 0; reg < GDB_TRACE_MAX_REGS; ++reg) {
+		uint8_t val[8];
+		const ssize_t size = target_reg_read(t, reg, val, sizeof(val));
+		if (size <= 0)
+			break;
+		if (*used + 1U + size > sizeof(trace_buf))
+			return false;
+		trace_buf[(*used)++] = size;
+		memcpy(trace_buf + *used, val, size);
+		*used += size;
+		++*count;
+	}
+	return true;
+}
+
+static bool trace_collect_range(target *const t, const gdb_trace_range_s *const range, size_t *const used)
+{
+	target_addr_t addr = range->offset;
+	if (range->basereg != GDB_TRACE_ABSOLUTE) {
+		uint8_t val[4] = {0};
+		if (target_reg_read(t, range->basereg, val, sizeof(val)) <= 0)
+			return true;
+		addr += val[0] | (val[1] << 8U) | (val[2] << 16U) | ((uint32_t)val[3] << 24U);
+	}
+	if (*used + 7U + range->len > sizeof(trace_buf))
+		return false;
+	uint8_t *const block = trace_buf + *used;
+	block[0] = 'M';
+	trace_put16(block + 1U, addr & 0xffffU);
+	trace_put16(block + 3U, addr >> 16U);
+	trace_put16(block + 5U, range->len);
+	/* memory that can not be read is left out of the frame */
+	if (!target_mem_read(t, block + 7U, addr, range->len))
+		*used += 7U + range->len;
+	return true;
+}
+
+bool gdb_trace_hit(target *const t, const target_addr_t pc)
+{
+	if (trace_state != TRACE_RUNNING)
+		return false;
+	gdb_tracepoint_s *tp = NULL;
+	for (size_t i = 0; i < tracepoint_count && !tp; ++i) {
+		if (tracepoints[i].enabled && tracepoints[i].addr == pc)
+			tp = &tracepoints[i];
+	}
+	if (!tp)
+		return false;
+	if (tp->cond_len && !gdb_agent_expression_true(t, tp->cond, tp->cond_len))
+		return true;
+
+	/* build the frame after the last one, it only counts once complete */
+	size_t used = trace_used + GDB_TRACE_FRAME_HEADER;
+	bool room = used <= sizeof(trace_buf);
+	if (room && tp->collect_regs)
+		room = trace_collect_regs(t, &used);
+	for (size_t i = 0; room && i < tp->range_count; ++i)
+		room = trace_collect_range(t, &tp->range[i], &used);
+	if (!room) {
+		trace_stop(t, TRACE_FULL);
+		return true;
+	}
+	trace_put16(trace_buf + trace_used, tp->number);
+	trace_put16(trace_buf + trace_used + 2U, used - trace_used);
+	trace_used = used;
+	++trace_frames;
+
+	++tp->hits;
+	if (tp->pass_count && tp->hits >= tp->pass_count) {
+		trace_stop_tracepoint = tp->number;
+		trace_stop(t, TRACE_PASSCOUNT);
+	}
+	return true;
+}
+
+/*********************************************************************
+ *
+ *       frames
+ *
+ *********************************************************************
+ */
+
+static bool trace_frame_offset(const uint32_t frame, size_t *const offset)
+{
+	if (frame >= trace_frames)
+		return false;
+	*offset = 0;
+	for (uint32_t i = 0; i < frame; ++i)
+		*offset += trace_get16(trace_buf + *offset + 2U);
+	return true;
+}
+
+/* the block of the given kind in the selected frame, NULL if it has none */
+static const uint8_t *trace_frame_block(const uint8_t kind, const uint8_t *block)
+{
+	const uint8_t *const end = trace_buf + frame_offset + trace_get16(trace_buf + frame_offset + 2U);
+	if (!block)
+		block = trace_buf + frame_offset + GDB_TRACE_FRAME_HEADER;
+	while (block < end) {
+		size_t size;
+		if (block[0] == 'R') {
+			size = 2U;
+			for (uint32_t i = 0; i < block[1]; ++i)
+				size += 1U + block[size];
+		} else
+			size = 7U + trace_get16(block + 5U);
+		if (block[0] == kind)
+			return block;
+		block += size;
+	}
+	return NULL;
+}
+
+static const uint8_t *trace_next_block(const uint8_t *const block)
+{
+	return trace_frame_block(block[0], block + 7U + trace_get16(block + 5U));
+}
+
+bool gdb_trace_frame_selected(void)
+{
+	return frame_selected != UINT32_MAX;
+}
+
+/* collected register, or its size taken from the target with value NULL when not collected */
+static ssize_t trace_frame_reg(target *const t, const uint32_t reg, const uint8_t **const value)
+{
+	const uint8_t *const regs = trace_frame_block('R', NULL);
+	*value = NULL;
+	if (regs && reg < regs[1]) {
+		const uint8_t *p = regs + 2U;
+		for (uint32_t i = 0; i < reg; ++i)
+			p += 1U + p[0];
+		*value = p + 1U;
+		return p[0];
+	}
+	uint8_t val[8];
+	return target_reg_read(t, reg, val, sizeof(val));
+}
+
+static size_t trace_hex_reg(char *const hex, const uint8_t *const value, const size_t size)
+{
+	if (value)
+		hexify(hex, value, size);
+	else
+		memset(hex, 'x', size * 2U);
+	return size * 2U;
+}
+
+size_t gdb_trace_frame_regs(target *const t, char *const hex, const size_t max)
+{
+	size_t len = 0;
+	for (uint32_t reg = 0; reg < GDB_TRACE_MAX_REGS; ++reg) {
+		const uint8_t *value;
+		const ssize_t size = trace_frame_reg(t, reg, &value);
+		if (size <= 0 || len + size * 2U > max)
+			break;
+		len += trace_hex_reg(hex + len, value, size);
+	}
+	return len;
+}
+
+size_t gdb_trace_frame_reg(target *const t, const uint32_t reg, char *const hex)
+{
+	const uint8_t *value;
+	const ssize_t size = trace_frame_reg(t, reg, &value);
+	if (size <= 0)
+		return 0;
+	return trace_hex_reg(hex, value, size);
+}
+
+size_t gdb_trace_frame_mem(void *const dest, const target_addr_t addr, const size_t len)
+{
+	for (const uint8_t *block = trace_frame_block('M', NULL); block; block = trace_next_block(block)) {
+		const target_addr_t start = trace_get16(block + 1U) | (trace_get16(block + 3U) << 16U);
+		const size_t size = trace_get16(block + 5U);
+		if (addr < start || addr - start >= size)
+			continue;
+		const size_t count = MIN(len, size - (addr - start));
+		memcpy(dest, block + 7U + (addr - start), count);
+		return count;
+	}
+	return 0;
+}
+
+/*********************************************************************
+ *
+ *       packets
+ *
+ *********************************************************************
+ */
+
+/* QTDP:n:addr:ena:step:pass[:Xlen,cond][-] defines a tracepoint */
+static void trace_define(const char *p)
+{
+	char *end;
+	const uint32_t number = strtoul(p, &end, 16);
+	const target_addr_t addr = strtoul(end + 1, &end, 16);
+	if (*end != ':' || (end[1] != 'E' && end[1] != 'D') || end[2] != ':') {
+		gdb_putpacketz("E01");
+		return;
+	}
+	gdb_tracepoint_s tp = {
+		.number = number,
+		.addr = addr,
+		.enabled = end[1] == 'E',
+	};
+	tp.step_count = strtoul(end + 3, &end, 16);
+	tp.pass_count = strtoul(end + 1, &end, 16);
+	while (*end == ':') {
+		if (end[1] == 'X') {
+			/* condition */
+			tp.cond_len = strtoul(end + 2, &end, 16);
+			if (*end != ',' || !tp.cond_len || tp.cond_len > sizeof(tp.cond) ||
+				strspn(end + 1, "0123456789abcdefABCDEF") < tp.cond_len * 2U) {
+				gdb_putpacketz("E01");
+				return;
+			}
+			unhexify(tp.cond, end + 1, tp.cond_len);
+			end += 1U + tp.cond_len * 2U;
+		} else {
+			/* fast tracepoints need code on the target */
+			gdb_putpacketz("E01");
+			return;
+		}
+	}
+
+	gdb_tracepoint_s *slot = trace_find(number);
+	if (!slot) {
+		if (tracepoint_count == GDB_TRACE_MAX_TRACEPOINTS) {
+			gdb_putpacketz("E01");
+			return;
+		}
+		slot = &tracepoints[tracepoint_count++];
+	}
+	memcpy(slot, &tp, sizeof(tp));
+	gdb_putpacketz("OK");
+}
+
+/* QTDP:-n:addr:actions[-] adds actions to a tracepoint */
+static void trace_actions(const char *p)
+{
+	char *end;
+	gdb_tracepoint_s *const tp = trace_find(strtoul(p, &end, 16));
+	if (!tp || *end != ':') {
+		gdb_putpacketz("E01");
+		return;
+	}
+	end = strchr(end + 1, ':');
+	if (!end) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	++end;
+	/* actions while stepping are not supported, drop them */
+	if (*end == 'S') {
+		gdb_putpacketz("OK");
+		return;
+	}
+	while (*end && *end != '-') {
+		switch (*end) {
+		case 'R':
+			/* the mask is GDB's guess of what it needs, collect all registers */
+			tp->collect_regs = true;
+			strtoul(end + 1, &end, 16);
+			break;
+		case 'M': {
+			if (tp->range_count == GDB_TRACE_MAX_RANGES) {
+				gdb_putpacketz("E01");
+				return;
+			}
+			gdb_trace_range_s *const range = &tp->range[tp->range_count];
+			range->basereg = strtoul(end + 1, &end, 16);
+			range->offset = strtoul(end + 1, &end, 16);
+			range->len = strtoul(end + 1, &end, 16);
+			if (range->len > GDB_TRACE_MAX_RANGE_LEN) {
+				gdb_putpacketz("E01");
+				return;
+			}
+			if (range->len)
+				++tp->range_count;
+			break;
+		}
+		case 'X': {
+			/* collection expressions are not evaluated, skip the bytecode */
+			const size_t len = strtoul(end + 1, &end, 16);
+			if (*end != ',' || strlen(end + 1) < len * 2U) {
+				gdb_putpacketz("E01");
+				return;
+			}
+			end += 1U + len * 2U;
+			break;
+		}
+		default:
+			gdb_putpacketz("E01");
+			return;
+		}
+	}
+	gdb_putpacketz("OK");
+}
+
+static void trace_start(target *const t)
+{
+	if (!t) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	trace_used = 0;
+	trace_frames = 0;
+	frame_selected = UINT32_MAX;
+	for (size_t i = 0; i < tracepoint_count; ++i) {
+		gdb_tracepoint_s *const tp = &tracepoints[i];
+		tp->hits = 0;
+		if (!tp->enabled)
+			continue;
+		/* share a breakpoint GDB already has there */
+		if (target_breakwatch_present(t, TARGET_BREAK_HARD, tp->addr, GDB_TRACE_BREAK_KIND))
+			continue;
+		if (target_breakwatch_set(t, TARGET_BREAK_HARD, tp->addr, GDB_TRACE_BREAK_KIND)) {
+			/* out of breakpoints, take back the ones set so far */
+			trace_stop(t, TRACE_STOPPED);
+			gdb_putpacketz("E01");
+			return;
+		}
+		tp->inserted = true;
+	}
+	trace_state = TRACE_RUNNING;
+	gdb_putpacketz("OK");
+}
+
+static void trace_status(void)
+{
+	static const char *const reasons[] = {
+		[TRACE_NOT_RUN] = "tnotrun:0",
+		[TRACE_RUNNING] = "tnotrun:0",
+		[TRACE_STOPPED] = "tstop:0",
+		[TRACE_FULL] = "tfull:0",
+		[TRACE_PASSCOUNT] = "tpasscount",
+	};
+	char reason[24];
+	if (trace_state == TRACE_PASSCOUNT)
+		snprintf(reason, sizeof(reason), "%s:%" PRIx32, reasons[trace_state], trace_stop_tracepoint);
+	else
+		snprintf(reason, sizeof(reason), "%s", reasons[trace_state]);
+	gdb_putpacket_f("T%u;%s;tframes:%" PRIx32 ";tcreated:%" PRIx32 ";tfree:%" PRIx32 ";tsize:%" PRIx32
+					";circular:0;disconn:0",
+		trace_state == TRACE_RUNNING ? 1U : 0U, reason, trace_frames, trace_frames,
+		(uint32_t)(sizeof(trace_buf) - trace_used), (uint32_t)sizeof(trace_buf));
+}
+
+static void trace_list(void)
+{
+	if (tracepoint_iter >= tracepoint_count) {
+		gdb_putpacketz("l");
+		return;
+	}
+	const gdb_tracepoint_s *const tp = &tracepoints[tracepoint_iter++];
+	char reply[64 + GDB_TRACE_MAX_COND * 2U];
+	size_t len = snprintf(reply, sizeof(reply), "T%" PRIx32 ":%08" PRIx32 ":%c:%" PRIx32 ":%" PRIx32, tp->number,
+		(uint32_t)tp->addr, tp->enabled ? 'E' : 'D', tp->step_count, tp->pass_count);
+	if (tp->cond_len) {
+		len += snprintf(reply + len, sizeof(reply) - len, ":X%x,", tp->cond_len);
+		hexify(reply + len, tp->cond, tp->cond_len);
+		len += tp->cond_len * 2U;
+	}
+	gdb_putpacket(reply, len);
+}
+
+/* QTFrame:n, or the next frame after the selected one at pc:addr, of tdp:n, in range:lo:hi or outside:lo:hi */
+static void trace_frame(const char *p)
+{
+	uint32_t frame = UINT32_MAX;
+	if (isxdigit((unsigned char)p[0])) {
+		frame = strtoul(p, NULL, 16);
+		if (frame == UINT32_MAX) {
+			/* back to the live target */
+			frame_selected = UINT32_MAX;
+			gdb_putpacketz("OK");
+			return;
+		}
+		if (frame >= trace_frames)
+			frame = UINT32_MAX;
+	} else {
+		char *end;
+		const bool by_pc = !strncmp(p, "pc:", 3);
+		const bool by_tdp = !strncmp(p, "tdp:", 4);
+		const bool in_range = !strncmp(p, "range:", 6);
+		const bool outside = !strncmp(p, "outside:", 8);
+		const uint32_t lo = strtoul(strchr(p, ':') + 1, &end, 16);
+		const uint32_t hi = *end == ':' ? strtoul(end + 1, NULL, 16) : lo;
+		size_t offset = 0;
+		for (uint32_t i = 0; i < trace_frames; offset += trace_get16(trace_buf + offset + 2U), ++i) {
+			if (frame_selected != UINT32_MAX && i <= frame_selected)
+				continue;
+			const gdb_tracepoint_s *const tp = trace_find(trace_get16(trace_buf + offset));
+			const uint32_t pc = tp ? tp->addr : 0;
+			if ((by_pc && pc == lo) || (by_tdp && trace_get16(trace_buf + offset) == lo) ||
+				(in_range && pc >= lo && pc <= hi) || (outside && (pc < lo || pc > hi))) {
+				frame = i;
+				break;
+			}
+		}
+	}
+	if (frame == UINT32_MAX || !trace_frame_offset(frame, &frame_offset)) {
+		frame_selected = UINT32_MAX;
+		gdb_putpacketz("F-1");
+		return;
+	}
+	frame_selected = frame;
+	gdb_putpacket_f("F%" PRIx32 "T%" PRIx32, frame, trace_get16(trace_buf + frame_offset));
+}
+
+bool gdb_trace_packet(target *const t, const char *const packet, const size_t len)
+{
+	(void)len;
+	if (!strcmp(packet, "QTinit")) {
+		gdb_trace_reset(t);
+		gdb_putpacketz("OK");
+	} else if (!strncmp(packet, "QTDP:-", 6))
+		trace_actions(packet + 6);
+	else if (!strncmp(packet, "QTDP:", 5))
+		trace_define(packet + 5);
+	else if (!strcmp(packet, "QTStart"))
+		trace_start(t);
+	else if (!strcmp(packet, "QTStop")) {
+		trace_stop(t, TRACE_STOPPED);
+		gdb_putpacketz("OK");
+	} else if (!strcmp(packet, "qTStatus"))
+		trace_status();
+	else if (!strncmp(packet, "QTFrame:", 8))
+		trace_frame(packet + 8);
+	else if (!strcmp(packet, "qTfP") || !strcmp(packet, "qTsP")) {
+		if (packet[2] == 'f')
+			tracepoint_iter = 0;
+		trace_list();
+	} else if (!strcmp(packet, "qTfV") || !strcmp(packet, "qTsV"))
+		/* no trace state variables */
+		gdb_putpacketz("l");
+	else if (!strncmp(packet, "qTP:", 4)) {
+		const gdb_tracepoint_s *const tp = trace_find(strtoul(packet + 4, NULL, 16));
+		if (tp)
+			gdb_putpacket_f("V%" PRIx32 ":0", tp->hits);
+		else
+			gdb_putpacketz("E01");
+	} else if (!strncmp(packet, "QTBuffer:circular:", 18))
+		gdb_putpacketz(packet[18] == '0' ? "OK" : "E01");
+	else if (!strncmp(packet, "QTro", 4) || !strncmp(packet, "QTDV:", 5))
+		/* memory not collected is unavailable, read-only or not */
+		gdb_putpacketz("OK");
+	else
+		return false;
+	return true;
+}
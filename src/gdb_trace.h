@@ -0,0 +1,43 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GDB_TRACE_H
+#define GDB_TRACE_H
+
+#include "target.h"
+
+/* tracepoints are hardware breakpoints of this kind */
+#define GDB_TRACE_BREAK_KIND 2U
+
+/* handle a qT or QT tracepoint packet, false if it is not one */
+bool gdb_trace_packet(target *t, const char *packet, size_t len);
+/* stop the experiment and drop tracepoints and frames, on detach */
+void gdb_trace_reset(target *t);
+
+/* the target stopped at pc: collect a frame if it is a tracepoint, true if it is one */
+bool gdb_trace_hit(target *t, target_addr_t pc);
+
+/* while a frame is selected with QTFrame, register and memory reads come from it */
+bool gdb_trace_frame_selected(void);
+/* 'g' reply for the frame into hex, registers not collected as 'x' */
+size_t gdb_trace_frame_regs(target *t, char *hex, size_t max);
+/* 'p' reply for the frame into hex, 0 for no such register */
+size_t gdb_trace_frame_reg(target *t, uint32_t reg, char *hex);
+/* bytes of frame memory collected from addr, up to len */
+size_t gdb_trace_frame_mem(void *dest, target_addr_t addr, size_t len);
+
+#endif /* GDB_TRACE_H */
@@ -24,36 +24,157 @@
 #include "general.h"
 #include "hex_utils.h"
 
-static const char hexdigits[] = "0123456789abcdef";
+#if PC_HOSTED == 1 && defined(__SSE2__)
+#include <emmintrin.h>
+#define HEX_UTILS_SSE2
+#elif PC_HOSTED == 1 && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HEX_UTILS_NEON
+#endif
 
-char *hexify(char *hex, const void *buf, const size_t size)
+/* The two digits of every byte value, "000102...feff" */
+#define HEX_ROW(h) \
+	h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+static const char hexpairs[] = HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3") HEX_ROW("4") HEX_ROW("5")
+	HEX_ROW("6") HEX_ROW("7") HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b") HEX_ROW("c") HEX_ROW("d")
+	HEX_ROW("e") HEX_ROW("f");
+
+/*
+ * Both hexify() and unhexify() may work in place, with the output starting
+ * no later in the buffer than the input. The vector kernels take a whole
+ * block in before writing any of it back, so they never overtake the input.
+ */
+
+#if defined(HEX_UTILS_SSE2)
+/* Nibbles to ascii digits: n + '0', plus the gap up to 'a' where n > 9 */
+static inline __m128i hex_digits_sse2(const __m128i nibbles)
+{
+	const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+/* Ascii digits to nibbles: the low four bits, plus 9 for letters of either case */
+static inline __m128i hex_values_sse2(const __m128i digits)
+{
+	const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(digits, _mm_set1_epi8('9')), _mm_set1_epi8(9));
+	return _mm_add_epi8(_mm_and_si128(digits, _mm_set1_epi8(0xf)), letters);
+}
+
+/* One byte from each pair of nibbles, high nibble first, as 16 bit lanes */
+static inline __m128i hex_combine_sse2(const __m128i values)
+{
+	const __m128i high = _mm_and_si128(values, _mm_set1_epi16(0x00ff));
+	return _mm_or_si128(_mm_slli_epi16(high, 4), _mm_srli_epi16(values, 8));
+}
+
+static size_t hexify_blocks(char *hex, const uint8_t *src, const size_t size)
+{
+	size_t idx = 0;
+	for (; idx + 16U <= size; idx += 16U) {
+		const __m128i data = _mm_loadu_si128((const __m128i *)(src + idx));
+		const __m128i high = hex_digits_sse2(_mm_and_si128(_mm_srli_epi16(data, 4), _mm_set1_epi8(0xf)));
+		const __m128i low = hex_digits_sse2(_mm_and_si128(data, _mm_set1_epi8(0xf)));
+		_mm_storeu_si128((__m128i *)(hex + idx * 2U), _mm_unpacklo_epi8(high, low));
+		_mm_storeu_si128((__m128i *)(hex + idx * 2U + 16U), _mm_unpackhi_epi8(high, low));
+	}
+	return idx;
+}
+
+static size_t unhexify_blocks(uint8_t *dst, const char *hex, const size_t size)
+{
+	size_t idx = 0;
+	for (; idx + 16U <= size; idx += 16U) {
+		const __m128i first = _mm_loadu_si128((const __m128i *)(hex + idx * 2U));
+		const __m128i second = _mm_loadu_si128((const __m128i *)(hex + idx * 2U + 16U));
+		const __m128i bytes =
+			_mm_packus_epi16(hex_combine_sse2(hex_values_sse2(first)), hex_combine_sse2(hex_values_sse2(second)));
+		_mm_storeu_si128((__m128i *)(dst + idx), bytes);
+	}
+	return idx;
+}
+#elif defined(HEX_UTILS_NEON)
+static inline uint8x16_t hex_digits_neon(const uint8x16_t nibbles)
+{
+	const uint8x16_t letters = vandq_u8(vcgtq_u8(nibbles, vdupq_n_u8(9)), vdupq_n_u8('a' - '0' - 10));
+	return vaddq_u8(vaddq_u8(nibbles, vdupq_n_u8('0')), letters);
+}
+
+static inline uint8x16_t hex_values_neon(const uint8x16_t digits)
+{
+	const uint8x16_t letters = vandq_u8(vcgtq_u8(digits, vdupq_n_u8('9')), vdupq_n_u8(9));
+	return vaddq_u8(vandq_u8(digits, vdupq_n_u8(0xf)), letters);
+}
+
+static size_t hexify_blocks(char *hex, const uint8_t *src, const size_t size)
+{
+	size_t idx = 0;
+	for (; idx + 16U <= size; idx += 16U) {
+		const uint8x16_t data = vld1q_u8(src + idx);
+		uint8x16x2_t digits;
+		digits.val[0] = hex_digits_neon(vshrq_n_u8(data, 4));
+		digits.val[1] = hex_digits_neon(vandq_u8(data, vdupq_n_u8(0xf)));
+		vst2q_u8((uint8_t *)hex + idx * 2U, digits);
+	}
+	return idx;
+}
+
+static size_t unhexify_blocks(uint8_t *dst, const char *hex, const size_t size)
+{
+	size_t idx = 0;
+	for (; idx + 16U <= size; idx += 16U) {
+		const uint8x16x2_t digits = vld2q_u8((const uint8_t *)hex + idx * 2U);
+		const uint8x16_t high = hex_values_neon(digits.val[0]);
+		const uint8x16_t low = hex_values_neon(digits.val[1]);
+		vst1q_u8(dst + idx, vorrq_u8(vshlq_n_u8(high, 4), low));
+	}
+	return idx;
+}
+#else
+static inline size_t hexify_blocks(char *hex, const uint8_t *src, const size_t size)
+{
+	(void)hex;
+	(void)src;
+	(void)size;
+	return 0;
+}
+
+static inline size_t unhexify_blocks(uint8_t *dst, const char *hex, const size_t size)
+{
+	(void)dst;
+	(void)hex;
+	(void)size;
+	return 0;
+}
+#endif
+
+RAMFUNC char *hexify(char *hex, const void *buf, const size_t size)
 {
-	char *dst = hex;
 	const uint8_t *const src = buf;
+	size_t idx = hexify_blocks(hex, src, size);
+	char *dst = hex + idx * 2U;
 
-	for (size_t idx = 0; idx < size; ++idx) {
-		*dst++ = hexdigits[src[idx] >> 4];
-		*dst++ = hexdigits[src[idx] & 0xF];
+	for (; idx < size; ++idx) {
+		const char *const pair = &hexpairs[src[idx] * 2U];
+		*dst++ = pair[0];
+		*dst++ = pair[1];
 	}
 	*dst++ = 0;
 
 	return hex;
 }
 
-static uint8_t unhex_digit(char hex)
+/* Branch free for 0-9, a-f and A-F: the low four bits, plus 9 for letters (bit 6 set) */
+static inline uint8_t unhex_digit(const char hex)
 {
-	uint8_t tmp = hex - '0';
-	if (tmp > 9)
-		tmp -= 'A' - '0' - 10;
-	if (tmp > 16)
-		tmp -= 'a' - 'A';
-	return tmp;
+	const uint8_t digit = (uint8_t)hex;
+	return (digit & 0xfU) + 9U * (digit >> 6U);
 }
 
-char *unhexify(void *buf, const char *hex, const size_t size)
+RAMFUNC char *unhexify(void *buf, const char *hex, const size_t size)
 {
 	uint8_t *const dst = buf;
-	for (size_t idx = 0; idx < size; ++idx, hex += 2) {
+	size_t idx = unhexify_blocks(dst, hex, size);
+	for (hex += idx * 2U; idx < size; ++idx, hex += 2) {
 		dst[idx] = (unhex_digit(hex[0]) << 4) | unhex_digit(hex[1]);
 	}
 	return buf;
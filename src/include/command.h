@@ -35,4 +35,11 @@ int command_process(target *t, char *cmd);
  */
 bool parse_enable_or_disable(const char *s, bool *out);
 
+/*
+ * Finds the highest SWJ frequency, up to max (0 for no limit), at which
+ * accesses to the target's RAM are reliable and sets it, less a margin.
+ * Returns the frequency set, or 0 if none worked.
+ */
+uint32_t command_frequency_auto(target *t, uint32_t max);
+
 #endif /* INCLUDE_COMMAND_H */
@@ -21,6 +21,24 @@
 #ifndef INCLUDE_CRC32_H
 #define INCLUDE_CRC32_H
 
-int generic_crc32(target *t, uint32_t *crc, uint32_t base, int len);
+/* The CRC GDB's qCRC expects, by the target itself if it can or else read back */
+int generic_crc32(target *t, uint32_t *crc, uint32_t base, size_t len);
+/* Continue a CRC over a buffer in probe memory */
+uint32_t crc32_buffer(uint32_t crc, const void *data, size_t len);
+/* Continue the reflected CRC32 hardware units such as the SAM DSU compute, with no final inversion */
+uint32_t crc32_ieee_buffer(uint32_t crc, const void *data, size_t len);
+
+typedef enum crc32_kind {
+	CRC32_GDB,
+	CRC32_IEEE,
+} crc32_kind_e;
+
+/*
+ * The CRC of a range computed by the target itself, in whichever kind it has, both starting
+ * from 0xffffffff. Returns false if it has neither and the range must be read back.
+ */
+bool target_crc32(target *t, target_addr_t base, size_t len, uint32_t *crc, crc32_kind_e *kind);
+/* Continue a CRC of the given kind over a buffer in probe memory, to check a target_crc32() result */
+uint32_t crc32_kind_buffer(crc32_kind_e kind, uint32_t crc, const void *data, size_t len);
 
 #endif /* INCLUDE_CRC32_H */
@@ -24,13 +24,56 @@
 #if PC_HOSTED == 0
 #include <libopencm3/usb/usbd.h>
 void gdb_usb_out_cb(usbd_device *dev, uint8_t ep);
+#ifdef ENABLE_BULK_IF
+void gdb_bulk_out_cb(usbd_device *dev, uint8_t ep);
+#endif
 #endif
 
 int gdb_if_init(void);
 unsigned char gdb_if_getchar(void);
 unsigned char gdb_if_getchar_to(int timeout);
+/*
+ * Span based reception: gdb_if_getspan() waits for input like
+ * gdb_if_getchar() and points span at the bytes already received, returning
+ * how many there are. The caller hands back the number it used through
+ * gdb_if_consume(), the rest is returned again by the next call.
+ */
+size_t gdb_if_getspan(const unsigned char **span);
+void gdb_if_consume(size_t count);
+
+/*
+ * PC-Hosted serves a GDB session per TCP port, gdb_if_select() picks the one the
+ * other calls work on. The probe firmware has its one USB connection.
+ */
+#if PC_HOSTED == 1
+#define GDB_IF_SESSIONS 4U
+size_t gdb_if_session(void);
+size_t gdb_if_session_count(void);
+void gdb_if_select(size_t session);
+/* Whether GDB is connected to the current session, monitor output goes to stdout otherwise */
+bool gdb_if_connected(void);
+/* Wait up to timeout ms for any session to have input, taking new connections */
+void gdb_if_wait(uint32_t timeout);
+/* Serve the one session on stdin and stdout instead of TCP, called before anything is printed */
+bool gdb_if_use_stdio(void);
+/* Hand the current session data as though GDB had sent it, for the code benchmark */
+void gdb_if_inject(const void *data, size_t len);
+#else
+#define GDB_IF_SESSIONS 1U
+#define gdb_if_session() 0U
+#define gdb_if_session_count() 1U
+#define gdb_if_select(session) ((void)(session))
+#endif
 
 /* sending gdb_if_putchar(0, true) seems to work as keep alive */
 void gdb_if_putchar(unsigned char c, int flush);
+/* Queue len bytes for sending in one go, flush as for gdb_if_putchar() applies after the last */
+void gdb_if_write(const void *data, size_t len, int flush);
+/*
+ * Flush value for output that a reply is expected to follow shortly, such
+ * as an ack. Transports that can hold it back to share a segment with the
+ * reply may do so, all others treat it as a plain flush.
+ */
+#define GDB_IF_FLUSH_MORE 2
 
 #endif /* INCLUDE_GDB_IF_H */
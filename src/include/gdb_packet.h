@@ -23,8 +23,11 @@
 
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdbool.h>
 
 size_t gdb_getpacket(char *packet, size_t size);
+bool gdb_getpacket_ready(void);
+void gdb_set_noackmode(bool enable);
 void gdb_putpacket(const char *packet, size_t size);
 void gdb_putpacket2(const char *packet1, size_t size1, const char *packet2, size_t size2);
 #define gdb_putpacketz(packet) gdb_putpacket((packet), strlen(packet))
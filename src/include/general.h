@@ -41,6 +41,7 @@
 
 #include "platform.h"
 #include "platform_support.h"
+#include "memory_profile.h"
 
 #ifndef ARRAY_LENGTH
 #define ARRAY_LENGTH(arr) (sizeof(arr) / sizeof(arr[0]))
@@ -61,6 +62,25 @@ enum BMP_DEBUG {
 
 #define FREQ_FIXED 0xffffffff
 
+/*
+ * Hot paths that should run without flash wait states are placed in RAM with
+ * RAMFUNC. The .ramtext input section is taken into .data by the libopencm3
+ * generic linker script, so the startup code copies it over with the data.
+ * Platforms with core coupled memory define PLATFORM_HAS_CCM and place buffers
+ * only the CPU touches in it with CCM_BSS. No DMA reaches CCM and it is not
+ * zeroed at reset, so such buffers must be written before they are read.
+ */
+#if PC_HOSTED == 0 && (defined(STM32F1) || defined(STM32F4))
+#define RAMFUNC __attribute__((section(".ramtext"), noinline))
+#else
+#define RAMFUNC
+#endif
+#if PC_HOSTED == 0 && defined(PLATFORM_HAS_CCM)
+#define CCM_BSS __attribute__((section(".ccm")))
+#else
+#define CCM_BSS
+#endif
+
 #if PC_HOSTED == 0
 /* For BMP debug output on a firmware BMP platform, using
  * BMP PC-Hosted is the preferred way. Printing DEBUG_WARN
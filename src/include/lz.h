@@ -0,0 +1,69 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A byte oriented LZ77 codec for flash images sent to the probe. The stream
+ * is a series of tokens: 0x00-0x7f is a run of token + 1 literal bytes that
+ * follow it, 0x80-0xff copies (token & 0x7f) + LZ_MATCH_MIN bytes from a
+ * little endian 16 bit distance back, 1 to LZ_WINDOW_SIZE. The decoder keeps
+ * only the window and hands the output on each time it fills up, so it runs
+ * incrementally on whatever pieces the stream arrives in.
+ */
+
+#ifndef INCLUDE_LZ_H
+#define INCLUDE_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ_WINDOW_SIZE  1024U
+#define LZ_LITERALS_MAX 128U
+#define LZ_MATCH_MIN    4U
+#define LZ_MATCH_MAX    (LZ_MATCH_MIN + 127U)
+
+/* Takes each window full of output, and the rest at the end, false stops the decoder */
+typedef bool (*lz_output_fn)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct lz_decoder {
+	uint8_t window[LZ_WINDOW_SIZE];
+	size_t pos;
+	size_t len;      /* output bytes expected */
+	size_t produced;
+	uint8_t state;
+	uint16_t count;
+	uint16_t distance;
+	bool ok;
+	lz_output_fn output;
+	void *ctx;
+} lz_decoder_s;
+
+void lz_decode_start(lz_decoder_s *dec, size_t len, lz_output_fn output, void *ctx);
+/* Feed the next piece of the stream, false once it is corrupt or the output failed */
+bool lz_decode(lz_decoder_s *dec, const uint8_t *data, size_t len);
+/* Hand on the last output, true only if exactly the expected length was decoded */
+bool lz_decode_finish(lz_decoder_s *dec);
+
+#if PC_HOSTED == 1
+/* Worst case encoded size, a token for every LZ_LITERALS_MAX bytes */
+#define LZ_ENCODE_BOUND(len) ((len) + ((len) + LZ_LITERALS_MAX - 1U) / LZ_LITERALS_MAX)
+
+/* Encode len bytes into dest, which must hold LZ_ENCODE_BOUND(len), returns the encoded length */
+size_t lz_encode(uint8_t *dest, const uint8_t *src, size_t len);
+#endif
+
+#endif /* INCLUDE_LZ_H */
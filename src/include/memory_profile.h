@@ -0,0 +1,121 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Buffer sizes from one RAM budget. platform.h picks the profile that fits
+ * the RAM the probe has to spare with PLATFORM_MEMORY_PROFILE, and may still
+ * set any one of the sizes itself. Without a choice hosted builds get the
+ * hosted profile, F4/F7 the medium one and the rest the 20K F103 one.
+ */
+
+#ifndef INCLUDE_MEMORY_PROFILE_H
+#define INCLUDE_MEMORY_PROFILE_H
+
+#define PLATFORM_MEMORY_SMALL  1 /* 20K of RAM, F103 and F072 */
+#define PLATFORM_MEMORY_MEDIUM 2 /* 40K to 96K */
+#define PLATFORM_MEMORY_LARGE  3 /* 128K or more */
+#define PLATFORM_MEMORY_HOSTED 4
+
+#ifndef PLATFORM_MEMORY_PROFILE
+#if PC_HOSTED == 1
+#define PLATFORM_MEMORY_PROFILE PLATFORM_MEMORY_HOSTED
+#elif defined(STM32F4) || defined(STM32F7)
+#define PLATFORM_MEMORY_PROFILE PLATFORM_MEMORY_MEDIUM
+#else
+#define PLATFORM_MEMORY_PROFILE PLATFORM_MEMORY_SMALL
+#endif
+#endif
+
+/*
+ * GDB packet, flash write buffer, RTT up (plus 8 for alignment and padding)
+ * and down buffers, SWO capture ring (async trace packets or Manchester
+ * capture pairs), the scratch buffer target memory is streamed through and
+ * the aux UART's receive (a power of 2) and transmit DMA rings
+ */
+#if PLATFORM_MEMORY_PROFILE == PLATFORM_MEMORY_HOSTED
+#define PLATFORM_MEMORY_NAME          "hosted"
+#define PROFILE_GDB_PACKET_SIZE       16384U
+#define PROFILE_FLASH_WRITEBUF_SIZE   16384U
+#define PROFILE_RTT_UP_SIZE           (4096U + 8U)
+#define PROFILE_RTT_DOWN_SIZE         512U
+#define PROFILE_TRACE_PACKETS         256U
+#define PROFILE_TRACE_CAPTURE_PAIRS   4096U
+#define PROFILE_SCRATCH_SIZE          4096U
+#define PROFILE_AUX_UART_RX_SIZE      256U
+#define PROFILE_AUX_UART_TX_SIZE      256U
+#elif PLATFORM_MEMORY_PROFILE == PLATFORM_MEMORY_LARGE
+#define PLATFORM_MEMORY_NAME          "large"
+#define PROFILE_GDB_PACKET_SIZE       4096U
+#define PROFILE_FLASH_WRITEBUF_SIZE   16384U
+#define PROFILE_RTT_UP_SIZE           (4096U + 8U)
+#define PROFILE_RTT_DOWN_SIZE         1024U
+#define PROFILE_TRACE_PACKETS         512U
+#define PROFILE_TRACE_CAPTURE_PAIRS   4096U
+#define PROFILE_SCRATCH_SIZE          1024U
+#define PROFILE_AUX_UART_RX_SIZE      4096U
+#define PROFILE_AUX_UART_TX_SIZE      2048U
+#elif PLATFORM_MEMORY_PROFILE == PLATFORM_MEMORY_MEDIUM
+#define PLATFORM_MEMORY_NAME          "medium"
+#define PROFILE_GDB_PACKET_SIZE       2048U
+#define PROFILE_FLASH_WRITEBUF_SIZE   4096U
+#define PROFILE_RTT_UP_SIZE           (2048U + 8U)
+#define PROFILE_RTT_DOWN_SIZE         256U
+#define PROFILE_TRACE_PACKETS         256U
+#define PROFILE_TRACE_CAPTURE_PAIRS   2048U
+#define PROFILE_SCRATCH_SIZE          256U
+#define PROFILE_AUX_UART_RX_SIZE      2048U
+#define PROFILE_AUX_UART_TX_SIZE      1024U
+#else
+#define PLATFORM_MEMORY_NAME          "small"
+#define PROFILE_GDB_PACKET_SIZE       1024U
+#define PROFILE_FLASH_WRITEBUF_SIZE   1024U
+#define PROFILE_RTT_UP_SIZE           (1024U + 8U)
+#define PROFILE_RTT_DOWN_SIZE         256U
+#define PROFILE_TRACE_PACKETS         128U
+#define PROFILE_TRACE_CAPTURE_PAIRS   1024U
+#define PROFILE_SCRATCH_SIZE          128U
+#define PROFILE_AUX_UART_RX_SIZE      256U
+#define PROFILE_AUX_UART_TX_SIZE      256U
+#endif
+
+#ifndef GDB_PACKET_BUFFER_SIZE
+#define GDB_PACKET_BUFFER_SIZE PROFILE_GDB_PACKET_SIZE
+#endif
+#ifndef FLASH_WRITEBUF_MAX_SIZE
+#define FLASH_WRITEBUF_MAX_SIZE PROFILE_FLASH_WRITEBUF_SIZE
+#endif
+#if !defined(RTT_UP_BUF_SIZE) || !defined(RTT_DOWN_BUF_SIZE)
+#define RTT_UP_BUF_SIZE   PROFILE_RTT_UP_SIZE
+#define RTT_DOWN_BUF_SIZE PROFILE_RTT_DOWN_SIZE
+#endif
+#ifndef NUM_TRACE_PACKETS
+#define NUM_TRACE_PACKETS PROFILE_TRACE_PACKETS
+#endif
+#ifndef TRACE_CAPTURE_PAIRS
+#define TRACE_CAPTURE_PAIRS PROFILE_TRACE_CAPTURE_PAIRS
+#endif
+#ifndef SCRATCH_BUF_SIZE
+#define SCRATCH_BUF_SIZE PROFILE_SCRATCH_SIZE
+#endif
+#ifndef AUX_UART_RX_BUFFER_SIZE
+#define AUX_UART_RX_BUFFER_SIZE PROFILE_AUX_UART_RX_SIZE
+#endif
+#ifndef AUX_UART_TX_BUFFER_SIZE
+#define AUX_UART_TX_BUFFER_SIZE PROFILE_AUX_UART_TX_SIZE
+#endif
+
+#endif /* INCLUDE_MEMORY_PROFILE_H */
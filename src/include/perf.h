@@ -0,0 +1,71 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Probe-side performance counters, built in with ENABLE_PERF=1 and shown by
+ * 'monitor perf'. Without it every PERF_* macro compiles to nothing.
+ */
+
+#ifndef INCLUDE_PERF_H
+#define INCLUDE_PERF_H
+
+#include "general.h"
+
+typedef enum perf_counter {
+	PERF_DP_READ,
+	PERF_DP_WRITE,
+	PERF_AP_READ,
+	PERF_AP_WRITE,
+	PERF_ACK_WAIT,
+	PERF_ACK_FAULT,
+	PERF_ROUND_TRIPS, /* exchanges with the probe, where the link has them */
+	PERF_USB_RX, /* GDB interface bytes from the host */
+	PERF_USB_TX, /* GDB interface bytes to the host */
+	PERF_SWO_BYTES,
+	PERF_COUNTER_COUNT,
+} perf_counter_e;
+
+/* Code sections timed with the probe's own cycle counter, or in us on hosted */
+typedef enum perf_section {
+	PERF_GDB_GETPACKET,
+	PERF_TARGET_MEM_READ,
+	PERF_FLASH_FLUSH,
+	PERF_POLL_RTT,
+	PERF_SECTION_COUNT,
+} perf_section_e;
+
+#ifdef ENABLE_PERF
+extern uint32_t perf_counters[PERF_COUNTER_COUNT];
+
+uint32_t perf_cycles(void);
+void perf_section_add(perf_section_e section, uint32_t start);
+void perf_gdb_packet(char type);
+void perf_reset(void);
+void perf_print(void);
+
+#define PERF_COUNT(counter, n)       (perf_counters[(counter)] += (n))
+#define PERF_BEGIN(start)            const uint32_t start = perf_cycles()
+#define PERF_END(section, start)     perf_section_add((section), (start))
+#define PERF_GDB_PACKET(type)        perf_gdb_packet(type)
+#else
+#define PERF_COUNT(counter, n)       do {} while (0)
+#define PERF_BEGIN(start)            do {} while (0)
+#define PERF_END(section, start)     do {} while (0)
+#define PERF_GDB_PACKET(type)        do {} while (0)
+#endif
+
+#endif /* INCLUDE_PERF_H */
@@ -28,10 +28,13 @@
 
 #if PC_HOSTED == 1
 void platform_init(int argc, char **argv);
-void platform_pace_poll(void);
+/* Pause between halt polls, running_ms is the time since the target was resumed */
+void platform_pace_poll(uint32_t running_ms);
+extern uint32_t pace_poll_burst_ms;
+extern uint32_t pace_poll_max_ms;
 #else
 void platform_init(void);
-inline void platform_pace_poll(void) { }
+inline void platform_pace_poll(uint32_t running_ms) { (void)running_ms; }
 #endif
 
 typedef struct platform_timeout platform_timeout;
@@ -54,4 +57,20 @@ uint32_t platform_max_frequency_get(void);
 
 void platform_target_clk_output_enable(bool enable);
 
+#ifdef PLATFORM_HAS_STANDALONE
+/* Storage for the standalone programmer image, 0 bytes if none is fitted */
+size_t platform_store_size(void);
+bool platform_store_read(uint32_t offset, void *data, size_t len);
+/* Program erased storage */
+bool platform_store_write(uint32_t offset, const void *data, size_t len);
+/* Erase the PLATFORM_STORE_ERASE_SIZE sectors covering the range */
+bool platform_store_erase(uint32_t offset, size_t len);
+bool platform_button_pressed(void);
+#endif
+
+#ifdef PLATFORM_HAS_JTAG_SPI
+/* Shift whole bytes through the TAP, LSB first with TMS held low. Returns false if the hardware cannot */
+bool platform_jtag_spi_shift(const uint8_t *data_in, uint8_t *data_out, size_t bytes);
+#endif
+
 #endif /* INCLUDE_PLATFORM_SUPPORT_H */
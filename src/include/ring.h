@@ -0,0 +1,68 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Lock-free byte ring for one producer and one consumer, either of which may
+ * be an interrupt handler. Only the producer moves the head and only the
+ * consumer the tail. Both run free and are masked on use, so the whole size
+ * can be filled, which must be a power of 2. A span is the contiguous room or
+ * data at the current position: DMA and USB endpoints fill or send from it in
+ * place, and then commit what they used.
+ */
+
+#ifndef INCLUDE_RING_H
+#define INCLUDE_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ring {
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t head; /* bytes ever written */
+	uint32_t tail; /* bytes ever read */
+} ring_s;
+
+/* Static initialiser for a ring over an array, whose size must be a power of 2 */
+#define RING_INIT(array)                                   \
+	{                                                      \
+		.buf = (uint8_t *)(array), .size = sizeof(array), \
+	}
+
+/* Empty the ring, only while neither side uses it */
+void ring_reset(ring_s *ring);
+uint32_t ring_used(const ring_s *ring);
+uint32_t ring_free(const ring_s *ring);
+
+/* Producer: the contiguous room at the head, then how much of it was filled */
+uint8_t *ring_write_span(ring_s *ring, uint32_t *len);
+void ring_write_commit(ring_s *ring, uint32_t len);
+/* Producer: copy in as much as there is room for, returns the bytes taken */
+uint32_t ring_write(ring_s *ring, const void *data, uint32_t len);
+/* Producer that fills the buffer circularly itself, as DMA does: move the head up to its offset */
+void ring_write_to(ring_s *ring, uint32_t offset);
+
+/* Consumer: the contiguous data at the tail, then how much of it was used */
+const uint8_t *ring_read_span(ring_s *ring, uint32_t *len);
+void ring_read_commit(ring_s *ring, uint32_t len);
+/* Consumer: copy out up to len bytes, returns the bytes taken */
+uint32_t ring_read(ring_s *ring, void *data, uint32_t len);
+/* Consumer: drop everything queued */
+void ring_discard(ring_s *ring);
+
+#endif /* INCLUDE_RING_H */
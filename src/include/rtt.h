@@ -34,12 +34,15 @@ extern char rtt_ident[16];	    // string
 extern bool rtt_enabled;	    // rtt on/off
 extern bool rtt_found;              // control block found
 extern uint32_t rtt_cbaddr;         // control block address
+extern uint32_t rtt_ram_start;      // control block search range start
+extern uint32_t rtt_ram_end;        // control block search range end, 0 for all ram
 extern uint32_t rtt_min_poll_ms;    // min time between polls (ms)
 extern uint32_t rtt_max_poll_ms;    // max time between polls (ms)
 extern uint32_t rtt_max_poll_errs;  // max number of errors before disconnect
 extern bool rtt_auto_channel;       // manual or auto channel selection
 extern bool rtt_flag_skip;          // skip if host-to-target fifo full
 extern bool rtt_flag_block;         // block if host-to-target fifo full
+extern bool rtt_quiet;              // no gdb to report errors to
 
 struct rtt_channel_struct {
 	bool is_enabled;            // does user want to see this channel?
@@ -54,8 +57,39 @@ struct rtt_channel_struct {
 
 extern struct rtt_channel_struct rtt_channel[MAX_RTT_CHAN];
 
-// true if target memory access does not work when target running
-bool target_no_background_memory_access(target *cur_target);
+struct rtt_stats_struct {
+	uint32_t bytes;             // bytes forwarded between target and host
+	uint32_t polls;             // polls of this channel
+	uint32_t empty_polls;       // polls without data to forward
+	uint32_t dropped;           // bytes read from target but dropped on the host side
+};
+
+extern struct rtt_stats_struct rtt_stats[MAX_RTT_CHAN];
+extern uint32_t rtt_poll_ms;        // current adaptive time between polls (ms)
+extern uint32_t rtt_poll_errs;      // errors since control block found
+
+/* live watch: variables sampled at a fixed rate while the target runs */
+#define MAX_LIVE_WATCH  8
+#define LIVE_WATCH_CHAN MAX_RTT_CHAN // rtt_if channel the samples are sent on
+
+struct live_watch_struct {
+	uint32_t addr;
+	uint32_t size;              // 1, 2, 4 or 8 bytes
+};
+
+extern struct live_watch_struct live_watch[MAX_LIVE_WATCH]; // sorted by address
+extern uint32_t live_watch_count;   // number of variables watched
+extern uint32_t live_watch_period_ms; // time between samples (ms)
+extern uint32_t live_watch_blocks;  // target reads per sample
+extern uint32_t live_watch_samples; // samples sent
+extern uint32_t live_watch_dropped; // samples dropped on the host side
+extern uint32_t live_watch_errs;    // samples lost to read errors
+
+bool live_watch_add(uint32_t addr, uint32_t size);
+void live_watch_clear(void);
+
 void poll_rtt(target *cur_target);
+/* Address in target ram of the first match of pattern, 0 if there is none */
+uint32_t rtt_search(target *cur_target, const uint8_t *pattern, uint32_t len);
 
 #endif /* INCLUDE_RTT_H */
@@ -29,35 +29,36 @@
 
 /* rtt i/o to terminal */
 
-/* default buffer sizes, 8 bytes added to up buffer for alignment and padding */
-/* override RTT_UP_BUF_SIZE and RTT_DOWN_BUF_SIZE in platform.h if needed */
-
-#if !defined(RTT_UP_BUF_SIZE) || !defined(RTT_DOWN_BUF_SIZE)
-#if (PC_HOSTED == 1)
-#define RTT_UP_BUF_SIZE    (4096 + 8)
-#define RTT_DOWN_BUF_SIZE  (512)
-#elif defined(STM32F7)
-#define RTT_UP_BUF_SIZE    (4096 + 8)
-#define RTT_DOWN_BUF_SIZE  (2048)
-#elif defined(STM32F4)
-#define RTT_UP_BUF_SIZE    (2048 + 8)
-#define RTT_DOWN_BUF_SIZE  (256)
-#else /* stm32f103 */
-#define RTT_UP_BUF_SIZE    (1024 + 8)
-#define RTT_DOWN_BUF_SIZE  (256)
-#endif
-#endif
+/*
+ * RTT_UP_BUF_SIZE, with 8 bytes added for alignment and padding, and
+ * RTT_DOWN_BUF_SIZE come from the platform's memory profile
+ */
 
-/* hosted initialisation */
-int rtt_if_init(void);
+/* hosted initialisation, port_base != 0 serves channel n on tcp port port_base + n instead of the terminal */
+int rtt_if_init(uint16_t port_base);
 /* hosted teardown */
 int rtt_if_exit(void);
 
-/* target to host: write len bytes from the buffer starting at buf. return number bytes written */
-uint32_t rtt_write(const char *buf, uint32_t len);
-/* host to target: read one character, non-blocking. return character, -1 if no character */
-int32_t rtt_getchar();
-/* host to target: true if no characters available for reading */
-bool rtt_nodata();
+/* target to host: get a transmit buffer for up to *len bytes of channel data, plus 8 bytes for alignment
+   and padding. return NULL if no buffer is free */
+char *rtt_up_reserve(uint32_t channel, uint32_t *len);
+/* target to host: send len bytes placed in the buffer from rtt_up_reserve(). return number of bytes
+   sent, the rest was dropped because nobody is listening */
+uint32_t rtt_up_commit(uint32_t channel, uint32_t len);
+/* target to host: the transmit buffers as one block of *len bytes of scratch space, dropping pending data */
+char *rtt_up_scratch(uint32_t *len);
+#if PC_HOSTED == 0
+/* usb uart packet sent: queue the next rtt packet. return true if one was queued */
+bool rtt_up_send_complete(void);
+/* host to target: queue characters that came over the remote protocol, return how many fit */
+uint32_t rtt_down_put(const char *data, uint32_t len);
+#endif
+/* host to target: read one character for channel, non-blocking. return character, -1 if no character */
+int32_t rtt_getchar(uint32_t channel);
+/* host to target: true if no characters available for reading on channel */
+bool rtt_nodata(uint32_t channel);
+/* while set, up channel data goes to sink instead of the terminal, channel sockets or usb uart */
+typedef void (*rtt_if_sink_func)(uint32_t channel, const char *data, uint32_t len, void *ctx);
+void rtt_if_set_sink(rtt_if_sink_func sink, void *ctx);
 
 #endif /* INCLUDE_RTT_IF_H */
@@ -0,0 +1,54 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Standalone programmer: the probe keeps an image in its own storage and
+ * programs it into every target that is plugged in, or on a button press,
+ * without a host. The storage holds one header sector followed by the image.
+ */
+
+#ifndef INCLUDE_STANDALONE_H
+#define INCLUDE_STANDALONE_H
+
+#include "target.h"
+
+#define STANDALONE_MAGIC   0x41534d42U /* "BMSA" */
+#define STANDALONE_VERSION 1U
+
+typedef struct standalone_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t addr;          /* target address the image is programmed to */
+	uint32_t size;
+	uint32_t crc;           /* generic_crc32() of the image as it reads back from the target */
+	uint16_t designer_code; /* target the image is for, 0 for any */
+	uint16_t part_id;
+	char driver[24];        /* for the status report only */
+	uint32_t check;         /* ~(magic ^ addr ^ size ^ crc) */
+} standalone_header_s;
+
+/* Called while no target is attached: program on target power up or the button */
+void standalone_poll(void);
+/* Run one programming cycle now, true if the target passed */
+bool standalone_program(void);
+/* Store size bytes of t's memory at addr as the image, trailing erased bytes dropped */
+bool standalone_capture(target *t, uint32_t addr, uint32_t size);
+bool standalone_erase(void);
+/* "monitor standalone" report of the storage and the last cycle */
+void standalone_status(void);
+
+#endif /* INCLUDE_STANDALONE_H */
@@ -40,6 +40,9 @@ uint32_t platform_jtag_scan(const uint8_t *lrlens);
 #endif
 uint32_t adiv5_swdp_scan(uint32_t targetid);
 uint32_t jtag_scan(const uint8_t *lrlens);
+/* Reuse the targets of the last SWD scan when a rescan finds the same DP and APs */
+extern bool adiv5_scan_cache_enabled;
+void adiv5_scan_cache_flush(void);
 
 int target_foreach(void (*cb)(int i, target *t, void *context), void *context);
 void target_list_free(void);
@@ -55,13 +58,23 @@ unsigned int target_designer(target *t);
 unsigned int target_part_id(target *t);
 
 /* Memory access functions */
-bool target_mem_map(target *t, char *buf, size_t len);
+/* XML memory map for GDB, built on first use after attach, NULL if out of memory */
+const char *target_mem_map(target *t);
 int target_mem_read(target *t, void *dest, target_addr_t src, size_t len);
 int target_mem_write(target *t, target_addr_t dest, const void *src, size_t len);
+/* True if the target must be halted for memory access, false if it can be read and written while running */
+bool target_no_background_memory_access(target *t);
+/* Longest pattern target_mem_fill() and target_mem_find() take */
+#define TARGET_MEM_PATTERN_MAX 32U
+bool target_mem_fill(target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len);
+bool target_mem_find(
+	target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len, target_addr_t *found);
 /* Flash memory access functions */
 bool target_flash_erase(target *t, target_addr_t addr, size_t len);
 bool target_flash_write(target *t, target_addr_t dest, const void *src, size_t len);
 bool target_flash_complete(target *t);
+/* Move a background erase on while waiting for the host, true while there is more to do */
+bool target_flash_background(target *t);
 
 /* Register access functions */
 size_t target_regs_size(target *t);
@@ -83,10 +96,16 @@ enum target_halt_reason {
 };
 
 void target_reset(target *t);
+/* Reset and halt before the first instruction, true once the halt is confirmed */
+bool target_reset_halt(target *t);
 void target_halt_request(target *t);
 enum target_halt_reason target_halt_poll(target *t, target_addr_t *watch);
 void target_halt_resume(target *t, bool step);
 void target_set_cmdline(target *t, char *cmdline);
+#if PC_HOSTED == 0
+/* Send out semihosted stdout and stderr buffered on the probe */
+void target_stdout_drain(target *t);
+#endif
 void target_set_heapinfo(
 	target *t, target_addr_t heap_base, target_addr_t heap_limit, target_addr_t stack_base, target_addr_t stack_limit);
 
@@ -100,6 +119,7 @@ enum target_breakwatch {
 };
 int target_breakwatch_set(target *t, enum target_breakwatch, target_addr_t, size_t);
 int target_breakwatch_clear(target *t, enum target_breakwatch, target_addr_t, size_t);
+bool target_breakwatch_present(target *t, enum target_breakwatch, target_addr_t, size_t);
 
 /* Command interpreter */
 void target_command_help(target *t);
@@ -0,0 +1,181 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* LZ77 codec for compressed flash writes, the stream format is described in lz.h */
+
+#include "general.h"
+#include "lz.h"
+
+#define LZ_WINDOW_MASK (LZ_WINDOW_SIZE - 1U)
+
+enum lz_state {
+	LZ_TOKEN,
+	LZ_LITERAL,
+	LZ_DISTANCE_LOW,
+	LZ_DISTANCE_HIGH,
+};
+
+void lz_decode_start(lz_decoder_s *const dec, const size_t len, const lz_output_fn output, void *const ctx)
+{
+	dec->pos = 0;
+	dec->len = len;
+	dec->produced = 0;
+	dec->state = LZ_TOKEN;
+	dec->ok = true;
+	dec->output = output;
+	dec->ctx = ctx;
+}
+
+static void lz_put(lz_decoder_s *const dec, const uint8_t c)
+{
+	if (dec->produced == dec->len) {
+		dec->ok = false;
+		return;
+	}
+	dec->window[dec->pos++] = c;
+	++dec->produced;
+	if (dec->pos == LZ_WINDOW_SIZE) {
+		dec->pos = 0;
+		if (!dec->output(dec->ctx, dec->window, LZ_WINDOW_SIZE))
+			dec->ok = false;
+	}
+}
+
+static void lz_copy(lz_decoder_s *const dec)
+{
+	if (!dec->distance || dec->distance > LZ_WINDOW_SIZE || dec->distance > dec->produced) {
+		dec->ok = false;
+		return;
+	}
+	/* Byte by byte, so a copy may overlap its own output to repeat a short pattern */
+	for (size_t i = 0; dec->ok && i < dec->count; ++i)
+		lz_put(dec, dec->window[(dec->pos - dec->distance) & LZ_WINDOW_MASK]);
+}
+
+bool lz_decode(lz_decoder_s *const dec, const uint8_t *const data, const size_t len)
+{
+	for (size_t i = 0; dec->ok && i < len; ++i) {
+		const uint8_t c = data[i];
+		switch (dec->state) {
+		case LZ_TOKEN:
+			if (c & 0x80U) {
+				dec->count = (c & 0x7fU) + LZ_MATCH_MIN;
+				dec->state = LZ_DISTANCE_LOW;
+			} else {
+				dec->count = c + 1U;
+				dec->state = LZ_LITERAL;
+			}
+			break;
+		case LZ_LITERAL:
+			lz_put(dec, c);
+			if (!--dec->count)
+				dec->state = LZ_TOKEN;
+			break;
+		case LZ_DISTANCE_LOW:
+			dec->distance = c;
+			dec->state = LZ_DISTANCE_HIGH;
+			break;
+		case LZ_DISTANCE_HIGH:
+			dec->distance |= (uint16_t)(c << 8U);
+			lz_copy(dec);
+			dec->state = LZ_TOKEN;
+			break;
+		}
+	}
+	return dec->ok;
+}
+
+bool lz_decode_finish(lz_decoder_s *const dec)
+{
+	if (dec->ok && dec->pos && !dec->output(dec->ctx, dec->window, dec->pos))
+		dec->ok = false;
+	return dec->ok && dec->state == LZ_TOKEN && dec->produced == dec->len;
+}
+
+#if PC_HOSTED == 1
+#define LZ_HASH_BITS   12U
+#define LZ_CHAIN_DEPTH 32U
+
+static uint32_t lz_hash(const uint8_t *const p)
+{
+	const uint32_t v = p[0] | (p[1] << 8U) | ((uint32_t)p[2] << 16U) | ((uint32_t)p[3] << 24U);
+	return (v * 2654435761U) >> (32U - LZ_HASH_BITS);
+}
+
+static size_t lz_put_literals(uint8_t *dest, const uint8_t *src, size_t count)
+{
+	size_t out = 0;
+	while (count) {
+		const size_t run = MIN(count, LZ_LITERALS_MAX);
+		dest[out++] = (uint8_t)(run - 1U);
+		memcpy(dest + out, src, run);
+		out += run;
+		src += run;
+		count -= run;
+	}
+	return out;
+}
+
+/* Greedy, with hash chains over the window, which is plenty for erased padding and repeated tables */
+size_t lz_encode(uint8_t *const dest, const uint8_t *const src, const size_t len)
+{
+	int32_t head[1U << LZ_HASH_BITS];
+	int32_t prev[LZ_WINDOW_SIZE];
+	memset(head, 0xff, sizeof(head));
+	size_t out = 0;
+	size_t literals = 0;
+	size_t i = 0;
+	while (i < len) {
+		size_t best_len = 0;
+		size_t best_distance = 0;
+		if (len - i >= LZ_MATCH_MIN) {
+			const size_t max = MIN(LZ_MATCH_MAX, len - i);
+			int32_t candidate = head[lz_hash(src + i)];
+			for (size_t depth = 0; candidate >= 0 && i - (size_t)candidate <= LZ_WINDOW_SIZE && depth < LZ_CHAIN_DEPTH;
+				 ++depth, candidate = prev[candidate & LZ_WINDOW_MASK]) {
+				size_t n = 0;
+				while (n < max && src[candidate + n] == src[i + n])
+					++n;
+				if (n > best_len) {
+					best_len = n;
+					best_distance = i - (size_t)candidate;
+					if (n == max)
+						break;
+				}
+			}
+		}
+		const size_t step = best_len >= LZ_MATCH_MIN ? best_len : 1U;
+		if (step > 1U) {
+			out += lz_put_literals(dest + out, src + i - literals, literals);
+			literals = 0;
+			dest[out++] = (uint8_t)(0x80U | (best_len - LZ_MATCH_MIN));
+			dest[out++] = best_distance & 0xffU;
+			dest[out++] = best_distance >> 8U;
+		} else
+			++literals;
+		for (const size_t end = i + step; i < end; ++i) {
+			if (len - i < LZ_MATCH_MIN)
+				continue;
+			const uint32_t hash = lz_hash(src + i);
+			prev[i & LZ_WINDOW_MASK] = head[hash];
+			head[hash] = (int32_t)i;
+		}
+	}
+	out += lz_put_literals(dest + out, src + len - literals, literals);
+	return out;
+}
+#endif
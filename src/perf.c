@@ -0,0 +1,143 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Counters and section timings for 'monitor perf', see perf.h */
+
+#include "general.h"
+#include "gdb_packet.h"
+#include "perf.h"
+#ifdef ENABLE_RTT
+#include "rtt.h"
+#endif
+
+#if PC_HOSTED == 1
+#include <sys/time.h>
+#define PERF_UNIT "us"
+#else
+#include <libopencm3/cm3/dwt.h>
+#define PERF_UNIT "cycles"
+#endif
+
+typedef struct perf_timing {
+	uint32_t calls;
+	uint32_t total;
+	uint32_t max;
+} perf_timing_s;
+
+uint32_t perf_counters[PERF_COUNTER_COUNT];
+static perf_timing_s perf_timings[PERF_SECTION_COUNT];
+
+/* Packets counted by their first character, anything else goes in the last slot */
+static const char perf_packet_types[] = "?gGmMXpPcCsSvqQzZkD!";
+static uint32_t perf_packets[sizeof(perf_packet_types)];
+
+#ifdef ENABLE_RTT
+/* RTT keeps its own per channel counts, perf shows what moved since its last reset */
+static uint32_t perf_rtt_base;
+
+static uint32_t perf_rtt_bytes(void)
+{
+	uint32_t bytes = 0;
+	for (size_t i = 0; i < MAX_RTT_CHAN; ++i)
+		bytes += rtt_stats[i].bytes;
+	return bytes;
+}
+#endif
+
+static const char *const perf_counter_names[PERF_COUNTER_COUNT] = {
+	"DP reads",
+	"DP writes",
+	"AP reads",
+	"AP writes",
+	"WAIT acks",
+	"FAULT acks",
+	"Round trips",
+	"USB bytes in",
+	"USB bytes out",
+	"SWO bytes",
+};
+
+static const char *const perf_section_names[PERF_SECTION_COUNT] = {
+	"gdb_getpacket",
+	"target_mem_read",
+	"flash_buffered_flush",
+	"poll_rtt",
+};
+
+uint32_t perf_cycles(void)
+{
+#if PC_HOSTED == 1
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint32_t)(tv.tv_sec * 1000000U + tv.tv_usec);
+#else
+	/* The counter may have been stopped by a reset or never started */
+	if (!(DWT_CTRL & DWT_CTRL_CYCCNTENA))
+		dwt_enable_cycle_counter();
+	return dwt_read_cycle_counter();
+#endif
+}
+
+void perf_section_add(const perf_section_e section, const uint32_t start)
+{
+	perf_timing_s *const timing = &perf_timings[section];
+	const uint32_t elapsed = perf_cycles() - start;
+	++timing->calls;
+	timing->total += elapsed;
+	timing->max = MAX(timing->max, elapsed);
+}
+
+void perf_gdb_packet(const char type)
+{
+	size_t i = 0;
+	while (i < sizeof(perf_packet_types) - 1U && perf_packet_types[i] != type)
+		++i;
+	++perf_packets[i];
+}
+
+void perf_reset(void)
+{
+	memset(perf_counters, 0, sizeof(perf_counters));
+	memset(perf_timings, 0, sizeof(perf_timings));
+	memset(perf_packets, 0, sizeof(perf_packets));
+#ifdef ENABLE_RTT
+	perf_rtt_base = perf_rtt_bytes();
+#endif
+}
+
+void perf_print(void)
+{
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+		gdb_outf("%-14s %10" PRIu32 "\n", perf_counter_names[i], perf_counters[i]);
+#ifdef ENABLE_RTT
+	gdb_outf("%-14s %10" PRIu32 "\n", "RTT bytes", perf_rtt_bytes() - perf_rtt_base);
+#endif
+
+	gdb_out("GDB packets:");
+	for (size_t i = 0; i < sizeof(perf_packet_types); ++i) {
+		if (perf_packets[i])
+			gdb_outf(" %c:%" PRIu32, perf_packet_types[i] ? perf_packet_types[i] : '*', perf_packets[i]);
+	}
+	gdb_out("\n");
+
+	gdb_outf("%-20s %10s %12s %10s (" PERF_UNIT ")\n", "section", "calls", "total", "max");
+	for (size_t i = 0; i < PERF_SECTION_COUNT; ++i) {
+		const perf_timing_s *const timing = &perf_timings[i];
+		gdb_outf("%-20s %10" PRIu32 " %12" PRIu32 " %10" PRIu32 "\n", perf_section_names[i], timing->calls,
+			timing->total, timing->max);
+	}
+}
@@ -137,6 +137,13 @@
 #define TRACE_TIM_CLK_EN() rcc_periph_clock_enable(RCC_TIM3)
 #define TRACE_IRQ   NVIC_TIM3_IRQ
 #define TRACE_ISR(x) tim3_isr(x)
+/* TIM3_CH1 DMA request, captures are moved to memory by DMA */
+#define TRACE_DMA_BUS DMA1
+#define TRACE_DMA_CLK RCC_DMA1
+#define TRACE_DMA_STREAM DMA_STREAM4
+#define TRACE_DMA_TRG DMA_SxCR_CHSEL_5
+#define TRACE_DMA_IRQ NVIC_DMA1_STREAM4_IRQ
+#define TRACE_DMA_ISR(x) dma1_stream4_isr(x)
 
 #define DEBUG(...)
 
@@ -36,18 +36,26 @@
 #include "general.h"
 #include "usb_serial.h"
 #include "aux_serial.h"
+#include <assert.h>
 
-static char aux_serial_receive_buffer[AUX_UART_BUFFER_SIZE];
-/* Fifo in pointer, writes assumed to be atomic, should be only incremented within RX ISR */
-static uint8_t aux_serial_receive_write_index = 0;
-/* Fifo out pointer, writes assumed to be atomic, should be only incremented outside RX ISR */
-static uint8_t aux_serial_receive_read_index = 0;
+/* Filled by the receive DMA or ISR, drained to USB from outside it */
+static char aux_serial_receive_buffer[AUX_UART_RX_BUFFER_SIZE];
+static ring_s aux_serial_receive_ring = RING_INIT(aux_serial_receive_buffer);
+static_assert((AUX_UART_RX_BUFFER_SIZE & (AUX_UART_RX_BUFFER_SIZE - 1U)) == 0, "AUX_UART_RX_BUFFER_SIZE must be a power of 2");
 
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4)
-static char aux_serial_transmit_buffer[2U][AUX_UART_BUFFER_SIZE];
-static uint8_t aux_serial_transmit_buffer_index = 0;
-static uint8_t aux_serial_transmit_buffer_consumed = 0;
-static bool aux_serial_transmit_complete = true;
+/*
+ * USB packets are read straight into the transmit ring at the write index,
+ * and DMA sends from the read index on, as much as is contiguous each time.
+ * When the end has no room for a whole packet the write index wraps early,
+ * the end index noting where the data stops until DMA has caught up.
+ */
+static char aux_serial_transmit_buffer[AUX_UART_TX_BUFFER_SIZE];
+static volatile uint16_t aux_serial_transmit_write_index = 0;
+static volatile uint16_t aux_serial_transmit_read_index = 0;
+static volatile uint16_t aux_serial_transmit_end_index = AUX_UART_TX_BUFFER_SIZE;
+/* Bytes the DMA transfer in flight sends, 0 while it is idle */
+static volatile uint16_t aux_serial_transmit_dma_len = 0;
 
 static volatile uint8_t aux_serial_led_state = 0;
 
@@ -130,7 +138,7 @@ void aux_serial_init(void)
 	dma_channel_reset(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN);
 	dma_set_peripheral_address(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN, (uintptr_t)&USBUSART_RDR);
 	dma_set_memory_address(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN, (uintptr_t)aux_serial_receive_buffer);
-	dma_set_number_of_data(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN, AUX_UART_BUFFER_SIZE);
+	dma_set_number_of_data(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN, AUX_UART_RX_BUFFER_SIZE);
 	dma_enable_memory_increment_mode(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN);
 	dma_enable_circular_mode(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN);
 	dma_set_peripheral_size(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN, DMA_PSIZE_8BIT);
@@ -208,9 +216,39 @@ void aux_serial_init(void)
 }
 #endif
 
+#if defined(STM32F4)
+/*
+ * Oversampling by 16 tops out at a 16th of the USART's clock, 2.6 Mbaud on
+ * the F4's APB1. Above that switch to oversampling by 8, for which the BRR
+ * fraction has 3 bits, so 2 to 4 Mbaud consoles work on any USART.
+ */
+static void aux_serial_set_baudrate(const uint32_t baud_rate)
+{
+	const uint32_t clock = USBUSART == USART1 || USBUSART == USART6 ? rcc_apb2_frequency : rcc_apb1_frequency;
+	const bool over8 = baud_rate > clock / 16U;
+	/* OVER8 may only change with the USART disabled */
+	if (over8 != !!(USART_CR1(USBUSART) & USART_CR1_OVER8)) {
+		usart_disable(USBUSART);
+		if (over8)
+			USART_CR1(USBUSART) |= USART_CR1_OVER8;
+		else
+			USART_CR1(USBUSART) &= ~USART_CR1_OVER8;
+		usart_enable(USBUSART);
+	}
+	if (!over8) {
+		usart_set_baudrate(USBUSART, baud_rate);
+		return;
+	}
+	const uint32_t divider = (2U * clock + baud_rate / 2U) / baud_rate;
+	USART_BRR(USBUSART) = (divider & 0xfff0U) | ((divider & 0x000fU) >> 1U);
+}
+#else
+#define aux_serial_set_baudrate(baud_rate) usart_set_baudrate(USBUSART, baud_rate)
+#endif
+
 void aux_serial_set_encoding(struct usb_cdc_line_coding *coding)
 {
-	usart_set_baudrate(USBUSART, coding->dwDTERate);
+	aux_serial_set_baudrate(coding->dwDTERate);
 
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4)
 	if (coding->bParityType)
@@ -264,65 +302,82 @@ void aux_serial_clear_led(const aux_serial_led_e led)
 
 char *aux_serial_current_transmit_buffer(void)
 {
-	return aux_serial_transmit_buffer[aux_serial_transmit_buffer_index];
+	return aux_serial_transmit_buffer + aux_serial_transmit_write_index;
 }
 
-size_t aux_serial_transmit_buffer_fullness(void)
+/* Called with the TX DMA interrupt held off, or from it */
+static size_t aux_serial_transmit_room(void)
 {
-	return aux_serial_transmit_buffer_consumed;
+	const size_t read_index = aux_serial_transmit_read_index;
+	const size_t write_index = aux_serial_transmit_write_index;
+	/* A gap of one keeps a full ring from looking empty */
+	if (write_index < read_index)
+		return read_index - write_index - 1U;
+	if (AUX_UART_TX_BUFFER_SIZE - write_index >= CDCACM_PACKET_SIZE || read_index <= CDCACM_PACKET_SIZE)
+		return AUX_UART_TX_BUFFER_SIZE - write_index;
+	aux_serial_transmit_end_index = write_index;
+	aux_serial_transmit_write_index = 0;
+	return read_index - 1U;
 }
 
-/*
- * Changes USBUSART TX buffer in which data is accumulated from USB.
- * Filled buffer is submitted to DMA for transfer.
- */
-void aux_serial_switch_transmit_buffers(void)
+size_t aux_serial_transmit_buffer_room(void)
 {
-	/* Make the buffer we've been filling the active DMA buffer, and swap to the other */
-	dma_set_memory_address(USBUSART_DMA_BUS, USBUSART_DMA_TX_CHAN, (uintptr_t)aux_serial_current_transmit_buffer());
-	dma_set_number_of_data(USBUSART_DMA_BUS, USBUSART_DMA_TX_CHAN, aux_serial_transmit_buffer_consumed);
-	dma_enable_channel(USBUSART_DMA_BUS, USBUSART_DMA_TX_CHAN);
+	CM_ATOMIC_CONTEXT();
+	return aux_serial_transmit_room();
+}
 
-	/* Change active buffer */
-	aux_serial_transmit_buffer_consumed = 0;
-	aux_serial_transmit_buffer_index ^= 1;
+/* Hand DMA the data from the read index that is contiguous, called with it idle */
+static void aux_serial_transmit_start(void)
+{
+	const size_t write_index = aux_serial_transmit_write_index;
+	if (write_index < aux_serial_transmit_read_index &&
+		aux_serial_transmit_read_index == aux_serial_transmit_end_index) {
+		aux_serial_transmit_read_index = 0;
+		aux_serial_transmit_end_index = AUX_UART_TX_BUFFER_SIZE;
+	}
+	const size_t read_index = aux_serial_transmit_read_index;
+	const size_t end_index = write_index >= read_index ? write_index : aux_serial_transmit_end_index;
+	aux_serial_transmit_dma_len = end_index - read_index;
+	if (!aux_serial_transmit_dma_len) {
+		aux_serial_clear_led(AUX_SERIAL_LED_TX);
+		return;
+	}
+	dma_set_memory_address(USBUSART_DMA_BUS, USBUSART_DMA_TX_CHAN, (uintptr_t)(aux_serial_transmit_buffer + read_index));
+	dma_set_number_of_data(USBUSART_DMA_BUS, USBUSART_DMA_TX_CHAN, aux_serial_transmit_dma_len);
+	dma_enable_channel(USBUSART_DMA_BUS, USBUSART_DMA_TX_CHAN);
+	aux_serial_set_led(AUX_SERIAL_LED_TX);
 }
 
 void aux_serial_send(const size_t len)
 {
-	aux_serial_transmit_buffer_consumed += len;
-
+	CM_ATOMIC_CONTEXT();
+	aux_serial_transmit_write_index += len;
 	/* If DMA is idle, schedule new transfer */
-	if (len && aux_serial_transmit_complete)
-	{
-		aux_serial_transmit_complete = false;
-		aux_serial_switch_transmit_buffers();
-		aux_serial_set_led(AUX_SERIAL_LED_TX);
-	}
+	if (len && !aux_serial_transmit_dma_len)
+		aux_serial_transmit_start();
 }
 
 void aux_serial_update_receive_buffer_fullness(void)
 {
-	aux_serial_receive_write_index =
-		AUX_UART_BUFFER_SIZE - dma_get_number_of_data(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN);
-	aux_serial_receive_write_index %= AUX_UART_BUFFER_SIZE;
+	/* The DMA fills the ring circularly, so the head just follows its position */
+	ring_write_to(&aux_serial_receive_ring,
+		AUX_UART_RX_BUFFER_SIZE - dma_get_number_of_data(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN));
 }
 
 bool aux_serial_receive_buffer_empty(void)
 {
-	return aux_serial_receive_write_index == aux_serial_receive_read_index;
+	return !ring_used(&aux_serial_receive_ring);
 }
 
 void aux_serial_drain_receive_buffer(void)
 {
-	aux_serial_receive_read_index = aux_serial_receive_write_index;
+	ring_discard(&aux_serial_receive_ring);
 	aux_serial_clear_led(AUX_SERIAL_LED_RX);
 }
 
 void aux_serial_stage_receive_buffer(void)
 {
-	aux_serial_receive_read_index = debug_serial_fifo_send(
-		aux_serial_receive_buffer, aux_serial_receive_read_index, aux_serial_receive_write_index);
+	debug_serial_ring_send(&aux_serial_receive_ring);
 }
 
 static void aux_serial_receive_isr(const uint32_t usart, const uint8_t dma_irq)
@@ -352,17 +407,11 @@ static void aux_serial_dma_transmit_isr(const uint8_t dma_tx_channel)
 	dma_disable_channel(USBUSART_DMA_BUS, dma_tx_channel);
 	dma_clear_interrupt_flags(USBUSART_DMA_BUS, dma_tx_channel, DMA_CGIF);
 
-	/*
-	 * If a new buffer is ready, continue transmission.
-	 * Otherwise we report the transfer has completed.
-	 */
-	if (aux_serial_transmit_buffer_fullness()) {
-		aux_serial_switch_transmit_buffers();
+	/* Continue with whatever USB added meanwhile, and take more from it once there's room */
+	aux_serial_transmit_read_index += aux_serial_transmit_dma_len;
+	aux_serial_transmit_start();
+	if (aux_serial_transmit_room() >= CDCACM_PACKET_SIZE)
 		usbd_ep_nak_set(usbdev, CDCACM_UART_ENDPOINT, 0);
-	} else {
-		aux_serial_clear_led(AUX_SERIAL_LED_TX);
-		aux_serial_transmit_complete = true;
-	}
 
 	nvic_enable_irq(USB_IRQ);
 }
@@ -468,9 +517,9 @@ char *aux_serial_current_transmit_buffer(void)
 	return aux_serial_transmit_buffer;
 }
 
-size_t aux_serial_transmit_buffer_fullness(void)
+size_t aux_serial_transmit_buffer_room(void)
 {
-	return 0;
+	return sizeof(aux_serial_transmit_buffer);
 }
 
 void aux_serial_send(const size_t len)
@@ -481,8 +530,7 @@ void aux_serial_send(const size_t len)
 
 /*
  * Read a character from the UART RX and stuff it in a software FIFO.
- * Allowed to read from FIFO out pointer, but not write to it.
- * Allowed to write to FIFO in pointer.
+ * The ISR is the ring's producer, and then its consumer as well when flushing.
  */
 void USBUART_ISR(void)
 {
@@ -491,43 +539,20 @@ void USBUART_ISR(void)
 	while (!uart_is_rx_fifo_empty(USBUART)) {
 		const char c = uart_recv(USBUART);
 
-		/* If the next increment of rx_in would put it at the same point
-		* as rx_out, the FIFO is considered full.
-		*/
-		if (((aux_serial_receive_write_index + 1) % AUX_UART_BUFFER_SIZE) != aux_serial_receive_read_index) {
-			/* insert into FIFO */
-			aux_serial_receive_buffer[aux_serial_receive_write_index++] = c;
-
-			/* wrap out pointer */
-			if (aux_serial_receive_write_index >= AUX_UART_BUFFER_SIZE)
-				aux_serial_receive_write_index = 0;
-		} else
+		/* A full FIFO drops the character and sends what it has */
+		if (!ring_write(&aux_serial_receive_ring, &c, 1U))
 			flush = true;
 	}
 
 	if (flush) {
 		/* forcibly empty fifo if no USB endpoint */
 		if (usb_get_config() != 1) {
-			aux_serial_receive_read_index = aux_serial_receive_write_index;
+			ring_discard(&aux_serial_receive_ring);
 			return;
 		}
 
-		char packet_buf[CDCACM_PACKET_SIZE];
-		uint8_t packet_size = 0;
-		uint8_t buf_out = aux_serial_receive_read_index;
-
-		/* copy from uart FIFO into local usb packet buffer */
-		while (aux_serial_receive_write_index != buf_out && packet_size < CDCACM_PACKET_SIZE) {
-			packet_buf[packet_size++] = aux_serial_receive_buffer[buf_out++];
-
-			/* wrap out pointer */
-			if (buf_out >= AUX_UART_BUFFER_SIZE)
-				buf_out = 0;
-		}
-
-		/* advance fifo out pointer by amount written */
-		aux_serial_receive_read_index += usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, packet_buf, packet_size);
-		aux_serial_receive_read_index %= AUX_UART_BUFFER_SIZE;
+		/* send straight from the FIFO, the tail only moving by what was written */
+		debug_serial_ring_send(&aux_serial_receive_ring);
 	}
 }
 #endif
@@ -35,6 +35,11 @@
 
 #define USART_DMA_BUF_SIZE  (1U << USART_DMA_BUF_SHIFT)
 #define AUX_UART_BUFFER_SIZE (USART_DMA_BUF_SIZE)
+/*
+ * The receive DMA ring and the transmit ring USB packets are read straight
+ * into come from the memory profile. The receive ring size must be a power
+ * of 2, the transmit ring must take at least two USB packets.
+ */
 #elif defined(LM4F)
 #define AUX_UART_BUFFER_SIZE 128
 #endif
@@ -50,14 +55,12 @@ typedef enum aux_serial_led {
 
 void aux_serial_set_led(aux_serial_led_e led);
 void aux_serial_clear_led(aux_serial_led_e led);
-
-void aux_serial_switch_transmit_buffers(void);
 #endif
 
-/* Get the current transmit buffer to stage data into */
+/* Get where the next data to transmit is to be staged */
 char *aux_serial_current_transmit_buffer(void);
-/* Get how full the current transmit buffer is */
-size_t aux_serial_transmit_buffer_fullness(void);
+/* Get the room there, a USB packet is only read in once it has enough */
+size_t aux_serial_transmit_buffer_room(void);
 /* Send a number of bytes staged into the current transmit bufer */
 void aux_serial_send(size_t len);
 
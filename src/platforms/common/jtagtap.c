@@ -29,11 +29,11 @@
 jtag_proc_t jtag_proc;
 
 static void jtagtap_reset(void);
-static void jtagtap_tms_seq(uint32_t tms_states, size_t ticks);
-static void jtagtap_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t ticks);
-static void jtagtap_tdi_seq(bool final_tms, const uint8_t *data_in, size_t ticks);
-static bool jtagtap_next(bool tms, bool tdi);
-static void jtagtap_cycle(bool tms, bool tdi, size_t clock_cycles);
+static void jtagtap_tms_seq(uint32_t tms_states, size_t ticks) RAMFUNC;
+static void jtagtap_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t ticks) RAMFUNC;
+static void jtagtap_tdi_seq(bool final_tms, const uint8_t *data_in, size_t ticks) RAMFUNC;
+static bool jtagtap_next(bool tms, bool tdi) RAMFUNC;
+static void jtagtap_cycle(bool tms, bool tdi, size_t clock_cycles) RAMFUNC;
 
 int jtagtap_init()
 {
@@ -70,7 +70,7 @@ static void jtagtap_reset(void)
 	jtagtap_soft_reset();
 }
 
-static bool jtagtap_next_swd_delay()
+static RAMFUNC bool jtagtap_next_swd_delay()
 {
 	gpio_set(TCK_PORT, TCK_PIN);
 	for (volatile int32_t cnt = swd_delay_cnt - 2U; cnt > 0; cnt--)
@@ -82,7 +82,7 @@ static bool jtagtap_next_swd_delay()
 	return result != 0;
 }
 
-static bool jtagtap_next_no_delay()
+static RAMFUNC bool jtagtap_next_no_delay()
 {
 	gpio_set(TCK_PORT, TCK_PIN);
 	const uint16_t result = gpio_get(TDO_PORT, TDO_PIN);
@@ -100,7 +100,7 @@ static bool jtagtap_next(const bool tms, const bool tdi)
 		return jtagtap_next_no_delay();
 }
 
-static void jtagtap_tms_seq_swd_delay(uint32_t tms_states, size_t ticks)
+static RAMFUNC void jtagtap_tms_seq_swd_delay(uint32_t tms_states, size_t ticks)
 {
 	while (ticks) {
 		const bool state = tms_states & 1;
@@ -116,7 +116,7 @@ static void jtagtap_tms_seq_swd_delay(uint32_t tms_states, size_t ticks)
 	}
 }
 
-static void jtagtap_tms_seq_no_delay(uint32_t tms_states, size_t ticks)
+static RAMFUNC void jtagtap_tms_seq_no_delay(uint32_t tms_states, size_t ticks)
 {
 	while (ticks) {
 		const bool state = tms_states & 1;
@@ -138,7 +138,7 @@ static void jtagtap_tms_seq(const uint32_t tms_states, const size_t ticks)
 		jtagtap_tms_seq_no_delay(tms_states, ticks);
 }
 
-static void jtagtap_tdi_tdo_seq_swd_delay(const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, size_t clock_cycles)
+static RAMFUNC void jtagtap_tdi_tdo_seq_swd_delay(const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, size_t clock_cycles)
 {
 	size_t byte = 0;
 	size_t index = 0;
@@ -168,7 +168,7 @@ static void jtagtap_tdi_tdo_seq_swd_delay(const uint8_t *const data_in, uint8_t
 		data_out[byte] = value;
 }
 
-static void jtagtap_tdi_tdo_seq_no_delay(const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, size_t clock_cycles)
+static RAMFUNC void jtagtap_tdi_tdo_seq_no_delay(const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, size_t clock_cycles)
 {
 	size_t byte = 0;
 	size_t index = 0;
@@ -195,17 +195,47 @@ static void jtagtap_tdi_tdo_seq_no_delay(const uint8_t *const data_in, uint8_t *
 		data_out[byte] = value;
 }
 
+#ifdef PLATFORM_HAS_JTAG_SPI
+/* Scans shorter than this many whole bytes are not worth switching the pins over to the SPI */
+#define JTAG_SPI_MIN_BYTES 4U
+
+/*
+ * Shift the whole bytes at the start of a scan through the platform's SPI and
+ * return how many were done. At least the final bit is always left to
+ * software, it may need TMS raised to leave the shift state.
+ */
+static size_t jtagtap_spi_shift(const uint8_t *const data_in, uint8_t *const data_out, const size_t clock_cycles)
+{
+	if (swd_delay_cnt || clock_cycles < 1U)
+		return 0;
+	const size_t bytes = (clock_cycles - 1U) >> 3U;
+	if (bytes < JTAG_SPI_MIN_BYTES || !platform_jtag_spi_shift(data_in, data_out, bytes))
+		return 0;
+	return bytes;
+}
+#else
+static inline size_t jtagtap_spi_shift(const uint8_t *const data_in, uint8_t *const data_out, const size_t clock_cycles)
+{
+	(void)data_in;
+	(void)data_out;
+	(void)clock_cycles;
+	return 0;
+}
+#endif
+
 static void jtagtap_tdi_tdo_seq(uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, size_t ticks)
 {
 	gpio_clear(TMS_PORT, TMS_PIN);
 	gpio_clear(TDI_PORT, TDI_PIN);
 	if (swd_delay_cnt)
 		jtagtap_tdi_tdo_seq_swd_delay(data_in, data_out, final_tms, ticks);
-	else
-		jtagtap_tdi_tdo_seq_no_delay(data_in, data_out, final_tms, ticks);
+	else {
+		const size_t bytes = jtagtap_spi_shift(data_in, data_out, ticks);
+		jtagtap_tdi_tdo_seq_no_delay(data_in + bytes, data_out + bytes, final_tms, ticks - (bytes << 3U));
+	}
 }
 
-static void jtagtap_tdi_seq_swd_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
+static RAMFUNC void jtagtap_tdi_seq_swd_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
 {
 	size_t byte = 0;
 	size_t index = 0;
@@ -229,7 +259,7 @@ static void jtagtap_tdi_seq_swd_delay(const uint8_t *const data_in, const bool f
 	}
 }
 
-static void jtagtap_tdi_seq_no_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
+static RAMFUNC void jtagtap_tdi_seq_no_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
 {
 	size_t byte = 0;
 	size_t index = 0;
@@ -254,11 +284,13 @@ static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *const data_in,
 	gpio_clear(TMS_PORT, TMS_PIN);
 	if (swd_delay_cnt)
 		jtagtap_tdi_seq_swd_delay(data_in, final_tms, ticks);
-	else
-		jtagtap_tdi_seq_no_delay(data_in, final_tms, ticks);
+	else {
+		const size_t bytes = jtagtap_spi_shift(data_in, NULL, ticks);
+		jtagtap_tdi_seq_no_delay(data_in + bytes, final_tms, ticks - (bytes << 3U));
+	}
 }
 
-static void jtagtap_cycle_swd_delay(const size_t clock_cycles)
+static RAMFUNC void jtagtap_cycle_swd_delay(const size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
 		gpio_set(TCK_PORT, TCK_PIN);
@@ -270,7 +302,7 @@ static void jtagtap_cycle_swd_delay(const size_t clock_cycles)
 	}
 }
 
-static void jtagtap_cycle_no_delay(const size_t clock_cycles)
+static RAMFUNC void jtagtap_cycle_no_delay(const size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
 		gpio_set(TCK_PORT, TCK_PIN);
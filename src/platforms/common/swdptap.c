@@ -29,19 +29,43 @@ typedef enum swdio_status_e {
 	SWDIO_STATUS_DRIVE
 } swdio_status_t;
 
-static void swdptap_turnaround(swdio_status_t dir) __attribute__((optimize(3)));
-static uint32_t swdptap_seq_in(size_t clock_cycles) __attribute__((optimize(3)));
-static bool swdptap_seq_in_parity(uint32_t *ret, size_t clock_cycles) __attribute__((optimize(3)));
-static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles) __attribute__((optimize(3)));
-static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles) __attribute__((optimize(3)));
+static void swdptap_turnaround(swdio_status_t dir) RAMFUNC __attribute__((optimize(3)));
+static uint32_t swdptap_seq_in(size_t clock_cycles) RAMFUNC __attribute__((optimize(3)));
+static bool swdptap_seq_in_parity(uint32_t *ret, size_t clock_cycles) RAMFUNC __attribute__((optimize(3)));
+static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles) RAMFUNC __attribute__((optimize(3)));
+static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles) RAMFUNC __attribute__((optimize(3)));
+
+/*
+ * Lower SWCLK and drive SWDIO with the next bit, the moment the target expects
+ * data to change. Where both share a port this is one BSRR write rather than
+ * a branch on the bit followed by two stores.
+ */
+static inline void swdptap_clock_low_data(bool bit) __attribute__((always_inline));
+static inline void swdptap_clock_low_data(const bool bit)
+{
+#if defined(GPIO_BSRR)
+	if (SWDIO_PORT == SWCLK_PORT) {
+		const uint32_t bsrr = ((uint32_t)SWCLK_PIN << 16U) | ((uint32_t)SWDIO_PIN << (bit ? 0U : 16U));
+		GPIO_BSRR(SWCLK_PORT) = bsrr;
+#ifdef STM32F4
+		/* Keep the doubled write of gpio_clear() so the low phase is as long as before */
+		GPIO_BSRR(SWCLK_PORT) = bsrr;
+#endif
+		return;
+	}
+#endif
+	gpio_set_val(SWDIO_PORT, SWDIO_PIN, bit);
+	gpio_clear(SWCLK_PORT, SWCLK_PIN);
+}
+
+static swdio_status_t swdptap_dir = SWDIO_STATUS_FLOAT;
 
 static void swdptap_turnaround(const swdio_status_t dir)
 {
-	static swdio_status_t olddir = SWDIO_STATUS_FLOAT;
 	/* Don't turnaround if direction not changing */
-	if (dir == olddir)
+	if (dir == swdptap_dir)
 		return;
-	olddir = dir;
+	swdptap_dir = dir;
 
 #ifdef DEBUG_SWD_BITS
 	DEBUG("%s", dir ? "\n-> " : "\n<- ");
@@ -59,7 +83,7 @@ static void swdptap_turnaround(const swdio_status_t dir)
 		SWDIO_MODE_DRIVE();
 }
 
-static uint32_t swdptap_seq_in_swd_delay(size_t clock_cycles) __attribute__((optimize(3)));
+static uint32_t swdptap_seq_in_swd_delay(size_t clock_cycles) RAMFUNC __attribute__((optimize(3)));
 static uint32_t swdptap_seq_in_swd_delay(const size_t clock_cycles)
 {
 	uint32_t value = 0;
@@ -77,7 +101,7 @@ static uint32_t swdptap_seq_in_swd_delay(const size_t clock_cycles)
 	return value;
 }
 
-static uint32_t swdptap_seq_in_no_delay(size_t clock_cycles) __attribute__((optimize(3)));
+static uint32_t swdptap_seq_in_no_delay(size_t clock_cycles) RAMFUNC __attribute__((optimize(3)));
 static uint32_t swdptap_seq_in_no_delay(const size_t clock_cycles)
 {
 	uint32_t value = 0;
@@ -119,7 +143,7 @@ static bool swdptap_seq_in_parity(uint32_t *ret, size_t clock_cycles)
 	return parity & 1;
 }
 
-static void swdptap_seq_out_swd_delay(uint32_t tms_states, size_t clock_cycles) __attribute__((optimize(3)));
+static void swdptap_seq_out_swd_delay(uint32_t tms_states, size_t clock_cycles) RAMFUNC __attribute__((optimize(3)));
 static void swdptap_seq_out_swd_delay(const uint32_t tms_states, const size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles;) {
@@ -127,21 +151,19 @@ static void swdptap_seq_out_swd_delay(const uint32_t tms_states, const size_t cl
 		gpio_set(SWCLK_PORT, SWCLK_PIN);
 		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
 			continue;
-		gpio_set_val(SWDIO_PORT, SWDIO_PIN, tms_states & (1 << cycle));
-		gpio_clear(SWCLK_PORT, SWCLK_PIN);
+		swdptap_clock_low_data(tms_states & (1U << cycle));
 		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
 			continue;
 	}
 }
 
-static void swdptap_seq_out_no_delay(uint32_t tms_states, size_t clock_cycles) __attribute__((optimize(3)));
+static void swdptap_seq_out_no_delay(uint32_t tms_states, size_t clock_cycles) RAMFUNC __attribute__((optimize(3)));
 static void swdptap_seq_out_no_delay(const uint32_t tms_states, const size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles;) {
 		++cycle;
 		gpio_set(SWCLK_PORT, SWCLK_PIN);
-		gpio_set_val(SWDIO_PORT, SWDIO_PIN, tms_states & (1 << cycle));
-		gpio_clear(SWCLK_PORT, SWCLK_PIN);
+		swdptap_clock_low_data(tms_states & (1U << cycle));
 	}
 }
 
@@ -168,12 +190,167 @@ static void swdptap_seq_out_parity(const uint32_t tms_states, const size_t clock
 		continue;
 }
 
+/*
+ * The fused transaction, built from these with delay fixed at compile time so
+ * each of its two copies has the delay loops either inlined or gone.
+ */
+static inline void swdptap_half_cycle(bool delay) __attribute__((always_inline));
+static inline void swdptap_half_cycle(const bool delay)
+{
+	if (delay) {
+		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
+			continue;
+	}
+}
+
+static inline void swdptap_clock(bool delay) __attribute__((always_inline));
+static inline void swdptap_clock(const bool delay)
+{
+	gpio_set(SWCLK_PORT, SWCLK_PIN);
+	swdptap_half_cycle(delay);
+	gpio_clear(SWCLK_PORT, SWCLK_PIN);
+	swdptap_half_cycle(delay);
+}
+
+/* Clock out cycles bits of value with SWDIO driven, leaving next on the line after them */
+static inline void swdptap_bits_out(uint32_t value, size_t cycles, bool next, bool delay) __attribute__((always_inline));
+static inline void swdptap_bits_out(const uint32_t value, const size_t cycles, const bool next, const bool delay)
+{
+	gpio_set_val(SWDIO_PORT, SWDIO_PIN, value & 1U);
+	for (size_t cycle = 1; cycle <= cycles; ++cycle) {
+		gpio_set(SWCLK_PORT, SWCLK_PIN);
+		swdptap_half_cycle(delay);
+		swdptap_clock_low_data(cycle < cycles ? value & (1U << cycle) : next);
+		swdptap_half_cycle(delay);
+	}
+}
+
+static inline uint32_t swdptap_bits_in(size_t cycles, bool delay) __attribute__((always_inline));
+static inline uint32_t swdptap_bits_in(const size_t cycles, const bool delay)
+{
+	uint32_t value = 0;
+	for (size_t cycle = 0; cycle < cycles; ++cycle) {
+		if (gpio_get(SWDIO_PORT, SWDIO_PIN))
+			value |= 1U << cycle;
+		gpio_set(SWCLK_PORT, SWCLK_PIN);
+		swdptap_half_cycle(delay);
+		gpio_clear(SWCLK_PORT, SWCLK_PIN);
+		swdptap_half_cycle(delay);
+	}
+	return value;
+}
+
+/* Turnaround back to the host driving SWDIO, after an ACK or read data */
+static inline void swdptap_turn_drive(bool delay) __attribute__((always_inline));
+static inline void swdptap_turn_drive(const bool delay)
+{
+	swdptap_clock(delay);
+	SWDIO_MODE_DRIVE();
+	swdptap_dir = SWDIO_STATUS_DRIVE;
+}
+
+static inline uint8_t swdptap_transaction_body(uint8_t request, uint32_t *data, bool data_phase, bool delay)
+	__attribute__((always_inline));
+static inline uint8_t swdptap_transaction_body(
+	const uint8_t request, uint32_t *const data, const bool data_phase, const bool delay)
+{
+	if (swdptap_dir != SWDIO_STATUS_DRIVE)
+		swdptap_turn_drive(delay);
+	/* Request, the park bit left on the line through the turnaround */
+	swdptap_bits_out(request, 8U, true, delay);
+	SWDIO_MODE_FLOAT();
+	swdptap_dir = SWDIO_STATUS_FLOAT;
+	swdptap_clock(delay);
+	uint8_t ack = swdptap_bits_in(3U, delay);
+	if (ack != SWDP_ACK_OK && !data_phase) {
+		swdptap_turn_drive(delay);
+		return ack;
+	}
+
+	/* RnW, bit 2 of the request */
+	if (request & 0x04U) {
+		const uint32_t value = swdptap_bits_in(32U, delay);
+		const bool parity = swdptap_bits_in(1U, delay);
+		swdptap_turn_drive(delay);
+		if ((__builtin_popcount(value) + parity) & 1)
+			ack |= SWDP_ACK_PARITY;
+		*data = value;
+	} else {
+		swdptap_turn_drive(delay);
+		const uint32_t value = *data;
+		swdptap_bits_out(value, 32U, __builtin_popcount(value) & 1, delay);
+		swdptap_clock(delay);
+	}
+	return ack;
+}
+
+static uint8_t swdptap_transaction_swd_delay(uint8_t request, uint32_t *data, bool data_phase)
+	RAMFUNC __attribute__((optimize(3)));
+static uint8_t swdptap_transaction_swd_delay(const uint8_t request, uint32_t *const data, const bool data_phase)
+{
+	return swdptap_transaction_body(request, data, data_phase, true);
+}
+
+static uint8_t swdptap_transaction_no_delay(uint8_t request, uint32_t *data, bool data_phase)
+	RAMFUNC __attribute__((optimize(3)));
+static uint8_t swdptap_transaction_no_delay(const uint8_t request, uint32_t *const data, const bool data_phase)
+{
+	return swdptap_transaction_body(request, data, data_phase, false);
+}
+
+static uint8_t swdptap_transaction(const uint8_t request, uint32_t *const data, const bool data_phase)
+{
+	if (swd_delay_cnt)
+		return swdptap_transaction_swd_delay(request, data, data_phase);
+	else // NOLINT(readability-else-after-return)
+		return swdptap_transaction_no_delay(request, data, data_phase);
+}
+
+/* Back to back DRW accesses of an overrun detection burst, every one with its data phase */
+static inline size_t swdptap_burst_body(uint8_t request, uint32_t *data, size_t count, bool delay)
+	__attribute__((always_inline));
+static inline size_t swdptap_burst_body(
+	const uint8_t request, uint32_t *const data, const size_t count, const bool delay)
+{
+	for (size_t i = 0; i < count; ++i) {
+		const uint8_t ack = swdptap_transaction_body(request, data + i, true, delay);
+		/* Only the data of an OK is meaningful, STICKYORUN covers the rest */
+		const uint8_t response = ack & ~SWDP_ACK_PARITY;
+		if (ack == (SWDP_ACK_OK | SWDP_ACK_PARITY) ||
+			(response != SWDP_ACK_OK && response != SWDP_ACK_WAIT && response != SWDP_ACK_FAULT))
+			return i;
+	}
+	return count;
+}
+
+static size_t swdptap_burst_swd_delay(uint8_t request, uint32_t *data, size_t count) RAMFUNC __attribute__((optimize(3)));
+static size_t swdptap_burst_swd_delay(const uint8_t request, uint32_t *const data, const size_t count)
+{
+	return swdptap_burst_body(request, data, count, true);
+}
+
+static size_t swdptap_burst_no_delay(uint8_t request, uint32_t *data, size_t count) RAMFUNC __attribute__((optimize(3)));
+static size_t swdptap_burst_no_delay(const uint8_t request, uint32_t *const data, const size_t count)
+{
+	return swdptap_burst_body(request, data, count, false);
+}
+
+static size_t swdptap_burst(const uint8_t request, uint32_t *const data, const size_t count)
+{
+	if (swd_delay_cnt)
+		return swdptap_burst_swd_delay(request, data, count);
+	else // NOLINT(readability-else-after-return)
+		return swdptap_burst_no_delay(request, data, count);
+}
+
 int swdptap_init(ADIv5_DP_t *dp)
 {
 	dp->seq_in  = swdptap_seq_in;
 	dp->seq_in_parity  = swdptap_seq_in_parity;
 	dp->seq_out = swdptap_seq_out;
 	dp->seq_out_parity  = swdptap_seq_out_parity;
+	dp->swd_transaction = swdptap_transaction;
+	dp->swd_burst = swdptap_burst;
 
 	return 0;
 }
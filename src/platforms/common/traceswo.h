@@ -20,6 +20,33 @@
 #ifndef PLATFORMS_COMMON_TRACESWO_H
 #define PLATFORMS_COMMON_TRACESWO_H
 
+#if PC_HOSTED == 1
+/* Default line rate, used as default for a request without baudrate */
+#define SWO_DEFAULT_BAUD (2250000)
+
+typedef enum traceswo_mode {
+	SWO_MODE_UART,       /* NRZ / async */
+	SWO_MODE_MANCHESTER,
+} traceswo_mode_e;
+
+/* raw trace output, a localhost TCP port number or a file name */
+void traceswo_output_init(const char *output);
+/* start capture through the connected probe, false if it can not capture swo */
+bool traceswo_init(traceswo_mode_e mode, uint32_t baudrate, uint32_t swo_chan_bitmask);
+void traceswo_deinit(void);
+/* move the trace data the probe has captured so far to the output */
+void traceswo_poll(void);
+/* where decoded stimulus data goes, implemented by the capture front end */
+void traceswo_decode_output(const uint8_t *data, size_t len);
+
+/* probe side of the capture, returning the number of trace bytes read or -1 on error */
+bool platform_traceswo_start(traceswo_mode_e mode, uint32_t baudrate, uint32_t *actual_baudrate);
+int platform_traceswo_read(uint8_t *data, size_t size);
+void platform_traceswo_stop(void);
+
+/* decode swo packets, stimulus data goes to traceswo_decode_output() */
+uint16_t traceswo_decode(const void *buf, uint16_t len);
+#else
 #include <libopencm3/usb/usbd.h>
 
 #if defined TRACESWO_PROTOCOL && TRACESWO_PROTOCOL == 2
@@ -32,11 +59,57 @@ void traceswo_init(uint32_t swo_chan_bitmask);
 
 void trace_buf_drain(usbd_device *dev, uint8_t ep);
 
+/* decode swo packets, printing stimulus data on usb serial */
+uint16_t traceswo_decode(usbd_device *usbd_dev, uint8_t addr,
+				const void *buf, uint16_t len);
+#endif
+
 /* set bitmask of swo channels to be decoded */
 void traceswo_setmask(uint32_t mask);
 
-/* print decoded swo packet on usb serial */
-uint16_t traceswo_decode(usbd_device *usbd_dev, uint8_t addr,
-				const void *buf, uint16_t len);
+/* counts of the decoded ITM/DWT packets */
+typedef struct traceswo_stats {
+	uint32_t syncs;
+	uint32_t overflows;
+	uint32_t timestamps;
+	uint32_t global_timestamp; /* low bits of the last global timestamp */
+	uint32_t extensions;
+	uint32_t stimulus;
+	uint32_t events;
+	uint32_t exception_entries;
+	uint32_t exception_exits;
+	uint32_t exception_returns;
+	uint32_t pc_samples;
+	uint32_t pc_other; /* samples not fitting in the histogram */
+	uint32_t sleep_samples;
+	uint32_t data_trace;
+	uint32_t lost_packets; /* trace packets dropped because the host did not keep up */
+	uint32_t isr_unmatched; /* exception exits without the entry, lost in an overflow */
+} traceswo_stats_s;
+
+typedef struct traceswo_pc_count {
+	uint32_t pc;
+	uint32_t count;
+} traceswo_pc_count_s;
+
+/* per exception timing from the exception trace, in local timestamp ticks */
+typedef struct traceswo_isr_stats {
+	uint16_t exception;     /* exception number, external interrupts from 16 */
+	uint16_t max_depth;     /* deepest nesting it was entered at */
+	uint32_t count;         /* completed entry to exit pairs */
+	uint32_t min_ticks;
+	uint32_t max_ticks;
+	uint64_t total_ticks;
+	uint32_t max_preempted; /* longest a run was held up by higher priority exceptions */
+} traceswo_isr_stats_s;
+
+extern traceswo_stats_s traceswo_stats;
+
+/* the exception slots, in the order first seen, return how many are in use */
+size_t traceswo_isr_stats(const traceswo_isr_stats_s **stats);
+
+/* copy the most sampled PCs, highest count first, return how many were copied */
+size_t traceswo_pc_histogram(traceswo_pc_count_s *top, size_t count);
+void traceswo_stats_clear(void);
 
 #endif /* PLATFORMS_COMMON_TRACESWO_H */
@@ -32,15 +32,35 @@ extern uint16_t usb_config;
 #define CDCACM_GDB_ENDPOINT  1
 #define CDCACM_UART_ENDPOINT 3
 #define TRACE_ENDPOINT       5
+#define BULK_ENDPOINT        6
 
 #define GDB_IF_NO  0
 #define UART_IF_NO 2
 #define DFU_IF_NO  4
 #ifdef PLATFORM_HAS_TRACESWO
-#define TRACE_IF_NO      5
-#define TOTAL_INTERFACES 6
+#define TRACE_IF_NO 5
+#define BULK_IF_NO  6
 #else
-#define TOTAL_INTERFACES 5
+#define BULK_IF_NO 5
+#endif
+
+/*
+ * With ENABLE_BULK_IF the probe also offers a vendor class interface whose
+ * bulk endpoints carry the same GDB/remote protocol stream as the GDB
+ * CDC-ACM port, without line coding or a tty layer on the host side.
+ * The host finds it by class, subclass and protocol.
+ */
+#ifdef ENABLE_BULK_IF
+#if defined(LM4F)
+#error "ENABLE_BULK_IF is only implemented by the STM32 gdb_if"
+#elif defined(STM32F1) && defined(PLATFORM_HAS_TRACESWO)
+#error "ENABLE_BULK_IF does not fit the STM32F1 packet memory alongside trace capture"
+#endif
+#define BULK_IF_SUBCLASS  0x42U
+#define BULK_IF_PROTOCOL  0x01U
+#define TOTAL_INTERFACES (BULK_IF_NO + 1)
+#else
+#define TOTAL_INTERFACES BULK_IF_NO
 #endif
 
 void blackmagic_usb_init(void);
@@ -351,6 +351,60 @@ static const struct usb_iface_assoc_descriptor trace_assoc = {
 };
 #endif
 
+/* Vendor bulk interface */
+
+#ifdef ENABLE_BULK_IF
+#if defined(PLATFORM_HAS_TRACESWO)
+#define BULK_IF_STRING 8
+#else
+#define BULK_IF_STRING 7
+#endif
+
+static const struct usb_endpoint_descriptor bulk_endp[] = {
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = BULK_ENDPOINT,
+		.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize = CDCACM_PACKET_SIZE,
+		.bInterval = 0,
+	},
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = BULK_ENDPOINT | USB_REQ_TYPE_IN,
+		.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize = CDCACM_PACKET_SIZE,
+		.bInterval = 0,
+	},
+};
+
+static const struct usb_interface_descriptor bulk_iface = {
+	.bLength = USB_DT_INTERFACE_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE,
+	.bInterfaceNumber = BULK_IF_NO,
+	.bAlternateSetting = 0,
+	.bNumEndpoints = 2,
+	.bInterfaceClass = 0xFF,
+	.bInterfaceSubClass = BULK_IF_SUBCLASS,
+	.bInterfaceProtocol = BULK_IF_PROTOCOL,
+	.iInterface = BULK_IF_STRING,
+
+	.endpoint = bulk_endp,
+};
+
+static const struct usb_iface_assoc_descriptor bulk_assoc = {
+	.bLength = USB_DT_INTERFACE_ASSOCIATION_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE_ASSOCIATION,
+	.bFirstInterface = BULK_IF_NO,
+	.bInterfaceCount = 1,
+	.bFunctionClass = 0xFF,
+	.bFunctionSubClass = BULK_IF_SUBCLASS,
+	.bFunctionProtocol = BULK_IF_PROTOCOL,
+	.iFunction = BULK_IF_STRING,
+};
+#endif
+
 /* Interface and configuration descriptors */
 
 static const struct usb_interface ifaces[] = {
@@ -384,6 +438,13 @@ static const struct usb_interface ifaces[] = {
 		.altsetting = &trace_iface,
 	},
 #endif
+#if defined(ENABLE_BULK_IF)
+	{
+		.num_altsetting = 1,
+		.iface_assoc = &bulk_assoc,
+		.altsetting = &bulk_iface,
+	},
+#endif
 };
 
 static const struct usb_config_descriptor config = {
@@ -409,6 +470,9 @@ static const char *const usb_strings[] = {
 #if defined(PLATFORM_HAS_TRACESWO)
 	"Black Magic Trace Capture",
 #endif
+#if defined(ENABLE_BULK_IF)
+	"Black Magic Remote Bulk",
+#endif
 };
 
 #endif /* PLATFORMS_COMMON_USB_DESCRIPTORS_H */
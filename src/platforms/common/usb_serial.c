@@ -37,6 +37,8 @@
  * OUT 3 UART CDC DATA
  * OUT 4 UART CDC CTRL
  * In  5 Trace Capture
+ * IN  6 Vendor bulk GDB/remote (ENABLE_BULK_IF)
+ * OUT 6 Vendor bulk GDB/remote (ENABLE_BULK_IF)
  *
  */
 
@@ -47,6 +49,9 @@
 #include "traceswo.h"
 #endif
 #include "aux_serial.h"
+#ifdef ENABLE_RTT
+#include "rtt_if.h"
+#endif
 
 #include <libopencm3/cm3/cortex.h>
 #include <libopencm3/cm3/nvic.h>
@@ -79,8 +84,7 @@ static bool debug_serial_send_complete = true;
 void initialise_monitor_handles(void);
 
 static char debug_serial_debug_buffer[AUX_UART_BUFFER_SIZE];
-static uint8_t debug_serial_debug_write_index;
-static uint8_t debug_serial_debug_read_index;
+static ring_s debug_serial_debug_ring = RING_INIT(debug_serial_debug_buffer);
 #endif
 
 static enum usbd_request_return_codes gdb_serial_control_request(usbd_device *dev, struct usb_setup_data *req,
@@ -171,6 +175,12 @@ void usb_serial_set_config(usbd_device *dev, uint16_t value)
 		dev, CDCACM_UART_ENDPOINT | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_BULK, CDCACM_PACKET_SIZE, debug_serial_send_callback);
 	usbd_ep_setup(dev, (CDCACM_UART_ENDPOINT + 1) | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
 
+#ifdef ENABLE_BULK_IF
+	/* Vendor bulk interface */
+	usbd_ep_setup(dev, BULK_ENDPOINT, USB_ENDPOINT_ATTR_BULK, CDCACM_PACKET_SIZE, gdb_bulk_out_cb);
+	usbd_ep_setup(dev, BULK_ENDPOINT | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_BULK, CDCACM_PACKET_SIZE, NULL);
+#endif
+
 #ifdef PLATFORM_HAS_TRACESWO
 	/* Trace interface */
 	usbd_ep_setup(dev, TRACE_ENDPOINT | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_BULK, 64, trace_buf_drain);
@@ -203,32 +213,20 @@ void debug_serial_send_stdout(const uint8_t *const data, const size_t len)
 	}
 }
 
-uint32_t debug_serial_fifo_send(const char *const fifo, const uint32_t fifo_begin, const uint32_t fifo_end)
+void debug_serial_ring_send(ring_s *const ring)
 {
 	/*
-	 * To avoid the need of sending ZLP don't transmit full packet.
-	 * Also reserve space for copy function overrun.
+	 * Send what is contiguous from the ring as it stands, the rest after the
+	 * wrap goes in the next packet. To avoid the need of sending ZLP don't
+	 * transmit full packet.
 	 */
-	char packet[CDCACM_PACKET_SIZE - 1];
-	uint32_t packet_len = 0;
-	for (uint32_t fifo_index = fifo_begin; fifo_index != fifo_end && packet_len < CDCACM_PACKET_SIZE - 1U;
-		 fifo_index %= AUX_UART_BUFFER_SIZE)
-		packet[packet_len++] = fifo[fifo_index++];
-
-	if (packet_len) {
-		const uint16_t written = usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, packet, packet_len);
-		return (fifo_begin + written) % AUX_UART_BUFFER_SIZE;
-	}
-	return fifo_begin;
+	uint32_t contiguous;
+	const uint8_t *const data = ring_read_span(ring, &contiguous);
+	const uint32_t packet_len = MIN(contiguous, CDCACM_PACKET_SIZE - 1U);
+	if (packet_len)
+		ring_read_commit(ring, usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, data, packet_len));
 }
 
-#if defined(ENABLE_DEBUG) && defined(PLATFORM_HAS_DEBUG)
-static bool debug_serial_fifo_buffer_empty(void)
-{
-	return debug_serial_debug_write_index == debug_serial_debug_read_index;
-}
-#endif
-
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4)
 /*
  * Runs deferred processing for AUX serial RX, draining RX FIFO by sending
@@ -243,17 +241,17 @@ static void debug_serial_send_data(void)
 	 * If fifo empty, nothing further to do. */
 	if (usb_get_config() != 1 || (aux_serial_receive_buffer_empty()
 #if defined(ENABLE_DEBUG) && defined(PLATFORM_HAS_DEBUG)
-									 && debug_serial_fifo_buffer_empty()
+									 && !ring_used(&debug_serial_debug_ring)
 #endif
 	)) {
 #if defined(ENABLE_DEBUG) && defined(PLATFORM_HAS_DEBUG)
-		debug_serial_debug_read_index = debug_serial_debug_write_index;
+		ring_discard(&debug_serial_debug_ring);
 #endif
 		aux_serial_drain_receive_buffer();
 		debug_serial_send_complete = true;
 	} else {
 #if defined(ENABLE_DEBUG) && defined(PLATFORM_HAS_DEBUG)
-		debug_serial_debug_read_index = debug_serial_fifo_send(debug_serial_debug_buffer, debug_serial_debug_read_index, debug_serial_debug_write_index);
+		debug_serial_ring_send(&debug_serial_debug_ring);
 #endif
 		aux_serial_stage_receive_buffer();
 	}
@@ -276,6 +274,10 @@ static void debug_serial_send_callback(usbd_device *dev, uint8_t ep)
 {
 	(void) ep;
 	(void) dev;
+#ifdef ENABLE_RTT
+	if (rtt_up_send_complete())
+		return;
+#endif
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4)
 	debug_serial_send_data();
 #endif
@@ -284,7 +286,8 @@ static void debug_serial_send_callback(usbd_device *dev, uint8_t ep)
 #ifndef ENABLE_RTT
 static void debug_serial_receive_callback(usbd_device *dev, uint8_t ep)
 {
-	char *const transmit_buffer = aux_serial_current_transmit_buffer() + aux_serial_transmit_buffer_fullness();
+	/* The packet lands straight in the transmit ring, for DMA to send from there */
+	char *const transmit_buffer = aux_serial_current_transmit_buffer();
 	const uint16_t len = usbd_ep_read_packet(dev, ep, transmit_buffer, CDCACM_PACKET_SIZE);
 
 #if defined(BLACKMAGIC)
@@ -299,7 +302,7 @@ static void debug_serial_receive_callback(usbd_device *dev, uint8_t ep)
 
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4)
 	/* Disable USBUART TX packet reception if buffer does not have enough space */
-	if (AUX_UART_BUFFER_SIZE - aux_serial_transmit_buffer_fullness() < CDCACM_PACKET_SIZE)
+	if (aux_serial_transmit_buffer_room() < CDCACM_PACKET_SIZE)
 		usbd_ep_nak_set(dev, ep, 1);
 #endif
 }
@@ -307,32 +310,30 @@ static void debug_serial_receive_callback(usbd_device *dev, uint8_t ep)
 
 #ifdef ENABLE_DEBUG
 #ifdef PLATFORM_HAS_DEBUG
-static void debug_serial_append_char(const char c)
-{
-	debug_serial_debug_buffer[debug_serial_debug_write_index] = c;
-	++debug_serial_debug_write_index;
-	debug_serial_debug_write_index %= AUX_UART_BUFFER_SIZE;
-}
-
 static size_t debug_serial_debug_write(const char *buf, const size_t len)
 {
 	if (nvic_get_active_irq(USB_IRQ) || nvic_get_active_irq(USBUSART_IRQ) || nvic_get_active_irq(USBUSART_DMA_RX_IRQ))
 		return 0;
 
 	CM_ATOMIC_CONTEXT();
+	size_t room = ring_free(&debug_serial_debug_ring);
 	size_t offset = 0;
 
-	for (; offset < len && (debug_serial_debug_write_index + 1) % AUX_UART_BUFFER_SIZE != debug_serial_debug_read_index;
-		 ++offset) {
-		if (buf[offset] == '\n') {
-			debug_serial_append_char('\r');
-
-			if ((debug_serial_debug_write_index + 1) % AUX_UART_BUFFER_SIZE == debug_serial_debug_read_index)
-				break;
-		}
-		debug_serial_append_char(buf[offset]);
+	while (offset < len && room) {
+		/* Everything up to the next newline goes in as one span, the newline then becomes "\r\n" */
+		const char *const newline = memchr(buf + offset, '\n', len - offset);
+		const size_t span = MIN((newline ? (size_t)(newline - buf) : len) - offset, room);
+		ring_write(&debug_serial_debug_ring, buf + offset, span);
+		offset += span;
+		room -= span;
+		if (offset == len || buf[offset] != '\n' || room < 2U)
+			break;
+		ring_write(&debug_serial_debug_ring, "\r\n", 2U);
+		++offset;
+		room -= 2U;
 	}
 
+	/* Only starts a packet if USB is idle, otherwise this joins the ones queued already */
 	debug_serial_run();
 	return offset;
 }
@@ -24,13 +24,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "usb.h"
+#include "ring.h"
 
 void usb_serial_set_config(usbd_device *dev, uint16_t value);
 
 bool gdb_serial_get_dtr(void);
 
 void debug_serial_run(void);
-uint32_t debug_serial_fifo_send(const char *fifo, uint32_t fifo_begin, uint32_t fifo_end);
+/* Send the next packet's worth of a ring on the USB UART endpoint, without needing a ZLP */
+void debug_serial_ring_send(ring_s *ring);
 
 #ifdef ENABLE_RTT
 void debug_serial_receive_callback(usbd_device *dev, uint8_t ep);
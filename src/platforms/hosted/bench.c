@@ -0,0 +1,273 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Link benchmark for the PC-Hosted command line.
+ *
+ * Times the primitive operations every debug session is built from, at a
+ * sweep of SWJ frequencies, and prints one CSV row per measurement so runs
+ * against different probes, or different releases, can be compared.
+ */
+
+#include "general.h"
+#include <sys/time.h>
+#include "exception.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortexm.h"
+#include "cli.h"
+#include "bmp_hosted.h"
+#include "bench.h"
+
+/* Each measurement repeats until it has taken this long, or this often */
+#define BENCH_MIN_US   200000U
+#define BENCH_MAX_ITER 100000U
+#define BENCH_MAX_SIZE 65536U
+#define BENCH_HALT_TIMEOUT_MS 1000U
+
+typedef enum bench_op {
+	BENCH_DP_READ,
+	BENCH_AP_READ,
+	BENCH_MEM_READ,
+	BENCH_MEM_WRITE,
+	BENCH_REGS_READ,
+	BENCH_HALT_RESUME,
+} bench_op_e;
+
+static const char *const bench_op_names[] = {
+	"dp_read",
+	"ap_read",
+	"mem_read",
+	"mem_write",
+	"regs_read",
+	"halt_resume",
+};
+
+static const uint32_t bench_frequencies[] = {
+	100000U,
+	500000U,
+	1000000U,
+	2000000U,
+	4000000U,
+	8000000U,
+	12000000U,
+	24000000U,
+};
+
+static const size_t bench_sizes[] = {4U, 64U, 1024U, 16384U, 65536U};
+
+typedef struct bench_ctx {
+	target *t;
+	ADIv5_AP_t *ap;
+	target_addr_t ram;
+	size_t ram_size;
+	uint8_t *buf;
+	uint32_t frequency;
+} bench_ctx_s;
+
+static uint64_t bench_time_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000U + tv.tv_usec;
+}
+
+static void bench_report(const bench_ctx_s *ctx, const char *test, size_t size, uint32_t iterations, uint64_t elapsed_us)
+{
+	const double us_per_op = (double)elapsed_us / iterations;
+	const double bytes_per_s = size && elapsed_us ? (double)size * iterations * 1000000.0 / elapsed_us : 0.0;
+	PRINT_INFO("%s,%" PRIu32 ",%s,%zu,%" PRIu32 ",%.3f,%.0f\n", platform_ident(), ctx->frequency, test, size,
+		iterations, us_per_op, bytes_per_s);
+}
+
+static bool bench_halt(target *t)
+{
+	target_halt_request(t);
+	const uint32_t start = platform_time_ms();
+	enum target_halt_reason reason;
+	while ((reason = target_halt_poll(t, NULL)) == TARGET_HALT_RUNNING) {
+		if (platform_time_ms() - start > BENCH_HALT_TIMEOUT_MS)
+			return false;
+	}
+	return reason != TARGET_HALT_ERROR;
+}
+
+static bool bench_halt_resume(target *t)
+{
+	target_halt_resume(t, false);
+	return bench_halt(t);
+}
+
+/* One operation, false if it failed or raised */
+static bool bench_once(bench_ctx_s *ctx, bench_op_e op, size_t size)
+{
+	volatile bool ok = true;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		switch (op) {
+		case BENCH_DP_READ:
+			adiv5_dp_read(ctx->ap->dp, ADIV5_DP_CTRLSTAT);
+			break;
+		case BENCH_AP_READ:
+			adiv5_ap_read(ctx->ap, ADIV5_AP_IDR);
+			break;
+		case BENCH_MEM_READ:
+			ok = !target_mem_read(ctx->t, ctx->buf, ctx->ram, size);
+			break;
+		case BENCH_MEM_WRITE:
+			ok = !target_mem_write(ctx->t, ctx->ram, ctx->buf, size);
+			break;
+		case BENCH_REGS_READ:
+			target_regs_read(ctx->t, ctx->buf);
+			break;
+		case BENCH_HALT_RESUME:
+			ok = bench_halt_resume(ctx->t);
+			break;
+		}
+	}
+	if (e.type)
+		return false;
+	if (ctx->ap && ctx->ap->dp->fault) {
+		ctx->ap->dp->fault = 0;
+		return false;
+	}
+	return ok;
+}
+
+static bool bench_run(bench_ctx_s *ctx, bench_op_e op, size_t size)
+{
+	uint32_t iterations = 0;
+	const uint64_t start = bench_time_us();
+	uint64_t elapsed = 0;
+	do {
+		if (!bench_once(ctx, op, size)) {
+			PRINT_INFO("%s,%" PRIu32 ",%s,%zu,0,error,error\n", platform_ident(), ctx->frequency,
+				bench_op_names[op], size);
+			return false;
+		}
+		elapsed = bench_time_us() - start;
+	} while (++iterations < BENCH_MAX_ITER && elapsed < BENCH_MIN_US);
+	bench_report(ctx, bench_op_names[op], size, iterations, elapsed);
+	return true;
+}
+
+/* All link measurements at the current frequency, false once the link no longer works */
+static bool bench_link(bench_ctx_s *ctx)
+{
+	if (ctx->ap && (!bench_run(ctx, BENCH_DP_READ, 0) || !bench_run(ctx, BENCH_AP_READ, 0)))
+		return false;
+	for (size_t i = 0; i < ARRAY_LENGTH(bench_sizes) && bench_sizes[i] <= ctx->ram_size; ++i) {
+		if (!bench_run(ctx, BENCH_MEM_READ, bench_sizes[i]) || !bench_run(ctx, BENCH_MEM_WRITE, bench_sizes[i]))
+			return false;
+	}
+	return bench_run(ctx, BENCH_REGS_READ, target_regs_size(ctx->t)) && bench_run(ctx, BENCH_HALT_RESUME, 0);
+}
+
+/* Erase and program the Flash block at addr, leaving it erased */
+static bool bench_flash(bench_ctx_s *ctx, target_addr_t addr)
+{
+	target_flash_s *f = ctx->t->flash;
+	while (f && (addr < f->start || addr >= f->start + f->length))
+		f = f->next;
+	if (!f) {
+		DEBUG_WARN("No Flash at 0x%08" PRIx32 " to benchmark\n", addr);
+		return false;
+	}
+	const target_addr_t block = addr - ((addr - f->start) % f->blocksize);
+	uint8_t *const data = malloc(f->blocksize);
+	if (!data)
+		return false;
+	for (size_t i = 0; i < f->blocksize; ++i)
+		data[i] = (uint8_t)(i * 0x5bU + 0x21U);
+
+	uint64_t start = bench_time_us();
+	bool ok = target_flash_erase(ctx->t, block, f->blocksize) && target_flash_complete(ctx->t);
+	uint64_t elapsed = bench_time_us() - start;
+	if (ok)
+		bench_report(ctx, "flash_erase", f->blocksize, 1, elapsed);
+
+	start = bench_time_us();
+	ok = ok && target_flash_write(ctx->t, block, data, f->blocksize) && target_flash_complete(ctx->t);
+	elapsed = bench_time_us() - start;
+	if (ok)
+		bench_report(ctx, "flash_write", f->blocksize, 1, elapsed);
+
+	ok = ok && target_flash_erase(ctx->t, block, f->blocksize) && target_flash_complete(ctx->t);
+	if (!ok)
+		PRINT_INFO("%s,%" PRIu32 ",flash,%" PRIu32 ",0,error,error\n", platform_ident(), ctx->frequency,
+			(uint32_t)f->blocksize);
+	free(data);
+	return ok;
+}
+
+bool cl_bench(target *t, BMP_CL_OPTIONS_t *opt)
+{
+	bench_ctx_s ctx = {.t = t};
+	/* DP and AP accesses are timed on ADIv5 Cortex-M only, the other cores skip them */
+	if (t->core && t->core[0] == 'M')
+		ctx.ap = cortexm_ap(t);
+	if (t->ram) {
+		ctx.ram = t->ram->start;
+		ctx.ram_size = MIN(t->ram->length, BENCH_MAX_SIZE);
+	}
+	const size_t buf_size = MAX(ctx.ram_size, target_regs_size(t));
+	ctx.buf = calloc(1, buf_size + 1U);
+	uint8_t *const saved_ram = calloc(1, ctx.ram_size + 1U);
+	uint8_t *const saved_regs = calloc(1, target_regs_size(t) + 1U);
+	if (!ctx.buf || !saved_ram || !saved_regs) {
+		free(ctx.buf);
+		free(saved_ram);
+		free(saved_regs);
+		return false;
+	}
+	DEBUG_WARN("Benchmarking, target RAM and registers are restored afterwards, Flash only touched with -a\n");
+	/* Reads must cross the link, not come from the halted memory cache */
+	const bool cache_enabled = t->mem_cache_enabled;
+	t->mem_cache_enabled = false;
+	target_mem_cache_drop(t);
+	target_mem_read(t, saved_ram, ctx.ram, ctx.ram_size);
+	target_regs_read(t, saved_regs);
+
+	PRINT_INFO("probe,frequency_hz,test,size,iterations,us_per_op,bytes_per_s\n");
+	uint32_t last = 0;
+	for (size_t i = 0; i < ARRAY_LENGTH(bench_frequencies); ++i) {
+		platform_max_frequency_set(bench_frequencies[i]);
+		ctx.frequency = platform_max_frequency_get();
+		/* Probes clamp to what they can do, do not repeat a frequency */
+		if (ctx.frequency == last)
+			continue;
+		last = ctx.frequency;
+		if (!bench_link(&ctx))
+			break;
+	}
+
+	platform_max_frequency_set(opt->opt_max_swj_frequency);
+	ctx.frequency = platform_max_frequency_get();
+	/* Make sure the target is halted and usable again before putting things back */
+	bool ok = !ctx.ap || bench_once(&ctx, BENCH_DP_READ, 0);
+	if (ok && target_halt_poll(t, NULL) == TARGET_HALT_RUNNING)
+		ok = bench_halt(t);
+	if (ok && opt->opt_flash_start != 0xffffffffU)
+		ok = bench_flash(&ctx, opt->opt_flash_start);
+	target_mem_write(t, ctx.ram, saved_ram, ctx.ram_size);
+	target_regs_write(t, saved_regs);
+	t->mem_cache_enabled = cache_enabled;
+
+	free(ctx.buf);
+	free(saved_ram);
+	free(saved_regs);
+	return ok;
+}
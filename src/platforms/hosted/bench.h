@@ -0,0 +1,32 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PLATFORMS_HOSTED_BENCH_H
+#define PLATFORMS_HOSTED_BENCH_H
+
+#include "target.h"
+#include "cli.h"
+
+/* Time link, memory, register, run control and (with -a) Flash operations
+ * on the attached target across SWJ frequencies, one CSV row each on stdout */
+bool cl_bench(target *t, BMP_CL_OPTIONS_t *opt);
+
+/* Time the probe independent code paths against a target in host memory,
+ * one CSV row each on stdout, no probe needed */
+bool cl_bench_code(void);
+
+#endif /* PLATFORMS_HOSTED_BENCH_H */
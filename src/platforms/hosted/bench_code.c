@@ -0,0 +1,322 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Code benchmark for the PC-Hosted command line.
+ *
+ * Times the loops that run on the host for every probe alike, against a
+ * target held in host memory, and prints one CSV row per measurement so
+ * builds can be compared from commit to commit.
+ */
+
+#include "general.h"
+#include <sys/time.h>
+#include "target_internal.h"
+#include "gdb_if.h"
+#include "gdb_packet.h"
+#include "hex_utils.h"
+#include "crc32.h"
+#ifdef ENABLE_RTT
+#include "rtt.h"
+#endif
+#include "version.h"
+#include "bmp_hosted.h"
+#include "bench.h"
+
+/* Each measurement repeats until it has taken this long, or this often */
+#define BENCH_CODE_MIN_US   200000U
+#define BENCH_CODE_MAX_ITER 1000000U
+
+#define BENCH_CODE_RAM_BASE   0x20000000U
+#define BENCH_CODE_RAM_SIZE   0x100000U
+#define BENCH_CODE_FLASH_BASE 0x08000000U
+#define BENCH_CODE_FLASH_SIZE 0x100000U
+#define BENCH_CODE_FLASH_BLOCK 0x800U
+#define BENCH_CODE_FLASH_WRITE 0x100U
+
+#define BENCH_CODE_HEX_SIZE    1024U
+#define BENCH_CODE_CRC_SIZE    0x10000U
+#define BENCH_CODE_FLASH_CHUNK 0x10000U
+#define BENCH_CODE_PACKET_SIZE 1024U
+
+typedef enum bench_code_op {
+	BENCH_CODE_HEXIFY,
+	BENCH_CODE_UNHEXIFY,
+	BENCH_CODE_GETPACKET_HEX,
+	BENCH_CODE_GETPACKET_ESCAPED,
+	BENCH_CODE_CRC32,
+	BENCH_CODE_FLASH_BUFFERED,
+	BENCH_CODE_RTT_SEARCH,
+} bench_code_op_e;
+
+static const char *const bench_code_op_names[] = {
+	"hexify",
+	"unhexify",
+	"getpacket_hex",
+	"getpacket_escaped",
+	"generic_crc32",
+	"flash_buffered",
+	"rtt_search",
+};
+
+typedef struct bench_code_ctx {
+	target *t;
+	uint8_t *ram;
+	uint8_t *data;
+	char *hex;
+	char *packet;
+	char *hex_packet;
+	size_t hex_packet_len;
+	char *escaped_packet;
+	size_t escaped_packet_len;
+} bench_code_ctx_s;
+
+static bench_code_ctx_s bench_code;
+
+static uint64_t bench_code_time_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000U + tv.tv_usec;
+}
+
+static void bench_code_mem_read(target *t, void *dest, target_addr_t src, size_t len)
+{
+	(void)t;
+	if (src >= BENCH_CODE_RAM_BASE && src - BENCH_CODE_RAM_BASE + len <= BENCH_CODE_RAM_SIZE)
+		memcpy(dest, bench_code.ram + (src - BENCH_CODE_RAM_BASE), len);
+	else
+		memset(dest, 0xff, len);
+}
+
+static void bench_code_mem_write(target *t, target_addr_t dest, const void *src, size_t len)
+{
+	(void)t;
+	if (dest >= BENCH_CODE_RAM_BASE && dest - BENCH_CODE_RAM_BASE + len <= BENCH_CODE_RAM_SIZE)
+		memcpy(bench_code.ram + (dest - BENCH_CODE_RAM_BASE), src, len);
+}
+
+static bool bench_code_check_error(target *t)
+{
+	(void)t;
+	return false;
+}
+
+static bool bench_code_flash_mode(target *t)
+{
+	(void)t;
+	return true;
+}
+
+/* A Flash driver that does nothing, leaving only the buffering to time */
+static bool bench_code_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
+{
+	(void)f;
+	(void)addr;
+	(void)len;
+	return true;
+}
+
+static bool bench_code_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+{
+	(void)f;
+	(void)dest;
+	(void)src;
+	(void)len;
+	return true;
+}
+
+static target *bench_code_target(void)
+{
+	target *const t = target_new();
+	target_flash_s *const f = calloc(1, sizeof(*f));
+	if (!t || !f) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		free(f);
+		return NULL;
+	}
+	t->driver = "Code benchmark";
+	t->mem_read = bench_code_mem_read;
+	t->mem_write = bench_code_mem_write;
+	t->check_error = bench_code_check_error;
+	t->enter_flash_mode = bench_code_flash_mode;
+	t->exit_flash_mode = bench_code_flash_mode;
+	target_add_ram(t, BENCH_CODE_RAM_BASE, BENCH_CODE_RAM_SIZE);
+
+	f->start = BENCH_CODE_FLASH_BASE;
+	f->length = BENCH_CODE_FLASH_SIZE;
+	f->blocksize = BENCH_CODE_FLASH_BLOCK;
+	f->writesize = BENCH_CODE_FLASH_WRITE;
+	f->erased = 0xffU;
+	f->erase = bench_code_flash_erase;
+	f->write = bench_code_flash_write;
+	target_add_flash(t, f);
+	return t;
+}
+
+/* Frame payload as a GDB packet, escaping as GDB does, returns its length */
+static size_t bench_code_frame(char *packet, const char *payload, size_t len)
+{
+	size_t offset = 0;
+	uint8_t csum = 0;
+	packet[offset++] = '$';
+	for (size_t i = 0; i < len; ++i) {
+		const char c = payload[i];
+		if (c == '$' || c == '#' || c == '}' || c == '*') {
+			packet[offset++] = '}';
+			packet[offset++] = c ^ 0x20;
+			csum += '}' + (c ^ 0x20);
+		} else {
+			packet[offset++] = c;
+			csum += c;
+		}
+	}
+	offset += sprintf(packet + offset, "#%02X", csum);
+	return offset;
+}
+
+static bool bench_code_setup(bench_code_ctx_s *ctx)
+{
+	const size_t payload_size = 32U + 2U * BENCH_CODE_PACKET_SIZE;
+	ctx->ram = malloc(BENCH_CODE_RAM_SIZE);
+	ctx->data = malloc(BENCH_CODE_FLASH_CHUNK);
+	ctx->hex = malloc(2U * BENCH_CODE_HEX_SIZE + 1U);
+	ctx->packet = malloc(2U * payload_size + 4U);
+	ctx->hex_packet = malloc(2U * payload_size + 4U);
+	ctx->escaped_packet = malloc(2U * payload_size + 4U);
+	if (!ctx->ram || !ctx->data || !ctx->hex || !ctx->packet || !ctx->hex_packet || !ctx->escaped_packet)
+		return false;
+
+	/* Noise over the whole of RAM, the RTT control block near its end */
+	uint32_t seed = 0x12345678U;
+	for (size_t i = 0; i < BENCH_CODE_RAM_SIZE; ++i) {
+		seed = seed * 1103515245U + 12345U;
+		ctx->ram[i] = (uint8_t)(seed >> 16U);
+	}
+	memcpy(ctx->ram + BENCH_CODE_RAM_SIZE - 1024U, "SEGGER RTT\0\0\0\0\0", 16U);
+	for (size_t i = 0; i < BENCH_CODE_FLASH_CHUNK; ++i)
+		ctx->data[i] = (uint8_t)(i * 0x5bU + 0x21U);
+
+	/* A hex memory write, and a binary one made of nothing but characters that need escaping */
+	int len = sprintf(ctx->packet, "M%08" PRIx32 ",%x:", BENCH_CODE_RAM_BASE, BENCH_CODE_PACKET_SIZE);
+	hexify(ctx->packet + len, ctx->data, BENCH_CODE_PACKET_SIZE);
+	ctx->hex_packet_len = bench_code_frame(ctx->hex_packet, ctx->packet, len + 2U * BENCH_CODE_PACKET_SIZE);
+	len = sprintf(ctx->packet, "X%08" PRIx32 ",%x:", BENCH_CODE_RAM_BASE, BENCH_CODE_PACKET_SIZE);
+	static const char escaped[] = "$#}*";
+	for (size_t i = 0; i < BENCH_CODE_PACKET_SIZE; ++i)
+		ctx->packet[len + i] = escaped[i & 3U];
+	ctx->escaped_packet_len = bench_code_frame(ctx->escaped_packet, ctx->packet, len + BENCH_CODE_PACKET_SIZE);
+
+	ctx->t = bench_code_target();
+	return ctx->t != NULL;
+}
+
+static void bench_code_free(bench_code_ctx_s *ctx)
+{
+	target_list_free();
+	free(ctx->ram);
+	free(ctx->data);
+	free(ctx->hex);
+	free(ctx->packet);
+	free(ctx->hex_packet);
+	free(ctx->escaped_packet);
+}
+
+/* Feed a canned packet to the GDB packet reader, true if it came out whole */
+static bool bench_code_getpacket(bench_code_ctx_s *ctx, const char *packet, size_t len)
+{
+	gdb_if_inject(packet, len);
+	return gdb_getpacket(ctx->packet, 2U * BENCH_CODE_PACKET_SIZE + 32U) > BENCH_CODE_PACKET_SIZE;
+}
+
+/* One operation, returns the bytes it processed, 0 if it failed */
+static size_t bench_code_once(bench_code_ctx_s *ctx, bench_code_op_e op)
+{
+	uint32_t crc;
+	switch (op) {
+	case BENCH_CODE_HEXIFY:
+		hexify(ctx->hex, ctx->data, BENCH_CODE_HEX_SIZE);
+		return BENCH_CODE_HEX_SIZE;
+	case BENCH_CODE_UNHEXIFY:
+		unhexify(ctx->ram, ctx->hex, BENCH_CODE_HEX_SIZE);
+		return BENCH_CODE_HEX_SIZE;
+	case BENCH_CODE_GETPACKET_HEX:
+		return bench_code_getpacket(ctx, ctx->hex_packet, ctx->hex_packet_len) ? ctx->hex_packet_len : 0;
+	case BENCH_CODE_GETPACKET_ESCAPED:
+		return bench_code_getpacket(ctx, ctx->escaped_packet, ctx->escaped_packet_len) ? ctx->escaped_packet_len : 0;
+	case BENCH_CODE_CRC32:
+		return generic_crc32(ctx->t, &crc, BENCH_CODE_RAM_BASE, BENCH_CODE_CRC_SIZE) ? 0 : BENCH_CODE_CRC_SIZE;
+	case BENCH_CODE_FLASH_BUFFERED:
+		return target_flash_write(ctx->t, BENCH_CODE_FLASH_BASE, ctx->data, BENCH_CODE_FLASH_CHUNK) &&
+				target_flash_complete(ctx->t) ?
+			BENCH_CODE_FLASH_CHUNK :
+			0;
+	case BENCH_CODE_RTT_SEARCH:
+#ifdef ENABLE_RTT
+		return rtt_search(ctx->t, (const uint8_t *)"SEGGER RTT\0\0\0\0\0", 16U) ? BENCH_CODE_RAM_SIZE : 0;
+#else
+		break;
+#endif
+	}
+	return 0;
+}
+
+static bool bench_code_run(bench_code_ctx_s *ctx, bench_code_op_e op)
+{
+	uint32_t iterations = 0;
+	size_t size = 0;
+	const uint64_t start = bench_code_time_us();
+	uint64_t elapsed = 0;
+	do {
+		size = bench_code_once(ctx, op);
+		if (!size) {
+			PRINT_INFO("%s,%s,0,0,error,error\n", FIRMWARE_VERSION, bench_code_op_names[op]);
+			return false;
+		}
+		elapsed = bench_code_time_us() - start;
+	} while (++iterations < BENCH_CODE_MAX_ITER && elapsed < BENCH_CODE_MIN_US);
+	const double ns_per_op = (double)elapsed * 1000.0 / iterations;
+	const double bytes_per_s = elapsed ? (double)size * iterations * 1000000.0 / elapsed : 0.0;
+	PRINT_INFO("%s,%s,%zu,%" PRIu32 ",%.1f,%.0f\n", FIRMWARE_VERSION, bench_code_op_names[op], size, iterations,
+		ns_per_op, bytes_per_s);
+	return true;
+}
+
+bool cl_bench_code(void)
+{
+	bench_code_ctx_s *const ctx = &bench_code;
+	if (!bench_code_setup(ctx)) {
+		DEBUG_WARN("Not enough memory for the code benchmark\n");
+		bench_code_free(ctx);
+		return false;
+	}
+	/* The canned packets are not acknowledged */
+	gdb_set_noackmode(true);
+
+	bool ok = true;
+	PRINT_INFO("version,test,size,iterations,ns_per_op,bytes_per_s\n");
+	for (size_t op = 0; op < ARRAY_LENGTH(bench_code_op_names); ++op) {
+#ifndef ENABLE_RTT
+		if (op == BENCH_CODE_RTT_SEARCH)
+			continue;
+#endif
+		ok &= bench_code_run(ctx, (bench_code_op_e)op);
+	}
+
+	gdb_set_noackmode(false);
+	bench_code_free(ctx);
+	return ok;
+}
@@ -45,18 +45,41 @@ struct trans_ctx {
     volatile unsigned long flags;
 };
 
+/* Transfers a link keeps allocated, bounding how many can be in flight */
+#define USB_TRANSFER_POOL_SIZE 32U
+
+/* A bulk transfer of the link's pool, see usb_submit() */
+typedef struct usb_transfer_s {
+	struct libusb_transfer *trans;
+	struct trans_ctx       ctx;
+	bool                   busy;
+} usb_transfer_s;
+
 typedef struct usb_link_s {
 	libusb_context        *ul_libusb_ctx;
 	libusb_device_handle  *ul_libusb_device_handle;
 	unsigned char         ep_tx;
 	unsigned char         ep_rx;
-	struct libusb_transfer* req_trans;
-	struct libusb_transfer* rep_trans;
+	usb_transfer_s        pool[USB_TRANSFER_POOL_SIZE];
 	void                  *priv;
 } usb_link_t;
 
+int usb_transfers_init(usb_link_t *link);
+void usb_transfers_free(usb_link_t *link);
+usb_transfer_s *usb_submit(usb_link_t *link, uint8_t *buf, size_t size, bool in);
+int usb_reap(usb_link_t *link, usb_transfer_s *transfer);
+
 int send_recv(usb_link_t *link, uint8_t *txbuf, size_t txsize,
 			  uint8_t *rxbuf, size_t rxsize);
+
+/* One bulk transfer of a send_recv_pipelined() run */
+typedef struct usb_pipelined_s {
+	uint8_t *buf;
+	size_t size;
+	bool in;
+} usb_pipelined_s;
+
+int send_recv_pipelined(usb_link_t *link, const usb_pipelined_s *steps, size_t count);
 #endif
 typedef struct bmp_info_s {
 	bmp_type_t bmp_type;
@@ -75,10 +98,23 @@ typedef struct bmp_info_s {
 	uint8_t interface_num;
 	uint8_t in_ep;
 	uint8_t out_ep;
+	uint8_t swo_ep; /* CMSIS-DAP v2 trace endpoint, 0 if none */
 #endif
 } bmp_info_t;
 
 extern bmp_info_t info;
+#if HOSTED_BMP_ONLY != 1
+int bmp_bulk_open(bmp_info_t *info);
+int bmp_bulk_write(const uint8_t *data, size_t size);
+int bmp_bulk_read(uint8_t *data, size_t size, uint32_t timeout);
+
+/* Told of each possible debugger, by serial number, as it is plugged in or removed */
+typedef void (*bmp_hotplug_cb)(const char *serial, bool arrived, void *ctx);
+/* Watch for debuggers coming and going, including those already plugged in */
+bool bmp_hotplug_start(bmp_hotplug_cb callback, void *ctx);
+/* Dispatch the hotplug events of the next timeout_ms to the callback */
+void bmp_hotplug_poll(uint32_t timeout_ms);
+#endif
 void bmp_ident(bmp_info_t *info);
 int find_debuggers(BMP_CL_OPTIONS_t *cl_opts,bmp_info_t *info);
 void libusb_exit_function(bmp_info_t *info);
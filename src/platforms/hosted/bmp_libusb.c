@@ -23,6 +23,7 @@
 #include "cli.h"
 #include "ftdi_bmp.h"
 #include "version.h"
+#include "wire_trace.h"
 
 #define NO_SERIAL_NUMBER "<no serial number>"
 
@@ -41,8 +42,7 @@ void libusb_exit_function(bmp_info_t *info)
 {
 	if (!info->usb_link)
 		return;
-	libusb_free_transfer(info->usb_link->req_trans);
-	libusb_free_transfer(info->usb_link->rep_trans);
+	usb_transfers_free(info->usb_link);
 	if (info->usb_link->ul_libusb_device_handle) {
 		libusb_release_interface (
 			info->usb_link->ul_libusb_device_handle, 0);
@@ -93,16 +93,22 @@ static bmp_type_t find_cmsis_dap_interface(libusb_device *dev,bmp_info_t *info)
 		}
 		type = BMP_TYPE_CMSIS_DAP;
 
-		if (interface->bInterfaceClass == 0xff && interface->bNumEndpoints == 2) {
+		/* A third endpoint, the second IN one, streams SWO trace */
+		if (interface->bInterfaceClass == 0xff &&
+			(interface->bNumEndpoints == 2 || interface->bNumEndpoints == 3)) {
 			info->interface_num = interface->bInterfaceNumber;
+			info->in_ep = 0;
+			info->swo_ep = 0;
 
 			for (int j = 0; j < interface->bNumEndpoints; j++) {
 				uint8_t n = interface->endpoint[j].bEndpointAddress;
 
-				if (n & 0x80) {
+				if (!(n & 0x80)) {
+					info->out_ep = n;
+				} else if (!info->in_ep) {
 					info->in_ep = n;
 				} else {
-					info->out_ep = n;
+					info->swo_ep = n;
 				}
 			}
 
@@ -114,6 +120,137 @@ static bmp_type_t find_cmsis_dap_interface(libusb_device *dev,bmp_info_t *info)
 	return type;
 }
 
+/*
+ * Firmware built with ENABLE_BULK_IF offers a vendor bulk interface next to
+ * its CDC-ACM ports. Note its endpoints in info if this BMP has one.
+ */
+static void find_bmp_bulk_interface(libusb_device *dev, bmp_info_t *info)
+{
+	info->in_ep = 0;
+	info->out_ep = 0;
+
+	struct libusb_config_descriptor *conf;
+	int res = libusb_get_active_config_descriptor(dev, &conf);
+	if (res < 0) {
+		DEBUG_WARN("WARN: libusb_get_active_config_descriptor() failed: %s",
+			libusb_strerror(res));
+		return;
+	}
+
+	for (int i = 0; i < conf->bNumInterfaces; i++) {
+		const struct libusb_interface_descriptor *interface = &conf->interface[i].altsetting[0];
+		if (interface->bInterfaceClass != BMP_BULK_IF_CLASS ||
+			interface->bInterfaceSubClass != BMP_BULK_IF_SUBCLASS ||
+			interface->bInterfaceProtocol != BMP_BULK_IF_PROTOCOL ||
+			interface->bNumEndpoints != 2)
+			continue;
+
+		info->interface_num = interface->bInterfaceNumber;
+		for (int j = 0; j < interface->bNumEndpoints; j++) {
+			uint8_t n = interface->endpoint[j].bEndpointAddress;
+			if (n & 0x80)
+				info->in_ep = n;
+			else
+				info->out_ep = n;
+		}
+		break;
+	}
+	libusb_free_config_descriptor(conf);
+}
+
+/*
+ * Whether dev could be a debugger this drives, from the descriptors libusb
+ * holds without opening it. Anything that is not a known VID/PID can only be
+ * a CMSIS-DAP, which has a vendor (v2) or HID (v1) interface.
+ */
+static bool usb_device_is_candidate(libusb_device *dev, const struct libusb_device_descriptor *desc)
+{
+	if (desc->idVendor == VENDOR_ID_BMP || desc->idVendor == VENDOR_ID_STLINK || desc->idVendor == VENDOR_ID_SEGGER)
+		return true;
+	for (const cable_desc_t *cable = cable_desc; cable->name; ++cable) {
+		if (cable->vendor == desc->idVendor && cable->product == desc->idProduct)
+			return true;
+	}
+	struct libusb_config_descriptor *conf;
+	if (libusb_get_active_config_descriptor(dev, &conf) < 0)
+		return true; /* Can not tell, have a closer look */
+	bool candidate = false;
+	for (int i = 0; i < conf->bNumInterfaces && !candidate; i++) {
+		const uint8_t class = conf->interface[i].altsetting[0].bInterfaceClass;
+		candidate = class == LIBUSB_CLASS_VENDOR_SPEC || class == LIBUSB_CLASS_HID;
+	}
+	libusb_free_config_descriptor(conf);
+	return candidate;
+}
+
+#if defined(__linux__)
+/* The kernel keeps the device's strings in sysfs, reading them there needs no access rights and no transfer */
+static bool usb_sysfs_string(libusb_device *dev, const char *name, char *str, size_t len)
+{
+	uint8_t ports[7];
+	const int depth = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	if (depth <= 0)
+		return false;
+	char path[96];
+	size_t offset = snprintf(path, sizeof(path), "/sys/bus/usb/devices/%u-%u", libusb_get_bus_number(dev), ports[0]);
+	for (int i = 1; i < depth && offset < sizeof(path); ++i)
+		offset += snprintf(path + offset, sizeof(path) - offset, ".%u", ports[i]);
+	if (offset >= sizeof(path) || (size_t)snprintf(path + offset, sizeof(path) - offset, "/%s", name) >= sizeof(path) - offset)
+		return false;
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+	const bool read = fgets(str, len, file) != NULL;
+	fclose(file);
+	if (read)
+		str[strcspn(str, "\n")] = '\0';
+	return read;
+}
+#endif
+
+/*
+ * Fetch the string descriptor index of dev, opening it into handle only if
+ * sysfs does not have the string. Returns false if the device is of no use.
+ */
+static bool usb_device_string(libusb_device *dev, libusb_device_handle **handle, bool *access_problems,
+	uint8_t index, const char *sysfs_name, char *str, size_t len)
+{
+	str[0] = '\0';
+	/* The device has no such string and that's ok */
+	if (!index)
+		return true;
+#if defined(__linux__)
+	if (usb_sysfs_string(dev, sysfs_name, str, len))
+		return true;
+#else
+	(void)sysfs_name;
+#endif
+	if (!*handle && libusb_open(dev, handle) != LIBUSB_SUCCESS) {
+		*handle = NULL;
+		*access_problems = true;
+		return false;
+	}
+	const int res = libusb_get_string_descriptor_ascii(*handle, index, (uint8_t *)str, len);
+	/* If the call fails and it's not because the device gave us STALL, the device is of no use */
+	if (res < 0 && res != LIBUSB_ERROR_PIPE) {
+		DEBUG_WARN("WARN: libusb_get_string_descriptor_ascii() call to fetch %s string failed: %s\n", sysfs_name,
+			libusb_strerror(res));
+		return false;
+	}
+	if (res <= 0)
+		str[0] = '\0';
+	return true;
+}
+
+/* The debuggers found, listed when there is more than one to choose from */
+#define FIND_LIST_MAX 32U
+
+typedef struct found_debugger {
+	char serial[64];
+	char manufacturer[128];
+	char product[128];
+} found_debugger_s;
+
 int find_debuggers(BMP_CL_OPTIONS_t *cl_opts, bmp_info_t *info)
 {
 	libusb_device **devs;
@@ -142,8 +279,8 @@ int find_debuggers(BMP_CL_OPTIONS_t *cl_opts, bmp_info_t *info)
         DEBUG_WARN( "WARN:libusb_get_device_list() failed");
 		return -1;
 	}
-	bool report = false;
-	int found_debuggers;
+	int found_debuggers = 0;
+	static found_debugger_s found_list[FIND_LIST_MAX];
 	struct libusb_device_descriptor desc;
 	char serial[64];
 	char manufacturer[128];
@@ -151,22 +288,12 @@ int find_debuggers(BMP_CL_OPTIONS_t *cl_opts, bmp_info_t *info)
 	bool access_problems = false;
 	char *active_cable = NULL;
 	bool ftdi_unknown = false;
-rescan:
-	found_debuggers = 0;
-	serial[0] = 0;
-	manufacturer[0] = 0;
-	product[0] = 0;
-	access_problems = false;
-	active_cable = NULL;
-	ftdi_unknown = false;
 	for (size_t i = 0; devs[i]; ++i) {
 		bmp_type_t type = BMP_TYPE_NONE;
 		libusb_device *dev = devs[i];
 		int res = libusb_get_device_descriptor(dev, &desc);
 		if (res < 0) {
-            DEBUG_WARN( "WARN: libusb_get_device_descriptor() failed: %s",
-					libusb_strerror(res));
-			libusb_free_device_list(devs, 1);
+			DEBUG_WARN("WARN: libusb_get_device_descriptor() failed: %s", libusb_strerror(res));
 			continue;
 		}
 		/* Exclude hubs from testing. Probably more classes could be excluded here!*/
@@ -175,70 +302,31 @@ rescan:
 		case LIBUSB_CLASS_WIRELESS:
 			continue;
 		}
-		libusb_device_handle *handle = NULL;
-		res = libusb_open(dev, &handle);
-		if (res != LIBUSB_SUCCESS) {
-			if (!access_problems) {
-				DEBUG_INFO("INFO: Open USB %04x:%04x class %2x failed\n",
-						   desc.idVendor, desc.idProduct, desc.bDeviceClass);
-				access_problems = true;
-			}
+		/* Decide as much as possible before the device is opened, opening each is what takes the time */
+		if (!usb_device_is_candidate(dev, &desc))
 			continue;
-		}
-		/* If the device even has a serial number string, fetch it */
-		if (desc.iSerialNumber) {
-			res = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
-				(uint8_t *)serial, sizeof(serial));
-			/* If the call fails and it's not because the device gave us STALL, continue to the next one */
-			if (res < 0 && res != LIBUSB_ERROR_PIPE) {
-				libusb_close(handle);
-				continue;
-			}
-			/* Device has no serial and that's ok. */
-			else if (res <= 0)
-				serial[0] = '\0';
-		}
-		else
-			serial[0] = '\0';
-		if (cl_opts->opt_serial && !strstr(serial, cl_opts->opt_serial)) {
+		libusb_device_handle *handle = NULL;
+		bool access_problem = false;
+		/* The serial number first, so a device that is not the one asked for is dropped early */
+		bool usable = usb_device_string(dev, &handle, &access_problem, desc.iSerialNumber, "serial", serial,
+			sizeof(serial));
+		if (usable && cl_opts->opt_serial && !strstr(serial, cl_opts->opt_serial))
+			usable = false;
+		if (usable)
+			usable = usb_device_string(dev, &handle, &access_problem, desc.iManufacturer, "manufacturer",
+				manufacturer, sizeof(manufacturer));
+		if (usable)
+			usable = usb_device_string(
+				dev, &handle, &access_problem, desc.iProduct, "product", product, sizeof(product));
+		if (handle)
 			libusb_close(handle);
-			continue;
-		}
-		/* Attempt to get the manufacturer string */
-		if (desc.iManufacturer) {
-			res = libusb_get_string_descriptor_ascii(handle, desc.iManufacturer,
-				(uint8_t *)manufacturer, sizeof(manufacturer));
-			/* If the call fails and it's not because the device gave us STALL, continue to the next one */
-			if (res < 0 && res != LIBUSB_ERROR_PIPE) {
-				DEBUG_WARN("WARN: libusb_get_string_descriptor_ascii() call to fetch manufacturer string failed: %s\n",
-					libusb_strerror(res));
-				libusb_close(handle);
-				continue;
-			}
-			/* Device has no manufacturer string and that's ok. */
-			else if (res <= 0)
-				manufacturer[0] = '\0';
-		}
-		else
-			manufacturer[0] = '\0';
-		/* Attempt to get the product string */
-		if (desc.iProduct) {
-			res = libusb_get_string_descriptor_ascii(handle, desc.iProduct,
-				(uint8_t *)product, sizeof(product));
-			/* If the call fails and it's not because the device gave us STALL, continue to the next one */
-			if (res < 0 && res != LIBUSB_ERROR_PIPE) {
-				DEBUG_WARN("WARN: libusb_get_string_descriptor_ascii() call to fetch product string failed: %s\n",
-					libusb_strerror(res));
-				libusb_close(handle);
-				continue;
-			}
-			/* Device has no product string and that's ok. */
-			else if (res <= 0)
-				product[0] = '\0';
+		if (access_problem && !access_problems) {
+			DEBUG_INFO("INFO: Open USB %04x:%04x class %2x failed\n", desc.idVendor, desc.idProduct,
+				desc.bDeviceClass);
+			access_problems = true;
 		}
-		else
-			product[0] = '\0';
-		libusb_close(handle);
+		if (!usable)
+			continue;
 		if (cl_opts->opt_ident_string) {
 			char *match_manu = NULL;
 			char *match_product = NULL;
@@ -250,9 +338,10 @@ rescan:
 		/* Either serial and/or ident_string match or are not given.
 		 * Check type.*/
 		if (desc.idVendor == VENDOR_ID_BMP) {
-			if (desc.idProduct == PRODUCT_ID_BMP)
+			if (desc.idProduct == PRODUCT_ID_BMP) {
 				type = BMP_TYPE_BMP;
-			else {
+				find_bmp_bulk_interface(dev, info);
+			} else {
 				if (desc.idProduct == PRODUCT_ID_BMP_BL)
 					DEBUG_WARN("BMP in bootloader mode found. Restart or reflash!\n");
 				continue;
@@ -313,10 +402,11 @@ rescan:
 			if (!cable->name)
 				continue;
 		}
-		if (report) {
-			DEBUG_WARN("%2d: %s, %s, %s\n", found_debuggers + 1,
-				serial[0] ? serial :  NO_SERIAL_NUMBER,
-				manufacturer,product);
+		if ((size_t)found_debuggers < FIND_LIST_MAX) {
+			found_debugger_s *const found = &found_list[found_debuggers];
+			strncpy(found->serial, serial, sizeof(found->serial));
+			strncpy(found->manufacturer, manufacturer, sizeof(found->manufacturer));
+			strncpy(found->product, product, sizeof(found->product));
 		}
 		info->vid = desc.idVendor;
 		info->pid = desc.idProduct;
@@ -339,18 +429,17 @@ rescan:
 		DEBUG_WARN("No usable debugger found\n");
 	if (found_debuggers > 1 ||
 		(found_debuggers == 1 && cl_opts->opt_list_only)) {
-		if (!report) {
-			if (found_debuggers > 1)
-				DEBUG_WARN("%d debuggers found!\nSelect with -P <pos> "
-						   "or -s <(partial)serial no.>\n",
-						   found_debuggers);
-			report = true;
-			goto rescan;
-		} else {
-			if (found_debuggers > 0)
-				access_problems = false;
-			found_debuggers = 0;
+		if (found_debuggers > 1)
+			DEBUG_WARN("%d debuggers found!\nSelect with -P <pos> "
+					   "or -s <(partial)serial no.>\n",
+					   found_debuggers);
+		for (size_t n = 0; n < (size_t)found_debuggers && n < FIND_LIST_MAX; ++n) {
+			const found_debugger_s *const found = &found_list[n];
+			DEBUG_WARN("%2d: %s, %s, %s\n", (int)n + 1, found->serial[0] ? found->serial : NO_SERIAL_NUMBER,
+				found->manufacturer, found->product);
 		}
+		access_problems = false;
+		found_debuggers = 0;
 	}
 	if (!found_debuggers && access_problems)
 		DEBUG_WARN(
@@ -359,9 +448,95 @@ rescan:
 	return found_debuggers == 1 ? 0 : -1;
 }
 
+/* Open the BMP found by find_debuggers() and claim its vendor bulk interface */
+int bmp_bulk_open(bmp_info_t *info)
+{
+	usb_link_t *link = calloc(1, sizeof(usb_link_t));
+	if (!link)
+		return -1;
+	link->ul_libusb_ctx = info->libusb_ctx;
+
+	libusb_device **devs;
+	const ssize_t n_devs = libusb_get_device_list(info->libusb_ctx, &devs);
+	if (n_devs < 0) {
+		DEBUG_WARN("WARN:libusb_get_device_list() failed");
+		free(link);
+		return -1;
+	}
+	for (ssize_t i = 0; i < n_devs && !link->ul_libusb_device_handle; ++i) {
+		struct libusb_device_descriptor desc;
+		if (libusb_get_device_descriptor(devs[i], &desc) != LIBUSB_SUCCESS ||
+			desc.idVendor != info->vid || desc.idProduct != info->pid)
+			continue;
+		libusb_device_handle *handle;
+		if (libusb_open(devs[i], &handle) != LIBUSB_SUCCESS)
+			continue;
+		/* Several probes may be attached, take the one with the serial number found */
+		char serial[64] = {0};
+		if (desc.iSerialNumber &&
+			libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, (uint8_t *)serial, sizeof(serial)) < 0)
+			serial[0] = '\0';
+		if (strcmp(serial, info->serial)) {
+			libusb_close(handle);
+			continue;
+		}
+		link->ul_libusb_device_handle = handle;
+	}
+	libusb_free_device_list(devs, 1);
+	if (!link->ul_libusb_device_handle) {
+		DEBUG_WARN("WARN: Failed to open the BMP bulk interface\n");
+		free(link);
+		return -1;
+	}
+
+	const int res = libusb_claim_interface(link->ul_libusb_device_handle, info->interface_num);
+	if (res) {
+		DEBUG_WARN("WARN: libusb_claim_interface() failed: %s\n", libusb_strerror(res));
+		libusb_close(link->ul_libusb_device_handle);
+		free(link);
+		return -1;
+	}
+	link->ep_tx = info->out_ep;
+	link->ep_rx = info->in_ep & 0x7fU;
+	if (usb_transfers_init(link)) {
+		libusb_release_interface(link->ul_libusb_device_handle, info->interface_num);
+		libusb_close(link->ul_libusb_device_handle);
+		free(link);
+		return -1;
+	}
+	info->usb_link = link;
+	DEBUG_INFO("Using the BMP bulk interface\n");
+	return 0;
+}
+
+int bmp_bulk_write(const uint8_t *data, size_t size)
+{
+	return send_recv(info.usb_link, (uint8_t *)data, size, NULL, 0);
+}
+
+/*
+ * Read whatever the probe sends within timeout ms. size must be a multiple
+ * of the endpoint packet size. Returns the number of bytes, 0 on timeout
+ * and -1 on error.
+ */
+int bmp_bulk_read(uint8_t *data, size_t size, uint32_t timeout)
+{
+	int transferred = 0;
+	const uint8_t ep = info.usb_link->ep_rx | LIBUSB_ENDPOINT_IN;
+	WIRE_TRACE(WIRE_TRACE_USB_SUBMIT, ep, size);
+	const int res = libusb_bulk_transfer(info.usb_link->ul_libusb_device_handle, ep, data, size, &transferred, timeout);
+	WIRE_TRACE(WIRE_TRACE_USB_COMPLETE, ep, transferred);
+	if (res && res != LIBUSB_ERROR_TIMEOUT) {
+		DEBUG_WARN("libusb_bulk_transfer(): %s\n", libusb_strerror(res));
+		return -1;
+	}
+	return transferred;
+}
+
 static void LIBUSB_CALL on_trans_done(struct libusb_transfer *trans)
 {
     struct trans_ctx * const ctx = trans->user_data;
+	WIRE_TRACE(WIRE_TRACE_USB_COMPLETE, trans->endpoint, trans->actual_length);
 
     if (trans->status != LIBUSB_TRANSFER_COMPLETED)
     {
@@ -379,44 +554,89 @@ static void LIBUSB_CALL on_trans_done(struct libusb_transfer *trans)
     ctx->flags |= TRANS_FLAGS_IS_DONE;
 }
 
-static int submit_wait(usb_link_t *link, struct libusb_transfer *trans) {
-	struct trans_ctx trans_ctx;
-	enum libusb_error error;
-
-	trans_ctx.flags = 0;
+int usb_transfers_init(usb_link_t *link)
+{
+	for (size_t i = 0; i < USB_TRANSFER_POOL_SIZE; ++i) {
+		usb_transfer_s *const transfer = &link->pool[i];
+		transfer->trans = libusb_alloc_transfer(0);
+		if (!transfer->trans) {
+			DEBUG_WARN("libusb_alloc_transfer failed\n");
+			usb_transfers_free(link);
+			return -1;
+		}
+		transfer->busy = false;
+	}
+	return 0;
+}
 
-	/* brief intrusion inside the libusb interface */
-	trans->callback = on_trans_done;
-	trans->user_data = &trans_ctx;
+void usb_transfers_free(usb_link_t *link)
+{
+	for (size_t i = 0; i < USB_TRANSFER_POOL_SIZE; ++i) {
+		libusb_free_transfer(link->pool[i].trans);
+		link->pool[i].trans = NULL;
+	}
+}
 
-	if ((error = libusb_submit_transfer(trans))) {
-		DEBUG_WARN("libusb_submit_transfer(%d): %s\n", error,
-			  libusb_strerror(error));
-		exit(-1);
+/*
+ * Queue a bulk transfer from a free slot of the link's pool without waiting
+ * for it. Transfers on the same endpoint complete in the order submitted.
+ * Returns NULL when the pool is exhausted or the submission failed.
+ */
+usb_transfer_s *usb_submit(usb_link_t *link, uint8_t *buf, size_t size, bool in)
+{
+	usb_transfer_s *transfer = NULL;
+	for (size_t i = 0; i < USB_TRANSFER_POOL_SIZE && !transfer; ++i) {
+		if (link->pool[i].trans && !link->pool[i].busy)
+			transfer = &link->pool[i];
+	}
+	if (!transfer) {
+		DEBUG_WARN("usb_submit: no free transfer\n");
+		return NULL;
+	}
+	transfer->ctx.flags = 0;
+	libusb_fill_bulk_transfer(transfer->trans, link->ul_libusb_device_handle,
+		in ? (link->ep_rx | LIBUSB_ENDPOINT_IN) : (link->ep_tx | LIBUSB_ENDPOINT_OUT),
+		buf, size, on_trans_done, &transfer->ctx, 0);
+	const int error = libusb_submit_transfer(transfer->trans);
+	if (error) {
+		DEBUG_WARN("libusb_submit_transfer(%d): %s\n", error, libusb_strerror(error));
+		return NULL;
 	}
+	transfer->busy = true;
+	WIRE_TRACE(WIRE_TRACE_USB_SUBMIT, transfer->trans->endpoint, size);
+	return transfer;
+}
 
-	uint32_t start_time = platform_time_ms();
-	while (trans_ctx.flags == 0) {
+/*
+ * Wait for a submitted transfer and give its slot back to the pool.
+ * A transfer gets a second to complete from the time it is reaped.
+ * Returns the length transferred, or -1 when it failed or timed out.
+ */
+int usb_reap(usb_link_t *link, usb_transfer_s *transfer)
+{
+	const uint32_t start_time = platform_time_ms();
+	bool cancelled = false;
+	while (!(transfer->ctx.flags & TRANS_FLAGS_IS_DONE)) {
 		struct timeval timeout;
 		timeout.tv_sec = 1;
 		timeout.tv_usec = 0;
 		if (libusb_handle_events_timeout(link->ul_libusb_ctx, &timeout)) {
+			/* The slot stays busy, libusb may still own the transfer */
 			DEBUG_WARN("libusb_handle_events()\n");
 			return -1;
 		}
-		uint32_t now = platform_time_ms();
-		if (now - start_time > 1000) {
-			libusb_cancel_transfer(trans);
+		if (!cancelled && platform_time_ms() - start_time > 1000U) {
+			libusb_cancel_transfer(transfer->trans);
 			DEBUG_WARN("libusb_handle_events() timeout\n");
-			return -1;
+			cancelled = true;
 		}
 	}
-	if (trans_ctx.flags & TRANS_FLAGS_HAS_ERROR) {
+	transfer->busy = false;
+	if (transfer->ctx.flags & TRANS_FLAGS_HAS_ERROR) {
 		DEBUG_WARN("libusb_handle_events() | has_error\n");
 		return -1;
 	}
-
-	return 0;
+	return transfer->trans->actual_length;
 }
 
 /* One USB transaction */
@@ -426,11 +646,6 @@ int send_recv(usb_link_t *link,
 {
 	int res = 0;
 	if (txsize) {
-		libusb_fill_bulk_transfer(link->req_trans,
-								  link->ul_libusb_device_handle,
-								  link->ep_tx | LIBUSB_ENDPOINT_OUT,
-								  txbuf, txsize,
-								  NULL, NULL, 0);
 		size_t i = 0;
 		DEBUG_WIRE(" Send (%3zu): ", txsize);
 		for (; i < txsize; ++i) {
@@ -442,7 +657,10 @@ int send_recv(usb_link_t *link,
 		}
 		if (!(i & 31U))
 			DEBUG_WIRE("\n");
-		if (submit_wait(link, link->req_trans)) {
+		usb_transfer_s *const transfer = usb_submit(link, txbuf, txsize, false);
+		if (!transfer)
+			exit(-1);
+		if (usb_reap(link, transfer) < 0) {
 			libusb_clear_halt(link->ul_libusb_device_handle, link->ep_tx);
 			return -1;
 		}
@@ -450,16 +668,15 @@ int send_recv(usb_link_t *link,
 	/* send_only */
 	if (rxsize != 0) {
 		/* read the response */
-		libusb_fill_bulk_transfer(link->rep_trans, link->ul_libusb_device_handle,
-								  link->ep_rx | LIBUSB_ENDPOINT_IN,
-								  rxbuf, rxsize, NULL, NULL, 0);
-
-		if (submit_wait(link, link->rep_trans)) {
+		usb_transfer_s *const transfer = usb_submit(link, rxbuf, rxsize, true);
+		if (!transfer)
+			exit(-1);
+		res = usb_reap(link, transfer);
+		if (res < 0) {
 			DEBUG_WARN("clear 1\n");
 			libusb_clear_halt(link->ul_libusb_device_handle, link->ep_rx);
 			return -1;
 		}
-		res = link->rep_trans->actual_length;
 		if (res > 0) {
 			const size_t rxlen = (size_t)res;
 			DEBUG_WIRE(" Rec (%zu/%zu)", rxsize, rxlen);
@@ -473,3 +690,140 @@ int send_recv(usb_link_t *link,
 	DEBUG_WIRE("\n");
 	return res;
 }
+
+/*
+ * Submit a run of bulk transfers back to back and wait for all of them.
+ * Transfers on the same endpoint complete in the order given, so a probe
+ * answering one command after the other finds the next already queued while
+ * the reply to the last is still coming in. Runs longer than the pool keep
+ * it full, reaping the oldest transfer before submitting the next.
+ * Returns 0, or -1 when a transfer failed or timed out.
+ */
+int send_recv_pipelined(usb_link_t *link, const usb_pipelined_s *steps, size_t count)
+{
+	usb_transfer_s *in_flight[USB_TRANSFER_POOL_SIZE];
+	size_t submitted = 0;
+	size_t reaped = 0;
+	int res = 0;
+	DEBUG_WIRE(" Pipelined %zu transfers\n", count);
+
+	while (reaped < count) {
+		while (res == 0 && submitted < count && submitted - reaped < USB_TRANSFER_POOL_SIZE) {
+			const usb_pipelined_s *const step = &steps[submitted];
+			usb_transfer_s *const transfer = usb_submit(link, step->buf, step->size, step->in);
+			if (!transfer) {
+				res = -1;
+				break;
+			}
+			in_flight[submitted++ % USB_TRANSFER_POOL_SIZE] = transfer;
+		}
+		if (reaped == submitted)
+			break;
+		const bool in = steps[reaped].in;
+		if (usb_reap(link, in_flight[reaped++ % USB_TRANSFER_POOL_SIZE]) < 0) {
+			libusb_clear_halt(link->ul_libusb_device_handle, in ? link->ep_rx : link->ep_tx);
+			res = -1;
+		}
+	}
+	return res;
+}
+
+/* Debuggers known to the hotplug watch, so one that goes away can be named */
+#define HOTPLUG_DEVICES_MAX 64U
+
+typedef struct hotplug_device {
+	libusb_device *dev;
+	char serial[64];
+	bool pending; /* arrived, the serial number not read yet */
+} hotplug_device_s;
+
+static libusb_context *hotplug_ctx;
+static hotplug_device_s hotplug_devices[HOTPLUG_DEVICES_MAX];
+static bmp_hotplug_cb hotplug_callback;
+static void *hotplug_callback_ctx;
+
+/*
+ * libusb must not be asked for anything but the descriptors it holds from
+ * within the callback, so an arrival only gets noted here and bmp_hotplug_poll()
+ * reads its serial number afterwards.
+ */
+static int LIBUSB_CALL hotplug_event(libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *user_data)
+{
+	(void)ctx;
+	(void)user_data;
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+		struct libusb_device_descriptor desc;
+		if (libusb_get_device_descriptor(dev, &desc) < 0 || desc.bDeviceClass == LIBUSB_CLASS_HUB ||
+			desc.bDeviceClass == LIBUSB_CLASS_WIRELESS || !usb_device_is_candidate(dev, &desc))
+			return 0;
+		for (size_t i = 0; i < HOTPLUG_DEVICES_MAX; ++i) {
+			hotplug_device_s *const device = &hotplug_devices[i];
+			if (device->dev)
+				continue;
+			device->dev = libusb_ref_device(dev);
+			device->pending = true;
+			return 0;
+		}
+		DEBUG_WARN("Watching %u devices already, ignoring another\n", HOTPLUG_DEVICES_MAX);
+		return 0;
+	}
+	for (size_t i = 0; i < HOTPLUG_DEVICES_MAX; ++i) {
+		hotplug_device_s *const device = &hotplug_devices[i];
+		if (device->dev != dev)
+			continue;
+		/* Never reported as arrived, so not as gone either */
+		if (!device->pending && device->serial[0])
+			hotplug_callback(device->serial, false, hotplug_callback_ctx);
+		libusb_unref_device(device->dev);
+		memset(device, 0, sizeof(*device));
+	}
+	return 0;
+}
+
+bool bmp_hotplug_start(const bmp_hotplug_cb callback, void *const ctx)
+{
+	int res = libusb_init(&hotplug_ctx);
+	if (res) {
+		DEBUG_WARN("Failed to get USB context: %s\n", libusb_strerror(res));
+		return false;
+	}
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		DEBUG_WARN("This libusb has no hotplug support\n");
+		return false;
+	}
+	hotplug_callback = callback;
+	hotplug_callback_ctx = ctx;
+	res = libusb_hotplug_register_callback(hotplug_ctx,
+		LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, LIBUSB_HOTPLUG_ENUMERATE,
+		LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, hotplug_event, NULL, NULL);
+	if (res != LIBUSB_SUCCESS) {
+		DEBUG_WARN("Can not watch for USB devices: %s\n", libusb_strerror(res));
+		return false;
+	}
+	return true;
+}
+
+void bmp_hotplug_poll(const uint32_t timeout_ms)
+{
+	struct timeval tv = {.tv_sec = timeout_ms / 1000U, .tv_usec = (timeout_ms % 1000U) * 1000U};
+	libusb_handle_events_timeout(hotplug_ctx, &tv);
+	for (size_t i = 0; i < HOTPLUG_DEVICES_MAX; ++i) {
+		hotplug_device_s *const device = &hotplug_devices[i];
+		if (!device->dev || !device->pending)
+			continue;
+		device->pending = false;
+		struct libusb_device_descriptor desc = {0};
+		libusb_device_handle *handle = NULL;
+		bool access_problem = false;
+		/* Without a serial number the debugger can not be told apart from the others */
+		if (libusb_get_device_descriptor(device->dev, &desc) == 0 &&
+			usb_device_string(device->dev, &handle, &access_problem, desc.iSerialNumber, "serial", device->serial,
+				sizeof(device->serial)) &&
+			device->serial[0])
+			hotplug_callback(device->serial, true, hotplug_callback_ctx);
+		else
+			DEBUG_INFO("Ignoring USB %04x:%04x without a readable serial number\n", desc.idVendor, desc.idProduct);
+		if (handle)
+			libusb_close(handle);
+	}
+}
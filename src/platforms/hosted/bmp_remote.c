@@ -27,6 +27,7 @@
 #include "bmp_remote.h"
 #include "cli.h"
 #include "hex_utils.h"
+#include "lz.h"
 
 #include <assert.h>
 #include <sys/time.h>
@@ -34,6 +35,11 @@
 #include <errno.h>
 
 #include "adiv5.h"
+#include "cortexm.h"
+#ifdef ENABLE_RTT
+#include "rtt.h"
+#include "rtt_if.h"
+#endif
 
 int remote_init(void)
 {
@@ -240,9 +246,82 @@ static uint32_t remote_adiv5_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 	return dest[0];
 }
 
+/*
+ * Commands whose reply nobody waits for are posted: sent with a sequence
+ * number and their replies only collected once REMOTE_POSTED_MAX are in
+ * flight, or before the reply to any other command is read.
+ */
+static struct {
+	ADIv5_DP_t *dp[REMOTE_POSTED_MAX]; /* DP to flag a fault on, if any */
+	uint8_t seq[REMOTE_POSTED_MAX];
+	size_t head;
+	size_t count;
+	uint8_t next_seq;
+	bool draining;
+} remote_posted;
+static bool remote_posting;
+
+static void remote_posted_reap(void)
+{
+	const size_t idx = remote_posted.head;
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	remote_posted.head = (remote_posted.head + 1U) % REMOTE_POSTED_MAX;
+	--remote_posted.count;
+	if (s >= 4 && construct[0] == REMOTE_SEQ_PACKET && remotehston(2, construct + 1) == remote_posted.seq[idx] &&
+		construct[3] == REMOTE_RESP_OK)
+		return;
+	DEBUG_WARN("Posted remote command %u failed: %s\n", remote_posted.seq[idx], s > 0 ? construct : "no reply");
+	if (remote_posted.dp[idx])
+		remote_posted.dp[idx]->fault = 1;
+}
+
+/* Collect all outstanding posted replies, called before any other reply is read */
+void remote_posted_drain(void)
+{
+	/* Reaping reads replies itself, which must not recurse into here */
+	if (remote_posted.draining)
+		return;
+	remote_posted.draining = true;
+	while (remote_posted.count)
+		remote_posted_reap();
+	remote_posted.draining = false;
+}
+
+/*
+ * Send a command built by the caller at construct + 3, of length s, as a
+ * posted one. Any data frames that belong to it must follow right away.
+ */
+static void remote_post(ADIv5_DP_t *dp, char *construct, int s)
+{
+	if (remote_posted.count == REMOTE_POSTED_MAX) {
+		remote_posted.draining = true;
+		remote_posted_reap();
+		remote_posted.draining = false;
+	}
+	const uint8_t seq = remote_posted.next_seq++;
+	const size_t idx = (remote_posted.head + remote_posted.count++) % REMOTE_POSTED_MAX;
+	remote_posted.seq[idx] = seq;
+	remote_posted.dp[idx] = dp;
+	/* The command's own REMOTE_SOM at construct[3] is replaced by the prefix */
+	static const char hex_digits[] = "0123456789abcdef";
+	construct[0] = REMOTE_SOM;
+	construct[1] = REMOTE_SEQ_PACKET;
+	construct[2] = hex_digits[seq >> 4U];
+	construct[3] = hex_digits[seq & 0x0fU];
+	platform_buffer_write((uint8_t *)construct, s + 3);
+}
+
 static void remote_adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
 	uint8_t construct[REMOTE_MAX_MSG_SIZE];
+	if (remote_posting) {
+		/* ap_write never reported errors, so a failure is only logged */
+		const int s = snprintf((char *)construct + 3, REMOTE_MAX_MSG_SIZE - 3, REMOTE_AP_WRITE_STR,
+			ap->dp->dp_jd_index, ap->apsel, addr, value);
+		remote_post(NULL, (char *)construct, s);
+		return;
+	}
 	int s = snprintf((char *)construct, REMOTE_MAX_MSG_SIZE,REMOTE_AP_WRITE_STR,
 		ap->dp->dp_jd_index,  ap->apsel, addr, value);
 	platform_buffer_write(construct, s);
@@ -375,15 +454,231 @@ static void remote_ap_mem_write_sized(
 	}
 }
 
-void remote_adiv5_dp_defaults(ADIv5_DP_t *dp)
+static void remote_ap_mem_read_bin(
+	ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	if (len == 0)
+		return;
+	char construct[REMOTE_MAX_MSG_SIZE];
+	/* Raw bytes come back unescaped, leave room for response code and NUL */
+	const size_t batchsize = REMOTE_MAX_MSG_SIZE - 0x20;
+	while (len) {
+		const size_t count = len > batchsize ? batchsize : len;
+		int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_READ_BIN_STR,
+			ap->dp->dp_jd_index, ap->apsel, ap->csw, src, (uint32_t)count);
+		platform_buffer_write((uint8_t *)construct, s);
+		s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+		if (s == (int)count + 1 && construct[0] == REMOTE_RESP_OK) {
+			memcpy(dest, construct + 1, count);
+			src  += count;
+			dest += count;
+			len  -= count;
+			continue;
+		}
+		if (s > 0 && construct[0] == REMOTE_RESP_ERR) {
+			ap->dp->fault = 1;
+			DEBUG_WARN("%s returned REMOTE_RESP_ERR at apsel %d, "
+				"addr: 0x%08" PRIx32 "\n", __func__, ap->apsel, src);
+		} else
+			DEBUG_WARN("%s error %d around 0x%08" PRIx32 "\n",
+				__func__, s, src);
+		break;
+	}
+}
+
+static void remote_ap_mem_write_bin(
+	ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len,
+	enum align align)
+{
+	if (len == 0)
+		return;
+	/* Worst case every payload byte needs escaping */
+	char construct[2 * REMOTE_MAX_MSG_SIZE];
+	/* The firmware unescapes into its packet buffer, header included */
+	const size_t batchsize = REMOTE_MAX_MSG_SIZE - 0x30;
+	const uint8_t *data = src;
+	while (len) {
+		const size_t count = len > batchsize ? batchsize : len;
+		int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_WRITE_BIN_STR,
+			ap->dp->dp_jd_index, ap->apsel, ap->csw, align, dest, (uint32_t)count);
+		char *p = construct + s;
+		for (size_t i = 0; i < count; ++i) {
+			const uint8_t c = data[i];
+			if (REMOTE_NEEDS_ESCAPE(c)) {
+				*p++ = REMOTE_ESC;
+				*p++ = (char)(c ^ REMOTE_ESC_XOR);
+			} else
+				*p++ = (char)c;
+		}
+		*p++ = REMOTE_EOM;
+		platform_buffer_write((uint8_t *)construct, p - construct);
+
+		s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+		if (s > 0 && construct[0] == REMOTE_RESP_OK) {
+			data += count;
+			dest += count;
+			len  -= count;
+			continue;
+		}
+		if (s > 0 && construct[0] == REMOTE_RESP_ERR) {
+			ap->dp->fault = 1;
+			DEBUG_WARN("%s returned REMOTE_RESP_ERR at apsel %d, "
+				"addr: 0x%08" PRIx32 "\n", __func__, ap->apsel, dest);
+		} else
+			DEBUG_WARN("%s error %d around address 0x%08" PRIx32 "\n",
+				__func__, s, dest);
+		break;
+	}
+}
+
+/* Send data as the !<raw># frames that follow a block or flash write header */
+void remote_send_frames(const uint8_t *data, const size_t len)
+{
+	/* Worst case every payload byte needs escaping */
+	char frame[2 * REMOTE_BLOCK_FRAME_SIZE + 2];
+	for (size_t offset = 0; offset < len; offset += REMOTE_BLOCK_FRAME_SIZE) {
+		const size_t count = MIN(len - offset, REMOTE_BLOCK_FRAME_SIZE);
+		char *p = frame;
+		*p++ = REMOTE_SOM;
+		for (size_t i = 0; i < count; ++i) {
+			const uint8_t c = data[offset + i];
+			if (REMOTE_NEEDS_ESCAPE(c)) {
+				*p++ = REMOTE_ESC;
+				*p++ = (char)(c ^ REMOTE_ESC_XOR);
+			} else
+				*p++ = (char)c;
+		}
+		*p++ = REMOTE_EOM;
+		platform_buffer_write((uint8_t *)frame, p - frame);
+	}
+}
+
+static void remote_ap_mem_read_block(
+	ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	if (len == 0)
+		return;
+	char construct[REMOTE_MAX_MSG_SIZE];
+	int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_READ_BLOCK_STR,
+		ap->dp->dp_jd_index, ap->apsel, ap->csw, src, (uint32_t)len);
+	platform_buffer_write((uint8_t *)construct, s);
+	/* One request, the probe streams the block back frame by frame */
+	while (len) {
+		const size_t count = MIN(len, REMOTE_BLOCK_FRAME_SIZE);
+		s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+		if (s == (int)count + 1 && construct[0] == REMOTE_RESP_OK) {
+			memcpy(dest, construct + 1, count);
+			src  += count;
+			dest += count;
+			len  -= count;
+			continue;
+		}
+		if (s > 0 && construct[0] == REMOTE_RESP_ERR) {
+			ap->dp->fault = 1;
+			DEBUG_WARN("%s returned REMOTE_RESP_ERR at apsel %d, "
+				"addr: 0x%08" PRIx32 "\n", __func__, ap->apsel, src);
+		} else
+			DEBUG_WARN("%s error %d around 0x%08" PRIx32 "\n",
+				__func__, s, src);
+		break;
+	}
+}
+
+static void remote_ap_mem_write_block(
+	ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len,
+	enum align align)
+{
+	if (len == 0)
+		return;
+	char construct[REMOTE_MAX_MSG_SIZE];
+	if (remote_posting) {
+		/* A fault shows up on the DP once the reply is collected */
+		const int s = snprintf(construct + 3, REMOTE_MAX_MSG_SIZE - 3, REMOTE_AP_MEM_WRITE_BLOCK_STR,
+			ap->dp->dp_jd_index, ap->apsel, ap->csw, align, dest, (uint32_t)len);
+		remote_post(ap->dp, construct, s);
+		remote_send_frames(src, len);
+		return;
+	}
+	int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_WRITE_BLOCK_STR,
+		ap->dp->dp_jd_index, ap->apsel, ap->csw, align, dest, (uint32_t)len);
+	platform_buffer_write((uint8_t *)construct, s);
+	remote_send_frames(src, len);
+	/* The whole block is acknowledged once */
+	s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	if (s > 0 && construct[0] == REMOTE_RESP_OK)
+		return;
+	if (s > 0 && construct[0] == REMOTE_RESP_ERR) {
+		ap->dp->fault = 1;
+		DEBUG_WARN("%s returned REMOTE_RESP_ERR at apsel %d, "
+			"block 0x%08" PRIx32 "\n", __func__, ap->apsel, dest);
+	} else
+		DEBUG_WARN("%s error %d around address 0x%08" PRIx32 "\n",
+			__func__, s, dest);
+}
+
+/* Send the queued accesses as access vectors, one round trip per vector */
+static bool remote_adiv5_queue_flush(ADIv5_DP_t *dp)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	/* Posted writes ahead of the queue must have reported their faults */
+	remote_posted_drain();
+	for (size_t base = 0; base < dp->queue_len; base += REMOTE_ACCESS_VECTOR_MAX) {
+		const size_t count = MIN(dp->queue_len - base, REMOTE_ACCESS_VECTOR_MAX);
+		const adiv5_transfer_s *const transfers = dp->queue + base;
+		int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_ACCESS_VECTOR_STR, dp->dp_jd_index, (unsigned)count);
+		size_t reads = 0;
+		for (size_t i = 0; i < count; ++i) {
+			s += snprintf(construct + s, REMOTE_MAX_MSG_SIZE - s, "%u%04x", transfers[i].RnW ? 1U : 0U,
+				transfers[i].addr);
+			if (transfers[i].RnW)
+				++reads;
+			else
+				s += snprintf(construct + s, REMOTE_MAX_MSG_SIZE - s, "%08" PRIx32, transfers[i].value);
+		}
+		construct[s++] = REMOTE_EOM;
+		platform_buffer_write((uint8_t *)construct, s);
+
+		s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+		if (s < 1 || construct[0] != REMOTE_RESP_OK || (reads && (size_t)s != 1U + reads * 8U)) {
+			if (s > 0 && construct[0] == REMOTE_RESP_ERR)
+				DEBUG_WARN("%s returned REMOTE_RESP_ERR after %" PRIu64 " accesses\n", __func__,
+					remotehston(2, construct + 1));
+			else
+				DEBUG_WARN("%s error %d\n", __func__, s);
+			dp->fault = 1;
+			return false;
+		}
+		uint32_t results[REMOTE_ACCESS_VECTOR_MAX];
+		unhexify(results, construct + 1, reads * 4U);
+		for (size_t i = 0, read = 0; i < count; ++i) {
+			if (!transfers[i].RnW)
+				continue;
+			if (transfers[i].result)
+				*transfers[i].result = results[read];
+			++read;
+		}
+	}
+	return true;
+}
+
+/* Returns the high level protocol version of the probe, 0 if it has none */
+static int remote_hl_version(void)
 {
 	uint8_t construct[REMOTE_MAX_MSG_SIZE];
 	int s = snprintf((char *)construct, REMOTE_MAX_MSG_SIZE, "%s",
 		REMOTE_HL_CHECK_STR);
 	platform_buffer_write(construct, s);
 	s = platform_buffer_read(construct, REMOTE_MAX_MSG_SIZE);
-	if (s < 1 || construct[0] == REMOTE_RESP_ERR ||
-		construct[1] - '0' < REMOTE_HL_VERSION) {
+	if (s < 2 || construct[0] != REMOTE_RESP_OK)
+		return 0;
+	return (int)remotehston(2, (const char *)construct + 1);
+}
+
+void remote_adiv5_dp_defaults(ADIv5_DP_t *dp)
+{
+	/* Firmware from version 2 on works, later versions add faster packets */
+	const int hl_version = remote_hl_version();
+	if (hl_version < 2) {
 		DEBUG_WARN("Please update BMP firmware for substantial speed increase!\n");
 		return;
 	}
@@ -391,8 +686,19 @@ void remote_adiv5_dp_defaults(ADIv5_DP_t *dp)
 	dp->dp_read    = remote_adiv5_dp_read;
 	dp->ap_write   = remote_adiv5_ap_write;
 	dp->ap_read    = remote_adiv5_ap_read;
-	dp->mem_read   = remote_ap_mem_read;
-	dp->mem_write_sized = remote_ap_mem_write_sized;
+	remote_posting = hl_version >= 7;
+	if (hl_version >= 5)
+		dp->queue_flush = remote_adiv5_queue_flush;
+	if (hl_version >= 4) {
+		dp->mem_read   = remote_ap_mem_read_block;
+		dp->mem_write_sized = remote_ap_mem_write_block;
+	} else if (hl_version >= 3) {
+		dp->mem_read   = remote_ap_mem_read_bin;
+		dp->mem_write_sized = remote_ap_mem_write_bin;
+	} else {
+		dp->mem_read   = remote_ap_mem_read;
+		dp->mem_write_sized = remote_ap_mem_write_sized;
+	}
 }
 
 void remote_add_jtag_dev(uint32_t i, const jtag_dev_t *jtag_dev)
@@ -411,3 +717,321 @@ void remote_add_jtag_dev(uint32_t i, const jtag_dev_t *jtag_dev)
 	s = platform_buffer_read(construct, REMOTE_MAX_MSG_SIZE);
 	/* No check for error here. Done in remote_adiv5_dp_defaults!*/
 }
+
+/* Whether the probe takes compressed flash writes, learnt with the offload check */
+static bool remote_flash_lz;
+
+#ifdef ENABLE_RTT
+/* Channel data the probe sent unasked, as records of channel, 16 bit length and data */
+#define REMOTE_RTT_RX_SIZE 16384U
+
+/* What the probe polls with, set from the host's own RTT settings */
+typedef struct remote_rtt_config {
+	size_t target;
+	uint32_t cbaddr;
+	uint32_t ram_start;
+	uint32_t ram_end;
+	uint32_t min_poll_ms;
+	uint32_t max_poll_ms;
+	uint32_t max_poll_errs;
+	uint32_t channels;
+	char ident[sizeof(rtt_ident)];
+} remote_rtt_config_s;
+
+static struct {
+	bool checked;
+	bool supported;
+	bool active;
+	bool lost;
+	remote_rtt_config_s config;
+	uint32_t down_channels;
+	size_t rx_used;
+	uint8_t rx[REMOTE_RTT_RX_SIZE];
+} remote_rtt;
+#endif
+
+bool remote_flash_offload_supported(void)
+{
+	const int hl_version = remote_hl_version();
+	remote_flash_lz = hl_version >= 9;
+	return hl_version >= 6;
+}
+
+/* Wait for the reply to a target packet, which may take a whole flash operation */
+static bool remote_target_reply(char *construct, uint32_t *result)
+{
+	const unsigned saved_timeout = cortexm_wait_timeout;
+	cortexm_wait_timeout = REMOTE_FLASH_TIMEOUT_MS;
+	const int s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	cortexm_wait_timeout = saved_timeout;
+	if (s < 1 || construct[0] != REMOTE_RESP_OK) {
+		DEBUG_WARN("Probe side target operation failed: %d\n", s);
+		return false;
+	}
+	if (result)
+		*result = remotehston(8, construct + 1);
+	return true;
+}
+
+uint32_t remote_target_scan(const bool jtag, const uint32_t targetid)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_TARGET_SCAN_STR, jtag ? 'j' : 's', targetid);
+	platform_buffer_write((uint8_t *)construct, s);
+	uint32_t num_targets = 0;
+	if (!remote_target_reply(construct, &num_targets))
+		return 0;
+	return num_targets;
+}
+
+bool remote_target_attach(const size_t n)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_TARGET_ATTACH_STR, (unsigned)n);
+	platform_buffer_write((uint8_t *)construct, s);
+	return remote_target_reply(construct, NULL);
+}
+
+void remote_target_detach(const bool reset)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_TARGET_DETACH_STR, reset ? '1' : '0');
+	platform_buffer_write((uint8_t *)construct, s);
+	remote_target_reply(construct, NULL);
+}
+
+bool remote_flash_erase(const uint32_t addr, const size_t len)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_FLASH_ERASE_STR, addr, (uint32_t)len);
+	platform_buffer_write((uint8_t *)construct, s);
+	return remote_target_reply(construct, NULL);
+}
+
+/* Send a write compressed if that saves at least an eighth, false if it went uncompressed */
+static bool remote_flash_write_lz(const uint32_t addr, const void *src, const size_t len, bool *const ok)
+{
+	if (!remote_flash_lz || len < LZ_WINDOW_SIZE)
+		return false;
+	uint8_t *const data = malloc(LZ_ENCODE_BOUND(len));
+	if (!data)
+		return false;
+	const size_t count = lz_encode(data, src, len);
+	if (count > len - len / 8U) {
+		free(data);
+		return false;
+	}
+	DEBUG_INFO("Compressed %zu bytes at 0x%08" PRIx32 " to %zu\n", len, addr, count);
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_FLASH_WRITE_LZ_STR, addr, (uint32_t)len, (uint32_t)count);
+	platform_buffer_write((uint8_t *)construct, s);
+	remote_send_frames(data, count);
+	free(data);
+	*ok = remote_target_reply(construct, NULL);
+	return true;
+}
+
+bool remote_flash_write(const uint32_t addr, const void *src, const size_t len)
+{
+	bool ok = false;
+	if (remote_flash_write_lz(addr, src, len, &ok))
+		return ok;
+	char construct[REMOTE_MAX_MSG_SIZE];
+	int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_FLASH_WRITE_STR, addr, (uint32_t)len);
+	platform_buffer_write((uint8_t *)construct, s);
+	remote_send_frames(src, len);
+	/* Acknowledged once the probe has programmed the last frame */
+	return remote_target_reply(construct, NULL);
+}
+
+bool remote_flash_done(void)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, "%s", REMOTE_FLASH_DONE_STR);
+	platform_buffer_write((uint8_t *)construct, s);
+	return remote_target_reply(construct, NULL);
+}
+
+#ifdef ENABLE_RTT
+static void remote_rtt_queue(const uint32_t channel, const uint8_t *const data, const size_t len)
+{
+	if (channel >= MAX_RTT_CHAN)
+		return;
+	if (remote_rtt.rx_used + 3U + len > REMOTE_RTT_RX_SIZE) {
+		rtt_stats[channel].dropped += len;
+		return;
+	}
+	uint8_t *const record = remote_rtt.rx + remote_rtt.rx_used;
+	record[0] = channel;
+	record[1] = len & 0xffU;
+	record[2] = len >> 8U;
+	memcpy(record + 3U, data, len);
+	remote_rtt.rx_used += 3U + len;
+}
+
+void remote_notify(const uint8_t *const data, const size_t len)
+{
+	switch (data[0]) {
+	case REMOTE_NOTIFY_RTT:
+		if (len >= 3U)
+			remote_rtt_queue(remotehston(2, (const char *)data + 1), data + 3, len - 3U);
+		break;
+	case REMOTE_NOTIFY_RTT_LAYOUT:
+		remote_rtt.down_channels = remotehston(8, (const char *)data + 1);
+		break;
+	case REMOTE_NOTIFY_RTT_LOST:
+		remote_rtt.lost = true;
+		break;
+	default:
+		DEBUG_WARN("Unknown notification from the probe: %c\n", data[0]);
+		break;
+	}
+}
+
+/* Hand the queued channel data on, the way print_rtt() would have */
+static void remote_rtt_deliver(void)
+{
+	for (size_t pos = 0; pos < remote_rtt.rx_used;) {
+		const uint8_t *const record = remote_rtt.rx + pos;
+		const uint32_t channel = record[0];
+		const size_t len = record[1] | (record[2] << 8U);
+		for (size_t done = 0; done < len;) {
+			uint32_t room;
+			char *const buf = rtt_up_reserve(channel, &room);
+			if (!buf || !room) {
+				rtt_stats[channel].dropped += len - done;
+				break;
+			}
+			const uint32_t chunk = MIN(room, len - done);
+			memcpy(buf, record + 3U + done, chunk);
+			const uint32_t sent = rtt_up_commit(channel, chunk);
+			rtt_stats[channel].bytes += chunk;
+			rtt_stats[channel].dropped += chunk - sent;
+			done += chunk;
+		}
+		pos += 3U + len;
+	}
+	remote_rtt.rx_used = 0;
+}
+
+/* Host input for the target, each input channel the probe found read as read_rtt() would */
+static void remote_rtt_down(void)
+{
+	for (uint32_t i = 0; i < MAX_RTT_CHAN; ++i) {
+		if (!(remote_rtt.down_channels & (1U << i)) || rtt_nodata(i))
+			continue;
+		char data[REMOTE_RTT_DOWN_MAX];
+		uint32_t len = 0;
+		int32_t c;
+		while (len < sizeof(data) && (c = rtt_getchar(i)) != -1)
+			data[len++] = (char)c;
+		if (!len)
+			continue;
+		char hex[REMOTE_RTT_DOWN_MAX * 2U + 1U];
+		hexify(hex, data, len);
+		char construct[REMOTE_MAX_MSG_SIZE];
+		const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_RTT_DOWN_STR, hex);
+		platform_buffer_write((uint8_t *)construct, s);
+		uint32_t taken = 0;
+		remote_target_reply(construct, &taken);
+		rtt_stats[i].bytes += taken;
+		rtt_stats[i].dropped += len - taken;
+	}
+}
+
+static void remote_rtt_config_get(remote_rtt_config_s *const config, const size_t place)
+{
+	memset(config, 0, sizeof(*config));
+	config->target = place;
+	config->cbaddr = rtt_cbaddr;
+	config->ram_start = rtt_ram_start;
+	config->ram_end = rtt_ram_end;
+	config->min_poll_ms = rtt_min_poll_ms;
+	config->max_poll_ms = rtt_max_poll_ms;
+	config->max_poll_errs = rtt_max_poll_errs;
+	for (uint32_t i = 0; !rtt_auto_channel && i < MAX_RTT_CHAN; ++i) {
+		if (rtt_channel[i].is_enabled)
+			config->channels |= 1U << i;
+	}
+	memcpy(config->ident, rtt_ident, sizeof(config->ident));
+}
+
+/* Scan on the probe as the host did, then have it poll the same target */
+static bool remote_rtt_start(const remote_rtt_config_s *const config, const bool jtag, const uint32_t targetid)
+{
+	if (!remote_target_scan(jtag, targetid))
+		return false;
+	char ident[sizeof(config->ident) * 2U + 1U];
+	hexify(ident, config->ident, strnlen(config->ident, sizeof(config->ident) - 1U));
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const uint32_t cbaddr = config->cbaddr;
+	const uint32_t ram_start = config->ram_start;
+	const uint32_t ram_end = config->ram_end;
+	const uint32_t min_poll = config->min_poll_ms;
+	const uint32_t max_poll = config->max_poll_ms;
+	const uint32_t max_errs = config->max_poll_errs;
+	const uint32_t channels = config->channels;
+	const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_RTT_START_STR, (unsigned)config->target, cbaddr,
+		ram_start, ram_end, min_poll, max_poll, max_errs, channels, ident);
+	platform_buffer_write((uint8_t *)construct, s);
+	if (!remote_target_reply(construct, NULL))
+		return false;
+	remote_rtt.config = *config;
+	remote_rtt.down_channels = 0;
+	remote_rtt.lost = false;
+	remote_rtt.active = true;
+	return true;
+}
+
+bool remote_rtt_poll(target *const t, const bool jtag, const uint32_t targetid)
+{
+	if (!remote_rtt.checked) {
+		remote_rtt.checked = true;
+		remote_rtt.supported = remote_hl_version() >= 10;
+		if (remote_rtt.supported)
+			DEBUG_INFO("RTT is polled by the probe\n");
+	}
+	if (!remote_rtt.supported || !t->core || t->core[0] != 'M')
+		return false;
+	/* The probe scans the same chain, so the target has the same place in its list */
+	size_t place = 1;
+	for (const target *other = target_list; other && other != t; other = other->next)
+		++place;
+	remote_rtt_config_s config;
+	remote_rtt_config_get(&config, place);
+	if (!remote_rtt.active || memcmp(&config, &remote_rtt.config, sizeof(config))) {
+		if (!remote_rtt_start(&config, jtag, targetid)) {
+			DEBUG_WARN("The probe can not poll RTT, polling it from here\n");
+			remote_rtt.supported = false;
+			return false;
+		}
+	}
+	remote_rtt_deliver();
+	if (remote_rtt.lost) {
+		DEBUG_WARN("rtt lost\n");
+		remote_rtt.active = false;
+		rtt_enabled = false;
+		return true;
+	}
+	remote_rtt_down();
+	/* The probe polls until the next packet, which can as well be posted */
+	char construct[REMOTE_MAX_MSG_SIZE];
+	if (remote_posting) {
+		const int s = snprintf(construct + 3, REMOTE_MAX_MSG_SIZE - 3, "%s", REMOTE_RTT_ARM_STR);
+		remote_post(NULL, construct, s);
+	} else {
+		const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, "%s", REMOTE_RTT_ARM_STR);
+		platform_buffer_write((uint8_t *)construct, s);
+		remote_target_reply(construct, NULL);
+	}
+	/* Polling moves SELECT, CSW and TAR about, nothing the host knew of them holds after */
+	adiv5_shadow_invalidate(cortexm_ap(t)->dp);
+	return true;
+}
+#else
+void remote_notify(const uint8_t *const data, const size_t len)
+{
+	(void)len;
+	DEBUG_WARN("Unknown notification from the probe: %c\n", data[0]);
+}
+#endif
@@ -26,9 +26,15 @@
 #include "target_internal.h"
 
 #define REMOTE_MAX_MSG_SIZE (1024)
+/* Reply timeout for probe side flash operations, a mass erase can take a while */
+#define REMOTE_FLASH_TIMEOUT_MS 60000U
+/* Posted commands whose replies may be outstanding at once */
+#define REMOTE_POSTED_MAX 8U
 
 int platform_buffer_write(const uint8_t *data, int size);
 int platform_buffer_read(uint8_t *data, int size);
+void remote_posted_drain(void);
+void remote_send_frames(const uint8_t *data, size_t len);
 
 int remote_init(void);
 int remote_swdptap_init(ADIv5_DP_t *dp);
@@ -45,4 +51,20 @@ void remote_target_clk_output_enable(bool enable);
 void remote_adiv5_dp_defaults(ADIv5_DP_t *dp);
 void remote_add_jtag_dev(uint32_t i, const jtag_dev_t *jtag_dev);
 
+/* Flash operations run by the probe on a target it scanned itself */
+bool remote_flash_offload_supported(void);
+uint32_t remote_target_scan(bool jtag, uint32_t targetid);
+bool remote_target_attach(size_t n);
+void remote_target_detach(bool reset);
+bool remote_flash_erase(uint32_t addr, size_t len);
+bool remote_flash_write(uint32_t addr, const void *src, size_t len);
+bool remote_flash_done(void);
+
+/* A notification the probe sent unasked, taken out of the stream while waiting for a reply */
+void remote_notify(const uint8_t *data, size_t len);
+#ifdef ENABLE_RTT
+/* Arm RTT polling by the probe on t, after forwarding what it sent since the last call */
+bool remote_rtt_poll(target *t, bool jtag, uint32_t targetid);
+#endif
+
 #endif /* PLATFORMS_HOSTED_BMP_REMOTE_H */
@@ -33,9 +33,20 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "command.h"
+#include "crc32.h"
+#include "image.h"
+#include "bench.h"
+#include "json_events.h"
+#include "flash_cache.h"
+#ifdef ENABLE_RTT
+#include "rtt.h"
+#include "rtt_if.h"
+#include "exception.h"
+#endif
 
 #include "cli.h"
 #include "bmp_hosted.h"
+#include "bmp_remote.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -44,6 +55,7 @@
 # include <windows.h>
 #else
 # include <sys/mman.h>
+# include <sys/wait.h>
 #endif
 
 static void cl_target_printf(struct target_controller *tc,
@@ -70,6 +82,7 @@ struct mmap_data {
 };
 int cl_debuglevel;
 static struct mmap_data map; /* Portable way way to nullify the struct!*/
+static image_s image;
 
 
 static int bmp_mmap(char *file, struct mmap_data *map)
@@ -128,32 +141,148 @@ static void bmp_munmap(struct mmap_data *map)
 #endif
 }
 
+/* Create the file at its final size and map it for writing, without reserving the holes of a sparse one */
+static int bmp_mmap_out(const char *file, size_t size, bool sparse, struct mmap_data *map)
+{
+	map->size = size;
+#if defined(_WIN32) || defined(__CYGWIN__)
+	(void)sparse;
+	map->hFile = CreateFile(file, GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ,
+							NULL, CREATE_ALWAYS, 0, NULL);
+	if (map->hFile == INVALID_HANDLE_VALUE) {
+		DEBUG_WARN("Open file %s failed: %lu\n", file, GetLastError());
+		return -1;
+	}
+	map->hMapFile = CreateFileMapping(map->hFile, NULL, PAGE_READWRITE,
+		(DWORD)((uint64_t)size >> 32U), (DWORD)size, NULL);
+	if (map->hMapFile == NULL || map->hMapFile == INVALID_HANDLE_VALUE) {
+		DEBUG_WARN("Map file %s failed: %lu\n", file, GetLastError());
+		CloseHandle(map->hFile);
+		return -1;
+	}
+	map->data = MapViewOfFile(map->hMapFile, FILE_MAP_WRITE, 0, 0, 0);
+	if (!map->data) {
+		DEBUG_WARN("Map file %s failed: %lu\n", file, GetLastError());
+		CloseHandle(map->hMapFile);
+		CloseHandle(map->hFile);
+		return -1;
+	}
+#else
+	map->fd = open(file, O_TRUNC | O_CREAT | O_RDWR | O_BINARY, S_IRUSR | S_IWUSR);
+	if (map->fd < 0) {
+		DEBUG_WARN("Open file %s failed: %s\n", file, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(map->fd, size)) {
+		DEBUG_WARN("Can not size file %s: %s\n", file, strerror(errno));
+		close(map->fd);
+		return -1;
+	}
+#if defined(__linux__)
+	/* Rather fail now than on a page fault when the disk fills up half way */
+	const int res = sparse ? 0 : posix_fallocate(map->fd, 0, size);
+	if (res && res != EOPNOTSUPP && res != EINVAL) {
+		DEBUG_WARN("Can not allocate %zu bytes for %s: %s\n", size, file, strerror(res));
+		close(map->fd);
+		return -1;
+	}
+#else
+	(void)sparse;
+#endif
+	map->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+	if (map->data == MAP_FAILED) {
+		DEBUG_WARN("Map file %s failed: %s\n", file, strerror(errno));
+		map->data = NULL;
+		close(map->fd);
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+/* Start writing back what was stored to the mapping, while the next part is read */
+static void bmp_mmap_flush_async(struct mmap_data *map, size_t offset, size_t len)
+{
+#if defined(_WIN32) || defined(__CYGWIN__)
+	FlushViewOfFile((uint8_t *)map->data + offset, len);
+#else
+	/* msync wants a page aligned start */
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t start = offset & ~(page - 1U);
+	msync((uint8_t *)map->data + start, offset + len - start, MS_ASYNC);
+#endif
+}
+
+/* Unmap and close the file, cutting it to the length actually stored */
+static void bmp_munmap_out(struct mmap_data *map, size_t length)
+{
+#if defined(_WIN32) || defined(__CYGWIN__)
+	UnmapViewOfFile(map->data);
+	CloseHandle(map->hMapFile);
+	if (length < map->size) {
+		LARGE_INTEGER end;
+		end.QuadPart = length;
+		SetFilePointerEx(map->hFile, end, NULL, FILE_BEGIN);
+		SetEndOfFile(map->hFile);
+	}
+	CloseHandle(map->hFile);
+#else
+	munmap(map->data, map->size);
+	if (length < map->size && ftruncate(map->fd, length))
+		DEBUG_WARN("Can not cut file to %zu bytes: %s\n", length, strerror(errno));
+	close(map->fd);
+#endif
+	map->data = NULL;
+	map->size = 0;
+}
+
 static void cl_help(char **argv)
 {
 	bmp_ident(NULL);
 	PRINT_INFO(
 		"\n"
-		"Usage: %s [-h | -l | [-vBITMASK] [-d PATH | -P NUMBER | -s SERIAL | -c TYPE]\n"
-		"\t[-n NUMBER] [-j | -A] [-C] [-t | -T] [-e] [-p] [-R[h]] [-H] [-M STRING ...]\n"
-		"\t[-f | -m] [-E | -w | -V | -r] [-a ADDR] [-S number] [file]]\n"
+		"Usage: %s [-h | -l | [-vBITMASK] [-W FILE] [-J] [-d PATH | -P NUMBER | -s SERIAL | -c TYPE | -G SERIALS | -k US]\n"
+		"\t[-n NUMBER] [-j | -A] [-C] [-t | -T] [-e] [-p] [-R[h]] [-H] [-L] [-u PORT] [-M STRING ...]\n"
+		"\t[-f | -m] [-E | -w | -V | -r | -x ADDR:LEN [-z]] [-a ADDR] [-S number] [-D | -K] [file]]\n"
 		"\n"
 		"The default is to start a debug server at localhost:2000\n\n"
-		"Single-shot and verbosity options [-h | -l | -vBITMASK]:\n"
+		"Single-shot and verbosity options [-h | -l | -vBITMASK | -W FILE | -J]:\n"
 		"\t-h, --help       Show the version and this help, then exit\n"
 		"\t-l, --list       List available supported probes\n"
 		"\t-v, --verbose    Set the output verbosity level based on some combination of:\n"
 		"\t                   1 = INFO, 2 = GDB, 4 = TARGET, 8 = PROBE, 16 = WIRE\n"
+		"\t-W, --wire-trace Record every USB transfer, remote and DAP command and GDB\n"
+		"\t                   packet with a timestamp, and write them to FILE on exit\n"
+		"\t                   or SIGUSR1, for scripts/wire_trace.py to analyse\n"
+		"\t-J, --json       Report progress and timing of the run as one JSON object\n"
+		"\t                   per line on stdout, all other output goes to stderr\n"
+		"\t-i, --stdio      Serve GDB on stdin and stdout instead of TCP, all other\n"
+		"\t                   output goes to stderr: target remote | blackmagic -i\n"
 		"\n"
-		"Probe selection arguments [-d PATH | -P NUMBER | -s SERIAL | -c TYPE]:\n"
+		"Probe selection arguments [-d PATH | -P NUMBER | -s SERIAL | -c TYPE | -k US]:\n"
 		"\t-d, --device     Use a serial device at the given path\n"
 		"\t-P, --probe      Use the <number>th debug probe found while scanning the\n"
 		"\t                   system, see the output from list for the order\n"
 		"\t-s, --serial     Select the debug probe with the given serial number\n"
 		"\t-c, --ftdi-type  Select the FTDI-based debug probe with of the given\n"
 		"\t                   type (cable)\n"
+		"\t-G, --gang       Run the operation on each probe of a comma separated list\n"
+		"\t                   of (partial) serial numbers at once, then report pass/fail\n"
+		"\t-Q, --station    Run until stopped, starting a worker for each probe as it\n"
+		"\t                   is plugged in (only those matching -s if given), which\n"
+		"\t                   runs the operation each time a target gets powered\n"
+		"\t-N, --all-targets Write the image to every target of the scan chain or\n"
+		"\t                   multi-drop bus with the driver of the selected one,\n"
+		"\t                   interleaved so their controllers program at once\n"
+		"\t-X, --client     Hand the operation to a blackmagic already running as GDB\n"
+		"\t                   server on the given local port, reusing its open probe\n"
+		"\t                   and scanned targets\n"
+		"\t-k, --mock       Use a simulated probe and Cortex-M instead of hardware,\n"
+		"\t                   taking US microseconds per probe round trip, and print\n"
+		"\t                   the round trips made on exit\n"
 		"\n"
 		"General configuration options: [-n NUMBER] [-j] [-C] [-t | -T] [-e] [-p] [-R[h]]\n"
-		"\t\t[-H] [-M STRING ...]\n"
+		"\t\t[-H] [-L] [-u PORT] [-M STRING ...]\n"
 		"\t-n, --number     Select the target device at the given position in the\n"
 		"\t                   scan chain (use the -t option to get a scan chain listing)\n"
 		"\t-j, --jtag       Use JTAG instead of SWD\n"
@@ -165,34 +294,62 @@ static void cl_help(char **argv)
 		"\t                   conected devices\n"
 		"\t-T, --timing     Perform continues read- or write-back of a value to allow\n"
 		"\t                   measurement of protocol timing. Aborted by ^C\n"
+		"\t-b, --bench      Benchmark the probe and link across SWJ frequencies,\n"
+		"\t                   printing CSV. Flash rates are measured on the block\n"
+		"\t                   at -a, which is left erased\n"
+		"\t-B, --bench-code Benchmark the host side packet, hex, CRC, Flash buffering\n"
+		"\t                   and RTT search code of this build, printing CSV, no\n"
+		"\t                   probe needed\n"
 		"\t-e, --ext-res    Assume external resistors for FTDI devices, that is having the\n"
 		"\t                   FTDI chip connected through resistors to TMS, TDI and TDO\n"
 		"\t-p, --power      Power the target from the probe (if possible)\n"
 		"\t-R, --reset      Reset the device. If followed by 'h', this will be done using\n"
 		"\t                   the hardware reset line instead of over the debug link\n"
-		"\t-H, --high-level Do not use the high level command API (bmp-remote)\n"
+		"\t-H, --high-level Do not use the high level command API (bmp-remote), nor\n"
+		"\t                   the transfer queue of the simulated probe\n"
+		"\t-L, --low-latency Put the serial port of a BMP into low latency mode (Linux)\n"
+		"\t-u, --rtt-port   Serve RTT channel n on localhost TCP port PORT + n instead\n"
+		"\t                   of the terminal (ENABLE_RTT builds, not on Windows)\n"
+		"\t-O, --swo-out    Write the trace of 'monitor traceswo' to FILE, or serve it\n"
+		"\t                   on localhost TCP port PORT if a number is given\n"
 		"\t-M, --monitor    Run target-specific monitor commands. This option\n"
 		"\t                   can be repeated for as many commands you wish to run.\n"
 		"\t                   If the command contains spaces, use quotes around the\n"
 		"\t                   complete command\n"
 		"\n"
 		"SWD-specific configuration options [-f FREQUENCY | -m TARGET]:\n"
-		"\t-f, --freq       Set an operating frequency for SWD\n"
+		"\t-f, --freq       Set an operating frequency for SWD, or \"auto\" to use\n"
+		"\t                   the highest that proves reliable on the target, less margin,\n"
+		"\t                   or \"rtck\" for adaptive clocking on FTDI cables wiring RTCK\n"
 		"\t-m, --mult-drop  Use the given target ID for selection in SWD multi-drop\n"
 		"\n"
 		"Flash operation selection options [-E | -w | -V | -r]:\n"
 		"\t-E, --erase      Erase the target device Flash\n"
-		"\t-w, --write      Write the specified binary file to the target device\n"
-		"\t                   Flash (the default)\n"
+		"\t-w, --write      Write the specified binary, ELF or Intel HEX file to the\n"
+		"\t                   target device Flash (the default)\n"
 		"\t-V, --verify     Verify the target device Flash against the specified\n"
-		"\t                   binary file\n"
+		"\t                   binary, ELF or Intel HEX file\n"
 		"\t-r, --read       Read the target device Flash\n"
+		"\t-x, --dump       Dump LEN bytes of any memory from ADDR, RAM or Flash, to\n"
+		"\t                   the file, e.g. -x 0xc0000000:32M\n"
+		"\t-z, --sparse     With --dump, leave the blocks found zero as holes in the\n"
+		"\t                   file and blocks found erased (0xff) unread, using the\n"
+		"\t                   target CRC routine to tell\n"
+		"\t-g, --run        Load the RAM segments of the ELF file and run it from its\n"
+		"\t                   vector table or entry point, Flash is not touched\n"
+		"\t-Y, --rtt        With --run, print the RTT output of the image until ^C,\n"
+		"\t                   the control block taken from its _SEGGER_RTT symbol\n"
 		"\n"
-		"Flash operation modifiers options: [-a ADDR] [-S number] [FILE]\n"
+		"Flash operation modifiers options: [-a ADDR] [-S number] [-D | -K] [FILE]\n"
 		"\t-a, --addr       Start address for the given Flash operation (defaults to\n"
 		"\t                   the start of Flash)\n"
 		"\t-S, --byte-count Number of bytes to work on in the Flash operation (default\n"
 		"\t                   is till the operation fails or is complete)\n"
+		"\t-D, --diff       Only erase and write the Flash sectors whose contents differ\n"
+		"\t                   from the file\n"
+		"\t-K, --flash-cache Flash differentially, remembering what was written per\n"
+		"\t                   device unique ID so unchanged sectors are not even read\n"
+		"\t                   back next time, see $BMP_FLASH_CACHE_DIR\n"
 		"\t<file>           Binary file to use in Flash operations\n",
 		argv[0]
 	);
@@ -206,6 +363,11 @@ static const struct option long_options[] = {
 	{"device", required_argument, NULL, 'd'},
 	{"probe", required_argument, NULL, 'P'},
 	{"serial", required_argument, NULL, 's'},
+	{"gang", required_argument, NULL, 'G'},
+	{"station", no_argument, NULL, 'Q'},
+	{"all-targets", no_argument, NULL, 'N'},
+	{"client", required_argument, NULL, 'X'},
+	{"mock", required_argument, NULL, 'k'},
 	{"ftdi-type", required_argument, NULL, 'c'},
 	{"fast-poll", no_argument, NULL, 'F'},
 	{"number", required_argument, NULL, 'n'},
@@ -214,10 +376,18 @@ static const struct option long_options[] = {
 	{"hw-reset", no_argument, NULL, 'C'},
 	{"list-chain", no_argument, NULL, 't'},
 	{"timing", no_argument, NULL, 'T'},
+	{"bench", no_argument, NULL, 'b'},
+	{"bench-code", no_argument, NULL, 'B'},
 	{"ext-res", no_argument, NULL, 'e'},
 	{"power", no_argument, NULL, 'p'},
 	{"reset", optional_argument, NULL, 'R'},
 	{"high-level", no_argument, NULL, 'H'},
+	{"low-latency", no_argument, NULL, 'L'},
+	{"rtt-port", required_argument, NULL, 'u'},
+	{"swo-out", required_argument, NULL, 'O'},
+	{"wire-trace", required_argument, NULL, 'W'},
+	{"json", no_argument, NULL, 'J'},
+	{"stdio", no_argument, NULL, 'i'},
 	{"monitor", required_argument, NULL, 'M'},
 	{"freq", required_argument, NULL, 'f'},
 	{"multi-drop", required_argument, NULL, 'm'},
@@ -225,21 +395,51 @@ static const struct option long_options[] = {
 	{"write", no_argument, NULL, 'W'},
 	{"verify", no_argument, NULL, 'V'},
 	{"read", no_argument, NULL, 'r'},
+	{"dump", required_argument, NULL, 'x'},
+	{"sparse", no_argument, NULL, 'z'},
+	{"run", no_argument, NULL, 'g'},
+	{"rtt", no_argument, NULL, 'Y'},
 	{"addr", required_argument, NULL, 'a'},
 	{"byte-count", required_argument, NULL, 'S'},
+	{"diff", no_argument, NULL, 'D'},
+	{"flash-cache", no_argument, NULL, 'K'},
 	{NULL, 0, NULL, 0}
 } ;
 
-void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
+void cl_defaults(BMP_CL_OPTIONS_t *opt)
 {
-	int c;
 	opt->opt_target_dev = 1;
 	opt->opt_flash_size = 0xffffffff;
 	opt->opt_flash_start = 0xffffffff;
 	opt->opt_max_swj_frequency = 4000000;
 	opt->opt_scanmode = BMP_SCAN_SWD;
 	opt->opt_mode = BMP_MODE_DEBUG;
-	while((c = getopt_long(argc, argv, "eEFhHv:d:f:s:I:c:Cln:m:M:wVtTa:S:jApP:rR::", long_options, NULL)) != -1) {
+}
+
+/* A byte count, with an optional k or M suffix */
+static size_t cl_parse_size(const char *arg, char **endptr)
+{
+	size_t size = strtoul(arg, endptr, 0);
+	switch ((*endptr)[0]) {
+	case 'k':
+	case 'K':
+		size *= 1024;
+		++*endptr;
+		break;
+	case 'm':
+	case 'M':
+		size *= 1024 * 1024;
+		++*endptr;
+		break;
+	}
+	return size;
+}
+
+void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
+{
+	int c;
+	cl_defaults(opt);
+	while((c = getopt_long(argc, argv, "bBeEFhHiJLu:O:W:v:d:f:s:G:QX:k:I:c:Cln:m:M:wVtTa:S:DjApP:rR::x:zKgYN", long_options, NULL)) != -1) {
 		switch(c) {
 		case 'c':
 			if (optarg)
@@ -279,8 +479,15 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 		case 'F':
 			opt->fast_poll = true;
 			break;
+		case 'L':
+			opt->opt_low_latency = true;
+			break;
 		case 'f':
-			if (optarg) {
+			if (optarg && !strcmp(optarg, "auto"))
+				opt->opt_frequency_auto = true;
+			else if (optarg && !strcmp(optarg, "rtck"))
+				opt->opt_rtck = true;
+			else if (optarg) {
 				char *p;
 				uint32_t frequency = strtol(optarg, &p, 10);
 				switch(*p) {
@@ -298,6 +505,23 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 			if (optarg)
 				opt->opt_serial = optarg;
 			break;
+		case 'G':
+			if (optarg)
+				opt->opt_gang = optarg;
+			break;
+		case 'Q':
+			opt->opt_station = true;
+			break;
+		case 'X':
+			if (optarg)
+				opt->opt_client_port = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			if (optarg) {
+				opt->opt_mock = true;
+				opt->opt_mock_latency_us = strtoul(optarg, NULL, 0);
+			}
+			break;
 		case 'I':
 			if (optarg)
 				opt->opt_ident_string = optarg;
@@ -312,6 +536,12 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 		case 'T':
 			opt->opt_mode = BMP_MODE_SWJ_TEST;
 			break;
+		case 'b':
+			opt->opt_mode = BMP_MODE_BENCH;
+			break;
+		case 'B':
+			opt->opt_mode = BMP_MODE_BENCH_CODE;
+			break;
 		case 'w':
 			if (opt->opt_mode == BMP_MODE_FLASH_VERIFY)
 				opt->opt_mode = BMP_MODE_FLASH_WRITE_VERIFY;
@@ -336,6 +566,31 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 		case 'p':
 			opt->opt_tpwr = true;
 			break;
+		case 'u':
+			if (optarg)
+				opt->opt_rtt_port = strtoul(optarg, NULL, 0);
+			break;
+		case 'O':
+			if (optarg)
+				opt->opt_swo_out = optarg;
+			break;
+		case 'W':
+			if (optarg)
+				opt->opt_wire_trace = optarg;
+			break;
+		case 'J':
+			opt->opt_json = true;
+			break;
+		case 'i':
+			opt->opt_stdio = true;
+			break;
+		case 'D':
+			opt->opt_flash_diff = true;
+			break;
+		case 'K':
+			flash_cache_enabled = true;
+			opt->opt_flash_diff = true;
+			break;
 		case 'a':
 			if (optarg)
 				opt->opt_flash_start = strtol(optarg, NULL, 0);
@@ -359,20 +614,35 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 		case 'S':
 			if (optarg) {
 				char *endptr;
-				opt->opt_flash_size = strtol(optarg, &endptr, 0);
-				if (endptr) {
-					switch(endptr[0]) {
-					case 'k':
-					case 'K':
-						opt->opt_flash_size *= 1024;
-						break;
-					case 'm':
-					case 'M':
-						opt->opt_flash_size *= 1024 * 1024;
-						break;
-					}
+				opt->opt_flash_size = cl_parse_size(optarg, &endptr);
+			}
+			break;
+		case 'x':
+			if (optarg) {
+				char *endptr;
+				opt->opt_flash_start = strtoul(optarg, &endptr, 0);
+				if (endptr[0] == ':')
+					opt->opt_flash_size = cl_parse_size(endptr + 1, &endptr);
+				if (endptr[0] || !opt->opt_flash_size ||
+					opt->opt_flash_size - 1U > UINT32_MAX - opt->opt_flash_start) {
+					DEBUG_WARN("Dump needs ADDR:LEN within the 32 bit address space, not \"%s\"\n", optarg);
+					exit(-1);
 				}
+				opt->opt_mode = BMP_MODE_DUMP;
 			}
+			break;
+		case 'z':
+			opt->opt_dump_sparse = true;
+			break;
+		case 'g':
+			opt->opt_mode = BMP_MODE_RAM_RUN;
+			break;
+		case 'Y':
+			opt->opt_run_rtt = true;
+			break;
+		case 'N':
+			opt->opt_all_targets = true;
+			break;
 		}
 	}
 	if ((optind) &&  argv[optind]) {
@@ -382,11 +652,26 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 	} else if ((opt->opt_mode == BMP_MODE_DEBUG) &&
 	           (opt->opt_monitor)) {
 		opt->opt_mode = BMP_MODE_MONITOR; // To avoid DEBUG mode
+	} else if (opt->opt_mode == BMP_MODE_DUMP) {
+		DEBUG_WARN("Dump needs a file to write to\n");
+		exit(-1);
+	} else if (opt->opt_mode == BMP_MODE_RAM_RUN) {
+		DEBUG_WARN("Run needs an ELF file to load\n");
+		exit(-1);
 	}
 
 	/* Checks */
+	if (opt->opt_stdio && opt->opt_mode != BMP_MODE_DEBUG) {
+		DEBUG_WARN("Ignoring --stdio, there is no GDB server in this mode\n");
+		opt->opt_stdio = false;
+	}
+	if (opt->opt_stdio && opt->opt_json) {
+		DEBUG_WARN("GDB on stdio and JSON events can not share stdout\n");
+		exit(-1);
+	}
 	if ((opt->opt_flash_file) && ((opt->opt_mode == BMP_MODE_TEST ) ||
 								  (opt->opt_mode == BMP_MODE_SWJ_TEST) ||
+								  (opt->opt_mode == BMP_MODE_BENCH) ||
 								  (opt->opt_mode == BMP_MODE_RESET) ||
 								  (opt->opt_mode == BMP_MODE_RESET_HW))) {
 		DEBUG_WARN("Ignoring filename in reset/test mode\n");
@@ -394,6 +679,272 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 	}
 }
 
+static bool cl_mode_uses_image(const BMP_CL_OPTIONS_t *opt)
+{
+	return opt->opt_mode == BMP_MODE_FLASH_WRITE || opt->opt_mode == BMP_MODE_FLASH_VERIFY ||
+		opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY || opt->opt_mode == BMP_MODE_RAM_RUN;
+}
+
+/*
+ * Gang mode: fork a worker per probe of the list, each of which returns from here to
+ * open its own probe and run the operation as a single probe run would. The image is
+ * mapped before forking so the workers share the one read-only mapping. The parent
+ * waits for all of them and exits with a pass/fail report.
+ */
+void cl_gang(BMP_CL_OPTIONS_t *opt)
+{
+#if defined(_WIN32) || defined(__CYGWIN__)
+	(void)opt;
+	DEBUG_WARN("Gang mode is not available on Windows\n");
+	exit(-1);
+#else
+	if (opt->opt_mode == BMP_MODE_DEBUG) {
+		DEBUG_WARN("Gang mode needs a flash, reset or monitor operation, not a debug server\n");
+		exit(-1);
+	}
+	char *serials[CL_GANG_MAX];
+	size_t count = 0;
+	for (char *serial = strtok(opt->opt_gang, ","); serial; serial = strtok(NULL, ",")) {
+		if (count == CL_GANG_MAX) {
+			DEBUG_WARN("Gang mode handles up to %u probes\n", CL_GANG_MAX);
+			exit(-1);
+		}
+		serials[count++] = serial;
+	}
+	if (!count) {
+		DEBUG_WARN("No probe serial numbers given for gang mode\n");
+		exit(-1);
+	}
+	if (cl_mode_uses_image(opt) && bmp_mmap(opt->opt_flash_file, &map)) {
+		DEBUG_WARN("Can not map file: %s. Aborting!\n", strerror(errno));
+		exit(-1);
+	}
+
+	pid_t workers[CL_GANG_MAX];
+	fflush(stdout);
+	fflush(stderr);
+	for (size_t i = 0; i < count; ++i) {
+		workers[i] = fork();
+		if (workers[i] == 0) {
+			opt->opt_serial = serials[i];
+			opt->opt_gang = NULL;
+			return;
+		}
+		if (workers[i] < 0)
+			DEBUG_WARN("Can not start the worker for probe %s: %s\n", serials[i], strerror(errno));
+	}
+
+	size_t failed = 0;
+	int results[CL_GANG_MAX];
+	for (size_t i = 0; i < count; ++i) {
+		results[i] = -1;
+		int status;
+		if (workers[i] > 0 && waitpid(workers[i], &status, 0) == workers[i] && WIFEXITED(status))
+			results[i] = WEXITSTATUS(status);
+		if (results[i])
+			++failed;
+	}
+	PRINT_INFO("\nGang result: %zu of %zu probes passed\n", count - failed, count);
+	for (size_t i = 0; i < count; ++i)
+		PRINT_INFO("\t%-24s %s\n", serials[i], results[i] ? "FAIL" : "PASS");
+	bmp_munmap(&map);
+	exit(failed ? 1 : 0);
+#endif
+}
+
+#define CL_STATION_POLL_MS   100U
+/* Time for the serial ports of a probe that just arrived to appear, and for a seated target to settle */
+#define CL_STATION_SETTLE_MS 1000U
+#define CL_STATION_DUT_MS    200U
+/* Target voltage that counts as a target seated */
+#define CL_STATION_VOLTAGE_MIN 1.5
+
+#if !defined(_WIN32) && !defined(__CYGWIN__) && HOSTED_BMP_ONLY != 1
+typedef struct cl_station_probe {
+	char serial[64];
+	pid_t worker;
+	uint32_t arrived_ms;
+	bool present;
+	bool failed; /* the worker gave up, wait for the probe to be plugged in again */
+} cl_station_probe_s;
+
+static cl_station_probe_s station_probes[CL_GANG_MAX];
+static const char *station_serial;
+static volatile sig_atomic_t station_stop;
+
+static void cl_station_signal(int sig)
+{
+	(void)sig;
+	station_stop = 1;
+}
+
+static void cl_station_event(const char *const serial, const char *const state)
+{
+	PRINT_INFO("Probe %s %s\n", serial, state);
+	json_events_set_serial(serial);
+	json_event("probe", "\"state\":\"%s\"", state);
+	json_events_set_serial("");
+}
+
+static void cl_station_hotplug(const char *const serial, const bool arrived, void *const ctx)
+{
+	(void)ctx;
+	if (station_serial && !strstr(serial, station_serial))
+		return;
+	cl_station_probe_s *probe = NULL;
+	for (size_t i = 0; i < CL_GANG_MAX && !probe; ++i) {
+		if (station_probes[i].present && !strcmp(station_probes[i].serial, serial))
+			probe = &station_probes[i];
+	}
+	if (!arrived) {
+		if (!probe)
+			return;
+		probe->present = false;
+		if (probe->worker > 0)
+			kill(probe->worker, SIGTERM);
+		cl_station_event(serial, "removed");
+		return;
+	}
+	if (probe)
+		return;
+	for (size_t i = 0; i < CL_GANG_MAX && !probe; ++i) {
+		if (!station_probes[i].present && !station_probes[i].worker)
+			probe = &station_probes[i];
+	}
+	if (!probe) {
+		DEBUG_WARN("Station mode handles up to %u probes, ignoring %s\n", CL_GANG_MAX, serial);
+		return;
+	}
+	strncpy(probe->serial, serial, sizeof(probe->serial) - 1U);
+	probe->arrived_ms = platform_time_ms();
+	probe->present = true;
+	probe->failed = false;
+	cl_station_event(serial, "arrived");
+}
+
+static void cl_station_reap(void)
+{
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (size_t i = 0; i < CL_GANG_MAX; ++i) {
+			cl_station_probe_s *const probe = &station_probes[i];
+			if (probe->worker != pid)
+				continue;
+			probe->worker = 0;
+			/* Workers only end by themselves when they can not use their probe */
+			if (probe->present) {
+				probe->failed = true;
+				cl_station_event(probe->serial, "unusable");
+			}
+		}
+	}
+}
+#endif
+
+/*
+ * Station mode: watch for probes being plugged in and removed, and fork a
+ * worker for each that arrives. Like with gang mode the workers return from
+ * here, each with its own probe selected, to run cl_station_worker(). The
+ * parent runs until SIGINT or SIGTERM, then stops the workers and exits.
+ */
+void cl_station(BMP_CL_OPTIONS_t *opt)
+{
+#if defined(_WIN32) || defined(__CYGWIN__) || HOSTED_BMP_ONLY == 1
+	(void)opt;
+	DEBUG_WARN("Station mode needs fork() and libusb hotplug support, not available in this build\n");
+	exit(-1);
+#else
+	if (opt->opt_mode == BMP_MODE_DEBUG) {
+		DEBUG_WARN("Station mode needs a flash, reset or monitor operation, not a debug server\n");
+		exit(-1);
+	}
+	if (opt->opt_gang) {
+		DEBUG_WARN("Station mode finds its probes itself, it does not take a gang list\n");
+		exit(-1);
+	}
+	if (opt->opt_json && !json_events_init())
+		exit(-1);
+	station_serial = opt->opt_serial;
+	signal(SIGTERM, cl_station_signal);
+	signal(SIGINT, cl_station_signal);
+	if (!bmp_hotplug_start(cl_station_hotplug, NULL))
+		exit(-1);
+	PRINT_INFO("Waiting for probes, stop with ^C\n");
+	while (!station_stop) {
+		bmp_hotplug_poll(CL_STATION_POLL_MS);
+		cl_station_reap();
+		for (size_t i = 0; i < CL_GANG_MAX && !station_stop; ++i) {
+			cl_station_probe_s *const probe = &station_probes[i];
+			if (!probe->present || probe->worker || probe->failed ||
+				platform_time_ms() - probe->arrived_ms < CL_STATION_SETTLE_MS)
+				continue;
+			fflush(stdout);
+			fflush(stderr);
+			probe->worker = fork();
+			if (probe->worker == 0) {
+				signal(SIGTERM, SIG_DFL);
+				signal(SIGINT, SIG_DFL);
+				opt->opt_serial = probe->serial;
+				return;
+			}
+			if (probe->worker < 0) {
+				DEBUG_WARN("Can not start the worker for probe %s: %s\n", probe->serial, strerror(errno));
+				probe->worker = 0;
+				probe->failed = true;
+			}
+		}
+	}
+	for (size_t i = 0; i < CL_GANG_MAX; ++i) {
+		if (station_probes[i].worker > 0)
+			kill(station_probes[i].worker, SIGTERM);
+	}
+	while (wait(NULL) > 0)
+		continue;
+	exit(0);
+#endif
+}
+
+/* The target voltage the probe senses, negative if it can not tell */
+static double cl_station_voltage(void)
+{
+	const char *const voltage = platform_target_voltage();
+	return voltage ? strtod(voltage, NULL) : -1.0;
+}
+
+/*
+ * A station worker runs the operation on each target ("DUT") as it is
+ * seated, which it tells by the target voltage appearing, then waits for it
+ * to be removed again. Each run reports as a single probe run would.
+ */
+int cl_station_worker(BMP_CL_OPTIONS_t *opt)
+{
+	if (cl_station_voltage() < 0.0) {
+		DEBUG_WARN("Station mode needs a probe that senses the target voltage\n");
+		return -1;
+	}
+	/* Each run starts out from the options given, whatever the last one derived from its target */
+	const BMP_CL_OPTIONS_t options = *opt;
+	uint32_t count = 0;
+	uint32_t passed = 0;
+	while (true) {
+		while (cl_station_voltage() < CL_STATION_VOLTAGE_MIN)
+			platform_delay(CL_STATION_POLL_MS);
+		json_event("dut", "\"state\":\"seated\"");
+		platform_delay(CL_STATION_DUT_MS);
+		*opt = options;
+		const int res = cl_execute(opt);
+		++count;
+		if (!res)
+			++passed;
+		PRINT_INFO("Target %" PRIu32 " on %s: %s\n", count, info.serial, res ? "FAIL" : "PASS");
+		fflush(stdout);
+		while (cl_station_voltage() >= CL_STATION_VOLTAGE_MIN)
+			platform_delay(CL_STATION_POLL_MS);
+		json_event("dut", "\"state\":\"removed\",\"count\":%" PRIu32 ",\"passed\":%" PRIu32, count, passed);
+	}
+}
+
 static void display_target(int i, target *t, void *context)
 {
 	(void)context;
@@ -411,10 +962,455 @@ static void display_target(int i, target *t, void *context)
 	}
 }
 
+int cl_scan_targets(const BMP_CL_OPTIONS_t *opt)
+{
+	if (opt->opt_scanmode == BMP_SCAN_JTAG)
+		return platform_jtag_scan(NULL);
+	if (opt->opt_scanmode == BMP_SCAN_SWD)
+		return platform_adiv5_swdp_scan(opt->opt_targetid);
+	int num_targets = platform_jtag_scan(NULL);
+	if (num_targets > 0)
+		return num_targets;
+	DEBUG_INFO("JTAG scan found no devices, trying SWD.\n");
+	num_targets = platform_adiv5_swdp_scan(opt->opt_targetid);
+	if (num_targets > 0)
+		return num_targets;
+	DEBUG_INFO("SW-DP scan failed!\n");
+	return 0;
+}
+
+/* Time spent per phase of a run, for the closing JSON event */
+typedef struct cl_phases {
+	uint32_t scan_ms;
+	uint32_t attach_ms;
+	uint32_t erase_ms;
+	uint32_t write_ms;
+	uint32_t verify_ms;
+} cl_phases_s;
+
+/* Write progress is reported, and the target written, this much at a time */
+#define CL_PROGRESS_CHUNK 0x10000U
+
+static double cl_kib_s(size_t bytes, uint32_t ms)
+{
+	return ms ? bytes / 1.024 / ms : 0.0;
+}
+
+static void cl_json_phase_end(const char *event, bool ok, uint32_t ms, size_t bytes)
+{
+	json_event(event, "\"phase\":\"end\",\"ok\":%s,\"bytes\":%zu,\"ms\":%" PRIu32 ",\"kib_s\":%.3f",
+		ok ? "true" : "false", bytes, ms, cl_kib_s(bytes, ms));
+}
+
+static void cl_json_progress(const char *event, size_t bytes, size_t total, uint32_t start_time)
+{
+	json_event(event, "\"phase\":\"progress\",\"bytes\":%zu,\"total\":%zu,\"kib_s\":%.3f", bytes, total,
+		cl_kib_s(bytes, platform_time_ms() - start_time));
+}
+
+/* Erase every segment of the image, before any is written */
+static bool cl_flash_erase_image(target *t, const image_s *image, cl_phases_s *phases)
+{
+	const uint32_t start_time = platform_time_ms();
+	json_event("erase", "\"phase\":\"start\",\"segments\":%zu,\"total\":%zu", image->count, image->total_size);
+	bool ok = true;
+	for (size_t i = 0; ok && i < image->count; ++i) {
+		const image_segment_s *const seg = &image->segments[i];
+		DEBUG_INFO("Erase    %zu bytes at 0x%08" PRIx32 "\n", seg->size, seg->addr);
+		ok = t ? target_flash_erase(t, seg->addr, seg->size) : remote_flash_erase(seg->addr, seg->size);
+	}
+	phases->erase_ms = platform_time_ms() - start_time;
+	cl_json_phase_end("erase", ok, phases->erase_ms, image->total_size);
+	return ok;
+}
+
+/* Write every segment of the image, CL_PROGRESS_CHUNK at a time */
+static bool cl_flash_write_image(target *t, const image_s *image, cl_phases_s *phases)
+{
+	const uint32_t start_time = platform_time_ms();
+	json_event("write", "\"phase\":\"start\",\"segments\":%zu,\"total\":%zu", image->count, image->total_size);
+	bool ok = true;
+	size_t written = 0;
+	for (size_t i = 0; ok && i < image->count; ++i) {
+		const image_segment_s *const seg = &image->segments[i];
+		DEBUG_INFO("Flashing %zu bytes at 0x%08" PRIx32 "\n", seg->size, seg->addr);
+		/* The probe streams a segment as a whole, the buffered target write takes it in chunks */
+		const size_t chunk = t ? CL_PROGRESS_CHUNK : seg->size;
+		for (size_t offset = 0; ok && offset < seg->size; offset += chunk) {
+			const size_t len = MIN(chunk, seg->size - offset);
+			ok = t ? target_flash_write(t, seg->addr + offset, seg->data + offset, len) :
+					 remote_flash_write(seg->addr + offset, seg->data + offset, len);
+			if (ok) {
+				written += len;
+				cl_json_progress("write", written, image->total_size, start_time);
+			}
+		}
+	}
+	ok = ok && (t ? target_flash_complete(t) : remote_flash_done());
+	phases->write_ms = platform_time_ms() - start_time;
+	cl_json_phase_end("write", ok, phases->write_ms, written);
+	return ok;
+}
+
+/* The unit handed to each target in turn, a write buffer or erase block of its flash */
+static size_t cl_interleave_chunk(target *t, uint32_t addr, bool erase)
+{
+	const target_flash_s *const f = target_flash_for_addr(t, addr);
+	if (!f)
+		return CL_PROGRESS_CHUNK;
+	return erase || !f->writebufsize ? f->blocksize : f->writebufsize;
+}
+
+/*
+ * Erase, write and optionally verify the image on each of count targets, round robin a flash
+ * block at a time. Drivers with a wait routine return as soon as a block is handed over, so
+ * the next target is fed while the previous one programs and the run takes about as long as
+ * the slowest target instead of the sum of all. Erases only overlap on concurrent flashes, the
+ * others block in their erase. A failing target drops out, the rest carry on.
+ */
+static bool cl_flash_interleaved(target **targets, size_t count, bool verify, cl_phases_s *phases)
+{
+	bool ok[CL_ALL_TARGETS_MAX];
+	for (size_t n = 0; n < count; ++n)
+		ok[n] = true;
+	uint32_t start_time = platform_time_ms();
+	json_event("erase", "\"phase\":\"start\",\"segments\":%zu,\"total\":%zu,\"targets\":%zu", image.count,
+		image.total_size, count);
+	for (size_t i = 0; i < image.count; ++i) {
+		const image_segment_s *const seg = &image.segments[i];
+		const size_t chunk = cl_interleave_chunk(targets[0], seg->addr, true);
+		for (size_t offset = 0; offset < seg->size; offset += chunk) {
+			for (size_t n = 0; n < count; ++n)
+				ok[n] = ok[n] && target_flash_erase(targets[n], seg->addr + offset, MIN(chunk, seg->size - offset));
+		}
+	}
+	phases->erase_ms = platform_time_ms() - start_time;
+	cl_json_phase_end("erase", true, phases->erase_ms, image.total_size);
+
+	start_time = platform_time_ms();
+	json_event("write", "\"phase\":\"start\",\"segments\":%zu,\"total\":%zu,\"targets\":%zu", image.count,
+		image.total_size, count);
+	for (size_t i = 0; i < image.count; ++i) {
+		const image_segment_s *const seg = &image.segments[i];
+		const size_t chunk = cl_interleave_chunk(targets[0], seg->addr, false);
+		for (size_t offset = 0; offset < seg->size; offset += chunk) {
+			const size_t len = MIN(chunk, seg->size - offset);
+			for (size_t n = 0; n < count; ++n)
+				ok[n] = ok[n] && target_flash_write(targets[n], seg->addr + offset, seg->data + offset, len);
+		}
+	}
+	for (size_t n = 0; n < count; ++n)
+		ok[n] = target_flash_complete(targets[n]) && ok[n];
+	phases->write_ms = platform_time_ms() - start_time;
+	cl_json_phase_end("write", true, phases->write_ms, image.total_size * count);
+	DEBUG_WARN("Flash Write of %zu bytes to %zu targets took %" PRIu32 " ms, %8.3f kiB/s in total\n",
+		image.total_size, count, phases->write_ms, cl_kib_s(image.total_size * count, phases->erase_ms + phases->write_ms));
+
+	if (verify) {
+		start_time = platform_time_ms();
+		uint8_t *const buffer = malloc(CL_PROGRESS_CHUNK);
+		if (!buffer) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return false;
+		}
+		for (size_t n = 0; n < count; ++n) {
+			for (size_t i = 0; ok[n] && i < image.count; ++i) {
+				const image_segment_s *const seg = &image.segments[i];
+				for (size_t offset = 0; ok[n] && offset < seg->size; offset += CL_PROGRESS_CHUNK) {
+					const size_t len = MIN(CL_PROGRESS_CHUNK, seg->size - offset);
+					ok[n] = !target_mem_read(targets[n], buffer, seg->addr + offset, len) &&
+						!memcmp(buffer, seg->data + offset, len);
+				}
+			}
+		}
+		free(buffer);
+		phases->verify_ms = platform_time_ms() - start_time;
+	}
+
+	bool all_ok = true;
+	for (size_t n = 0; n < count; ++n) {
+		DEBUG_WARN("Target %zu (%s): %s\n", n + 1U, targets[n]->driver, ok[n] ? "pass" : "FAIL");
+		json_event("target", "\"index\":%zu,\"ok\":%s", n + 1U, ok[n] ? "true" : "false");
+		if (ok[n])
+			target_reset(targets[n]);
+		all_ok &= ok[n];
+	}
+	return all_ok;
+}
+
+/* Attach every target with the same driver as t, which comes first, up to CL_ALL_TARGETS_MAX */
+static size_t cl_attach_alike(target *t, bool flash_diff, target **targets)
+{
+	size_t count = 0;
+	targets[count++] = t;
+	for (target *other = target_list; other && count < CL_ALL_TARGETS_MAX; other = other->next) {
+		if (other == t || strcmp(other->driver, t->driver))
+			continue;
+		if (!target_attach(other, &cl_controller)) {
+			DEBUG_WARN("Can not attach to %s, leaving it out\n", other->driver);
+			continue;
+		}
+		targets[count++] = other;
+	}
+	for (size_t n = 0; n < count; ++n)
+		targets[n]->flash_diff = flash_diff;
+	return count;
+}
+
+/* Have the probe erase and program the image itself, only the data crosses the link */
+static bool cl_flash_offload(const BMP_CL_OPTIONS_t *opt, const image_s *image, cl_phases_s *phases)
+{
+	DEBUG_INFO("Programming through the probe\n");
+	if (!remote_target_scan(info.is_jtag, opt->opt_targetid) || !remote_target_attach(opt->opt_target_dev)) {
+		DEBUG_WARN("Probe can not attach to target %d\n", opt->opt_target_dev);
+		return false;
+	}
+	const bool ok = cl_flash_erase_image(NULL, image, phases) && cl_flash_write_image(NULL, image, phases);
+	/* Without a verify pass to follow, the probe resets the target before letting go */
+	remote_target_detach(ok && opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY);
+	return ok;
+}
+
+/* A dump is read this much at a time, as one block transfer where the probe streams them */
+#define CL_DUMP_CHUNK 0x100000U
+/* Sparse dumps look for zero and erased memory per block this big, and for holes per page */
+#define CL_DUMP_BLANK_CHUNK CL_PROGRESS_CHUNK
+#define CL_DUMP_PAGE 0x1000U
+
+/* Fill of the block whose CRC on the target is crc, -1 if it is not all zero or all 0xff */
+static int cl_dump_blank_fill(size_t len, uint32_t crc)
+{
+	static uint8_t blank[CL_DUMP_BLANK_CHUNK];
+	static uint32_t crc_zero;
+	static uint32_t crc_erased;
+	static size_t crc_len;
+	if (len != crc_len) {
+		memset(blank, 0, len);
+		crc_zero = crc32_buffer(0xffffffffU, blank, len);
+		memset(blank, 0xff, len);
+		crc_erased = crc32_buffer(0xffffffffU, blank, len);
+		crc_len = len;
+	}
+	if (crc == crc_zero)
+		return 0;
+	return crc == crc_erased ? 0xff : -1;
+}
+
+/* Store a block read for a sparse dump, skipping the pages that are zero so they stay holes */
+static void cl_dump_store_sparse(uint8_t *dest, const uint8_t *data, size_t len)
+{
+	for (size_t offset = 0; offset < len; offset += CL_DUMP_PAGE) {
+		const size_t page = MIN(CL_DUMP_PAGE, len - offset);
+		const uint8_t *const src = data + offset;
+		if (src[0] || page == 1 || memcmp(src, src + 1, page - 1))
+			memcpy(dest + offset, src, page);
+	}
+}
+
+/*
+ * Dump any memory range to the file, mapped at its final size. The reads land in the mapping
+ * directly and their write back is started straight away, so the disk writes overlap the next read.
+ * A sparse dump asks the target for a block's CRC first and does not read it if it shows the block
+ * zero, which is left as a hole, or erased, which is filled in here.
+ */
+static bool cl_dump(target *t, const BMP_CL_OPTIONS_t *opt, cl_phases_s *phases)
+{
+	const uint32_t addr = opt->opt_flash_start;
+	const size_t size = opt->opt_flash_size;
+	const bool sparse = opt->opt_dump_sparse;
+	struct mmap_data out = {0};
+	if (bmp_mmap_out(opt->opt_flash_file, size, sparse, &out))
+		return false;
+	uint8_t *buffer = NULL;
+	if (sparse) {
+		buffer = malloc(CL_DUMP_BLANK_CHUNK);
+		if (!buffer) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			bmp_munmap_out(&out, 0);
+			return false;
+		}
+	}
+	DEBUG_INFO("Dumping %zu bytes from 0x%08" PRIx32 " to %s\n", size, addr, opt->opt_flash_file);
+	json_event("read", "\"phase\":\"start\",\"addr\":%" PRIu32 ",\"total\":%zu", addr, size);
+	const uint32_t start_time = platform_time_ms();
+	const size_t chunk = sparse ? CL_DUMP_BLANK_CHUNK : CL_DUMP_CHUNK;
+	size_t done = 0;
+	size_t skipped = 0;
+	bool ok = true;
+	while (ok && done < size) {
+		const size_t len = MIN(chunk, size - done);
+		uint8_t *const dest = (uint8_t *)out.data + done;
+		uint32_t crc;
+		int fill = -1;
+		if (sparse && t->crc32 && t->crc32(t, &crc, addr + done, len))
+			fill = cl_dump_blank_fill(len, crc);
+		if (fill == 0xff)
+			memset(dest, 0xff, len);
+		if (fill >= 0)
+			skipped += len;
+		else if (target_mem_read(t, sparse ? buffer : dest, addr + done, len)) {
+			DEBUG_WARN("Read failed at 0x%08" PRIx32 "\n", (uint32_t)(addr + done));
+			ok = false;
+			break;
+		} else if (sparse)
+			cl_dump_store_sparse(dest, buffer, len);
+		bmp_mmap_flush_async(&out, done, len);
+		done += len;
+		cl_json_progress("read", done, size, start_time);
+	}
+	free(buffer);
+	phases->verify_ms = platform_time_ms() - start_time;
+	bmp_munmap_out(&out, done);
+	cl_json_phase_end("read", ok, phases->verify_ms, done);
+	if (ok) {
+		DEBUG_WARN("Dump succeeded for %zu bytes, %8.3f kiB/s\n", done, cl_kib_s(done, phases->verify_ms));
+		if (skipped)
+			DEBUG_INFO("%zu bytes found zero or erased by CRC, not read\n", skipped);
+	}
+	return ok;
+}
+
+static bool cl_in_ram(const target *t, uint32_t addr, size_t size)
+{
+	for (const struct target_ram *r = t->ram; r; r = r->next) {
+		if (addr >= r->start && addr - r->start < r->length && size <= r->length - (addr - r->start))
+			return true;
+	}
+	return false;
+}
+
+static bool cl_in_image(const image_s *image, uint32_t addr)
+{
+	for (size_t i = 0; i < image->count; ++i) {
+		if (addr >= image->segments[i].addr && addr - image->segments[i].addr < image->segments[i].size)
+			return true;
+	}
+	return false;
+}
+
+#ifdef ENABLE_RTT
+/* Forward the RTT channels of the running image until ^C. The control block
+ * address comes from the ELF, the search is clipped to it in case the image
+ * has not initialised it yet. */
+static void cl_run_rtt(target *t, uint16_t port_base)
+{
+	uint32_t cbaddr;
+	if (image_elf_symbol(map.data, map.size, "_SEGGER_RTT", &cbaddr)) {
+		DEBUG_INFO("RTT control block at 0x%08" PRIx32 "\n", cbaddr);
+		rtt_cbaddr = cbaddr;
+		rtt_ram_start = cbaddr;
+		rtt_ram_end = cbaddr + sizeof(rtt_ident);
+	} else
+		DEBUG_WARN("No _SEGGER_RTT symbol in the image, searching RAM for the control block\n");
+	if (rtt_if_init(port_base))
+		return;
+	rtt_enabled = true;
+	DEBUG_WARN("RTT output of the image follows, abort with ^C\n");
+	while (true) {
+		volatile struct exception e;
+		TRY_CATCH (e, EXCEPTION_ALL) {
+			poll_rtt(t);
+		}
+		if (e.type) {
+			DEBUG_WARN("Target lost: %s\n", e.msg);
+			return;
+		}
+		platform_delay(1);
+	}
+}
+#endif
+
+/*
+ * Load the RAM segments of an ELF image and start it there, Flash is not touched. Every
+ * segment goes down in one write, which the probe backends split at their largest transfer.
+ * A vector table at the start of the lowest segment gives SP, PC and VTOR on Cortex-M,
+ * otherwise the ELF entry point is jumped to with SP left as it is.
+ */
+static bool cl_ram_run(target *t, const BMP_CL_OPTIONS_t *opt, cl_phases_s *phases)
+{
+	if (map.size < 4 || memcmp(map.data, "\x7f" "ELF", 4)) {
+		DEBUG_WARN("Run needs an ELF file, %s is not one\n", opt->opt_flash_file);
+		return false;
+	}
+	target_halt_request(t);
+	json_event("write", "\"phase\":\"start\",\"total\":%zu", image.total_size);
+	const uint32_t start_time = platform_time_ms();
+	const image_segment_s *lowest = NULL;
+	size_t loaded = 0;
+	for (size_t i = 0; i < image.count; ++i) {
+		const image_segment_s *const seg = &image.segments[i];
+		if (!cl_in_ram(t, seg->addr, seg->size)) {
+			DEBUG_WARN("Skipping segment at 0x%08" PRIx32 ", it is not in RAM\n", seg->addr);
+			continue;
+		}
+		DEBUG_INFO("Loading %zu bytes at 0x%08" PRIx32 "\n", seg->size, seg->addr);
+		if (target_mem_write(t, seg->addr, seg->data, seg->size)) {
+			DEBUG_WARN("Write failed at 0x%08" PRIx32 "\n", seg->addr);
+			cl_json_phase_end("write", false, platform_time_ms() - start_time, loaded);
+			return false;
+		}
+		loaded += seg->size;
+		if (!lowest || seg->addr < lowest->addr)
+			lowest = seg;
+	}
+	phases->write_ms = platform_time_ms() - start_time;
+	cl_json_phase_end("write", lowest != NULL, phases->write_ms, loaded);
+	if (!lowest) {
+		DEBUG_WARN("The image has no segments in RAM\n");
+		return false;
+	}
+	DEBUG_WARN("Loaded %zu bytes into RAM, %8.3f kiB/s\n", loaded, cl_kib_s(loaded, phases->write_ms));
+
+	const bool is_cortexm = t->core[0] == 'M';
+	uint32_t pc = image.entry;
+	if (is_cortexm && lowest->size >= 8U) {
+		uint32_t vectors[2];
+		memcpy(vectors, lowest->data, sizeof(vectors));
+		/* A Thumb reset handler inside the image and an aligned stack make it a vector table */
+		if ((vectors[1] & 1U) && cl_in_image(&image, vectors[1] & ~1U) && vectors[0] && !(vectors[0] & 3U)) {
+			target_mem_write32(t, CORTEXM_VTOR, lowest->addr);
+			target_reg_write(t, REG_SP, &vectors[0], sizeof(vectors[0]));
+			pc = vectors[1];
+			DEBUG_INFO("Vector table at 0x%08" PRIx32 ", SP 0x%08" PRIx32 "\n", lowest->addr, vectors[0]);
+		}
+	}
+	if (!cl_in_image(&image, pc & ~1U)) {
+		DEBUG_WARN("Entry point 0x%08" PRIx32 " is not in the loaded image\n", pc);
+		return false;
+	}
+	if (is_cortexm) {
+		const uint32_t xpsr = CORTEXM_XPSR_THUMB;
+		target_reg_write(t, REG_XPSR, &xpsr, sizeof(xpsr));
+		pc &= ~1U;
+	}
+	target_reg_write(t, REG_PC, &pc, sizeof(pc));
+	DEBUG_WARN("Starting at 0x%08" PRIx32 "\n", pc);
+	target_halt_resume(t, false);
+#ifdef ENABLE_RTT
+	if (opt->opt_run_rtt)
+		cl_run_rtt(t, opt->opt_rtt_port);
+#else
+	if (opt->opt_run_rtt)
+		DEBUG_WARN("RTT needs a build with ENABLE_RTT\n");
+#endif
+	return true;
+}
+
+static void cl_json_result(int res, uint32_t start_time, const cl_phases_s *phases)
+{
+	json_event("result",
+		"\"ok\":%s,\"total_ms\":%" PRIu32 ",\"scan_ms\":%" PRIu32 ",\"attach_ms\":%" PRIu32
+		",\"erase_ms\":%" PRIu32 ",\"write_ms\":%" PRIu32 ",\"verify_ms\":%" PRIu32,
+		res ? "false" : "true", platform_time_ms() - start_time, phases->scan_ms, phases->attach_ms,
+		phases->erase_ms, phases->write_ms, phases->verify_ms);
+}
+
 int cl_execute(BMP_CL_OPTIONS_t *opt)
 {
 	int res = 0;
 	int num_targets;
+	target *t = NULL;
+	cl_phases_s phases = {0};
 	if (opt->opt_tpwr) {
 		platform_target_set_power(true);
 		platform_delay(500);
@@ -433,41 +1429,45 @@ int cl_execute(BMP_CL_OPTIONS_t *opt)
 		DEBUG_INFO("Running in Test Mode\n");
 	DEBUG_INFO("Target voltage: %s Volt\n", platform_target_voltage());
 
-	if (opt->opt_scanmode == BMP_SCAN_JTAG)
-		num_targets = platform_jtag_scan(NULL);
-	else if (opt->opt_scanmode == BMP_SCAN_SWD)
-		num_targets = platform_adiv5_swdp_scan(opt->opt_targetid);
-	else
-	{
-		num_targets = platform_jtag_scan(NULL);
-		if (num_targets > 0)
-			goto found_targets;
-		DEBUG_INFO("JTAG scan found no devices, trying SWD.\n");
-		num_targets = platform_adiv5_swdp_scan(opt->opt_targetid);
-		if (num_targets > 0)
-			goto found_targets;
-		DEBUG_INFO("SW-DP scan failed!\n");
-	}
-
-found_targets:
+	const uint32_t run_start = platform_time_ms();
+	num_targets = cl_scan_targets(opt);
+	phases.scan_ms = platform_time_ms() - run_start;
+	json_event("scan", "\"targets\":%d,\"ms\":%" PRIu32, num_targets, phases.scan_ms);
 	if (!num_targets) {
 		DEBUG_WARN("No target found\n");
-		return -1;
+		res = -1;
+		goto target_detach;
 	} else {
 		num_targets = target_foreach(display_target, &num_targets);
 	}
 	if (opt->opt_target_dev > num_targets) {
 		DEBUG_WARN("Given target number %d not available max %d\n",
 				   opt->opt_target_dev, num_targets);
-		return -1;
+		res = -1;
+		goto target_detach;
+	}
+	uint32_t phase_start = platform_time_ms();
+	t = target_attach_n(opt->opt_target_dev, &cl_controller);
+	phases.attach_ms = platform_time_ms() - phase_start;
+	if (json_events_enabled) {
+		char driver[64];
+		json_event("attach", "\"target\":%d,\"ok\":%s,\"driver\":\"%s\",\"ms\":%" PRIu32,
+			opt->opt_target_dev, t ? "true" : "false", json_escape(driver, sizeof(driver), t ? t->driver : ""),
+			phases.attach_ms);
 	}
-	target *t = target_attach_n(opt->opt_target_dev, &cl_controller);
 
 	if (!t) {
 		DEBUG_WARN("Can not attach to target %d\n", opt->opt_target_dev);
 		res = -1;
 		goto target_detach;
 	}
+	if (opt->opt_frequency_auto) {
+		const uint32_t frequency = command_frequency_auto(t, 0);
+		if (frequency) {
+			DEBUG_INFO("Using SWJ frequency %" PRIu32 "Hz\n", frequency);
+			opt->opt_max_swj_frequency = frequency;
+		}
+	}
 	/* List each defined RAM */
 	int n_ram = 0;
 	for (struct target_ram *r = t->ram; r; r = r->next)
@@ -499,6 +1499,11 @@ found_targets:
 				}
 			}
 	}
+	/* Before the defaults below, Flash is only benchmarked when asked for with -a */
+	if (opt->opt_mode == BMP_MODE_BENCH) {
+		res = cl_bench(t, opt) ? 0 : -1;
+		goto target_detach;
+	}
 	if (opt->opt_flash_start == 0xffffffff)
 		opt->opt_flash_start = lowest_flash_start;
 	if ((opt->opt_flash_size == 0xffffffff) &&
@@ -524,15 +1529,21 @@ found_targets:
 		(opt->opt_mode == BMP_MODE_SWJ_TEST))
 		goto target_detach;
 	int read_file = -1;
-	if ((opt->opt_mode == BMP_MODE_FLASH_WRITE) ||
-	    (opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
-	    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-		int mmap_res = bmp_mmap(opt->opt_flash_file, &map);
+	if (cl_mode_uses_image(opt)) {
+		/* In gang mode the image is already mapped, shared with the other workers */
+		int mmap_res = map.data ? 0 : bmp_mmap(opt->opt_flash_file, &map);
 		if (mmap_res) {
 			DEBUG_WARN("Can not map file: %s. Aborting!\n", strerror(errno));
 			res = -1;
 			goto target_detach;
 		}
+		/* Raw binaries are restricted to the size given on the command line */
+		if (!image_load(&image, map.data, map.size, opt->opt_flash_start, opt->opt_flash_size) ||
+			(opt->opt_mode != BMP_MODE_RAM_RUN && !image_merge(&image, t))) {
+			DEBUG_WARN("Can not parse file %s. Aborting!\n", opt->opt_flash_file);
+			res = -1;
+			goto free_map;
+		}
 	} else if (opt->opt_mode == BMP_MODE_FLASH_READ) {
 		/* Open as binary */
 		read_file = open(opt->opt_flash_file, O_TRUNC | O_CREAT | O_RDWR | O_BINARY,
@@ -544,45 +1555,108 @@ found_targets:
 			goto target_detach;
 		}
 	}
-	if (opt->opt_flash_size < map.size)
-		/* restrict to size given on command line */
-		map.size = opt->opt_flash_size;
 	if (opt->opt_monitor) {
 		res = command_process(t, opt->opt_monitor);
 		if (res)
 			DEBUG_WARN("Command \"%s\" failed\n", opt->opt_monitor);
 	}
+	if (opt->opt_mode == BMP_MODE_DUMP) {
+		if (!cl_dump(t, opt, &phases))
+			res = -1;
+		goto target_detach;
+	}
+	if (opt->opt_mode == BMP_MODE_RAM_RUN) {
+		if (!cl_ram_run(t, opt, &phases))
+			res = -1;
+		goto free_map;
+	}
+	t->flash_diff = opt->opt_flash_diff;
 	if (opt->opt_mode == BMP_MODE_RESET) {
 		target_reset(t);
 	} else if (opt->opt_mode == BMP_MODE_FLASH_ERASE) {
 		DEBUG_INFO("Erase %zu bytes at 0x%08" PRIx32 "\n", opt->opt_flash_size, opt->opt_flash_start);
-		if (!target_flash_erase(t, opt->opt_flash_start, opt->opt_flash_size)) {
+		json_event("erase", "\"phase\":\"start\",\"addr\":%" PRIu32 ",\"total\":%zu", opt->opt_flash_start,
+			opt->opt_flash_size);
+		phase_start = platform_time_ms();
+		const bool erased = target_flash_erase(t, opt->opt_flash_start, opt->opt_flash_size);
+		phases.erase_ms = platform_time_ms() - phase_start;
+		cl_json_phase_end("erase", erased, phases.erase_ms, opt->opt_flash_size);
+		if (!erased) {
 			DEBUG_WARN("Erasure failed!\n");
 			res = -1;
 			goto free_map;
 		}
 		target_reset(t);
+	} else if (((opt->opt_mode == BMP_MODE_FLASH_WRITE) || (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) &&
+		opt->opt_all_targets) {
+		target *targets[CL_ALL_TARGETS_MAX];
+		const size_t count = cl_attach_alike(t, opt->opt_flash_diff, targets);
+		DEBUG_INFO("Programming %zu targets interleaved\n", count);
+		if (!cl_flash_interleaved(targets, count, opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY, &phases)) {
+			DEBUG_WARN("Flashing failed!\n");
+			res = -1;
+		}
+		for (size_t n = 1; n < count; ++n)
+			target_detach(targets[n]);
+		goto free_map;
+	} else if (((opt->opt_mode == BMP_MODE_FLASH_WRITE) || (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) &&
+		platform_flash_offload_supported()) {
+		uint32_t start_time = platform_time_ms();
+		/* The probe attaches on its own, release the target meanwhile */
+		target_detach(t);
+		t = NULL;
+		if (!cl_flash_offload(opt, &image, &phases)) {
+			DEBUG_WARN("Flashing failed!\n");
+			res = -1;
+			goto free_map;
+		}
+		uint32_t end_time = platform_time_ms();
+		DEBUG_WARN("Flash Write succeeded for %d bytes, %8.3f kiB/s\n",
+			   (int)image.total_size, (((image.total_size * 1.0)/(end_time - start_time))));
+		if (opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY)
+			goto free_map;
+		/* The probe moved the DP state under our feet, so rescan before verifying */
+		if (cl_scan_targets(opt) > 0)
+			t = target_attach_n(opt->opt_target_dev, &cl_controller);
+		if (!t) {
+			DEBUG_WARN("Can not attach to target %d\n", opt->opt_target_dev);
+			res = -1;
+			goto free_map;
+		}
 	} else if ((opt->opt_mode == BMP_MODE_FLASH_WRITE) || (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-		DEBUG_INFO("Erase    %zu bytes at 0x%08" PRIx32 "\n", map.size, opt->opt_flash_start);
 		uint32_t start_time = platform_time_ms();
-		if (!target_flash_erase(t, opt->opt_flash_start, map.size)) {
+		/* Only the populated ranges are touched, every segment is erased before any is written */
+		if (!cl_flash_erase_image(t, &image, &phases)) {
 			DEBUG_WARN("Erasure failed!\n");
 			res = -1;
 			goto free_map;
-		} else {
-			DEBUG_INFO("Flashing %zu bytes at 0x%08" PRIx32 "\n", map.size, opt->opt_flash_start);
-			/* Buffered write cares for padding*/
-			if (!target_flash_write(t, opt->opt_flash_start, map.data, map.size) || !target_flash_complete(t)) {
-				DEBUG_WARN("Flashing failed!\n");
-				res = -1;
-				goto free_map;
-			} else {
-				DEBUG_INFO("Success!\n");
-			}
 		}
+		/* Buffered write cares for padding*/
+		if (!cl_flash_write_image(t, &image, &phases)) {
+			DEBUG_WARN("Flashing failed!\n");
+			res = -1;
+			goto free_map;
+		}
+		DEBUG_INFO("Success!\n");
 		uint32_t end_time = platform_time_ms();
 		DEBUG_WARN("Flash Write succeeded for %d bytes, %8.3f kiB/s\n",
-			   (int)map.size, (((map.size * 1.0)/(end_time - start_time))));
+			   (int)image.total_size, (((image.total_size * 1.0)/(end_time - start_time))));
+		for (const target_flash_s *f = t->flash; f; f = f->next) {
+			const flash_stats_s *const stats = &f->stats;
+			if (!stats->bytes_received && !stats->sectors_erased && !stats->sectors_blank)
+				continue;
+			DEBUG_INFO("Flash 0x%08" PRIx32 ": %" PRIu32 " bytes programmed of %" PRIu32 ", %" PRIu32
+				" sectors erased, %" PRIu32 " found blank\n", f->start, stats->bytes_programmed, stats->bytes_received,
+				stats->sectors_erased, stats->sectors_blank);
+			DEBUG_INFO("  erase %" PRIu32 " ms, write %" PRIu32 " ms, prepare/done %" PRIu32 " ms, "
+				"waiting on host %" PRIu32 " ms\n", stats->erase_ms, stats->write_ms, stats->prepare_done_ms,
+				stats->host_wait_ms);
+			if (stats->status_polls)
+				DEBUG_INFO("  %" PRIu32 " status reads, longest operation %" PRIu32 " ms\n", stats->status_polls,
+					stats->busy_max_ms);
+			if (stats->sectors_cached)
+				DEBUG_INFO("  %" PRIu32 " sectors known unchanged from the host cache\n", stats->sectors_cached);
+		}
 		if (opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY) {
 			target_reset(t);
 			goto free_map;
@@ -603,51 +1677,87 @@ found_targets:
 			DEBUG_INFO("Reading flash from 0x%08" PRIx32 " for %zu"
 				   " bytes to %s\n", opt->opt_flash_start,  opt->opt_flash_size,
 				   opt->opt_flash_file);
-		uint32_t flash_src = opt->opt_flash_start;
-		size_t size = (opt->opt_mode == BMP_MODE_FLASH_READ) ? opt->opt_flash_size:
-			map.size;
+		/* Reading covers the requested range, verifying every populated image segment */
+		const image_segment_s read_range = {opt->opt_flash_start, opt->opt_flash_size, NULL};
+		const bool reading = opt->opt_mode == BMP_MODE_FLASH_READ;
+		const image_segment_s *const ranges = reading ? &read_range : image.segments;
+		const size_t n_ranges = reading ? 1U : image.count;
 		int bytes_read = 0;
-		void *flash = map.data;
+		size_t total = 0;
+		for (size_t i = 0; i < n_ranges; ++i)
+			total += ranges[i].size;
+		const char *const event = reading ? "read" : "verify";
+		json_event(event, "\"phase\":\"start\",\"segments\":%zu,\"total\":%zu", n_ranges, total);
+		size_t last_progress = 0;
 		uint32_t start_time = platform_time_ms();
-		while (size) {
-			int worksize = (size > WORKSIZE) ? WORKSIZE : size;
-			int n_read = target_mem_read(t, data, flash_src, worksize);
-			if (n_read) {
-				if (opt->opt_flash_size == 0) {/* we reached end of flash */
-					DEBUG_INFO("Reached end of flash at size %" PRId32 "\n",
-						   flash_src - opt->opt_flash_start);
-					break;
+		for (size_t i = 0; i < n_ranges; ++i) {
+			uint32_t flash_src = ranges[i].addr;
+			size_t size = ranges[i].size;
+			const uint8_t *flash = ranges[i].data;
+			uint32_t crc;
+			crc32_kind_e kind;
+			if (!reading && target_crc32(t, flash_src, size, &crc, &kind)) {
+				/* Only the checksum crosses the link, read back only to locate a mismatch */
+				if (crc == crc32_kind_buffer(kind, 0xffffffffU, flash, size)) {
+					bytes_read += size;
+					size = 0;
+				} else
+					DEBUG_WARN("CRC mismatch, reading back to locate the difference\n");
+			}
+			while (size) {
+				int worksize = (size > WORKSIZE) ? WORKSIZE : size;
+				int n_read = target_mem_read(t, data, flash_src, worksize);
+				if (n_read) {
+					if (opt->opt_flash_size == 0) {/* we reached end of flash */
+						DEBUG_INFO("Reached end of flash at size %" PRId32 "\n",
+							   flash_src - opt->opt_flash_start);
+						break;
+					} else {
+						DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n",
+							   flash_src);
+						break;
+					}
 				} else {
-					DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n",
-						   flash_src);
-					break;
+					bytes_read += worksize;
 				}
-			} else {
-				bytes_read += worksize;
-			}
-			if ((opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
-			    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-				int difference = memcmp(data, flash, worksize);
-				if (difference){
-					DEBUG_WARN("Verify failed at flash region 0x%08"
-							   PRIx32 "\n", flash_src);
-					res = -1;
-					goto free_map;
+				if ((opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
+				    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
+					int difference = memcmp(data, flash, worksize);
+					if (difference){
+						DEBUG_WARN("Verify failed at flash region 0x%08"
+								   PRIx32 "\n", flash_src);
+						if (json_events_enabled) {
+							int offset = 0;
+							while (data[offset] == flash[offset])
+								++offset;
+							phases.verify_ms = platform_time_ms() - start_time;
+							json_event(event, "\"phase\":\"end\",\"ok\":false,\"mismatch_addr\":%" PRIu32
+								",\"bytes\":%d,\"ms\":%" PRIu32, flash_src + offset, bytes_read, phases.verify_ms);
+						}
+						res = -1;
+						goto free_map;
+					}
+					flash += worksize;
+				} else if (read_file != -1) {
+					int written = write(read_file, data, worksize);
+					if (written < worksize) {
+						DEBUG_WARN("Read failed at flash region 0x%08" PRIx32 "\n",
+							   flash_src);
+						res = -1;
+						goto free_map;
+					}
 				}
-				flash += worksize;
-			} else if (read_file != -1) {
-				int written = write(read_file, data, worksize);
-				if (written < worksize) {
-					DEBUG_WARN("Read failed at flash region 0x%08" PRIx32 "\n",
-						   flash_src);
-					res = -1;
-					goto free_map;
+				flash_src += worksize;
+				size -= worksize;
+				if ((size_t)bytes_read - last_progress >= CL_PROGRESS_CHUNK) {
+					last_progress = bytes_read;
+					cl_json_progress(event, bytes_read, total, start_time);
 				}
 			}
-			flash_src += worksize;
-			size -= worksize;
 		}
 		uint32_t end_time = platform_time_ms();
+		phases.verify_ms = end_time - start_time;
+		cl_json_phase_end(event, (size_t)bytes_read >= total, phases.verify_ms, bytes_read);
 		if (read_file != -1)
 			close(read_file);
 		DEBUG_WARN("Read/Verify succeeded for %d bytes, %8.3f kiB/s\n",
@@ -657,11 +1767,13 @@ found_targets:
 			target_reset(t);
 	}
   free_map:
+	image_free(&image);
 	if (map.size)
 		bmp_munmap(&map);
   target_detach:
 	if (t)
 		target_detach(t);
 	target_list_free();
+	cl_json_result(res, run_start, &phases);
 	return res;
 }
@@ -37,7 +37,11 @@ enum bmp_cl_mode {
 	BMP_MODE_FLASH_READ,
 	BMP_MODE_FLASH_VERIFY,
 	BMP_MODE_SWJ_TEST,
+	BMP_MODE_BENCH,
+	BMP_MODE_BENCH_CODE,
 	BMP_MODE_MONITOR,
+	BMP_MODE_DUMP,
+	BMP_MODE_RAM_RUN,
 };
 
 typedef enum bmp_scan_mode_e {
@@ -55,9 +59,23 @@ typedef struct BMP_CL_OPTIONS_s {
 	bool external_resistor_swd;
 	bool fast_poll;
 	bool opt_no_hl;
+	bool opt_flash_diff;
+	bool opt_low_latency;
+	bool opt_frequency_auto;
+	bool opt_rtck;
+	bool opt_mock;
+	bool opt_json;
+	bool opt_dump_sparse;
+	bool opt_run_rtt;
+	bool opt_all_targets;
+	bool opt_station;
+	bool opt_stdio;
+	uint32_t opt_mock_latency_us;
 	char *opt_flash_file;
 	char *opt_device;
 	char *opt_serial;
+	char *opt_gang;
+	uint16_t opt_client_port;
 	uint32_t opt_targetid;
 	char *opt_ident_string;
 	int opt_position;
@@ -68,10 +86,24 @@ typedef struct BMP_CL_OPTIONS_s {
 	uint32_t opt_flash_start;
 	uint32_t opt_max_swj_frequency;
 	size_t opt_flash_size;
+	uint16_t opt_rtt_port;
+	char *opt_swo_out;
+	char *opt_wire_trace;
 } BMP_CL_OPTIONS_t;
 
+/* Probes a gang run drives at once */
+#define CL_GANG_MAX 64U
+#define CL_ALL_TARGETS_MAX 16U
+
+void cl_defaults(BMP_CL_OPTIONS_t *opt);
 void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv);
+void cl_gang(BMP_CL_OPTIONS_t *opt);
+void cl_station(BMP_CL_OPTIONS_t *opt);
+int cl_station_worker(BMP_CL_OPTIONS_t *opt);
+int cl_scan_targets(const BMP_CL_OPTIONS_t *opt);
 int cl_execute(BMP_CL_OPTIONS_t *opt);
+int platform_probe_open(const BMP_CL_OPTIONS_t *opt);
+void platform_probe_close(void);
 int serial_open(BMP_CL_OPTIONS_t *opt, char *serial);
 void serial_close(void);
 
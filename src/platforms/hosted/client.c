@@ -0,0 +1,487 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Thin client for a blackmagic left running as GDB server.
+ *
+ * The operation given on the command line goes to the server as GDB remote
+ * protocol packets: the probe it holds open, and the targets it has scanned,
+ * are reused rather than found, initialised and scanned again on every call.
+ */
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+#   define __USE_MINGW_ANSI_STDIO 1
+#   include <winsock2.h>
+#   include <windows.h>
+#   include <ws2tcpip.h>
+#else
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <arpa/inet.h>
+#   include <sys/mman.h>
+#endif
+
+#include "general.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bmp_hosted.h"
+#include "cli.h"
+#include "client.h"
+#include "crc32.h"
+#include "hex_utils.h"
+#include "image.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Largest packet the server takes, it says what it can handle in qSupported */
+#define CLIENT_BUFFER_SIZE 16384U
+#define CLIENT_RETRIES     3U
+
+static int client_sock = -1;
+static size_t client_packet_size = 1024U;
+static char client_buf[CLIENT_BUFFER_SIZE + 1U];
+static char client_reply[CLIENT_BUFFER_SIZE + 1U];
+
+static uint8_t client_rx_buf[4096U];
+static size_t client_rx_pos;
+static size_t client_rx_len;
+
+static bool client_send(const void *data, size_t len)
+{
+	const char *bytes = data;
+	while (len) {
+		const int sent = send(client_sock, bytes, len, 0);
+		if (sent <= 0)
+			return false;
+		bytes += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+static int client_getc(void)
+{
+	if (client_rx_pos == client_rx_len) {
+		const int received = recv(client_sock, (char *)client_rx_buf, sizeof(client_rx_buf), 0);
+		if (received <= 0)
+			return -1;
+		client_rx_pos = 0;
+		client_rx_len = received;
+	}
+	return client_rx_buf[client_rx_pos++];
+}
+
+/* Frame already escaped packet data, send it and wait for the server's ack */
+static bool client_put_packet(const char *data, const size_t len)
+{
+	static char frame[CLIENT_BUFFER_SIZE + 5U];
+	if (len > CLIENT_BUFFER_SIZE)
+		return false;
+	uint8_t csum = 0;
+	frame[0] = '$';
+	for (size_t i = 0; i < len; ++i) {
+		frame[1U + i] = data[i];
+		csum += (uint8_t)data[i];
+	}
+	snprintf(frame + 1U + len, 4U, "#%02x", csum);
+
+	for (size_t attempt = 0; attempt < CLIENT_RETRIES; ++attempt) {
+		if (!client_send(frame, len + 4U))
+			return false;
+		int c;
+		do
+			c = client_getc();
+		while (c >= 0 && c != '+' && c != '-');
+		if (c == '+')
+			return true;
+		if (c < 0)
+			return false;
+	}
+	return false;
+}
+
+static int client_get_packet(char *const packet, const size_t size)
+{
+	for (size_t attempt = 0; attempt < CLIENT_RETRIES; ++attempt) {
+		int c;
+		do
+			c = client_getc();
+		while (c >= 0 && c != '$');
+		if (c < 0)
+			return -1;
+
+		size_t len = 0;
+		uint8_t csum = 0;
+		bool escaped = false;
+		while ((c = client_getc()) >= 0 && c != '#') {
+			csum += (uint8_t)c;
+			if (escaped) {
+				c ^= 0x20;
+				escaped = false;
+			} else if (c == '}') {
+				escaped = true;
+				continue;
+			}
+			if (len < size)
+				packet[len++] = (char)c;
+		}
+		if (c < 0)
+			return -1;
+		char hex[3] = {0};
+		for (size_t i = 0; i < 2U; ++i) {
+			if ((c = client_getc()) < 0)
+				return -1;
+			hex[i] = (char)c;
+		}
+		if (strtoul(hex, NULL, 16) == csum) {
+			client_send("+", 1U);
+			packet[len] = '\0';
+			return len;
+		}
+		client_send("-", 1U);
+	}
+	return -1;
+}
+
+/* Send a packet and return its reply, printing the console output the server sends before it */
+static int client_transact(const char *const packet, const size_t len)
+{
+	if (!client_put_packet(packet, len))
+		return -1;
+	while (true) {
+		const int reply_len = client_get_packet(client_reply, CLIENT_BUFFER_SIZE);
+		if (reply_len < 0)
+			return -1;
+		/* 'O' then hex is console output, "OK" is a reply */
+		if (client_reply[0] == 'O' && (reply_len & 1) && isxdigit((unsigned char)client_reply[1])) {
+			char text[CLIENT_BUFFER_SIZE / 2U + 1U];
+			const size_t text_len = (reply_len - 1U) / 2U;
+			unhexify(text, client_reply + 1, text_len);
+			text[text_len] = '\0';
+			PRINT_INFO("%s", text);
+			continue;
+		}
+		return reply_len;
+	}
+}
+
+static int client_transactf(const char *const fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	const int len = vsnprintf(client_buf, sizeof(client_buf), fmt, ap);
+	va_end(ap);
+	if (len < 0 || (size_t)len >= sizeof(client_buf))
+		return -1;
+	return client_transact(client_buf, len);
+}
+
+static bool client_monitor(const char *const command)
+{
+	const size_t len = strlen(command);
+	if (6U + len * 2U > CLIENT_BUFFER_SIZE)
+		return false;
+	memcpy(client_buf, "qRcmd,", 6U);
+	hexify(client_buf + 6U, command, len);
+	const int reply_len = client_transact(client_buf, 6U + len * 2U);
+	return reply_len > 0 && !strcmp(client_reply, "OK");
+}
+
+static bool client_connect(const uint16_t port)
+{
+#if defined(_WIN32) || defined(__CYGWIN__)
+	WSADATA wsa_data;
+	WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+	client_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (client_sock == -1)
+		return false;
+	int opt = 1;
+	setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, (void *)&opt, sizeof(opt));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return connect(client_sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+}
+
+static void client_close(void)
+{
+	if (client_sock == -1)
+		return;
+#if defined(_WIN32) || defined(__CYGWIN__)
+	closesocket(client_sock);
+#else
+	close(client_sock);
+#endif
+	client_sock = -1;
+}
+
+/* Attach to the target asked for, having the server scan only if it has none to offer */
+static bool client_attach(const BMP_CL_OPTIONS_t *const opt)
+{
+	if (client_transactf("vAttach;%x", opt->opt_target_dev) > 0 && client_reply[0] == 'T')
+		return true;
+
+	if (opt->opt_connect_under_reset)
+		client_monitor("connect_rst enable");
+	char scan[32];
+	if (opt->opt_scanmode == BMP_SCAN_JTAG)
+		snprintf(scan, sizeof(scan), "jtag_scan");
+	else if (opt->opt_scanmode == BMP_SCAN_AUTO)
+		snprintf(scan, sizeof(scan), "auto_scan");
+	else if (opt->opt_targetid)
+		snprintf(scan, sizeof(scan), "swdp_scan 0x%" PRIx32, opt->opt_targetid);
+	else
+		snprintf(scan, sizeof(scan), "swdp_scan");
+	if (!client_monitor(scan))
+		return false;
+	return client_transactf("vAttach;%x", opt->opt_target_dev) > 0 && client_reply[0] == 'T';
+}
+
+/* Find the first Flash region in the target's memory map, for the defaults of -a and -S */
+static bool client_flash_region(uint32_t *const start, uint32_t *const length)
+{
+	char map[2048];
+	size_t map_len = 0;
+	while (map_len < sizeof(map) - 1U) {
+		const int reply_len =
+			client_transactf("qXfer:memory-map:read::%zx,%zx", map_len, sizeof(map) - 1U - map_len);
+		if (reply_len < 1 || (client_reply[0] != 'm' && client_reply[0] != 'l'))
+			return false;
+		memcpy(map + map_len, client_reply + 1, reply_len - 1U);
+		map_len += reply_len - 1U;
+		if (client_reply[0] == 'l')
+			break;
+	}
+	map[map_len] = '\0';
+	const char *const flash = strstr(map, "<memory type=\"flash\"");
+	return flash && sscanf(flash, "<memory type=\"flash\" start=\"%" SCNx32 "\" length=\"%" SCNx32 "\"", start, length) == 2;
+}
+
+/* One vFlashWrite, data escaped as binary packets need it */
+static bool client_flash_write(const uint32_t addr, const uint8_t *const data, const size_t len)
+{
+	size_t pos = (size_t)snprintf(client_buf, sizeof(client_buf), "vFlashWrite:%08" PRIx32 ":", addr);
+	for (size_t i = 0; i < len; ++i) {
+		const char c = (char)data[i];
+		if (c == '$' || c == '#' || c == '}' || c == '*') {
+			client_buf[pos++] = '}';
+			client_buf[pos++] = c ^ 0x20;
+		} else
+			client_buf[pos++] = c;
+	}
+	return client_transact(client_buf, pos) > 0 && !strcmp(client_reply, "OK");
+}
+
+static bool client_write_image(const image_s *const image)
+{
+	/* All erases go first, a block two segments share must not be erased once written */
+	for (size_t i = 0; i < image->count; ++i) {
+		const image_segment_s *const seg = &image->segments[i];
+		if (client_transactf("vFlashErase:%08" PRIx32 ",%08zx", seg->addr, seg->size) <= 0 ||
+			strcmp(client_reply, "OK")) {
+			DEBUG_WARN("Erase failed at 0x%08" PRIx32 "\n", seg->addr);
+			return false;
+		}
+	}
+	/* Escaping can double the data, leave room for it and the header */
+	const size_t chunk = (client_packet_size - 32U) / 2U;
+	for (size_t i = 0; i < image->count; ++i) {
+		const image_segment_s *const seg = &image->segments[i];
+		for (size_t offset = 0; offset < seg->size; offset += chunk) {
+			const size_t len = MIN(chunk, seg->size - offset);
+			if (!client_flash_write(seg->addr + offset, seg->data + offset, len)) {
+				DEBUG_WARN("Write failed at 0x%08zx\n", seg->addr + offset);
+				return false;
+			}
+		}
+	}
+	return client_transactf("vFlashDone") > 0 && !strcmp(client_reply, "OK");
+}
+
+static bool client_verify_image(const image_s *const image)
+{
+	for (size_t i = 0; i < image->count; ++i) {
+		const image_segment_s *const seg = &image->segments[i];
+		uint32_t crc = 0;
+		if (client_transactf("qCRC:%" PRIx32 ",%zx", seg->addr, seg->size) <= 0 ||
+			sscanf(client_reply, "C%" SCNx32, &crc) != 1) {
+			DEBUG_WARN("Server could not checksum 0x%08" PRIx32 "\n", seg->addr);
+			return false;
+		}
+		if (crc != crc32_buffer(0xffffffffU, seg->data, seg->size)) {
+			DEBUG_WARN("Verify failed in region 0x%08" PRIx32 "\n", seg->addr);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool client_read_flash(const BMP_CL_OPTIONS_t *const opt, const uint32_t start, const size_t size)
+{
+	const int fd = open(opt->opt_flash_file, O_TRUNC | O_CREAT | O_RDWR | O_BINARY, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		DEBUG_WARN("Error opening flashfile %s for read: %s\n", opt->opt_flash_file, strerror(errno));
+		return false;
+	}
+	const size_t chunk = (client_packet_size - 8U) / 2U;
+	uint8_t data[CLIENT_BUFFER_SIZE / 2U];
+	bool ok = true;
+	for (size_t offset = 0; ok && offset < size; offset += chunk) {
+		const size_t len = MIN(chunk, size - offset);
+		const int reply_len = client_transactf("m%" PRIx32 ",%zx", start + (uint32_t)offset, len);
+		if (reply_len != (int)(len * 2U)) {
+			DEBUG_WARN("Read failed at flash address 0x%08zx\n", start + offset);
+			ok = false;
+			break;
+		}
+		unhexify(data, client_reply, len);
+		ok = write(fd, data, len) == (ssize_t)len;
+	}
+	close(fd);
+	return ok;
+}
+
+static bool client_map_image(const BMP_CL_OPTIONS_t *const opt, const uint32_t base, const size_t max_size,
+	image_s *const image, void **const data, size_t *const size)
+{
+	const int fd = open(opt->opt_flash_file, O_RDONLY | O_BINARY);
+	if (fd < 0) {
+		DEBUG_WARN("Open file %s failed: %s\n", opt->opt_flash_file, strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return false;
+	}
+	*size = st.st_size;
+	*data = malloc(*size);
+	const bool read_ok = *data && read(fd, *data, *size) == (ssize_t)*size;
+	close(fd);
+	if (!read_ok || !image_load(image, *data, *size, base, max_size)) {
+		DEBUG_WARN("Can not parse file %s. Aborting!\n", opt->opt_flash_file);
+		free(*data);
+		*data = NULL;
+		return false;
+	}
+	return true;
+}
+
+int cl_client_execute(BMP_CL_OPTIONS_t *opt)
+{
+	if (opt->opt_mode == BMP_MODE_DEBUG || opt->opt_mode == BMP_MODE_TEST || opt->opt_mode == BMP_MODE_SWJ_TEST ||
+		opt->opt_mode == BMP_MODE_BENCH || opt->opt_mode == BMP_MODE_RESET_HW || opt->opt_mode == BMP_MODE_RAM_RUN) {
+		DEBUG_WARN("This operation needs the probe itself, it can not be sent to a server\n");
+		return -1;
+	}
+	if (!client_connect(opt->opt_client_port)) {
+		DEBUG_WARN("No blackmagic server on localhost:%u: %s\n", opt->opt_client_port, strerror(errno));
+		client_close();
+		return -1;
+	}
+
+	uint32_t packet_size = 0;
+	if (client_transactf("qSupported") > 0) {
+		const char *const size_field = strstr(client_reply, "PacketSize=");
+		if (size_field && sscanf(size_field, "PacketSize=%" SCNx32, &packet_size) == 1 && packet_size > 64U)
+			client_packet_size = MIN(packet_size, CLIENT_BUFFER_SIZE);
+	}
+
+	int res = 0;
+	if (!client_attach(opt)) {
+		DEBUG_WARN("Server can not attach to target %d\n", opt->opt_target_dev);
+		client_close();
+		return -1;
+	}
+	if (opt->opt_monitor && !client_monitor(opt->opt_monitor)) {
+		DEBUG_WARN("Command \"%s\" failed\n", opt->opt_monitor);
+		res = -1;
+	}
+
+	uint32_t flash_start = opt->opt_flash_start;
+	size_t flash_size = opt->opt_flash_size;
+	if (opt->opt_mode != BMP_MODE_MONITOR && opt->opt_mode != BMP_MODE_RESET &&
+		(flash_start == 0xffffffffU || flash_size == 0xffffffffU)) {
+		uint32_t region_start = 0;
+		uint32_t region_length = 0;
+		if (client_flash_region(&region_start, &region_length)) {
+			if (flash_start == 0xffffffffU)
+				flash_start = region_start;
+			if (flash_size == 0xffffffffU)
+				flash_size = region_start + region_length - flash_start;
+		}
+	}
+
+	const uint32_t start_time = platform_time_ms();
+	image_s image = {0};
+	void *data = NULL;
+	size_t data_size = 0;
+	switch (opt->opt_mode) {
+	case BMP_MODE_RESET:
+		res = client_transactf("vKill;1") > 0 && !strcmp(client_reply, "OK") ? 0 : -1;
+		break;
+	case BMP_MODE_FLASH_ERASE:
+		if (opt->opt_flash_start == 0xffffffffU && opt->opt_flash_size == 0xffffffffU)
+			res = client_monitor("erase_mass") ? 0 : -1;
+		else if (client_transactf("vFlashErase:%08" PRIx32 ",%08zx", flash_start, flash_size) <= 0 ||
+			strcmp(client_reply, "OK") || client_transactf("vFlashDone") <= 0 || strcmp(client_reply, "OK"))
+			res = -1;
+		break;
+	case BMP_MODE_FLASH_WRITE:
+	case BMP_MODE_FLASH_VERIFY:
+	case BMP_MODE_FLASH_WRITE_VERIFY:
+		if (!client_map_image(opt, flash_start, flash_size, &image, &data, &data_size)) {
+			res = -1;
+			break;
+		}
+		if (opt->opt_mode != BMP_MODE_FLASH_VERIFY && !client_write_image(&image))
+			res = -1;
+		else if (opt->opt_mode != BMP_MODE_FLASH_WRITE && !client_verify_image(&image))
+			res = -1;
+		else if (opt->opt_mode != BMP_MODE_FLASH_VERIFY)
+			client_transactf("vKill;1"); /* Start the new firmware */
+		image_free(&image);
+		free(data);
+		break;
+	case BMP_MODE_FLASH_READ:
+	case BMP_MODE_DUMP:
+		if (!client_read_flash(opt, flash_start, flash_size))
+			res = -1;
+		break;
+	default:
+		break;
+	}
+	if (res)
+		DEBUG_WARN("Operation failed!\n");
+	else if (opt->opt_mode != BMP_MODE_MONITOR)
+		DEBUG_INFO("Done in %" PRIu32 " ms\n", platform_time_ms() - start_time);
+
+	/* Leave the target to the server for the next client */
+	client_transactf("D");
+	client_close();
+	return res;
+}
@@ -42,6 +42,7 @@
 #include "cli.h"
 #include "target.h"
 #include "target_internal.h"
+#include "wire_trace.h"
 
 uint8_t dap_caps;
 uint8_t mode;
@@ -59,10 +60,19 @@ static cmsis_type_t type;
 static libusb_device_handle *usb_handle = NULL;
 static uint8_t in_ep;
 static uint8_t out_ep;
+static uint8_t swo_ep;
 static hid_device *handle = NULL;
-static uint8_t buffer[1024 + 1];
-static int report_size = 64 + 1; // TODO: read actual report size
+static uint8_t buffer[DAP_PACKET_SIZE_MAX + 1U];
+/* Packet size reported by the probe, plus the HID report ID */
+static int report_size = 64 + 1;
+static bool report_size_limited = false;
 static bool has_swd_sequence = false;
+/* Set once DAP_JTAG_Configure took the IR lengths of the chain last scanned */
+static bool jtag_configured = false;
+/* Commands the probe can buffer, bulk transfers keep this many in flight */
+static size_t packet_count = 1;
+
+#define DAP_PACKET_COUNT_MAX 16U
 
 static size_t mbslen(const char *str)
 {
@@ -137,7 +147,7 @@ static bool dap_init_hid(const bmp_info_t *const info)
 	*/
 	if (info->vid == 0x1fc9 && info->pid == 0x0132) {
 		DEBUG_WARN("Blacklist\n");
-		report_size = 64 + 1;
+		report_size_limited = true;
 	}
 	handle = hid_open(info->vid, info->pid, serial[0] ? serial : NULL);
 	if (!handle) {
@@ -165,6 +175,7 @@ static bool dap_init_bulk(const bmp_info_t *const info)
 	}
 	in_ep = info->in_ep;
 	out_ep = info->out_ep;
+	swo_ep = info->swo_ep;
 	return true;
 }
 
@@ -197,6 +208,16 @@ int dap_init(bmp_info_t *info)
 			has_swd_sequence = ((major > 1 ) || ((major > 0 ) && (minor > 1)));
 		}
 	}
+	size = dap_info(DAP_INFO_PACKET_COUNT, buffer, sizeof(buffer));
+	if (size && buffer[0])
+		packet_count = MIN(buffer[0], DAP_PACKET_COUNT_MAX);
+	/* Transfers are sized from this, 64 bytes on full speed HID, 512 or more on high speed bulk */
+	size = dap_info(DAP_INFO_PACKET_SIZE, buffer, sizeof(buffer));
+	if (size >= 2U && !report_size_limited) {
+		const size_t packet_size = buffer[0] | (buffer[1] << 8U);
+		if (packet_size >= 64U)
+			report_size = MIN(packet_size, DAP_PACKET_SIZE_MAX) + 1U;
+	}
 	size = dap_info(DAP_INFO_CAPABILITIES, buffer, sizeof(buffer));
 	dap_caps = buffer[0];
 	DEBUG_INFO("Cap (0x%2x): %s%s%s", dap_caps,
@@ -209,8 +230,13 @@ int dap_init(bmp_info_t *info)
 		DEBUG_INFO(", SWO_MANCHESTER");
 	if (dap_caps & 0x10)
 		DEBUG_INFO(", Atomic Cmds");
+	if ((dap_caps & DAP_CAP_SWO_STREAMING) && swo_ep)
+		DEBUG_INFO(", SWO streaming");
 	if (has_swd_sequence)
 		DEBUG_INFO(", DAP_SWD_Sequence");
+	DEBUG_INFO(", %d byte packets", report_size - 1);
+	if (type == CMSIS_TYPE_BULK && packet_count > 1)
+		DEBUG_INFO(", %zu packets pipelined", packet_count);
 	DEBUG_INFO("\n");
 	return 0;
 }
@@ -273,29 +299,124 @@ void dap_exit_function(void)
 {
 	if (type == CMSIS_TYPE_HID) {
 		if (handle) {
+			dap_swo_stop();
 			dap_disconnect();
 			hid_close(handle);
 		}
 	} else if (type == CMSIS_TYPE_BULK) {
 		if (usb_handle) {
+			dap_swo_stop();
 			dap_disconnect();
 			libusb_close(usb_handle);
 		}
 	}
 }
 
+/* SWO transport in use, DAP_SWO_TRANSPORT_NONE while not capturing */
+static dap_swo_transport_t swo_transport;
+
+/*
+ * Set up and start trace capture. Bulk probes with a dedicated SWO endpoint
+ * stream the trace on it, all others have it fetched with DAP_SWO_Data.
+ */
+bool dap_swo_start(const dap_swo_mode_t mode, const uint32_t baudrate, uint32_t *const actual_baudrate)
+{
+	const uint8_t cap = mode == DAP_SWO_MODE_MANCHESTER ? DAP_CAP_SWO_MANCHESTER : DAP_CAP_SWO_UART;
+	if (!(dap_caps & cap)) {
+		DEBUG_WARN("Probe does not capture SWO in %s mode\n", mode == DAP_SWO_MODE_MANCHESTER ? "Manchester" : "UART");
+		return false;
+	}
+	dap_swo_stop();
+	const dap_swo_transport_t transport = (type == CMSIS_TYPE_BULK && swo_ep && (dap_caps & DAP_CAP_SWO_STREAMING)) ?
+		DAP_SWO_TRANSPORT_STREAM : DAP_SWO_TRANSPORT_DATA;
+	if (!dap_swo_transport(transport) || !dap_swo_mode(mode)) {
+		DEBUG_WARN("SWO setup failed\n");
+		return false;
+	}
+	*actual_baudrate = dap_swo_baudrate(baudrate);
+	if (!*actual_baudrate) {
+		DEBUG_WARN("Probe can not capture SWO at %" PRIu32 " baud\n", baudrate);
+		return false;
+	}
+	if (!dap_swo_control(true)) {
+		DEBUG_WARN("SWO start failed\n");
+		return false;
+	}
+	swo_transport = transport;
+	return true;
+}
+
+void dap_swo_stop(void)
+{
+	if (swo_transport == DAP_SWO_TRANSPORT_NONE)
+		return;
+	dap_swo_control(false);
+	dap_swo_mode(DAP_SWO_MODE_OFF);
+	swo_transport = DAP_SWO_TRANSPORT_NONE;
+}
+
+/* Read the trace captured so far, returns the number of bytes or -1 on error */
+int dap_swo_read(uint8_t *const data, const size_t size)
+{
+	if (swo_transport == DAP_SWO_TRANSPORT_STREAM) {
+		int transferred = 0;
+		const int res = libusb_bulk_transfer(usb_handle, swo_ep, data, (int)size, &transferred, 1);
+		if (res < 0 && res != LIBUSB_ERROR_TIMEOUT) {
+			DEBUG_WARN("SWO IN error: %d\n", res);
+			return -1;
+		}
+		return transferred;
+	}
+	if (swo_transport == DAP_SWO_TRANSPORT_DATA) {
+		uint8_t status = 0;
+		const size_t len = dap_swo_data(data, size, &status);
+		if (status & DAP_SWO_STATUS_OVERRUN)
+			DEBUG_WARN("SWO buffer overrun on the probe\n");
+		if (status & DAP_SWO_STATUS_ERROR)
+			return -1;
+		return (int)len;
+	}
+	return -1;
+}
+
 int dbg_get_report_size(void)
 {
 	return report_size;
 }
 
+static int dap_bulk_submit(const uint8_t *data, int len)
+{
+	int transferred = 0;
+	WIRE_TRACE(WIRE_TRACE_DAP_CMD, data[0], len);
+	const int res = libusb_bulk_transfer(usb_handle, out_ep, (uint8_t *)data, len, &transferred, TRANSFER_TIMEOUT_MS);
+	if (res < 0)
+		DEBUG_WARN("OUT error: %d\n", res);
+	return res;
+}
+
+/* Receive the response to cmd into buffer, returns the response length */
+static int dap_bulk_receive(uint8_t cmd)
+{
+	int transferred = 0;
+	/* We repeat the read in case we're out of step with the transmitter */
+	do {
+		const int res = libusb_bulk_transfer(usb_handle, in_ep, buffer, report_size, &transferred, TRANSFER_TIMEOUT_MS);
+		if (res < 0) {
+			DEBUG_WARN("IN error: %d\n", res);
+			return res;
+		}
+	} while (buffer[0] != cmd);
+	WIRE_TRACE(WIRE_TRACE_DAP_RESP, cmd, transferred);
+	return transferred;
+}
+
 int dbg_dap_cmd(uint8_t *data, int size, int rsize)
 
 {
 	char cmd = data[0];
 	int res = -1;
 
-	memset(buffer, 0xff, report_size + 1);
+	memset(buffer, 0xff, report_size);
 
 	buffer[0] = 0x00; // Report ID??
 	memcpy(&buffer[1], data, rsize);
@@ -305,13 +426,14 @@ int dbg_dap_cmd(uint8_t *data, int size, int rsize)
 		DEBUG_WIRE("%02x.",	buffer[i]);
 	DEBUG_WIRE("\n");
 	if (type == CMSIS_TYPE_HID) {
-		res = hid_write(handle, buffer, 65);
+		WIRE_TRACE(WIRE_TRACE_DAP_CMD, cmd, rsize);
+		res = hid_write(handle, buffer, report_size);
 		if (res < 0) {
 			DEBUG_WARN("Error: %ls\n", hid_error(handle));
 			exit(-1);
 		}
 		do {
-			res = hid_read_timeout(handle, buffer, 65, 1000);
+			res = hid_read_timeout(handle, buffer, report_size, 1000);
 			if (res < 0) {
 				DEBUG_WARN("debugger read(): %ls\n", hid_error(handle));
 				exit(-1);
@@ -320,24 +442,14 @@ int dbg_dap_cmd(uint8_t *data, int size, int rsize)
 				exit(-1);
 			}
 		} while (buffer[0] != cmd);
+		WIRE_TRACE(WIRE_TRACE_DAP_RESP, cmd, res);
 	} else if (type == CMSIS_TYPE_BULK) {
-		int transferred = 0;
-
-		res = libusb_bulk_transfer(usb_handle, out_ep, data, rsize, &transferred, TRANSFER_TIMEOUT_MS);
-		if (res < 0) {
-			DEBUG_WARN("OUT error: %d\n", res);
+		res = dap_bulk_submit(data, rsize);
+		if (res < 0)
+			return res;
+		res = dap_bulk_receive(cmd);
+		if (res < 0)
 			return res;
-		}
-
-		/* We repeat the read in case we're out of step with the transmitter */
-		do {
-			res = libusb_bulk_transfer(usb_handle, in_ep, buffer, report_size, &transferred, TRANSFER_TIMEOUT_MS);
-			if (res < 0) {
-				DEBUG_WARN("IN error: %d\n", res);
-				return res;
-			}
-		} while (buffer[0] != cmd);
-		res = transferred;
 	}
 	DEBUG_WIRE("cmd res:");
 	for (int i = 0; i < res; i++)
@@ -354,42 +466,216 @@ int dbg_dap_cmd(uint8_t *data, int size, int rsize)
 #define ALIGNOF(x) (((x) & 3) == 0 ? ALIGN_WORD :					\
                     (((x) & 1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
+/* Packet bytes a DAP_TransferBlock takes besides the data: command, index, count and request */
+#define DAP_BLOCK_OVERHEAD 5U
+/* A block sharing its packet with the access setup in a DAP_ExecuteCommands */
+#define DAP_BLOCK_READ_SETUP_OVERHEAD  10U
+#define DAP_BLOCK_WRITE_SETUP_OVERHEAD 28U
+
+/*
+ * Bytes of memory one DAP_TransferBlock moves in a packet of the negotiated size,
+ * each access taking a whole word of the packet, whatever its width.
+ */
+static size_t dap_block_max_size(enum align data_align, size_t overhead)
+{
+	return (((size_t)dbg_get_report_size() - 1U - overhead) >> (2U - data_align)) & ~3U;
+}
+
+/* A command in flight during a pipelined memory access */
+typedef struct dap_pipeline_entry {
+	uint8_t cmd;
+	uint32_t addr;
+	uint8_t *dest;
+	size_t len; /* 0 for the access setup */
+} dap_pipeline_entry_s;
+
+/*
+ * Memory access keeping up to packet_count commands in flight, for bulk probes.
+ * Requests go out as long as the probe has packet buffers free and responses
+ * are collected in order. After a failure no further requests are issued, and
+ * those in flight are drained before the link is recovered.
+ */
+static bool dap_mem_pipelined(ADIv5_AP_t *ap, uint8_t *dest, uint32_t addr, const uint8_t *src,
+	size_t len, enum align align, bool packed, bool write)
+{
+	const enum align data_align = packed ? ALIGN_WORD : align;
+	const size_t max_size = dap_block_max_size(data_align, DAP_BLOCK_OVERHEAD);
+	dap_pipeline_entry_s pipeline[DAP_PACKET_COUNT_MAX];
+	uint8_t request[1024];
+	size_t issued = 0;
+	size_t completed = 0;
+	size_t block_remaining = 0;
+	bool result = true;
+	uint8_t failure[3] = {0};
+	uint32_t failure_addr = 0;
+
+	while (true) {
+		while (result && len && issued - completed < packet_count) {
+			dap_pipeline_entry_s *const entry = &pipeline[issued % DAP_PACKET_COUNT_MAX];
+			size_t request_len;
+			entry->addr = addr;
+			if (!block_remaining) {
+				/* Calculate length until next access setup is needed */
+				block_remaining = MIN((addr | 0x3ffU) - addr + 1U, len);
+				request_len = dap_ap_mem_access_setup_request(ap, request, addr, align, packed);
+				/* Nothing to send if CSW and TAR are set up already */
+				if (!request_len)
+					continue;
+				entry->len = 0;
+			} else {
+				const size_t transfer_size = MIN(block_remaining, max_size);
+				if (write) {
+					request_len = dap_write_block_request(ap, request, addr, src, transfer_size, data_align);
+					src += transfer_size;
+				} else {
+					request_len = dap_read_block_request(ap, request, transfer_size, data_align);
+					entry->dest = dest;
+					dest += transfer_size;
+				}
+				entry->len = transfer_size;
+				block_remaining -= transfer_size;
+				len -= transfer_size;
+				addr += transfer_size;
+			}
+			entry->cmd = request[0];
+			if (dap_bulk_submit(request, request_len) < 0) {
+				result = false;
+				break;
+			}
+			++issued;
+		}
+		if (completed == issued)
+			break;
+
+		const dap_pipeline_entry_s *const entry = &pipeline[completed++ % DAP_PACKET_COUNT_MAX];
+		if (dap_bulk_receive(entry->cmd) < 0)
+			return false;
+		/* Like the unpipelined path, the access setup response is not checked */
+		if (!entry->len || !result)
+			continue;
+		const uint8_t *const response = buffer + 1;
+		const unsigned int res = write ? dap_write_block_response(response) :
+			dap_read_block_response(response, entry->dest, entry->addr, entry->len, data_align);
+		if (res) {
+			DEBUG_WIRE("pipelined mem access failed @ %08" PRIx32 "\n", entry->addr);
+			memcpy(failure, response, sizeof(failure));
+			failure_addr = entry->addr;
+			result = false;
+		}
+	}
+	if (!result)
+		dap_block_recover(ap->dp, failure, failure_addr, write);
+	else
+		adiv5_ap_shadow_tar_advance(ap, addr);
+	return result;
+}
+
+/*
+ * Move len bytes in accesses of the given width, or packed into whole words,
+ * returns false on failure. Each packet is filled up to the negotiated size,
+ * and blocks end at the 1kiB boundaries where TAR needs setting up again.
+ */
+static bool dap_mem_run(ADIv5_AP_t *ap, uint8_t *dest, uint32_t addr, const uint8_t *src, size_t len,
+	enum align align, bool packed, bool write)
+{
+	if (len == 0)
+		return true;
+	if (type == CMSIS_TYPE_BULK && packet_count > 1)
+		return dap_mem_pipelined(ap, dest, addr, src, len, align, packed, write);
+	const enum align data_align = packed ? ALIGN_WORD : align;
+	const size_t max_size = dap_block_max_size(data_align, DAP_BLOCK_OVERHEAD);
+	/* The first block shares its packet with the access setup, leaving less room */
+	const size_t setup_max_size = (dap_caps & DAP_CAP_ATOMIC_CMD) ?
+		dap_block_max_size(data_align, write ? DAP_BLOCK_WRITE_SETUP_OVERHEAD : DAP_BLOCK_READ_SETUP_OVERHEAD) :
+		max_size;
+	while (len) {
+		/* Calculate length until next access setup is needed */
+		size_t blocksize = MIN((addr | 0x3ffU) - addr + 1U, len);
+		bool setup = true;
+		while (blocksize) {
+			const size_t transfersize = MIN(blocksize, setup ? setup_max_size : max_size);
+			unsigned int res;
+			if (write)
+				res = setup ? dap_write_block_setup(ap, addr, src, transfersize, align, packed) :
+					dap_write_block(ap, addr, src, transfersize, data_align);
+			else
+				res = setup ? dap_read_block_setup(ap, dest, addr, transfersize, align, packed) :
+					dap_read_block(ap, dest, addr, transfersize, data_align);
+			setup = false;
+			if (res) {
+				DEBUG_WARN("mem_%s failed %02x\n", write ? "write" : "read", res);
+				return false;
+			}
+			if (write)
+				src += transfersize;
+			else
+				dest += transfersize;
+			blocksize -= transfersize;
+			len -= transfersize;
+			addr += transfersize;
+		}
+	}
+	adiv5_ap_shadow_tar_advance(ap, addr);
+	return true;
+}
+
+static bool dap_mem_read_run(ADIv5_AP_t *ap, uint8_t *dest, uint32_t src, size_t len, enum align align, bool packed)
+{
+	return dap_mem_run(ap, dest, src, NULL, len, align, packed, false);
+}
+
+/* Read the head or tail of a split access in the widest accesses each part of it allows */
+static bool dap_mem_read_edge(ADIv5_AP_t *ap, uint8_t *dest, uint32_t src, size_t len)
+{
+	while (len) {
+		const enum align align = adiv5_edge_align(src, len);
+		if (!dap_mem_read_run(ap, dest, src, 1U << align, align, false))
+			return false;
+		dest += 1U << align;
+		src += 1U << align;
+		len -= 1U << align;
+	}
+	return true;
+}
+
 static void dap_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
 	if (len == 0)
 		return;
+	uint8_t *data = dest;
+	size_t head;
+	const size_t words = adiv5_align_split(src, len, &head);
+	if (words) {
+		if (!dap_mem_read_edge(ap, data, src, head) ||
+			!dap_mem_read_run(ap, data + head, src + head, words, ALIGN_WORD, false) ||
+			!dap_mem_read_edge(ap, data + head + words, src + head + words, len - head - words))
+			ap->dp->fault = 1;
+		return;
+	}
 	enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
 	DEBUG_WIRE("memread @ %" PRIx32 " len %ld, align %d , start: \n",
 		   src, len, align);
 	if (((unsigned)(1 << align)) == len)
 		return dap_read_single(ap, dest, src, align);
-	/* One word transfer for every byte/halfword/word
-	 * Total number of bytes in transfer*/
-	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - align)) & ~3;
-	while (len) {
-		dap_ap_mem_access_setup(ap, src, align);
-		/* Calculate length until next access setup is needed */
-		unsigned int blocksize = (src | 0x3ff) - src + 1;
-		if (blocksize > len)
-			blocksize = len;
-		while (blocksize) {
-			unsigned int transfersize = blocksize;
-			if (transfersize > max_size)
-				transfersize = max_size;
-			unsigned int res = dap_read_block(ap, dest, src, transfersize,
-											  align);
-			if (res) {
-			    DEBUG_WIRE("mem_read failed %02x\n", res);
-				ap->dp->fault = 1;
-				return;
-			}
-			blocksize -= transfersize;
-			len       -= transfersize;
-			dest      += transfersize;
-			src       += transfersize;
+	const size_t body = adiv5_packed_split(ap, src, len, align, &head);
+	if (body) {
+		if (!dap_mem_read_run(ap, data, src, head, align, false) ||
+			!dap_mem_read_run(ap, data + head, src + head, body, align, true)) {
+			ap->dp->fault = 1;
+			return;
 		}
+		data += head + body;
+		src += head + body;
+		len -= head + body;
 	}
-    DEBUG_WIRE("memread res last data %08" PRIx32 "\n", ((uint32_t*)dest)[-1]);
+	if (!dap_mem_read_run(ap, data, src, len, align, false))
+		ap->dp->fault = 1;
+}
+
+static bool dap_mem_write_run(
+	ADIv5_AP_t *ap, uint32_t dest, const uint8_t *src, size_t len, enum align align, bool packed)
+{
+	return dap_mem_run(ap, NULL, dest, src, len, align, packed, true);
 }
 
 static void dap_mem_write_sized( ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
@@ -400,30 +686,25 @@ static void dap_mem_write_sized( ADIv5_AP_t *ap, uint32_t dest, const void *src,
 		dest, len, align, *(uint32_t *)src);
 	if (((unsigned)(1 << align)) == len)
 		return dap_write_single(ap, dest, src, align);
-	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - align) & ~3);
-	while (len) {
-		dap_ap_mem_access_setup(ap, dest, align);
-		unsigned int blocksize = (dest | 0x3ff) - dest + 1;
-		if (blocksize > len)
-			blocksize = len;
-		while (blocksize) {
-			unsigned int transfersize = blocksize;
-			if (transfersize > max_size)
-				transfersize = max_size;
-			unsigned int res = dap_write_block(ap, dest, src, transfersize,
-											   align);
-			if (res) {
-				DEBUG_WARN("mem_write failed %02x\n", res);
-				ap->dp->fault = 1;
-				return;
-			}
-			blocksize -= transfersize;
-			len       -= transfersize;
-			dest      += transfersize;
-			src       += transfersize;
+	const uint8_t *data = src;
+	size_t head;
+	const size_t body = adiv5_packed_split(ap, dest, len, align, &head);
+	if (body) {
+		if (!dap_mem_write_run(ap, dest, data, head, align, false) ||
+			!dap_mem_write_run(ap, dest + head, data + head, body, align, true)) {
+			DEBUG_WARN("mem_write failed\n");
+			ap->dp->fault = 1;
+			return;
 		}
+		data += head + body;
+		dest += head + body;
+		len -= head + body;
+	}
+	if (!dap_mem_write_run(ap, dest, data, len, align, false)) {
+		DEBUG_WARN("mem_write failed\n");
+		ap->dp->fault = 1;
+		return;
 	}
-
 	/* Make sure this write is complete by doing a dummy read */
 	adiv5_dp_read(ap->dp, ADIV5_DP_RDBUFF);
 	DEBUG_WIRE("memwrite done\n");
@@ -431,12 +712,15 @@ static void dap_mem_write_sized( ADIv5_AP_t *ap, uint32_t dest, const void *src,
 
 void dap_adiv5_dp_defaults(ADIv5_DP_t *dp)
 {
-	if ((mode == DAP_CAP_JTAG) && dap_jtag_configure())
+	/* A JTAG-DP left on raw scans has nothing the DAP_Transfer paths could address */
+	if (mode == DAP_CAP_JTAG && !jtag_configured)
 		return;
 	dp->ap_read  = dap_ap_read;
 	dp->ap_write = dap_ap_write;
 	dp->mem_read = dap_mem_read;
 	dp->mem_write_sized =  dap_mem_write_sized;
+	dp->queue_flush = dap_queue_flush;
+	dp->mem_poll32 = dap_mem_poll32;
 }
 
 static void cmsis_dap_jtagtap_reset(void)
@@ -481,6 +765,7 @@ int cmsis_dap_jtagtap_init(jtag_proc_t *jtag_proc)
 	if (!(dap_caps & DAP_CAP_JTAG))
 		return -1;
 	mode =  DAP_CAP_JTAG;
+	jtag_configured = false;
 	dap_disconnect();
 	dap_connect(true);
 	dap_reset_link(true);
@@ -492,12 +777,39 @@ int cmsis_dap_jtagtap_init(jtag_proc_t *jtag_proc)
 	return 0;
 }
 
+/* JTAG-DP sticky flags clear by writing them back to CTRL/STAT, its ABORT has no clear bits */
+static uint32_t dap_jtag_dp_error(ADIv5_DP_t *dp)
+{
+	const uint32_t ctrlstat = dap_read_reg(dp, ADIV5_DP_CTRLSTAT);
+	const uint32_t err = ctrlstat &
+		(ADIV5_DP_CTRLSTAT_STICKYORUN | ADIV5_DP_CTRLSTAT_STICKYCMP | ADIV5_DP_CTRLSTAT_STICKYERR);
+	dap_write_reg(dp, ADIV5_DP_CTRLSTAT, ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ | err);
+	dp->fault = 0;
+	return err;
+}
+
+/*
+ * Have the probe run the JTAG-DP protocol itself. Once it has the IR lengths
+ * of the chain, DAP_Transfer and DAP_TransferBlock reach the DP by its index
+ * and the probe pipelines the DPACC/APACC scans, rather than each going out
+ * as raw DAP_JTAG_Sequence bits. Returns false to leave the DP on those when
+ * the probe does not take the chain.
+ */
 int dap_jtag_dp_init(ADIv5_DP_t *dp)
 {
+	if (!jtag_configured) {
+		if (dap_jtag_configure()) {
+			DEBUG_WARN("DAP_JTAG_Configure failed, using JTAG sequences\n");
+			return false;
+		}
+		dap_transfer_configure(2, 128, DAP_MATCH_RETRY);
+		jtag_configured = true;
+	}
 	dp->dp_read = dap_dp_read_reg;
-	dp->error = dap_dp_error;
+	dp->error = dap_jtag_dp_error;
 	dp->low_access = dap_dp_low_access;
-	dp->abort = dap_dp_abort;
+	/* ABORT is not in the DPACC space on JTAG, it has its own instruction */
+	dp->abort = dap_write_abort;
 
 	return true;
 }
@@ -537,16 +849,19 @@ int dap_swdptap_init(ADIv5_DP_t *dp)
 	if (!(dap_caps & DAP_CAP_SWD))
 		return 1;
 	mode =  DAP_CAP_SWD;
-	dap_transfer_configure(2, 128, 128);
+	dap_transfer_configure(2, 128, DAP_MATCH_RETRY);
 	dap_swd_configure(0);
 	dap_connect(false);
 	dap_led(0, 1);
 	dap_reset_link(false);
-	if (has_swd_sequence)
+	if (has_swd_sequence) {
 		/* DAP_SWD_SEQUENCE does not do auto turnaround, use own!*/
 		dp->dp_low_write = dap_dp_low_write;
-	else
+		dp->swd_reset_read = dap_swd_reset_read;
+	} else {
 		dp->dp_low_write = NULL;
+		dp->swd_reset_read = NULL;
+	}
 	dp->seq_out = dap_swdptap_seq_out;
 	dp->dp_read = dap_dp_read_reg;
 	/* For error() use the TARGETID switching firmware_swdp_error */
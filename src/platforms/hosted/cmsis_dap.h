@@ -21,6 +21,7 @@
 #define PLATFORMS_HOSTED_CMSIS_DAP_H
 
 #include "adiv5.h"
+#include "dap.h"
 #include "cli.h"
 
 #if defined(CMSIS_DAP)
@@ -33,6 +34,9 @@ int dap_jtag_dp_init(ADIv5_DP_t *dp);
 uint32_t dap_swj_clock(uint32_t clock);
 void dap_swd_configure(uint8_t cfg);
 void dap_nrst_set_val(bool assert);
+bool dap_swo_start(dap_swo_mode_t mode, uint32_t baudrate, uint32_t *actual_baudrate);
+void dap_swo_stop(void);
+int dap_swo_read(uint8_t *data, size_t size);
 #else
 int dap_init(bmp_info_t *info)
 {
@@ -50,6 +54,9 @@ int dap_swdptap_init(ADIv5_DP_t *dp) { return -1; }
 int dap_jtag_dp_init(ADIv5_DP_t *dp) { return -1; }
 void dap_swd_configure(uint8_t cfg) { }
 void dap_nrst_set_val(bool assert) { }
+bool dap_swo_start(dap_swo_mode_t mode, uint32_t baudrate, uint32_t *actual_baudrate) { return false; }
+void dap_swo_stop(void) { }
+int dap_swo_read(uint8_t *data, size_t size) { return -1; }
 # pragma GCC diagnostic pop
 
 #endif
@@ -57,7 +57,15 @@ enum
 	ID_DAP_JTAG_SEQUENCE      = 0x14,
 	ID_DAP_JTAG_CONFIGURE     = 0x15,
 	ID_DAP_JTAG_IDCODE        = 0x16,
+	ID_DAP_SWO_TRANSPORT      = 0x17,
+	ID_DAP_SWO_MODE           = 0x18,
+	ID_DAP_SWO_BAUDRATE       = 0x19,
+	ID_DAP_SWO_CONTROL        = 0x1A,
+	ID_DAP_SWO_STATUS         = 0x1B,
+	ID_DAP_SWO_DATA           = 0x1C,
 	ID_DAP_SWD_SEQUENCE       = 0x1D,
+	ID_DAP_QUEUE_COMMANDS     = 0x7E,
+	ID_DAP_EXECUTE_COMMANDS   = 0x7F,
 };
 
 enum
@@ -270,6 +278,76 @@ size_t dap_info(const dap_info_t info, uint8_t *const data, const size_t size)
 	return rsize;
 }
 
+//-----------------------------------------------------------------------------
+bool dap_swo_transport(const dap_swo_transport_t transport)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_TRANSPORT;
+	buf[1] = transport;
+	dbg_dap_cmd(buf, sizeof(buf), 2);
+	return buf[0] == DAP_OK;
+}
+
+//-----------------------------------------------------------------------------
+bool dap_swo_mode(const dap_swo_mode_t mode)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_MODE;
+	buf[1] = mode;
+	dbg_dap_cmd(buf, sizeof(buf), 2);
+	return buf[0] == DAP_OK;
+}
+
+/* Set the SWO line rate, returns the rate the probe has set up or 0 if it can not */
+uint32_t dap_swo_baudrate(const uint32_t baudrate)
+{
+	uint8_t buf[5];
+
+	buf[0] = ID_DAP_SWO_BAUDRATE;
+	buf[1] = baudrate & 0xff;
+	buf[2] = (baudrate >> 8) & 0xff;
+	buf[3] = (baudrate >> 16) & 0xff;
+	buf[4] = (baudrate >> 24) & 0xff;
+	dbg_dap_cmd(buf, sizeof(buf), 5);
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+//-----------------------------------------------------------------------------
+bool dap_swo_control(const bool start)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_CONTROL;
+	buf[1] = start ? 1 : 0;
+	dbg_dap_cmd(buf, sizeof(buf), 2);
+	return buf[0] == DAP_OK;
+}
+
+/*
+ * Fetch captured trace data through the command channel, at most size bytes.
+ * Returns the number of bytes copied to data, the trace status goes to status.
+ */
+size_t dap_swo_data(uint8_t *const data, const size_t size, uint8_t *const status)
+{
+	uint8_t buf[1024];
+	const size_t max_size = MIN((size_t)dbg_get_report_size() - 5U, sizeof(buf) - 3U);
+	const size_t count = MIN(size, max_size);
+
+	buf[0] = ID_DAP_SWO_DATA;
+	buf[1] = count & 0xff;
+	buf[2] = (count >> 8) & 0xff;
+	if (dbg_dap_cmd(buf, sizeof(buf), 3) < 0) {
+		*status = DAP_SWO_STATUS_ERROR;
+		return 0;
+	}
+	*status = buf[0];
+	const size_t received = MIN((size_t)(buf[1] | (buf[2] << 8)), count);
+	memcpy(data, buf + 3, received);
+	return received;
+}
+
 void dap_reset_pin(int state)
 {
 	uint8_t buf[7];
@@ -303,8 +381,9 @@ void dap_trst_reset(void)
 	dbg_dap_cmd(buf, sizeof(buf), 7);
 }
 
-static void dap_line_reset(void)
+static void dap_line_reset(ADIv5_DP_t *dp)
 {
+	adiv5_shadow_invalidate(dp);
 	uint8_t buf[] = {
 		ID_DAP_SWJ_SEQUENCE,
 		64,
@@ -322,7 +401,36 @@ static void dap_line_reset(void)
 		DEBUG_WARN("line reset failed\n");
 }
 
-static uint32_t wait_word(uint8_t *buf, int size, int len, uint8_t *dp_fault)
+/*
+ * Send two commands in one DAP_ExecuteCommands packet if the probe supports
+ * atomic commands, otherwise one after the other. Like dbg_dap_cmd(), each
+ * buffer holds the request on entry and the response after the command byte
+ * on return, first_response_len being the size of the first response.
+ */
+static void dap_execute_pair(uint8_t *first, size_t first_len, size_t first_response_len,
+	uint8_t *second, size_t second_size, size_t second_len)
+{
+	if (dap_caps & DAP_CAP_ATOMIC_CMD) {
+		uint8_t buf[1024];
+		buf[0] = ID_DAP_EXECUTE_COMMANDS;
+		buf[1] = 2;
+		memcpy(buf + 2, first, first_len);
+		memcpy(buf + 2 + first_len, second, second_len);
+		dbg_dap_cmd(buf, sizeof(buf), 2 + first_len + second_len);
+		/* Response: command count, then each command byte followed by its response */
+		if (buf[0] == 2 && buf[1] == first[0] && buf[2 + first_response_len] == second[0]) {
+			memcpy(first, buf + 2, first_response_len);
+			memcpy(second, buf + 3 + first_response_len, second_size);
+			return;
+		}
+		DEBUG_WARN("DAP_ExecuteCommands failed, sending commands separately\n");
+		dap_caps &= ~DAP_CAP_ATOMIC_CMD;
+	}
+	dbg_dap_cmd(first, first_response_len, first_len);
+	dbg_dap_cmd(second, second_size, second_len);
+}
+
+static uint32_t wait_word(uint8_t *buf, int size, int len, ADIv5_DP_t *dp)
 {
 	uint8_t cmd_copy[len];
 	memcpy(cmd_copy, buf, len);
@@ -334,12 +442,14 @@ static uint32_t wait_word(uint8_t *buf, int size, int len, uint8_t *dp_fault)
 	} while (buf[1] == DAP_TRANSFER_WAIT);
 
 	if(buf[1] == SWDP_ACK_FAULT) {
-		*dp_fault = 1;
+		dp->fault = 1;
 		return 0;
 	}
 
-	if(buf[1] != SWDP_ACK_OK)
-		raise_exception(EXCEPTION_ERROR, "SWDP invalid ACK");
+	if(buf[1] != SWDP_ACK_OK) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP invalid ACK");
+		return 0;
+	}
 	uint32_t res =
 		((uint32_t)buf[5] << 24) | ((uint32_t)buf[4] << 16) |
 		((uint32_t)buf[3] << 8) | (uint32_t)buf[2];
@@ -356,7 +466,7 @@ uint32_t dap_read_reg(ADIv5_DP_t *dp, uint8_t reg)
 	buf[1] = dap_index;
 	buf[2] = 0x01; // Request size
 	buf[3] = reg | DAP_TRANSFER_RnW;
-	uint32_t res = wait_word(buf, 8, 4, &dp->fault);
+	uint32_t res = wait_word(buf, 8, 4, dp);
 	DEBUG_WIRE("\tdap_read_reg %02x %08x\n", reg, res);
 	return res;
 }
@@ -393,35 +503,41 @@ void dap_write_reg(ADIv5_DP_t *dp, uint8_t reg, uint32_t data)
 	if (buf[1] == DAP_TRANSFER_ERROR) {
 		DEBUG_WARN("dap_write_reg %02x data %08x: protocoll error\n",
 					reg, data);
-		dap_line_reset();
+		dap_line_reset(dp);
 	}
 }
 
-unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
-							size_t len, enum align align)
+/* Build a DAP_TransferBlock request reading len bytes from DRW, returns the request length */
+size_t dap_read_block_request(ADIv5_AP_t *ap, uint8_t *buf, size_t len, enum align align)
 {
-	uint8_t buf[1024];
 	unsigned int sz = len >> align;
 	uint8_t dap_index = 0;
 	dap_index = ap->dp->dp_jd_index;
-    buf[0] = ID_DAP_TRANSFER_BLOCK;
-    buf[1] = dap_index;
-    buf[2] =  sz & 0xff;
-    buf[3] = (sz >> 8) & 0xff;
-    buf[4] = SWD_AP_DRW | DAP_TRANSFER_RnW;
-    dbg_dap_cmd(buf, 1023, 5);
+	buf[0] = ID_DAP_TRANSFER_BLOCK;
+	buf[1] = dap_index;
+	buf[2] =  sz & 0xff;
+	buf[3] = (sz >> 8) & 0xff;
+	buf[4] = SWD_AP_DRW | DAP_TRANSFER_RnW;
+	adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
+	return 5;
+}
+
+/*
+ * Unpack the response to dap_read_block_request(), returns non-zero on failure.
+ * This does not touch the link, the caller recovers with dap_block_recover().
+ */
+unsigned int dap_read_block_response(const uint8_t *buf, void *dest, uint32_t src,
+									 size_t len, enum align align)
+{
+	unsigned int sz = len >> align;
 	unsigned int transferred = buf[0] + (buf[1] << 8);
-	if (buf[2] >= DAP_TRANSFER_FAULT) {
-		DEBUG_WARN("dap_read_block @ %08" PRIx32 " fault -> line reset\n", src);
-		dap_line_reset();
-	}
 	if (sz != transferred)
 		return 1;
 
 	if (align > ALIGN_HALFWORD)
 		memcpy(dest, &buf[3], len);
 	else {
-		uint32_t *p = (uint32_t *)&buf[3];
+		const uint32_t *p = (const uint32_t *)&buf[3];
 		while(sz) {
 			dest = extract(dest, src, *p, align);
 			p++;
@@ -432,18 +548,50 @@ unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
 	return (buf[2] > DAP_TRANSFER_WAIT) ? 1 : 0;
 }
 
-unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
-							 size_t len, enum align align)
+unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
+							size_t len, enum align align)
+{
+	uint8_t buf[DAP_PACKET_SIZE_MAX];
+	const size_t request_len = dap_read_block_request(ap, buf, len, align);
+	dbg_dap_cmd(buf, sizeof(buf) - 1U, request_len);
+	dap_block_recover(ap->dp, buf, src, false);
+	return dap_read_block_response(buf, dest, src, len, align);
+}
+
+/*
+ * dap_ap_mem_access_setup() followed by dap_read_block(), in one packet where possible.
+ * Packed transfers move whole words, each holding several accesses of the given width.
+ */
+unsigned int dap_read_block_setup(ADIv5_AP_t *ap, void *dest, uint32_t src,
+								  size_t len, enum align align, bool packed)
+{
+	uint8_t setup[63];
+	const size_t setup_len = dap_ap_mem_access_setup_request(ap, setup, src, align, packed);
+	if (packed)
+		align = ALIGN_WORD;
+	uint8_t buf[DAP_PACKET_SIZE_MAX];
+	const size_t request_len = dap_read_block_request(ap, buf, len, align);
+	if (setup_len)
+		dap_execute_pair(setup, setup_len, 2, buf, sizeof(buf) - 1U, request_len);
+	else
+		dbg_dap_cmd(buf, sizeof(buf) - 1U, request_len);
+	dap_block_recover(ap->dp, buf, src, false);
+	return dap_read_block_response(buf, dest, src, len, align);
+}
+
+/* Build a DAP_TransferBlock request writing len bytes to DRW, returns the request length */
+size_t dap_write_block_request(ADIv5_AP_t *ap, uint8_t *buf, uint32_t dest, const void *src,
+							   size_t len, enum align align)
 {
-	uint8_t buf[1024];
 	unsigned int sz = len >> align;
 	uint8_t dap_index = 0;
 	dap_index = ap->dp->dp_jd_index;
-    buf[0] = ID_DAP_TRANSFER_BLOCK;
-    buf[1] = dap_index;
-    buf[2] =  sz & 0xff;
-    buf[3] = (sz >> 8) & 0xff;
-    buf[4] = SWD_AP_DRW;
+	buf[0] = ID_DAP_TRANSFER_BLOCK;
+	buf[1] = dap_index;
+	buf[2] =  sz & 0xff;
+	buf[3] = (sz >> 8) & 0xff;
+	buf[4] = SWD_AP_DRW;
+	adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
 	if (align > ALIGN_HALFWORD)
 		memcpy(&buf[5], src, len);
 	else {
@@ -463,13 +611,121 @@ unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 			*p++ = tmp;
 		}
 	}
-	dbg_dap_cmd(buf, 1023, 5 + (sz << 2U));
-	if (buf[2] > DAP_TRANSFER_FAULT) {
-		dap_line_reset();
-	}
+	return 5 + (sz << 2U);
+}
+
+/* Check the response to dap_write_block_request(), returns non-zero on failure */
+unsigned int dap_write_block_response(const uint8_t *buf)
+{
 	return (buf[2] > DAP_TRANSFER_WAIT) ? 1 : 0;
 }
 
+/* dap_ap_mem_access_setup() followed by dap_write_block(), in one packet where possible */
+unsigned int dap_write_block_setup(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+								   size_t len, enum align align, bool packed)
+{
+	uint8_t setup[63];
+	const size_t setup_len = dap_ap_mem_access_setup_request(ap, setup, dest, align, packed);
+	if (packed)
+		align = ALIGN_WORD;
+	uint8_t buf[DAP_PACKET_SIZE_MAX];
+	const size_t request_len = dap_write_block_request(ap, buf, dest, src, len, align);
+	if (setup_len)
+		dap_execute_pair(setup, setup_len, 2, buf, sizeof(buf) - 1U, request_len);
+	else
+		dbg_dap_cmd(buf, sizeof(buf) - 1U, request_len);
+	dap_block_recover(ap->dp, buf, dest, true);
+	return dap_write_block_response(buf);
+}
+
+/* Reset the line if a DAP_TransferBlock response reports the link is out of step */
+void dap_block_recover(ADIv5_DP_t *dp, const uint8_t *buf, uint32_t addr, bool write)
+{
+	if (write) {
+		if (buf[2] > DAP_TRANSFER_FAULT)
+			dap_line_reset(dp);
+	} else if (buf[2] >= DAP_TRANSFER_FAULT) {
+		DEBUG_WARN("dap_read_block @ %08" PRIx32 " fault -> line reset\n", addr);
+		dap_line_reset(dp);
+	}
+}
+
+unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+							 size_t len, enum align align)
+{
+	uint8_t buf[DAP_PACKET_SIZE_MAX];
+	const size_t request_len = dap_write_block_request(ap, buf, dest, src, len, align);
+	dbg_dap_cmd(buf, sizeof(buf) - 1U, request_len);
+	dap_block_recover(ap->dp, buf, dest, true);
+	return dap_write_block_response(buf);
+}
+
+/*
+ * Issue the DP's transfer queue as DAP_Transfer commands, packing as many
+ * requests into each packet as the request and response both fit.
+ * The probe resolves WAIT and the posted AP read results itself.
+ */
+bool dap_queue_flush(ADIv5_DP_t *dp)
+{
+	const size_t packet_size = dbg_get_report_size() - 1U;
+	size_t start = 0;
+	while (start < dp->queue_len) {
+		uint8_t buf[1024];
+		buf[0] = ID_DAP_TRANSFER;
+		buf[1] = dp->dp_jd_index;
+		size_t request_len = 3;
+		size_t response_len = 3;
+		size_t count = 0;
+		for (size_t i = start; i < dp->queue_len && count < 255U; ++i, ++count) {
+			const adiv5_transfer_s *const transfer = &dp->queue[i];
+			if (request_len + (transfer->RnW ? 1U : 5U) > packet_size ||
+				response_len + (transfer->RnW ? 4U : 0U) > packet_size)
+				break;
+			buf[request_len++] = (transfer->addr & 0x0cU) | ((transfer->addr & ADIV5_APnDP) ? DAP_TRANSFER_APnDP : 0) |
+				(transfer->RnW ? DAP_TRANSFER_RnW : 0);
+			if (transfer->RnW)
+				response_len += 4U;
+			else {
+				buf[request_len++] = transfer->value & 0xff;
+				buf[request_len++] = (transfer->value >> 8) & 0xff;
+				buf[request_len++] = (transfer->value >> 16) & 0xff;
+				buf[request_len++] = (transfer->value >> 24) & 0xff;
+			}
+		}
+		buf[2] = count;
+		dbg_dap_cmd(buf, sizeof(buf), request_len);
+
+		/* Reads that completed carry their data, in order, even if a later transfer failed */
+		const size_t done = MIN(buf[0], count);
+		const uint8_t *data = &buf[2];
+		for (size_t i = start; i < start + count; ++i) {
+			const adiv5_transfer_s *const transfer = &dp->queue[i];
+			if (!transfer->RnW)
+				continue;
+			if (i < start + done) {
+				*transfer->result = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+				data += 4;
+			} else
+				*transfer->result = 0;
+		}
+		DEBUG_PROBE("dap_queue_flush %zu of %zu transfers, ack %02x\n", done, count, buf[1]);
+		if (done != count || buf[1] != DAP_TRANSFER_OK) {
+			DEBUG_WARN("dap_queue_flush failed after %zu transfers, ack %02x\n", done, buf[1]);
+			dp->fault = 1;
+			if (buf[1] == DAP_TRANSFER_ERROR)
+				dap_line_reset(dp);
+			/* Leave the reads that never ran well defined */
+			for (size_t i = start + count; i < dp->queue_len; ++i) {
+				if (dp->queue[i].RnW)
+					*dp->queue[i].result = 0;
+			}
+			return false;
+		}
+		start += count;
+	}
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 void dap_reset_link(bool jtag)
 {
@@ -503,16 +759,17 @@ void dap_reset_link(bool jtag)
 		*p++ = 0x00;
 		buf[1] = (p - buf + 2) * 8;
 	}
-	dbg_dap_cmd(buf, sizeof(buf), p - buf);
-
 	if (!jtag) {
 		//-------------
-		buf[0] = ID_DAP_TRANSFER;
-		buf[1] = 0; // DAP index
-		buf[2] = 1; // Request size
-		buf[3] = SWD_DP_R_IDCODE | DAP_TRANSFER_RnW;
-		dbg_dap_cmd(buf, sizeof(buf), 4);
-	}
+		/* The IDCODE read completing the reset goes out with the sequence */
+		uint8_t idcode[8];
+		idcode[0] = ID_DAP_TRANSFER;
+		idcode[1] = 0; // DAP index
+		idcode[2] = 1; // Request size
+		idcode[3] = SWD_DP_R_IDCODE | DAP_TRANSFER_RnW;
+		dap_execute_pair(buf, p - buf, 1, idcode, sizeof(idcode), 4);
+	} else
+		dbg_dap_cmd(buf, sizeof(buf), p - buf);
 }
 
 //-----------------------------------------------------------------------------
@@ -521,10 +778,33 @@ uint32_t dap_read_idcode(ADIv5_DP_t *dp)
 	return dap_read_reg(dp, SWD_DP_R_IDCODE);
 }
 
+/* Append a register write to a DAP_Transfer request and count it in *count */
+static uint8_t *transfer_write(uint8_t *p, uint8_t *count, uint8_t reg, uint32_t value)
+{
+	*p++ = reg;
+	*p++ = (value >>  0) & 0xff;
+	*p++ = (value >>  8) & 0xff;
+	*p++ = (value >> 16) & 0xff;
+	*p++ = (value >> 24) & 0xff;
+	++*count;
+	return p;
+}
+
+/* Select the AP bank holding addr, unless the SELECT shadow says it already is */
+static uint8_t *transfer_select(ADIv5_AP_t *ap, uint8_t *p, uint8_t *count, uint16_t addr)
+{
+	const uint32_t select = ((uint32_t)ap->apsel << 24) | (addr & 0xF0);
+	if (adiv5_dp_select_shadowed(ap->dp, select))
+		return p;
+	adiv5_dp_select_shadow(ap->dp, select);
+	return transfer_write(p, count, SWD_DP_W_SELECT, select);
+}
+
+/* Build a DAP_Transfer request with the SELECT, CSW and TAR writes not shadowed already */
 static uint8_t *mem_access_setup(ADIv5_AP_t *ap, uint8_t *p,
-								 uint32_t addr, enum align align)
+								 uint32_t addr, enum align align, uint32_t addrinc)
 {
-	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	uint32_t csw = ap->csw | addrinc;
 	switch (align) {
 	case ALIGN_BYTE:
 		csw |= ADIV5_AP_CSW_SIZE_BYTE;
@@ -541,30 +821,37 @@ static uint8_t *mem_access_setup(ADIv5_AP_t *ap, uint8_t *p,
 	dap_index = ap->dp->dp_jd_index;
 	*p++ = ID_DAP_TRANSFER;
 	*p++ = dap_index;
-	*p++ = 3; /* Nr transfers */
-	*p++ = SWD_DP_W_SELECT;
-	*p++ = ADIV5_AP_CSW & 0xF0;
-	*p++ = 0;
-	*p++ = 0;
-	*p++ = ap->apsel & 0xff;
-	*p++ = SWD_AP_CSW;
-	*p++ = (csw >>  0) & 0xff;
-	*p++ = (csw >>  8) & 0xff;
-	*p++ = (csw >> 16) & 0xff;
-	*p++ = (csw >> 24) & 0xff;
-	*p++ = SWD_AP_TAR ;
-	*p++ = (addr >>  0) & 0xff;
-	*p++ = (addr >>  8) & 0xff;
-	*p++ = (addr >> 16) & 0xff;
-	*p++ = (addr >> 24) & 0xff;
+	uint8_t *const count = p++; /* Nr transfers */
+	*count = 0;
+	p = transfer_select(ap, p, count, ADIV5_AP_CSW);
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_CSW, csw)) {
+		p = transfer_write(p, count, SWD_AP_CSW, csw);
+		adiv5_ap_shadow_write(ap, ADIV5_AP_CSW, csw);
+	}
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_TAR, addr)) {
+		p = transfer_write(p, count, SWD_AP_TAR, addr);
+		adiv5_ap_shadow_write(ap, ADIV5_AP_TAR, addr);
+	}
 	return p;
 }
 
+/*
+ * Build the DAP_Transfer request setting up CSW and TAR, returns the request
+ * length or 0 when the shadows show no setup is needed
+ */
+size_t dap_ap_mem_access_setup_request(ADIv5_AP_t *ap, uint8_t *buf, uint32_t addr, enum align align, bool packed)
+{
+	const size_t len =
+		mem_access_setup(ap, buf, addr, align, packed ? ADIV5_AP_CSW_ADDRINC_PACKED : ADIV5_AP_CSW_ADDRINC_SINGLE) - buf;
+	return buf[2] ? len : 0;
+}
+
 void dap_ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
 {
 	uint8_t buf[63];
-	uint8_t *p = mem_access_setup(ap, buf, addr, align);
-	dbg_dap_cmd(buf, sizeof(buf), p - buf);
+	const size_t request_len = dap_ap_mem_access_setup_request(ap, buf, addr, align, false);
+	if (request_len)
+		dbg_dap_cmd(buf, sizeof(buf), request_len);
 }
 
 uint32_t dap_ap_read(ADIv5_AP_t *ap, uint16_t addr)
@@ -576,17 +863,17 @@ uint32_t dap_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 	dap_index = ap->dp->dp_jd_index;
 	*p++ = ID_DAP_TRANSFER;
 	*p++ = dap_index;
-	*p++ = 2; /* Nr transfers */
-	*p++ = SWD_DP_W_SELECT;
-	*p++ = (addr & 0xF0);
-	*p++ = 0;
-	*p++ = 0;
-	*p++ = ap->apsel & 0xff;
+	uint8_t *const count = p++; /* Nr transfers */
+	*count = 0;
+	p = transfer_select(ap, p, count, addr);
 	*p++ = (addr & 0x0c) | DAP_TRANSFER_RnW  |
 		((addr & 0x100) ?  DAP_TRANSFER_APnDP : 0);
-	uint32_t res = wait_word(buf, 63, p - buf, &ap->dp->fault);
-	if ((buf[0] != 2) || (buf[1] != 1)) {
+	const uint8_t transfers = ++*count;
+	adiv5_ap_shadow_read(ap, addr);
+	uint32_t res = wait_word(buf, 63, p - buf, ap->dp);
+	if ((buf[0] != transfers) || (buf[1] != 1)) {
 		DEBUG_WARN("dap_ap_read error %x\n", buf[1]);
+		adiv5_shadow_invalidate(ap->dp);
 	}
 	return res;
 }
@@ -599,40 +886,37 @@ void dap_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 	dap_index = ap->dp->dp_jd_index;
 	*p++ = ID_DAP_TRANSFER;
 	*p++ = dap_index;
-	*p++ = 2; /* Nr transfers */
-	*p++ = SWD_DP_W_SELECT;
-	*p++ = (addr & 0xF0);
-	*p++ = 0;
-	*p++ = 0;
-	*p++ = ap->apsel & 0xff;
-	*p++ = (addr & 0x0c) | ((addr & 0x100) ?  DAP_TRANSFER_APnDP : 0);
-	*p++ = (value >>  0) & 0xff;
-	*p++ = (value >>  8) & 0xff;
-	*p++ = (value >> 16) & 0xff;
-	*p++ = (value >> 24) & 0xff;
+	uint8_t *const count = p++; /* Nr transfers */
+	*count = 0;
+	p = transfer_select(ap, p, count, addr);
+	p = transfer_write(p, count, (addr & 0x0c) | ((addr & 0x100) ?  DAP_TRANSFER_APnDP : 0), value);
+	const uint8_t transfers = *count;
+	adiv5_ap_shadow_write(ap, addr, value);
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
-	if ((buf[0] != 2) || (buf[1] != 1)) {
+	if ((buf[0] != transfers) || (buf[1] != 1)) {
 		DEBUG_WARN("dap_ap_write error %x\n", buf[1]);
+		adiv5_shadow_invalidate(ap->dp);
 	}
 }
 
 void dap_read_single(ADIv5_AP_t *ap, void *dest, uint32_t src, enum align align)
 {
 	uint8_t buf[63];
-	uint8_t *p = mem_access_setup(ap, buf, src, align);
+	uint8_t *p = mem_access_setup(ap, buf, src, align, ADIV5_AP_CSW_ADDRINC_SINGLE);
 	*p++ = SWD_AP_DRW | DAP_TRANSFER_RnW;
 	*p++ = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
-	buf[2] = 5;
-	uint32_t tmp = wait_word(buf, 63, p - buf, &ap->dp->fault);
+	buf[2] += 2;
+	adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
+	uint32_t tmp = wait_word(buf, 63, p - buf, ap->dp);
 	dest = extract(dest, src, tmp, align);
+	adiv5_ap_shadow_tar_advance(ap, src + (1U << align));
 }
 
 void dap_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 					  enum align align)
 {
 	uint8_t buf[63];
-	uint8_t *p = mem_access_setup(ap, buf, dest, align);
-	*p++ = SWD_AP_DRW;
+	uint8_t *p = mem_access_setup(ap, buf, dest, align, ADIV5_AP_CSW_ADDRINC_SINGLE);
 	uint32_t tmp = 0;
 	/* Pack data into correct data lane */
 	switch (align) {
@@ -647,12 +931,53 @@ void dap_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 		tmp = *(uint32_t *)src;
 		break;
 	}
-	*p++ = (tmp >>  0) & 0xff;
-	*p++ = (tmp >>  8) & 0xff;
-	*p++ = (tmp >> 16) & 0xff;
-	*p++ = (tmp >> 24) & 0xff;
-	buf[2] = 4;
+	p = transfer_write(p, &buf[2], SWD_AP_DRW, tmp);
+	const uint8_t transfers = buf[2];
+	adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
+	dbg_dap_cmd(buf, sizeof(buf), p - buf);
+	if (buf[0] != transfers || buf[1] != DAP_TRANSFER_OK) {
+		/* The write did not complete, CSW and TAR may not hold their shadows */
+		adiv5_shadow_invalidate(ap->dp);
+		return;
+	}
+	adiv5_ap_shadow_tar_advance(ap, dest + (1U << align));
+}
+
+/*
+ * Read the word at addr until it matches value under mask, the probe doing
+ * the retries itself, up to the DAP_MATCH_RETRY set with
+ * DAP_TransferConfigure. CSW goes without address increment so every read
+ * of DRW is of the same word. A match read returns no data, and a mismatch
+ * leaves it as the one transfer of the request not done.
+ */
+bool dap_mem_poll32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t value)
+{
+	uint8_t buf[63];
+	uint8_t *p = mem_access_setup(ap, buf, addr, ALIGN_WORD, ADIV5_AP_CSW_ADDRINC_NONE);
+	p = transfer_write(p, &buf[2], DAP_TRANSFER_MATCH_MASK, mask);
+	p = transfer_write(p, &buf[2], SWD_AP_DRW | DAP_TRANSFER_RnW | DAP_TRANSFER_MATCH_VALUE, value);
+	const uint8_t transfers = buf[2];
+	adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
+	const uint8_t ack = buf[1] & ~DAP_TRANSFER_MISMATCH;
+	DEBUG_PROBE("dap_mem_poll32 %08" PRIx32 " %u of %u transfers, ack %02x\n", addr, buf[0], transfers, buf[1]);
+	if (buf[0] == transfers && buf[1] == DAP_TRANSFER_OK) {
+		adiv5_ap_shadow_write(ap, ADIV5_AP_TAR, addr);
+		return true;
+	}
+	/* The setup did not all complete, CSW and TAR may not hold their shadows */
+	if (buf[0] + 1U < transfers)
+		adiv5_shadow_invalidate(ap->dp);
+	else
+		adiv5_ap_shadow_write(ap, ADIV5_AP_TAR, addr);
+	/* A mismatch or a target still answering WAIT is only not there yet */
+	if (ack == DAP_TRANSFER_FAULT)
+		ap->dp->fault = 1;
+	else if (ack != DAP_TRANSFER_OK && ack != DAP_TRANSFER_WAIT) {
+		dap_line_reset(ap->dp);
+		adiv5_dp_raise(ap->dp, EXCEPTION_ERROR, "SWDP invalid ACK");
+	}
+	return false;
 }
 
 void dap_jtagtap_tdi_tdo_seq(
@@ -756,14 +1081,32 @@ int dap_jtag_configure(void)
 	}
 	if ((!i || i >= JTAG_MAX_DEVS))
 		return -1;
-	buf[0] = 0x15;
+	buf[0] = ID_DAP_JTAG_CONFIGURE;
 	buf[1] = i;
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
-	if (buf[0] != DAP_OK)
+	if (buf[0] != DAP_OK) {
 		DEBUG_WARN("dap_jtag_configure Failed %02x\n", buf[0]);
+		return -1;
+	}
 	return 0;
 }
 
+/* Write ABORT with DAP_WriteABORT, which on JTAG shifts the ABORT instruction for the DP */
+void dap_write_abort(ADIv5_DP_t *dp, uint32_t abort)
+{
+	uint8_t buf[6] = {
+		ID_DAP_WRITE_ABORT,
+		dp->dp_jd_index,
+		abort & 0xff,
+		(abort >> 8) & 0xff,
+		(abort >> 16) & 0xff,
+		(abort >> 24) & 0xff,
+	};
+	dbg_dap_cmd(buf, sizeof(buf), sizeof(buf));
+	if (buf[0] != DAP_OK)
+		DEBUG_WARN("dap_write_abort failed %02x\n", buf[0]);
+}
+
 void dap_swdptap_seq_out(uint32_t tms_states, size_t clock_cycles)
 {
 	/* clang-format off */
@@ -800,6 +1143,108 @@ void dap_swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles)
 }
 
 #define SWD_SEQUENCE_IN 0x80
+
+/* One DAP_SWD_Sequence command being built: a count, then per sequence its info byte and any output data */
+typedef struct dap_swd_seq {
+	uint8_t buf[DAP_PACKET_SIZE_MAX];
+	size_t len;
+	size_t response_len; /* Bytes the input sequences so far capture into the response */
+} dap_swd_seq_s;
+
+static void dap_swd_seq_init(dap_swd_seq_s *seq)
+{
+	seq->buf[0] = ID_DAP_SWD_SEQUENCE;
+	seq->buf[1] = 0;
+	seq->len = 2;
+	seq->response_len = 0;
+}
+
+/* Append up to 64 bits to clock out, LSB first */
+static void dap_swd_seq_out(dap_swd_seq_s *seq, uint64_t data, size_t cycles)
+{
+	/* A cycle count of 0 means 64 */
+	seq->buf[seq->len++] = cycles & 0x3fU;
+	for (size_t i = 0; i < (cycles + 7U) >> 3U; ++i)
+		seq->buf[seq->len++] = (data >> (8U * i)) & 0xffU;
+	++seq->buf[1];
+}
+
+/* Append up to 64 bits to capture, returns where they will be in the response data */
+static size_t dap_swd_seq_in(dap_swd_seq_s *seq, size_t cycles)
+{
+	const size_t offset = seq->response_len;
+	seq->buf[seq->len++] = (cycles & 0x3fU) | SWD_SEQUENCE_IN;
+	seq->response_len += (cycles + 7U) >> 3U;
+	++seq->buf[1];
+	return offset;
+}
+
+/*
+ * Clock out cycles bits of bits, 32 to a word. While nothing is captured yet a
+ * command about to outgrow the packet goes out first and a new one is started.
+ */
+static void dap_swd_seq_out_bits(dap_swd_seq_s *seq, const uint32_t *bits, size_t cycles)
+{
+	const size_t packet_size = dbg_get_report_size() - 1U;
+	for (size_t i = 0; i < cycles; i += 64U) {
+		if (seq->len + 9U > packet_size && !seq->response_len) {
+			dbg_dap_cmd(seq->buf, sizeof(seq->buf), seq->len);
+			dap_swd_seq_init(seq);
+		}
+		const size_t count = MIN(cycles - i, 64U);
+		uint64_t data = bits[i / 32U];
+		if (count > 32U)
+			data |= (uint64_t)bits[i / 32U + 1U] << 32U;
+		dap_swd_seq_out(seq, data, count);
+	}
+}
+
+/*
+ * Wake-up or switch sequence, line reset, TARGETSEL write and the DPIDR read
+ * completing them in one DAP_SWD_Sequence, rather than a DAP_SWJ_Sequence per
+ * piece and a DAP_Transfer for the read. The probe does not look at the ACKs
+ * in a sequence, so they are checked here.
+ */
+bool dap_swd_reset_read(ADIv5_DP_t *dp, const uint32_t *seq, size_t cycles, const uint32_t *targetsel, uint32_t *dpidr)
+{
+	(void)dp;
+	dap_swd_seq_s swd;
+	dap_swd_seq_init(&swd);
+	dap_swd_seq_out_bits(&swd, seq, cycles);
+	/* Line reset, 60 cycles high then 4 idle */
+	dap_swd_seq_out(&swd, 0x0fffffffffffffffULL, 64U);
+	if (targetsel) {
+		dap_swd_seq_out(&swd, make_packet_request(ADIV5_LOW_WRITE, ADIV5_DP_TARGETSEL & 0xfU), 8U);
+		/* Turnaround and the ACK that no drop drives */
+		dap_swd_seq_in(&swd, 4U);
+		/* Turnaround, then the data and its parity */
+		dap_swd_seq_out(&swd, ((uint64_t)*targetsel << 1U) | ((uint64_t)(__builtin_parity(*targetsel) & 1) << 33U), 34U);
+	}
+	dap_swd_seq_out(&swd, make_packet_request(ADIV5_LOW_READ, ADIV5_DP_DPIDR), 8U);
+	/* Turnaround, ACK, data and parity */
+	const size_t offset = dap_swd_seq_in(&swd, 37U);
+	/* Turnaround back and idle cycles */
+	dap_swd_seq_out(&swd, 0, 8U);
+	dbg_dap_cmd(swd.buf, sizeof(swd.buf), swd.len);
+	if (swd.buf[0] != DAP_OK) {
+		DEBUG_WARN("dap_swd_reset_read failed\n");
+		return false;
+	}
+
+	const uint8_t *const response = swd.buf + 1U + offset;
+	uint64_t bits = 0;
+	for (size_t i = 0; i < 5U; ++i)
+		bits |= (uint64_t)response[i] << (8U * i);
+	const uint32_t ack = (bits >> 1U) & 7U;
+	const uint32_t value = (bits >> 4U) & 0xffffffffU;
+	if (ack != SWDP_ACK_OK || ((__builtin_parity(value) ^ (bits >> 36U)) & 1U)) {
+		DEBUG_PROBE("dap_swd_reset_read ack %" PRIx32 "\n", ack);
+		return false;
+	}
+	*dpidr = value;
+	return true;
+}
+
 uint32_t dap_swdptap_seq_in(int ticks)
 {
 	uint8_t buf[5] = {
@@ -58,9 +58,34 @@ typedef enum dap_cap_e {
 	DAP_CAP_SWO_STREAMING = (1 << 6),
 } dap_cap_t;
 
+typedef enum dap_swo_transport_e {
+	DAP_SWO_TRANSPORT_NONE = 0,
+	DAP_SWO_TRANSPORT_DATA = 1,   /* fetched with DAP_SWO_Data */
+	DAP_SWO_TRANSPORT_STREAM = 2, /* streamed on the dedicated endpoint */
+} dap_swo_transport_t;
+
+typedef enum dap_swo_mode_e {
+	DAP_SWO_MODE_OFF = 0,
+	DAP_SWO_MODE_UART = 1,
+	DAP_SWO_MODE_MANCHESTER = 2,
+} dap_swo_mode_t;
+
+/* DAP_SWO_Data trace status */
+#define DAP_SWO_STATUS_ACTIVE  (1U << 0U)
+#define DAP_SWO_STATUS_ERROR   (1U << 6U)
+#define DAP_SWO_STATUS_OVERRUN (1U << 7U)
+
+/* Largest packet a probe may report with DAP_INFO_PACKET_SIZE that is used */
+#define DAP_PACKET_SIZE_MAX 1024U
+
+extern uint8_t dap_caps;
+
 void dap_led(int index, int state);
 void dap_connect(bool jtag);
 void dap_disconnect(void);
+/* Reads the probe repeats for a value match before it answers a mismatch, see dap_mem_poll32() */
+#define DAP_MATCH_RETRY 128U
+
 void dap_transfer_configure(uint8_t idle, uint16_t count, uint16_t retry);
 void dap_swd_configure(uint8_t cfg);
 size_t dap_info(dap_info_t info, uint8_t *data, size_t size);
@@ -74,16 +99,37 @@ void dap_write_reg(ADIv5_DP_t *dp, uint8_t reg, uint32_t data);
 void dap_reset_link(bool jtag);
 uint32_t dap_read_idcode(ADIv5_DP_t *dp);
 unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len, enum align align);
+unsigned int dap_read_block_setup(
+	ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len, enum align align, bool packed);
+size_t dap_read_block_request(ADIv5_AP_t *ap, uint8_t *buf, size_t len, enum align align);
+unsigned int dap_read_block_response(const uint8_t *buf, void *dest, uint32_t src, size_t len, enum align align);
 unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align);
+unsigned int dap_write_block_setup(
+	ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align, bool packed);
+size_t dap_write_block_request(
+	ADIv5_AP_t *ap, uint8_t *buf, uint32_t dest, const void *src, size_t len, enum align align);
+unsigned int dap_write_block_response(const uint8_t *buf);
+void dap_block_recover(ADIv5_DP_t *dp, const uint8_t *buf, uint32_t addr, bool write);
 void dap_ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align);
+size_t dap_ap_mem_access_setup_request(ADIv5_AP_t *ap, uint8_t *buf, uint32_t addr, enum align align, bool packed);
 uint32_t dap_ap_read(ADIv5_AP_t *ap, uint16_t addr);
 void dap_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
 void dap_read_single(ADIv5_AP_t *ap, void *dest, uint32_t src, enum align align);
 void dap_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src, enum align align);
+bool dap_mem_poll32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t value);
+bool dap_queue_flush(ADIv5_DP_t *dp);
+bool dap_swo_transport(dap_swo_transport_t transport);
+bool dap_swo_mode(dap_swo_mode_t mode);
+uint32_t dap_swo_baudrate(uint32_t baudrate);
+bool dap_swo_control(bool start);
+size_t dap_swo_data(uint8_t *data, size_t size, uint8_t *status);
 int dbg_dap_cmd(uint8_t *data, int size, int rsize);
+int dbg_get_report_size(void);
 void dap_jtagtap_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t *tms, const uint8_t *data_in, size_t clock_cycles);
 int dap_jtag_configure(void);
+void dap_write_abort(ADIv5_DP_t *dp, uint32_t abort);
 void dap_swdptap_seq_out(uint32_t tms_states, size_t clock_cycles);
+bool dap_swd_reset_read(ADIv5_DP_t *dp, const uint32_t *seq, size_t cycles, const uint32_t *targetsel, uint32_t *dpidr);
 void dap_swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
 
 #endif /* PLATFORMS_HOSTED_DAP_H */
@@ -0,0 +1,348 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Flash content cache: the CRC32 of every sector of a part's Flash the host knows the contents
+ * of, in a file per device unique ID. A Flash session loads the record and removes the file, so
+ * a session that never ends cleanly leaves nothing to be trusted, and stores it back at its end.
+ * Every erase or write made forgets the sectors it touched until differential flashing records
+ * what they were left holding.
+ *
+ * Anything else writing the Flash, the firmware itself or another tool, is not seen. So the first
+ * time a record is used in a session a few of its sectors, picked at random, are checked against
+ * the target's CRC and the record for that Flash is dropped if one differs.
+ */
+
+#include "general.h"
+#include <errno.h>
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(__CYGWIN__)
+#include <direct.h>
+#endif
+#include "target_internal.h"
+#include "crc32.h"
+#include "flash_cache.h"
+
+#define FLASH_CACHE_MAGIC   "blackmagic flash cache 1\n"
+#define FLASH_CACHE_SAMPLES 3U
+#define FLASH_CACHE_PATH_MAX 512U
+
+bool flash_cache_enabled;
+
+typedef struct flash_cache_region {
+	target_addr_t start;
+	size_t length;
+	size_t blocksize;
+	bool checked;   /* sampled against the target this session */
+	uint32_t *crc;  /* per sector */
+	uint8_t *known; /* bitmap of the sectors crc holds for */
+} flash_cache_region_s;
+
+struct flash_cache {
+	char path[FLASH_CACHE_PATH_MAX];
+	size_t count;
+	flash_cache_region_s regions[];
+};
+
+static uint32_t flash_cache_seed;
+
+static uint32_t flash_cache_random(void)
+{
+	if (!flash_cache_seed)
+		flash_cache_seed = platform_time_ms() | 1U;
+	/* xorshift32 */
+	flash_cache_seed ^= flash_cache_seed << 13U;
+	flash_cache_seed ^= flash_cache_seed >> 17U;
+	flash_cache_seed ^= flash_cache_seed << 5U;
+	return flash_cache_seed;
+}
+
+/* $BMP_FLASH_CACHE_DIR, else the user's cache directory */
+static bool flash_cache_path(target *t, char *path, size_t size)
+{
+	uint8_t uid[TARGET_UID_MAX];
+	const size_t uid_len = t->unique_id ? t->unique_id(t, uid) : 0;
+	if (!uid_len || uid_len > TARGET_UID_MAX)
+		return false;
+	const char *dir = getenv("BMP_FLASH_CACHE_DIR");
+	const char *sub = "";
+	if (!dir || !dir[0]) {
+#if defined(_WIN32) || defined(__CYGWIN__)
+		dir = getenv("LOCALAPPDATA");
+		sub = "/blackmagic";
+#else
+		dir = getenv("XDG_CACHE_HOME");
+		sub = "/blackmagic";
+		if (!dir || !dir[0]) {
+			dir = getenv("HOME");
+			sub = "/.cache/blackmagic";
+		}
+#endif
+	}
+	if (!dir || !dir[0])
+		return false;
+	char uid_hex[TARGET_UID_MAX * 2U + 1U];
+	for (size_t i = 0; i < uid_len; ++i)
+		snprintf(uid_hex + i * 2U, 3U, "%02x", uid[i]);
+	const int len = snprintf(path, size, "%s%s/flash-%s.txt", dir, sub, uid_hex);
+	return len > 0 && (size_t)len < size;
+}
+
+/* Create the directories leading up to the file */
+static void flash_cache_mkdirs(char *path)
+{
+	for (char *p = path + 1; *p; ++p) {
+		if (*p != '/' && *p != '\\')
+			continue;
+		const char separator = *p;
+		*p = '\0';
+#if defined(_WIN32) || defined(__CYGWIN__)
+		_mkdir(path);
+#else
+		mkdir(path, 0700);
+#endif
+		*p = separator;
+	}
+}
+
+static flash_cache_region_s *flash_cache_region(const target_flash_s *f)
+{
+	flash_cache_s *const cache = f->t->flash_cache;
+	if (!cache)
+		return NULL;
+	for (size_t i = 0; i < cache->count; ++i) {
+		if (cache->regions[i].start == f->start)
+			return &cache->regions[i];
+	}
+	return NULL;
+}
+
+static bool flash_cache_is_known(const flash_cache_region_s *region, size_t sector)
+{
+	return region->known[sector / 8U] & (1U << (sector % 8U));
+}
+
+static size_t flash_cache_sectors(const flash_cache_region_s *region)
+{
+	return region->length / region->blocksize;
+}
+
+static void flash_cache_free(flash_cache_s *cache)
+{
+	for (size_t i = 0; i < cache->count; ++i) {
+		free(cache->regions[i].crc);
+		free(cache->regions[i].known);
+	}
+	free(cache);
+}
+
+static void flash_cache_load(flash_cache_s *cache, FILE *file)
+{
+	char line[80];
+	if (!fgets(line, sizeof(line), file) || strcmp(line, FLASH_CACHE_MAGIC))
+		return;
+	flash_cache_region_s *region = NULL;
+	while (fgets(line, sizeof(line), file)) {
+		uint32_t start;
+		uint32_t length;
+		uint32_t blocksize;
+		uint32_t sector;
+		uint32_t crc;
+		if (sscanf(line, "region %" SCNx32 " %" SCNx32 " %" SCNx32, &start, &length, &blocksize) == 3) {
+			/* A record of a different layout, from another driver version say, is of no use */
+			region = NULL;
+			for (size_t i = 0; i < cache->count; ++i) {
+				flash_cache_region_s *const candidate = &cache->regions[i];
+				if (candidate->start == start && candidate->length == length && candidate->blocksize == blocksize)
+					region = candidate;
+			}
+		} else if (region && sscanf(line, "%" SCNx32 " %" SCNx32, &sector, &crc) == 2 &&
+			sector < flash_cache_sectors(region)) {
+			region->crc[sector] = crc;
+			region->known[sector / 8U] |= 1U << (sector % 8U);
+		}
+	}
+}
+
+void flash_cache_open(target *t)
+{
+	if (t->flash_cache || !t->flash)
+		return;
+	char path[FLASH_CACHE_PATH_MAX];
+	if (!flash_cache_path(t, path, sizeof(path)))
+		return;
+	FILE *const file = fopen(path, "r");
+	/* Devices already cached stay up to date whether asked for or not */
+	if (!file && !flash_cache_enabled)
+		return;
+
+	size_t count = 0;
+	for (target_flash_s *f = t->flash; f; f = f->next)
+		++count;
+	flash_cache_s *const cache = calloc(1, sizeof(*cache) + count * sizeof(cache->regions[0]));
+	if (!cache) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		if (file)
+			fclose(file);
+		return;
+	}
+	memcpy(cache->path, path, sizeof(path));
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		flash_cache_region_s *const region = &cache->regions[cache->count++];
+		region->start = f->start;
+		region->length = f->length;
+		region->blocksize = f->blocksize;
+		const size_t sectors = flash_cache_sectors(region);
+		region->crc = calloc(sectors, sizeof(*region->crc));
+		region->known = calloc((sectors + 7U) / 8U, 1U);
+		if (!region->crc || !region->known) { /* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			flash_cache_free(cache);
+			if (file)
+				fclose(file);
+			return;
+		}
+	}
+	if (file) {
+		flash_cache_load(cache, file);
+		fclose(file);
+		remove(path);
+	}
+	t->flash_cache = cache;
+}
+
+void flash_cache_close(target *t)
+{
+	flash_cache_s *const cache = t->flash_cache;
+	if (!cache)
+		return;
+	t->flash_cache = NULL;
+
+	char tmp_path[FLASH_CACHE_PATH_MAX + 4U];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+	flash_cache_mkdirs(tmp_path);
+	FILE *const file = fopen(tmp_path, "w");
+	if (!file) {
+		DEBUG_WARN("Can not store the flash cache to %s: %s\n", tmp_path, strerror(errno));
+		flash_cache_free(cache);
+		return;
+	}
+	bool ok = fputs(FLASH_CACHE_MAGIC, file) >= 0;
+	for (size_t i = 0; ok && i < cache->count; ++i) {
+		const flash_cache_region_s *const region = &cache->regions[i];
+		ok = fprintf(file, "region %08" PRIx32 " %" PRIx32 " %" PRIx32 "\n", region->start, (uint32_t)region->length,
+				 (uint32_t)region->blocksize) > 0;
+		for (size_t sector = 0; ok && sector < flash_cache_sectors(region); ++sector) {
+			if (flash_cache_is_known(region, sector))
+				ok = fprintf(file, "%zx %08" PRIx32 "\n", sector, region->crc[sector]) > 0;
+		}
+	}
+	ok &= fclose(file) == 0;
+	/* Only a whole record takes the place of the one loaded */
+	if (!ok || rename(tmp_path, cache->path)) {
+		DEBUG_WARN("Can not store the flash cache to %s: %s\n", cache->path, strerror(errno));
+		remove(tmp_path);
+	}
+	flash_cache_free(cache);
+}
+
+/* CRC32 of a sector holding data, or erased for data NULL */
+static uint32_t flash_cache_crc(const target_flash_s *f, const uint8_t *data)
+{
+	if (data)
+		return crc32_buffer(0xffffffffU, data, f->blocksize);
+	uint8_t erased[256];
+	memset(erased, f->erased, sizeof(erased));
+	uint32_t crc = 0xffffffffU;
+	for (size_t offset = 0; offset < f->blocksize; offset += sizeof(erased))
+		crc = crc32_buffer(crc, erased, MIN(sizeof(erased), f->blocksize - offset));
+	return crc;
+}
+
+/* Check a few sectors of the record at random against the target, drop it all if one differs */
+static void flash_cache_check(target_flash_s *f, flash_cache_region_s *region)
+{
+	region->checked = true;
+	const size_t sectors = flash_cache_sectors(region);
+	size_t known = 0;
+	for (size_t sector = 0; sector < sectors; ++sector)
+		known += flash_cache_is_known(region, sector);
+	for (size_t sample = 0; sample < MIN(FLASH_CACHE_SAMPLES, known); ++sample) {
+		size_t pick = flash_cache_random() % known;
+		size_t sector = 0;
+		for (; sector < sectors; ++sector) {
+			if (flash_cache_is_known(region, sector) && !pick--)
+				break;
+		}
+		const target_addr_t addr = f->start + sector * f->blocksize;
+		uint32_t crc;
+		if (!target_flash_sector_crc(f, addr, &crc) || crc != region->crc[sector]) {
+			DEBUG_WARN("Flash at 0x%08" PRIx32 " changed since it was cached, comparing every sector\n", addr);
+			memset(region->known, 0, (sectors + 7U) / 8U);
+			return;
+		}
+	}
+}
+
+bool flash_cache_holds(target_flash_s *f, target_addr_t sector, const uint8_t *data)
+{
+	flash_cache_region_s *const region = flash_cache_region(f);
+	if (!region)
+		return false;
+	const size_t index = (sector - f->start) / f->blocksize;
+	if (!flash_cache_is_known(region, index))
+		return false;
+	if (!region->checked)
+		flash_cache_check(f, region);
+	return flash_cache_is_known(region, index) && region->crc[index] == flash_cache_crc(f, data);
+}
+
+void flash_cache_store(target_flash_s *f, target_addr_t sector, const uint8_t *data)
+{
+	flash_cache_region_s *const region = flash_cache_region(f);
+	if (!region)
+		return;
+	const size_t index = (sector - f->start) / f->blocksize;
+	region->crc[index] = flash_cache_crc(f, data);
+	region->known[index / 8U] |= 1U << (index % 8U);
+}
+
+void flash_cache_forget(target_flash_s *f, target_addr_t addr, size_t len)
+{
+	flash_cache_region_s *const region = flash_cache_region(f);
+	if (!region || !len)
+		return;
+	const size_t first = (addr - f->start) / f->blocksize;
+	if (first >= flash_cache_sectors(region))
+		return;
+	const size_t last = MIN((addr - f->start + len - 1U) / f->blocksize, flash_cache_sectors(region) - 1U);
+	for (size_t sector = first; sector <= last; ++sector)
+		region->known[sector / 8U] &= ~(1U << (sector % 8U));
+}
+
+void flash_cache_drop(target *t)
+{
+	flash_cache_s *const cache = t->flash_cache;
+	if (cache) {
+		for (size_t i = 0; i < cache->count; ++i)
+			memset(cache->regions[i].known, 0, (flash_cache_sectors(&cache->regions[i]) + 7U) / 8U);
+		return;
+	}
+	char path[FLASH_CACHE_PATH_MAX];
+	if (flash_cache_path(t, path, sizeof(path)))
+		remove(path);
+}
@@ -262,6 +262,7 @@ cable_desc_t cable_desc[] = {
 		.init.ddr_low = PIN4,
 		.init.data_high = PIN3 | PIN1 | PIN0,
 		.init.ddr_high =  PIN4 | PIN3 | PIN1 | PIN0,
+		.rtck = true,
 		.name = "arm-usb-ocd-h"
 	},
 	{
@@ -341,6 +342,7 @@ cable_desc_t cable_desc[] = {
 		.assert_nrst.ddr_high    =  PIN2,
 		.deassert_nrst.data_high =  PIN2,
 		.deassert_nrst.ddr_high  = ~PIN2,
+		.rtck = true,
 		.name = "arm-usb-tiny-h",
 		.description = "Olimex OpenOCD JTAG ARM-USB-TINY-H",
 	},
@@ -464,6 +466,8 @@ int ftdi_bmp_init(BMP_CL_OPTIONS_t *cl_opts, bmp_info_t *info)
 	case TYPE_4232H:
 	case TYPE_232H:
 		ftdi_init[index++] = DIS_DIV_5;
+		/* TCK waits for each RTCK edge, the divisor only sets the upper limit */
+		ftdi_init[index++] = cl_opts->opt_rtck && active_cable->rtck ? EN_ADAPTIVE : DIS_ADAPTIVE;
 		break;
 	case TYPE_2232C:
 		break;
@@ -471,6 +475,12 @@ int ftdi_bmp_init(BMP_CL_OPTIONS_t *cl_opts, bmp_info_t *info)
 		DEBUG_WARN("FTDI Chip has no MPSSE\n");
 		goto error_2;
 	}
+	if (cl_opts->opt_rtck) {
+		if (active_cable->rtck && ftdic->type != TYPE_2232C)
+			DEBUG_INFO("Using adaptive clocking on RTCK\n");
+		else
+			DEBUG_WARN("Cable %s can not do adaptive clocking, using a fixed TCK\n", active_cable->name);
+	}
 	ftdi_init[index++]= TCK_DIVISOR;
 	/* Use CLK/2 for about 50 % SWDCLK duty cycle on FT2232c.*/
 	ftdi_init[index++]= 1;
@@ -629,40 +639,48 @@ int libftdi_buffer_read(uint8_t *data, int size)
 	return size;
 }
 
+/* Bytes of TDO the FTDI buffers before it stops clocking, read back after each such chunk */
+#define MPSSE_READ_CHUNK 4096U
+/* Largest length of one MPSSE byte mode command */
+#define MPSSE_BYTES_MAX  65536U
+
 void libftdi_jtagtap_tdi_tdo_seq(uint8_t *DO, const bool final_tms, const uint8_t *DI, size_t ticks)
 {
-	int rsize, rticks;
-
 	if (!ticks)
 		return;
 	if (!DI && !DO)
 		return;
 
 	DEBUG_WIRE("libftdi_jtagtap_tdi_tdo_seq %s ticks: %d\n",
-			   (DI && DO) ? "read/write" : ((DI) ? "write" : "read"), ticks);
+			   (DI && DO) ? "read/write" : ((DI) ? "write" : "read"), (int)ticks);
 	if (final_tms)
 		--ticks;
-	rticks = ticks & 7;
-	ticks >>= 3;
+	const size_t rticks = ticks & 7U;
+	const size_t bytes = ticks >> 3U;
 	uint8_t data[8];
 	uint8_t cmd =  ((DO)? MPSSE_DO_READ : 0) |
 		((DI)? (MPSSE_DO_WRITE | MPSSE_WRITE_NEG) : 0) | MPSSE_LSB;
-	rsize = ticks;
-	if (ticks) {
+	/* Byte mode for the aligned bulk, bit mode only for the remainder */
+	const size_t chunk = DO ? MPSSE_READ_CHUNK : MPSSE_BYTES_MAX;
+	for (size_t offset = 0; offset < bytes; offset += chunk) {
+		const size_t count = MIN(bytes - offset, chunk);
 		data[0] = cmd;
-		data[1] = ticks - 1;
-		data[2] = 0;
+		data[1] = (count - 1U) & 0xffU;
+		data[2] = (count - 1U) >> 8U;
 		libftdi_buffer_write(data, 3);
 		if (DI)
-			libftdi_buffer_write(DI, ticks);
+			libftdi_buffer_write(DI + offset, count);
+		if (DO)
+			libftdi_buffer_read(DO + offset, count);
 	}
 	int index = 0;
+	int rsize = 0;
 	if (rticks) {
 		rsize++;
 		data[index++] = cmd | MPSSE_BITMODE;
 		data[index++] = rticks - 1;
 		if (DI)
-			data[index++] = DI[ticks];
+			data[index++] = DI[bytes];
 	}
 	if (final_tms) {
 		rsize++;
@@ -670,30 +688,18 @@ void libftdi_jtagtap_tdi_tdo_seq(uint8_t *DO, const bool final_tms, const uint8_
 			MPSSE_LSB | MPSSE_BITMODE | MPSSE_WRITE_NEG;
 		data[index++] = 0;
 		if (DI)
-			data[index++] = (DI[ticks] & (1 << rticks)) ? 0x81 : 0x01;
+			data[index++] = (DI[bytes] & (1 << rticks)) ? 0x81 : 0x01;
 	}
 	if (index)
 		libftdi_buffer_write(data, index);
-	if (DO) {
-		int index = 0;
-		uint8_t *tmp = alloca(rsize);
+	if (DO && rsize) {
+		uint8_t tmp[2];
 		libftdi_buffer_read(tmp, rsize);
-		if(final_tms) rsize--;
-
-		while (rsize--)
-			*DO++ = tmp[index++];
-		if (rticks == 0)
-			*DO++ = 0;
-
-		if (final_tms) {
-			rticks++;
-			*(--DO) >>= 1;
-			*DO |= tmp[index] & 0x80;
-		} else
-			--DO;
-
-		if (rticks)
-			*DO >>= (8-rticks);
+		/* Bit mode shifts TDO in from the top of the byte */
+		uint8_t value = rticks ? tmp[0] >> (8U - rticks) : 0;
+		if (final_tms)
+			value |= (tmp[rsize - 1] & 0x80U) >> (7U - rticks);
+		DO[bytes] = value;
 	}
 }
 
@@ -93,6 +93,8 @@ typedef struct cable_desc_s {
 	uint8_t target_voltage_cmd;
 	/* Pin to check target voltage.*/
 	uint8_t target_voltage_pin;
+	/* Target RTCK is wired to GPIOL3 (ADBUS7) for adaptive clocking.*/
+	bool rtck;
 	/* USB readable description of the device.*/
 	char *description;
 	/* Command line argument to -c option to select this device.*/
@@ -20,7 +20,9 @@
 
 /* This file implements a transparent channel over which the GDB Remote
  * Serial Debugging protocol is implemented.  This implementation for Linux
- * uses a TCP server on port 2000.
+ * uses a TCP server on port 2000, and the ports after it for further GDB
+ * sessions, one per target. Alternatively the one session is on stdin and
+ * stdout, for GDB to start us with "target remote | blackmagic --stdio".
  */
 
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -42,12 +44,179 @@
 #include <unistd.h>
 
 #include "gdb_if.h"
+#include "gdb_packet.h"
 
-static int gdb_if_serv, gdb_if_conn;
 #define DEFAULT_PORT 2000
 #define NUM_GDB_SERVER 4
+
+/* Sized for a full hex encoded packet buffer, so a reply leaves in one send() */
+#define GDB_IF_TX_BUFFER_SIZE 16384U
+#define GDB_IF_RX_BUFFER_SIZE 4096U
+#define GDB_IF_SNDBUF_SIZE    (256 * 1024)
+
+#if !defined(MSG_MORE)
+#define MSG_MORE 0
+#endif
+
+/* A listening port and the GDB connected to it */
+typedef struct gdb_if_session {
+	int serv;
+	int conn;
+	int port;
+	/* Received bytes are taken in one recv() per burst and handed out from here */
+	uint8_t rx_buf[GDB_IF_RX_BUFFER_SIZE];
+	size_t rx_pos;
+	size_t rx_len;
+#if defined(__WIN32__) || defined(__CYGWIN__)
+	char tx_buf[GDB_IF_TX_BUFFER_SIZE];
+#else
+	uint8_t tx_buf[GDB_IF_TX_BUFFER_SIZE];
+#endif
+	int tx_len;
+	/* For the stdio session the pipe output, conn being its input, -1 for sockets */
+	int out;
+} gdb_if_session_s;
+
+static gdb_if_session_s gdb_if_sessions[GDB_IF_SESSIONS];
+static size_t gdb_if_listening;
+/* The session gdb_if_getchar() and gdb_if_putchar() work on, see gdb_if_select() */
+static gdb_if_session_s *gdb_if = gdb_if_sessions;
+static int gdb_if_stdio_in = -1;
+static int gdb_if_stdio_out = -1;
+
+/* Send the whole of data on the current session, looping on the partial writes of a pipe */
+static void gdb_if_send(const void *const data, const size_t len, const int flags)
+{
+	if (gdb_if->out == -1) {
+		send(gdb_if->conn, data, len, flags);
+		return;
+	}
+	const uint8_t *bytes = data;
+	for (size_t sent = 0; sent < len;) {
+		const ssize_t res = write(gdb_if->out, bytes + sent, len - sent);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			return;
+		sent += res;
+	}
+}
+
+static ssize_t gdb_if_recv(void)
+{
+	if (gdb_if->out == -1)
+		return recv(gdb_if->conn, (void *)gdb_if->rx_buf, sizeof(gdb_if->rx_buf), 0);
+	ssize_t res;
+	do
+		res = read(gdb_if->conn, gdb_if->rx_buf, sizeof(gdb_if->rx_buf));
+	while (res < 0 && errno == EINTR);
+	return res;
+}
+
+static void gdb_if_conn_setup(void)
+{
+	/* Not every system passes these on from the listening socket */
+	int opt = 1;
+	if (setsockopt(gdb_if->conn, IPPROTO_TCP, TCP_NODELAY, (void *)&opt, sizeof(opt)) == -1)
+		DEBUG_WARN("Failed to set TCP_NODELAY on the GDB connection\n");
+	opt = GDB_IF_SNDBUF_SIZE;
+	if (setsockopt(gdb_if->conn, SOL_SOCKET, SO_SNDBUF, (void *)&opt, sizeof(opt)) == -1)
+		DEBUG_WARN("Failed to enlarge the GDB connection send buffer\n");
+	gdb_if->rx_pos = 0;
+	gdb_if->rx_len = 0;
+	gdb_if->tx_len = 0;
+}
+
+/* Listen on port, returns the socket or -1 */
+static int gdb_if_listen(const int port)
+{
+	struct sockaddr_in addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	const int serv = socket(PF_INET, SOCK_STREAM, 0);
+	if (serv == -1) {
+		DEBUG_WARN("PF_INET %d\n", serv);
+		return -1;
+	}
+
+	int opt = 1;
+	if (setsockopt(serv, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(opt)) == -1) {
+#if defined(_WIN32) || defined(__CYGWIN__)
+		DEBUG_WARN("error setsockopt SOL_SOCKET : %d error: %d\n", serv,
+		WSAGetLastError());
+#else
+		DEBUG_WARN("error setsockopt SOL_SOCKET : %d error: %d\n", serv,
+		strerror(errno));
+#endif
+		close(serv);
+		return -1;
+	}
+	if (setsockopt(serv, IPPROTO_TCP, TCP_NODELAY, (void*)&opt, sizeof(opt)) == -1) {
+#if defined(_WIN32) || defined(__CYGWIN__)
+		DEBUG_WARN("error setsockopt IPPROTO_TCP : %d error: %d\n", serv,
+		WSAGetLastError());
+#else
+		DEBUG_WARN("error setsockopt IPPROTO_TCP : %d error: %d\n", serv,
+		strerror(errno));
+#endif
+		close(serv);
+		return -1;
+	}
+	if (bind(serv, (void*)&addr, sizeof(addr)) == -1) {
+#if defined(_WIN32) || defined(__CYGWIN__)
+		DEBUG_WARN("error when binding socket: %d error: %d\n", serv,
+		WSAGetLastError());
+#else
+		DEBUG_WARN("error when binding socket: %d error: %d\n", serv,
+		strerror(errno));
+#endif
+		close(serv);
+		return -1;
+	}
+	if (listen(serv, 1) == -1) {
+		DEBUG_WARN("listen closed %d\n", serv);
+		close(serv);
+		return -1;
+	}
+	return serv;
+}
+
+bool gdb_if_use_stdio(void)
+{
+#if defined(_WIN32) || defined(__CYGWIN__)
+	DEBUG_WARN("GDB on stdio is not available on Windows\n");
+	return false;
+#else
+	/* Keep the real stdin and stdout for GDB and send all other output to stderr */
+	fflush(stdout);
+	gdb_if_stdio_in = dup(STDIN_FILENO);
+	gdb_if_stdio_out = dup(STDOUT_FILENO);
+	if (gdb_if_stdio_in < 0 || gdb_if_stdio_out < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		DEBUG_WARN("Can not set up GDB on stdio: %s\n", strerror(errno));
+		return false;
+	}
+#if defined(F_SETPIPE_SZ)
+	/* Like the socket send buffer, so a burst of replies does not stall on a slow reader */
+	fcntl(gdb_if_stdio_out, F_SETPIPE_SZ, GDB_IF_SNDBUF_SIZE);
+#endif
+	return true;
+#endif
+}
+
 int gdb_if_init(void)
 {
+	if (gdb_if_stdio_in != -1) {
+		gdb_if_session_s *const session = &gdb_if_sessions[0];
+		session->serv = -1;
+		session->conn = gdb_if_stdio_in;
+		session->out = gdb_if_stdio_out;
+		session->port = 0;
+		gdb_if_listening = 1;
+		DEBUG_WARN("GDB on stdio\n");
+		return 0;
+	}
 #if defined(_WIN32) || defined(__CYGWIN__)
 	int iResult;
 	WSADATA wsaData;
@@ -57,135 +226,152 @@ int gdb_if_init(void)
 		exit(1);
 	}
 #endif
-	struct sockaddr_in addr;
-	int opt;
+	/* The first free port takes the first session, the others follow it while theirs are free */
 	int port = DEFAULT_PORT - 1;
-
+	int serv;
 	do {
 		port ++;
-		if (port > DEFAULT_PORT + NUM_GDB_SERVER)
+		if (port > DEFAULT_PORT + NUM_GDB_SERVER * (int)GDB_IF_SESSIONS)
 			return - 1;
-		addr.sin_family = AF_INET;
-		addr.sin_port = htons(port);
-		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		serv = gdb_if_listen(port);
+	} while (serv == -1);
 
-		gdb_if_serv = socket(PF_INET, SOCK_STREAM, 0);
-		if (gdb_if_serv == -1) {
-			DEBUG_WARN("PF_INET %d\n",gdb_if_serv);
-			continue;
-		}
+	for (gdb_if_listening = 0; gdb_if_listening < GDB_IF_SESSIONS; ++gdb_if_listening, ++port) {
+		if (gdb_if_listening)
+			serv = gdb_if_listen(port);
+		if (serv == -1)
+			break;
+		gdb_if_session_s *const session = &gdb_if_sessions[gdb_if_listening];
+		session->serv = serv;
+		session->conn = -1;
+		session->out = -1;
+		session->port = port;
+		DEBUG_WARN("Listening on TCP: %4d\n", port);
+	}
+	return 0;
+}
 
-		opt = 1;
-		if (setsockopt(gdb_if_serv, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(opt)) == -1) {
-#if defined(_WIN32) || defined(__CYGWIN__)
-		    DEBUG_WARN("error setsockopt SOL_SOCKET : %d error: %d\n", gdb_if_serv,
-			WSAGetLastError());
-#else
-			DEBUG_WARN("error setsockopt SOL_SOCKET : %d error: %d\n", gdb_if_serv,
-			strerror(errno));
-#endif
-			close(gdb_if_serv);
-			continue;
-		}
-		if (setsockopt(gdb_if_serv, IPPROTO_TCP, TCP_NODELAY, (void*)&opt, sizeof(opt)) == -1) {
-#if defined(_WIN32) || defined(__CYGWIN__)
-			DEBUG_WARN("error setsockopt IPPROTO_TCP : %d error: %d\n", gdb_if_serv,
-			WSAGetLastError());
-#else
-			DEBUG_WARN("error setsockopt IPPROTO_TCP : %d error: %d\n", gdb_if_serv,
-			strerror(errno));
-#endif
-			close(gdb_if_serv);
-			continue;
-		}
-		if (bind(gdb_if_serv, (void*)&addr, sizeof(addr)) == -1) {
-#if defined(_WIN32) || defined(__CYGWIN__)
-			DEBUG_WARN("error when binding socket: %d error: %d\n", gdb_if_serv,
-			WSAGetLastError());
-#else
-			DEBUG_WARN("error when binding socket: %d error: %d\n", gdb_if_serv,
-			strerror(errno));
-#endif
-			close(gdb_if_serv);
-			continue;
-		}
-		if (listen(gdb_if_serv, 1) == -1) {
-			DEBUG_WARN("listen closed %d\n",gdb_if_serv);
-			close(gdb_if_serv);
-			continue;
-		}
-		break;
-	} while(1);
-	DEBUG_WARN("Listening on TCP: %4d\n", port);
+size_t gdb_if_session(void)
+{
+	return gdb_if - gdb_if_sessions;
+}
 
-	return 0;
+size_t gdb_if_session_count(void)
+{
+	return gdb_if_listening;
 }
 
+void gdb_if_select(const size_t session)
+{
+	gdb_if = &gdb_if_sessions[session];
+}
 
-unsigned char gdb_if_getchar(void)
+/* Take the connection waiting on the current session's port, false if there is none */
+static bool gdb_if_accept(void)
 {
-	unsigned char ret;
-	int i = 0;
-#if defined(_WIN32) || defined(__CYGWIN__)
-	int iResult;
-	unsigned long opt;
-#else
-	int flags;
-#endif
-	while(i <= 0) {
-		if(gdb_if_conn <= 0) {
 #if defined(_WIN32) || defined(__CYGWIN__)
-			opt = 1;
-			iResult = ioctlsocket(gdb_if_serv, FIONBIO, &opt);
-			if (iResult != NO_ERROR) {
-				DEBUG_WARN("ioctlsocket failed with error: %ld\n", iResult);
-			}
+	unsigned long opt = 1;
+	const int iResult = ioctlsocket(gdb_if->serv, FIONBIO, &opt);
+	if (iResult != NO_ERROR) {
+		DEBUG_WARN("ioctlsocket failed with error: %ld\n", iResult);
+	}
 #else
-			flags = fcntl(gdb_if_serv, F_GETFL);
-			fcntl(gdb_if_serv, F_SETFL, flags | O_NONBLOCK);
+	const int flags = fcntl(gdb_if->serv, F_GETFL);
+	fcntl(gdb_if->serv, F_SETFL, flags | O_NONBLOCK);
 #endif
-			while(1) {
-				gdb_if_conn = accept(gdb_if_serv, NULL, NULL);
-				if (gdb_if_conn == -1) {
+	gdb_if->conn = accept(gdb_if->serv, NULL, NULL);
 #if defined(_WIN32) || defined(__CYGWIN__)
-					if (WSAGetLastError() == WSAEWOULDBLOCK) {
+	opt = 0;
+	ioctlsocket(gdb_if->serv, FIONBIO, &opt);
 #else
-					if (errno == EWOULDBLOCK) {
+	fcntl(gdb_if->serv, F_SETFL, flags);
 #endif
-						SET_IDLE_STATE(1);
-						platform_delay(100);
-					} else {
+	if (gdb_if->conn == -1) {
 #if defined(_WIN32) || defined(__CYGWIN__)
-						DEBUG_WARN("error when accepting connection: %d",
-								   WSAGetLastError());
+		if (WSAGetLastError() == WSAEWOULDBLOCK)
+			return false;
+		DEBUG_WARN("error when accepting connection: %d",
+				   WSAGetLastError());
 #else
-						DEBUG_WARN("error when accepting connection: %s",
-								   strerror(errno));
+		if (errno == EWOULDBLOCK)
+			return false;
+		DEBUG_WARN("error when accepting connection: %s",
+				   strerror(errno));
 #endif
-						exit(1);
-					}
-				} else {
+		exit(1);
+	}
+
+	DEBUG_INFO("Got connection on port %d\n", gdb_if->port);
+	gdb_if_conn_setup();
+	/* A new GDB starts over in ack mode */
+	gdb_set_noackmode(false);
 #if defined(_WIN32) || defined(__CYGWIN__)
-					opt = 0;
-					ioctlsocket(gdb_if_serv, FIONBIO, &opt);
+	opt = 0;
+	ioctlsocket(gdb_if->conn, FIONBIO, &opt);
 #else
-					fcntl(gdb_if_serv, F_SETFL, flags);
+	const int conn_flags = fcntl(gdb_if->conn, F_GETFL);
+	fcntl(gdb_if->conn, F_SETFL, conn_flags & ~O_NONBLOCK);
 #endif
-					break;
-				}
-			}
-			DEBUG_INFO("Got connection\n");
-#if defined(_WIN32) || defined(__CYGWIN__)
-			opt = 0;
-			ioctlsocket(gdb_if_conn, FIONBIO, &opt);
+	return true;
+}
+
+/*
+ * Wait up to timeout ms for any session to have something to read, taking new connections
+ * meanwhile. The current session stays selected.
+ */
+void gdb_if_wait(const uint32_t timeout)
+{
+	fd_set fds;
+# if defined(__CYGWIN__)
+	TIMEVAL tv;
 #else
-			flags = fcntl(gdb_if_conn, F_GETFL);
-			fcntl(gdb_if_conn, F_SETFL, flags & ~O_NONBLOCK);
+	struct timeval tv;
 #endif
+	tv.tv_sec = timeout / 1000U;
+	tv.tv_usec = (timeout % 1000U) * 1000U;
+
+	FD_ZERO(&fds);
+	int max_fd = -1;
+	for (size_t i = 0; i < gdb_if_listening; ++i) {
+		const gdb_if_session_s *const session = &gdb_if_sessions[i];
+		/* Already received data needs no waiting */
+		if (session->conn > 0 && session->rx_pos < session->rx_len)
+			return;
+		const int fd = session->conn > 0 ? session->conn : session->serv;
+		FD_SET(fd, &fds);
+		max_fd = MAX(max_fd, fd);
+	}
+	if (select(max_fd + 1, &fds, NULL, NULL, &tv) <= 0)
+		return;
+
+	gdb_if_session_s *const current = gdb_if;
+	for (size_t i = 0; i < gdb_if_listening; ++i) {
+		gdb_if = &gdb_if_sessions[i];
+		if (gdb_if->conn <= 0 && FD_ISSET(gdb_if->serv, &fds))
+			gdb_if_accept();
+	}
+	gdb_if = current;
+}
+
+unsigned char gdb_if_getchar(void)
+{
+	if (gdb_if->rx_pos < gdb_if->rx_len)
+		return gdb_if->rx_buf[gdb_if->rx_pos++];
+	/* The other sessions go on, this one reads as GDB gone until gdb_if_wait() accepts anew */
+	if (gdb_if->conn <= 0)
+		return 0x04;
+	int i = 0;
+	while(i <= 0) {
+		i = gdb_if_recv();
+		/* Nothing can connect again to the pipe GDB started us on */
+		if (i <= 0 && gdb_if->out != -1) {
+			DEBUG_INFO("GDB closed stdio\n");
+			exit(0);
 		}
-		i = recv(gdb_if_conn, (void*)&ret, 1, 0);
 		if(i <= 0) {
-			gdb_if_conn = -1;
+			gdb_if->conn = -1;
+			gdb_if->rx_pos = 0;
+			gdb_if->rx_len = 0;
 #if defined(_WIN32) || defined(__CYGWIN__)
 			DEBUG_INFO("Dropped broken connection: %d\n", WSAGetLastError());
 #else
@@ -195,7 +381,40 @@ unsigned char gdb_if_getchar(void)
 			return '+';
 		}
 	}
-	return ret;
+	gdb_if->rx_pos = 1;
+	gdb_if->rx_len = i;
+	return gdb_if->rx_buf[0];
+}
+
+size_t gdb_if_getspan(const unsigned char **span)
+{
+	static unsigned char c;
+
+	if (gdb_if->rx_pos == gdb_if->rx_len) {
+		c = gdb_if_getchar();
+		/* A dropped connection yields a byte that never was in the buffer */
+		if (!gdb_if->rx_len) {
+			*span = &c;
+			return 1;
+		}
+		--gdb_if->rx_pos;
+	}
+	*span = gdb_if->rx_buf + gdb_if->rx_pos;
+	return gdb_if->rx_len - gdb_if->rx_pos;
+}
+
+void gdb_if_consume(size_t count)
+{
+	if (gdb_if->rx_pos < gdb_if->rx_len)
+		gdb_if->rx_pos += count;
+}
+
+void gdb_if_inject(const void *data, size_t len)
+{
+	len = MIN(len, sizeof(gdb_if->rx_buf));
+	memcpy(gdb_if->rx_buf, data, len);
+	gdb_if->rx_pos = 0;
+	gdb_if->rx_len = len;
 }
 
 unsigned char gdb_if_getchar_to(int timeout)
@@ -207,33 +426,54 @@ unsigned char gdb_if_getchar_to(int timeout)
 	struct timeval tv;
 #endif
 
-	if(gdb_if_conn == -1) return -1;
+	if(gdb_if->conn <= 0) return -1;
+	/* Already received data needs no waiting */
+	if (gdb_if->rx_pos < gdb_if->rx_len)
+		return gdb_if->rx_buf[gdb_if->rx_pos++];
 
 	tv.tv_sec = timeout / 1000;
 	tv.tv_usec = (timeout % 1000) * 1000;
 
 	FD_ZERO(&fds);
-	FD_SET(gdb_if_conn, &fds);
+	FD_SET(gdb_if->conn, &fds);
 
-	if(select(gdb_if_conn+1, &fds, NULL, NULL, &tv) > 0)
+	if(select(gdb_if->conn+1, &fds, NULL, NULL, &tv) > 0)
 		return gdb_if_getchar();
 
 	return -1;
 }
 
+bool gdb_if_connected(void)
+{
+	return gdb_if->conn > 0;
+}
+
 void gdb_if_putchar(unsigned char c, int flush)
 {
-#if defined(__WIN32__) || defined(__CYGWIN__)
-	static char buf[2048];
-#else
-	static uint8_t buf[2048];
-#endif
-	static int bufsize = 0;
-	if (gdb_if_conn > 0) {
-		buf[bufsize++] = c;
-		if (flush || (bufsize == sizeof(buf))) {
-			send(gdb_if_conn, buf, bufsize, 0);
-			bufsize = 0;
+	if (gdb_if->conn > 0) {
+		gdb_if->tx_buf[gdb_if->tx_len++] = c;
+		if (flush || (gdb_if->tx_len == sizeof(gdb_if->tx_buf))) {
+			/* Let the kernel hold an ack back briefly to go out together with the reply */
+			gdb_if_send(gdb_if->tx_buf, gdb_if->tx_len, flush == GDB_IF_FLUSH_MORE ? MSG_MORE : 0);
+			gdb_if->tx_len = 0;
+		}
+	}
+}
+
+void gdb_if_write(const void *const data, size_t len, const int flush)
+{
+	if (gdb_if->conn <= 0)
+		return;
+	const uint8_t *bytes = data;
+	while (len) {
+		const size_t chunk = MIN(len, sizeof(gdb_if->tx_buf) - gdb_if->tx_len);
+		memcpy(gdb_if->tx_buf + gdb_if->tx_len, bytes, chunk);
+		gdb_if->tx_len += chunk;
+		bytes += chunk;
+		len -= chunk;
+		if (gdb_if->tx_len == sizeof(gdb_if->tx_buf) || (flush && !len)) {
+			gdb_if_send(gdb_if->tx_buf, gdb_if->tx_len, flush == GDB_IF_FLUSH_MORE && !len ? MSG_MORE : 0);
+			gdb_if->tx_len = 0;
 		}
 	}
 }
@@ -0,0 +1,357 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements loading of raw binary, ELF and Intel HEX images
+ * into a sorted list of populated address ranges.
+ */
+
+#include "general.h"
+#include <ctype.h>
+#include "target_internal.h"
+#include "image.h"
+
+#define ELF_HEADER_SIZE   52U
+#define ELF_PHDR_SIZE     32U
+#define ELF_PT_LOAD       1U
+#define ELF_SHDR_SIZE     40U
+#define ELF_SYM_SIZE      16U
+#define ELF_SHT_SYMTAB    2U
+#define IHEX_DATA         0x00U
+#define IHEX_EOF          0x01U
+#define IHEX_EXT_SEGMENT  0x02U
+#define IHEX_EXT_LINEAR   0x04U
+
+static uint16_t read_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8U);
+}
+
+static uint32_t read_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8U) | (p[2] << 16U) | ((uint32_t)p[3] << 24U);
+}
+
+/* Append data at addr, extending the last segment when contiguous */
+static bool image_append(image_s *image, uint32_t addr, const uint8_t *data, size_t size)
+{
+	if (!size)
+		return true;
+	image_segment_s *seg = image->count ? &image->segments[image->count - 1] : NULL;
+	if (!seg || seg->addr + seg->size != addr) {
+		image_segment_s *segments = realloc(image->segments, (image->count + 1) * sizeof(*segments));
+		if (!segments) {
+			DEBUG_WARN("realloc: failed in %s\n", __func__);
+			return false;
+		}
+		image->segments = segments;
+		seg = &segments[image->count++];
+		seg->addr = addr;
+		seg->size = 0;
+		seg->data = NULL;
+	}
+	uint8_t *buf = realloc(seg->data, seg->size + size);
+	if (!buf) {
+		DEBUG_WARN("realloc: failed in %s\n", __func__);
+		return false;
+	}
+	memcpy(buf + seg->size, data, size);
+	seg->data = buf;
+	seg->size += size;
+	image->total_size += size;
+	return true;
+}
+
+static bool image_load_elf(image_s *image, const uint8_t *data, size_t size)
+{
+	if (size < ELF_HEADER_SIZE || data[4] != 1 || data[5] != 1) {
+		DEBUG_WARN("Only 32 bit little endian ELF files are supported\n");
+		return false;
+	}
+	image->entry = read_le32(data + 24);
+	const uint32_t phoff = read_le32(data + 28);
+	const uint16_t phentsize = read_le16(data + 42);
+	const uint16_t phnum = read_le16(data + 44);
+	if (phentsize < ELF_PHDR_SIZE || phoff > size || (size - phoff) / phentsize < phnum) {
+		DEBUG_WARN("Malformed ELF program header table\n");
+		return false;
+	}
+	for (size_t i = 0; i < phnum; ++i) {
+		const uint8_t *const phdr = data + phoff + i * phentsize;
+		if (read_le32(phdr) != ELF_PT_LOAD)
+			continue;
+		const uint32_t offset = read_le32(phdr + 4);
+		/* Program to the load address, not the execution address */
+		const uint32_t paddr = read_le32(phdr + 12);
+		const uint32_t filesz = read_le32(phdr + 16);
+		/* Segments with nothing in the file, such as .bss, have nothing to program */
+		if (!filesz)
+			continue;
+		if (offset > size || size - offset < filesz) {
+			DEBUG_WARN("ELF segment %zu exceeds the file\n", i);
+			return false;
+		}
+		DEBUG_INFO("ELF segment at 0x%08" PRIx32 ", %" PRIu32 " bytes\n", paddr, filesz);
+		if (!image_append(image, paddr, data + offset, filesz))
+			return false;
+	}
+	if (!image->count) {
+		DEBUG_WARN("ELF file has no loadable segments\n");
+		return false;
+	}
+	return true;
+}
+
+bool image_elf_symbol(const void *file, size_t size, const char *name, uint32_t *value)
+{
+	const uint8_t *const data = file;
+	if (size < ELF_HEADER_SIZE || memcmp(data, "\x7f" "ELF", 4) || data[4] != 1 || data[5] != 1)
+		return false;
+	const uint32_t shoff = read_le32(data + 32);
+	const uint16_t shentsize = read_le16(data + 46);
+	const uint16_t shnum = read_le16(data + 48);
+	if (shentsize < ELF_SHDR_SIZE || shoff > size || (size - shoff) / shentsize < shnum)
+		return false;
+	const size_t name_len = strlen(name) + 1U;
+	for (size_t i = 0; i < shnum; ++i) {
+		const uint8_t *const shdr = data + shoff + i * shentsize;
+		if (read_le32(shdr + 4) != ELF_SHT_SYMTAB)
+			continue;
+		const uint32_t sym_off = read_le32(shdr + 16);
+		const uint32_t sym_size = read_le32(shdr + 20);
+		/* sh_link names the string table of the symbols */
+		const uint32_t link = read_le32(shdr + 24);
+		if (link >= shnum || sym_off > size || size - sym_off < sym_size)
+			return false;
+		const uint8_t *const strtab = data + shoff + link * shentsize;
+		const uint32_t str_off = read_le32(strtab + 16);
+		const uint32_t str_size = read_le32(strtab + 20);
+		if (str_off > size || size - str_off < str_size)
+			return false;
+		for (uint32_t sym = 0; sym + ELF_SYM_SIZE <= sym_size; sym += ELF_SYM_SIZE) {
+			const uint8_t *const entry = data + sym_off + sym;
+			const uint32_t st_name = read_le32(entry);
+			if (st_name < str_size && str_size - st_name >= name_len &&
+				!memcmp(data + str_off + st_name, name, name_len)) {
+				*value = read_le32(entry + 4);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static bool image_load_ihex(image_s *image, const char *data, size_t size)
+{
+	uint32_t base = 0;
+	size_t line = 0;
+	for (size_t pos = 0; pos < size;) {
+		/* Skip line endings and trailing whitespace */
+		if (data[pos] != ':') {
+			if (!isspace((unsigned char)data[pos]) && data[pos] != '\x1a') {
+				DEBUG_WARN("Intel HEX: unexpected character on line %zu\n", line + 1);
+				return false;
+			}
+			if (data[pos] == '\n')
+				++line;
+			++pos;
+			continue;
+		}
+		++pos;
+		uint8_t record[5 + 255];
+		size_t len = 0;
+		uint8_t checksum = 0;
+		while (pos + 1 < size && len < sizeof(record)) {
+			const int hi = hex_digit(data[pos]);
+			const int lo = hex_digit(data[pos + 1]);
+			if (hi < 0 || lo < 0)
+				break;
+			record[len] = (hi << 4U) | lo;
+			checksum += record[len++];
+			pos += 2;
+		}
+		if (len < 5 || len != record[0] + 5U || checksum) {
+			DEBUG_WARN("Intel HEX: malformed record on line %zu\n", line + 1);
+			return false;
+		}
+		const uint8_t count = record[0];
+		const uint16_t offset = (record[1] << 8U) | record[2];
+		switch (record[3]) {
+		case IHEX_DATA:
+			if (!image_append(image, base + offset, record + 4, count))
+				return false;
+			break;
+		case IHEX_EOF:
+			return true;
+		case IHEX_EXT_SEGMENT:
+			if (count != 2)
+				return false;
+			base = ((record[4] << 8U) | record[5]) << 4U;
+			break;
+		case IHEX_EXT_LINEAR:
+			if (count != 2)
+				return false;
+			base = ((record[4] << 8U) | record[5]) << 16U;
+			break;
+		default:
+			/* Start address records have no bearing on programming */
+			break;
+		}
+	}
+	DEBUG_WARN("Intel HEX: missing end of file record\n");
+	return false;
+}
+
+static bool image_is_ihex(const char *data, size_t size)
+{
+	size_t pos = 0;
+	while (pos < size && isspace((unsigned char)data[pos]))
+		++pos;
+	return pos + 11 <= size && data[pos] == ':' && hex_digit(data[pos + 1]) >= 0 && hex_digit(data[pos + 2]) >= 0;
+}
+
+bool image_load(image_s *image, const void *data, size_t size, uint32_t base, size_t max_size)
+{
+	memset(image, 0, sizeof(*image));
+	bool result;
+	if (size >= 4 && !memcmp(data, "\x7f" "ELF", 4)) {
+		DEBUG_INFO("Loading ELF image\n");
+		result = image_load_elf(image, data, size);
+	} else if (image_is_ihex(data, size)) {
+		DEBUG_INFO("Loading Intel HEX image\n");
+		result = image_load_ihex(image, data, size);
+	} else
+		result = image_append(image, base, data, MIN(size, max_size));
+	if (!result)
+		image_free(image);
+	return result;
+}
+
+static int image_segment_compare(const void *a, const void *b)
+{
+	const image_segment_s *const seg_a = a;
+	const image_segment_s *const seg_b = b;
+	if (seg_a->addr == seg_b->addr)
+		return 0;
+	return seg_a->addr < seg_b->addr ? -1 : 1;
+}
+
+/* True if the whole segment lies in the target's flash, possibly across adjacent regions */
+static bool image_segment_in_flash(target *t, const image_segment_s *seg)
+{
+	for (uint32_t addr = seg->addr; addr - seg->addr < seg->size;) {
+		const target_flash_s *const f = target_flash_for_addr(t, addr);
+		if (!f)
+			return false;
+		addr = f->start + f->length;
+		if (!addr)
+			break;
+	}
+	return true;
+}
+
+/* Leave out segments outside the flash, such as RAM sections, and refuse ones only partly in it */
+static bool image_drop_non_flash(image_s *image, target *t)
+{
+	for (size_t i = 0; i < image->count; ++i) {
+		const image_segment_s *const seg = &image->segments[i];
+		if (!image_segment_in_flash(t, seg) &&
+			(target_flash_for_addr(t, seg->addr) || target_flash_for_addr(t, seg->addr + seg->size - 1U))) {
+			DEBUG_WARN("Image segment at 0x%08" PRIx32 ", %zu bytes, is only partly in flash\n", seg->addr, seg->size);
+			return false;
+		}
+	}
+	size_t out = 0;
+	for (size_t i = 0; i < image->count; ++i) {
+		image_segment_s *const seg = &image->segments[i];
+		if (image_segment_in_flash(t, seg)) {
+			image->segments[out++] = *seg;
+			continue;
+		}
+		DEBUG_WARN("Skipping image segment at 0x%08" PRIx32 ", %zu bytes, it is not in flash\n", seg->addr, seg->size);
+		image->total_size -= seg->size;
+		free(seg->data);
+	}
+	if (image->count && !out) {
+		DEBUG_WARN("Image has nothing to program in flash\n");
+		image->count = 0;
+		return false;
+	}
+	image->count = out;
+	return true;
+}
+
+bool image_merge(image_s *image, target *t)
+{
+	if (!image_drop_non_flash(image, t))
+		return false;
+	if (!image->count)
+		return true;
+	qsort(image->segments, image->count, sizeof(*image->segments), image_segment_compare);
+	size_t out = 0;
+	for (size_t i = 1; i < image->count; ++i) {
+		image_segment_s *const cur = &image->segments[out];
+		image_segment_s *const next = &image->segments[i];
+		const uint32_t cur_end = cur->addr + cur->size;
+		if (next->addr < cur_end) {
+			DEBUG_WARN("Image segments at 0x%08" PRIx32 " and 0x%08" PRIx32 " overlap\n", cur->addr, next->addr);
+			return false;
+		}
+		/* Segments sharing a flash block are written as one */
+		const target_flash_s *const f = target_flash_for_addr(t, cur_end - 1U);
+		const uint32_t blocksize = f ? f->blocksize : 1U;
+		const uint8_t erased = f ? f->erased : 0xffU;
+		const uint32_t cur_block_end = (cur_end + blocksize - 1U) & ~(blocksize - 1U);
+		if (f != target_flash_for_addr(t, next->addr) || (next->addr & ~(blocksize - 1U)) >= cur_block_end) {
+			image->segments[++out] = *next;
+			continue;
+		}
+		const size_t gap = next->addr - cur_end;
+		uint8_t *buf = realloc(cur->data, cur->size + gap + next->size);
+		if (!buf) {
+			DEBUG_WARN("realloc: failed in %s\n", __func__);
+			return false;
+		}
+		memset(buf + cur->size, erased, gap);
+		memcpy(buf + cur->size + gap, next->data, next->size);
+		free(next->data);
+		next->data = NULL;
+		cur->data = buf;
+		cur->size += gap + next->size;
+		image->total_size += gap;
+	}
+	image->count = out + 1;
+	return true;
+}
+
+void image_free(image_s *image)
+{
+	for (size_t i = 0; i < image->count; ++i)
+		free(image->segments[i].data);
+	free(image->segments);
+	memset(image, 0, sizeof(*image));
+}
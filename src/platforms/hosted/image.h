@@ -0,0 +1,53 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* In-memory segment list for images handed to the PC-Hosted command line.
+ * Raw binaries become a single segment at the given base address, ELF files
+ * contribute their PT_LOAD program headers and Intel HEX files their data
+ * records.
+ */
+#ifndef PLATFORMS_HOSTED_IMAGE_H
+#define PLATFORMS_HOSTED_IMAGE_H
+
+#include "general.h"
+#include "target.h"
+
+typedef struct image_segment {
+	uint32_t addr;
+	size_t size;
+	uint8_t *data;
+} image_segment_s;
+
+typedef struct image {
+	image_segment_s *segments;
+	size_t count;
+	size_t total_size;
+	/* ELF entry point, 0 for other formats */
+	uint32_t entry;
+} image_s;
+
+/* Parse the file contents, raw binaries are placed at base (and
+ * truncated to max_size). Returns false on malformed input. */
+bool image_load(image_s *image, const void *data, size_t size, uint32_t base, size_t max_size);
+/* Sort the segments and merge those sharing a flash block, so every block
+ * is erased and written exactly once. Gaps are filled with the erased value. */
+bool image_merge(image_s *image, target *t);
+void image_free(image_s *image);
+/* Look name up in the symbol table of an ELF file */
+bool image_elf_symbol(const void *file, size_t size, const char *name, uint32_t *value);
+
+#endif /* PLATFORMS_HOSTED_IMAGE_H */
@@ -206,9 +206,7 @@ int jlink_init(bmp_info_t *info)
 		goto error;
 	if (initialize_handle(info, devs[i]))
 		goto error;
-	jl->req_trans = libusb_alloc_transfer(0);
-	jl->rep_trans = libusb_alloc_transfer(0);
-	if (!jl->req_trans || !jl->rep_trans ||
+	if (usb_transfers_init(jl) ||
 		!jl->ep_tx || !jl->ep_rx) {
 		DEBUG_WARN("Device setup failed\n");
 		goto error;
@@ -273,3 +271,81 @@ uint32_t jlink_max_frequency_get(bmp_info_t *info)
 		return (emu_speed_kHz * 1000L)/ emu_current_divisor;
 	return FREQ_FIXED;
 }
+
+/* Size of the probe side trace buffer requested on start */
+#define JLINK_SWO_BUFFER_SIZE 4096U
+
+static bool swo_running = false;
+
+static uint32_t jlink_swo_word(const uint8_t *const res)
+{
+	return res[0] | (res[1] << 8) | (res[2] << 16) | ((uint32_t)res[3] << 24);
+}
+
+/* The J-Link captures SWO in UART mode only */
+bool jlink_swo_start(bmp_info_t *info, const uint32_t baudrate)
+{
+	if (!(emu_caps & JLINK_CAP_SWO)) {
+		DEBUG_WARN("J-Link does not capture SWO\n");
+		return false;
+	}
+	jlink_swo_stop(info);
+	uint8_t cmd[21] = {
+		CMD_SWO, SWO_CMD_START,
+		0x04, SWO_PARAM_MODE, SWO_MODE_UART, 0, 0, 0,
+		0x04, SWO_PARAM_BAUDRATE,
+		baudrate & 0xff, (baudrate >> 8) & 0xff, (baudrate >> 16) & 0xff, (baudrate >> 24) & 0xff,
+		0x04, SWO_PARAM_BUFFER_SIZE,
+		JLINK_SWO_BUFFER_SIZE & 0xff, (JLINK_SWO_BUFFER_SIZE >> 8) & 0xff, 0, 0,
+		0x00,
+	};
+	uint8_t res[4];
+	if (send_recv(info->usb_link, cmd, sizeof(cmd), res, sizeof(res)) < 4 || jlink_swo_word(res)) {
+		DEBUG_WARN("J-Link SWO start failed\n");
+		return false;
+	}
+	swo_running = true;
+	return true;
+}
+
+void jlink_swo_stop(bmp_info_t *info)
+{
+	if (!swo_running)
+		return;
+	uint8_t cmd[3] = {CMD_SWO, SWO_CMD_STOP, 0x00};
+	uint8_t res[4];
+	send_recv(info->usb_link, cmd, sizeof(cmd), res, sizeof(res));
+	swo_running = false;
+}
+
+/*
+ * Read the trace captured so far, returns the number of bytes or -1 on error.
+ * The reply is the status and data length followed by the data, which the
+ * probe may send in the same or in a separate transfer.
+ */
+int jlink_swo_read(bmp_info_t *info, uint8_t *const data, const size_t size)
+{
+	if (!swo_running)
+		return -1;
+	uint8_t buf[8U + JLINK_SWO_BUFFER_SIZE];
+	const uint32_t request = MIN(size, JLINK_SWO_BUFFER_SIZE);
+	uint8_t cmd[9] = {
+		CMD_SWO, SWO_CMD_READ,
+		0x04, SWO_PARAM_READ_SIZE, request & 0xff, (request >> 8) & 0xff, 0, 0,
+		0x00,
+	};
+	int res = send_recv(info->usb_link, cmd, sizeof(cmd), buf, 8U + request);
+	if (res < 8 || (jlink_swo_word(buf) & SWO_STATUS_ERROR))
+		return -1;
+	const uint32_t len = MIN(jlink_swo_word(buf + 4), request);
+	size_t received = res - 8;
+	if (received < len) {
+		res = send_recv(info->usb_link, NULL, 0, buf + 8 + received, len - received);
+		if (res < 0)
+			return -1;
+		received += res;
+	}
+	received = MIN(received, len);
+	memcpy(data, buf + 8, received);
+	return (int)received;
+}
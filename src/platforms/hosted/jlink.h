@@ -33,14 +33,28 @@
 #define CMD_HW_RESET0           0xdc
 #define CMD_HW_RESET1           0xdd
 #define CMD_GET_CAPS            0xe8
+#define CMD_SWO                 0xeb
 #define CMD_GET_EXT_CAPS        0xed
 #define CMD_GET_HW_VERSION      0xf0
 
+#define SWO_CMD_START           0x64
+#define SWO_CMD_STOP            0x65
+#define SWO_CMD_READ            0x66
+
+#define SWO_PARAM_MODE          0x01
+#define SWO_PARAM_BAUDRATE      0x02
+#define SWO_PARAM_READ_SIZE     0x03
+#define SWO_PARAM_BUFFER_SIZE   0x04
+
+#define SWO_MODE_UART           0x00
+#define SWO_STATUS_ERROR        (1U << 31U)
+
 #define JLINK_IF_GET_ACTIVE    0xfe
 #define JLINK_IF_GET_AVAILABLE 0xff
 
 #define JLINK_CAP_GET_SPEEDS     (1 <<  9)
 #define JLINK_CAP_GET_HW_VERSION (1 <<  1)
+#define JLINK_CAP_SWO            (1 << 23)
 #define JLINK_IF_JTAG             1
 #define JLINK_IF_SWD              2
 
@@ -58,6 +72,9 @@ void jlink_nrst_set_val(bmp_info_t *info, bool assert) { }
 bool jlink_nrst_get_val(bmp_info_t *info) { return true; }
 void jlink_max_frequency_set(bmp_info_t *info, uint32_t freq) { }
 uint32_t jlink_max_frequency_get(bmp_info_t *info) { return 0; }
+bool jlink_swo_start(bmp_info_t *info, uint32_t baudrate) { return false; }
+void jlink_swo_stop(bmp_info_t *info) { }
+int jlink_swo_read(bmp_info_t *info, uint8_t *data, size_t size) { return -1; }
 # pragma GCC diagnostic pop
 #else
 /** Device capabilities. (from openocd*/
@@ -105,6 +122,9 @@ void jlink_nrst_set_val(bmp_info_t *info, bool assert);
 bool jlink_nrst_get_val(bmp_info_t *info);
 void jlink_max_frequency_set(bmp_info_t *info, uint32_t freq);
 uint32_t jlink_max_frequency_get(bmp_info_t *info);
+bool jlink_swo_start(bmp_info_t *info, uint32_t baudrate);
+void jlink_swo_stop(bmp_info_t *info);
+int jlink_swo_read(bmp_info_t *info, uint8_t *data, size_t size);
 #endif
 
 #endif /* PLATFORMS_HOSTED_JLINK_H */
@@ -40,6 +40,10 @@ static uint32_t jlink_adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_
 
 static void jlink_adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort);
 
+static void jlink_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
+
+static void jlink_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align);
+
 enum {
 	SWDIO_WRITE = 0,
 	SWDIO_READ
@@ -133,6 +137,8 @@ uint32_t jlink_swdp_scan(bmp_info_t *info)
 	dp->error = jlink_adiv5_swdp_error;
 	dp->low_access = jlink_adiv5_swdp_low_access;
 	dp->abort = jlink_adiv5_swdp_abort;
+	dp->mem_read = jlink_mem_read;
+	dp->mem_write_sized = jlink_mem_write_sized;
 
 	jlink_adiv5_swdp_error(dp);
 
@@ -209,14 +215,18 @@ static uint32_t jlink_adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_
 		send_recv(info.usb_link, cmd, 8, res, 2);
 		send_recv(info.usb_link, NULL, 0, res + 2, 1);
 
-		if (res[2] != 0)
-			raise_exception(EXCEPTION_ERROR, "Low access setup failed");
+		if (res[2] != 0) {
+			adiv5_dp_raise(dp, EXCEPTION_ERROR, "Low access setup failed");
+			return 0;
+		}
 
 		ack = res[1] & 7;
 	} while (ack == SWDP_ACK_WAIT && !platform_timeout_is_expired(&timeout));
 
-	if (ack == SWDP_ACK_WAIT)
-		raise_exception(EXCEPTION_TIMEOUT, "SWDP ACK timeout");
+	if (ack == SWDP_ACK_WAIT) {
+		adiv5_dp_raise(dp, EXCEPTION_TIMEOUT, "SWDP ACK timeout");
+		return 0;
+	}
 
 	if (ack == SWDP_ACK_FAULT) {
 		if (cl_debuglevel & BMP_DEBUG_TARGET)
@@ -228,6 +238,7 @@ static uint32_t jlink_adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_
 	if (ack != SWDP_ACK_OK) {
 		if (cl_debuglevel & BMP_DEBUG_TARGET)
 			DEBUG_WARN("Protocol %d\n", ack);
+		adiv5_shadow_invalidate(dp);
 		line_reset(&info);
 		return 0;
 	}
@@ -240,15 +251,19 @@ static uint32_t jlink_adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_
 		send_recv(info.usb_link, cmd, 14, res, 5);
 		send_recv(info.usb_link, NULL, 0, res + 5, 1);
 
-		if (res[5] != 0)
-			raise_exception(EXCEPTION_ERROR, "Low access read failed");
+		if (res[5] != 0) {
+			adiv5_dp_raise(dp, EXCEPTION_ERROR, "Low access read failed");
+			return 0;
+		}
 
 		response = res[0] | res[1] << 8U | res[2] << 16U | res[3] << 24U;
 
 		const unsigned int parity = res[4] & 1;
 		const unsigned int bit_count = __builtin_popcount(response) + parity;
-		if (bit_count & 1) /* Give up on parity error */
-			raise_exception(EXCEPTION_ERROR, "SWDP Parity error");
+		if (bit_count & 1) { /* Give up on parity error */
+			adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP Parity error");
+			return 0;
+		}
 	} else {
 		cmd[2] = 33 + 8; /* 8 idle cycle  to move data through SW-DP */
 		memset(cmd + 4, 0xffU, 6);
@@ -263,8 +278,10 @@ static uint32_t jlink_adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_
 		send_recv(info.usb_link, cmd, 16, res, 6);
 		send_recv(info.usb_link, NULL, 0, res, 1);
 
-		if (res[0] != 0)
-			raise_exception(EXCEPTION_ERROR, "Low access write failed");
+		if (res[0] != 0) {
+			adiv5_dp_raise(dp, EXCEPTION_ERROR, "Low access write failed");
+			return 0;
+		}
 	}
 	return response;
 }
@@ -273,3 +290,339 @@ static void jlink_adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
 }
+
+/*
+ * Room for a run of SWD transactions as one CMD_HW_JTAG3 bit stream.
+ * A read takes 46 clocks and a write 54, so this holds about 80 of them.
+ */
+#define JLINK_SWD_BATCH_BYTES     512U
+#define JLINK_SWD_BATCH_TRANSFERS 96U
+#define JLINK_SWD_READ_BITS       46U
+#define JLINK_SWD_WRITE_BITS      54U
+
+#define ALIGNOF(x) (((x)&3) == 0 ? ALIGN_WORD : (((x)&1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
+
+typedef struct jlink_swd_transfer {
+	size_t ack_offset; /* Bit offset of the ACK in the read back stream */
+	bool RnW;
+	uint32_t *result; /* Where the data phase of a read goes, NULL to drop it */
+} jlink_swd_transfer_s;
+
+typedef struct jlink_swd_batch {
+	size_t bits;
+	size_t count;
+	jlink_swd_transfer_s transfers[JLINK_SWD_BATCH_TRANSFERS];
+	uint8_t direction[JLINK_SWD_BATCH_BYTES];
+	uint8_t data[JLINK_SWD_BATCH_BYTES];
+	uint8_t res[JLINK_SWD_BATCH_BYTES + 1U];
+} jlink_swd_batch_s;
+
+static jlink_swd_batch_s jlink_batch;
+
+static void jlink_swd_batch_reset(jlink_swd_batch_s *batch)
+{
+	batch->bits = 0;
+	batch->count = 0;
+	memset(batch->direction, 0, sizeof(batch->direction));
+	memset(batch->data, 0, sizeof(batch->data));
+}
+
+/* Append clock_cycles bits to the stream, driving value LSB first when out is set */
+static void jlink_swd_batch_bits(jlink_swd_batch_s *batch, bool out, uint32_t value, size_t clock_cycles)
+{
+	for (size_t i = 0; i < clock_cycles; ++i, ++batch->bits) {
+		const uint8_t mask = 1U << (batch->bits & 7U);
+		if (out)
+			batch->direction[batch->bits >> 3U] |= mask;
+		if (value & (1U << i))
+			batch->data[batch->bits >> 3U] |= mask;
+	}
+}
+
+/* Take count bits of the read back stream starting at offset */
+static uint32_t jlink_swd_batch_in(const jlink_swd_batch_s *batch, size_t offset, size_t clock_cycles)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < clock_cycles; ++i, ++offset) {
+		if (batch->res[offset >> 3U] & (1U << (offset & 7U)))
+			value |= 1U << i;
+	}
+	return value;
+}
+
+/* Number of transactions of transfer_bits clocks each still fitting the batch */
+static size_t jlink_swd_batch_room(const jlink_swd_batch_s *batch, size_t transfer_bits)
+{
+	const size_t by_bits = (JLINK_SWD_BATCH_BYTES * 8U - batch->bits) / transfer_bits;
+	return MIN(by_bits, JLINK_SWD_BATCH_TRANSFERS - batch->count);
+}
+
+/*
+ * Add one transaction with the same clocking low_access uses: the read data
+ * is sampled right after the ACK, writes get a turnaround bit and 8 idle
+ * cycles, reads 2 idle cycles to turn the line back around.
+ */
+static void jlink_swd_batch_add(jlink_swd_batch_s *batch, uint8_t RnW, uint16_t addr, uint32_t value, uint32_t *result)
+{
+	jlink_swd_transfer_s *const transfer = &batch->transfers[batch->count++];
+	jlink_swd_batch_bits(batch, true, make_packet_request(RnW, addr), 8U);
+	transfer->ack_offset = batch->bits;
+	transfer->RnW = RnW;
+	transfer->result = result;
+	if (RnW) {
+		jlink_swd_batch_bits(batch, false, 0, 36U);
+		jlink_swd_batch_bits(batch, true, 0, 2U);
+	} else {
+		jlink_swd_batch_bits(batch, false, 0, 4U);
+		jlink_swd_batch_bits(batch, true, 0, 1U);
+		jlink_swd_batch_bits(batch, true, value, 32U);
+		jlink_swd_batch_bits(batch, true, __builtin_parity(value), 1U);
+		jlink_swd_batch_bits(batch, true, 0, 8U);
+	}
+}
+
+/*
+ * Clock the batch out in one go and check the transactions in order.
+ * Returns how many completed, with the ACK of the first one that did not in *ack.
+ */
+static size_t jlink_swd_batch_run(ADIv5_DP_t *dp, jlink_swd_batch_s *batch, uint8_t *ack)
+{
+	*ack = SWDP_ACK_OK;
+	if (!batch->count)
+		return 0;
+	const size_t bytes = (batch->bits + 7U) >> 3U;
+	uint8_t cmd[4U + 2U * JLINK_SWD_BATCH_BYTES];
+	cmd[0] = CMD_HW_JTAG3;
+	cmd[1] = 0;
+	cmd[2] = batch->bits & 0xffU;
+	cmd[3] = batch->bits >> 8U;
+	memcpy(cmd + 4U, batch->direction, bytes);
+	memcpy(cmd + 4U + bytes, batch->data, bytes);
+	send_recv(info.usb_link, cmd, 4U + 2U * bytes, batch->res, bytes);
+	send_recv(info.usb_link, NULL, 0, batch->res + bytes, 1);
+	if (batch->res[bytes] != 0) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "Low access batch failed");
+		*ack = 0;
+		return 0;
+	}
+
+	for (size_t i = 0; i < batch->count; ++i) {
+		const jlink_swd_transfer_s *const transfer = &batch->transfers[i];
+		*ack = jlink_swd_batch_in(batch, transfer->ack_offset, 3U);
+		if (*ack != SWDP_ACK_OK)
+			return i;
+		if (!transfer->RnW)
+			continue;
+		const uint32_t value = jlink_swd_batch_in(batch, transfer->ack_offset + 3U, 32U);
+		if ((__builtin_parity(value) ^ jlink_swd_batch_in(batch, transfer->ack_offset + 35U, 1U)) & 1U) {
+			adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP Parity error");
+			return i;
+		}
+		if (transfer->result)
+			*transfer->result = value;
+	}
+	return batch->count;
+}
+
+/*
+ * The transactions clocked out behind a failed one leave the line out of
+ * step. Resync, and tell whether the run is worth resuming: WAIT and
+ * protocol errors are retried until the timeout, a FAULT ends it.
+ */
+static bool jlink_swd_batch_recover(ADIv5_DP_t *dp, uint8_t ack, platform_timeout *timeout)
+{
+	adiv5_shadow_invalidate(dp);
+	line_reset(&info);
+	if (ack == SWDP_ACK_FAULT) {
+		if (cl_debuglevel & BMP_DEBUG_TARGET)
+			DEBUG_WARN("Fault\n");
+		dp->fault = 1;
+		return false;
+	}
+	if (platform_timeout_is_expired(timeout)) {
+		adiv5_dp_raise(dp, EXCEPTION_TIMEOUT, "SWDP ACK timeout");
+		return false;
+	}
+	return true;
+}
+
+/* Add the SELECT, CSW and TAR writes not shadowed already, as ap_mem_access_setup() would */
+static void jlink_swd_batch_mem_setup(
+	jlink_swd_batch_s *batch, ADIv5_AP_t *ap, uint32_t addr, enum align align, bool packed)
+{
+	uint32_t csw = ap->csw | (packed ? ADIV5_AP_CSW_ADDRINC_PACKED : ADIV5_AP_CSW_ADDRINC_SINGLE);
+	switch (align) {
+	case ALIGN_BYTE:
+		csw |= ADIV5_AP_CSW_SIZE_BYTE;
+		break;
+	case ALIGN_HALFWORD:
+		csw |= ADIV5_AP_CSW_SIZE_HALFWORD;
+		break;
+	case ALIGN_DWORD:
+	case ALIGN_WORD:
+		csw |= ADIV5_AP_CSW_SIZE_WORD;
+		break;
+	}
+	const uint32_t select = ((uint32_t)ap->apsel << 24U) | (ADIV5_AP_CSW & 0xf0U);
+	if (!adiv5_dp_select_shadowed(ap->dp, select)) {
+		jlink_swd_batch_add(batch, ADIV5_LOW_WRITE, ADIV5_DP_SELECT, select, NULL);
+		adiv5_dp_select_shadow(ap->dp, select);
+	}
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_CSW, csw)) {
+		jlink_swd_batch_add(batch, ADIV5_LOW_WRITE, ADIV5_AP_CSW, csw, NULL);
+		adiv5_ap_shadow_write(ap, ADIV5_AP_CSW, csw);
+	}
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_TAR, addr)) {
+		jlink_swd_batch_add(batch, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr, NULL);
+		adiv5_ap_shadow_write(ap, ADIV5_AP_TAR, addr);
+	}
+	adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
+}
+
+/* Accesses left before TAR stops auto-incrementing at the next 1kiB boundary */
+static size_t jlink_swd_tar_window(uint32_t addr, enum align data_align)
+{
+	return (0x400U - (addr & 0x3ffU)) >> data_align;
+}
+
+/* Read len bytes starting at src in accesses of the given width, or as whole words of packed accesses */
+static void *jlink_mem_read_run(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len, enum align align, bool packed)
+{
+	const enum align data_align = packed ? ALIGN_WORD : align;
+	size_t count = len >> data_align;
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 2000);
+	while (count && !ap->dp->fault) {
+		jlink_swd_batch_s *const batch = &jlink_batch;
+		jlink_swd_batch_reset(batch);
+		jlink_swd_batch_mem_setup(batch, ap, src, align, packed);
+		const size_t setup = batch->count;
+		/* Keep one read back for collecting the last posted read from RDBUFF */
+		const size_t reads = MIN(MIN(count, jlink_swd_tar_window(src, data_align)), jlink_swd_batch_room(batch, JLINK_SWD_READ_BITS) - 1U);
+
+		/* DRW reads are posted, each returns the data of the one before */
+		uint32_t values[JLINK_SWD_BATCH_TRANSFERS];
+		for (size_t i = 0; i < reads; ++i)
+			jlink_swd_batch_add(batch, ADIV5_LOW_READ, ADIV5_AP_DRW, 0, i ? &values[i - 1U] : NULL);
+		jlink_swd_batch_add(batch, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0, &values[reads - 1U]);
+
+		uint8_t ack;
+		const size_t done = jlink_swd_batch_run(ap->dp, batch, &ack);
+		const size_t received = done > setup + 1U ? done - setup - 1U : 0;
+		for (size_t i = 0; i < received; ++i) {
+			dest = extract(dest, src, values[i], data_align);
+			src += 1U << data_align;
+		}
+		count -= received;
+		if (done == batch->count)
+			adiv5_ap_shadow_tar_advance(ap, src);
+		else if (!jlink_swd_batch_recover(ap->dp, ack, &timeout))
+			break;
+	}
+	return dest;
+}
+
+/* Read the head or tail of a split access in the widest accesses each part of it allows */
+static void *jlink_mem_read_edge(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	while (len) {
+		const enum align align = adiv5_edge_align(src, len);
+		dest = jlink_mem_read_run(ap, dest, src, 1U << align, align, false);
+		src += 1U << align;
+		len -= 1U << align;
+	}
+	return dest;
+}
+
+static void jlink_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	size_t head;
+	const size_t words = adiv5_align_split(src, len, &head);
+	if (words) {
+		dest = jlink_mem_read_edge(ap, dest, src, head);
+		dest = jlink_mem_read_run(ap, dest, src + head, words, ALIGN_WORD, false);
+		jlink_mem_read_edge(ap, dest, src + head + words, len - head - words);
+		return;
+	}
+
+	const enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	const size_t body = adiv5_packed_split(ap, src, len, align, &head);
+
+	if (body) {
+		dest = jlink_mem_read_run(ap, dest, src, head, align, false);
+		dest = jlink_mem_read_run(ap, dest, src + head, body, align, true);
+		src += head + body;
+		len -= head + body;
+	}
+	jlink_mem_read_run(ap, dest, src, len, align, false);
+}
+
+/* Write len bytes starting at dest in accesses of the given width, or as whole words of packed accesses */
+static const void *jlink_mem_write_run(
+	ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align, bool packed)
+{
+	const enum align data_align = packed ? ALIGN_WORD : align;
+	size_t count = len >> data_align;
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 2000);
+	while (count && !ap->dp->fault) {
+		jlink_swd_batch_s *const batch = &jlink_batch;
+		jlink_swd_batch_reset(batch);
+		jlink_swd_batch_mem_setup(batch, ap, dest, align, packed);
+		const size_t setup = batch->count;
+		const size_t writes = MIN(MIN(count, jlink_swd_tar_window(dest, data_align)), jlink_swd_batch_room(batch, JLINK_SWD_WRITE_BITS));
+
+		const uint8_t *data = src;
+		uint32_t lane = dest;
+		for (size_t i = 0; i < writes; ++i) {
+			uint32_t value = 0;
+			/* Pack data into correct data lane */
+			switch (data_align) {
+			case ALIGN_BYTE:
+				value = (uint32_t)*data << ((lane & 3U) << 3U);
+				break;
+			case ALIGN_HALFWORD: {
+				uint16_t half;
+				memcpy(&half, data, sizeof(half));
+				value = (uint32_t)half << ((lane & 2U) << 3U);
+				break;
+			}
+			case ALIGN_DWORD:
+			case ALIGN_WORD:
+				memcpy(&value, data, sizeof(value));
+				break;
+			}
+			data += 1U << data_align;
+			lane += 1U << data_align;
+			jlink_swd_batch_add(batch, ADIV5_LOW_WRITE, ADIV5_AP_DRW, value, NULL);
+		}
+
+		uint8_t ack;
+		const size_t done = jlink_swd_batch_run(ap->dp, batch, &ack);
+		const size_t accepted = done > setup ? done - setup : 0;
+		src = (const uint8_t *)src + (accepted << data_align);
+		dest += accepted << data_align;
+		count -= accepted;
+		if (done == batch->count)
+			adiv5_ap_shadow_tar_advance(ap, dest);
+		else if (!jlink_swd_batch_recover(ap->dp, ack, &timeout))
+			break;
+	}
+	return src;
+}
+
+static void jlink_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+{
+	size_t head;
+	const size_t body = adiv5_packed_split(ap, dest, len, align, &head);
+
+	if (body) {
+		src = jlink_mem_write_run(ap, dest, src, head, align, false);
+		src = jlink_mem_write_run(ap, dest + head, src, body, align, true);
+		dest += head + body;
+		len -= head + body;
+	}
+	jlink_mem_write_run(ap, dest, src, len, align, false);
+	/* Make sure this write is complete by doing a dummy read */
+	adiv5_dp_read(ap->dp, ADIV5_DP_RDBUFF);
+}
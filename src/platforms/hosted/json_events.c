@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* JSON progress events, see json_events.h */
+
+#include "general.h"
+#include <stdarg.h>
+#include <unistd.h>
+#include "json_events.h"
+
+bool json_events_enabled;
+
+static FILE *json_events_out;
+static char json_events_serial[64];
+static uint32_t json_events_start;
+
+bool json_events_init(void)
+{
+	/* Already set up by the station mode parent before the worker was forked */
+	if (json_events_enabled)
+		return true;
+	/* Keep the real stdout for the events and send all other output to stderr */
+	fflush(stdout);
+	const int fd = dup(STDOUT_FILENO);
+	if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 || !(json_events_out = fdopen(fd, "w"))) {
+		DEBUG_WARN("Can not set up the JSON output\n");
+		return false;
+	}
+	json_events_start = platform_time_ms();
+	json_events_enabled = true;
+	return true;
+}
+
+/* Every event from here on names the probe, so interleaved gang runs can be told apart */
+void json_events_set_serial(const char *const serial)
+{
+	json_escape(json_events_serial, sizeof(json_events_serial), serial);
+}
+
+void json_event(const char *const event, const char *const fmt, ...)
+{
+	if (!json_events_enabled)
+		return;
+	fprintf(json_events_out, "{\"event\":\"%s\",\"time_ms\":%" PRIu32, event, platform_time_ms() - json_events_start);
+	if (json_events_serial[0])
+		fprintf(json_events_out, ",\"serial\":\"%s\"", json_events_serial);
+	if (fmt && fmt[0]) {
+		va_list ap;
+		va_start(ap, fmt);
+		fputc(',', json_events_out);
+		vfprintf(json_events_out, fmt, ap);
+		va_end(ap);
+	}
+	fputs("}\n", json_events_out);
+	/* Consumers follow the run as it goes */
+	fflush(json_events_out);
+}
+
+const char *json_escape(char *const buf, const size_t size, const char *s)
+{
+	size_t offset = 0;
+	for (; *s && offset + 7U < size; ++s) {
+		const unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			buf[offset++] = '\\';
+			buf[offset++] = (char)c;
+		} else if (c < 0x20U)
+			offset += snprintf(buf + offset, size - offset, "\\u%04x", c);
+		else
+			buf[offset++] = (char)c;
+	}
+	buf[offset] = '\0';
+	return buf;
+}
@@ -0,0 +1,45 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Progress events of the command line operations for production tooling,
+ * enabled with -J. Each is one JSON object on a line of its own on stdout,
+ * everything else printed goes to stderr meanwhile.
+ */
+
+#ifndef PLATFORMS_HOSTED_JSON_EVENTS_H
+#define PLATFORMS_HOSTED_JSON_EVENTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+extern bool json_events_enabled;
+
+/* Take stdout for the events, then tag each with the serial of the probe */
+bool json_events_init(void);
+void json_events_set_serial(const char *serial);
+
+/*
+ * Emit an event with the members formatted from fmt, which are written
+ * as they are after the event name and time, so must be valid JSON.
+ */
+void json_event(const char *event, const char *fmt, ...);
+
+/* s as the contents of a JSON string, truncated to fit buf */
+const char *json_escape(char *buf, size_t size, const char *s);
+
+#endif /* PLATFORMS_HOSTED_JSON_EVENTS_H */
@@ -0,0 +1,460 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The libblackmagic calls, see libblackmagic.h.
+ *
+ * Each call is a thin wrapper around what the command line and GDB server
+ * use, with target exceptions caught so a lost target fails the call rather
+ * than unwinding into the caller.
+ */
+
+#include "general.h"
+#include "exception.h"
+#include "target.h"
+#include "target_internal.h"
+#include "command.h"
+#include "cli.h"
+#include "libblackmagic.h"
+#include "snapshot.h"
+
+#ifdef ENABLE_RTT
+#include "rtt.h"
+#include "rtt_if.h"
+#endif
+
+struct bmd_session {
+	BMP_CL_OPTIONS_t opts;
+	struct target_controller tc;
+	target *t;
+};
+
+/* The platform code is process wide, so is the session */
+static bmd_session_s *bmd_current;
+
+static void bmd_target_printf(struct target_controller *tc, const char *fmt, va_list ap)
+{
+	(void)tc;
+	vprintf(fmt, ap);
+}
+
+/* A rescan frees the targets, the attached one included */
+static void bmd_target_destroyed(struct target_controller *tc, target *t)
+{
+	(void)t;
+	bmd_session_s *const s = (bmd_session_s *)((char *)tc - offsetof(bmd_session_s, tc));
+	s->t = NULL;
+}
+
+int bmd_api_version(void)
+{
+	return BMD_API_VERSION;
+}
+
+bmd_session_s *bmd_open(const bmd_options_s *opts)
+{
+	if (bmd_current) {
+		DEBUG_WARN("libblackmagic: a session is open already\n");
+		return NULL;
+	}
+	bmd_session_s *const s = calloc(1, sizeof(*s));
+	if (!s) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return NULL;
+	}
+	cl_defaults(&s->opts);
+	if (opts) {
+		/* The options are only read, the casts are for the command line's sake */
+		s->opts.opt_serial = (char *)opts->serial;
+		s->opts.opt_device = (char *)opts->device;
+		s->opts.opt_cable = (char *)opts->cable;
+		s->opts.opt_mock = opts->mock;
+		if (opts->scan == BMD_SCAN_JTAG)
+			s->opts.opt_scanmode = BMP_SCAN_JTAG;
+		else if (opts->scan == BMD_SCAN_AUTO)
+			s->opts.opt_scanmode = BMP_SCAN_AUTO;
+		s->opts.opt_targetid = opts->targetid;
+		if (opts->frequency)
+			s->opts.opt_max_swj_frequency = opts->frequency;
+		s->opts.opt_connect_under_reset = opts->connect_under_reset;
+		s->opts.opt_no_hl = opts->no_high_level;
+		cl_debuglevel = opts->debug_level;
+	}
+	s->tc.printf = bmd_target_printf;
+	s->tc.destroy_callback = bmd_target_destroyed;
+	if (platform_probe_open(&s->opts)) {
+		platform_probe_close();
+		free(s);
+		return NULL;
+	}
+	bmd_current = s;
+	return s;
+}
+
+void bmd_close(bmd_session_s *s)
+{
+	if (!s)
+		return;
+	bmd_detach(s);
+	snapshot_drop_all();
+	target_list_free();
+	platform_probe_close();
+	bmd_current = NULL;
+	free(s);
+}
+
+const char *bmd_probe_ident(bmd_session_s *s)
+{
+	(void)s;
+	return platform_ident();
+}
+
+const char *bmd_target_voltage(bmd_session_s *s)
+{
+	(void)s;
+	return platform_target_voltage();
+}
+
+int bmd_scan(bmd_session_s *s)
+{
+	volatile int targets = -1;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		connect_assert_nrst = s->opts.opt_connect_under_reset;
+		platform_nrst_set_val(s->opts.opt_connect_under_reset);
+		targets = cl_scan_targets(&s->opts);
+	}
+	if (e.type)
+		return -1;
+	return targets;
+}
+
+typedef struct bmd_find {
+	int n;
+	target *t;
+} bmd_find_s;
+
+static void bmd_find_target(int i, target *t, void *context)
+{
+	bmd_find_s *const find = (bmd_find_s *)context;
+	if (i == find->n)
+		find->t = t;
+}
+
+const char *bmd_target_driver(bmd_session_s *s, int n)
+{
+	(void)s;
+	bmd_find_s find = {.n = n};
+	target_foreach(bmd_find_target, &find);
+	return find.t ? target_driver_name(find.t) : NULL;
+}
+
+bool bmd_attach(bmd_session_s *s, int n)
+{
+	bmd_detach(s);
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		s->t = target_attach_n(n, &s->tc);
+	}
+	if (e.type)
+		s->t = NULL;
+	return s->t != NULL;
+}
+
+void bmd_detach(bmd_session_s *s)
+{
+	if (!s->t)
+		return;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_detach(s->t);
+	}
+	s->t = NULL;
+}
+
+bool bmd_mem_read(bmd_session_s *s, uint32_t addr, void *data, size_t len)
+{
+	const bmd_mem_op_s op = {.addr = addr, .data = data, .len = len};
+	return bmd_mem_batch(s, &op, 1) == 1;
+}
+
+bool bmd_mem_write(bmd_session_s *s, uint32_t addr, const void *data, size_t len)
+{
+	const bmd_mem_op_s op = {.write = true, .addr = addr, .data = (void *)data, .len = len};
+	return bmd_mem_batch(s, &op, 1) == 1;
+}
+
+size_t bmd_mem_batch(bmd_session_s *s, const bmd_mem_op_s *ops, size_t count)
+{
+	if (!s->t)
+		return 0;
+	volatile size_t done = 0;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		for (; done < count; ++done) {
+			const bmd_mem_op_s *const op = &ops[done];
+			const int res = op->write ? target_mem_write(s->t, op->addr, op->data, op->len) :
+										target_mem_read(s->t, op->data, op->addr, op->len);
+			if (res)
+				break;
+		}
+	}
+	return done;
+}
+
+size_t bmd_regs_size(bmd_session_s *s)
+{
+	return s->t ? target_regs_size(s->t) : 0;
+}
+
+bool bmd_regs_read(bmd_session_s *s, void *data)
+{
+	if (!s->t)
+		return false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_regs_read(s->t, data);
+	}
+	return !e.type && !target_check_error(s->t);
+}
+
+bool bmd_regs_write(bmd_session_s *s, const void *data)
+{
+	if (!s->t)
+		return false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_regs_write(s->t, data);
+	}
+	return !e.type && !target_check_error(s->t);
+}
+
+int bmd_reg_read(bmd_session_s *s, int reg, void *data, size_t max)
+{
+	if (!s->t)
+		return -1;
+	volatile ssize_t res = -1;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		res = target_reg_read(s->t, reg, data, max);
+	}
+	return e.type ? -1 : (int)res;
+}
+
+int bmd_reg_write(bmd_session_s *s, int reg, const void *data, size_t size)
+{
+	if (!s->t)
+		return -1;
+	volatile ssize_t res = -1;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		res = target_reg_write(s->t, reg, data, size);
+	}
+	return e.type ? -1 : (int)res;
+}
+
+bool bmd_flash_erase(bmd_session_s *s, uint32_t addr, size_t len)
+{
+	if (!s->t)
+		return false;
+	volatile bool ok = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		ok = target_flash_erase(s->t, addr, len);
+		ok = target_flash_complete(s->t) && ok;
+	}
+	return !e.type && ok;
+}
+
+bool bmd_flash_write(bmd_session_s *s, uint32_t addr, const void *data, size_t len)
+{
+	if (!s->t)
+		return false;
+	volatile bool ok = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		ok = target_flash_write(s->t, addr, data, len);
+		ok = target_flash_complete(s->t) && ok;
+	}
+	return !e.type && ok;
+}
+
+bool bmd_flash_mass_erase(bmd_session_s *s)
+{
+	if (!s->t || !s->t->mass_erase)
+		return false;
+	volatile bool ok = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		ok = s->t->mass_erase(s->t);
+	}
+	return !e.type && ok;
+}
+
+bool bmd_reset(bmd_session_s *s)
+{
+	if (!s->t)
+		return false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_reset(s->t);
+	}
+	return !e.type;
+}
+
+bool bmd_reset_halt(bmd_session_s *s)
+{
+	if (!s->t)
+		return false;
+	volatile bool halted = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		halted = target_reset_halt(s->t);
+	}
+	return !e.type && halted;
+}
+
+bool bmd_halt(bmd_session_s *s)
+{
+	if (!s->t)
+		return false;
+	volatile enum target_halt_reason reason = TARGET_HALT_ERROR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_halt_request(s->t);
+		const uint32_t start_time = platform_time_ms();
+		while ((reason = target_halt_poll(s->t, NULL)) == TARGET_HALT_RUNNING &&
+			platform_time_ms() - start_time < 1000U)
+			continue;
+	}
+	return !e.type && reason != TARGET_HALT_RUNNING && reason != TARGET_HALT_ERROR;
+}
+
+bool bmd_resume(bmd_session_s *s)
+{
+	if (!s->t)
+		return false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_halt_resume(s->t, false);
+	}
+	return !e.type;
+}
+
+bool bmd_halted(bmd_session_s *s)
+{
+	if (!s->t)
+		return false;
+	volatile enum target_halt_reason reason = TARGET_HALT_ERROR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		reason = target_halt_poll(s->t, NULL);
+	}
+	return !e.type && reason != TARGET_HALT_RUNNING && reason != TARGET_HALT_ERROR;
+}
+
+bool bmd_monitor(bmd_session_s *s, const char *command)
+{
+	char *const cmd = strdup(command);
+	if (!cmd) { /* strdup failed: heap exhaustion */
+		DEBUG_WARN("strdup: failed in %s\n", __func__);
+		return false;
+	}
+	volatile int res = -1;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		res = command_process(s->t, cmd);
+	}
+	free(cmd);
+	return !e.type && res == 0;
+}
+
+bool bmd_snapshot_save(bmd_session_s *s, uint32_t slot, bool dirty)
+{
+	if (!s->t)
+		return false;
+	volatile bool ok = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		snapshot_stats_s stats;
+		ok = snapshot_save(s->t, slot, dirty, &stats);
+	}
+	return !e.type && ok;
+}
+
+bool bmd_snapshot_restore(bmd_session_s *s, uint32_t slot, bool dirty)
+{
+	if (!s->t)
+		return false;
+	volatile bool ok = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		snapshot_stats_s stats;
+		ok = snapshot_restore(s->t, slot, dirty, &stats);
+	}
+	return !e.type && ok;
+}
+
+#ifdef ENABLE_RTT
+typedef struct bmd_rtt_sink {
+	bmd_rtt_func func;
+	void *ctx;
+	size_t bytes;
+} bmd_rtt_sink_s;
+
+static void bmd_rtt_sink(uint32_t channel, const char *data, uint32_t len, void *ctx)
+{
+	bmd_rtt_sink_s *const sink = (bmd_rtt_sink_s *)ctx;
+	sink->func(channel, data, len, sink->ctx);
+	sink->bytes += len;
+}
+
+bool bmd_rtt_enable(bmd_session_s *s, bool enable)
+{
+	(void)s;
+	rtt_enabled = enable;
+	return true;
+}
+
+int bmd_rtt_poll(bmd_session_s *s, bmd_rtt_func func, void *ctx)
+{
+	if (!s->t || !func)
+		return -1;
+	bmd_rtt_sink_s sink = {.func = func, .ctx = ctx};
+	rtt_if_set_sink(bmd_rtt_sink, &sink);
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		poll_rtt(s->t);
+	}
+	rtt_if_set_sink(NULL, NULL);
+	return e.type ? -1 : (int)sink.bytes;
+}
+#else
+bool bmd_rtt_enable(bmd_session_s *s, bool enable)
+{
+	(void)s;
+	(void)enable;
+	return false;
+}
+
+int bmd_rtt_poll(bmd_session_s *s, bmd_rtt_func func, void *ctx)
+{
+	(void)s;
+	(void)func;
+	(void)ctx;
+	return -1;
+}
+#endif
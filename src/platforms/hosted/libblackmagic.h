@@ -0,0 +1,131 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* In-process access to the PC-Hosted probes and target drivers.
+ *
+ * Built with "make PROBE_HOST=hosted libblackmagic.so" (or libblackmagic.a),
+ * this is the code behind the blackmagic binary without its GDB server and
+ * command line. It is meant for test harnesses: scan, attach, read and write
+ * memory, registers and Flash without going through GDB or a child process.
+ *
+ * The probe and target state is process wide, there can be one session open
+ * at a time and its calls must come from one thread. A probe that stops
+ * answering still ends the process, as it does for the blackmagic binary.
+ *
+ * Calls returning bool report failure with false, those returning int with a
+ * negative value.
+ */
+
+#ifndef PLATFORMS_HOSTED_LIBBLACKMAGIC_H
+#define PLATFORMS_HOSTED_LIBBLACKMAGIC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped on every incompatible change of the calls or structures below */
+#define BMD_API_VERSION 1
+
+typedef struct bmd_session bmd_session_s;
+
+typedef enum bmd_scan {
+	BMD_SCAN_SWD,
+	BMD_SCAN_JTAG,
+	BMD_SCAN_AUTO, /* JTAG, then SWD if that found nothing */
+} bmd_scan_e;
+
+/* Zero initialised, this selects the only probe connected, over SWD at 4MHz */
+typedef struct bmd_options {
+	const char *serial;      /* probe serial number, or a unique part of it */
+	const char *device;      /* serial device of a Black Magic Probe, skips the probe search */
+	const char *cable;       /* FTDI cable type, as -c takes */
+	bool mock;               /* the built-in simulated probe and target instead of hardware */
+	bmd_scan_e scan;
+	uint32_t targetid;       /* SWD multi-drop target, 0 for none */
+	uint32_t frequency;      /* maximum SWJ frequency in Hz, 0 for the default */
+	bool connect_under_reset;
+	bool no_high_level;      /* as -H, do not use the probe's high level commands */
+	int debug_level;         /* as -v, 0 for warnings only */
+} bmd_options_s;
+
+/* One access of bmd_mem_batch() */
+typedef struct bmd_mem_op {
+	bool write;
+	uint32_t addr;
+	void *data;              /* read into, or written from */
+	size_t len;
+} bmd_mem_op_s;
+
+typedef void (*bmd_rtt_func)(uint32_t channel, const void *data, size_t len, void *ctx);
+
+int bmd_api_version(void);
+
+bmd_session_s *bmd_open(const bmd_options_s *opts);
+void bmd_close(bmd_session_s *s);
+const char *bmd_probe_ident(bmd_session_s *s);
+const char *bmd_target_voltage(bmd_session_s *s);
+
+/* Targets found, numbered from 1 */
+int bmd_scan(bmd_session_s *s);
+const char *bmd_target_driver(bmd_session_s *s, int n);
+bool bmd_attach(bmd_session_s *s, int n);
+void bmd_detach(bmd_session_s *s);
+
+bool bmd_mem_read(bmd_session_s *s, uint32_t addr, void *data, size_t len);
+bool bmd_mem_write(bmd_session_s *s, uint32_t addr, const void *data, size_t len);
+/* Accesses done back to back in the order given, the number completed before one failed */
+size_t bmd_mem_batch(bmd_session_s *s, const bmd_mem_op_s *ops, size_t count);
+
+size_t bmd_regs_size(bmd_session_s *s);
+bool bmd_regs_read(bmd_session_s *s, void *data);
+bool bmd_regs_write(bmd_session_s *s, const void *data);
+/* Numbered as in the target description GDB is given, bytes read or written */
+int bmd_reg_read(bmd_session_s *s, int reg, void *data, size_t max);
+int bmd_reg_write(bmd_session_s *s, int reg, const void *data, size_t size);
+
+/* Erase, write and finish the whole range, writes only erase what they cover */
+bool bmd_flash_erase(bmd_session_s *s, uint32_t addr, size_t len);
+bool bmd_flash_write(bmd_session_s *s, uint32_t addr, const void *data, size_t len);
+bool bmd_flash_mass_erase(bmd_session_s *s);
+
+bool bmd_reset(bmd_session_s *s);
+/* Reset and stay halted before the first instruction */
+bool bmd_reset_halt(bmd_session_s *s);
+bool bmd_halt(bmd_session_s *s);
+bool bmd_resume(bmd_session_s *s);
+bool bmd_halted(bmd_session_s *s);
+/* Monitor command, as "monitor <command>" in GDB, its output goes to stdout */
+bool bmd_monitor(bmd_session_s *s, const char *command);
+
+/* RAM and registers kept in host memory, up to 8 slots. Dirty transfers only what changed since the
+ * slot was saved, see "monitor snapshot" */
+bool bmd_snapshot_save(bmd_session_s *s, uint32_t slot, bool dirty);
+bool bmd_snapshot_restore(bmd_session_s *s, uint32_t slot, bool dirty);
+
+/* RTT, only in builds with ENABLE_RTT=1. Each poll hands new up channel data to func, the bytes handed */
+bool bmd_rtt_enable(bmd_session_s *s, bool enable);
+int bmd_rtt_poll(bmd_session_s *s, bmd_rtt_func func, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PLATFORMS_HOSTED_LIBBLACKMAGIC_H */
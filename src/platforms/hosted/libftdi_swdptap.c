@@ -41,12 +41,25 @@ static bool direct_bb_swd;
 #define MPSSE_TMS_SHIFT (MPSSE_WRITE_TMS | MPSSE_LSB | MPSSE_BITMODE | MPSSE_WRITE_NEG)
 #define MPSSE_TDO_SHIFT (MPSSE_DO_WRITE | MPSSE_LSB | MPSSE_BITMODE | MPSSE_WRITE_NEG)
 
-static void swdptap_turnaround(enum swdio_status dir)
+/* Longest command stream one transfer encodes to, a bit-banged read */
+#define SWD_TRANSFER_CMD_MAX 192U
+
+/* The request byte, parity included, for each RnW, APnDP and A[3:2] */
+static uint8_t swd_requests[16];
+
+static uint8_t swdptap_request(uint8_t RnW, uint16_t addr)
+{
+	return swd_requests[(RnW ? 8U : 0U) | ((addr & ADIV5_APnDP) ? 4U : 0U) | ((addr >> 2U) & 3U)];
+}
+
+/* Append the commands turning SWDIO around to cmd, returning their length */
+static size_t swdptap_turnaround_encode(uint8_t *cmd, enum swdio_status dir)
 {
 	if (dir == olddir)
-		return;
+		return 0;
 	olddir = dir;
 	DEBUG_PROBE("Turnaround %s\n", (dir == SWDIO_STATUS_FLOAT) ? "float": "drive");
+	size_t index = 0;
 	if (do_mpsse) {
 		if (dir == SWDIO_STATUS_FLOAT)	/* SWDIO goes to input */ {
 			active_state.data_low |=  active_cable->mpsse_swd_read.set_data_low | MPSSE_DO;
@@ -54,30 +67,31 @@ static void swdptap_turnaround(enum swdio_status dir)
 			active_state.ddr_low &= ~MPSSE_DO;
 			active_state.data_high |=  active_cable->mpsse_swd_read.set_data_high;
 			active_state.data_high &= ~active_cable->mpsse_swd_read.clr_data_high;
-			uint8_t cmd_read[6] = {
-				SET_BITS_LOW,  active_state.data_low,
-				active_state.ddr_low,
-				SET_BITS_HIGH, active_state.data_high, active_state.ddr_high};
-			libftdi_buffer_write(cmd_read, 6);
+			cmd[index++] = SET_BITS_LOW;
+			cmd[index++] = active_state.data_low;
+			cmd[index++] = active_state.ddr_low;
+			cmd[index++] = SET_BITS_HIGH;
+			cmd[index++] = active_state.data_high;
+			cmd[index++] = active_state.ddr_high;
 		}
-		uint8_t cmd[] = {MPSSE_TDO_SHIFT, 0, 0}; /* One clock cycle */
-		libftdi_buffer_write(cmd, sizeof(cmd));
+		/* One clock cycle */
+		cmd[index++] = MPSSE_TDO_SHIFT;
+		cmd[index++] = 0;
+		cmd[index++] = 0;
 		if (dir == SWDIO_STATUS_DRIVE)  /* SWDIO goes to output */ {
 			active_state.data_low |=  active_cable->mpsse_swd_write.set_data_low | MPSSE_DO;
 			active_state.data_low &= ~active_cable->mpsse_swd_write.clr_data_low;
 			active_state.ddr_low |= MPSSE_DO;
 			active_state.data_high |=  active_cable->mpsse_swd_write.set_data_high;
 			active_state.data_high &= ~active_cable->mpsse_swd_write.clr_data_high;
-			uint8_t cmd_write[6] = {
-				SET_BITS_LOW,  active_state.data_low,
-				active_state.ddr_low,
-				SET_BITS_HIGH, active_state.data_high, active_state.ddr_high};
-			libftdi_buffer_write(cmd_write, 6);
+			cmd[index++] = SET_BITS_LOW;
+			cmd[index++] = active_state.data_low;
+			cmd[index++] = active_state.ddr_low;
+			cmd[index++] = SET_BITS_HIGH;
+			cmd[index++] = active_state.data_high;
+			cmd[index++] = active_state.ddr_high;
 		}
 	} else {
-		uint8_t cmd[9];
-		int index = 0;
-
 		if(dir == SWDIO_STATUS_FLOAT)	  { /* SWDIO goes to input */
 			if (direct_bb_swd) {
 				active_state.data_low |=  MPSSE_CS;
@@ -116,14 +130,23 @@ static void swdptap_turnaround(enum swdio_status dir)
 			cmd[index++] = active_state.data_high;
 			cmd[index++] = active_state.ddr_high;
 		}
-		libftdi_buffer_write(cmd, index);
 	}
+	return index;
+}
+
+static void swdptap_turnaround(enum swdio_status dir)
+{
+	uint8_t cmd[16];
+	const size_t index = swdptap_turnaround_encode(cmd, dir);
+	if (index)
+		libftdi_buffer_write(cmd, index);
 }
 
 static bool swdptap_seq_in_parity(uint32_t *res, size_t clock_cycles);
 static uint32_t swdptap_seq_in(size_t clock_cycles);
 static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles);
 static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
+static bool swdptap_queue_flush(ADIv5_DP_t *dp);
 
 bool libftdi_swd_possible(bool *do_mpsse, bool *direct_bb_swd)
 {
@@ -203,6 +226,9 @@ int libftdi_swdptap_init(ADIv5_DP_t *dp)
 	libftdi_buffer_write(cmd_write, 6);
 	libftdi_buffer_flush();
 	olddir = SWDIO_STATUS_FLOAT;
+	for (size_t i = 0; i < ARRAY_LENGTH(swd_requests); ++i)
+		swd_requests[i] = make_packet_request((i & 8U) ? ADIV5_LOW_READ : ADIV5_LOW_WRITE,
+			((i & 4U) ? ADIV5_APnDP : 0U) | ((i & 3U) << 2U));
 
 	dp->seq_in  = swdptap_seq_in;
 	dp->seq_in_parity  = swdptap_seq_in_parity;
@@ -212,6 +238,7 @@ int libftdi_swdptap_init(ADIv5_DP_t *dp)
 	dp->error = firmware_swdp_error;
 	dp->low_access = firmware_swdp_low_access;
 	dp->abort = firmware_swdp_abort;
+	dp->queue_flush = swdptap_queue_flush;
 	return 0;
 }
 
@@ -256,157 +283,291 @@ void swdptap_bit_out(bool val)
 	}
 }
 
-bool swdptap_seq_in_parity(uint32_t *res, size_t clock_cycles)
+/* Append the commands sampling clock_cycles bits to cmd, adding the bytes they read back to read_size */
+static size_t swdptap_in_encode(uint8_t *cmd, size_t clock_cycles, size_t *read_size)
 {
-	assert(clock_cycles == 32);
-	swdptap_turnaround(SWDIO_STATUS_FLOAT);
-	unsigned int parity = 0;
-	unsigned int result = 0;
+	size_t index = 0;
 	if (do_mpsse) {
-		uint8_t DO[5];
-		libftdi_jtagtap_tdi_tdo_seq(DO, 0, NULL, clock_cycles + 1);
-		result = DO[0] + (DO[1] << 8) + (DO[2] << 16) + (DO[3] << 24);
-		parity =  __builtin_parity(result & ((1LL << clock_cycles) - 1)) & 1;
-		parity ^= DO[4] & 1;
-	} else {
-		size_t index = clock_cycles + 1;
-		uint8_t cmd[4];
-
-		cmd[0] = active_cable->bb_swdio_in_port_cmd;
-		cmd[1] = MPSSE_TMS_SHIFT;
-		cmd[2] = 0;
-		cmd[3] = 0;
-		while (index--) {
-			libftdi_buffer_write(cmd, sizeof(cmd));
+		const size_t bytes = clock_cycles >> 3U;
+		const size_t bits = clock_cycles & 7U;
+		if (bytes) {
+			cmd[index++] = MPSSE_DO_READ | MPSSE_LSB;
+			cmd[index++] = bytes - 1U;
+			cmd[index++] = 0;
 		}
-		uint8_t data[33];
-		libftdi_buffer_read(data, clock_cycles + 1);
-		if (data[clock_cycles] & active_cable->bb_swdio_in_pin)
-			parity ^= 1;
-		index = clock_cycles;
-		while (index--) {
-			if (data[index] & active_cable->bb_swdio_in_pin) {
-				parity ^= 1;
-				result |= (1 << index);
-			}
+		if (bits) {
+			cmd[index++] = MPSSE_DO_READ | MPSSE_LSB | MPSSE_BITMODE;
+			cmd[index++] = bits - 1U;
 		}
+		*read_size += bytes + (bits ? 1U : 0U);
+		return index;
 	}
-	*res = result;
-	return parity;
+	for (size_t i = 0; i < clock_cycles; ++i) {
+		cmd[index++] = active_cable->bb_swdio_in_port_cmd;
+		cmd[index++] = MPSSE_TMS_SHIFT;
+		cmd[index++] = 0;
+		cmd[index++] = 0;
+	}
+	*read_size += clock_cycles;
+	return index;
 }
 
-static uint32_t swdptap_seq_in(size_t clock_cycles)
+/* Append the commands clocking out the low clock_cycles bits of data, LSB first, to cmd */
+static size_t swdptap_out_encode(uint8_t *cmd, uint64_t data, size_t clock_cycles)
 {
-	if (!clock_cycles)
-		return 0;
-	uint32_t result = 0;
-	swdptap_turnaround(SWDIO_STATUS_FLOAT);
+	size_t index = 0;
 	if (do_mpsse) {
-		uint8_t DO[4];
-		libftdi_jtagtap_tdi_tdo_seq(DO, 0, NULL, clock_cycles);
-		int bytes = clock_cycles >> 3;
-		if (clock_cycles & 7)
-			bytes++;
-		for (int i = 0; i < bytes; i++) {
-			result |= DO[i] << (8 * i);
+		const size_t bytes = clock_cycles >> 3U;
+		const size_t bits = clock_cycles & 7U;
+		if (bytes) {
+			cmd[index++] = MPSSE_DO_WRITE | MPSSE_WRITE_NEG | MPSSE_LSB;
+			cmd[index++] = bytes - 1U;
+			cmd[index++] = 0;
+			for (size_t i = 0; i < bytes; ++i)
+				cmd[index++] = (data >> (8U * i)) & 0xffU;
 		}
-	} else {
-		size_t index = clock_cycles;
-		uint8_t cmd[4];
+		if (bits) {
+			cmd[index++] = MPSSE_TDO_SHIFT;
+			cmd[index++] = bits - 1U;
+			cmd[index++] = (data >> (8U * bytes)) & 0xffU;
+		}
+		return index;
+	}
+	/* TMS shifts take 7 bits at most */
+	while (clock_cycles) {
+		const size_t bits = MIN(clock_cycles, 7U);
+		cmd[index++] = MPSSE_TMS_SHIFT;
+		cmd[index++] = bits - 1U;
+		cmd[index++] = data & 0x7fU;
+		data >>= 7U;
+		clock_cycles -= bits;
+	}
+	return index;
+}
+
+/*
+ * The data phase of a write, the 32 data bits and parity, then 8 idle cycles
+ * to clock the data through the SW-DP. ADIv5.0 to ADIv5.2 allow either that,
+ * or starting the next transaction straight away, or idling until then;
+ * this favours correctness over a slight speed decrease.
+ */
+static uint64_t swdptap_write_data(uint32_t value)
+{
+	return value | ((uint64_t)(__builtin_parity(value) & 1) << 32U);
+}
 
-		cmd[0] = active_cable->bb_swdio_in_port_cmd;
-		cmd[1] = MPSSE_TMS_SHIFT;
-		cmd[2] = 0;
-		cmd[3] = 0;
+#define SWD_WRITE_DATA_CYCLES (32U + 1U + 8U)
 
-		while (index--) {
-			libftdi_buffer_write(cmd, sizeof(cmd));
-		}
-		uint8_t data[32];
-		libftdi_buffer_read(data, clock_cycles);
-		index = clock_cycles;
-		while (index--) {
-			if (data[index] & active_cable->bb_swdio_in_pin)
-				result |= (1 << index);
+/*
+ * Encode a whole transfer, request, turnarounds, ACK and data phase, as one
+ * command stream to go to the FTDI in a single buffer write. Returns its
+ * length and adds what it reads back to read_size.
+ */
+static size_t swdptap_transfer_encode(uint8_t *cmd, uint8_t RnW, uint16_t addr, uint32_t value, size_t *read_size)
+{
+	size_t index = swdptap_turnaround_encode(cmd, SWDIO_STATUS_DRIVE);
+	index += swdptap_out_encode(cmd + index, swdptap_request(RnW, addr), 8U);
+	index += swdptap_turnaround_encode(cmd + index, SWDIO_STATUS_FLOAT);
+	index += swdptap_in_encode(cmd + index, 3U, read_size);
+	if (RnW) {
+		index += swdptap_in_encode(cmd + index, 32U, read_size);
+		index += swdptap_in_encode(cmd + index, 1U, read_size);
+	} else {
+		index += swdptap_turnaround_encode(cmd + index, SWDIO_STATUS_DRIVE);
+		index += swdptap_out_encode(cmd + index, swdptap_write_data(value), SWD_WRITE_DATA_CYCLES);
+	}
+	return index;
+}
+
+/* Turn the bytes read back for swdptap_in_encode() into the sampled bits */
+static uint32_t swdptap_in_decode(const uint8_t *data, size_t clock_cycles)
+{
+	uint32_t result = 0;
+	if (do_mpsse) {
+		const size_t bytes = clock_cycles >> 3U;
+		const size_t bits = clock_cycles & 7U;
+		for (size_t i = 0; i < bytes; ++i)
+			result |= (uint32_t)data[i] << (8U * i);
+		/* Bit mode shifts the samples in from the top of the byte */
+		if (bits)
+			result |= (uint32_t)(data[bytes] >> (8U - bits)) << (8U * bytes);
+	} else {
+		for (size_t i = 0; i < clock_cycles; ++i) {
+			if (data[i] & active_cable->bb_swdio_in_pin)
+				result |= 1U << i;
 		}
 	}
 	return result;
 }
 
+static bool swdptap_seq_in_parity(uint32_t *res, size_t clock_cycles)
+{
+	assert(clock_cycles == 32);
+	uint8_t cmd[SWD_TRANSFER_CMD_MAX];
+	size_t size = 0;
+	size_t index = swdptap_turnaround_encode(cmd, SWDIO_STATUS_FLOAT);
+	index += swdptap_in_encode(cmd + index, clock_cycles + 1U, &size);
+	libftdi_buffer_write(cmd, index);
+	uint8_t data[33];
+	libftdi_buffer_read(data, size);
+	const uint32_t result = swdptap_in_decode(data, clock_cycles);
+	*res = result;
+	return (__builtin_parity(result) ^ swdptap_in_decode(data + size - 1U, 1U)) & 1U;
+}
+
+static uint32_t swdptap_seq_in(size_t clock_cycles)
+{
+	if (!clock_cycles)
+		return 0;
+	uint8_t cmd[SWD_TRANSFER_CMD_MAX];
+	size_t size = 0;
+	size_t index = swdptap_turnaround_encode(cmd, SWDIO_STATUS_FLOAT);
+	index += swdptap_in_encode(cmd + index, clock_cycles, &size);
+	libftdi_buffer_write(cmd, index);
+	uint8_t data[32];
+	libftdi_buffer_read(data, size);
+	return swdptap_in_decode(data, clock_cycles);
+}
+
 static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles)
 {
 	if (!clock_cycles)
 		return;
-	swdptap_turnaround(SWDIO_STATUS_DRIVE);
-	if (do_mpsse) {
-		uint8_t DI[4];
-		DI[0] = (tms_states >>  0) & 0xff;
-		DI[1] = (tms_states >>  8) & 0xff;
-		DI[2] = (tms_states >> 16) & 0xff;
-		DI[3] = (tms_states >> 24) & 0xff;
-		libftdi_jtagtap_tdi_tdo_seq(NULL, 0, DI, clock_cycles);
-	} else {
-		uint8_t cmd[16];
-		size_t index = 0;
-		while (clock_cycles) {
-			cmd[index++] = MPSSE_TMS_SHIFT;
-			if (clock_cycles >= 7) {
-				cmd[index++] = 6;
-				cmd[index++] = tms_states & 0x7f;
-				tms_states >>= 7;
-				clock_cycles -= 7;
-			} else {
-				cmd[index++] = clock_cycles - 1;
-				cmd[index++] = tms_states & 0x7f;
-				clock_cycles = 0;
-			}
+	uint8_t cmd[48];
+	size_t index = swdptap_turnaround_encode(cmd, SWDIO_STATUS_DRIVE);
+	index += swdptap_out_encode(cmd + index, tms_states, clock_cycles);
+	libftdi_buffer_write(cmd, index);
+}
+
+static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles)
+{
+	(void) clock_cycles;
+	uint8_t cmd[48];
+	size_t index = swdptap_turnaround_encode(cmd, SWDIO_STATUS_DRIVE);
+	index += swdptap_out_encode(cmd + index, swdptap_write_data(tms_states), SWD_WRITE_DATA_CYCLES);
+	libftdi_buffer_write(cmd, index);
+}
+
+/*
+ * Read back the FTDI buffers before it stops executing commands.
+ * The FT2232D holds only 384 bytes, so stay well below that.
+ */
+#define SWD_QUEUE_READ_MAX 256U
+#define SWD_QUEUE_WIRE_MAX (ADIV5_QUEUE_DEPTH * 2U)
+
+/* A transfer clocked out by the queue, waiting for its read back data */
+typedef struct swd_wire {
+	size_t offset;    /* Of the ACK in the read back data */
+	bool RnW;
+	uint32_t *result; /* Where the data phase is stored, NULL to drop it */
+} swd_wire_s;
+
+static swd_wire_s swd_wires[SWD_QUEUE_WIRE_MAX];
+static size_t swd_wire_count;
+static size_t swd_wire_size;
+
+/* Read back everything clocked since the last drain and check it in order */
+static bool swdptap_queue_drain(ADIv5_DP_t *dp)
+{
+	const size_t count = swd_wire_count;
+	swd_wire_count = 0;
+	if (!count)
+		return true;
+	uint8_t data[SWD_QUEUE_READ_MAX];
+	libftdi_buffer_read(data, swd_wire_size);
+	swd_wire_size = 0;
+
+	const size_t ack_size = do_mpsse ? 1U : 3U;
+	const size_t data_size = do_mpsse ? 4U : 32U;
+	for (size_t i = 0; i < count; ++i) {
+		const swd_wire_s *const wire = &swd_wires[i];
+		const uint32_t ack = swdptap_in_decode(data + wire->offset, 3U);
+		if (ack != SWDP_ACK_OK) {
+			DEBUG_WARN("SWD queue failed after %zu transfers, ack %" PRIx32 "\n", i, ack);
+			dp->fault = 1;
+			return false;
 		}
-		libftdi_buffer_write(cmd, index);
+		if (!wire->RnW)
+			continue;
+		const uint8_t *const response = data + wire->offset + ack_size;
+		const uint32_t value = swdptap_in_decode(response, 32U);
+		if ((__builtin_parity(value) ^ swdptap_in_decode(response + data_size, 1U)) & 1U) {
+			DEBUG_WARN("SWD queue parity error after %zu transfers\n", i);
+			dp->fault = 1;
+			return false;
+		}
+		if (wire->result)
+			*wire->result = value;
 	}
+	return true;
 }
 
-/* ARM Debug Interface Architecture Specification ADIv5.0 to ADIv5.2
- * tells to clock the data through SW-DP to either :
- * - immediate start a new transaction
- * - continue to drive idle cycles
- * - or clock at least 8 idle cycles
- *
- * Implement last option to favour correctness over
- *   slight speed decrease
+/* Clock out one transfer, deferring its ACK and any data phase to the drain */
+static bool swdptap_queue_wire(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value, uint32_t *result)
+{
+	const size_t size = (do_mpsse ? 1U : 3U) + (RnW ? (do_mpsse ? 5U : 33U) : 0U);
+	if ((swd_wire_size + size > SWD_QUEUE_READ_MAX || swd_wire_count == SWD_QUEUE_WIRE_MAX) &&
+		!swdptap_queue_drain(dp))
+		return false;
+
+	swd_wire_s *const wire = &swd_wires[swd_wire_count++];
+	wire->offset = swd_wire_size;
+	wire->RnW = RnW;
+	wire->result = result;
+
+	uint8_t cmd[SWD_TRANSFER_CMD_MAX];
+	const size_t index = swdptap_transfer_encode(cmd, RnW, addr, value, &swd_wire_size);
+	libftdi_buffer_write(cmd, index);
+	return true;
+}
+
+/*
+ * Clock the whole queue out as one MPSSE command stream and read it back in
+ * as few round trips as the FTDI buffers allow. ACKs are only checked after
+ * the fact, so the first one that is not OK fails the rest of the queue.
+ * AP reads are posted: each returns the data of the one before it, and the
+ * last is collected from RDBUFF.
  */
-static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles)
+static bool swdptap_queue_flush(ADIv5_DP_t *dp)
 {
-	(void) clock_cycles;
-	int parity = __builtin_parity(tms_states) & 1;
-	size_t index = 0;
-	swdptap_turnaround(SWDIO_STATUS_DRIVE);
-	if (do_mpsse) {
-		uint8_t DI[8];
-		DI[0] = (tms_states >>  0) & 0xff;
-		DI[1] = (tms_states >>  8) & 0xff;
-		DI[2] = (tms_states >> 16) & 0xff;
-		DI[3] = (tms_states >> 24) & 0xff;
-		DI[4] = parity;
-		DI[5] = 0;
-		libftdi_jtagtap_tdi_tdo_seq(NULL, 0, DI, 32 + 1 + 8);
-	} else {
-		uint8_t cmd[32];
-		size_t steps = clock_cycles;
-		while (steps) {
-			cmd[index++] = MPSSE_TMS_SHIFT;
-			cmd[index++] = 6;
-			if (steps >= 7) {
-				cmd[index++] = tms_states & 0x7f;
-				tms_states >>= 7;
-				steps -= 7;
-			} else {
-				cmd[index++] = (tms_states & 0x7f) | (parity << 4);
-				steps = 0;
-			}
+	const size_t count = dp->queue_len;
+	/* The recovery below uses immediate accesses, which would flush again */
+	dp->queue_len = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (dp->queue[i].RnW)
+			*dp->queue[i].result = 0;
+	}
+
+	uint32_t *posted = NULL;
+	bool ok = true;
+	for (size_t i = 0; ok && i < count; ++i) {
+		const adiv5_transfer_s *const transfer = &dp->queue[i];
+		const bool ap_read = transfer->RnW && (transfer->addr & ADIV5_APnDP);
+		if (posted && !ap_read) {
+			ok = swdptap_queue_wire(dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0, posted);
+			posted = NULL;
+			if (!ok)
+				break;
 		}
-		cmd[index++] = MPSSE_TMS_SHIFT;
-		cmd[index++] = 4;
-		cmd[index++] = 0;
-		libftdi_buffer_write(cmd, index);
+		ok = swdptap_queue_wire(dp, transfer->RnW, transfer->addr, transfer->value,
+			ap_read ? posted : transfer->result);
+		if (ap_read)
+			posted = transfer->result;
 	}
+	if (ok && posted)
+		ok = swdptap_queue_wire(dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0, posted);
+	if (ok)
+		ok = swdptap_queue_drain(dp);
+	if (ok)
+		return true;
+
+	/* The transfers clocked out behind the failure may have left the line out of step */
+	swdptap_seq_out(0xffffffffU, 32U);
+	swdptap_seq_out(0x0fffffffU, 32U);
+	adiv5_shadow_invalidate(dp);
+	if (dp->version < 2)
+		firmware_swdp_low_access(dp, ADIV5_LOW_READ, ADIV5_DP_DPIDR, 0);
+	dp->error(dp);
+	dp->fault = 1;
+	return false;
 }
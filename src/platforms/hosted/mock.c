@@ -0,0 +1,716 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Simulated probe and target for the PC-Hosted command line.
+ *
+ * Stands in for a probe with a SW-DP, an AHB-AP and a Cortex-M4 with RAM
+ * and Flash behind it, modelled at the level of the DP and AP register
+ * accesses, so everything above low_access() runs as it does against
+ * hardware. Each exchange with the "probe" is counted and takes a set
+ * latency plus the SWD clocking of its transfers, which makes the round
+ * trips and throughput of the GDB, Flash, RTT and transfer queue paths
+ * reproducible without any hardware attached.
+ */
+
+#include "general.h"
+#include <sys/time.h>
+#include "exception.h"
+#include "target.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortexm.h"
+#include "perf.h"
+#include "bmp_hosted.h"
+#include "mock.h"
+
+#define MOCK_DPIDR  0x2ba01477U /* SW-DP v1, by ARM */
+#define MOCK_AP_IDR 0x24770011U /* AHB-AP */
+#define MOCK_CPUID  0x410fc241U /* Cortex-M4 r0p1 */
+
+#define MOCK_RAM_BASE        0x20000000U
+#define MOCK_RAM_SIZE        0x10000U
+#define MOCK_FLASH_BASE      0x08000000U
+#define MOCK_FLASH_SIZE      0x20000U
+#define MOCK_FLASH_BLOCKSIZE 0x800U
+
+/* Bus writes only program the Flash with PG set, a write to ERASE erases the block holding that address */
+#define MOCK_FLASH_CTRL_BASE 0x40022000U
+#define MOCK_FLASH_CR        (MOCK_FLASH_CTRL_BASE + 0x0U)
+#define MOCK_FLASH_ERASE     (MOCK_FLASH_CTRL_BASE + 0x4U)
+#define MOCK_FLASH_CR_PG     (1U << 0U)
+
+/* The PPB is plain registers, bar the debug ones that act on writes */
+#define MOCK_PPB_SIZE  0x100000U
+#define MOCK_ROM_BASE  (CORTEXM_PPB_BASE + 0xff000U)
+#define MOCK_ID_OFFSET 0xfd0U /* PIDR4, the first of a component's ID registers */
+
+#define MOCK_FPB_CTRL ((2U << 8U) | (6U << 4U)) /* 2 literal and 6 code comparators */
+#define MOCK_DWT_CTRL (4U << 28U)               /* 4 comparators */
+#define MOCK_AIRCR    (0xfa05U << 16U)          /* VECTKEYSTAT */
+
+/* ARM's JEP106 identity, and a ROM table part number no target driver claims */
+#define MOCK_JEP106_CODE 0x3bU
+#define MOCK_JEP106_CONT 0x4U
+#define MOCK_ROM_PARTNO  0xfffU
+#define MOCK_SCS_PARTNO  0x00cU /* Cortex-M4 SCS */
+#define MOCK_DWT_PARTNO  0x002U
+#define MOCK_FPB_PARTNO  0x003U
+#define MOCK_CID_ROM     0x1U
+#define MOCK_CID_GIPC    0xeU
+
+/* DCRSR register numbers */
+#define MOCK_REGSEL_SP   13U
+#define MOCK_REGSEL_PC   15U
+#define MOCK_REGSEL_XPSR 16U
+#define MOCK_REGSEL_MSP  17U
+#define MOCK_REGSEL_MASK 0x7fU
+#define MOCK_DCRSR_REGWNR (1U << 16U)
+#define MOCK_XPSR_THUMB  (1U << 24U)
+
+/* Request, turnarounds, ACK, data, parity and idle cycles of one SWD transfer */
+#define MOCK_SWD_CYCLES 46U
+#define MOCK_DEFAULT_FREQUENCY 4000000U
+/* Reads a value match repeats before it answers, as a CMSIS-DAP probe is set up to */
+#define MOCK_MATCH_RETRY 128U
+
+#define MOCK_CTRLSTAT_STICKY \
+	(ADIV5_DP_CTRLSTAT_STICKYORUN | ADIV5_DP_CTRLSTAT_STICKYCMP | ADIV5_DP_CTRLSTAT_STICKYERR | ADIV5_DP_CTRLSTAT_WDATAERR)
+#define MOCK_CTRLSTAT_WRITABLE                                                                   \
+	(ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGRSTREQ | \
+		ADIV5_DP_CTRLSTAT_ORUNDETECT)
+
+typedef struct mock_state {
+	uint32_t latency_us;
+	uint32_t frequency;
+	/* SWD clocking of the transfers since the last round trip */
+	uint64_t wire_ns;
+	uint64_t round_trips;
+	uint64_t transfers;
+	bool nrst;
+
+	uint32_t ctrlstat;
+	uint32_t select;
+	uint32_t rdbuff;
+	uint32_t csw;
+	uint32_t tar;
+
+	bool halted;
+	bool reset_seen; /* S_RESET_ST, cleared by reading DHCSR once out of reset */
+	uint32_t dhcsr;  /* the C_* bits */
+	uint32_t dcrdr;
+	uint32_t regs[MOCK_REGSEL_MASK + 1U];
+	uint32_t flash_cr;
+
+	uint8_t *ram;
+	uint8_t *flash;
+	uint32_t *ppb;
+} mock_state_s;
+
+static mock_state_s mock;
+
+static uint64_t mock_time_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000U + tv.tv_usec;
+}
+
+/* One exchange with the probe. Spins rather than sleeps, a sleep overshoots by more than a fast link takes */
+static void mock_round_trip(void)
+{
+	++mock.round_trips;
+	PERF_COUNT(PERF_ROUND_TRIPS, 1U);
+	const uint64_t delay = mock.latency_us + mock.wire_ns / 1000U;
+	mock.wire_ns %= 1000U;
+	if (!delay)
+		return;
+	const uint64_t end = mock_time_us() + delay;
+	while (mock_time_us() < end)
+		continue;
+}
+
+static uint32_t *mock_ppb_reg(uint32_t addr)
+{
+	return &mock.ppb[(addr - CORTEXM_PPB_BASE) >> 2U];
+}
+
+static uint8_t *mock_memory(uint32_t addr)
+{
+	if (addr - MOCK_RAM_BASE < MOCK_RAM_SIZE)
+		return mock.ram + (addr - MOCK_RAM_BASE);
+	if (addr - MOCK_FLASH_BASE < MOCK_FLASH_SIZE)
+		return mock.flash + (addr - MOCK_FLASH_BASE);
+	return NULL;
+}
+
+static void mock_core_halt(uint32_t reason)
+{
+	mock.halted = true;
+	*mock_ppb_reg(CORTEXM_DFSR) |= reason;
+}
+
+static bool mock_bus_read(uint32_t addr, uint32_t *value);
+
+/* A system reset, the core starts over from the vector table at the start of Flash */
+static void mock_core_reset(void)
+{
+	memset(mock.regs, 0, sizeof(mock.regs));
+	uint32_t pc = 0;
+	mock_bus_read(MOCK_FLASH_BASE, &mock.regs[MOCK_REGSEL_MSP]);
+	mock_bus_read(MOCK_FLASH_BASE + 4U, &pc);
+	mock.regs[MOCK_REGSEL_SP] = mock.regs[MOCK_REGSEL_MSP];
+	mock.regs[MOCK_REGSEL_PC] = pc & ~1U;
+	mock.regs[MOCK_REGSEL_XPSR] = MOCK_XPSR_THUMB;
+	mock.flash_cr = 0;
+	mock.reset_seen = true;
+	mock.halted = false;
+	if ((mock.dhcsr & CORTEXM_DHCSR_C_DEBUGEN) && (*mock_ppb_reg(CORTEXM_DEMCR) & CORTEXM_DEMCR_VC_CORERESET))
+		mock_core_halt(CORTEXM_DFSR_VCATCH);
+}
+
+/* The core runs no code: it only halts when asked, and a step moves on by one 16 bit instruction */
+static void mock_dhcsr_write(uint32_t value)
+{
+	mock.dhcsr = value & (CORTEXM_DHCSR_C_SNAPSTALL | CORTEXM_DHCSR_C_MASKINTS | CORTEXM_DHCSR_C_STEP |
+							 CORTEXM_DHCSR_C_HALT | CORTEXM_DHCSR_C_DEBUGEN);
+	if (!(mock.dhcsr & CORTEXM_DHCSR_C_DEBUGEN))
+		mock.halted = false;
+	else if (mock.dhcsr & CORTEXM_DHCSR_C_HALT) {
+		if (!mock.halted)
+			mock_core_halt(CORTEXM_DFSR_HALTED);
+	} else if (mock.halted && (mock.dhcsr & CORTEXM_DHCSR_C_STEP)) {
+		mock.regs[MOCK_REGSEL_PC] += 2U;
+		*mock_ppb_reg(CORTEXM_DFSR) |= CORTEXM_DFSR_HALTED;
+	} else
+		mock.halted = false;
+}
+
+static uint32_t mock_ppb_read(uint32_t addr)
+{
+	switch (addr) {
+	case CORTEXM_DHCSR: {
+		uint32_t dhcsr = mock.dhcsr | CORTEXM_DHCSR_S_REGRDY;
+		if (mock.halted)
+			dhcsr |= CORTEXM_DHCSR_S_HALT;
+		if (mock.reset_seen)
+			dhcsr |= CORTEXM_DHCSR_S_RESET_ST;
+		if (!mock.nrst)
+			mock.reset_seen = false;
+		return dhcsr;
+	}
+	case CORTEXM_DCRDR:
+		return mock.dcrdr;
+	case CORTEXM_AIRCR:
+		return MOCK_AIRCR;
+	default:
+		return *mock_ppb_reg(addr);
+	}
+}
+
+static void mock_ppb_write(uint32_t addr, uint32_t value, uint32_t mask)
+{
+	uint32_t *const reg = mock_ppb_reg(addr);
+	value = (*reg & ~mask) | (value & mask);
+	switch (addr) {
+	case CORTEXM_DHCSR:
+		if ((value & 0xffff0000U) == CORTEXM_DHCSR_DBGKEY)
+			mock_dhcsr_write(value);
+		return;
+	case CORTEXM_DCRSR:
+		if (value & MOCK_DCRSR_REGWNR)
+			mock.regs[value & MOCK_REGSEL_MASK] = mock.dcrdr;
+		else
+			mock.dcrdr = mock.regs[value & MOCK_REGSEL_MASK];
+		return;
+	case CORTEXM_DCRDR:
+		mock.dcrdr = value;
+		return;
+	case CORTEXM_AIRCR:
+		if ((value & 0xffff0000U) == CORTEXM_AIRCR_VECTKEY && (value & CORTEXM_AIRCR_SYSRESETREQ))
+			mock_core_reset();
+		return;
+	case CORTEXM_DFSR:
+		*reg &= ~value;
+		return;
+	case CORTEXM_FPB_CTRL:
+		if (value & CORTEXM_FPB_CTRL_KEY)
+			*reg = (*reg & ~CORTEXM_FPB_CTRL_ENABLE) | (value & CORTEXM_FPB_CTRL_ENABLE);
+		return;
+	case CORTEXM_CPUID:
+	case CORTEXM_DWT_CTRL:
+		return;
+	default:
+		break;
+	}
+	/* The ROM table and the ID registers of each component are read only */
+	if (addr >= MOCK_ROM_BASE || (addr & 0xfffU) >= MOCK_ID_OFFSET)
+		return;
+	*reg = value;
+}
+
+static bool mock_flash_ctrl_write(uint32_t addr, uint32_t value)
+{
+	if (addr == MOCK_FLASH_CR) {
+		mock.flash_cr = value & MOCK_FLASH_CR_PG;
+		return true;
+	}
+	if (addr == MOCK_FLASH_ERASE && value - MOCK_FLASH_BASE < MOCK_FLASH_SIZE) {
+		memset(mock_memory(value & ~(MOCK_FLASH_BLOCKSIZE - 1U)), 0xff, MOCK_FLASH_BLOCKSIZE);
+		return true;
+	}
+	return false;
+}
+
+/* A bus read of the word holding addr, false on a bus fault */
+static bool mock_bus_read(uint32_t addr, uint32_t *value)
+{
+	addr &= ~3U;
+	const uint8_t *const mem = mock_memory(addr);
+	if (mem)
+		*value = mem[0] | (mem[1] << 8U) | (mem[2] << 16U) | ((uint32_t)mem[3] << 24U);
+	else if (addr - CORTEXM_PPB_BASE < MOCK_PPB_SIZE)
+		*value = mock_ppb_read(addr);
+	else if (addr == MOCK_FLASH_CR)
+		*value = mock.flash_cr;
+	else
+		return false;
+	return true;
+}
+
+/* A bus write of the byte lanes of value set in mask, to the word holding addr, false on a bus fault */
+static bool mock_bus_write(uint32_t addr, uint32_t value, uint32_t mask)
+{
+	addr &= ~3U;
+	uint8_t *const mem = mock_memory(addr);
+	if (addr - CORTEXM_PPB_BASE < MOCK_PPB_SIZE) {
+		mock_ppb_write(addr, value, mask);
+		return true;
+	}
+	if (!mem)
+		return mock_flash_ctrl_write(addr, value & mask);
+	const bool flash = addr - MOCK_FLASH_BASE < MOCK_FLASH_SIZE;
+	/* Flash ignores writes outside programming, and programming only clears bits */
+	if (flash && !(mock.flash_cr & MOCK_FLASH_CR_PG))
+		return true;
+	for (size_t i = 0; i < 4U; ++i) {
+		if (!(mask & (0xffU << (i * 8U))))
+			continue;
+		const uint8_t byte = value >> (i * 8U);
+		mem[i] = flash ? mem[i] & byte : byte;
+	}
+	return true;
+}
+
+/* A DRW access of the width CSW sets, as many as fit the word when packed */
+static uint32_t mock_drw_access(bool read, uint32_t value)
+{
+	const uint32_t size = 1U << MIN(mock.csw & ADIV5_AP_CSW_SIZE_MASK, 2U);
+	const uint32_t addrinc = mock.csw & ADIV5_AP_CSW_ADDRINC_MASK;
+	const size_t count = addrinc == ADIV5_AP_CSW_ADDRINC_PACKED ? 4U / size : 1U;
+	uint32_t result = 0;
+	for (size_t i = 0; i < count; ++i) {
+		const uint32_t lanes = (size == 4U ? 0xffffffffU : (1U << (size * 8U)) - 1U) << ((mock.tar & 3U) * 8U);
+		uint32_t word = 0;
+		if (read ? !mock_bus_read(mock.tar, &word) : !mock_bus_write(mock.tar, value, lanes)) {
+			mock.ctrlstat |= ADIV5_DP_CTRLSTAT_STICKYERR;
+			return 0;
+		}
+		result |= word & lanes;
+		if (addrinc != ADIV5_AP_CSW_ADDRINC_NONE)
+			mock.tar += size;
+	}
+	return result;
+}
+
+/* The banked data registers reach the four words of the 16 byte block TAR points into */
+static uint32_t mock_bd_access(bool read, uint8_t reg, uint32_t value)
+{
+	const uint32_t addr = (mock.tar & ~0xfU) | (reg & 0xcU);
+	uint32_t word = 0;
+	if (read ? !mock_bus_read(addr, &word) : !mock_bus_write(addr, value, 0xffffffffU))
+		mock.ctrlstat |= ADIV5_DP_CTRLSTAT_STICKYERR;
+	return word;
+}
+
+/* Only AP0 is there, the others read as absent */
+static uint32_t mock_ap_access(bool read, uint8_t reg, uint32_t value)
+{
+	if (mock.select >> 24U)
+		return 0;
+	switch (reg) {
+	case ADIV5_AP_CSW & 0xffU:
+		if (!read)
+			mock.csw = value & ~(ADIV5_AP_CSW_TRINPROG | ADIV5_AP_CSW_DEVICEEN);
+		return mock.csw | ADIV5_AP_CSW_DEVICEEN;
+	case ADIV5_AP_TAR & 0xffU:
+		if (!read)
+			mock.tar = value;
+		return mock.tar;
+	case ADIV5_AP_DRW & 0xffU:
+		return mock_drw_access(read, value);
+	case ADIV5_AP_DB(0) & 0xffU:
+	case ADIV5_AP_DB(1) & 0xffU:
+	case ADIV5_AP_DB(2) & 0xffU:
+	case ADIV5_AP_DB(3) & 0xffU:
+		return mock_bd_access(read, reg, value);
+	case ADIV5_AP_BASE & 0xffU:
+		return MOCK_ROM_BASE | 3U;
+	case ADIV5_AP_IDR & 0xffU:
+		return MOCK_AP_IDR;
+	default:
+		return 0;
+	}
+}
+
+static uint32_t mock_ctrlstat(void)
+{
+	/* Power up and debug reset requests are granted at once */
+	uint32_t ctrlstat = mock.ctrlstat;
+	if (ctrlstat & ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ)
+		ctrlstat |= ADIV5_DP_CTRLSTAT_CSYSPWRUPACK;
+	if (ctrlstat & ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ)
+		ctrlstat |= ADIV5_DP_CTRLSTAT_CDBGPWRUPACK;
+	if (ctrlstat & ADIV5_DP_CTRLSTAT_CDBGRSTREQ)
+		ctrlstat |= ADIV5_DP_CTRLSTAT_CDBGRSTACK;
+	return ctrlstat;
+}
+
+static void mock_dp_abort(uint32_t abort)
+{
+	if (abort & ADIV5_DP_ABORT_ORUNERRCLR)
+		mock.ctrlstat &= ~ADIV5_DP_CTRLSTAT_STICKYORUN;
+	if (abort & ADIV5_DP_ABORT_WDERRCLR)
+		mock.ctrlstat &= ~ADIV5_DP_CTRLSTAT_WDATAERR;
+	if (abort & ADIV5_DP_ABORT_STKERRCLR)
+		mock.ctrlstat &= ~ADIV5_DP_CTRLSTAT_STICKYERR;
+	if (abort & ADIV5_DP_ABORT_STKCMPCLR)
+		mock.ctrlstat &= ~ADIV5_DP_CTRLSTAT_STICKYCMP;
+}
+
+/* One transfer as the SW-DP takes it, AP reads are posted and return the result of the one before */
+static uint32_t mock_transfer(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value)
+{
+	if ((addr & ADIV5_APnDP) && dp->fault)
+		return 0;
+	++mock.transfers;
+	mock.wire_ns += (uint64_t)MOCK_SWD_CYCLES * 1000000000U / mock.frequency;
+
+	if (addr & ADIV5_APnDP) {
+		PERF_COUNT(RnW ? PERF_AP_READ : PERF_AP_WRITE, 1U);
+		/* With a sticky error standing the AP accesses are answered FAULT */
+		if (mock.ctrlstat & ADIV5_DP_CTRLSTAT_STICKYERR) {
+			PERF_COUNT(PERF_ACK_FAULT, 1U);
+			dp->fault = 1;
+			return 0;
+		}
+		const uint8_t reg = (mock.select & 0xf0U) | (addr & 0x0cU);
+		if (!RnW) {
+			mock_ap_access(false, reg, value);
+			return 0;
+		}
+		const uint32_t posted = mock.rdbuff;
+		mock.rdbuff = mock_ap_access(true, reg, 0);
+		return posted;
+	}
+
+	PERF_COUNT(RnW ? PERF_DP_READ : PERF_DP_WRITE, 1U);
+	switch (addr & 0x0cU) {
+	case ADIV5_DP_DPIDR:
+		if (RnW)
+			return MOCK_DPIDR;
+		mock_dp_abort(value);
+		return 0;
+	case ADIV5_DP_CTRLSTAT:
+		if (RnW)
+			return mock_ctrlstat();
+		mock.ctrlstat = (mock.ctrlstat & MOCK_CTRLSTAT_STICKY) | (value & MOCK_CTRLSTAT_WRITABLE);
+		return 0;
+	case ADIV5_DP_SELECT:
+		if (!RnW)
+			mock.select = value;
+		return 0;
+	default:
+		return RnW ? mock.rdbuff : 0;
+	}
+}
+
+static uint32_t mock_dp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value)
+{
+	const uint32_t result = mock_transfer(dp, RnW, addr, value);
+	mock_round_trip();
+	return result;
+}
+
+/* AP reads are posted, their value comes with the RDBUFF read after */
+static uint32_t mock_dp_read(ADIv5_DP_t *dp, uint16_t addr)
+{
+	if (addr & ADIV5_APnDP) {
+		mock_dp_low_access(dp, ADIV5_LOW_READ, addr, 0);
+		addr = ADIV5_DP_RDBUFF;
+	}
+	return mock_dp_low_access(dp, ADIV5_LOW_READ, addr, 0);
+}
+
+/* The whole queue is one exchange, the probe resolving the posted AP reads as it goes */
+static bool mock_queue_flush(ADIv5_DP_t *dp)
+{
+	bool posted = false;
+	uint32_t *posted_result = NULL;
+	for (size_t i = 0; i < dp->queue_len; ++i) {
+		const adiv5_transfer_s *const transfer = &dp->queue[i];
+		const uint32_t value = mock_transfer(dp, transfer->RnW, transfer->addr, transfer->value);
+		if (!transfer->RnW)
+			continue;
+		if (transfer->addr & ADIV5_APnDP) {
+			if (posted && posted_result)
+				*posted_result = value;
+			posted = true;
+			posted_result = transfer->result;
+		} else if (transfer->result)
+			*transfer->result = value;
+	}
+	if (posted) {
+		const uint32_t value = mock_transfer(dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+		if (posted_result)
+			*posted_result = value;
+	}
+	mock_round_trip();
+	return !dp->fault;
+}
+
+/* A CMSIS-DAP style value match read, the DRW reads done without address increment in one exchange */
+static bool mock_mem_poll32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t value)
+{
+	ADIv5_DP_t *const dp = ap->dp;
+	const uint32_t select = (uint32_t)ap->apsel << 24U;
+	const uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_NONE | ADIV5_AP_CSW_SIZE_WORD;
+	if (!adiv5_dp_select_shadowed(dp, select)) {
+		mock_transfer(dp, ADIV5_LOW_WRITE, ADIV5_DP_SELECT, select);
+		adiv5_dp_select_shadow(dp, select);
+	}
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_CSW, csw)) {
+		mock_transfer(dp, ADIV5_LOW_WRITE, ADIV5_AP_CSW, csw);
+		adiv5_ap_shadow_write(ap, ADIV5_AP_CSW, csw);
+	}
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_TAR, addr)) {
+		mock_transfer(dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr);
+		adiv5_ap_shadow_write(ap, ADIV5_AP_TAR, addr);
+	}
+	/* The first read is posted, each one after returns the word the one before read */
+	mock_transfer(dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	bool match = false;
+	for (size_t i = 0; i <= MOCK_MATCH_RETRY && !match && !dp->fault; ++i)
+		match = (mock_transfer(dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0) & mask) == value;
+	mock_round_trip();
+	return match;
+}
+
+static bool mock_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
+{
+	for (size_t offset = 0; offset < len; offset += f->blocksize)
+		target_mem_write32(f->t, MOCK_FLASH_ERASE, addr + offset);
+	return !target_check_error(f->t);
+}
+
+/* Erases are done as soon as they are asked for, which still takes the background erase path */
+static bool mock_flash_erase_start(target_flash_s *f, target_addr_t addr)
+{
+	return mock_flash_erase(f, addr, f->blocksize);
+}
+
+static flash_poll_result_e mock_flash_status(target_flash_s *f)
+{
+	return target_check_error(f->t) ? FLASH_POLL_ERROR : FLASH_POLL_DONE;
+}
+
+static bool mock_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+{
+	target_mem_write32(f->t, MOCK_FLASH_CR, MOCK_FLASH_CR_PG);
+	target_mem_write(f->t, dest, src, len);
+	target_mem_write32(f->t, MOCK_FLASH_CR, 0);
+	return !target_check_error(f->t);
+}
+
+static void mock_add_flash(target *t)
+{
+	target_flash_s *f = calloc(1, sizeof(*f));
+	if (!f) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return;
+	}
+
+	f->start = MOCK_FLASH_BASE;
+	f->length = MOCK_FLASH_SIZE;
+	f->blocksize = MOCK_FLASH_BLOCKSIZE;
+	f->erase = mock_flash_erase;
+	f->erase_start = mock_flash_erase_start;
+	f->status = mock_flash_status;
+	f->write = mock_flash_write;
+	f->erased = 0xff;
+	target_add_flash(t, f);
+}
+
+/* A fixed ID, the simulated Flash starts out erased on every run so a cached record of it never holds */
+static size_t mock_unique_id(target *t, uint8_t *uid)
+{
+	(void)t;
+	static const uint8_t mock_uid[] = {'B', 'M', 'P', 'M', 'O', 'C', 'K', '1'};
+	memcpy(uid, mock_uid, sizeof(mock_uid));
+	return sizeof(mock_uid);
+}
+
+/* No driver claims the simulated part, so give the Cortex-M found its memory map here */
+static void mock_target_setup(target *t)
+{
+	/* Taken back from the scan cache with its map */
+	if (t->ram)
+		return;
+	t->driver = "Mock Cortex-M";
+	/* The core runs no code, so these take the host side paths rather than a stub */
+	t->crc32 = NULL;
+	t->mem_fill = NULL;
+	t->mem_find = NULL;
+	t->unique_id = mock_unique_id;
+	/* The simulated core is out of reset as soon as it is asked */
+	t->reset_profile = &cortexm_reset_instant;
+	target_add_ram(t, MOCK_RAM_BASE, MOCK_RAM_SIZE);
+	mock_add_flash(t);
+}
+
+uint32_t mock_swdp_scan(void)
+{
+	target_list_free();
+
+	ADIv5_DP_t *dp = calloc(1, sizeof(*dp));
+	if (!dp) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return 0;
+	}
+
+	dp->dp_read = mock_dp_read;
+	dp->error = firmware_swdp_error;
+	dp->low_access = mock_dp_low_access;
+	dp->abort = firmware_swdp_abort;
+
+	/* A line reset leaves the DP with bank 0 selected */
+	mock.select = 0;
+	adiv5_dp_init(dp, 0);
+
+	for (target *t = target_list; t; t = t->next)
+		mock_target_setup(t);
+	return target_list ? 1U : 0U;
+}
+
+void mock_adiv5_dp_defaults(ADIv5_DP_t *dp)
+{
+	dp->queue_flush = mock_queue_flush;
+	dp->mem_poll32 = mock_mem_poll32;
+}
+
+/* ID registers of an ARM component whose 4KiB block starts at base */
+static void mock_component_ids(uint32_t base, uint8_t cid_class, uint16_t partno)
+{
+	uint32_t *const ids = mock_ppb_reg(base + MOCK_ID_OFFSET);
+	ids[0] = MOCK_JEP106_CONT;
+	ids[4] = partno & 0xffU;
+	ids[5] = ((partno >> 8U) & 0xfU) | ((MOCK_JEP106_CODE & 0xfU) << 4U);
+	ids[6] = (MOCK_JEP106_CODE >> 4U) | 0x8U; /* JEP106 code used */
+	ids[8] = 0x0dU;
+	ids[9] = cid_class << 4U;
+	ids[10] = 0x05U;
+	ids[11] = 0xb1U;
+}
+
+static void mock_ppb_setup(void)
+{
+	static const uint32_t components[] = {CORTEXM_SCS_BASE, CORTEXM_DWT_BASE, CORTEXM_FPB_BASE};
+	uint32_t *const entries = mock_ppb_reg(MOCK_ROM_BASE);
+	for (size_t i = 0; i < ARRAY_LENGTH(components); ++i)
+		entries[i] = ((components[i] - MOCK_ROM_BASE) & ADIV5_ROM_ROMENTRY_OFFSET) | 3U;
+	*mock_ppb_reg(MOCK_ROM_BASE + ADIV5_ROM_MEMTYPE) = ADIV5_ROM_MEMTYPE_SYSMEM;
+	mock_component_ids(MOCK_ROM_BASE, MOCK_CID_ROM, MOCK_ROM_PARTNO);
+	mock_component_ids(CORTEXM_SCS_BASE, MOCK_CID_GIPC, MOCK_SCS_PARTNO);
+	mock_component_ids(CORTEXM_DWT_BASE, MOCK_CID_GIPC, MOCK_DWT_PARTNO);
+	mock_component_ids(CORTEXM_FPB_BASE, MOCK_CID_GIPC, MOCK_FPB_PARTNO);
+
+	*mock_ppb_reg(CORTEXM_CPUID) = MOCK_CPUID;
+	*mock_ppb_reg(CORTEXM_FPB_CTRL) = MOCK_FPB_CTRL;
+	*mock_ppb_reg(CORTEXM_DWT_CTRL) = MOCK_DWT_CTRL;
+}
+
+int mock_init(bmp_info_t *info, uint32_t latency_us)
+{
+	memset(&mock, 0, sizeof(mock));
+	mock.ram = calloc(1, MOCK_RAM_SIZE);
+	mock.flash = malloc(MOCK_FLASH_SIZE);
+	mock.ppb = calloc(1, MOCK_PPB_SIZE);
+	if (!mock.ram || !mock.flash || !mock.ppb) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return -1;
+	}
+	memset(mock.flash, 0xff, MOCK_FLASH_SIZE);
+	mock.latency_us = latency_us;
+	mock.frequency = MOCK_DEFAULT_FREQUENCY;
+	mock_ppb_setup();
+	/* Power on, the core is running */
+	mock_core_reset();
+
+	snprintf(info->manufacturer, sizeof(info->manufacturer), "Black Magic Debug");
+	snprintf(info->product, sizeof(info->product), "Mock");
+	snprintf(info->version, sizeof(info->version), "%" PRIu32 "us per round trip", latency_us);
+	DEBUG_INFO("Simulated Cortex-M4, %" PRIu32 "us per round trip\n", latency_us);
+	return 0;
+}
+
+void mock_exit_function(void)
+{
+	PRINT_INFO("Mock: %" PRIu64 " round trips, %" PRIu64 " transfers\n", mock.round_trips, mock.transfers);
+	free(mock.ram);
+	free(mock.flash);
+	free(mock.ppb);
+	mock.ram = NULL;
+	mock.flash = NULL;
+	mock.ppb = NULL;
+}
+
+const char *mock_target_voltage(void)
+{
+	return "3.3V";
+}
+
+/* Taking nRST resets the core, and S_RESET_ST stays set for as long as it is held */
+void mock_nrst_set_val(bool assert)
+{
+	if (assert && !mock.nrst)
+		mock_core_reset();
+	mock.nrst = assert;
+}
+
+bool mock_nrst_get_val(void)
+{
+	return mock.nrst;
+}
+
+void mock_max_frequency_set(uint32_t freq)
+{
+	mock.frequency = freq;
+}
+
+uint32_t mock_max_frequency_get(void)
+{
+	return mock.frequency;
+}
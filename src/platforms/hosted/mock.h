@@ -0,0 +1,34 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PLATFORMS_HOSTED_MOCK_H
+#define PLATFORMS_HOSTED_MOCK_H
+
+#include "bmp_hosted.h"
+#include "adiv5.h"
+
+int mock_init(bmp_info_t *info, uint32_t latency_us);
+void mock_exit_function(void);
+uint32_t mock_swdp_scan(void);
+void mock_adiv5_dp_defaults(ADIv5_DP_t *dp);
+const char *mock_target_voltage(void);
+void mock_nrst_set_val(bool assert);
+bool mock_nrst_get_val(void);
+void mock_max_frequency_set(uint32_t freq);
+uint32_t mock_max_frequency_get(void);
+
+#endif /* PLATFORMS_HOSTED_MOCK_H */
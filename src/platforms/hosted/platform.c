@@ -27,12 +27,15 @@
 #include "adiv5.h"
 #include "timing.h"
 #include "cli.h"
+#include "client.h"
+#include "bench.h"
 #include "gdb_if.h"
 #include <signal.h>
 
 #ifdef ENABLE_RTT
 #include "rtt_if.h"
 #endif
+#include "traceswo.h"
 
 #include "bmp_remote.h"
 #include "bmp_hosted.h"
@@ -40,6 +43,9 @@
 #include "ftdi_bmp.h"
 #include "jlink.h"
 #include "cmsis_dap.h"
+#include "mock.h"
+#include "wire_trace.h"
+#include "json_events.h"
 
 bmp_info_t info;
 
@@ -52,15 +58,26 @@ void gdb_ident(char *p, int count)
 	snprintf(p, count, "%s (%s), %s", info.manufacturer, info.product, info.version);
 }
 
-static void exit_function(void)
+void platform_probe_close(void)
 {
+	if (!wire_trace_dump())
+		DEBUG_WARN("Writing the wire trace to %s failed\n", cl_opts.opt_wire_trace);
+	traceswo_deinit();
 	libusb_exit_function(&info);
 
 	switch (info.bmp_type) {
+	case BMP_TYPE_BMP:
+		serial_close();
+		break;
+
 	case BMP_TYPE_CMSIS_DAP:
 		dap_exit_function();
 		break;
 
+	case BMP_TYPE_MOCK:
+		mock_exit_function();
+		break;
+
 	default:
 		break;
 	}
@@ -69,67 +86,112 @@ static void exit_function(void)
 	rtt_if_exit();
 #endif
 	fflush(stdout);
+	info.bmp_type = BMP_TYPE_NONE;
 }
 
-/* SIGTERM handler. */
-static void sigterm_handler(int sig)
-{
-	(void)sig;
-	exit(0);
-}
-
-void platform_init(int argc, char **argv)
+/* Find and set up the probe opt selects, the options are kept for later scans */
+int platform_probe_open(const BMP_CL_OPTIONS_t *opt)
 {
-	cl_init(&cl_opts, argc, argv);
-	atexit(exit_function);
-	signal(SIGTERM, sigterm_handler);
-	signal(SIGINT, sigterm_handler);
-
-	if (cl_opts.opt_device)
+	if (opt != &cl_opts)
+		cl_opts = *opt;
+	if (cl_opts.opt_mock)
+		info.bmp_type = BMP_TYPE_MOCK;
+	else if (cl_opts.opt_device)
 		info.bmp_type = BMP_TYPE_BMP;
 	else if (find_debuggers(&cl_opts, &info))
-		exit(-1);
+		return -1;
+	json_events_set_serial(info.serial);
 
 	bmp_ident(&info);
 
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
+#if HOSTED_BMP_ONLY != 1
+		/* Prefer the vendor bulk interface if the firmware has one, the tty otherwise */
+		if (!cl_opts.opt_device && info.out_ep && !bmp_bulk_open(&info)) {
+			remote_init();
+			break;
+		}
+#endif
 		if (serial_open(&cl_opts, info.serial))
-			exit(-1);
+			return -1;
 		remote_init();
 		break;
 
 	case BMP_TYPE_STLINKV2:
 		if (stlink_init(&info))
-			exit(-1);
+			return -1;
 		break;
 
 	case BMP_TYPE_CMSIS_DAP:
 		if (dap_init(&info))
-			exit(-1);
+			return -1;
 		break;
 
 	case BMP_TYPE_LIBFTDI:
 		if (ftdi_bmp_init(&cl_opts, &info))
-			exit(-1);
+			return -1;
 		break;
 
 	case BMP_TYPE_JLINK:
 		if (jlink_init(&info))
-			exit(-1);
+			return -1;
+		break;
+
+	case BMP_TYPE_MOCK:
+		if (mock_init(&info, cl_opts.opt_mock_latency_us))
+			return -1;
 		break;
 
 	default:
-		exit(-1);
+		return -1;
 	}
+	return 0;
+}
+
+/* SIGTERM handler. */
+static void sigterm_handler(int sig)
+{
+	(void)sig;
+	exit(0);
+}
+
+void platform_init(int argc, char **argv)
+{
+	cl_init(&cl_opts, argc, argv);
+	/* Before anything is printed, so it goes to stderr rather than to GDB */
+	if (cl_opts.opt_stdio && !gdb_if_use_stdio())
+		exit(-1);
+	/* A resident server already holds the probe, it does the work */
+	if (cl_opts.opt_client_port)
+		exit(cl_client_execute(&cl_opts));
+	/* The code benchmark runs against a target in host memory */
+	if (cl_opts.opt_mode == BMP_MODE_BENCH_CODE)
+		exit(cl_bench_code() ? 0 : -1);
+	/* Only the workers return, each with its own probe selected */
+	if (cl_opts.opt_gang)
+		cl_gang(&cl_opts);
+	else if (cl_opts.opt_station)
+		cl_station(&cl_opts);
+	atexit(platform_probe_close);
+	signal(SIGTERM, sigterm_handler);
+	signal(SIGINT, sigterm_handler);
+	if (cl_opts.opt_wire_trace && !wire_trace_init(cl_opts.opt_wire_trace))
+		exit(-1);
+	if (cl_opts.opt_json && !json_events_init())
+		exit(-1);
+
+	if (platform_probe_open(&cl_opts))
+		exit(-1);
 
 	if (cl_opts.opt_mode != BMP_MODE_DEBUG)
-		exit(cl_execute(&cl_opts));
+		exit(cl_opts.opt_station ? cl_station_worker(&cl_opts) : cl_execute(&cl_opts));
 	else {
 		gdb_if_init();
+		traceswo_output_init(cl_opts.opt_swo_out);
 
 #ifdef ENABLE_RTT
-		rtt_if_init();
+		rtt_if_init(cl_opts.opt_rtt_port);
 #endif
 		return;
 	}
@@ -153,6 +215,9 @@ uint32_t platform_adiv5_swdp_scan(uint32_t targetid)
 	case BMP_TYPE_JLINK:
 		return jlink_swdp_scan(&info);
 
+	case BMP_TYPE_MOCK:
+		return mock_swdp_scan();
+
 	default:
 		return 0;
 	}
@@ -169,6 +234,7 @@ int swdptap_init(ADIv5_DP_t *dp)
 
 	case BMP_TYPE_STLINKV2:
 	case BMP_TYPE_JLINK:
+	case BMP_TYPE_MOCK:
 		return 0;
 
 	case BMP_TYPE_LIBFTDI:
@@ -185,6 +251,24 @@ void platform_add_jtag_dev(uint32_t i, const jtag_dev_t *jtag_dev)
 		remote_add_jtag_dev(i, jtag_dev);
 }
 
+bool platform_flash_offload_supported(void)
+{
+	return info.bmp_type == BMP_TYPE_BMP && remote_flash_offload_supported();
+}
+
+#ifdef ENABLE_RTT
+bool platform_rtt_offload(target *t)
+{
+	switch (info.bmp_type) {
+	case BMP_TYPE_BMP:
+		return remote_rtt_poll(t, info.is_jtag, cl_opts.opt_targetid);
+
+	default:
+		return false;
+	}
+}
+#endif
+
 uint32_t platform_jtag_scan(const uint8_t *lrlens)
 {
 	info.is_jtag = true;
@@ -247,6 +331,13 @@ void platform_adiv5_dp_defaults(ADIv5_DP_t *dp)
 	case BMP_TYPE_CMSIS_DAP:
 		return dap_adiv5_dp_defaults(dp);
 
+	case BMP_TYPE_MOCK:
+		if (cl_opts.opt_no_hl) {
+			DEBUG_WARN("Not queueing transfers\n");
+			return;
+		}
+		return mock_adiv5_dp_defaults(dp);
+
 	default:
 		break;
 	}
@@ -292,6 +383,9 @@ char *platform_ident(void)
 	case BMP_TYPE_JLINK:
 		return "J-Link";
 
+	case BMP_TYPE_MOCK:
+		return "Mock";
+
 	default:
 		return NULL;
 	}
@@ -312,6 +406,9 @@ const char *platform_target_voltage(void)
 	case BMP_TYPE_JLINK:
 		return jlink_target_voltage(&info);
 
+	case BMP_TYPE_MOCK:
+		return mock_target_voltage();
+
 	default:
 		return NULL;
 	}
@@ -335,6 +432,9 @@ void platform_nrst_set_val(bool assert)
 	case BMP_TYPE_CMSIS_DAP:
 		return dap_nrst_set_val(assert);
 
+	case BMP_TYPE_MOCK:
+		return mock_nrst_set_val(assert);
+
 	default:
 		break;
 	}
@@ -355,6 +455,9 @@ bool platform_nrst_get_val(void)
 	case BMP_TYPE_LIBFTDI:
 		return libftdi_nrst_get_val();
 
+	case BMP_TYPE_MOCK:
+		return mock_nrst_get_val();
+
 	default:
 		return false;
 	}
@@ -386,6 +489,10 @@ void platform_max_frequency_set(uint32_t freq)
 		jlink_max_frequency_set(&info, freq);
 		break;
 
+	case BMP_TYPE_MOCK:
+		mock_max_frequency_set(freq);
+		break;
+
 	default:
 		DEBUG_WARN("Setting max SWJ frequency not yet implemented\n");
 		break;
@@ -417,6 +524,9 @@ uint32_t platform_max_frequency_get(void)
 	case BMP_TYPE_JLINK:
 		return jlink_max_frequency_get(&info);
 
+	case BMP_TYPE_MOCK:
+		return mock_max_frequency_get();
+
 	default:
 		DEBUG_WARN("Reading max SWJ frequency not yet implemented\n");
 		return 0;
@@ -483,10 +593,71 @@ void platform_buffer_flush(void)
 	}
 }
 
-void platform_pace_poll(void)
+bool platform_traceswo_start(const traceswo_mode_e mode, const uint32_t baudrate, uint32_t *const actual_baudrate)
+{
+	switch (info.bmp_type) {
+	case BMP_TYPE_CMSIS_DAP:
+		return dap_swo_start(
+			mode == SWO_MODE_MANCHESTER ? DAP_SWO_MODE_MANCHESTER : DAP_SWO_MODE_UART, baudrate, actual_baudrate);
+
+	case BMP_TYPE_JLINK:
+		if (mode != SWO_MODE_UART) {
+			DEBUG_WARN("J-Link captures SWO in UART mode only\n");
+			return false;
+		}
+		*actual_baudrate = baudrate;
+		return jlink_swo_start(&info, baudrate);
+
+	default:
+		DEBUG_WARN("Trace capture is not supported for this probe\n");
+		return false;
+	}
+}
+
+int platform_traceswo_read(uint8_t *const data, const size_t size)
+{
+	switch (info.bmp_type) {
+	case BMP_TYPE_CMSIS_DAP:
+		return dap_swo_read(data, size);
+
+	case BMP_TYPE_JLINK:
+		return jlink_swo_read(&info, data, size);
+
+	default:
+		return -1;
+	}
+}
+
+void platform_traceswo_stop(void)
+{
+	switch (info.bmp_type) {
+	case BMP_TYPE_CMSIS_DAP:
+		return dap_swo_stop();
+
+	case BMP_TYPE_JLINK:
+		return jlink_swo_stop(&info);
+
+	default:
+		break;
+	}
+}
+
+uint32_t pace_poll_burst_ms = 50;
+uint32_t pace_poll_max_ms = 8;
+
+/*
+ * Most halts come right after a resume or step, so those are polled for
+ * without pausing. After the burst each pause is a quarter of the time
+ * spent running so far, so pauses grow geometrically up to the ceiling.
+ * The pause is spent waiting on the GDB sockets, a packet from any GDB
+ * ends it at once.
+ */
+void platform_pace_poll(const uint32_t running_ms)
 {
-	if (!cl_opts.fast_poll)
-		platform_delay(8);
+	if (cl_opts.fast_poll || running_ms < pace_poll_burst_ms)
+		return;
+	const uint32_t pause = (running_ms - pace_poll_burst_ms) / 4U + 1U;
+	gdb_if_wait(MIN(pause, pace_poll_max_ms));
 }
 
 void platform_target_clk_output_enable(const bool enable)
@@ -585,17 +756,22 @@ static void ap_decode_access(uint16_t addr, uint8_t RnW)
 	}
 }
 
+/* Immediate accesses must not overtake queued ones, so each flushes the queue first */
 void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
 {
+	adiv5_queue_flush(dp);
 	if (cl_debuglevel & BMP_DEBUG_TARGET) {
 		ap_decode_access(addr, ADIV5_LOW_WRITE);
 		fprintf(stderr, " 0x%08" PRIx32 "\n", value);
 	}
+	if (addr == ADIV5_DP_SELECT)
+		dp->select_valid = false;
 	dp->low_access(dp, ADIV5_LOW_WRITE, addr, value);
 }
 
 uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
+	adiv5_queue_flush(dp);
 	uint32_t ret = dp->dp_read(dp, addr);
 	if (cl_debuglevel & BMP_DEBUG_TARGET) {
 		ap_decode_access(addr, ADIV5_LOW_READ);
@@ -606,6 +782,8 @@ uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 
 uint32_t adiv5_dp_error(ADIv5_DP_t *dp)
 {
+	adiv5_queue_flush(dp);
+	adiv5_shadow_invalidate(dp);
 	uint32_t ret = dp->error(dp);
 	DEBUG_TARGET("DP Error 0x%08" PRIx32 "\n", ret);
 	return ret;
@@ -613,6 +791,7 @@ uint32_t adiv5_dp_error(ADIv5_DP_t *dp)
 
 uint32_t adiv5_dp_low_access(struct ADIv5_DP_s *dp, uint8_t RnW, uint16_t addr, uint32_t value)
 {
+	adiv5_queue_flush(dp);
 	uint32_t ret = dp->low_access(dp, RnW, addr, value);
 	if (cl_debuglevel & BMP_DEBUG_TARGET) {
 		ap_decode_access(addr, RnW);
@@ -623,6 +802,7 @@ uint32_t adiv5_dp_low_access(struct ADIv5_DP_s *dp, uint8_t RnW, uint16_t addr,
 
 uint32_t adiv5_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 {
+	adiv5_queue_flush(ap->dp);
 	uint32_t ret = ap->dp->ap_read(ap, addr);
 	if (cl_debuglevel & BMP_DEBUG_TARGET) {
 		ap_decode_access(addr, ADIV5_LOW_READ);
@@ -633,6 +813,7 @@ uint32_t adiv5_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 
 void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
+	adiv5_queue_flush(ap->dp);
 	if (cl_debuglevel & BMP_DEBUG_TARGET) {
 		ap_decode_access(addr, ADIV5_LOW_WRITE);
 		fprintf(stderr, " 0x%08" PRIx32 "\n", value);
@@ -642,6 +823,7 @@ void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 
 void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
+	adiv5_queue_flush(ap->dp);
 	ap->dp->mem_read(ap, dest, src, len);
 	if (cl_debuglevel & BMP_DEBUG_TARGET) {
 		fprintf(stderr, "ap_memread @ %" PRIx32 " len %" PRIx32 ":", src, (uint32_t)len);
@@ -663,6 +845,7 @@ void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 }
 void adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
 {
+	adiv5_queue_flush(ap->dp);
 	if (cl_debuglevel & BMP_DEBUG_TARGET) {
 		fprintf(stderr, "ap_mem_write_sized @ %" PRIx32 " len %" PRIx32 ", align %d:", dest, (uint32_t)len, 1 << align);
 
@@ -685,6 +868,8 @@ void adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_
 
 void adiv5_dp_abort(struct ADIv5_DP_s *dp, uint32_t abort)
 {
+	adiv5_queue_flush(dp);
 	DEBUG_TARGET("Abort: %08" PRIx32 "\n", abort);
+	adiv5_shadow_invalidate(dp);
 	return dp->abort(dp, abort);
 }
@@ -39,17 +39,26 @@
 
 char *platform_ident(void);
 void platform_buffer_flush(void);
+bool platform_flash_offload_supported(void);
+struct target_s;
+/* Have the probe poll RTT on t and forward what it sent since, false if the host has to poll */
+bool platform_rtt_offload(struct target_s *t);
 
 #define PLATFORM_IDENT     "(PC-Hosted) "
 #define SET_IDLE_STATE(x)
 #define SET_RUN_STATE(x)
 #define PLATFORM_HAS_POWER_SWITCH
+#define PLATFORM_HAS_TRACESWO
 
 #define SYSTICKHZ 1000
 
 #define VENDOR_ID_BMP            0x1d50
 #define PRODUCT_ID_BMP_BL        0x6017
 #define PRODUCT_ID_BMP           0x6018
+/* Vendor bulk interface of firmware built with ENABLE_BULK_IF */
+#define BMP_BULK_IF_CLASS        0xff
+#define BMP_BULK_IF_SUBCLASS     0x42
+#define BMP_BULK_IF_PROTOCOL     0x01
 
 #define VENDOR_ID_STLINK		 0x0483
 #define PRODUCT_ID_STLINK_MASK	 0xffe0
@@ -71,7 +80,8 @@ typedef enum bmp_type_e {
 	BMP_TYPE_STLINKV2,
 	BMP_TYPE_LIBFTDI,
 	BMP_TYPE_CMSIS_DAP,
-	BMP_TYPE_JLINK
+	BMP_TYPE_JLINK,
+	BMP_TYPE_MOCK
 } bmp_type_t;
 
 void gdb_ident(char *p, int count);
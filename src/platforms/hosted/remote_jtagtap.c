@@ -39,6 +39,8 @@
 static void jtagtap_reset(void);
 static void jtagtap_tms_seq(uint32_t tms_states, size_t ticks);
 static void jtagtap_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+static void jtagtap_tdi_tdo_seq_block(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+static void jtagtap_tdi_seq_block(bool final_tms, const uint8_t *data_in, size_t clock_cycles);
 static void jtagtap_tdi_seq(bool final_tms, const uint8_t *data_in, size_t clock_cycles);
 static bool jtagtap_next(bool tms, bool tdi);
 static void jtagtap_cycle(bool tms, bool tdi, size_t clock_cycles);
@@ -71,6 +73,11 @@ int remote_jtagtap_init(jtag_proc_t *jtag_proc)
 		PRINT_INFO("Firmware does not support newer JTAG commands, please update it.");
 	else
 		jtag_proc->jtagtap_cycle = jtagtap_cycle;
+	/* Firmware from HL version 8 on shifts sequences of any length in one request */
+	if (length > 2 && buffer[0] == REMOTE_RESP_OK && remotehston(2, buffer + 1) >= 8U) {
+		jtag_proc->jtagtap_tdi_tdo_seq = jtagtap_tdi_tdo_seq_block;
+		jtag_proc->jtagtap_tdi_seq = jtagtap_tdi_seq_block;
+	}
 
 	return 0;
 }
@@ -102,10 +109,8 @@ static void jtagtap_tms_seq(uint32_t tms_states, size_t clock_cycles)
 }
 
 /* At least up to v1.7.1-233, remote handles only up to 32 clock cycles in one
- * call. Break up large calls.
- *
- * FIXME: Provide and test faster call and keep fallback
- * for old firmware
+ * call. Break up large calls. This is the fallback for firmware without the
+ * block shift below.
  */
 static void jtagtap_tdi_tdo_seq(uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
 {
@@ -131,7 +136,7 @@ static void jtagtap_tdi_tdo_seq(uint8_t *const data_out, const bool final_tms, c
 		}
 		/* PRIx64 differs with system. Use it explicit in the format string*/
 		int length = snprintf(buffer, REMOTE_MAX_MSG_SIZE, "!J%c%02zx%" PRIx64 "%c",
-			!clock_cycles && final_tms ? REMOTE_TDITDO_TMS : REMOTE_TDITDO_NOTMS, chunk, data, REMOTE_EOM);
+			cycle == clock_cycles && final_tms ? REMOTE_TDITDO_TMS : REMOTE_TDITDO_NOTMS, chunk, data, REMOTE_EOM);
 		platform_buffer_write((uint8_t *)buffer, length);
 
 		length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
@@ -152,6 +157,48 @@ static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *data_in, size_t
 	return jtagtap_tdi_tdo_seq(NULL, final_tms, data_in, clock_cycles);
 }
 
+/* One request for the whole sequence, TDI goes out in frames and, when wanted, TDO comes back per frame */
+static void jtagtap_tdi_tdo_seq_block(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	if (!clock_cycles || (!data_in && !data_out))
+		return;
+
+	static const uint8_t zeros[REMOTE_JTAG_FRAME_SIZE];
+	char buffer[REMOTE_MAX_MSG_SIZE];
+	int length = snprintf(buffer, REMOTE_MAX_MSG_SIZE, REMOTE_JTAG_TDITDO_BLOCK_STR, bool_to_int(final_tms),
+		bool_to_int(data_out != NULL), (uint32_t)clock_cycles);
+	platform_buffer_write((uint8_t *)buffer, length);
+
+	/* Every frame is sent and every reply collected, even after an error, to stay in sync */
+	bool ok = true;
+	const size_t bytes = (clock_cycles + 7U) >> 3U;
+	for (size_t offset = 0; offset < bytes; offset += REMOTE_JTAG_FRAME_SIZE) {
+		const size_t count = MIN(bytes - offset, REMOTE_JTAG_FRAME_SIZE);
+		remote_send_frames(data_in ? data_in + offset : zeros, count);
+		if (!data_out)
+			continue;
+		length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
+		if (length == (int)count + 1 && buffer[0] == REMOTE_RESP_OK)
+			memcpy(data_out + offset, buffer + 1, count);
+		else
+			ok = false;
+	}
+	if (!data_out) {
+		length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
+		ok = length > 0 && buffer[0] == REMOTE_RESP_OK;
+	}
+	if (!ok) {
+		DEBUG_WARN("jtagtap_tdi_tdo_seq_block failed, error %s\n", length > 0 ? buffer + 1 : "unknown");
+		exit(-1);
+	}
+}
+
+static void jtagtap_tdi_seq_block(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	jtagtap_tdi_tdo_seq_block(NULL, final_tms, data_in, clock_cycles);
+}
+
 static bool jtagtap_next(const bool tms, const bool tdi)
 {
 	char buffer[REMOTE_MAX_MSG_SIZE];
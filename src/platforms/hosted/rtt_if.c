@@ -27,21 +27,137 @@
 #include <general.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <rtt.h>
 #include <rtt_if.h>
 
-/* maybe rewrite this as tcp server */
+/* terminal transmit buffer */
+static char xmit_buf[RTT_UP_BUF_SIZE];
+
+char *rtt_up_scratch(uint32_t *len)
+{
+	*len = sizeof(xmit_buf);
+	return xmit_buf;
+}
+
+static rtt_if_sink_func rtt_sink;
+static void *rtt_sink_ctx;
+
+void rtt_if_set_sink(const rtt_if_sink_func sink, void *const ctx)
+{
+	rtt_sink = sink;
+	rtt_sink_ctx = ctx;
+}
 
 #ifndef WIN32
 #include <termios.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 /* linux */
 static struct termios saved_ttystate;
 static bool tty_saved = false;
 
+/*
+ * With a port base given, every rtt channel gets its own tcp socket on
+ * localhost, port base + channel number, so each channel can be consumed by a
+ * different tool. Up channel data is buffered per channel: a slow consumer
+ * holds back only its own channel, and channels nobody is connected to are
+ * drained and dropped so the target does not block on them. The live watch
+ * samples get the socket after the last channel.
+ */
+#define RTT_SOCK_BUF_SIZE 65536U
+#define RTT_SOCK_COUNT    (LIVE_WATCH_CHAN + 1U)
+
+typedef struct rtt_sock {
+	int listen_fd;
+	int client_fd;
+	uint32_t head; /* bytes buffered */
+	uint32_t tail; /* bytes sent */
+	char buf[RTT_SOCK_BUF_SIZE + 8U]; /* 8 bytes for alignment and padding */
+} rtt_sock_s;
+
+static rtt_sock_s *rtt_sock;
+
+static void rtt_sock_drop_client(rtt_sock_s *sock)
+{
+	close(sock->client_fd);
+	sock->client_fd = -1;
+	sock->head = 0;
+	sock->tail = 0;
+}
+
+/* take a waiting consumer if the channel has none, true if a consumer is connected */
+static bool rtt_sock_client(rtt_sock_s *sock)
+{
+	if (sock->client_fd != -1)
+		return true;
+	if (sock->listen_fd == -1)
+		return false;
+	sock->client_fd = accept(sock->listen_fd, NULL, NULL);
+	if (sock->client_fd == -1)
+		return false;
+	fcntl(sock->client_fd, F_SETFL, fcntl(sock->client_fd, F_GETFL, 0) | O_NONBLOCK);
+	sock->head = 0;
+	sock->tail = 0;
+	return true;
+}
+
+/* send as much buffered data as the consumer takes without blocking */
+static void rtt_sock_flush(rtt_sock_s *sock)
+{
+	while (sock->client_fd != -1 && sock->head != sock->tail) {
+		const uint32_t pos = sock->tail % RTT_SOCK_BUF_SIZE;
+		const uint32_t len = MIN(sock->head - sock->tail, RTT_SOCK_BUF_SIZE - pos);
+		const ssize_t sent = send(sock->client_fd, sock->buf + pos, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent > 0)
+			sock->tail += sent;
+		else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return;
+		else
+			rtt_sock_drop_client(sock);
+	}
+}
+
+static int rtt_sock_listen(uint16_t port)
+{
+	const int fd = socket(PF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	int opt = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(opt));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (void *)&addr, sizeof(addr)) == -1 || listen(fd, 1) == -1) {
+		DEBUG_WARN("rtt: can not listen on port %u: %s\n", port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	return fd;
+}
+
 /* set up and tear down */
 
-int rtt_if_init()
+int rtt_if_init(const uint16_t port_base)
 {
+	if (port_base) {
+		rtt_sock = calloc(RTT_SOCK_COUNT, sizeof(*rtt_sock));
+		if (!rtt_sock)
+			return -1;
+		for (uint32_t i = 0; i < RTT_SOCK_COUNT; i++) {
+			rtt_sock[i].listen_fd = rtt_sock_listen(port_base + i);
+			rtt_sock[i].client_fd = -1;
+		}
+		DEBUG_INFO("rtt: channels on localhost ports %u-%u, live watch on port %u\n", port_base,
+			port_base + MAX_RTT_CHAN - 1U, port_base + LIVE_WATCH_CHAN);
+		return 0;
+	}
+
 	struct termios ttystate;
 	tcgetattr(STDIN_FILENO, &saved_ttystate);
 	tty_saved = true;
@@ -57,43 +173,113 @@ int rtt_if_init()
 
 int rtt_if_exit()
 {
+	if (rtt_sock) {
+		for (uint32_t i = 0; i < RTT_SOCK_COUNT; i++) {
+			if (rtt_sock[i].client_fd != -1)
+				close(rtt_sock[i].client_fd);
+			if (rtt_sock[i].listen_fd != -1)
+				close(rtt_sock[i].listen_fd);
+		}
+		free(rtt_sock);
+		rtt_sock = NULL;
+	}
 	if (tty_saved)
 		tcsetattr(STDIN_FILENO, TCSANOW, &saved_ttystate);
 	return 0;
 }
 
-/* write buffer to terminal */
+/* target data is read straight into the transmit buffer of the channel */
 
-uint32_t rtt_write(const char *buf, uint32_t len)
+char *rtt_up_reserve(const uint32_t channel, uint32_t *len)
 {
-	write(1, buf, len);
+	if (rtt_sink || !rtt_sock || channel >= RTT_SOCK_COUNT) {
+		*len = sizeof(xmit_buf) - 8U;
+		return xmit_buf;
+	}
+	rtt_sock_s *const sock = &rtt_sock[channel];
+	if (!rtt_sock_client(sock)) {
+		/* no consumer, data is dropped on commit */
+		*len = sizeof(xmit_buf) - 8U;
+		return xmit_buf;
+	}
+	rtt_sock_flush(sock);
+
+	const uint32_t pos = sock->head % RTT_SOCK_BUF_SIZE;
+	uint32_t space = RTT_SOCK_BUF_SIZE - (sock->head - sock->tail);
+	if (RTT_SOCK_BUF_SIZE - pos < space)
+		/* up to the end of the buffer, padding goes into the 8 spare bytes */
+		space = RTT_SOCK_BUF_SIZE - pos;
+	else if (space > 8U)
+		/* up to unsent data, keep the padding clear of it */
+		space -= 8U;
+	else
+		return NULL;
+	*len = space;
+	return sock->buf + pos;
+}
+
+/* write buffer to terminal or channel socket */
+
+uint32_t rtt_up_commit(const uint32_t channel, const uint32_t len)
+{
+	if (rtt_sink) {
+		rtt_sink(channel, xmit_buf, len, rtt_sink_ctx);
+		return len;
+	}
+	if (!rtt_sock || channel >= RTT_SOCK_COUNT) {
+		write(1, xmit_buf, len);
+		return len;
+	}
+	rtt_sock_s *const sock = &rtt_sock[channel];
+	if (sock->client_fd == -1)
+		return 0;
+	sock->head += len;
+	rtt_sock_flush(sock);
 	return len;
 }
 
-/* read character from terminal */
+/* read character from terminal or channel socket */
 
-int32_t rtt_getchar()
+int32_t rtt_getchar(const uint32_t channel)
 {
 	char ch;
-	int len;
-	len = read(0, &ch, 1);
+	ssize_t len;
+	if (!rtt_sock || channel >= MAX_RTT_CHAN)
+		len = read(0, &ch, 1);
+	else if (rtt_sock_client(&rtt_sock[channel])) {
+		len = recv(rtt_sock[channel].client_fd, &ch, 1, MSG_DONTWAIT);
+		if (len == 0)
+			rtt_sock_drop_client(&rtt_sock[channel]);
+	} else
+		len = 0;
 	if (len == 1) return ch;
 	return -1;
 }
 
 /* true if no characters available */
 
-bool rtt_nodata()
+bool rtt_nodata(const uint32_t channel)
 {
-	return false;
+	if (!rtt_sock || channel >= MAX_RTT_CHAN)
+		return false;
+	rtt_sock_s *const sock = &rtt_sock[channel];
+	if (!rtt_sock_client(sock))
+		return true;
+	char ch;
+	const ssize_t len = recv(sock->client_fd, &ch, 1, MSG_DONTWAIT | MSG_PEEK);
+	if (len == 0)
+		rtt_sock_drop_client(sock);
+	return len != 1;
 }
 
 #else
 
 /* windows, output only */
 
-int rtt_if_init()
+int rtt_if_init(const uint16_t port_base)
 {
+	if (port_base)
+		DEBUG_WARN("rtt: per channel ports are not supported on windows, using the terminal\n");
 	return 0;
 }
 
@@ -102,25 +288,38 @@ int rtt_if_exit()
 	return 0;
 }
 
+char *rtt_up_reserve(const uint32_t channel, uint32_t *len)
+{
+	(void)channel;
+	*len = sizeof(xmit_buf) - 8U;
+	return xmit_buf;
+}
+
 /* write buffer to terminal */
 
-uint32_t rtt_write(const char *buf, uint32_t len)
+uint32_t rtt_up_commit(const uint32_t channel, const uint32_t len)
 {
-	write(1, buf, len);
+	if (rtt_sink) {
+		rtt_sink(channel, xmit_buf, len, rtt_sink_ctx);
+		return len;
+	}
+	write(1, xmit_buf, len);
 	return len;
 }
 
 /* read character from terminal */
 
-int32_t rtt_getchar()
+int32_t rtt_getchar(const uint32_t channel)
 {
+	(void)channel;
 	return -1;
 }
 
 /* true if no characters available */
 
-bool rtt_nodata()
+bool rtt_nodata(const uint32_t channel)
 {
+	(void)channel;
 	return false;
 }
 
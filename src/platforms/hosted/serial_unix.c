@@ -27,10 +27,28 @@
 #include <unistd.h>
 
 #include "remote.h"
+#include "bmp_remote.h"
 #include "cli.h"
 #include "cortexm.h"
+#include "bmp_hosted.h"
+#include "wire_trace.h"
 
-static int fd;  /* File descriptor for connection to GDB remote */
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+
+static int fd = -1;  /* File descriptor for connection to GDB remote */
+#if defined(__linux__)
+static int epoll_fd = -1;
+#endif
+
+/* Received bytes are taken in large reads and parsed from here */
+#define SERIAL_RX_BUFFER_SIZE 4096U
+static uint8_t rx_buffer[SERIAL_RX_BUFFER_SIZE];
+static size_t rx_pos;
+static size_t rx_len;
 
 /* A nice routine grabbed from
  * https://stackoverflow.com/questions/6947413/how-to-open-read-and-write-from-serial-port-in-c
@@ -51,8 +69,8 @@ static int set_interface_attribs(void)
 	tty.c_lflag = 0;                // no signaling chars, no echo,
 	// no canonical processing
 	tty.c_oflag = 0;                // no remapping, no delays
-	tty.c_cc[VMIN]  = 0;            // read doesn't block
-	tty.c_cc[VTIME] = 5;            // 0.5 seconds read timeout
+	tty.c_cc[VMIN]  = 0;            // read doesn't block,
+	tty.c_cc[VTIME] = 0;            // waiting is done in serial_wait()
 
 	tty.c_iflag &= ~(IXON | IXOFF | IXANY); // shut off xon/xoff ctrl
 
@@ -69,6 +87,41 @@ static int set_interface_attribs(void)
 	return 0;
 }
 
+/* Ask the driver to push received data up right away instead of batching it */
+static void serial_set_low_latency(void)
+{
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+	struct serial_struct serial;
+	if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+		serial.flags |= ASYNC_LOW_LATENCY;
+		if (ioctl(fd, TIOCSSERIAL, &serial) == 0)
+			return;
+	}
+	DEBUG_WARN("Low latency mode not supported by the serial driver: %s\n", strerror(errno));
+#else
+	DEBUG_WARN("Low latency mode not supported on this platform\n");
+#endif
+}
+
+static int serial_configure(const BMP_CL_OPTIONS_t *cl_opts)
+{
+	if (set_interface_attribs())
+		return -1;
+	if (cl_opts->opt_low_latency)
+		serial_set_low_latency();
+	rx_pos = 0;
+	rx_len = 0;
+#if defined(__linux__)
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+	if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+		DEBUG_WARN("Failed to set up epoll: %s\n", strerror(errno));
+		return -1;
+	}
+#endif
+	return 0;
+}
+
 #ifdef __APPLE__
 int serial_open(BMP_CL_OPTIONS_t *cl_opts, char *serial)
 {
@@ -92,7 +145,7 @@ int serial_open(BMP_CL_OPTIONS_t *cl_opts, char *serial)
     /* BMP only offers an USB-Serial connection with no real serial
      * line in between. No need for baudrate or parity.!
      */
-    return set_interface_attribs();
+    return serial_configure(cl_opts);
 }
 #else
 #define BMP_IDSTRING_BLACKSPHERE "usb-Black_Sphere_Technologies_Black_Magic_Probe"
@@ -162,13 +215,20 @@ int serial_open(BMP_CL_OPTIONS_t *cl_opts, char *serial)
 	/* BMP only offers an USB-Serial connection with no real serial
 	 * line in between. No need for baudrate or parity.!
 	 */
-	return set_interface_attribs();
+	return serial_configure(cl_opts);
 }
 #endif
 
 void serial_close(void)
 {
-	close(fd);
+#if defined(__linux__)
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	epoll_fd = -1;
+#endif
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
 }
 
 int platform_buffer_write(const uint8_t *data, int size)
@@ -176,6 +236,16 @@ int platform_buffer_write(const uint8_t *data, int size)
 	int s;
 
 	DEBUG_WIRE("%s\n", data);
+	WIRE_TRACE(WIRE_TRACE_REMOTE_TX, size > 1 ? data[1] : 0, size);
+#if HOSTED_BMP_ONLY != 1
+	if (info.usb_link) {
+		if (bmp_bulk_write(data, size) < 0) {
+			DEBUG_WARN("Failed to write\n");
+			exit(-2);
+		}
+		return size;
+	}
+#endif
 	s = write(fd, data, size);
 	if (s < 0) {
 		DEBUG_WARN("Failed to write\n");
@@ -185,62 +255,120 @@ int platform_buffer_write(const uint8_t *data, int size)
 	return size;
 }
 
-int platform_buffer_read(uint8_t *data, int maxsize)
+/* Wait up to timeout ms for received data, returns <0 on error and 0 on timeout */
+static int serial_wait(const uint32_t timeout)
 {
-	uint8_t *c;
-	int s;
-	int ret;
-	fd_set  rset;
-	struct timeval tv;
+#if defined(__linux__)
+	struct epoll_event event;
+	return epoll_wait(epoll_fd, &event, 1, timeout);
+#else
+	fd_set rset;
+	FD_ZERO(&rset);
+	FD_SET(fd, &rset);
+	struct timeval tv = {.tv_sec = timeout / 1000U, .tv_usec = 1000U * (timeout % 1000U)};
+	return select(fd + 1, &rset, NULL, NULL, &tv);
+#endif
+}
+
+/* Returns the next received byte, -1 on timeout and -2 on error */
+static int serial_getc(const uint32_t deadline)
+{
+	while (rx_pos == rx_len) {
+#if HOSTED_BMP_ONLY != 1
+		/* The vendor bulk interface needs no tty, read it for as long as is left */
+		if (info.usb_link) {
+			const uint32_t now = platform_time_ms();
+			if (now >= deadline)
+				return -1;
+			const int len = bmp_bulk_read(rx_buffer, SERIAL_RX_BUFFER_SIZE, deadline - now);
+			if (len < 0)
+				return -2;
+			rx_pos = 0;
+			rx_len = len;
+			continue;
+		}
+#endif
+		/* Try first, the data is often there already and this saves the wait */
+		const ssize_t len = read(fd, rx_buffer, SERIAL_RX_BUFFER_SIZE);
+		if (len > 0) {
+			rx_pos = 0;
+			rx_len = len;
+			break;
+		}
+		if (len < 0 && errno != EAGAIN && errno != EINTR) {
+			DEBUG_WARN("Failed to read: %s\n", strerror(errno));
+			return -2;
+		}
+		const uint32_t now = platform_time_ms();
+		if (now >= deadline)
+			return -1;
+		if (serial_wait(deadline - now) < 0 && errno != EINTR) {
+			DEBUG_WARN("Failed on wait: %s\n", strerror(errno));
+			return -2;
+		}
+	}
+	return rx_buffer[rx_pos++];
+}
 
-	c = data;
-	tv.tv_sec = 0;
+static int serial_read_body(uint8_t *data, int maxsize, uint32_t deadline);
 
-	tv.tv_sec = cortexm_wait_timeout / 1000 ;
-	tv.tv_usec = 1000 * (cortexm_wait_timeout % 1000);
+int platform_buffer_read(uint8_t *data, int maxsize)
+{
+	/* Replies to posted commands come first, collect them before this one */
+	remote_posted_drain();
+	const uint32_t deadline = platform_time_ms() + cortexm_wait_timeout;
 
 	/* Look for start of response */
-	do {
-		FD_ZERO(&rset);
-		FD_SET(fd, &rset);
-
-		ret = select(fd + 1, &rset, NULL, NULL, &tv);
-		if (ret < 0) {
-			DEBUG_WARN("Failed on select\n");
-			return(-3);
-		}
-		if(ret == 0) {
+	while (true) {
+		const int c = serial_getc(deadline);
+		if (c == -2)
+			return -3;
+		if (c < 0) {
 			DEBUG_WARN("Timeout on read RESP\n");
-			return(-4);
+			return -4;
 		}
+		if (c == REMOTE_RESP)
+			break;
+		/* The probe may have sent a notification of its own before the reply */
+		if (c == REMOTE_NOTIFY) {
+			uint8_t notify[REMOTE_MAX_MSG_SIZE];
+			const int len = serial_read_body(notify, sizeof(notify) - 1U, deadline);
+			if (len > 0)
+				remote_notify(notify, len);
+		}
+	}
+	return serial_read_body(data, maxsize, deadline);
+}
 
-		s = read(fd, c, 1);
-    }
-	while ((s > 0) && (*c != REMOTE_RESP));
-	/* Now collect the response */
-	do {
-		FD_ZERO(&rset);
-		FD_SET(fd, &rset);
-		ret = select(fd + 1, &rset, NULL, NULL, &tv);
-		if (ret < 0) {
-			DEBUG_WARN("Failed on select\n");
+/* Collect a reply or notification up to its REMOTE_EOM, undoing the escaping */
+static int serial_read_body(uint8_t *const data, const int maxsize, const uint32_t deadline)
+{
+	int c;
+	bool escaped = false;
+	int offset = 0;
+	while (offset < maxsize) {
+		c = serial_getc(deadline);
+		if (c == -2)
 			exit(-4);
-		}
-		if(ret == 0) {
+		if (c < 0) {
 			DEBUG_WARN("Timeout on read\n");
-			return(-5);
+			return -5;
 		}
-		s = read(fd, c, 1);
-		if (*c==REMOTE_EOM) {
-			*c = 0;
-			DEBUG_WIRE("       %s\n",data);
-			return (c - data);
-		} else {
-			c++;
-		}
-	}while ((s >= 0) && ((c - data) < maxsize));
+		if (escaped) {
+			/* Binary payload byte that collided with the framing */
+			data[offset++] = c ^ REMOTE_ESC_XOR;
+			escaped = false;
+		} else if (c == REMOTE_ESC) {
+			escaped = true;
+		} else if (c == REMOTE_EOM) {
+			data[offset] = 0;
+			DEBUG_WIRE("       %s\n", data);
+			WIRE_TRACE(WIRE_TRACE_REMOTE_RX, data[0], offset);
+			return offset;
+		} else
+			data[offset++] = c;
+	}
 
 	DEBUG_WARN("Failed to read\n");
-	return(-6);
-	return 0;
+	return -6;
 }
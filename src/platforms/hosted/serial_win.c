@@ -20,9 +20,25 @@
 #include "general.h"
 #include <windows.h>
 #include "remote.h"
+#include "bmp_remote.h"
 #include "cli.h"
+#include "wire_trace.h"
 
 static HANDLE hComm;
+/* All I/O is overlapped, so a read can be left pending across calls and waited for on its event */
+static OVERLAPPED read_ov;
+static OVERLAPPED write_ov;
+static bool read_pending;
+
+/* Received bytes are taken in large reads and parsed from here */
+#define SERIAL_RX_BUFFER_SIZE 4096U
+static uint8_t rx_buffer[SERIAL_RX_BUFFER_SIZE];
+static size_t rx_pos;
+static size_t rx_len;
+
+/* Longest ReadFile() waits before completing empty, it is simply issued again */
+#define SERIAL_READ_IDLE_MS  1000U
+#define SERIAL_WRITE_TIMEOUT 2000U
 
 static char *find_bmp_by_serial(const char *serial)
 {
@@ -85,13 +101,22 @@ int serial_open(BMP_CL_OPTIONS_t *cl_opts, char * serial)
                       0,                            // No Sharing
                       NULL,                         // No Security
                       OPEN_EXISTING,// Open existing port only
-                      0,            // Non Overlapped I/O
+                      FILE_FLAG_OVERLAPPED,
                       NULL);        // Null for Comm Devices}
 	if (hComm == INVALID_HANDLE_VALUE) {
 		DEBUG_WARN("Could not open %s: %ld\n", device,
 				GetLastError());
 		return -1;
 	}
+	read_ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	write_ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!read_ov.hEvent || !write_ov.hEvent) {
+		DEBUG_WARN("CreateEvent failed %ld\n", GetLastError());
+		return -1;
+	}
+	read_pending = false;
+	rx_pos = 0;
+	rx_len = 0;
 	DCB dcbSerialParams;
 	dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
 	if (!GetCommState(hComm, &dcbSerialParams)) {
@@ -104,12 +129,15 @@ int serial_open(BMP_CL_OPTIONS_t *cl_opts, char * serial)
 		DEBUG_WARN("SetCommState failed %ld\n", GetLastError());
 		return -1;
 	}
+	/*
+	 * A read completes as soon as anything has arrived, with whatever has,
+	 * rather than after an interval timeout. Writes have no timeout of
+	 * their own, their completion is waited for instead.
+	 */
 	COMMTIMEOUTS timeouts = {0};
-	timeouts.ReadIntervalTimeout         = 10;
-	timeouts.ReadTotalTimeoutConstant    = 10;
-	timeouts.ReadTotalTimeoutMultiplier  = 10;
-	timeouts.WriteTotalTimeoutConstant   = 10;
-	timeouts.WriteTotalTimeoutMultiplier = 10;
+	timeouts.ReadIntervalTimeout         = MAXDWORD;
+	timeouts.ReadTotalTimeoutMultiplier  = MAXDWORD;
+	timeouts.ReadTotalTimeoutConstant    = SERIAL_READ_IDLE_MS;
 	if (!SetCommTimeouts(hComm, &timeouts)) {
 		DEBUG_WARN("SetCommTimeouts failed %ld\n", GetLastError());
 		return -1;
@@ -119,60 +147,136 @@ int serial_open(BMP_CL_OPTIONS_t *cl_opts, char * serial)
 
 void serial_close(void)
 {
+	CancelIo(hComm);
 	CloseHandle(hComm);
+	CloseHandle(read_ov.hEvent);
+	CloseHandle(write_ov.hEvent);
+	read_pending = false;
 }
 
 int platform_buffer_write(const uint8_t *data, int size)
 {
 	DEBUG_WIRE("%s\n",data);
-	int s = 0;
-
-	do {
-		DWORD written;
-		if (!WriteFile(hComm, data + s, size - s, &written, NULL)) {
-			DEBUG_WARN("Serial write failed %ld, written %d\n",
-					GetLastError(), s);
+	WIRE_TRACE(WIRE_TRACE_REMOTE_TX, size > 1 ? data[1] : 0, size);
+	DWORD written = 0;
+	if (!WriteFile(hComm, data, size, &written, &write_ov)) {
+		if (GetLastError() != ERROR_IO_PENDING) {
+			DEBUG_WARN("Serial write failed %ld\n", GetLastError());
+			return -1;
+		}
+		if (WaitForSingleObject(write_ov.hEvent, SERIAL_WRITE_TIMEOUT) != WAIT_OBJECT_0) {
+			CancelIoEx(hComm, &write_ov);
+			DEBUG_WARN("Serial write timed out\n");
+			return -1;
+		}
+		if (!GetOverlappedResult(hComm, &write_ov, &written, FALSE)) {
+			DEBUG_WARN("Serial write failed %ld\n", GetLastError());
 			return -1;
 		}
-		s += written;
-	} while (s < size);
+	}
+	if (written != (DWORD)size) {
+		DEBUG_WARN("Serial write short, written %ld of %d\n", written, size);
+		return -1;
+	}
 	return 0;
 }
-int platform_buffer_read(uint8_t *data, int maxsize)
+
+/* Returns the next received byte, -1 on timeout and -2 on error */
+static int serial_getc(const uint32_t deadline)
 {
-	DWORD s;
-	uint8_t response = 0;
-	uint32_t startTime = platform_time_ms();
-	uint32_t endTime = platform_time_ms() + cortexm_wait_timeout;
-	do {
-		if (!ReadFile(hComm, &response, 1, &s, NULL)) {
-			DEBUG_WARN("ERROR on read RESP\n");
-			exit(-3);
+	while (rx_pos == rx_len) {
+		DWORD len = 0;
+		if (!read_pending) {
+			/* Often the data is there already and the read completes at once */
+			if (ReadFile(hComm, rx_buffer, SERIAL_RX_BUFFER_SIZE, &len, &read_ov)) {
+				rx_pos = 0;
+				rx_len = len;
+				continue;
+			}
+			if (GetLastError() != ERROR_IO_PENDING) {
+				DEBUG_WARN("Failed to read %ld\n", GetLastError());
+				return -2;
+			}
+			read_pending = true;
+		}
+		const uint32_t now = platform_time_ms();
+		if (now >= deadline)
+			return -1;
+		/* On a timeout the read stays pending, for the next call to pick up */
+		const DWORD result = WaitForSingleObject(read_ov.hEvent, deadline - now);
+		if (result == WAIT_TIMEOUT)
+			return -1;
+		read_pending = false;
+		if (result != WAIT_OBJECT_0 || !GetOverlappedResult(hComm, &read_ov, &len, FALSE)) {
+			DEBUG_WARN("Failed to read %ld\n", GetLastError());
+			return -2;
 		}
-		if (platform_time_ms() > endTime) {
+		rx_pos = 0;
+		rx_len = len;
+	}
+	return rx_buffer[rx_pos++];
+}
+
+static int serial_read_body(uint8_t *data, int maxsize, uint32_t deadline);
+
+int platform_buffer_read(uint8_t *data, int maxsize)
+{
+	/* Replies to posted commands come first, collect them before this one */
+	remote_posted_drain();
+	const uint32_t deadline = platform_time_ms() + cortexm_wait_timeout;
+
+	/* Look for start of response */
+	while (true) {
+		const int c = serial_getc(deadline);
+		if (c == -2)
+			return -3;
+		if (c < 0) {
 			DEBUG_WARN("Timeout on read RESP\n");
-			exit(-4);
+			return -4;
 		}
-	} while (response != REMOTE_RESP);
-	uint8_t *c = data;
-	do {
-		if (!ReadFile(hComm, c, 1, &s, NULL)) {
-			DEBUG_WARN("Error on read\n");
-			exit(-3);
+		if (c == REMOTE_RESP)
+			break;
+		/* The probe may have sent a notification of its own before the reply */
+		if (c == REMOTE_NOTIFY) {
+			uint8_t notify[REMOTE_MAX_MSG_SIZE];
+			const int len = serial_read_body(notify, sizeof(notify) - 1U, deadline);
+			if (len > 0)
+				remote_notify(notify, len);
 		}
-		if (s > 0 ) {
-			DEBUG_WIRE("%c", *c);
-			if (*c == REMOTE_EOM) {
-				*c = 0;
-				DEBUG_WIRE("\n");
-				return (c - data);
-			} else {
-				c++;
-			}
+	}
+	return serial_read_body(data, maxsize, deadline);
+}
+
+/* Collect a reply or notification up to its REMOTE_EOM, undoing the escaping */
+static int serial_read_body(uint8_t *const data, const int maxsize, const uint32_t deadline)
+{
+	int c;
+	bool escaped = false;
+	int offset = 0;
+	while (offset < maxsize) {
+		c = serial_getc(deadline);
+		if (c == -2)
+			exit(-4);
+		if (c < 0) {
+			DEBUG_WARN("Timeout on read\n");
+			return -5;
 		}
-	} while (((c - data) < maxsize) && (platform_time_ms() < endTime));
-	DEBUG_WARN("Failed to read EOM at %d\n",
-			platform_time_ms() - startTime);
-	exit(-3);
-	return 0;
+		DEBUG_WIRE("%c", c);
+		if (escaped) {
+			/* Binary payload byte that collided with the framing */
+			data[offset++] = c ^ REMOTE_ESC_XOR;
+			escaped = false;
+		} else if (c == REMOTE_ESC) {
+			escaped = true;
+		} else if (c == REMOTE_EOM) {
+			data[offset] = 0;
+			DEBUG_WIRE("\n");
+			WIRE_TRACE(WIRE_TRACE_REMOTE_RX, data[0], offset);
+			return offset;
+		} else
+			data[offset++] = c;
+	}
+
+	DEBUG_WARN("Failed to read EOM\n");
+	return -6;
 }
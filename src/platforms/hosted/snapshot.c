@@ -0,0 +1,377 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* RAM and register snapshots, to put a target back into a known state
+ * quicker than a reset and re-initialisation would.
+ *
+ * Each RAM region is kept as chunks, each run-length compressed on its own
+ * so a dirty save can replace some of them. Dirty saves and restores compare
+ * CRCs computed on the target against the snapshot, halving a range that
+ * differs until the chunks that changed are found, and only move those.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "crc32.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_CHUNK_SIZE 4096U
+/* Largest transfer handed to target_mem_read() or target_mem_write() at once */
+#define SNAPSHOT_SPAN_CHUNKS 64U
+/* A differing range this small is transferred rather than narrowed down with more CRCs */
+#define SNAPSHOT_SYNC_MIN_CHUNKS 2U
+
+/* Run-length coding: a header below 128 is followed by header + 1 literal bytes, from 128 up it
+ * repeats the following byte header - 125 times */
+#define SNAPSHOT_RUN_MIN 3U
+#define SNAPSHOT_RUN_MAX 130U
+#define SNAPSHOT_LITERAL_MAX 128U
+#define SNAPSHOT_PACK_MAX(len) ((len) + ((len) + SNAPSHOT_LITERAL_MAX - 1U) / SNAPSHOT_LITERAL_MAX)
+
+typedef struct snapshot_chunk {
+	uint8_t *data;
+	uint32_t stored_len; /* the chunk's length if kept uncompressed */
+} snapshot_chunk_s;
+
+typedef struct snapshot_region {
+	target_addr_t start;
+	size_t length;
+	size_t chunk_count;
+	snapshot_chunk_s *chunks;
+} snapshot_region_s;
+
+typedef struct snapshot {
+	size_t region_count;
+	snapshot_region_s *regions;
+	uint8_t *regs;
+	size_t regs_size;
+} snapshot_s;
+
+static snapshot_s *snapshots[SNAPSHOT_SLOTS];
+
+static size_t snapshot_pack(const uint8_t *src, const size_t len, uint8_t *dst)
+{
+	size_t out = 0;
+	size_t literal = 0; /* start of the pending literal run in src */
+	size_t i = 0;
+	while (i < len) {
+		size_t run = 1;
+		while (i + run < len && run < SNAPSHOT_RUN_MAX && src[i + run] == src[i])
+			++run;
+		if (run < SNAPSHOT_RUN_MIN && i + run < len) {
+			i += run;
+			continue;
+		}
+		if (run < SNAPSHOT_RUN_MIN)
+			i += run;
+		/* Flush the literals before the run, or up to the end */
+		while (literal < i) {
+			const size_t count = MIN(i - literal, SNAPSHOT_LITERAL_MAX);
+			dst[out++] = (uint8_t)(count - 1U);
+			memcpy(dst + out, src + literal, count);
+			out += count;
+			literal += count;
+		}
+		if (run >= SNAPSHOT_RUN_MIN) {
+			dst[out++] = (uint8_t)(run + 125U);
+			dst[out++] = src[i];
+			i += run;
+			literal = i;
+		}
+	}
+	return out;
+}
+
+static void snapshot_unpack(const uint8_t *src, const size_t len, uint8_t *dst)
+{
+	for (size_t i = 0; i < len;) {
+		const uint8_t header = src[i++];
+		if (header < SNAPSHOT_LITERAL_MAX) {
+			memcpy(dst, src + i, header + 1U);
+			dst += header + 1U;
+			i += header + 1U;
+		} else {
+			memset(dst, src[i++], header - 125U);
+			dst += header - 125U;
+		}
+	}
+}
+
+static size_t snapshot_chunk_len(const snapshot_region_s *region, const size_t chunk)
+{
+	return MIN(SNAPSHOT_CHUNK_SIZE, region->length - chunk * SNAPSHOT_CHUNK_SIZE);
+}
+
+static bool snapshot_chunk_store(snapshot_chunk_s *chunk, const uint8_t *data, const size_t len)
+{
+	uint8_t packed[SNAPSHOT_PACK_MAX(SNAPSHOT_CHUNK_SIZE)];
+	size_t stored_len = snapshot_pack(data, len, packed);
+	if (stored_len >= len)
+		stored_len = len;
+	uint8_t *const stored = malloc(stored_len);
+	if (!stored) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	memcpy(stored, stored_len == len ? data : packed, stored_len);
+	free(chunk->data);
+	chunk->data = stored;
+	chunk->stored_len = stored_len;
+	return true;
+}
+
+static void snapshot_chunk_load(const snapshot_chunk_s *chunk, uint8_t *data, const size_t len)
+{
+	if (chunk->stored_len == len)
+		memcpy(data, chunk->data, len);
+	else
+		snapshot_unpack(chunk->data, chunk->stored_len, data);
+}
+
+static void snapshot_free(snapshot_s *snapshot)
+{
+	if (!snapshot)
+		return;
+	for (size_t i = 0; i < snapshot->region_count; ++i) {
+		snapshot_region_s *const region = &snapshot->regions[i];
+		for (size_t chunk = 0; chunk < region->chunk_count; ++chunk)
+			free(region->chunks[chunk].data);
+		free(region->chunks);
+	}
+	free(snapshot->regions);
+	free(snapshot->regs);
+	free(snapshot);
+}
+
+/* A snapshot laid out for the target's RAM regions, with no data yet */
+static snapshot_s *snapshot_new(target *t)
+{
+	snapshot_s *const snapshot = calloc(1, sizeof(*snapshot));
+	if (!snapshot) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return NULL;
+	}
+	for (const struct target_ram *ram = t->ram; ram; ram = ram->next)
+		++snapshot->region_count;
+	snapshot->regions = calloc(snapshot->region_count + 1U, sizeof(*snapshot->regions));
+	snapshot->regs_size = target_regs_size(t);
+	snapshot->regs = calloc(1, snapshot->regs_size + 1U);
+	if (!snapshot->regions || !snapshot->regs) {
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		snapshot_free(snapshot);
+		return NULL;
+	}
+	size_t i = 0;
+	for (const struct target_ram *ram = t->ram; ram; ram = ram->next, ++i) {
+		snapshot_region_s *const region = &snapshot->regions[i];
+		region->start = ram->start;
+		region->length = ram->length;
+		region->chunk_count = (ram->length + SNAPSHOT_CHUNK_SIZE - 1U) / SNAPSHOT_CHUNK_SIZE;
+		region->chunks = calloc(region->chunk_count + 1U, sizeof(*region->chunks));
+		if (!region->chunks) {
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			snapshot_free(snapshot);
+			return NULL;
+		}
+	}
+	return snapshot;
+}
+
+/* A dirty save can only update a snapshot of the same RAM layout */
+static bool snapshot_matches(target *t, const snapshot_s *snapshot)
+{
+	size_t i = 0;
+	for (const struct target_ram *ram = t->ram; ram; ram = ram->next, ++i) {
+		if (i >= snapshot->region_count || snapshot->regions[i].start != ram->start ||
+			snapshot->regions[i].length != ram->length)
+			return false;
+	}
+	return i == snapshot->region_count && snapshot->regs_size == target_regs_size(t);
+}
+
+/* Read chunks [first, first + count) into the snapshot, or write them back from it */
+static bool snapshot_transfer(target *t, snapshot_region_s *region, const size_t first, const size_t count,
+	const bool restore, uint8_t *buf, snapshot_stats_s *stats)
+{
+	const target_addr_t addr = region->start + first * SNAPSHOT_CHUNK_SIZE;
+	size_t len = 0;
+	if (restore) {
+		for (size_t chunk = first; chunk < first + count; ++chunk) {
+			snapshot_chunk_load(&region->chunks[chunk], buf + len, snapshot_chunk_len(region, chunk));
+			len += snapshot_chunk_len(region, chunk);
+		}
+		if (target_mem_write(t, addr, buf, len))
+			return false;
+	} else {
+		for (size_t chunk = first; chunk < first + count; ++chunk)
+			len += snapshot_chunk_len(region, chunk);
+		if (target_mem_read(t, buf, addr, len))
+			return false;
+		size_t offset = 0;
+		for (size_t chunk = first; chunk < first + count; ++chunk) {
+			if (!snapshot_chunk_store(&region->chunks[chunk], buf + offset, snapshot_chunk_len(region, chunk)))
+				return false;
+			offset += snapshot_chunk_len(region, chunk);
+		}
+	}
+	stats->transferred_bytes += len;
+	return true;
+}
+
+/* CRC of chunks [first, first + count) as the snapshot has them */
+static uint32_t snapshot_crc(const snapshot_region_s *region, const size_t first, const size_t count)
+{
+	uint8_t data[SNAPSHOT_CHUNK_SIZE];
+	uint32_t crc = 0xffffffffU;
+	for (size_t chunk = first; chunk < first + count; ++chunk) {
+		const size_t len = snapshot_chunk_len(region, chunk);
+		snapshot_chunk_load(&region->chunks[chunk], data, len);
+		crc = crc32_buffer(crc, data, len);
+	}
+	return crc;
+}
+
+/* Transfer the chunks of [first, first + count) the target CRC shows to differ */
+static bool snapshot_sync(target *t, snapshot_region_s *region, const size_t first, const size_t count,
+	const bool restore, uint8_t *buf, snapshot_stats_s *stats)
+{
+	const target_addr_t addr = region->start + first * SNAPSHOT_CHUNK_SIZE;
+	const size_t len = MIN(count * SNAPSHOT_CHUNK_SIZE, region->length - first * SNAPSHOT_CHUNK_SIZE);
+	uint32_t crc = 0;
+	/* The CRC routine fails on ranges it would load itself into, those are split further */
+	if (t->crc32(t, &crc, addr, len) && crc == snapshot_crc(region, first, count))
+		return true;
+	if (count <= SNAPSHOT_SYNC_MIN_CHUNKS)
+		return snapshot_transfer(t, region, first, count, restore, buf, stats);
+	const size_t half = count / 2U;
+	return snapshot_sync(t, region, first, half, restore, buf, stats) &&
+		snapshot_sync(t, region, first + half, count - half, restore, buf, stats);
+}
+
+static bool snapshot_regions(
+	target *t, snapshot_s *snapshot, const bool restore, const bool dirty, snapshot_stats_s *stats)
+{
+	uint8_t *const buf = malloc(SNAPSHOT_SPAN_CHUNKS * SNAPSHOT_CHUNK_SIZE);
+	if (!buf) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	bool ret = true;
+	for (size_t i = 0; ret && i < snapshot->region_count; ++i) {
+		snapshot_region_s *const region = &snapshot->regions[i];
+		for (size_t chunk = 0; ret && chunk < region->chunk_count; chunk += SNAPSHOT_SPAN_CHUNKS) {
+			const size_t count = MIN(SNAPSHOT_SPAN_CHUNKS, region->chunk_count - chunk);
+			if (dirty)
+				ret = snapshot_sync(t, region, chunk, count, restore, buf, stats);
+			else
+				ret = snapshot_transfer(t, region, chunk, count, restore, buf, stats);
+		}
+	}
+	free(buf);
+	return ret;
+}
+
+bool snapshot_info(const uint32_t slot, snapshot_stats_s *stats)
+{
+	if (slot >= SNAPSHOT_SLOTS || !snapshots[slot])
+		return false;
+	const snapshot_s *const snapshot = snapshots[slot];
+	stats->ram_bytes = 0;
+	stats->stored_bytes = snapshot->regs_size;
+	for (size_t i = 0; i < snapshot->region_count; ++i) {
+		const snapshot_region_s *const region = &snapshot->regions[i];
+		stats->ram_bytes += region->length;
+		for (size_t chunk = 0; chunk < region->chunk_count; ++chunk)
+			stats->stored_bytes += region->chunks[chunk].stored_len;
+	}
+	return true;
+}
+
+bool snapshot_save(target *t, const uint32_t slot, bool dirty, snapshot_stats_s *stats)
+{
+	if (slot >= SNAPSHOT_SLOTS)
+		return false;
+	const uint32_t start_time = platform_time_ms();
+	memset(stats, 0, sizeof(*stats));
+	/* A failed save leaves the slot empty rather than a mix of old and new */
+	snapshot_s *snapshot = snapshots[slot];
+	snapshots[slot] = NULL;
+	if (snapshot && !snapshot_matches(t, snapshot)) {
+		snapshot_free(snapshot);
+		snapshot = NULL;
+	}
+	if (!snapshot) {
+		dirty = false;
+		snapshot = snapshot_new(t);
+		if (!snapshot)
+			return false;
+	}
+	if (!t->crc32)
+		dirty = false;
+	target_regs_read(t, snapshot->regs);
+	if (target_check_error(t) || !snapshot_regions(t, snapshot, false, dirty, stats)) {
+		snapshot_free(snapshot);
+		return false;
+	}
+	snapshots[slot] = snapshot;
+	const uint32_t transferred = stats->transferred_bytes;
+	snapshot_info(slot, stats);
+	stats->transferred_bytes = transferred;
+	stats->ms = platform_time_ms() - start_time;
+	return true;
+}
+
+bool snapshot_restore(target *t, const uint32_t slot, bool dirty, snapshot_stats_s *stats)
+{
+	if (slot >= SNAPSHOT_SLOTS || !snapshots[slot])
+		return false;
+	snapshot_s *const snapshot = snapshots[slot];
+	if (!snapshot_matches(t, snapshot)) {
+		DEBUG_WARN("Snapshot %" PRIu32 " was taken of a different target\n", slot);
+		return false;
+	}
+	const uint32_t start_time = platform_time_ms();
+	memset(stats, 0, sizeof(*stats));
+	if (!t->crc32)
+		dirty = false;
+	/* The target CRC routine borrows the core registers, so those go back last */
+	if (!snapshot_regions(t, snapshot, true, dirty, stats))
+		return false;
+	target_regs_write(t, snapshot->regs);
+	if (target_check_error(t))
+		return false;
+	const uint32_t transferred = stats->transferred_bytes;
+	snapshot_info(slot, stats);
+	stats->transferred_bytes = transferred;
+	stats->ms = platform_time_ms() - start_time;
+	return true;
+}
+
+void snapshot_drop(const uint32_t slot)
+{
+	if (slot >= SNAPSHOT_SLOTS)
+		return;
+	snapshot_free(snapshots[slot]);
+	snapshots[slot] = NULL;
+}
+
+void snapshot_drop_all(void)
+{
+	for (uint32_t slot = 0; slot < SNAPSHOT_SLOTS; ++slot)
+		snapshot_drop(slot);
+}
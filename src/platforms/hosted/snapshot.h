@@ -0,0 +1,44 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PLATFORMS_HOSTED_SNAPSHOT_H
+#define PLATFORMS_HOSTED_SNAPSHOT_H
+
+#include "target.h"
+
+/* Snapshots of a halted target's RAM and core registers, kept compressed in host memory */
+#define SNAPSHOT_SLOTS 8U
+
+typedef struct snapshot_stats {
+	uint32_t ram_bytes;         /* RAM the snapshot covers */
+	uint32_t stored_bytes;      /* host memory it takes after compression */
+	uint32_t transferred_bytes; /* RAM read or written by the last save or restore */
+	uint32_t ms;
+} snapshot_stats_s;
+
+/*
+ * With dirty set, only the parts of RAM whose CRC on the target differs from the snapshot are
+ * transferred. That needs a target CRC routine and a previous save to the slot, everything is
+ * transferred otherwise.
+ */
+bool snapshot_save(target *t, uint32_t slot, bool dirty, snapshot_stats_s *stats);
+bool snapshot_restore(target *t, uint32_t slot, bool dirty, snapshot_stats_s *stats);
+bool snapshot_info(uint32_t slot, snapshot_stats_s *stats);
+void snapshot_drop(uint32_t slot);
+void snapshot_drop_all(void);
+
+#endif /* PLATFORMS_HOSTED_SNAPSHOT_H */
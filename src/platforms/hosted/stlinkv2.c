@@ -401,6 +401,14 @@ static int write_retry(uint8_t *cmdbuf, size_t cmdsize,
 	return res;
 }
 
+/* The largest 8 bit access the adapter takes is one USB packet, so ask for its real size */
+static uint16_t stlink_max_packet_size(bmp_info_t *info, uint16_t fallback)
+{
+	libusb_device *const dev = libusb_get_device(info->usb_link->ul_libusb_device_handle);
+	const int size = libusb_get_max_packet_size(dev, info->usb_link->ep_rx | LIBUSB_ENDPOINT_IN);
+	return size > 0 ? (uint16_t)size : fallback;
+}
+
 /* Version data is at 0x080103f8 with STLINKV3 bootloader flashed with
  * STLinkUpgrade_v3[3|5].jar
  */
@@ -418,7 +426,7 @@ static void stlink_version(bmp_info_t *info)
 		stlink.ver_jtag  =  data[2];
 		stlink.ver_mass  =  data[3];
 		stlink.ver_bridge = data[4];
-		stlink.block_size = 512;
+		stlink.block_size = stlink_max_packet_size(info, 512);
 		stlink.vid = data[3] <<  9 | data[8];
 		stlink.pid = data[5] << 11 | data[10];
 	} else {
@@ -431,7 +439,7 @@ static void stlink_version(bmp_info_t *info)
 		stlink.vid = data[3] << 8 | data[2];
 		stlink.pid = data[5] << 8 | data[4];
 		int  version = data[0] << 8 | data[1]; /* Big endian here!*/
-		stlink.block_size = 64;
+		stlink.block_size = stlink_max_packet_size(info, 64);
 		stlink.ver_stlink = (version >> 12) & 0x0f;
 		stlink.ver_jtag   = (version >>  6) & 0x3f;
 		if ((stlink.pid == PRODUCT_ID_STLINKV21_MSD) ||
@@ -610,8 +618,8 @@ int stlink_init(bmp_info_t *info)
 				libusb_strerror(r));
 		return -1;
 	}
-	sl->req_trans = libusb_alloc_transfer(0);
-	sl->rep_trans = libusb_alloc_transfer(0);
+	if (usb_transfers_init(sl))
+		return -1;
 	stlink_version(info);
 	if ((stlink.ver_stlink < 3 && stlink.ver_jtag < 32) ||
 		(stlink.ver_stlink == 3 && stlink.ver_jtag < 3)) {
@@ -796,15 +804,19 @@ uint32_t stlink_dp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 		res = stlink_write_dp_register(
 			(addr < 0x100) ? STLINK_DEBUG_PORT_ACCESS : 0, addr, value);
 	}
-	if (res == STLINK_ERROR_WAIT)
-		raise_exception(EXCEPTION_TIMEOUT, "DP ACK timeout");
+	if (res == STLINK_ERROR_WAIT) {
+		adiv5_dp_raise(dp, EXCEPTION_TIMEOUT, "DP ACK timeout");
+		return 0;
+	}
 
 	if(res == STLINK_ERROR_DP_FAULT) {
 		dp->fault = 1;
 		return 0;
 	}
-	if(res == STLINK_ERROR_FAIL)
-		raise_exception(EXCEPTION_ERROR, "SWDP invalid ACK");
+	if(res == STLINK_ERROR_FAIL) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP invalid ACK");
+		return 0;
+	}
 
 	return response;
 }
@@ -854,100 +866,6 @@ static int stlink_usb_get_rw_status(bool verbose)
 	return stlink_usb_error_check(data, verbose);
 }
 
-static void stlink_readmem(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
-{
-	if (len == 0)
-		return;
-	size_t read_len = len;
-	uint8_t type;
-	if (src & 1 || len & 1) {
-		type = STLINK_DEBUG_READMEM_8BIT;
-		if (len > stlink.block_size) {
-			DEBUG_WARN("Too large!\n");
-			return;
-		}
-		if (len == 1)
-			read_len ++; /* Fix read length as in openocd*/
-	} else if (src & 3 || len & 3) {
-		type = STLINK_DEBUG_APIV2_READMEM_16BIT;
-	} else {
-		type = STLINK_DEBUG_READMEM_32BIT;
-	}
-	uint8_t cmd[16] = {
-		STLINK_DEBUG_COMMAND,
-		type,
-		src & 0xff, (src >>  8) & 0xff, (src >> 16) & 0xff,
-		(src >> 24) & 0xff,
-		len & 0xff, len >> 8, ap->apsel};
-	int res = read_retry(cmd, 16, dest, read_len);
-	if (res != STLINK_ERROR_OK) {
-		/* FIXME: What is the right measure when failing?
-		 *
-		 * E.g. TM4C129 gets here when NRF probe reads 0x10000010
-		 * Approach taken:
-		 * Fill the memory with some fixed pattern so hopefully
-		 * the caller notices the error*/
-		DEBUG_WARN("stlink_readmem from  %" PRIx32 " to %" PRIx32 ", len %"
-				   PRIx32 "failed\n", src, dest, (uint32_t) len);
-		memset(dest, 0xff, len);
-	}
-	DEBUG_PROBE("stlink_readmem from %" PRIx32 " to %" PRIx32 ", len %" PRIx32
-				"\n", src, dest, (uint32_t) len);
-}
-
-static void stlink_writemem8(usb_link_t *link, ADIv5_AP_t *ap, uint32_t addr,
-							 size_t len, uint8_t *buffer)
-{
-	(void)link;
-	while (len) {
-		size_t length;
-		/* OpenOCD has some note about writemem8*/
-		if (len > stlink.block_size)
-			length = stlink.block_size;
-		else
-			length = len;
-		uint8_t cmd[16] = {
-			STLINK_DEBUG_COMMAND,
-			STLINK_DEBUG_WRITEMEM_8BIT,
-			addr & 0xff, (addr >>  8) & 0xff, (addr >> 16) & 0xff,
-			(addr >> 24) & 0xff,
-			length & 0xff, length >> 8, ap->apsel};
-		send_recv(link, cmd, 16, NULL, 0);
-		send_recv(link, (void*)buffer, length, NULL, 0);
-		stlink_usb_get_rw_status(true);
-		len -= length;
-		addr += length;
-	}
-}
-
-static void stlink_writemem16(usb_link_t *link, ADIv5_AP_t *ap, uint32_t addr,
-							  size_t len, uint16_t *buffer)
-{
-	(void)link;
-	uint8_t cmd[16] = {
-		STLINK_DEBUG_COMMAND,
-		STLINK_DEBUG_APIV2_WRITEMEM_16BIT,
-		addr & 0xff, (addr >>  8) & 0xff, (addr >> 16) & 0xff,
-		(addr >> 24) & 0xff,
-		len & 0xff, len >> 8, ap->apsel};
-	send_recv(link, cmd, 16, NULL, 0);
-	send_recv(link, (void*)buffer, len, NULL, 0);
-	stlink_usb_get_rw_status(true);
-}
-
-static void stlink_writemem32(usb_link_t * link, ADIv5_AP_t *ap, uint32_t addr,
-							  size_t len, uint32_t *buffer)
-{
-	(void)link;
-	uint8_t cmd[16] = {
-		STLINK_DEBUG_COMMAND,
-		STLINK_DEBUG_WRITEMEM_32BIT,
-		addr & 0xff, (addr >>  8) & 0xff, (addr >> 16) & 0xff,
-		(addr >> 24) & 0xff,
-		len & 0xff, len >> 8, ap->apsel};
-	write_retry(cmd, 16, (void*)buffer, len);
-}
-
 static void stlink_regs_read(ADIv5_AP_t *ap, void *data)
 {
 	uint8_t cmd[16] = {STLINK_DEBUG_COMMAND, STLINK_DEBUG_APIV2_READALLREGS,
@@ -985,25 +903,184 @@ static void stlink_reg_write(ADIv5_AP_t *ap, int num, uint32_t val)
 	stlink_usb_error_check(res, true);
 }
 
+/*
+ * Data transfers stay within one 1kiB TAR auto-increment block, 8 bit ones
+ * also within a single USB packet. Up to STLINK_PIPELINE_CHUNKS of them are
+ * kept queued on the adapter at once.
+ */
+#define STLINK_TAR_AUTOINC_BLOCK 1024U
+#define STLINK_PIPELINE_CHUNKS   8U
+
+static size_t stlink_chunk_len(uint32_t addr, size_t len, bool byte_access)
+{
+	size_t max = STLINK_TAR_AUTOINC_BLOCK - (addr & (STLINK_TAR_AUTOINC_BLOCK - 1U));
+	if (byte_access)
+		max = MIN(max, stlink.block_size);
+	return MIN(len, max);
+}
+
+static void stlink_mem_cmd(uint8_t *cmd, uint8_t type, uint32_t addr, size_t len, uint8_t apsel)
+{
+	memset(cmd, 0, 16);
+	cmd[0] = STLINK_DEBUG_COMMAND;
+	cmd[1] = type;
+	cmd[2] = addr & 0xff;
+	cmd[3] = (addr >>  8) & 0xff;
+	cmd[4] = (addr >> 16) & 0xff;
+	cmd[5] = (addr >> 24) & 0xff;
+	cmd[6] = len & 0xff;
+	cmd[7] = len >> 8;
+	cmd[8] = apsel;
+}
+
+/* Read one chunk on its own, retrying while the AP is busy */
+static void stlink_read_chunk(ADIv5_AP_t *ap, uint8_t type, uint8_t *dest, uint32_t src, size_t len)
+{
+	uint8_t cmd[16];
+	uint8_t pad[2];
+	stlink_mem_cmd(cmd, type, src, len, ap->apsel);
+	/* A single byte read is answered with two, as in openocd */
+	int res = len == 1 ? read_retry(cmd, 16, pad, 2) : read_retry(cmd, 16, dest, len);
+	if (len == 1)
+		dest[0] = pad[0];
+	if (res != STLINK_ERROR_OK) {
+		/* FIXME: What is the right measure when failing?
+		 *
+		 * E.g. TM4C129 gets here when NRF probe reads 0x10000010
+		 * Approach taken:
+		 * Fill the memory with some fixed pattern so hopefully
+		 * the caller notices the error*/
+		DEBUG_WARN("stlink_readmem from  %" PRIx32 " to %p, len %" PRIx32 "failed\n",
+			src, (void *)dest, (uint32_t)len);
+		memset(dest, 0xff, len);
+	}
+}
+
+static void stlink_readmem(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	if (len == 0)
+		return;
+	/*
+	 * 8-bit reads are limited to the adapter's block size, so only split off the unaligned
+	 * edges when the word aligned body does not fit one of those anyway
+	 */
+	size_t head;
+	const size_t words = adiv5_align_split(src, len, &head);
+	if (words > stlink.block_size) {
+		uint8_t *const data = dest;
+		stlink_readmem(ap, data, src, head);
+		stlink_readmem(ap, data + head, src + head, words);
+		stlink_readmem(ap, data + head + words, src + head + words, len - head - words);
+		return;
+	}
+	uint8_t type;
+	if (src & 1 || len & 1)
+		type = STLINK_DEBUG_READMEM_8BIT;
+	else if (src & 3 || len & 3)
+		type = STLINK_DEBUG_APIV2_READMEM_16BIT;
+	else
+		type = STLINK_DEBUG_READMEM_32BIT;
+	DEBUG_PROBE("stlink_readmem from %" PRIx32 " to %p, len %" PRIx32 "\n", src, dest, (uint32_t)len);
+
+	uint8_t *data = dest;
+	while (len) {
+		uint8_t cmds[STLINK_PIPELINE_CHUNKS][16];
+		uint8_t status[STLINK_PIPELINE_CHUNKS][12];
+		uint8_t status_cmd[16] = {STLINK_DEBUG_COMMAND, STLINK_DEBUG_APIV2_GETLASTRWSTATUS2};
+		usb_pipelined_s steps[STLINK_PIPELINE_CHUNKS * 4U];
+		uint32_t chunk_addr[STLINK_PIPELINE_CHUNKS];
+		size_t chunk_len[STLINK_PIPELINE_CHUNKS];
+		uint8_t *chunk_data[STLINK_PIPELINE_CHUNKS];
+		size_t chunks = 0;
+		size_t count = 0;
+		/* Single byte reads take the two byte reply, leave them to stlink_read_chunk() */
+		while (chunks < STLINK_PIPELINE_CHUNKS && len > 1) {
+			const size_t chunk = stlink_chunk_len(src, len, type == STLINK_DEBUG_READMEM_8BIT);
+			stlink_mem_cmd(cmds[chunks], type, src, chunk, ap->apsel);
+			steps[count++] = (usb_pipelined_s){cmds[chunks], 16, false};
+			steps[count++] = (usb_pipelined_s){data, chunk, true};
+			steps[count++] = (usb_pipelined_s){status_cmd, 16, false};
+			steps[count++] = (usb_pipelined_s){status[chunks], 12, true};
+			chunk_addr[chunks] = src;
+			chunk_len[chunks] = chunk;
+			chunk_data[chunks++] = data;
+			data += chunk;
+			src += chunk;
+			len -= chunk;
+		}
+		if (!chunks) {
+			stlink_read_chunk(ap, type, data, src, len);
+			break;
+		}
+		const bool sent = !send_recv_pipelined(info.usb_link, steps, count);
+		/* Chunks the adapter did not complete are read again one by one */
+		for (size_t i = 0; i < chunks; ++i) {
+			if (!sent || stlink_usb_error_check(status[i], false) != STLINK_ERROR_OK)
+				stlink_read_chunk(ap, type, chunk_data[i], chunk_addr[i], chunk_len[i]);
+		}
+	}
+}
+
+/* Write one chunk on its own, retrying while the AP is busy */
+static void stlink_write_chunk(ADIv5_AP_t *ap, uint8_t type, uint32_t addr, const uint8_t *src, size_t len)
+{
+	uint8_t cmd[16];
+	stlink_mem_cmd(cmd, type, addr, len, ap->apsel);
+	if (write_retry(cmd, 16, (uint8_t *)src, len) != STLINK_ERROR_OK)
+		DEBUG_WARN("stlink_writemem to %" PRIx32 ", len %" PRIx32 " failed\n", addr, (uint32_t)len);
+}
+
 static void stlink_mem_write_sized(	ADIv5_AP_t *ap, uint32_t dest,
 									const void *src, size_t len,
 									enum align align)
 {
-	if (len == 0)
-		return;
-	usb_link_t *link = info.usb_link;
-	switch(align) {
+	uint8_t type;
+	switch (align) {
 	case ALIGN_BYTE:
-		stlink_writemem8(link, ap, dest, len, (uint8_t *) src);
+		type = STLINK_DEBUG_WRITEMEM_8BIT;
 		break;
 	case ALIGN_HALFWORD:
-		stlink_writemem16(link,ap, dest, len, (uint16_t *) src);
+		type = STLINK_DEBUG_APIV2_WRITEMEM_16BIT;
 		break;
 	case ALIGN_WORD:
 	case ALIGN_DWORD:
-		stlink_writemem32(link, ap, dest, len, (uint32_t *) src);
+	default:
+		type = STLINK_DEBUG_WRITEMEM_32BIT;
 		break;
 	}
+
+	const uint8_t *data = src;
+	while (len) {
+		uint8_t cmds[STLINK_PIPELINE_CHUNKS][16];
+		uint8_t status[STLINK_PIPELINE_CHUNKS][12];
+		uint8_t status_cmd[16] = {STLINK_DEBUG_COMMAND, STLINK_DEBUG_APIV2_GETLASTRWSTATUS2};
+		usb_pipelined_s steps[STLINK_PIPELINE_CHUNKS * 4U];
+		uint32_t chunk_addr[STLINK_PIPELINE_CHUNKS];
+		size_t chunk_len[STLINK_PIPELINE_CHUNKS];
+		const uint8_t *chunk_data[STLINK_PIPELINE_CHUNKS];
+		size_t chunks = 0;
+		size_t count = 0;
+		while (chunks < STLINK_PIPELINE_CHUNKS && len) {
+			const size_t chunk = stlink_chunk_len(dest, len, align == ALIGN_BYTE);
+			stlink_mem_cmd(cmds[chunks], type, dest, chunk, ap->apsel);
+			steps[count++] = (usb_pipelined_s){cmds[chunks], 16, false};
+			steps[count++] = (usb_pipelined_s){(uint8_t *)data, chunk, false};
+			steps[count++] = (usb_pipelined_s){status_cmd, 16, false};
+			steps[count++] = (usb_pipelined_s){status[chunks], 12, true};
+			chunk_addr[chunks] = dest;
+			chunk_len[chunks] = chunk;
+			chunk_data[chunks++] = data;
+			data += chunk;
+			dest += chunk;
+			len -= chunk;
+		}
+		const bool sent = !send_recv_pipelined(info.usb_link, steps, count);
+		/* Chunks the adapter did not complete are written again one by one */
+		for (size_t i = 0; i < chunks; ++i) {
+			if (!sent || stlink_usb_error_check(status[i], false) != STLINK_ERROR_OK)
+				stlink_write_chunk(ap, type, chunk_addr[i], chunk_data[i], chunk_len[i]);
+		}
+	}
 }
 
 static void stlink_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
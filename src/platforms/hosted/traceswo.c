@@ -0,0 +1,162 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Capture of the TRACESWO output through the probe, for CMSIS-DAP probes
+ * and J-Links. The raw trace goes to the file or localhost TCP port given
+ * with --swo-out, for trace tools to pick up, and with 'traceswo decode' the
+ * stimulus port data of the selected channels is decoded onto the terminal.
+ */
+
+#include "general.h"
+#include "traceswo.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifndef WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* at most this many probe reads each poll, so a busy trace does not stall gdb */
+#define SWO_READS_PER_POLL 8U
+
+static bool swo_active = false;
+static bool swo_decoding = false;
+static uint8_t swo_buf[4096];
+
+static int swo_file_fd = -1;
+#ifndef WIN32
+static int swo_listen_fd = -1;
+static int swo_client_fd = -1;
+
+static void traceswo_listen(const uint16_t port)
+{
+	swo_listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+	if (swo_listen_fd == -1)
+		return;
+	int opt = 1;
+	setsockopt(swo_listen_fd, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(opt));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(swo_listen_fd, (void *)&addr, sizeof(addr)) == -1 || listen(swo_listen_fd, 1) == -1) {
+		DEBUG_WARN("swo: can not listen on port %u: %s\n", port, strerror(errno));
+		close(swo_listen_fd);
+		swo_listen_fd = -1;
+		return;
+	}
+	fcntl(swo_listen_fd, F_SETFL, fcntl(swo_listen_fd, F_GETFL, 0) | O_NONBLOCK);
+	DEBUG_INFO("swo: trace on localhost port %u\n", port);
+}
+
+/* trace nobody is connected for, or a slow consumer can not take, is dropped */
+static void traceswo_send(const uint8_t *const data, const size_t len)
+{
+	if (swo_client_fd == -1 && swo_listen_fd != -1) {
+		swo_client_fd = accept(swo_listen_fd, NULL, NULL);
+		if (swo_client_fd != -1)
+			fcntl(swo_client_fd, F_SETFL, fcntl(swo_client_fd, F_GETFL, 0) | O_NONBLOCK);
+	}
+	if (swo_client_fd == -1)
+		return;
+	const ssize_t sent = send(swo_client_fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		close(swo_client_fd);
+		swo_client_fd = -1;
+	}
+}
+#endif
+
+/* output is a port number for a localhost socket, or a file name */
+void traceswo_output_init(const char *const output)
+{
+	if (!output)
+		return;
+#ifndef WIN32
+	if (output[0] && strspn(output, "0123456789") == strlen(output)) {
+		traceswo_listen(strtoul(output, NULL, 10));
+		return;
+	}
+#endif
+	swo_file_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	if (swo_file_fd == -1)
+		DEBUG_WARN("swo: can not open %s: %s\n", output, strerror(errno));
+}
+
+bool traceswo_init(const traceswo_mode_e mode, const uint32_t baudrate, const uint32_t swo_chan_bitmask)
+{
+	traceswo_deinit();
+	uint32_t actual_baudrate = baudrate;
+	if (!platform_traceswo_start(mode, baudrate, &actual_baudrate))
+		return false;
+	if (actual_baudrate != baudrate)
+		DEBUG_WARN("swo: probe captures at %" PRIu32 " baud\n", actual_baudrate);
+	traceswo_setmask(swo_chan_bitmask);
+	swo_decoding = swo_chan_bitmask != 0;
+	swo_active = true;
+	return true;
+}
+
+void traceswo_deinit(void)
+{
+	if (!swo_active)
+		return;
+	platform_traceswo_stop();
+	swo_active = false;
+}
+
+void traceswo_poll(void)
+{
+	if (!swo_active)
+		return;
+	for (size_t i = 0; i < SWO_READS_PER_POLL; ++i) {
+		const int len = platform_traceswo_read(swo_buf, sizeof(swo_buf));
+		if (len < 0) {
+			DEBUG_WARN("swo: trace capture failed, stopped\n");
+			traceswo_deinit();
+			return;
+		}
+		if (!len)
+			return;
+		if (swo_file_fd != -1 && write(swo_file_fd, swo_buf, len) != len) {
+			DEBUG_WARN("swo: trace file write failed: %s\n", strerror(errno));
+			close(swo_file_fd);
+			swo_file_fd = -1;
+		}
+#ifndef WIN32
+		traceswo_send(swo_buf, len);
+#endif
+		if (swo_decoding)
+			traceswo_decode(swo_buf, len);
+	}
+}
+
+/* decoded stimulus data goes to the terminal, as rtt output does */
+void traceswo_decode_output(const uint8_t *const data, const size_t len)
+{
+	fwrite(data, 1, len, stdout);
+	fflush(stdout);
+}
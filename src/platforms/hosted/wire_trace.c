@@ -0,0 +1,147 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Binary transport trace recorder, see wire_trace.h */
+
+#include "general.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+#include "wire_trace.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* 16MiB of records, the oldest are overwritten once it is full */
+#define WIRE_TRACE_RECORDS (1U << 20U)
+
+#define WIRE_TRACE_VERSION 1U
+
+/* File layout, host byte order: the header then the records, oldest first */
+typedef struct wire_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t recorded; /* records ever added, more than in the file if the ring wrapped */
+} wire_trace_header_s;
+
+typedef struct wire_trace_record {
+	uint64_t time_ns; /* monotonic, from an arbitrary origin */
+	uint32_t len;
+	uint8_t op;
+	uint8_t tag;
+	uint16_t reserved;
+} wire_trace_record_s;
+
+bool wire_trace_enabled;
+
+static const char *wire_trace_path;
+static wire_trace_record_s *wire_trace_ring;
+static uint64_t wire_trace_count;
+
+static uint64_t wire_trace_time_ns(void)
+{
+#if defined(_WIN32)
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000U +
+		(uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000U / (uint64_t)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void wire_trace_add(const wire_trace_op_e op, const uint8_t tag, const uint32_t len)
+{
+	wire_trace_record_s *const record = &wire_trace_ring[wire_trace_count++ & (WIRE_TRACE_RECORDS - 1U)];
+	record->time_ns = wire_trace_time_ns();
+	record->len = len;
+	record->op = op;
+	record->tag = tag;
+	record->reserved = 0;
+}
+
+static bool wire_trace_write(const int fd, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	while (size) {
+		const ssize_t written = write(fd, p, size);
+		if (written <= 0)
+			return false;
+		p += written;
+		size -= (size_t)written;
+	}
+	return true;
+}
+
+/* Only uses calls safe from a signal handler, SIGUSR1 dumps a snapshot */
+bool wire_trace_dump(void)
+{
+	if (!wire_trace_enabled)
+		return true;
+	const int fd = open(wire_trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	if (fd < 0)
+		return false;
+	const wire_trace_header_s header = {
+		.magic = "BMPWIRE",
+		.version = WIRE_TRACE_VERSION,
+		.record_size = sizeof(wire_trace_record_s),
+		.recorded = wire_trace_count,
+	};
+	const uint64_t count = wire_trace_count;
+	const size_t head = count & (WIRE_TRACE_RECORDS - 1U);
+	bool ok = wire_trace_write(fd, &header, sizeof(header));
+	if (count > WIRE_TRACE_RECORDS)
+		ok = ok && wire_trace_write(fd, wire_trace_ring + head, (WIRE_TRACE_RECORDS - head) * sizeof(*wire_trace_ring));
+	ok = ok && wire_trace_write(fd, wire_trace_ring, head * sizeof(*wire_trace_ring));
+	close(fd);
+	return ok;
+}
+
+#ifdef SIGUSR1
+static void wire_trace_signal(int sig)
+{
+	(void)sig;
+	wire_trace_dump();
+}
+#endif
+
+bool wire_trace_init(const char *const path)
+{
+	wire_trace_ring = calloc(WIRE_TRACE_RECORDS, sizeof(*wire_trace_ring));
+	if (!wire_trace_ring) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	wire_trace_path = path;
+	wire_trace_enabled = true;
+#ifdef SIGUSR1
+	signal(SIGUSR1, wire_trace_signal);
+#endif
+	DEBUG_INFO("Tracing the wire to %s\n", path);
+	return true;
+}
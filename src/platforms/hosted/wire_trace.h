@@ -0,0 +1,54 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Binary trace of the transport operations, enabled with -W FILE. Records
+ * go to a ring buffer in memory and are written out on exit, or on SIGUSR1
+ * where there is one. scripts/wire_trace.py reads the file.
+ */
+
+#ifndef PLATFORMS_HOSTED_WIRE_TRACE_H
+#define PLATFORMS_HOSTED_WIRE_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Keep in step with scripts/wire_trace.py */
+typedef enum wire_trace_op {
+	WIRE_TRACE_USB_SUBMIT,   /* tag: endpoint address, len: bytes asked for */
+	WIRE_TRACE_USB_COMPLETE, /* tag: endpoint address, len: bytes moved */
+	WIRE_TRACE_REMOTE_TX,    /* tag: remote packet class */
+	WIRE_TRACE_REMOTE_RX,    /* tag: response code */
+	WIRE_TRACE_DAP_CMD,      /* tag: DAP command */
+	WIRE_TRACE_DAP_RESP,     /* tag: DAP command answered */
+	WIRE_TRACE_GDB_RX,       /* tag: packet type */
+	WIRE_TRACE_GDB_TX,       /* tag: packet type */
+} wire_trace_op_e;
+
+extern bool wire_trace_enabled;
+
+bool wire_trace_init(const char *path);
+void wire_trace_add(wire_trace_op_e op, uint8_t tag, uint32_t len);
+bool wire_trace_dump(void);
+
+#define WIRE_TRACE(op, tag, len)                                   \
+	do {                                                           \
+		if (wire_trace_enabled)                                    \
+			wire_trace_add((op), (uint8_t)(tag), (uint32_t)(len)); \
+	} while (0)
+
+#endif /* PLATFORMS_HOSTED_WIRE_TRACE_H */
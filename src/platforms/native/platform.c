@@ -36,9 +36,11 @@
 #include <libopencm3/usb/usbd.h>
 #include <libopencm3/stm32/adc.h>
 #include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/spi.h>
 
 static void adc_init(void);
 static void setup_vbus_irq(void);
+static void jtag_spi_init(void);
 
 /* Starting with hardware version 4 we are storing the hardware version in the
  * flash option user Data1 byte.
@@ -169,6 +171,7 @@ void platform_init(void)
 		gpio_set_mode(TCK_DIR_PORT, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, TCK_DIR_PIN);
 		gpio_set_mode(TCK_PORT, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, TCK_PIN);
 		gpio_clear(TCK_DIR_PORT, TCK_DIR_PIN);
+		jtag_spi_init();
 	}
 
 	gpio_set_mode(LED_PORT, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, LED_UART | LED_IDLE_RUN | LED_ERROR);
@@ -346,6 +349,196 @@ void platform_target_clk_output_enable(bool enable)
 	}
 }
 
+/*
+ * From hardware 6 on TCK, TDI and TDO sit on SPI1's SCK, MOSI and MISO (PA5-7).
+ * SPI mode 0, LSB first, shifts TDI out on the falling edge and samples TDO on
+ * the rising edge just as JTAG wants. 72MHz / 16 keeps the clock a little above
+ * what the bit-banged loop manages.
+ */
+static void jtag_spi_init(void)
+{
+	rcc_periph_clock_enable(RCC_SPI1);
+	spi_init_master(SPI1, SPI_CR1_BAUDRATE_FPCLK_DIV_16, SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
+		SPI_CR1_CPHA_CLK_TRANSITION_1, SPI_CR1_DFF_8BIT, SPI_CR1_LSBFIRST);
+	spi_enable_software_slave_management(SPI1);
+	spi_set_nss_high(SPI1);
+	spi_enable(SPI1);
+}
+
+bool platform_jtag_spi_shift(const uint8_t *const data_in, uint8_t *const data_out, const size_t bytes)
+{
+	if (platform_hwversion() < 6 || !bytes)
+		return false;
+	/* Hand TCK and TDI to the SPI for the shift, TCK idles low in both modes */
+	gpio_clear(TCK_PORT, TCK_PIN);
+	gpio_set_mode(JTAG_PORT, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, TCK_PIN | TDI_PIN);
+	(void)SPI_DR(SPI1);
+	SPI_DR(SPI1) = data_in[0];
+	for (size_t i = 0; i < bytes; ++i) {
+		/* Queue the next byte while this one shifts, so the clock runs without gaps */
+		if (i + 1U < bytes) {
+			while (!(SPI_SR(SPI1) & SPI_SR_TXE))
+				continue;
+			SPI_DR(SPI1) = data_in[i + 1U];
+		}
+		while (!(SPI_SR(SPI1) & SPI_SR_RXNE))
+			continue;
+		const uint8_t value = SPI_DR(SPI1);
+		if (data_out)
+			data_out[i] = value;
+	}
+	while (SPI_SR(SPI1) & SPI_SR_BSY)
+		continue;
+	gpio_set_mode(JTAG_PORT, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, TCK_PIN | TDI_PIN);
+	return true;
+}
+
+/*
+ * The optional OTG SPI Flash of hardware 5 and newer on SPI2 (PB13-15, CS on PB5) holds
+ * the standalone programmer image. Any 25-series part with 4K sector erase, 256 byte page
+ * program and a JEDEC ID giving its size will do. Set up on first use, the ID read decides
+ * whether one is fitted.
+ */
+#define STORE_CMD_WRITE_ENABLE 0x06U
+#define STORE_CMD_PAGE_PROGRAM 0x02U
+#define STORE_CMD_READ         0x03U
+#define STORE_CMD_READ_STATUS  0x05U
+#define STORE_CMD_SECTOR_ERASE 0x20U
+#define STORE_CMD_JEDEC_ID     0x9fU
+#define STORE_STATUS_BUSY      0x01U
+#define STORE_PAGE_SIZE        256U
+#define STORE_TIMEOUT_MS       1000U
+
+static size_t store_size;
+static bool store_probed;
+
+static void store_select(const bool select)
+{
+	gpio_set_val(OTG_PORT, OTG_CS, !select);
+}
+
+static uint8_t store_xfer(const uint8_t value)
+{
+	return spi_xfer(SPI2, value);
+}
+
+static void store_command(const uint8_t command, const uint32_t addr)
+{
+	store_select(true);
+	store_xfer(command);
+	store_xfer(addr >> 16U);
+	store_xfer(addr >> 8U);
+	store_xfer(addr);
+}
+
+static bool store_wait_ready(void)
+{
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, STORE_TIMEOUT_MS);
+	bool busy = true;
+	while (busy && !platform_timeout_is_expired(&timeout)) {
+		store_select(true);
+		store_xfer(STORE_CMD_READ_STATUS);
+		busy = store_xfer(0) & STORE_STATUS_BUSY;
+		store_select(false);
+	}
+	return !busy;
+}
+
+static void store_write_enable(void)
+{
+	store_select(true);
+	store_xfer(STORE_CMD_WRITE_ENABLE);
+	store_select(false);
+}
+
+size_t platform_store_size(void)
+{
+	if (store_probed)
+		return store_size;
+	store_probed = true;
+	if (platform_hwversion() < 5)
+		return 0;
+	rcc_periph_clock_enable(RCC_SPI2);
+	gpio_set(OTG_PORT, OTG_CS);
+	gpio_set_mode(OTG_PORT, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, OTG_CS);
+	gpio_set_mode(OTG_PORT, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, OTG_SCLK | OTG_COPI);
+	gpio_set_mode(OTG_PORT, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, OTG_CIPO);
+	/* 36MHz APB1 / 2, mode 0 */
+	spi_init_master(SPI2, SPI_CR1_BAUDRATE_FPCLK_DIV_2, SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
+		SPI_CR1_CPHA_CLK_TRANSITION_1, SPI_CR1_DFF_8BIT, SPI_CR1_MSBFIRST);
+	spi_enable_software_slave_management(SPI2);
+	spi_set_nss_high(SPI2);
+	spi_enable(SPI2);
+
+	store_select(true);
+	store_xfer(STORE_CMD_JEDEC_ID);
+	const uint8_t manufacturer = store_xfer(0);
+	store_xfer(0);
+	const uint8_t capacity = store_xfer(0);
+	store_select(false);
+	/* Nothing fitted reads all zeros or all ones, sizes past 16MiB need 4 byte addresses */
+	if (manufacturer == 0x00U || manufacturer == 0xffU || capacity < 12U || capacity > 30U)
+		return 0;
+	store_size = 1U << MIN(capacity, 24U);
+	return store_size;
+}
+
+bool platform_store_read(uint32_t offset, void *const data, const size_t len)
+{
+	if (!platform_store_size() || offset + len > store_size)
+		return false;
+	uint8_t *const dest = (uint8_t *)data;
+	store_command(STORE_CMD_READ, offset);
+	for (size_t i = 0; i < len; ++i)
+		dest[i] = store_xfer(0);
+	store_select(false);
+	return true;
+}
+
+bool platform_store_write(uint32_t offset, const void *const data, const size_t len)
+{
+	if (!platform_store_size() || offset + len > store_size)
+		return false;
+	const uint8_t *src = (const uint8_t *)data;
+	for (size_t done = 0; done < len;) {
+		/* A page program wraps at the page end, so each stops there */
+		const size_t amount = MIN(len - done, STORE_PAGE_SIZE - (offset & (STORE_PAGE_SIZE - 1U)));
+		store_write_enable();
+		store_command(STORE_CMD_PAGE_PROGRAM, offset);
+		for (size_t i = 0; i < amount; ++i)
+			store_xfer(src[done + i]);
+		store_select(false);
+		if (!store_wait_ready())
+			return false;
+		offset += amount;
+		done += amount;
+	}
+	return true;
+}
+
+bool platform_store_erase(const uint32_t offset, const size_t len)
+{
+	if (!platform_store_size() || offset + len > store_size)
+		return false;
+	const uint32_t end = offset + len;
+	for (uint32_t sector = offset & ~(PLATFORM_STORE_ERASE_SIZE - 1U); sector < end;
+		 sector += PLATFORM_STORE_ERASE_SIZE) {
+		store_write_enable();
+		store_command(STORE_CMD_SECTOR_ERASE, sector);
+		store_select(false);
+		if (!store_wait_ready())
+			return false;
+	}
+	return true;
+}
+
+/* BTN1 is the bootloader button, it reads low while pressed */
+bool platform_button_pressed(void)
+{
+	return !gpio_get(AUX_BTN1_PORT, AUX_BTN1);
+}
+
 void exti15_10_isr(void)
 {
 	uint32_t usb_vbus_port;
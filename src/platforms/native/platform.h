@@ -32,6 +32,10 @@
 #define PLATFORM_HAS_TRACESWO
 #define PLATFORM_HAS_POWER_SWITCH
 #define PLATFORM_HAS_USBUART
+#define PLATFORM_HAS_JTAG_SPI
+#define PLATFORM_HAS_STANDALONE
+/* The OTG SPI Flash holding the standalone image erases 4K sectors */
+#define PLATFORM_STORE_ERASE_SIZE 4096U
 
 #ifdef ENABLE_DEBUG
 #define PLATFORM_HAS_DEBUG
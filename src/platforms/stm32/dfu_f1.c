@@ -44,6 +44,11 @@ void dfu_check_and_do_sector_erase(uint32_t sector)
 	}
 }
 
+uint32_t dfu_erase_unit_end(uint32_t addr)
+{
+	return (addr | (FLASHBLOCKSIZE - 1)) + 1;
+}
+
 void dfu_flash_program_buffer(uint32_t baseaddr, void *buf, int len)
 {
 	for(int i = 0; i < len; i += 2)
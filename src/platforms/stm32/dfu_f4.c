@@ -57,6 +57,17 @@ void dfu_check_and_do_sector_erase(uint32_t addr)
 	}
 }
 
+uint32_t dfu_erase_unit_end(uint32_t addr)
+{
+	int i = 0;
+	while (sector_addr[i + 1] && addr >= sector_addr[i + 1])
+		i++;
+	/* Past the last sector there is nothing to erase */
+	if (!sector_addr[i + 1])
+		return addr;
+	return sector_addr[i + 1];
+}
+
 void dfu_flash_program_buffer(uint32_t baseaddr, void *buf, int len)
 {
 	for(int i = 0; i < len; i += 4)
@@ -73,8 +84,8 @@ uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum)
 			return sector_erase_time[sector_num];
 	}
 
-	/* Programming 256 word with 100 us(max) per word*/
-	return 26;
+	/* Programming a block of words with 100 us(max) per word*/
+	return (DFU_TRANSFER_SIZE / 4) * 100 / 1000 + 1;
 }
 
 void dfu_protect(bool enable)
@@ -47,7 +47,7 @@
 
 usbd_device *usbdev;
 /* We need a special large control buffer for this device: */
-uint8_t usbd_control_buffer[1024];
+uint8_t usbd_control_buffer[DFU_TRANSFER_SIZE];
 
 static uint32_t max_address;
 
@@ -85,7 +85,7 @@ const struct usb_dfu_descriptor dfu_function = {
 	.bDescriptorType = DFU_FUNCTIONAL,
 	.bmAttributes = USB_DFU_CAN_DOWNLOAD | USB_DFU_CAN_UPLOAD | USB_DFU_WILL_DETACH,
 	.wDetachTimeout = 255,
-	.wTransferSize = 1024,
+	.wTransferSize = DFU_TRANSFER_SIZE,
 	.bcdDFUVersion = 0x011A,
 };
 
@@ -142,14 +142,66 @@ static uint32_t get_le32(const void *vp)
 	return ((uint32_t)p[3] << 24) + ((uint32_t)p[2] << 16) + (p[1] << 8) + p[0];
 }
 
+static void put_le32(void *vp, uint32_t val)
+{
+	uint8_t *p = vp;
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
+
+/* Bitwise, the bootloader has no room for a table. The upgrade utility computes the same CRC. */
+static uint32_t dfu_crc32(const uint8_t *data, uint32_t len)
+{
+	uint32_t crc = 0xffffffff;
+	while (len--) {
+		crc ^= *data++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+/* Fill buf with the size and CRC of each erase unit from prog.addr, returns the length used */
+static uint16_t dfu_crc_table(uint8_t *buf, uint16_t len)
+{
+	uint32_t addr = prog.addr;
+	uint16_t used = 0;
+	while (used + 8 <= len && addr < max_address) {
+		uint32_t end = dfu_erase_unit_end(addr);
+		if (end <= addr || end > max_address)
+			break;
+		put_le32(buf + used, end - addr);
+		put_le32(buf + used + 4, dfu_crc32((const uint8_t *)addr, end - addr));
+		used += 8;
+		addr = end;
+	}
+	return used;
+}
+
+static uint32_t prog_baseaddr(void)
+{
+	return prog.addr + ((prog.blocknum - 2) * dfu_function.wTransferSize);
+}
+
+/* A block that is in Flash already, as after an erase for 0xff, needs no programming */
+static bool prog_unchanged(void)
+{
+	return prog.blocknum >= 2 && !memcmp((void *)prog_baseaddr(), prog.buf, prog.len);
+}
+
 static uint8_t usbdfu_getstatus(uint32_t *bwPollTimeout)
 {
 	switch(usbdfu_state) {
 	case STATE_DFU_DNLOAD_SYNC:
 		usbdfu_state = STATE_DFU_DNBUSY;
-		*bwPollTimeout = dfu_poll_timeout(prog.buf[0],
-					get_le32(prog.buf + 1),
-					prog.blocknum);
+		if (prog_unchanged())
+			*bwPollTimeout = 0;
+		else
+			*bwPollTimeout = dfu_poll_timeout(prog.buf[0],
+						get_le32(prog.buf + 1),
+						prog.blocknum);
 		return DFU_STATUS_OK;
 
 	case STATE_DFU_MANIFEST_SYNC:
@@ -184,11 +236,8 @@ usbdfu_getstatus_complete(usbd_device *dev, struct usb_setup_data *req)
 				}
 				dfu_check_and_do_sector_erase(addr);
 			}
-		} else {
-			uint32_t baseaddr = prog.addr +
-				((prog.blocknum - 2) *
-					dfu_function.wTransferSize);
-			dfu_flash_program_buffer(baseaddr, prog.buf, prog.len);
+		} else if (!prog_unchanged()) {
+			dfu_flash_program_buffer(prog_baseaddr(), prog.buf, prog.len);
 		}
 		flash_lock();
 
@@ -253,10 +302,9 @@ static enum usbd_request_return_codes usbdfu_control_request(usbd_device *dev,
 			prog.blocknum = req->wValue;
 			usbdfu_state = STATE_DFU_UPLOAD_IDLE;
 			if(prog.blocknum > 1) {
-				uint32_t baseaddr = prog.addr +
-					((prog.blocknum - 2) *
-					 dfu_function.wTransferSize);
-				memcpy(*buf, (void*)baseaddr, *len);
+				memcpy(*buf, (void*)prog_baseaddr(), *len);
+			} else if (prog.blocknum == DFU_CRC_TABLE_BLOCK) {
+				*len = dfu_crc_table(*buf, *len);
 			}
 			return USBD_REQ_HANDLED;
 		} else {
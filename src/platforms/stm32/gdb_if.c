@@ -28,6 +28,7 @@
 #include "general.h"
 #include "usb_serial.h"
 #include "gdb_if.h"
+#include "perf.h"
 
 static uint32_t count_out;
 static uint32_t count_in;
@@ -38,32 +39,84 @@ static uint8_t buffer_in[CDCACM_PACKET_SIZE];
 static volatile uint32_t count_new;
 static uint8_t double_buffer_out[CDCACM_PACKET_SIZE];
 #endif
+#ifdef ENABLE_BULK_IF
+/*
+ * The vendor bulk OUT endpoint fills these in turn, one packet can be
+ * received while the other is parsed. The endpoint NAKs while both are full.
+ */
+static uint8_t bulk_buffer_out[2][CDCACM_PACKET_SIZE];
+static volatile uint32_t bulk_count[2];
+static volatile uint8_t bulk_head;
+static uint8_t bulk_tail;
+/* Replies go out on the interface the last request came in on */
+static bool gdb_if_bulk;
+#endif
 
-void gdb_if_putchar(unsigned char c, int flush)
+/* The bulk interface has no DTR, it counts as connected while it has traffic */
+static bool gdb_if_connected(void)
 {
-	buffer_in[count_in++] = c;
-	if (flush || (count_in == CDCACM_PACKET_SIZE)) {
-		/* Refuse to send if USB isn't configured, and
-		 * don't bother if nobody's listening */
-		if (usb_get_config() != 1 || !gdb_serial_get_dtr()) {
-			count_in = 0;
-			return;
-		}
-		while (usbd_ep_write_packet(usbdev, CDCACM_GDB_ENDPOINT, buffer_in, count_in) <= 0)
-			continue;
+#ifdef ENABLE_BULK_IF
+	if (gdb_if_bulk || bulk_count[bulk_tail])
+		return true;
+#endif
+	return gdb_serial_get_dtr();
+}
 
-		if (flush && (count_in == CDCACM_PACKET_SIZE)) {
-			/* We need to send an empty packet for some hosts
-			 * to accept this as a complete transfer. */
-			/* libopencm3 needs a change for us to confirm when
-			 * that transfer is complete, so we just send a packet
-			 * containing a null byte for now.
-			 */
-			while (usbd_ep_write_packet(usbdev, CDCACM_GDB_ENDPOINT, "\0", 1) <= 0)
-				continue;
-		}
+static uint8_t gdb_if_endpoint(void)
+{
+#ifdef ENABLE_BULK_IF
+	if (gdb_if_bulk)
+		return BULK_ENDPOINT;
+#endif
+	return CDCACM_GDB_ENDPOINT;
+}
 
+/* Send what buffer_in holds, with flush a full packet is followed by one that ends the transfer */
+static void gdb_if_send(const bool flush)
+{
+	/* Refuse to send if USB isn't configured, and
+	 * don't bother if nobody's listening */
+	if (usb_get_config() != 1 || !gdb_if_connected()) {
 		count_in = 0;
+		return;
+	}
+	const uint8_t ep = gdb_if_endpoint();
+	while (usbd_ep_write_packet(usbdev, ep, buffer_in, count_in) <= 0)
+		continue;
+	PERF_COUNT(PERF_USB_TX, count_in);
+
+	if (flush && (count_in == CDCACM_PACKET_SIZE)) {
+		/* We need to send an empty packet for some hosts
+		 * to accept this as a complete transfer. */
+		/* libopencm3 needs a change for us to confirm when
+		 * that transfer is complete, so we just send a packet
+		 * containing a null byte for now.
+		 */
+		while (usbd_ep_write_packet(usbdev, ep, "\0", 1) <= 0)
+			continue;
+	}
+
+	count_in = 0;
+}
+
+void gdb_if_putchar(unsigned char c, int flush)
+{
+	buffer_in[count_in++] = c;
+	if (flush || (count_in == CDCACM_PACKET_SIZE))
+		gdb_if_send(flush);
+}
+
+void gdb_if_write(const void *const data, size_t len, const int flush)
+{
+	const uint8_t *bytes = data;
+	while (len) {
+		const size_t chunk = MIN(len, CDCACM_PACKET_SIZE - count_in);
+		memcpy(buffer_in + count_in, bytes, chunk);
+		count_in += chunk;
+		bytes += chunk;
+		len -= chunk;
+		if (count_in == CDCACM_PACKET_SIZE || (flush && !len))
+			gdb_if_send(flush && !len);
 	}
 }
 
@@ -80,14 +133,53 @@ void gdb_usb_out_cb(usbd_device *dev, uint8_t ep)
 }
 #endif
 
+#ifdef ENABLE_BULK_IF
+void gdb_bulk_out_cb(usbd_device *dev, uint8_t ep)
+{
+	const uint8_t head = bulk_head;
+	bulk_count[head] = usbd_ep_read_packet(dev, ep, bulk_buffer_out[head], CDCACM_PACKET_SIZE);
+	if (!bulk_count[head])
+		return;
+	bulk_head = head ^ 1U;
+	/* Hold the host off until the parser frees the other buffer */
+	if (bulk_count[head ^ 1U])
+		usbd_ep_nak_set(dev, ep, 1);
+}
+
+static bool gdb_if_update_bulk(void)
+{
+	bool updated = false;
+	__asm__ volatile("cpsid i; isb");
+	const uint32_t count = bulk_count[bulk_tail];
+	if (count) {
+		memcpy(buffer_out, bulk_buffer_out[bulk_tail], count);
+		count_out = count;
+		PERF_COUNT(PERF_USB_RX, count);
+		out_ptr = 0;
+		bulk_count[bulk_tail] = 0;
+		bulk_tail ^= 1U;
+		usbd_ep_nak_set(usbdev, BULK_ENDPOINT, 0);
+		gdb_if_bulk = true;
+		updated = true;
+	}
+	__asm__ volatile("cpsie i; isb");
+	return updated;
+}
+#endif
+
 static void gdb_if_update_buf(void)
 {
 	while (usb_get_config() != 1);
+#ifdef ENABLE_BULK_IF
+	if (gdb_if_update_bulk())
+		return;
+#endif
 #ifdef STM32F4
 	__asm__ volatile("cpsid i; isb");
 	if (count_new) {
 		memcpy(buffer_out, double_buffer_out, count_new);
 		count_out = count_new;
+		PERF_COUNT(PERF_USB_RX, count_new);
 		count_new = 0;
 		out_ptr = 0;
 		usbd_ep_nak_set(usbdev, CDCACM_GDB_ENDPOINT, 0);
@@ -97,6 +189,11 @@ static void gdb_if_update_buf(void)
 	count_out = usbd_ep_read_packet(usbdev, CDCACM_GDB_ENDPOINT,
 	                                buffer_out, CDCACM_PACKET_SIZE);
 	out_ptr = 0;
+	PERF_COUNT(PERF_USB_RX, count_out);
+#endif
+#ifdef ENABLE_BULK_IF
+	if (out_ptr < count_out)
+		gdb_if_bulk = false;
 #endif
 	if (!count_out)
 		__WFI();
@@ -107,7 +204,7 @@ unsigned char gdb_if_getchar(void)
 
 	while (!(out_ptr < count_out)) {
 		/* Detach if port closed */
-		if (!gdb_serial_get_dtr()) {
+		if (!gdb_if_connected()) {
 			__WFI();
 			return 0x04;
 		}
@@ -118,6 +215,32 @@ unsigned char gdb_if_getchar(void)
 	return buffer_out[out_ptr++];
 }
 
+size_t gdb_if_getspan(const unsigned char **span)
+{
+	static const unsigned char detach = 0x04;
+
+	while (!(out_ptr < count_out)) {
+		/* Detach if port closed */
+		if (!gdb_if_connected()) {
+			__WFI();
+			*span = &detach;
+			return 1;
+		}
+
+		gdb_if_update_buf();
+	}
+
+	/* Hand out the endpoint buffer itself rather than a copy */
+	*span = buffer_out + out_ptr;
+	return count_out - out_ptr;
+}
+
+void gdb_if_consume(size_t count)
+{
+	if (out_ptr < count_out)
+		out_ptr += count;
+}
+
 unsigned char gdb_if_getchar_to(int timeout)
 {
 	platform_timeout t;
@@ -125,7 +248,7 @@ unsigned char gdb_if_getchar_to(int timeout)
 
 	if (!(out_ptr < count_out)) do {
 		/* Detach if port closed */
-			if (!gdb_serial_get_dtr()) {
+			if (!gdb_if_connected()) {
 				__WFI(); /* systick will wake up too!*/
 				return 0x04;
 			}
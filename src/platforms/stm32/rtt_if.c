@@ -30,6 +30,9 @@
 #include "usb_serial.h"
 #include "rtt.h"
 #include "rtt_if.h"
+#include "ring.h"
+
+#include <libopencm3/cm3/nvic.h>
 
 /*********************************************************************
 *
@@ -39,17 +42,14 @@
 */
 
 /* usb uart receive buffer */
-static char recv_buf[RTT_DOWN_BUF_SIZE];
-static uint32_t recv_head = 0;
-static uint32_t recv_tail = 0;
+static char recv_buf[RTT_DOWN_BUF_SIZE] CCM_BSS;
+static ring_s recv_ring = RING_INIT(recv_buf);
+static_assert((sizeof(recv_buf) & (sizeof(recv_buf) - 1U)) == 0, "RTT_DOWN_BUF_SIZE must be a power of 2");
 
 /* data from host to target: number of free bytes in usb receive buffer */
 inline static uint32_t recv_bytes_free()
 {
-	if (recv_tail <= recv_head)
-		return sizeof(recv_buf) - recv_head + recv_tail - 1;
-	else
-		return recv_tail - recv_head - 1;
+	return ring_free(&recv_ring);
 }
 
 /* data from host to target: true if not enough free buffer space and we need to close flow control */
@@ -79,14 +79,8 @@ void debug_serial_receive_callback(usbd_device *dev, uint8_t ep)
 		return;
 	}
 
-	/* copy data to recv_buf */
-	for (int i = 0; i < len; i++) {
-		uint32_t next_recv_head = (recv_head + 1) % sizeof(recv_buf);
-		if (next_recv_head == recv_tail)
-			break; /* overflow */
-		recv_buf[recv_head] = usb_buf[i];
-		recv_head = next_recv_head;
-	}
+	/* copy data to recv_buf, dropping what overflows */
+	ring_write(&recv_ring, usb_buf, len);
 
 	/* block flag: flow control closed if not enough free buffer space */
 	if (!(rtt_flag_block && recv_set_nak()))
@@ -95,40 +89,132 @@ void debug_serial_receive_callback(usbd_device *dev, uint8_t ep)
 	return;
 }
 
+uint32_t rtt_down_put(const char *const data, const uint32_t len)
+{
+	/* the usb uart callback adds to the ring from the interrupt, keep it out meanwhile */
+	nvic_disable_irq(USB_IRQ);
+	const uint32_t written = ring_write(&recv_ring, data, len);
+	nvic_enable_irq(USB_IRQ);
+	return written;
+}
+
 /* rtt host to target: read one character */
-int32_t rtt_getchar()
+int32_t rtt_getchar(const uint32_t channel)
 {
-	int retval;
+	(void)channel;
+	uint8_t c;
 
-	if (recv_head == recv_tail)
+	if (!ring_read(&recv_ring, &c, 1))
 		return -1;
-	retval = recv_buf[recv_tail];
-	recv_tail = (recv_tail + 1) % sizeof(recv_buf);
 
 	/* open flow control if enough free buffer space */
 	if (!recv_set_nak())
 		usbd_ep_nak_set(usbdev, CDCACM_UART_ENDPOINT, 0);
 
-	return retval;
+	return c;
 }
 
 /* rtt host to target: true if no characters available for reading */
-bool rtt_nodata()
+bool rtt_nodata(const uint32_t channel)
 {
-	return recv_head == recv_tail;
+	(void)channel;
+	return !ring_used(&recv_ring);
 }
 
-/* rtt target to host: write string */
-uint32_t rtt_write(const char *buf, uint32_t len)
+/*
+ * rtt target to host: ring of usb packet sized slots. print_rtt() reads target
+ * data directly into a free slot, and the slots are sent from the main loop and
+ * from the endpoint completion interrupt. Packets are kept one byte short of
+ * CDCACM_PACKET_SIZE so no zero length packet is needed, as in debug_serial_ring_send().
+ */
+#define XMIT_SLOT_DATA  (CDCACM_PACKET_SIZE - 1U)
+#define XMIT_SLOT_COUNT ((RTT_UP_BUF_SIZE - 8U) / CDCACM_PACKET_SIZE)
+
+static char xmit_slot[XMIT_SLOT_COUNT][XMIT_SLOT_DATA + 8U] CCM_BSS; /* 8 bytes for alignment and padding */
+static uint8_t xmit_slot_len[XMIT_SLOT_COUNT];
+static volatile uint32_t xmit_head = 0; /* slots filled */
+static volatile uint32_t xmit_tail = 0; /* slots sent */
+static volatile bool xmit_busy = false; /* rtt packet on the endpoint */
+
+static rtt_if_sink_func rtt_sink;
+static void *rtt_sink_ctx;
+
+void rtt_if_set_sink(const rtt_if_sink_func sink, void *const ctx)
 {
-	if (len != 0 && usbdev && usb_get_config() && gdb_serial_get_dtr()) {
-		for (uint32_t p = 0; p < len; p += CDCACM_PACKET_SIZE) {
-			uint32_t plen = MIN(CDCACM_PACKET_SIZE, len - p);
-			while(usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, buf + p, plen) <= 0);
-		}
-		/* flush 64-byte packet on full-speed */
-		if (CDCACM_PACKET_SIZE == 64 && (len % CDCACM_PACKET_SIZE) == 0)
-			usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, NULL, 0);
+	rtt_sink = sink;
+	rtt_sink_ctx = ctx;
+}
+
+static bool rtt_up_connected(void)
+{
+	return usbdev && usb_get_config() && gdb_serial_get_dtr();
+}
+
+/* start sending the next slot, called with the usb interrupt disabled or from it */
+static bool rtt_up_send_next(void)
+{
+	if (xmit_busy)
+		return true;
+	if (xmit_tail == xmit_head)
+		return false;
+	const uint32_t slot = xmit_tail % XMIT_SLOT_COUNT;
+	if (usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, xmit_slot[slot], xmit_slot_len[slot]) == 0)
+		return false; /* endpoint in use by the aux uart, retried on its completion */
+	/* the packet has been copied to the endpoint buffer, so the slot can be reused */
+	++xmit_tail;
+	xmit_busy = true;
+	return true;
+}
+
+bool rtt_up_send_complete(void)
+{
+	xmit_busy = false;
+	return rtt_up_send_next();
+}
+
+char *rtt_up_reserve(const uint32_t channel, uint32_t *len)
+{
+	(void)channel;
+	/* a sink takes the data at once, so all slots make one buffer once the usb uart is done with them */
+	if (rtt_sink) {
+		if (xmit_head != xmit_tail)
+			return NULL;
+		*len = sizeof(xmit_slot) - 8U;
+		return (char *)xmit_slot;
 	}
+	if (xmit_head - xmit_tail >= XMIT_SLOT_COUNT)
+		return NULL;
+	*len = XMIT_SLOT_DATA;
+	return xmit_slot[xmit_head % XMIT_SLOT_COUNT];
+}
+
+uint32_t rtt_up_commit(const uint32_t channel, uint32_t len)
+{
+	if (rtt_sink) {
+		rtt_sink(channel, (const char *)xmit_slot, len, rtt_sink_ctx);
+		return len;
+	}
+	/* data is dropped while no terminal is connected */
+	if (len == 0 || !rtt_up_connected())
+		return 0;
+	xmit_slot_len[xmit_head % XMIT_SLOT_COUNT] = len;
+	nvic_disable_irq(USB_IRQ);
+	++xmit_head;
+	rtt_up_send_next();
+	nvic_enable_irq(USB_IRQ);
 	return len;
 }
+
+char *rtt_up_scratch(uint32_t *len)
+{
+	/* give queued output a moment to drain before it is dropped */
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 100);
+	while (xmit_tail != xmit_head && rtt_up_connected() && !platform_timeout_is_expired(&timeout))
+		continue;
+	nvic_disable_irq(USB_IRQ);
+	xmit_head = xmit_tail;
+	nvic_enable_irq(USB_IRQ);
+	*len = sizeof(xmit_slot);
+	return (char *)xmit_slot;
+}
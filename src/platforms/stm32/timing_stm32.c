@@ -22,6 +22,7 @@
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/dwt.h>
 
 uint8_t running_status;
 static volatile uint32_t time_ms;
@@ -29,8 +30,12 @@ uint32_t swd_delay_cnt = 0;
 
 static int morse_tick;
 
+static void platform_delay_calibrate(void);
+
 void platform_timing_init(void)
 {
+	platform_delay_calibrate();
+
 	/* Setup heartbeat timer */
 	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
 	/* Interrupt us at 10 Hz */
@@ -71,25 +76,70 @@ uint32_t platform_time_ms(void)
  * and  CYCLES_PER_CNT Cycles per delay loop cnt with 2 delay loops per clock
  */
 
-/* Values for STM32F103 at 72 MHz */
+/* Values for STM32F103 at 72 MHz, CYCLES_PER_CNT is measured at boot where DWT allows */
 #define USED_SWD_CYCLES 22
 #define CYCLES_PER_CNT 10
+
+/* Delay loop counts the calibration runs, and how often, keeping the fastest to leave out interrupts */
+#define CALIBRATION_COUNT  256
+#define CALIBRATION_ROUNDS 4U
+
+static uint32_t swd_cycles_per_cnt = CYCLES_PER_CNT;
+
+/* The half clock delay loop of swdptap.c and jtagtap.c */
+static void __attribute__((noinline, optimize(3))) platform_delay_loop(const int32_t count)
+{
+	for (volatile int32_t cnt = count; cnt > 0; cnt--)
+		continue;
+}
+
+static uint32_t platform_delay_loop_cycles(const int32_t count)
+{
+	uint32_t best = UINT32_MAX;
+	for (size_t round = 0; round < CALIBRATION_ROUNDS; ++round) {
+		const uint32_t start = dwt_read_cycle_counter();
+		platform_delay_loop(count);
+		best = MIN(best, dwt_read_cycle_counter() - start);
+	}
+	return best;
+}
+
+/*
+ * What a delay loop count costs depends on the compiler, flash wait states and
+ * prefetch, so measure it with the cycle counter rather than trusting the
+ * figure for one part. Cortex-M0 parts have no cycle counter and keep it.
+ */
+static void platform_delay_calibrate(void)
+{
+	if (!dwt_enable_cycle_counter())
+		return;
+	const uint32_t overhead = platform_delay_loop_cycles(0);
+	const uint32_t loop = platform_delay_loop_cycles(CALIBRATION_COUNT);
+	if (loop <= overhead)
+		return;
+	swd_cycles_per_cnt = MAX((loop - overhead + CALIBRATION_COUNT / 2U) / CALIBRATION_COUNT, 1U);
+}
+
+/* The bit-banging loops spin swd_delay_cnt - 2 times per half clock */
+#define SWD_DELAY_CNT_OFFSET 2U
+
 void platform_max_frequency_set(uint32_t freq)
 {
-	int divisor = rcc_ahb_frequency - USED_SWD_CYCLES * freq;
-	if (divisor < 0) {
+	if (!freq)
+		freq = 1;
+	const uint32_t clock_cycles = rcc_ahb_frequency / freq;
+	if (clock_cycles <= USED_SWD_CYCLES) {
 		swd_delay_cnt = 0;
 		return;
 	}
-	divisor /= 2;
-	swd_delay_cnt = divisor/(CYCLES_PER_CNT * freq);
-	if ((swd_delay_cnt * (CYCLES_PER_CNT * freq)) < (unsigned int)divisor)
-		swd_delay_cnt++;
+	/* Round the count up, so the clock is never faster than asked */
+	const uint32_t delay_per_cnt = 2U * swd_cycles_per_cnt;
+	swd_delay_cnt = (clock_cycles - USED_SWD_CYCLES + delay_per_cnt - 1U) / delay_per_cnt + SWD_DELAY_CNT_OFFSET;
 }
 
+/* The frequency the delay loops actually give, two of them per clock */
 uint32_t platform_max_frequency_get(void)
 {
-	uint32_t ret = rcc_ahb_frequency;
-	ret /= USED_SWD_CYCLES + CYCLES_PER_CNT * swd_delay_cnt;
-	return ret;
+	const uint32_t count = swd_delay_cnt > SWD_DELAY_CNT_OFFSET ? swd_delay_cnt - SWD_DELAY_CNT_OFFSET : 0U;
+	return rcc_ahb_frequency / (USED_SWD_CYCLES + 2U * swd_cycles_per_cnt * count);
 }
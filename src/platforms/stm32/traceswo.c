@@ -34,14 +34,61 @@
 #include "general.h"
 #include "usb.h"
 #include "traceswo.h"
+#include "perf.h"
 
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/stm32/rcc.h>
+#ifdef TRACE_DMA_STREAM
+#include <libopencm3/stm32/dma.h>
+#endif
 
 /* SWO decoding */
 static bool decoding = false;
 
+#ifdef TRACE_DMA_STREAM
+/*
+ * On platforms giving a DMA stream for the CC1 request, every rising edge
+ * moves the CCR1 (cycle) and CCR2 (high time) captures into this ring with a
+ * timer DMA burst. The ring is decoded in batches from the DMA half and full
+ * transfer interrupts, and from the timer update interrupt once the line
+ * goes idle, instead of taking one interrupt per edge.
+ */
+/* TRACE_CAPTURE_PAIRS, the size of the ring, comes from the platform's memory profile */
+/* DMA burst from CCR1 (register 13 from CR1) of 2 registers */
+#define TRACE_DCR_BURST ((1U << 8U) | 13U)
+
+static uint16_t trace_capture[TRACE_CAPTURE_PAIRS * 2U];
+static uint16_t trace_capture_read;
+
+static void traceswo_dma_init(void)
+{
+	rcc_periph_clock_enable(TRACE_DMA_CLK);
+	dma_stream_reset(TRACE_DMA_BUS, TRACE_DMA_STREAM);
+	dma_set_peripheral_address(TRACE_DMA_BUS, TRACE_DMA_STREAM, (uintptr_t)&TIM_DMAR(TRACE_TIM));
+	dma_set_memory_address(TRACE_DMA_BUS, TRACE_DMA_STREAM, (uintptr_t)trace_capture);
+	dma_set_number_of_data(TRACE_DMA_BUS, TRACE_DMA_STREAM, ARRAY_LENGTH(trace_capture));
+	dma_set_transfer_mode(TRACE_DMA_BUS, TRACE_DMA_STREAM, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+	dma_channel_select(TRACE_DMA_BUS, TRACE_DMA_STREAM, TRACE_DMA_TRG);
+	dma_enable_memory_increment_mode(TRACE_DMA_BUS, TRACE_DMA_STREAM);
+	dma_set_peripheral_size(TRACE_DMA_BUS, TRACE_DMA_STREAM, DMA_SxCR_PSIZE_16BIT);
+	dma_set_memory_size(TRACE_DMA_BUS, TRACE_DMA_STREAM, DMA_SxCR_MSIZE_16BIT);
+	dma_set_priority(TRACE_DMA_BUS, TRACE_DMA_STREAM, DMA_SxCR_PL_VERY_HIGH);
+	dma_enable_direct_mode(TRACE_DMA_BUS, TRACE_DMA_STREAM);
+	dma_enable_circular_mode(TRACE_DMA_BUS, TRACE_DMA_STREAM);
+	dma_enable_half_transfer_interrupt(TRACE_DMA_BUS, TRACE_DMA_STREAM);
+	dma_enable_transfer_complete_interrupt(TRACE_DMA_BUS, TRACE_DMA_STREAM);
+	trace_capture_read = 0;
+
+	nvic_set_priority(TRACE_DMA_IRQ, IRQ_PRI_TRACE);
+	nvic_enable_irq(TRACE_DMA_IRQ);
+	dma_enable_stream(TRACE_DMA_BUS, TRACE_DMA_STREAM);
+
+	TIM_DCR(TRACE_TIM) = TRACE_DCR_BURST;
+	timer_enable_irq(TRACE_TIM, TIM_DIER_CC1DE);
+}
+#endif
+
 void traceswo_init(uint32_t swo_chan_bitmask)
 {
 	TRACE_TIM_CLK_EN();
@@ -66,10 +113,17 @@ void traceswo_init(uint32_t swo_chan_bitmask)
 	/* Slave reset mode: reset counter on trigger */
 	timer_slave_set_mode(TRACE_TIM, TIM_SMCR_SMS_RM);
 
-	/* Enable capture interrupt */
 	nvic_set_priority(TRACE_IRQ, IRQ_PRI_TRACE);
 	nvic_enable_irq(TRACE_IRQ);
+#ifdef TRACE_DMA_STREAM
+	/* Captures go to memory by DMA, the update interrupt flags the end of a frame */
+	traceswo_dma_init();
+	timer_clear_flag(TRACE_TIM, TIM_SR_UIF);
+	timer_enable_irq(TRACE_TIM, TIM_DIER_UIE);
+#else
+	/* Enable capture interrupt */
 	timer_enable_irq(TRACE_TIM, TIM_DIER_CC1IE);
+#endif
 
 	/* Enable the capture channels */
 	timer_ic_enable(TRACE_TIM, TIM_IC1);
@@ -86,6 +140,7 @@ static uint8_t trace_usb_buf_size;
 
 void trace_buf_push(uint8_t *buf, int len)
 {
+	PERF_COUNT(PERF_SWO_BYTES, len);
 	if (decoding)
 		traceswo_decode(usbdev, CDCACM_UART_ENDPOINT, buf, len);
 	else if (usbd_ep_write_packet(usbdev, USB_REQ_TYPE_IN | TRACE_ENDPOINT, buf, len) != len) {
@@ -114,32 +169,37 @@ void trace_buf_drain(usbd_device *dev, uint8_t ep)
 
 #define ALLOWED_DUTY_ERROR 5
 
-void TRACE_ISR(void)
-{
-	uint16_t sr = TIM_SR(TRACE_TIM);
-	uint16_t duty, cycle;
-	static uint16_t bt;
-	static uint8_t lastbit;
-	static uint8_t decbuf[17];
-	static uint8_t decbuf_pos;
-	static uint8_t halfbit;
-	static uint8_t notstart;
-
-	/* Reset decoder state if capture overflowed */
-	if (sr & (TIM_SR_CC1OF | TIM_SR_UIF)) {
-		timer_clear_flag(TRACE_TIM, TIM_SR_CC1OF | TIM_SR_UIF);
-		if (!(sr & (TIM_SR_CC2IF | TIM_SR_CC1IF)))
-			goto flush_and_reset;
-	}
+/* Manchester decoder state */
+static uint16_t bt;
+static uint8_t lastbit;
+static uint8_t decbuf[17];
+static uint8_t decbuf_pos;
+static uint8_t halfbit;
+static uint8_t notstart;
 
-	cycle = TIM_CCR1(TRACE_TIM);
-	duty = TIM_CCR2(TRACE_TIM);
+static void traceswo_flush_and_reset(void)
+{
+	timer_set_period(TRACE_TIM, -1);
+#ifndef TRACE_DMA_STREAM
+	timer_disable_irq(TRACE_TIM, TIM_DIER_UIE);
+#endif
+	trace_buf_push(decbuf, decbuf_pos >> 3);
+	bt = 0;
+	decbuf_pos = 0;
+	memset(decbuf, 0, sizeof(decbuf));
+}
 
+/* Decode one capture: cycle and high time of a period ended by a rising edge,
+   or only the high time when the line went idle after a falling edge */
+static void traceswo_decode_capture(const uint16_t cycle, uint16_t duty, const bool rising)
+{
 	/* Reset decoder state if crazy shit happened */
-	if ((bt && (((duty / bt) > 2) || ((duty / bt) == 0))) || (duty == 0))
-		goto flush_and_reset;
+	if ((bt && (((duty / bt) > 2) || ((duty / bt) == 0))) || (duty == 0)) {
+		traceswo_flush_and_reset();
+		return;
+	}
 
-	if(!(sr & TIM_SR_CC1IF)) notstart = 1;
+	if (!rising) notstart = 1;
 
 	if (!bt) {
 		if (notstart) {
@@ -160,8 +220,10 @@ void TRACE_ISR(void)
 	} else {
 		/* If high time is extended we need to flip the bit */
 		if ((duty / bt) > 1) {
-			if (!halfbit) /* lost sync somehow */
-				goto flush_and_reset;
+			if (!halfbit) { /* lost sync somehow */
+				traceswo_flush_and_reset();
+				return;
+			}
 			halfbit = 0;
 			lastbit ^= 1;
 		}
@@ -169,27 +231,75 @@ void TRACE_ISR(void)
 		decbuf_pos++;
 	}
 
-	if (!(sr & TIM_SR_CC1IF) || (((cycle - duty) / bt) > 2))
-		goto flush_and_reset;
+	if (!rising || (((cycle - duty) / bt) > 2)) {
+		traceswo_flush_and_reset();
+		return;
+	}
 
 	if (((cycle - duty) / bt) > 1) {
 		/* If low time extended we need to pack another bit. */
-		if (halfbit) /* this is a valid stop-bit or we lost sync */
-			goto flush_and_reset;
+		if (halfbit) { /* this is a valid stop-bit or we lost sync */
+			traceswo_flush_and_reset();
+			return;
+		}
 		halfbit = 1;
 		lastbit ^= 1;
 		decbuf[decbuf_pos >> 3] |= lastbit << (decbuf_pos & 7);
 		decbuf_pos++;
 	}
 
-	if (decbuf_pos < 128)
+	if (decbuf_pos >= 128)
+		traceswo_flush_and_reset();
+}
+
+#ifdef TRACE_DMA_STREAM
+/* Decode the captures the DMA has written since the last call */
+static void traceswo_dma_drain(void)
+{
+	const uint16_t write =
+		(ARRAY_LENGTH(trace_capture) - dma_get_number_of_data(TRACE_DMA_BUS, TRACE_DMA_STREAM)) & ~1U;
+	while (trace_capture_read != write % ARRAY_LENGTH(trace_capture)) {
+		traceswo_decode_capture(trace_capture[trace_capture_read], trace_capture[trace_capture_read + 1U], true);
+		trace_capture_read = (trace_capture_read + 2U) % ARRAY_LENGTH(trace_capture);
+	}
+}
+
+void TRACE_DMA_ISR(void)
+{
+	dma_clear_interrupt_flags(TRACE_DMA_BUS, TRACE_DMA_STREAM, DMA_ISR_FLAGS);
+	traceswo_dma_drain();
+}
+
+void TRACE_ISR(void)
+{
+	const uint16_t sr = TIM_SR(TRACE_TIM);
+	timer_clear_flag(TRACE_TIM, TIM_SR_UIF | TIM_SR_CC1OF);
+
+	/* No rising edge for a while, decode what is left of the frame */
+	traceswo_dma_drain();
+	if (!bt && !decbuf_pos)
 		return;
+	if (sr & TIM_SR_CC2IF)
+		traceswo_decode_capture(TIM_CCR1(TRACE_TIM), TIM_CCR2(TRACE_TIM), false);
+	else
+		traceswo_flush_and_reset();
+}
+#else
+void TRACE_ISR(void)
+{
+	uint16_t sr = TIM_SR(TRACE_TIM);
 
-flush_and_reset:
-	timer_set_period(TRACE_TIM, -1);
-	timer_disable_irq(TRACE_TIM, TIM_DIER_UIE);
-	trace_buf_push(decbuf, decbuf_pos >> 3);
-	bt = 0;
-	decbuf_pos = 0;
-	memset(decbuf, 0, sizeof(decbuf));
+	/* Reset decoder state if capture overflowed */
+	if (sr & (TIM_SR_CC1OF | TIM_SR_UIF)) {
+		timer_clear_flag(TRACE_TIM, TIM_SR_CC1OF | TIM_SR_UIF);
+		if (!(sr & (TIM_SR_CC2IF | TIM_SR_CC1IF))) {
+			traceswo_flush_and_reset();
+			return;
+		}
+	}
+
+	const uint16_t cycle = TIM_CCR1(TRACE_TIM);
+	const uint16_t duty = TIM_CCR2(TRACE_TIM);
+	traceswo_decode_capture(cycle, duty, sr & TIM_SR_CC1IF);
 }
+#endif
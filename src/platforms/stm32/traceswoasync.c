@@ -31,7 +31,10 @@
 #include "general.h"
 #include "usb.h"
 #include "traceswo.h"
+#include "perf.h"
+#include "ring.h"
 
+#include <assert.h>
 #include <libopencmsis/core_cm3.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/timer.h>
@@ -42,36 +45,76 @@
 /* For speed this is set to the USB transfer size */
 #define FULL_SWO_PACKET	(64)
 
-static volatile uint32_t w;	/* Packet currently received via UART */
-static volatile uint32_t r;	/* Packet currently waiting to transmit to USB */
-/* Packets arrived from the SWO interface */
+/* NUM_TRACE_PACKETS, the size of the buffer, comes from the platform's memory profile */
+
+/* Packets arrived from the SWO interface, filled from the DMA interrupt and sent from the drain */
 static uint8_t trace_rx_buf[NUM_TRACE_PACKETS * FULL_SWO_PACKET];
+static ring_s trace_ring = RING_INIT(trace_rx_buf);
+static_assert((NUM_TRACE_PACKETS & (NUM_TRACE_PACKETS - 1U)) == 0, "NUM_TRACE_PACKETS must be a power of 2");
 /* Packet pingpong buffer used for receiving packets */
 static uint8_t pingpong_buf[2 * FULL_SWO_PACKET];
 /* SWO decoding */
 static bool decoding = false;
+/* Packets dropped since the last overflow marker was queued */
+static volatile uint32_t lost;
+
+/*
+ * Marker queued in place of lost data once there is room again: an ITM
+ * overflow packet followed by a synchronisation packet, so host tools see
+ * the gap and can resynchronise. Decoded streams count the loss only.
+ */
+static void trace_queue_overflow_marker(void)
+{
+	/* Packets are only ever queued whole, so there is a whole packet's span at the head */
+	uint32_t len;
+	uint8_t *const packet = ring_write_span(&trace_ring, &len);
+	memset(packet, 0, FULL_SWO_PACKET);
+	packet[0] = 0x70;
+	packet[FULL_SWO_PACKET - 1] = 0x80;
+	ring_write_commit(&trace_ring, FULL_SWO_PACKET);
+}
+
+/* Queue one packet from the DMA buffer, accounting for it if the ring is full */
+static void trace_queue_packet(const uint8_t *const packet)
+{
+	/* Keep room for the overflow marker */
+	if (ring_free(&trace_ring) < 2U * FULL_SWO_PACKET) {
+		++lost;
+		++traceswo_stats.lost_packets;
+		return;
+	}
+	if (lost) {
+		if (!decoding)
+			trace_queue_overflow_marker();
+		lost = 0;
+	}
+	ring_write(&trace_ring, packet, FULL_SWO_PACKET);
+	PERF_COUNT(PERF_SWO_BYTES, FULL_SWO_PACKET);
+}
 
 void trace_buf_drain(usbd_device *dev, uint8_t ep)
 {
 	static volatile char inBufDrain;
 
-	/* If we are already in this routine then we don't need to come in again */
+	/*
+	 * Both the DMA and the USB interrupt drain, and may preempt each other.
+	 * The ring takes one consumer, so only one of them comes in at a time.
+	 */
 	if (__atomic_test_and_set (&inBufDrain, __ATOMIC_RELAXED))
 		return;
-	/* Attempt to write everything we buffered */
-	if (w != r) {
+	/* Send the next packet straight from the ring */
+	uint32_t len;
+	const uint8_t *const packet = ring_read_span(&trace_ring, &len);
+	if (len >= FULL_SWO_PACKET) {
 		uint16_t rc;
 		if (decoding)
 			/* write decoded swo packets to the uart port */
-			rc = traceswo_decode(dev, CDCACM_UART_ENDPOINT,
-										  &trace_rx_buf[r * FULL_SWO_PACKET],
-										  FULL_SWO_PACKET);
+			rc = traceswo_decode(dev, CDCACM_UART_ENDPOINT, packet, FULL_SWO_PACKET);
 		else
 			/* write raw swo packets to the trace port */
-			rc = usbd_ep_write_packet(dev, ep,
-										  &trace_rx_buf[r * FULL_SWO_PACKET],
-										  FULL_SWO_PACKET);
-		if (rc) r = (r + 1) % NUM_TRACE_PACKETS;
+			rc = usbd_ep_write_packet(dev, ep, packet, FULL_SWO_PACKET);
+		if (rc)
+			ring_read_commit(&trace_ring, FULL_SWO_PACKET);
 	}
 	__atomic_clear (&inBufDrain, __ATOMIC_RELAXED);
 }
@@ -102,7 +145,8 @@ void traceswo_setspeed(uint32_t baudrate)
 
 	usart_enable(SWO_UART);
 	nvic_enable_irq(SWO_DMA_IRQ);
-	w = r = 0;
+	ring_reset(&trace_ring);
+	lost = 0;
 	dma_set_memory_address(SWO_DMA_BUS, SWO_DMA_CHAN, (uint32_t)pingpong_buf);
 	dma_set_number_of_data(SWO_DMA_BUS, SWO_DMA_CHAN, 2 * FULL_SWO_PACKET);
 	dma_enable_channel(SWO_DMA_BUS, SWO_DMA_CHAN);
@@ -113,15 +157,12 @@ void SWO_DMA_ISR(void)
 {
 	if (DMA_ISR(SWO_DMA_BUS) & DMA_ISR_HTIF(SWO_DMA_CHAN)) {
 		DMA_IFCR(SWO_DMA_BUS) |= DMA_ISR_HTIF(SWO_DMA_CHAN);
-		memcpy(&trace_rx_buf[w * FULL_SWO_PACKET], pingpong_buf,
-			   FULL_SWO_PACKET);
+		trace_queue_packet(pingpong_buf);
 	}
 	if (DMA_ISR(SWO_DMA_BUS) & DMA_ISR_TCIF(SWO_DMA_CHAN)) {
 		DMA_IFCR(SWO_DMA_BUS) |= DMA_ISR_TCIF(SWO_DMA_CHAN);
-		memcpy(&trace_rx_buf[w * FULL_SWO_PACKET],
-			   &pingpong_buf[FULL_SWO_PACKET], FULL_SWO_PACKET);
+		trace_queue_packet(&pingpong_buf[FULL_SWO_PACKET]);
 	}
-	w = (w + 1) % NUM_TRACE_PACKETS;
 	trace_buf_drain(usbdev, 0x85);
 }
 
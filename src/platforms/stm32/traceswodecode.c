@@ -16,50 +16,425 @@
  * along with this program.	 If not, see <http://www.gnu.org/licenses/>.
  */
 
-/* Print decoded swo stream on the usb serial */
+/*
+ * Decode the ITM/DWT packet stream, as described in ARM DDI 0403E
+ * appendix D4 "Debug ITM and DWT Packet Protocol".
+ *
+ * Stimulus port data of the selected channels is printed on the usb serial,
+ * or in hosted builds handed to traceswo_decode_output(), PC samples are counted into a histogram and all other packets into
+ * traceswo_stats, for 'mon swo_stats' to report.
+ *
+ * Exception trace is timed with the local timestamps into per exception
+ * statistics for 'mon isrstats'. A local timestamp follows the packets it
+ * stamps, so exception events wait for the next one to learn their time.
+ */
 
 #include "general.h"
+#if PC_HOSTED == 0
 #include "usb_serial.h"
+#endif
 #include "traceswo.h"
 
 /* SWO decoding */
 /* data is static in case swo packet is astride two buffers */
-static uint8_t swo_buf[CDCACM_PACKET_SIZE];
+#if PC_HOSTED == 0
+static uint8_t swo_buf[CDCACM_PACKET_SIZE] CCM_BSS;
+static usbd_device *swo_usbd_dev;
+static uint8_t swo_usbd_addr;
+#else
+static uint8_t swo_buf[64] CCM_BSS;
+#endif
 static int swo_buf_len = 0;
 static uint32_t swo_decode = 0; /* bitmask of channels to print */
-static int swo_pkt_len = 0; /* decoder state */
 static bool swo_print = false;
 
-/* print decoded swo packet on usb serial */
-uint16_t traceswo_decode(usbd_device *usbd_dev, uint8_t addr,
-				const void *buf, uint16_t len) {
-	if (usbd_dev == NULL) return 0;
+traceswo_stats_s traceswo_stats;
+
+/* decoder state */
+typedef enum swo_state {
+	SWO_HEADER,       /* waiting for a packet header */
+	SWO_PAYLOAD,      /* source packet payload */
+	SWO_CONTINUATION, /* timestamp or extension continuation bytes */
+} swo_state_e;
+
+static swo_state_e swo_state = SWO_HEADER;
+static uint8_t swo_header;
+static uint8_t swo_pkt_len;  /* payload bytes of a source packet */
+static uint8_t swo_pkt_pos;  /* payload or continuation bytes received */
+static uint32_t swo_value;   /* packet value assembled so far */
+static uint8_t swo_zeros;    /* zero bytes seen towards a synchronisation packet */
+
+/* PC sample histogram, open addressing on the sampled PC */
+#define SWO_PC_BUCKETS 128U
+#define SWO_PC_PROBES  8U
+
+static traceswo_pc_count_s swo_pc_hist[SWO_PC_BUCKETS];
+
+static void swo_pc_sample(const uint32_t pc)
+{
+	++traceswo_stats.pc_samples;
+	uint32_t bucket = ((pc >> 1U) * 2654435761U) >> 25U;
+	for (size_t i = 0; i < SWO_PC_PROBES; ++i, bucket = (bucket + 1U) % SWO_PC_BUCKETS) {
+		traceswo_pc_count_s *const entry = &swo_pc_hist[bucket];
+		if (entry->count == 0)
+			entry->pc = pc;
+		if (entry->pc == pc) {
+			++entry->count;
+			return;
+		}
+	}
+	++traceswo_stats.pc_other;
+}
+
+/* Exception trace timing */
+#define SWO_ISR_SLOTS   24U
+#define SWO_ISR_DEPTH   8U
+#define SWO_ISR_PENDING 8U
+
+#define SWO_EXC_ENTRY  1U
+#define SWO_EXC_EXIT   2U
+#define SWO_EXC_RETURN 3U
+
+typedef struct swo_isr_active {
+	uint16_t exception;
+	uint32_t entry_time;
+	uint32_t preempted;       /* ticks spent preempted so far */
+	uint32_t preempted_since; /* time it was preempted at, while preempted */
+	bool is_preempted;
+} swo_isr_active_s;
+
+typedef struct swo_exc_event {
+	uint16_t exception;
+	uint8_t function;
+} swo_exc_event_s;
+
+static traceswo_isr_stats_s swo_isr[SWO_ISR_SLOTS];
+static size_t swo_isr_used;
+static swo_isr_active_s swo_isr_stack[SWO_ISR_DEPTH];
+static size_t swo_isr_depth;
+static swo_exc_event_s swo_exc_pending[SWO_ISR_PENDING];
+static size_t swo_exc_pending_count;
+static uint32_t swo_time; /* sum of the local timestamp deltas */
+
+static traceswo_isr_stats_s *swo_isr_slot(const uint16_t exception)
+{
+	for (size_t i = 0; i < swo_isr_used; ++i) {
+		if (swo_isr[i].exception == exception)
+			return &swo_isr[i];
+	}
+	if (swo_isr_used == SWO_ISR_SLOTS)
+		return NULL;
+	traceswo_isr_stats_s *const slot = &swo_isr[swo_isr_used++];
+	memset(slot, 0, sizeof(*slot));
+	slot->exception = exception;
+	slot->min_ticks = UINT32_MAX;
+	return slot;
+}
+
+static void swo_isr_entry(const uint16_t exception)
+{
+	if (swo_isr_depth) {
+		swo_isr_active_s *const outer = &swo_isr_stack[swo_isr_depth - 1U];
+		if (!outer->is_preempted) {
+			outer->is_preempted = true;
+			outer->preempted_since = swo_time;
+		}
+	}
+	if (swo_isr_depth == SWO_ISR_DEPTH)
+		return;
+	swo_isr_active_s *const active = &swo_isr_stack[swo_isr_depth++];
+	active->exception = exception;
+	active->entry_time = swo_time;
+	active->preempted = 0;
+	active->is_preempted = false;
+	traceswo_isr_stats_s *const slot = swo_isr_slot(exception);
+	if (slot && swo_isr_depth > slot->max_depth)
+		slot->max_depth = swo_isr_depth;
+}
+
+static void swo_isr_exit(const uint16_t exception)
+{
+	/* Unwind to the exception, anything above it lost its exit */
+	size_t level = swo_isr_depth;
+	while (level && swo_isr_stack[level - 1U].exception != exception)
+		--level;
+	if (!level) {
+		++traceswo_stats.isr_unmatched;
+		return;
+	}
+	swo_isr_depth = level - 1U;
+	const swo_isr_active_s *const active = &swo_isr_stack[swo_isr_depth];
+	traceswo_isr_stats_s *const slot = swo_isr_slot(exception);
+	if (!slot)
+		return;
+	const uint32_t ticks = swo_time - active->entry_time;
+	++slot->count;
+	slot->total_ticks += ticks;
+	slot->min_ticks = MIN(slot->min_ticks, ticks);
+	slot->max_ticks = MAX(slot->max_ticks, ticks);
+	slot->max_preempted = MAX(slot->max_preempted, active->preempted);
+}
+
+/* returned to exception, 0 for thread mode: the one preempted resumes */
+static void swo_isr_return(const uint16_t exception)
+{
+	if (!exception) {
+		/* Nothing is active in thread mode, a leftover lost its exit */
+		swo_isr_depth = 0;
+		return;
+	}
+	if (!swo_isr_depth)
+		return;
+	swo_isr_active_s *const active = &swo_isr_stack[swo_isr_depth - 1U];
+	if (active->exception == exception && active->is_preempted) {
+		active->preempted += swo_time - active->preempted_since;
+		active->is_preempted = false;
+	}
+}
+
+static void swo_exc_apply(const swo_exc_event_s *const event)
+{
+	switch (event->function) {
+	case SWO_EXC_ENTRY:
+		swo_isr_entry(event->exception);
+		break;
+	case SWO_EXC_EXIT:
+		swo_isr_exit(event->exception);
+		break;
+	case SWO_EXC_RETURN:
+		swo_isr_return(event->exception);
+		break;
+	default:
+		break;
+	}
+}
+
+/* local timestamp: the events since the last one happened delta ticks after it */
+static void swo_timestamp(const uint32_t delta)
+{
+	swo_time += delta;
+	for (size_t i = 0; i < swo_exc_pending_count; ++i)
+		swo_exc_apply(&swo_exc_pending[i]);
+	swo_exc_pending_count = 0;
+}
+
+static void swo_exception(const uint16_t exception, const uint8_t function)
+{
+	/* Without timestamps events keep coming, the oldest are timed as they stand */
+	if (swo_exc_pending_count == SWO_ISR_PENDING)
+		swo_timestamp(0);
+	swo_exc_pending[swo_exc_pending_count].exception = exception;
+	swo_exc_pending[swo_exc_pending_count].function = function;
+	++swo_exc_pending_count;
+}
+
+/* the trace lost packets, no telling which exceptions are still active */
+static void swo_isr_overflow(void)
+{
+	swo_exc_pending_count = 0;
+	swo_isr_depth = 0;
+}
+
+size_t traceswo_isr_stats(const traceswo_isr_stats_s **const stats)
+{
+	*stats = swo_isr;
+	return swo_isr_used;
+}
+
+static void swo_buf_flush(void)
+{
+#if PC_HOSTED == 0
+	if (usb_get_config() && gdb_serial_get_dtr()) /* silently drop if usb not ready */
+		usbd_ep_write_packet(swo_usbd_dev, swo_usbd_addr, swo_buf, swo_buf_len);
+#else
+	traceswo_decode_output(swo_buf, swo_buf_len);
+#endif
+	swo_buf_len = 0;
+}
+
+/* stimulus port data byte: print on usb serial if the channel is selected */
+static void swo_stimulus(const uint8_t ch)
+{
+	if (!swo_print)
+		return;
+	swo_buf[swo_buf_len++] = ch;
+	if (swo_buf_len == sizeof(swo_buf))
+		swo_buf_flush();
+}
+
+/* complete DWT hardware source packet */
+static void swo_hardware(const uint8_t discriminator, const uint32_t value)
+{
+	switch (discriminator) {
+	case 0: /* event counter wrap */
+		++traceswo_stats.events;
+		break;
+	case 1: /* exception trace, function in bits 13:12 */
+		swo_exception(value & 0x1ffU, (value >> 12U) & 3U);
+		switch ((value >> 12U) & 3U) {
+		case 1:
+			++traceswo_stats.exception_entries;
+			break;
+		case 2:
+			++traceswo_stats.exception_exits;
+			break;
+		case 3:
+			++traceswo_stats.exception_returns;
+			break;
+		default:
+			break;
+		}
+		break;
+	case 2: /* periodic PC sample, a single byte packet when the core is sleeping */
+		if (swo_pkt_len == 4)
+			swo_pc_sample(value);
+		else
+			++traceswo_stats.sleep_samples;
+		break;
+	default:
+		if (discriminator >= 8 && discriminator < 24) /* data trace: PC value, address offset, data value */
+			++traceswo_stats.data_trace;
+		break;
+	}
+}
+
+static void swo_header_byte(const uint8_t ch)
+{
+	/* synchronisation: at least 47 zero bits followed by a one */
+	if (ch == 0x00) {
+		++swo_zeros;
+		return;
+	}
+	if (ch == 0x80 && swo_zeros >= 5U) {
+		swo_zeros = 0;
+		++traceswo_stats.syncs;
+		return;
+	}
+	swo_zeros = 0;
+
+	swo_header = ch;
+	swo_value = 0;
+	swo_pkt_pos = 0;
+	if (ch == 0x70) { /* overflow */
+		++traceswo_stats.overflows;
+		swo_isr_overflow();
+	} else if ((ch & 0x0fU) == 0) {
+		/* local timestamp, format 2 carries the value in the header */
+		++traceswo_stats.timestamps;
+		if (ch & 0x80U)
+			swo_state = SWO_CONTINUATION;
+		else
+			swo_timestamp((ch >> 4U) & 7U);
+	} else if (ch == 0x94 || ch == 0xb4) {
+		/* global timestamp */
+		++traceswo_stats.timestamps;
+		swo_state = SWO_CONTINUATION;
+	} else if ((ch & 0x0bU) == 0x08) {
+		/* extension */
+		++traceswo_stats.extensions;
+		if (ch & 0x80U)
+			swo_state = SWO_CONTINUATION;
+	} else if (ch & 0x03U) {
+		/* source packet, software (stimulus port) or hardware (DWT) */
+		const uint32_t size = ch & 0x03U;
+		swo_pkt_len = size == 3U ? 4U : size;
+		if (ch & 0x04U)
+			swo_print = false;
+		else {
+			++traceswo_stats.stimulus;
+			swo_print = (swo_decode & (1UL << (ch >> 3U))) != 0UL;
+		}
+		swo_state = SWO_PAYLOAD;
+	}
+	/* anything else is reserved, skip it and look for the next header */
+}
+
+static void swo_decode_bytes(const void *buf, uint16_t len)
+{
 	for (int i = 0; i<len; i++) {
-		uint8_t ch=((uint8_t*)buf)[i];
-		if (swo_pkt_len == 0) { /* header */
-			uint32_t channel = (uint32_t)ch >> 3; /* channel number */
-			uint32_t size = ch & 0x7; /* drop channel number */
-			if (size == 0x01) swo_pkt_len = 1;      /* SWO packet 0x01XX */
-			else if (size == 0x02) swo_pkt_len = 2; /* SWO packet 0x02XXXX */
-			else if (size == 0x03) swo_pkt_len = 4; /* SWO packet 0x03XXXXXXXX */
-			swo_print = (swo_pkt_len != 0) && ((swo_decode & (1UL << channel)) != 0UL);
-		} else if (swo_pkt_len <= 4) { /* data */
-			if (swo_print) {
-				swo_buf[swo_buf_len++]=ch;
-				if (swo_buf_len == sizeof(swo_buf)) {
-					if (usb_get_config() && gdb_serial_get_dtr()) /* silently drop if usb not ready */
-						usbd_ep_write_packet(usbd_dev, addr, swo_buf, swo_buf_len);
-					swo_buf_len=0;
-				}
+		const uint8_t ch = ((uint8_t *)buf)[i];
+		switch (swo_state) {
+		case SWO_HEADER:
+			swo_header_byte(ch);
+			break;
+		case SWO_PAYLOAD:
+			swo_value |= (uint32_t)ch << (8U * swo_pkt_pos);
+			if (!(swo_header & 0x04U))
+				swo_stimulus(ch);
+			if (++swo_pkt_pos == swo_pkt_len) {
+				if (swo_header & 0x04U)
+					swo_hardware(swo_header >> 3U, swo_value);
+				swo_state = SWO_HEADER;
+			}
+			break;
+		case SWO_CONTINUATION:
+			/* at most 7 continuation bytes, the largest being a global timestamp 2 */
+			if (++swo_pkt_pos < 7U)
+				swo_value |= (uint32_t)(ch & 0x7fU) << (7U * (swo_pkt_pos - 1U));
+			if (!(ch & 0x80U) || swo_pkt_pos == 7U) {
+				if (swo_header == 0x94)
+					traceswo_stats.global_timestamp = swo_value;
+				else if ((swo_header & 0xcfU) == 0xc0U) /* local timestamp, format 1 */
+					swo_timestamp(swo_value);
+				swo_state = SWO_HEADER;
 			}
-			--swo_pkt_len;
-		} else { /* recover */
-			swo_buf_len=0;
-			swo_pkt_len=0;
+			break;
 		}
 	}
+}
+
+#if PC_HOSTED == 0
+/* decode swo packets, printing stimulus data on usb serial */
+uint16_t traceswo_decode(usbd_device *usbd_dev, uint8_t addr,
+				const void *buf, uint16_t len) {
+	if (usbd_dev == NULL) return 0;
+	swo_usbd_dev = usbd_dev;
+	swo_usbd_addr = addr;
+	swo_decode_bytes(buf, len);
+	return len;
+}
+#else
+/* decode swo packets, stimulus data is passed on at the end of every buffer */
+uint16_t traceswo_decode(const void *buf, uint16_t len)
+{
+	swo_decode_bytes(buf, len);
+	if (swo_buf_len)
+		swo_buf_flush();
 	return len;
 }
+#endif
+
+/* copy the most sampled PCs, highest count first, return how many were copied */
+size_t traceswo_pc_histogram(traceswo_pc_count_s *const top, const size_t count)
+{
+	size_t found = 0;
+	for (; found < count; ++found) {
+		const traceswo_pc_count_s *best = NULL;
+		for (size_t i = 0; i < SWO_PC_BUCKETS; ++i) {
+			const traceswo_pc_count_s *const entry = &swo_pc_hist[i];
+			if (!entry->count || (best && entry->count <= best->count))
+				continue;
+			/* skip entries already reported */
+			bool reported = false;
+			for (size_t j = 0; j < found && !reported; ++j)
+				reported = top[j].pc == entry->pc;
+			if (!reported)
+				best = entry;
+		}
+		if (!best)
+			break;
+		top[found] = *best;
+	}
+	return found;
+}
+
+void traceswo_stats_clear(void)
+{
+	memset(&traceswo_stats, 0, sizeof(traceswo_stats));
+	memset(swo_pc_hist, 0, sizeof(swo_pc_hist));
+	swo_isr_used = 0;
+	swo_isr_overflow();
+}
 
 /* set bitmask of swo channels to be decoded */
 void traceswo_setmask(uint32_t mask) {
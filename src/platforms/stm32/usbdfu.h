@@ -25,6 +25,20 @@
 /* Commands sent with wBlockNum == 0 as per ST implementation. */
 #define CMD_SETADDR	0x21
 #define CMD_ERASE	0x41
+
+/*
+ * An upload with wBlockNum == 1, unused by ST, returns the erase units from
+ * the address set: pairs of little endian size and CRC-32 of their contents,
+ * so an upgrade can leave the unchanged ones alone.
+ */
+#define DFU_CRC_TABLE_BLOCK 1
+
+/* The F4 and F7 have the RAM for larger blocks */
+#if defined(STM32F4) || defined(STM32F7)
+#define DFU_TRANSFER_SIZE 4096
+#else
+#define DFU_TRANSFER_SIZE 1024
+#endif
 extern uint32_t app_address;
 
 /* dfucore.c - DFU core, common to libopencm3 platforms. */
@@ -33,6 +47,8 @@ void dfu_main(void);
 
 /* Device specific functions */
 void dfu_check_and_do_sector_erase(uint32_t sector);
+/* End of the erase unit, page or sector, that addr is in */
+uint32_t dfu_erase_unit_end(uint32_t addr);
 void dfu_flash_program_buffer(uint32_t baseaddr, void *buf, int len);
 uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum);
 void dfu_protect(bool enable);
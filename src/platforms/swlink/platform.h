@@ -59,7 +59,6 @@ extern bool debug_bmp;
 #define LED_UART	GPIO14
 
 #define PLATFORM_HAS_TRACESWO	1
-#define NUM_TRACE_PACKETS		(128)		/* This is an 8K buffer */
 #define TRACESWO_PROTOCOL		2			/* 1 = Manchester, 2 = NRZ / async */
 
 # define SWD_CR   GPIO_CRH(SWDIO_PORT)
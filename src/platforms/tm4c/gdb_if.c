@@ -50,6 +50,13 @@ void gdb_if_putchar(unsigned char c, int flush)
 	}
 }
 
+void gdb_if_write(const void *const data, const size_t len, const int flush)
+{
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < len; ++i)
+		gdb_if_putchar(bytes[i], flush && i + 1U == len);
+}
+
 void gdb_usb_out_cb(usbd_device *dev, uint8_t ep)
 {
 	(void)ep;
@@ -78,6 +85,36 @@ unsigned char gdb_if_getchar(void)
 	return buffer_out[tail_out++ % sizeof(buffer_out)];
 }
 
+size_t gdb_if_getspan(const unsigned char **span)
+{
+	static const unsigned char detach = 0x04;
+
+	while (tail_out == head_out) {
+		/* Detach if port closed */
+		if (!gdb_serial_get_dtr()) {
+			*span = &detach;
+			return 1;
+		}
+
+		while (usb_get_config() != 1)
+			continue;
+	}
+
+	/* Only the part up to the end of the ring is contiguous */
+	const uint32_t tail = tail_out % sizeof(buffer_out);
+	uint32_t count = head_out - tail_out;
+	if (count > sizeof(buffer_out) - tail)
+		count = sizeof(buffer_out) - tail;
+	*span = (const unsigned char *)buffer_out + tail;
+	return count;
+}
+
+void gdb_if_consume(size_t count)
+{
+	if (tail_out != head_out)
+		tail_out += count;
+}
+
 unsigned char gdb_if_getchar_to(int timeout)
 {
 	platform_timeout t;
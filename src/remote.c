@@ -30,6 +30,13 @@
 #include "target/adiv5.h"
 #include "target.h"
 #include "hex_utils.h"
+#include "lz.h"
+#ifdef ENABLE_RTT
+#include "target/target_internal.h"
+#include "target/cortexm.h"
+#include "rtt.h"
+#include "rtt_if.h"
+#endif
 
 #define NTOH(x)    (((x) <= 9) ? (x) + '0' : 'a' + (x) - 10)
 #define HTON(x)    (((x) <= '9') ? (x) - '0' : ((TOUPPER(x)) - 'A' + 10))
@@ -50,6 +57,21 @@ uint64_t remotehston(const uint32_t max, const char *const str)
 }
 
 #if PC_HOSTED == 0
+/* Sequence number of the command being processed, echoed in its response */
+static uint8_t remote_seq;
+static bool remote_seq_tagged;
+
+static void remote_respond_start(char respCode)
+{
+	gdb_if_putchar(REMOTE_RESP, 0);
+	if (remote_seq_tagged) {
+		gdb_if_putchar(REMOTE_SEQ_PACKET, 0);
+		gdb_if_putchar(NTOH(remote_seq >> 4U), 0);
+		gdb_if_putchar(NTOH(remote_seq & 0x0fU), 0);
+	}
+	gdb_if_putchar(respCode, 0);
+}
+
 static void remote_send_buf(uint8_t *buffer, size_t len)
 {
 	uint8_t *p = buffer;
@@ -65,22 +87,40 @@ static void remote_send_buf(uint8_t *buffer, size_t len)
 
 static void remote_respond_buf(char respCode, uint8_t *buffer, size_t len)
 {
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_respond_start(respCode);
 
 	remote_send_buf(buffer, len);
 
 	gdb_if_putchar(REMOTE_EOM, 1);
 }
 
+/* Send buffer as raw bytes, escaping the framing characters */
+static void remote_send_bin(const uint8_t *buffer, size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		const uint8_t c = buffer[i];
+		if (REMOTE_NEEDS_ESCAPE(c)) {
+			gdb_if_putchar(REMOTE_ESC, 0);
+			gdb_if_putchar(c ^ REMOTE_ESC_XOR, 0);
+		} else
+			gdb_if_putchar(c, 0);
+	}
+}
+
+static void remote_respond_bin(char respCode, const uint8_t *buffer, size_t len)
+{
+	remote_respond_start(respCode);
+	remote_send_bin(buffer, len);
+	gdb_if_putchar(REMOTE_EOM, 1);
+}
+
 /* Send response to far end */
 static void remote_respond(char respCode, uint64_t param)
 {
 	char buf[35]; /*Response, code, EOM and 2*16 hex nibbles*/
 	char *p = buf;
 
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_respond_start(respCode);
 
 	do {
 		*p++ = NTOH((param & 0x0f));
@@ -97,11 +137,10 @@ static void remote_respond(char respCode, uint64_t param)
 static void remote_respond_string(char respCode, const char *s)
 /* Send response to far end */
 {
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_respond_start(respCode);
 	while (*s) {
 		/* Just clobber illegal characters so they don't disturb the protocol */
-		if ((*s == '$') || (*s == REMOTE_SOM) || (*s == REMOTE_EOM))
+		if ((*s == '$') || (*s == REMOTE_SOM) || (*s == REMOTE_EOM) || (*s == REMOTE_ESC))
 			gdb_if_putchar(' ', 0);
 		else
 			gdb_if_putchar(*s, 0);
@@ -168,6 +207,9 @@ static void remote_packet_process_swd(unsigned i, char *packet)
 	}
 }
 
+/* Shift the TDI frames that follow a JB header, answering each with its TDO when asked to */
+static void remote_jtag_tdi_tdo_block(uint8_t *buffer, bool final_tms, bool want_tdo, size_t clock_cycles);
+
 static void remote_packet_process_jtag(unsigned i, char *packet)
 {
 	uint32_t MS;
@@ -226,6 +268,13 @@ static void remote_packet_process_jtag(unsigned i, char *packet)
 		}
 		break;
 
+	case REMOTE_TDITDO_BLOCK: /* JB = TDI/TDO of any length, in frames ====== */
+		if (i != 12)
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+		else
+			remote_jtag_tdi_tdo_block((uint8_t *)packet, packet[2] == '1', packet[3] == '1', remotehston(8, &packet[4]));
+		break;
+
 	case REMOTE_NEXT: /* JN = NEXT ======================================== */
 		if (i != 4)
 			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
@@ -258,6 +307,10 @@ static void remote_packet_process_jtag(unsigned i, char *packet)
 	}
 }
 
+#ifdef ENABLE_RTT
+static void remote_rtt_stop(void);
+#endif
+
 static void remotePacketProcessGEN(unsigned i, char *packet)
 {
 	(void)i;
@@ -314,6 +367,10 @@ static void remotePacketProcessGEN(unsigned i, char *packet)
 # define PLATFORM_IDENT() BOARD_IDENT
 #endif
 	case REMOTE_START:
+#ifdef ENABLE_RTT
+		/* A new host starts with no RTT polled for it */
+		remote_rtt_stop();
+#endif
 		remote_respond_string(REMOTE_RESP_OK, PLATFORM_IDENT ""  FIRMWARE_VERSION);
 		break;
 
@@ -328,13 +385,137 @@ static void remotePacketProcessGEN(unsigned i, char *packet)
     }
 }
 
+/* Receive one !<raw># frame of a block write, returns the unescaped length */
+static size_t remote_read_frame(uint8_t *buffer, size_t size)
+{
+	while (gdb_if_getchar() != REMOTE_SOM)
+		continue;
+	size_t len = 0;
+	for (unsigned char c = gdb_if_getchar(); c != REMOTE_EOM; c = gdb_if_getchar()) {
+		if (c == REMOTE_ESC)
+			c = gdb_if_getchar() ^ REMOTE_ESC_XOR;
+		/* Keep counting past the end so an oversized frame is caught */
+		if (len < size)
+			buffer[len] = c;
+		++len;
+	}
+	return len;
+}
+
+static void remote_jtag_tdi_tdo_block(uint8_t *const buffer, const bool final_tms, const bool want_tdo, size_t clock_cycles)
+{
+	/* All frames are consumed and, with TDO, answered even after an error, to stay in sync with the host */
+	uint8_t *const data_out = buffer + REMOTE_JTAG_FRAME_SIZE;
+	bool ok = true;
+	while (clock_cycles) {
+		const size_t cycles = MIN(clock_cycles, REMOTE_JTAG_FRAME_SIZE * 8U);
+		const size_t bytes = (cycles + 7U) >> 3U;
+		clock_cycles -= cycles;
+		if (remote_read_frame(buffer, bytes) != bytes)
+			ok = false;
+		/* Only the last bit of the whole sequence moves the TAP on */
+		const bool tms = final_tms && !clock_cycles;
+		if (ok && want_tdo)
+			jtag_proc.jtagtap_tdi_tdo_seq(data_out, tms, buffer, cycles);
+		else if (ok)
+			jtag_proc.jtagtap_tdi_seq(tms, buffer, cycles);
+		if (want_tdo && ok)
+			remote_respond_bin(REMOTE_RESP_OK, data_out, bytes);
+		else if (want_tdo)
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+	}
+	if (!want_tdo)
+		remote_respond(ok ? REMOTE_RESP_OK : REMOTE_RESP_ERR, ok ? 0 : REMOTE_ERROR_WRONGLEN);
+}
+
+static void remote_mem_read_block(ADIv5_AP_t *ap, uint8_t *buffer, uint32_t address, uint32_t count)
+{
+	while (count) {
+		const uint32_t frame = MIN(count, REMOTE_BLOCK_FRAME_SIZE);
+		adiv5_mem_read(ap, buffer, address, frame);
+		if (ap->dp->fault) {
+			/* Replaces the frame, the host stops reading here */
+			remote_respond(REMOTE_RESP_ERR, 0);
+			ap->dp->fault = 0;
+			adiv5_shadow_invalidate(ap->dp);
+			return;
+		}
+		remote_respond_bin(REMOTE_RESP_OK, buffer, frame);
+		address += frame;
+		count -= frame;
+	}
+}
+
+static void remote_mem_write_block(
+	ADIv5_AP_t *ap, uint8_t *buffer, uint32_t dest, uint32_t count, enum align align)
+{
+	/* All frames are consumed even after an error, to stay in sync with the host */
+	bool ok = !(count & ((1U << align) - 1U));
+	while (count) {
+		const uint32_t frame = MIN(count, REMOTE_BLOCK_FRAME_SIZE);
+		if (remote_read_frame(buffer, frame) != frame)
+			ok = false;
+		if (ok) {
+			adiv5_mem_write_sized(ap, dest, buffer, frame, align);
+			if (ap->dp->fault)
+				ok = false;
+		}
+		dest += frame;
+		count -= frame;
+	}
+	if (ok) {
+		remote_respond(REMOTE_RESP_OK, 0);
+		return;
+	}
+	remote_respond(REMOTE_RESP_ERR, 0);
+	ap->dp->fault = 0;
+	adiv5_shadow_invalidate(ap->dp);
+}
+
+/* Run a vector of DP/AP accesses, replying with all read results at once */
+static void remote_access_vector(ADIv5_DP_t *dp, const char *packet, const char *end)
+{
+	uint32_t results[REMOTE_ACCESS_VECTOR_MAX];
+	const size_t count = remotehston(2, packet);
+	packet += 2;
+	size_t reads = 0;
+	size_t done = 0;
+	for (; done < count && done < REMOTE_ACCESS_VECTOR_MAX && !dp->fault; ++done) {
+		if (end - packet < 5)
+			break;
+		const uint8_t RnW = remotehston(1, packet);
+		const uint16_t addr = remotehston(4, packet + 1);
+		packet += 5;
+		if (RnW) {
+			/* dp_read resolves posted AP reads for both SW-DP and JTAG-DP */
+			results[reads++] = dp->dp_read(dp, addr);
+			continue;
+		}
+		if (end - packet < 8)
+			break;
+		dp->low_access(dp, ADIV5_LOW_WRITE, addr, remotehston(8, packet));
+		packet += 8;
+	}
+	/* The accesses may have left SELECT, CSW and TAR anywhere */
+	adiv5_shadow_invalidate(dp);
+	if (dp->fault || done != count) {
+		remote_respond(REMOTE_RESP_ERR, done);
+		dp->fault = 0;
+		return;
+	}
+	if (reads)
+		remote_respond_buf(REMOTE_RESP_OK, (uint8_t *)results, reads * 4U);
+	else
+		remote_respond(REMOTE_RESP_OK, 0);
+}
+
 static void remotePacketProcessHL(unsigned i, char *packet)
 
 {
-	(void)i;
 	SET_IDLE_STATE(0);
+	const char *const end = packet + i;
 
-	ADIv5_AP_t remote_ap;
+	static ADIv5_AP_t remote_ap;
 	/* Re-use packet buffer. Align to DWORD! */
 	void *src = (void *)(((uint32_t)packet + 7) & ~7);
 	char index = packet[1];
@@ -343,9 +524,18 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 		return;
 	}
 	packet += 2;
-	remote_dp.dp_jd_index = remotehston(2, packet);
+	const uint8_t dp_jd_index = remotehston(2, packet);
+	if (remote_dp.dp_jd_index != dp_jd_index) {
+		remote_dp.dp_jd_index = dp_jd_index;
+		adiv5_shadow_invalidate(&remote_dp);
+	}
 	packet += 2;
-	remote_ap.apsel = remotehston(2, packet);
+	const uint8_t apsel = remotehston(2, packet);
+	/* The CSW and TAR shadows only carry over between packets for the same AP */
+	if (remote_ap.apsel != apsel) {
+		remote_ap.apsel = apsel;
+		remote_ap.shadow_valid = 0;
+	}
 	remote_ap.dp = &remote_dp;
 	switch (index) {
 	case REMOTE_DP_READ:  /* Hd = Read from DP register */
@@ -360,6 +550,8 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 		packet += 4;
 		uint32_t value = remotehston(8, packet);
 		data = remote_dp.low_access(&remote_dp, remote_ap.apsel, addr16, value);
+		/* Raw accesses may leave SELECT, CSW and TAR anywhere */
+		adiv5_shadow_invalidate(&remote_dp);
 		remote_respond_buf(REMOTE_RESP_OK, (uint8_t*)&data, 4);
 		break;
 	case REMOTE_AP_READ: /* Ha = Read from AP register*/
@@ -376,6 +568,10 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 		adiv5_ap_write(&remote_ap, addr16, value);
 		remote_respond(REMOTE_RESP_OK, 0);
 		break;
+	case REMOTE_ACCESS_VECTOR: /* HV = Run a vector of DP/AP accesses */
+		remote_access_vector(&remote_dp, packet + 2, end);
+		break;
+	case REMOTE_AP_MEM_READ_BIN: /* Hr = Read from Mem and set csw, raw reply */
 	case REMOTE_AP_MEM_READ: /* HM = Read from Mem and set csw */
 		packet += 2;
 		remote_ap.csw = remotehston(8, packet);
@@ -389,12 +585,26 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 		packet += 8;
 		adiv5_mem_read(&remote_ap, src, address, count);
 		if (remote_ap.dp->fault == 0) {
-			remote_respond_buf(REMOTE_RESP_OK, src, count);
+			if (index == REMOTE_AP_MEM_READ_BIN)
+				remote_respond_bin(REMOTE_RESP_OK, src, count);
+			else
+				remote_respond_buf(REMOTE_RESP_OK, src, count);
 			break;
 		}
 		remote_respond(REMOTE_RESP_ERR, 0);
 		remote_ap.dp->fault = 0;
+		adiv5_shadow_invalidate(remote_ap.dp);
+		break;
+	case REMOTE_AP_MEM_READ_BLOCK: /* HB = Stream a block from Mem and set csw */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		address = remotehston(8, packet);
+		packet += 8;
+		count = remotehston(8, packet);
+		remote_mem_read_block(&remote_ap, src, address, count);
 		break;
+	case REMOTE_AP_MEM_WRITE_BIN: /* Hw = Write raw bytes to memory and set csw */
 	case REMOTE_AP_MEM_WRITE_SIZED: /* Hm = Write to memory and set csw */
 		packet += 2;
 		remote_ap.csw = remotehston(8, packet);
@@ -413,17 +623,37 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 			remote_respond(REMOTE_RESP_ERR, 0);
 			break;
 		}
-		/* Read as stream of hexified bytes*/
-		unhexify(src, packet, len);
+		if (index == REMOTE_AP_MEM_WRITE_BIN) {
+			/* Raw bytes, already unescaped on reception */
+			if ((size_t)(end - packet) != len) {
+				remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+				break;
+			}
+			memmove(src, packet, len);
+		} else
+			/* Read as stream of hexified bytes*/
+			unhexify(src, packet, len);
 		adiv5_mem_write_sized(&remote_ap, dest, src, len, align);
 		if (remote_ap.dp->fault) {
 			/* Errors handles on hosted side.*/
 			remote_respond(REMOTE_RESP_ERR, 0);
 			remote_ap.dp->fault = 0;
+			adiv5_shadow_invalidate(remote_ap.dp);
 			break;
 		}
 		remote_respond(REMOTE_RESP_OK, 0);
 		break;
+	case REMOTE_AP_MEM_WRITE_BLOCK: /* HW = Write a stream of frames to Mem and set csw */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		align = remotehston(2, packet);
+		packet += 2;
+		dest = remotehston(8, packet);
+		packet += 8;
+		count = remotehston(8, packet);
+		remote_mem_write_block(&remote_ap, src, dest, count, align);
+		break;
 	default:
 		remote_respond(REMOTE_RESP_ERR,REMOTE_ERROR_UNRECOGNISED);
 		break;
@@ -432,8 +662,309 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 }
 
 
+/* Target the probe scanned and attached itself, for flash offload */
+static target *remote_target;
+
+static void remote_target_destroy_callback(struct target_controller *tc, target *t)
+{
+	(void)tc;
+	if (t == remote_target)
+		remote_target = NULL;
+}
+
+static void remote_target_printf(struct target_controller *tc, const char *fmt, va_list ap)
+{
+	/* There is no console on this side of the link */
+	(void)tc;
+	(void)fmt;
+	(void)ap;
+}
+
+static struct target_controller remote_controller = {
+	.destroy_callback = remote_target_destroy_callback,
+	.printf = remote_target_printf,
+};
+
+static bool remote_flash_write(uint8_t *buffer, uint32_t addr, uint32_t len)
+{
+	/* All frames are consumed even after an error, to stay in sync with the host */
+	bool ok = remote_target != NULL;
+	while (len) {
+		const uint32_t frame = MIN(len, REMOTE_BLOCK_FRAME_SIZE);
+		if (remote_read_frame(buffer, frame) != frame)
+			ok = false;
+		if (ok) {
+			volatile struct exception e;
+			TRY_CATCH (e, EXCEPTION_ALL) {
+				ok = target_flash_write(remote_target, addr, buffer, frame);
+			}
+			if (e.type)
+				ok = false;
+		}
+		addr += frame;
+		len -= frame;
+	}
+	return ok;
+}
+
+typedef struct remote_flash_lz {
+	uint32_t addr;
+	bool ok;
+} remote_flash_lz_s;
+
+static lz_decoder_s remote_lz;
+
+/* Each window full of decompressed data goes straight to the buffered flash write */
+static bool remote_flash_lz_output(void *const ctx, const uint8_t *const data, const size_t len)
+{
+	remote_flash_lz_s *const state = (remote_flash_lz_s *)ctx;
+	if (state->ok) {
+		volatile struct exception e;
+		TRY_CATCH (e, EXCEPTION_ALL) {
+			state->ok = target_flash_write(remote_target, state->addr, data, len);
+		}
+		if (e.type)
+			state->ok = false;
+	}
+	state->addr += len;
+	return state->ok;
+}
+
+static bool remote_flash_write_lz(uint8_t *buffer, uint32_t addr, uint32_t len, uint32_t count)
+{
+	/* As with an uncompressed write all frames are consumed, whatever happens */
+	remote_flash_lz_s state = {.addr = addr, .ok = remote_target != NULL};
+	lz_decode_start(&remote_lz, len, remote_flash_lz_output, &state);
+	bool ok = true;
+	while (count) {
+		const uint32_t frame = MIN(count, REMOTE_BLOCK_FRAME_SIZE);
+		if (remote_read_frame(buffer, frame) != frame)
+			ok = false;
+		if (ok)
+			ok = lz_decode(&remote_lz, buffer, frame);
+		count -= frame;
+	}
+	return ok && lz_decode_finish(&remote_lz) && state.ok;
+}
+
+#ifdef ENABLE_RTT
+/* RTT polled for the host on a target of the probe's own scan, see remote.h */
+static struct {
+	size_t target; /* place in the target list, 0 for none */
+	bool armed;
+	bool layout_sent;
+} remote_rtt;
+
+/* Looked up again each time, the list may have been scanned anew since */
+static target *remote_rtt_target(void)
+{
+	target *t = target_list;
+	for (size_t i = 1; t && i < remote_rtt.target; ++i)
+		t = t->next;
+	return remote_rtt.target && t && t->core && t->core[0] == 'M' ? t : NULL;
+}
+
+static void remote_notify_start(const char type)
+{
+	gdb_if_putchar(REMOTE_NOTIFY, 0);
+	gdb_if_putchar(type, 0);
+}
+
+static void remote_rtt_sink(const uint32_t channel, const char *const data, const uint32_t len, void *const ctx)
+{
+	(void)ctx;
+	for (uint32_t offset = 0; offset < len; offset += REMOTE_RTT_NOTIFY_MAX) {
+		remote_notify_start(REMOTE_NOTIFY_RTT);
+		gdb_if_putchar(NTOH((channel >> 4U) & 0x0fU), 0);
+		gdb_if_putchar(NTOH(channel & 0x0fU), 0);
+		remote_send_bin((const uint8_t *)data + offset, MIN(len - offset, REMOTE_RTT_NOTIFY_MAX));
+		gdb_if_putchar(REMOTE_EOM, 1);
+	}
+}
+
+static void remote_rtt_stop(void)
+{
+	remote_rtt.target = 0;
+	remote_rtt.armed = false;
+	rtt_enabled = false;
+	rtt_quiet = false;
+}
+
+static void remote_rtt_poll(void)
+{
+	target *const t = remote_rtt_target();
+	if (!t || !rtt_enabled) {
+		remote_rtt_stop();
+		return;
+	}
+	/* The host's packets have moved SELECT, CSW and TAR since, and this poll moves them for the host */
+	adiv5_shadow_invalidate(cortexm_ap(t)->dp);
+	rtt_if_set_sink(remote_rtt_sink, NULL);
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		poll_rtt(t);
+	}
+	rtt_if_set_sink(NULL, NULL);
+	adiv5_shadow_invalidate(&remote_dp);
+	if (e.type)
+		rtt_enabled = false;
+	/* The host reads input for the channels the target takes it on */
+	if (rtt_found && !remote_rtt.layout_sent) {
+		uint32_t down_channels = 0;
+		for (uint32_t i = 0; i < MAX_RTT_CHAN; ++i) {
+			if (rtt_channel[i].is_enabled && rtt_channel[i].is_configured && !rtt_channel[i].is_output)
+				down_channels |= 1U << i;
+		}
+		remote_notify_start(REMOTE_NOTIFY_RTT_LAYOUT);
+		remote_send_buf((uint8_t[]){down_channels >> 24U, down_channels >> 16U, down_channels >> 8U, down_channels}, 4);
+		gdb_if_putchar(REMOTE_EOM, 1);
+		remote_rtt.layout_sent = true;
+	}
+	if (!rtt_enabled) {
+		remote_notify_start(REMOTE_NOTIFY_RTT_LOST);
+		gdb_if_putchar(REMOTE_EOM, 1);
+		remote_rtt_stop();
+	}
+}
+
+/* TR: take the host's RTT settings and start afresh on the given target */
+static bool remote_rtt_start(const char *const packet)
+{
+	remote_rtt_stop();
+	remote_rtt.target = remotehston(2, packet);
+	if (!remote_rtt_target()) {
+		remote_rtt.target = 0;
+		return false;
+	}
+	rtt_cbaddr = remotehston(8, packet + 2);
+	rtt_ram_start = remotehston(8, packet + 10);
+	rtt_ram_end = remotehston(8, packet + 18);
+	rtt_min_poll_ms = remotehston(8, packet + 26);
+	rtt_max_poll_ms = remotehston(8, packet + 34);
+	rtt_max_poll_errs = remotehston(8, packet + 42);
+	const uint32_t channels = remotehston(8, packet + 50);
+	rtt_auto_channel = !channels;
+	for (uint32_t i = 0; i < MAX_RTT_CHAN; ++i)
+		rtt_channel[i].is_enabled = channels & (1U << i);
+	const char *const ident = packet + 58;
+	const size_t ident_len = MIN(strlen(ident) / 2U, sizeof(rtt_ident) - 1U);
+	memset(rtt_ident, 0, sizeof(rtt_ident));
+	unhexify(rtt_ident, ident, ident_len);
+	memset(rtt_stats, 0, sizeof(rtt_stats));
+	rtt_found = false;
+	rtt_poll_errs = 0;
+	rtt_quiet = true;
+	rtt_enabled = true;
+	remote_rtt.layout_sent = false;
+	return true;
+}
+
+/* TK: host input, the reply says how much of it fitted */
+static uint32_t remote_rtt_down(const char *const hex)
+{
+	char data[REMOTE_RTT_DOWN_MAX];
+	const size_t len = MIN(strlen(hex) / 2U, sizeof(data));
+	unhexify(data, hex, len);
+	return rtt_down_put(data, len);
+}
+#endif
+
+void remote_idle(void)
+{
+#ifdef ENABLE_RTT
+	while (remote_rtt.armed && !gdb_getpacket_ready())
+		remote_rtt_poll();
+#endif
+}
+
+static void remote_packet_process_target(unsigned i, char *packet)
+{
+	(void)i;
+	SET_IDLE_STATE(0);
+	volatile bool ok = false;
+	volatile uint32_t result = 0;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		switch (packet[1]) {
+		case REMOTE_TARGET_SCAN: { /* TS = Scan for targets ================ */
+			const uint32_t targetid = remotehston(8, &packet[3]);
+#ifdef ENABLE_RTT
+			remote_rtt_stop();
+#endif
+			/* Drops any target attached before, from GDB or an earlier offload */
+			result = packet[2] == 'j' ? jtag_scan(NULL) : adiv5_swdp_scan(targetid);
+			ok = result != 0;
+			break;
+		}
+		case REMOTE_TARGET_ATTACH: /* TA = Attach to the n-th target ======= */
+			if (remote_target)
+				target_detach(remote_target);
+			remote_target = target_attach_n(remotehston(2, &packet[2]), &remote_controller);
+			ok = remote_target != NULL;
+			break;
+		case REMOTE_FLASH_ERASE: /* TE = Erase a flash range ============== */
+			ok = remote_target &&
+				target_flash_erase(remote_target, remotehston(8, &packet[2]), remotehston(8, &packet[10]));
+			break;
+		case REMOTE_FLASH_WRITE: /* TW = Write the frames that follow ====== */
+			ok = remote_flash_write((uint8_t *)packet, remotehston(8, &packet[2]), remotehston(8, &packet[10]));
+			break;
+		case REMOTE_FLASH_WRITE_LZ: /* TZ = Write compressed frames ====== */
+			ok = remote_flash_write_lz((uint8_t *)packet, remotehston(8, &packet[2]), remotehston(8, &packet[10]),
+				remotehston(8, &packet[18]));
+			break;
+		case REMOTE_FLASH_DONE: /* TC = Flush and finish flash writes ====== */
+			ok = remote_target && target_flash_complete(remote_target);
+			break;
+		case REMOTE_TARGET_DETACH: /* TD = Optionally reset, then detach === */
+			if (remote_target) {
+				if (packet[2] == '1')
+					target_reset(remote_target);
+				target_detach(remote_target);
+				remote_target = NULL;
+			}
+			ok = true;
+			break;
+#ifdef ENABLE_RTT
+		case REMOTE_RTT_START: /* TR = Poll RTT for the host =========== */
+			ok = remote_rtt_start(&packet[2]);
+			break;
+		case REMOTE_RTT_ARM: /* TP = Poll until the next packet ========= */
+			remote_rtt.armed = remote_rtt.target != 0;
+			ok = remote_rtt.armed;
+			break;
+		case REMOTE_RTT_DOWN: /* TK = Input for the target ============= */
+			result = remote_rtt_down(&packet[2]);
+			ok = true;
+			break;
+#endif
+		default:
+			result = REMOTE_ERROR_UNRECOGNISED;
+			break;
+		}
+	}
+	if (e.type)
+		ok = false;
+	remote_respond(ok ? REMOTE_RESP_OK : REMOTE_RESP_ERR, result);
+	SET_IDLE_STATE(1);
+}
+
 void remotePacketProcess(unsigned i, char *packet)
 {
+#ifdef ENABLE_RTT
+	/* Any packet ends RTT polling, until the host arms it again */
+	remote_rtt.armed = false;
+#endif
+	/* Strip the sequence number of pipelined commands, the response echoes it */
+	remote_seq_tagged = packet[0] == REMOTE_SEQ_PACKET && i > 3;
+	if (remote_seq_tagged) {
+		remote_seq = remotehston(2, packet + 1);
+		packet += 3;
+		i -= 3;
+	}
+	/* Sequences and resets driven from the host can change the DP state */
+	if (packet[0] != REMOTE_HL_PACKET)
+		adiv5_shadow_invalidate(&remote_dp);
 	switch (packet[0]) {
     case REMOTE_SWDP_PACKET:
 		remote_packet_process_swd(i,packet);
@@ -451,6 +982,10 @@ void remotePacketProcess(unsigned i, char *packet)
 		remotePacketProcessHL(i, packet);
 		break;
 
+    case REMOTE_TARGET_PACKET:
+		remote_packet_process_target(i, packet);
+		break;
+
     default: /* Oh dear, unrecognised, return an error */
 		remote_respond(REMOTE_RESP_ERR,REMOTE_ERROR_UNRECOGNISED);
 		break;
@@ -24,7 +24,7 @@
 #include <inttypes.h>
 #include "general.h"
 
-#define REMOTE_HL_VERSION 2
+#define REMOTE_HL_VERSION 10
 
 /*
  * Commands to remote end, and responses
@@ -46,6 +46,54 @@
  *       resp: F<PARAM> - hex value returned, bad parity.
  *             X<err>   - error occured
  *
+ * From REMOTE_HL_VERSION 3 on, memory contents may also travel as raw
+ * bytes (the 'r' and 'w' high level packets). The byte count is carried
+ * in the packet header; any payload byte that would be mistaken for a
+ * framing character is sent as REMOTE_ESC followed by the byte XORed
+ * with REMOTE_ESC_XOR. Hex digits never need escaping, so both ends undo
+ * the escaping unconditionally.
+ *
+ * From REMOTE_HL_VERSION 4 on, the 'B' and 'W' high level packets move a
+ * whole block with a single request. A block read is answered by one
+ * &K<raw># frame per REMOTE_BLOCK_FRAME_SIZE bytes, or an error response
+ * in place of the first frame that failed. A block write header is
+ * followed by the data as !<raw># frames of the same size and is
+ * acknowledged once, after the last frame.
+ *
+ * From REMOTE_HL_VERSION 5 on, the 'V' high level packet carries up to
+ * REMOTE_ACCESS_VECTOR_MAX DP/AP accesses, each a RnW digit, the 4 digit
+ * register address and, for writes, the 8 digit value. The reply holds
+ * the results of all reads in order, or an error with the number of
+ * accesses issued before the vector stopped.
+ *
+ * From REMOTE_HL_VERSION 6 on, the 'T' packets run whole flash operations
+ * inside the probe on a target it scanned and attached itself. Flash
+ * write data follows its header as !<raw># frames, like a block write.
+ *
+ * From REMOTE_HL_VERSION 7 on, any packet may be prefixed with
+ * REMOTE_SEQ_PACKET and a 2 digit sequence number, as in !Q2aHA...#. The
+ * response then starts with the same prefix, &Q2aK...#, so the host can
+ * keep several commands in flight and match each reply, error or not, to
+ * its command. Replies always come back in command order.
+ *
+ * From REMOTE_HL_VERSION 8 on, the 'JB' packet shifts a TDI/TDO sequence
+ * of any length. Its header carries the final TMS and whether TDO is
+ * wanted, then the TDI data follows as !<raw># frames of up to
+ * REMOTE_JTAG_FRAME_SIZE bytes. With TDO each frame is answered by a
+ * &K<raw># frame of the bits shifted out, or an error in its place,
+ * otherwise the whole sequence is acknowledged once, after the last frame.
+ *
+ * From REMOTE_HL_VERSION 9 on, the 'TZ' packet writes flash like 'TW', but
+ * the frames that follow carry the data LZ compressed (see lz.h). Its header
+ * has both the decompressed length written and the compressed length sent.
+ *
+ * From REMOTE_HL_VERSION 10 on, the 'TR' packet has the probe poll RTT on
+ * a target of its own scan, without attaching it. Polling only runs once
+ * armed by a 'TP' packet and until the next packet arrives, so it never
+ * comes between the accesses of a host operation. The channel data goes to
+ * the host unasked, as %R<channel><raw># notifications between replies, and
+ * the host takes these out of the stream wherever it waits for a reply.
+ *
  * The whole protocol is defined in this header file. Parameters have
  * to be marshalled in remote.c, swdptap.c and jtagtap.c, so be
  * careful to ensure the parameter handling matches the protocol
@@ -60,6 +108,18 @@
 #define REMOTE_SOM  '!'
 #define REMOTE_EOM  '#'
 #define REMOTE_RESP '&'
+/* Start of a notification the probe sends unasked, ended by REMOTE_EOM */
+#define REMOTE_NOTIFY '%'
+
+/* Sequence number prefix of pipelined commands and their responses */
+#define REMOTE_SEQ_PACKET 'Q'
+
+/* Escaping of raw bytes inside binary payloads */
+#define REMOTE_ESC     '}'
+#define REMOTE_ESC_XOR 0x20U
+#define REMOTE_NEEDS_ESCAPE(c)                                                                        \
+	((c) == REMOTE_SOM || (c) == REMOTE_EOM || (c) == REMOTE_RESP || (c) == REMOTE_ESC || (c) == '$' || \
+		(c) == 0x04)
 
 /* Generic protocol elements */
 #define REMOTE_START         'A'
@@ -83,6 +143,7 @@
 #define REMOTE_NRST_SET      'Z'
 #define REMOTE_NRST_GET      'z'
 #define REMOTE_ADD_JTAG_DEV  'J'
+#define REMOTE_TDITDO_BLOCK  'B'
 
 /* Protocol response options */
 #define REMOTE_RESP_OK     'K'
@@ -101,6 +162,19 @@
 #define REMOTE_MEM_READ           'h'
 #define REMOTE_MEM_WRITE_SIZED    'H'
 #define REMOTE_AP_MEM_WRITE_SIZED 'm'
+#define REMOTE_AP_MEM_READ_BIN    'r'
+#define REMOTE_AP_MEM_WRITE_BIN   'w'
+#define REMOTE_AP_MEM_READ_BLOCK  'B'
+#define REMOTE_AP_MEM_WRITE_BLOCK 'W'
+#define REMOTE_ACCESS_VECTOR      'V'
+
+/* Accesses in one REMOTE_ACCESS_VECTOR packet, matches the hosted DP queue depth */
+#define REMOTE_ACCESS_VECTOR_MAX 64U
+
+/* Payload bytes per frame of a block transfer, fits both ends' packet buffers */
+#define REMOTE_BLOCK_FRAME_SIZE 0x3c0U
+/* Bytes per frame of a JTAG block shift, the probe holds the TDI and TDO of a frame at once */
+#define REMOTE_JTAG_FRAME_SIZE (REMOTE_BLOCK_FRAME_SIZE / 2U)
 
 /* Generic protocol elements */
 #define REMOTE_GEN_PACKET  'G'
@@ -220,6 +294,12 @@
 		REMOTE_SOM, REMOTE_JTAG_PACKET, REMOTE_NEXT, '%', 'u', '%', 'u', REMOTE_EOM, 0 \
 	}
 
+#define REMOTE_JTAG_TDITDO_BLOCK_STR                                                                           \
+	(char[])                                                                                                   \
+	{                                                                                                          \
+		REMOTE_SOM, REMOTE_JTAG_PACKET, REMOTE_TDITDO_BLOCK, '%', 'u', '%', 'u', '%', '0', '8', 'x', REMOTE_EOM, 0 \
+	}
+
 /* HL protocol elements */
 #define HEX '%', '0', '2', 'x'
 #define HEX_U32(x) '%', '0', '8', 'x'
@@ -276,6 +356,35 @@
 		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_SIZED, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
 			'%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), 0                                                    \
 	}
+#define REMOTE_AP_MEM_READ_BIN_STR                                                                                  \
+	(char[])                                                                                                        \
+	{                                                                                                               \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_READ_BIN, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			HEX_U32(address), HEX_U32(count), REMOTE_EOM, 0                                                         \
+	}
+#define REMOTE_AP_MEM_WRITE_BIN_STR                                                                                  \
+	(char[])                                                                                                         \
+	{                                                                                                                \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_BIN, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			'%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), 0                                                  \
+	}
+#define REMOTE_AP_MEM_READ_BLOCK_STR                                                                                  \
+	(char[])                                                                                                          \
+	{                                                                                                                 \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_READ_BLOCK, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			HEX_U32(address), HEX_U32(count), REMOTE_EOM, 0                                                           \
+	}
+#define REMOTE_AP_MEM_WRITE_BLOCK_STR                                                                                  \
+	(char[])                                                                                                           \
+	{                                                                                                                  \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_BLOCK, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			'%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), REMOTE_EOM, 0                                        \
+	}
+#define REMOTE_ACCESS_VECTOR_STR                                                                            \
+	(char[])                                                                                                \
+	{                                                                                                       \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_ACCESS_VECTOR, '%', '0', '2', 'x', '0', '0', '%', '0', '2', 'x', 0 \
+	}
 #define REMOTE_MEM_WRITE_SIZED_STR                                                                       \
 	(char[])                                                                                             \
 	{                                                                                                    \
@@ -283,7 +392,91 @@
 			HEX_U32(address), HEX_U32(count), 0                                                          \
 	}
 
+/* Probe side target and flash operations */
+#define REMOTE_TARGET_PACKET 'T'
+#define REMOTE_TARGET_SCAN   'S'
+#define REMOTE_TARGET_ATTACH 'A'
+#define REMOTE_TARGET_DETACH 'D'
+#define REMOTE_FLASH_ERASE   'E'
+#define REMOTE_FLASH_WRITE   'W'
+#define REMOTE_FLASH_DONE    'C'
+#define REMOTE_FLASH_WRITE_LZ 'Z'
+#define REMOTE_RTT_START      'R'
+#define REMOTE_RTT_ARM        'P'
+#define REMOTE_RTT_DOWN       'K'
+
+/* Notifications: RTT channel data, the input channels found, and RTT lost */
+#define REMOTE_NOTIFY_RTT        'R'
+#define REMOTE_NOTIFY_RTT_LAYOUT 'C'
+#define REMOTE_NOTIFY_RTT_LOST   'X'
+/* Channel data bytes in one notification, and host input bytes in one 'TK' packet */
+#define REMOTE_RTT_NOTIFY_MAX 256U
+#define REMOTE_RTT_DOWN_MAX   64U
+
+#define REMOTE_TARGET_SCAN_STR                                                                       \
+	(char[])                                                                                         \
+	{                                                                                                \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_TARGET_SCAN, '%', 'c', HEX_U32(targetid), REMOTE_EOM, 0 \
+	}
+#define REMOTE_TARGET_ATTACH_STR                                                                    \
+	(char[])                                                                                        \
+	{                                                                                               \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_TARGET_ATTACH, '%', '0', '2', 'x', REMOTE_EOM, 0 \
+	}
+#define REMOTE_TARGET_DETACH_STR                                                         \
+	(char[])                                                                             \
+	{                                                                                    \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_TARGET_DETACH, '%', 'c', REMOTE_EOM, 0 \
+	}
+#define REMOTE_FLASH_ERASE_STR                                                                          \
+	(char[])                                                                                            \
+	{                                                                                                   \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_FLASH_ERASE, HEX_U32(addr), HEX_U32(len), REMOTE_EOM, 0 \
+	}
+#define REMOTE_FLASH_WRITE_STR                                                                          \
+	(char[])                                                                                            \
+	{                                                                                                   \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_FLASH_WRITE, HEX_U32(addr), HEX_U32(len), REMOTE_EOM, 0 \
+	}
+#define REMOTE_FLASH_WRITE_LZ_STR                                                                     \
+	(char[])                                                                                          \
+	{                                                                                                 \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_FLASH_WRITE_LZ, HEX_U32(addr), HEX_U32(len), HEX_U32(count), \
+			REMOTE_EOM, 0                                                                             \
+	}
+#define REMOTE_FLASH_DONE_STR                                                \
+	(char[])                                                                 \
+	{                                                                        \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_FLASH_DONE, REMOTE_EOM, 0 \
+	}
+
+/*
+ * TR: target, control block address, search range start and end, min and
+ * max poll ms, max errors, channel mask (0 for auto), then the ident in hex
+ */
+#define REMOTE_RTT_START_STR                                                                                 \
+	(char[])                                                                                                 \
+	{                                                                                                        \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_RTT_START, '%', '0', '2', 'x', HEX_U32(cbaddr),             \
+			HEX_U32(ram_start), HEX_U32(ram_end), HEX_U32(min_poll), HEX_U32(max_poll), HEX_U32(max_errs), \
+			HEX_U32(channels), '%', 's', REMOTE_EOM, 0                                                       \
+	}
+#define REMOTE_RTT_ARM_STR                                                \
+	(char[])                                                              \
+	{                                                                     \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_RTT_ARM, REMOTE_EOM, 0 \
+	}
+#define REMOTE_RTT_DOWN_STR                                                         \
+	(char[])                                                                        \
+	{                                                                               \
+		REMOTE_SOM, REMOTE_TARGET_PACKET, REMOTE_RTT_DOWN, '%', 's', REMOTE_EOM, 0 \
+	}
+
 uint64_t remotehston(uint32_t limit, const char *s);
 void remotePacketProcess(unsigned int i, char *packet);
+#if PC_HOSTED == 0
+/* Called while waiting for a packet, returns once one is coming */
+void remote_idle(void);
+#endif
 
 #endif /* REMOTE_H */
@@ -0,0 +1,119 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Single producer, single consumer byte ring, see ring.h */
+
+#include "general.h"
+#include "ring.h"
+
+/*
+ * Each side reads the other's index with acquire and publishes its own with
+ * release, so the data is in the buffer before the head says so, and has
+ * been taken out before the tail gives the room back.
+ */
+static uint32_t ring_head(const ring_s *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+static uint32_t ring_tail(const ring_s *ring)
+{
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+void ring_reset(ring_s *ring)
+{
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+uint32_t ring_used(const ring_s *ring)
+{
+	return ring_head(ring) - ring_tail(ring);
+}
+
+uint32_t ring_free(const ring_s *ring)
+{
+	return ring->size - ring_used(ring);
+}
+
+uint8_t *ring_write_span(ring_s *ring, uint32_t *len)
+{
+	const uint32_t head = ring->head;
+	const uint32_t offset = head & (ring->size - 1U);
+	*len = MIN(ring->size - (head - ring_tail(ring)), ring->size - offset);
+	return ring->buf + offset;
+}
+
+void ring_write_commit(ring_s *ring, uint32_t len)
+{
+	__atomic_store_n(&ring->head, ring->head + len, __ATOMIC_RELEASE);
+}
+
+uint32_t ring_write(ring_s *ring, const void *data, uint32_t len)
+{
+	const uint8_t *src = data;
+	uint32_t done = 0;
+	/* At most two spans, either side of the wrap */
+	for (size_t i = 0; i < 2U && done < len; ++i) {
+		uint32_t room;
+		uint8_t *const dest = ring_write_span(ring, &room);
+		const uint32_t count = MIN(room, len - done);
+		memcpy(dest, src + done, count);
+		ring_write_commit(ring, count);
+		done += count;
+	}
+	return done;
+}
+
+void ring_write_to(ring_s *ring, const uint32_t offset)
+{
+	ring_write_commit(ring, (offset - ring->head) & (ring->size - 1U));
+}
+
+const uint8_t *ring_read_span(ring_s *ring, uint32_t *len)
+{
+	const uint32_t tail = ring->tail;
+	const uint32_t offset = tail & (ring->size - 1U);
+	*len = MIN(ring_head(ring) - tail, ring->size - offset);
+	return ring->buf + offset;
+}
+
+void ring_read_commit(ring_s *ring, uint32_t len)
+{
+	__atomic_store_n(&ring->tail, ring->tail + len, __ATOMIC_RELEASE);
+}
+
+uint32_t ring_read(ring_s *ring, void *data, uint32_t len)
+{
+	uint8_t *dest = data;
+	uint32_t done = 0;
+	for (size_t i = 0; i < 2U && done < len; ++i) {
+		uint32_t avail;
+		const uint8_t *const src = ring_read_span(ring, &avail);
+		const uint32_t count = MIN(avail, len - done);
+		memcpy(dest + done, src, count);
+		ring_read_commit(ring, count);
+		done += count;
+	}
+	return done;
+}
+
+void ring_discard(ring_s *ring)
+{
+	ring_read_commit(ring, ring_head(ring) - ring->tail);
+}
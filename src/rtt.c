@@ -36,18 +36,33 @@ bool rtt_enabled = false;
 bool rtt_found = false;
 static bool rtt_halt = false; // true if rtt needs to halt target to access memory
 uint32_t rtt_cbaddr = 0;
+uint32_t rtt_ram_start = 0;
+uint32_t rtt_ram_end = 0;
 bool rtt_auto_channel = true;
 struct rtt_channel_struct rtt_channel[MAX_RTT_CHAN];
 
 uint32_t rtt_min_poll_ms = 8;    /* 8 ms */
 uint32_t rtt_max_poll_ms = 256;  /* 0.256 s */
 uint32_t rtt_max_poll_errs = 10;
-static uint32_t poll_ms;
-static uint32_t poll_errs;
+uint32_t rtt_poll_ms;
+uint32_t rtt_poll_errs;
+struct rtt_stats_struct rtt_stats[MAX_RTT_CHAN];
 static uint32_t last_poll_ms;
 /* flags for data from host to target */
 bool rtt_flag_skip = false;
 bool rtt_flag_block = false;
+bool rtt_quiet = false;
+
+/* trouble is told to gdb, unless there is none as the probe polls for a remote host */
+static void rtt_report(const char *const fmt, ...)
+{
+	if (rtt_quiet)
+		return;
+	va_list ap;
+	va_start(ap, fmt);
+	gdb_voutf(fmt, ap);
+	va_end(ap);
+}
 
 typedef enum rtt_retval {
 	RTT_OK,
@@ -63,8 +78,12 @@ char rtt_ident[16] = QUOTE(RTT_IDENT);
 char rtt_ident[16] = {0};
 #endif
 
-/* usb uart transmit buffer */
-static char xmit_buf[RTT_UP_BUF_SIZE];
+/* per-poll copy of the SEGGER_RTT_BUFFER descriptors following the control block header */
+#define RTT_DESC_WORDS 6U
+#define RTT_DESC_HEAD  3U
+#define RTT_DESC_TAIL  4U
+static uint32_t rtt_desc[MAX_RTT_CHAN][RTT_DESC_WORDS];
+static uint32_t rtt_desc_dirty;
 
 /*********************************************************************
 *
@@ -73,91 +92,156 @@ static char xmit_buf[RTT_UP_BUF_SIZE];
 **********************************************************************
 */
 
-uint32_t fastsrch(target *cur_target)
+/* Boyer-Moore-Horspool search of target ram for a byte pattern.
+   Ram is read in windows as large as the rtt transmit buffer, which is idle until
+   the control block is found; the last len - 1 bytes of each window are carried
+   over so matches spanning two reads are not missed. */
+uint32_t rtt_search(target *cur_target, const uint8_t *pattern, uint32_t len)
 {
-	const uint32_t m = 16;
-	const uint64_t q = 0x797a9691; /* prime */
-	const uint64_t rm = 0x73b07d01;
-	const uint64_t p = 0x444110cd;
-	const uint32_t stride = 128;
-	uint64_t t = 0;
-	uint8_t srch_buf[m+stride];
+	uint32_t scratch_len;
+	uint8_t *const srch_buf = (uint8_t *)rtt_up_scratch(&scratch_len);
+	uint8_t skip[256];
 
-	for (struct target_ram *r = cur_target->ram; r; r = r->next) {
-		const uint32_t ram_start = r->start;
-		const uint32_t ram_end = r->start + r->length;
+	if (len == 0 || len > 255 || scratch_len < 2U * len + 4U)
+		return 0;
+	const uint32_t chunk = (scratch_len - len) & ~3U;
+	memset(skip, len, sizeof(skip));
+	for (uint32_t i = 0; i + 1 < len; i++)
+		skip[pattern[i]] = len - 1 - i;
 
-		t = 0;
-		memset(srch_buf, 0, sizeof(srch_buf));
+	for (struct target_ram *r = cur_target->ram; r; r = r->next) {
+		uint32_t ram_start = r->start;
+		uint32_t ram_end = r->start + r->length;
+		/* clip to the range given with 'mon rtt ram' */
+		if (rtt_ram_end > rtt_ram_start) {
+			ram_start = MAX(ram_start, rtt_ram_start);
+			ram_end = MIN(ram_end, rtt_ram_end);
+		}
+		uint32_t kept = 0;
 
-		for (uint32_t addr = ram_start; addr < ram_end; addr += stride) {
-			uint32_t buf_siz = MIN(stride, ram_end - addr);
-			memcpy(srch_buf, srch_buf + stride, m);
-			if (target_mem_read(cur_target, srch_buf + m, addr, buf_siz)) {
-				gdb_outf("rtt: read fail at 0x%" PRIx32 "\r\n", addr);
+		for (uint32_t addr = ram_start; addr < ram_end; addr += chunk) {
+			const uint32_t buf_siz = MIN(chunk, ram_end - addr);
+			if (target_mem_read(cur_target, srch_buf + kept, addr, buf_siz)) {
+				rtt_report("rtt: read fail at 0x%" PRIx32 "\r\n", addr);
 				return 0;
 			}
-			for (uint32_t i = 0; i < buf_siz; i++) {
-				t = (t + q - rm * srch_buf[i] % q) % q;
-				t = ((t << 8) + srch_buf[i + m]) % q;
-				if (p == t) {
-					uint32_t offset =  i - m + 1;
-					return addr + offset;
-				}
+			const uint32_t avail = kept + buf_siz;
+			for (uint32_t pos = 0; pos + len <= avail; pos += skip[srch_buf[pos + len - 1]]) {
+				if (srch_buf[pos + len - 1] == pattern[len - 1] && memcmp(srch_buf + pos, pattern, len - 1) == 0)
+					return addr - kept + pos;
 			}
+			kept = MIN(len - 1, avail);
+			memmove(srch_buf, srch_buf + avail - kept, kept);
 		}
 	}
 	/* no match */
 	return 0;
 }
 
-uint32_t memsrch(target *cur_target)
+/* default SEGGER control block id, including the zero padding of acID[16] */
+static const uint8_t segger_id[16] = "SEGGER RTT";
+
+/* pattern identifying the control block: the user ident if set, else the SEGGER id */
+static const uint8_t *rtt_pattern(uint32_t *len)
+{
+	if (rtt_ident[0] == '\0') {
+		*len = sizeof(segger_id);
+		return segger_id;
+	}
+	*len = strlen(rtt_ident);
+	return (const uint8_t *)rtt_ident;
+}
+
+/* true if the control block id is found at addr */
+static bool rtt_cb_at(target *cur_target, uint32_t addr)
 {
-	char *srch_str = rtt_ident;
-	uint32_t srch_str_len = strlen(srch_str);
-	uint8_t srch_buf[128];
+	uint32_t len;
+	const uint8_t *const pattern = rtt_pattern(&len);
+	uint8_t id_buf[sizeof(segger_id)];
+	return addr && !target_mem_read(cur_target, id_buf, addr, len) && memcmp(id_buf, pattern, len) == 0;
+}
+
+/*
+ * Control block addresses of recently seen targets, so a reset or re-attach
+ * does not repeat the ram search. Entries are keyed by the target id and a
+ * hash of the start of the first flash region (the vector table on most parts),
+ * which changes when a different program is loaded.
+ */
+#define RTT_CB_CACHE_SIZE 4U
+
+typedef struct rtt_cb_cache_entry {
+	uint16_t designer_code;
+	uint16_t part_id;
+	uint32_t image_hash;
+	uint32_t cbaddr;
+} rtt_cb_cache_entry_s;
 
-	if (srch_str_len == 0 || srch_str_len > sizeof(srch_buf) / 2)
+static rtt_cb_cache_entry_s rtt_cb_cache[RTT_CB_CACHE_SIZE];
+static uint32_t rtt_cb_cache_next;
+
+static uint32_t rtt_image_hash(target *cur_target)
+{
+	uint32_t vectors[8];
+	if (!cur_target->flash || target_mem_read(cur_target, vectors, cur_target->flash->start, sizeof(vectors)))
 		return 0;
+	/* FNV-1a */
+	uint32_t hash = 0x811c9dc5U;
+	const uint8_t *const data = (const uint8_t *)vectors;
+	for (size_t i = 0; i < sizeof(vectors); i++)
+		hash = (hash ^ data[i]) * 0x01000193U;
+	return hash;
+}
 
-	if (rtt_cbaddr && !target_mem_read(cur_target, srch_buf, rtt_cbaddr, srch_str_len)
-		&& strncmp((const char *)(srch_buf), srch_str, srch_str_len) == 0)
-		/* still at same place */
+static rtt_cb_cache_entry_s *rtt_cb_cache_lookup(target *cur_target, uint32_t image_hash)
+{
+	for (size_t i = 0; i < RTT_CB_CACHE_SIZE; i++) {
+		rtt_cb_cache_entry_s *const entry = &rtt_cb_cache[i];
+		if (entry->cbaddr && entry->designer_code == cur_target->designer_code &&
+			entry->part_id == cur_target->part_id && entry->image_hash == image_hash)
+			return entry;
+	}
+	return NULL;
+}
+
+static uint32_t rtt_cb_locate(target *cur_target)
+{
+	const uint32_t image_hash = rtt_image_hash(cur_target);
+	rtt_cb_cache_entry_s *entry = rtt_cb_cache_lookup(cur_target, image_hash);
+
+	/* verify the known addresses before scanning all of ram */
+	if (entry && rtt_cb_at(cur_target, entry->cbaddr))
+		return entry->cbaddr;
+	if (rtt_cb_at(cur_target, rtt_cbaddr))
 		return rtt_cbaddr;
 
-	for (struct target_ram *r = cur_target->ram; r; r = r->next) {
-		uint32_t ram_end = r->start + r->length;
-		for (uint32_t addr = r->start; addr < ram_end; addr += sizeof(srch_buf) - srch_str_len - 1) {
-			uint32_t buf_siz = MIN(ram_end - addr, sizeof(srch_buf));
-			if (target_mem_read(cur_target, srch_buf, addr, buf_siz)) {
-				gdb_outf("rtt: read fail at 0x%" PRIx32 "\r\n", addr);
-				continue;
-			}
-			for (uint32_t offset = 0; offset + srch_str_len + 1 < buf_siz; offset++) {
-				if (strncmp((const char *)(srch_buf + offset), srch_str, srch_str_len) == 0) {
-					uint32_t cb_addr = addr + offset;
-					return cb_addr;
-				}
-			}
-		}
+	uint32_t len;
+	const uint8_t *const pattern = rtt_pattern(&len);
+	const uint32_t cbaddr = rtt_search(cur_target, pattern, len);
+	if (!cbaddr)
+		return 0;
+
+	if (!entry) {
+		entry = &rtt_cb_cache[rtt_cb_cache_next];
+		rtt_cb_cache_next = (rtt_cb_cache_next + 1U) % RTT_CB_CACHE_SIZE;
+		entry->designer_code = cur_target->designer_code;
+		entry->part_id = cur_target->part_id;
+		entry->image_hash = image_hash;
 	}
-	return 0;
+	entry->cbaddr = cbaddr;
+	return cbaddr;
 }
 
 static void find_rtt(target *cur_target)
 {
 	rtt_found = false;
-	poll_ms = rtt_max_poll_ms;
-	poll_errs = 0;
+	rtt_poll_ms = rtt_max_poll_ms;
+	rtt_poll_errs = 0;
 	last_poll_ms = 0;
 
 	if (!cur_target || !rtt_enabled)
 		return;
 
-	if (rtt_ident[0] == 0)
-		rtt_cbaddr = fastsrch(cur_target);
-	else
-		rtt_cbaddr = memsrch(cur_target);
+	rtt_cbaddr = rtt_cb_locate(cur_target);
 	DEBUG_INFO("rtt: match at 0x%" PRIx32 "\r\n", rtt_cbaddr);
 
 	if (rtt_cbaddr) {
@@ -170,11 +254,11 @@ static void find_rtt(target *cur_target)
 		num_down_buf = num_buf[1];
 
 		if (num_up_buf > 255 || num_down_buf > 255) {
-			gdb_out("rtt: bad cblock\r\n");
+			rtt_report("rtt: bad cblock\r\n");
 			rtt_enabled = false;
 			return;
 		} else if (num_up_buf == 0 && num_down_buf == 0)
-			gdb_out("rtt: empty cblock\r\n");
+			rtt_report("rtt: empty cblock\r\n");
 
 		for (int32_t i = 0; i < MAX_RTT_CHAN; i++) {
 			uint32_t buf_desc[6];
@@ -234,43 +318,45 @@ static void find_rtt(target *cur_target)
 */
 
 /* poll if host has new data for target */
+/* host data bound for a down buffer, collected so the target sees at most two block writes per poll */
+static uint8_t rtt_down_buf[RTT_DOWN_BUF_SIZE] CCM_BSS;
+
 static rtt_retval read_rtt(target *cur_target, uint32_t i)
 {
-	uint32_t head_tail[2];
-	uint32_t buf_head;
-	uint32_t buf_tail;
-	uint32_t next_head;
-	int ch;
+	uint32_t buf_head = rtt_desc[i][RTT_DESC_HEAD];
+	uint32_t buf_tail = rtt_desc[i][RTT_DESC_TAIL];
+	int32_t ch;
 
 	/* copy data from recv_buf to target rtt 'down' buffer */
-	if (rtt_nodata())
+	if (rtt_nodata(i))
 		return RTT_IDLE;
 
 	if (cur_target == NULL || rtt_channel[i].is_output || rtt_channel[i].buf_addr == 0 || rtt_channel[i].buf_size == 0)
 		return RTT_IDLE;
 
-	/* read down buffer head and tail from target */
-	if (target_mem_read(cur_target, head_tail, rtt_channel[i].head_addr, sizeof(head_tail)))
-		return RTT_ERR;
-
-	buf_head = head_tail[0];
-	buf_tail = head_tail[1];
-
 	if (buf_head >= rtt_channel[i].buf_size || buf_tail >= rtt_channel[i].buf_size)
 		return RTT_ERR;
 
-	/* write recv_buf to target rtt 'down' buf */
-	while ((next_head = ((buf_head + 1) % rtt_channel[i].buf_size)) != buf_tail && (ch = rtt_getchar()) != -1) {
-		if (target_mem_write(cur_target, rtt_channel[i].buf_addr + buf_head, &ch, 1))
-			return RTT_ERR;
-
-		/* advance pointers */
-		buf_head = next_head;
-	}
+	/* drain recv_buf, up to the free space of the target rtt 'down' buf */
+	const uint32_t buf_free = (buf_tail + rtt_channel[i].buf_size - buf_head - 1U) % rtt_channel[i].buf_size;
+	uint32_t len = 0;
+	while (len < buf_free && len < sizeof(rtt_down_buf) && (ch = rtt_getchar(i)) != -1)
+		rtt_down_buf[len++] = (uint8_t)ch;
+	if (len == 0)
+		return RTT_IDLE;
 
-	/* update head of target 'down' buffer */
-	if (target_mem_write(cur_target, rtt_channel[i].head_addr, &buf_head, sizeof(buf_head)))
+	/* write as one block up to the end of the ring, and one more from its start if it wraps */
+	const uint32_t first = MIN(len, rtt_channel[i].buf_size - buf_head);
+	if (target_mem_write(cur_target, rtt_channel[i].buf_addr + buf_head, rtt_down_buf, first))
 		return RTT_ERR;
+	if (first < len && target_mem_write(cur_target, rtt_channel[i].buf_addr, rtt_down_buf + first, len - first))
+		return RTT_ERR;
+	buf_head = (buf_head + len) % rtt_channel[i].buf_size;
+	rtt_stats[i].bytes += len;
+
+	/* head of target 'down' buffer is written back at the end of the poll */
+	rtt_desc[i][RTT_DESC_HEAD] = buf_head;
+	rtt_desc_dirty |= 1U << i;
 	return RTT_OK;
 }
 
@@ -307,74 +393,245 @@ int target_aligned_mem_read(target *t, void *dest, target_addr_t src, size_t len
 /* poll if target has new data for host */
 static rtt_retval print_rtt(target *cur_target, uint32_t i)
 {
-	uint32_t head;
-	uint32_t tail;
+	uint32_t head = rtt_desc[i][RTT_DESC_HEAD];
+	uint32_t tail = rtt_desc[i][RTT_DESC_TAIL];
 
 	if (!cur_target || !rtt_channel[i].is_output || rtt_channel[i].buf_addr == 0 || rtt_channel[i].head_addr == 0)
 		return RTT_IDLE;
 
-	uint32_t head_tail[2];
-	if (target_mem_read(cur_target, head_tail, rtt_channel[i].head_addr, sizeof(head_tail)))
-		return RTT_ERR;
-	head = head_tail[0];
-	tail = head_tail[1];
-
 	if (head >= rtt_channel[i].buf_size || tail >= rtt_channel[i].buf_size)
 		return RTT_ERR;
 	else if (head == tail)
 		return RTT_IDLE;
 
-	uint32_t bytes_free = sizeof(xmit_buf) - 8; /* need 8 bytes for alignment and padding */
-	uint32_t bytes_read = 0;
-
-	if (tail > head) {
-		uint32_t len = rtt_channel[i].buf_size - tail;
+	/* read the ring straight into usb transmit buffers; when they are all in use the
+	   rest of the data stays in the target ring until the next poll */
+	const uint32_t start_tail = tail;
+	bool read_fail = false;
+	while (tail != head) {
+		uint32_t bytes_free;
+		char *const xmit_buf = rtt_up_reserve(i, &bytes_free);
+		if (!xmit_buf)
+			break;
+		uint32_t len = (tail > head ? rtt_channel[i].buf_size : head) - tail;
 		if (len > bytes_free)
 			len = bytes_free;
-		if (target_aligned_mem_read(cur_target, xmit_buf + bytes_read, rtt_channel[i].buf_addr + tail, len))
-			return RTT_ERR;
-		bytes_free -= len;
-		bytes_read += len;
+		if (target_aligned_mem_read(cur_target, xmit_buf, rtt_channel[i].buf_addr + tail, len)) {
+			read_fail = true;
+			break;
+		}
+		const uint32_t sent = rtt_up_commit(i, len);
+		rtt_stats[i].bytes += len;
+		rtt_stats[i].dropped += len - sent;
 		tail = (tail + len) % rtt_channel[i].buf_size;
 	}
-
-	if (head > tail && bytes_free > 0) {
-		uint32_t len = head - tail;
-		if (len > bytes_free)
-			len = bytes_free;
-		if (target_aligned_mem_read(cur_target, xmit_buf + bytes_read, rtt_channel[i].buf_addr + tail, len))
-			return RTT_ERR;
-		bytes_read += len;
-		tail = (tail + len) % rtt_channel[i].buf_size;
+	/* tail on target is written back at the end of the poll */
+	if (tail != start_tail) {
+		rtt_desc[i][RTT_DESC_TAIL] = tail;
+		rtt_desc_dirty |= 1U << i;
 	}
-
-	/* update tail on target */
-	if (target_mem_write(cur_target, rtt_channel[i].tail_addr, &tail, sizeof(tail)))
+	if (read_fail)
 		return RTT_ERR;
 
-	/* write buffer to usb */
-	rtt_write(xmit_buf, bytes_read);
-
 	return RTT_OK;
 }
 
 
 /*********************************************************************
 *
-*       target background memory access
+*       rtt channel state snapshot
 *
 **********************************************************************
 */
 
-/* target_no_background_memory_access() is true if the target needs to be halted during jtag memory access
-   target_no_background_memory_access() is false if the target allows jtag memory access while running */
+/* read the descriptors of channels 0..count-1 in one block transfer */
+static bool rtt_snapshot(target *cur_target, uint32_t count)
+{
+	rtt_desc_dirty = 0;
+	if (count == 0)
+		return true;
+	return !target_mem_read(cur_target, rtt_desc, rtt_cbaddr + 24, count * sizeof(rtt_desc[0]));
+}
 
-bool target_no_background_memory_access(target *cur_target)
+/* write back the offsets the probe owns: tail of 'up' buffers, head of 'down' buffers.
+   The other offset of each pair belongs to the target, so the writes can not be merged
+   into one block without racing it; they are issued back to back after all reads. */
+static bool rtt_writeback(target *cur_target)
 {
-	/* if error message is 'rtt: read fail at' add target to expression below.
-	   As a first approximation, assume all arm processors allow memory access while running, and no riscv does. */
-	bool riscv_core = cur_target && target_core_name(cur_target) && strstr(target_core_name(cur_target), "RVDBG");
-	return riscv_core;
+	bool ok = true;
+	for (uint32_t i = 0; rtt_desc_dirty != 0; i++, rtt_desc_dirty >>= 1) {
+		if (!(rtt_desc_dirty & 1U))
+			continue;
+		if (rtt_channel[i].is_output)
+			ok &= !target_mem_write(cur_target, rtt_channel[i].tail_addr, &rtt_desc[i][RTT_DESC_TAIL], sizeof(uint32_t));
+		else
+			ok &= !target_mem_write(cur_target, rtt_channel[i].head_addr, &rtt_desc[i][RTT_DESC_HEAD], sizeof(uint32_t));
+	}
+	return ok;
+}
+
+/*********************************************************************
+*
+*       live watch
+*
+**********************************************************************
+*/
+
+/* variables closer together than this are read as one block, the bytes in between are thrown away */
+#define LIVE_WATCH_MERGE_GAP 16U
+#define LIVE_WATCH_BUF_SIZE  (MAX_LIVE_WATCH * (8U + LIVE_WATCH_MERGE_GAP))
+
+struct live_watch_struct live_watch[MAX_LIVE_WATCH];
+uint32_t live_watch_count = 0;
+uint32_t live_watch_period_ms = 10; /* 100 samples a second */
+uint32_t live_watch_blocks = 0;
+uint32_t live_watch_samples;
+uint32_t live_watch_dropped;
+uint32_t live_watch_errs;
+static uint32_t live_watch_next_ms;
+static bool live_watch_partial; /* last sample line was cut short */
+
+/* the block reads covering all variables, and where each variable lands in the sample buffer */
+static struct {
+	uint32_t addr;
+	uint32_t len;
+	uint32_t offset;
+} live_watch_block[MAX_LIVE_WATCH];
+static uint32_t live_watch_offset[MAX_LIVE_WATCH];
+static uint8_t live_watch_buf[LIVE_WATCH_BUF_SIZE + 8U] CCM_BSS; /* 8 bytes for alignment and padding */
+
+/* merge neighbouring variables into as few block reads as possible */
+static void live_watch_plan(void)
+{
+	uint32_t used = 0;
+	live_watch_blocks = 0;
+	for (uint32_t i = 0; i < live_watch_count; i++) {
+		const uint32_t addr = live_watch[i].addr;
+		const uint32_t end = addr + live_watch[i].size;
+		if (live_watch_blocks) {
+			uint32_t *const len = &live_watch_block[live_watch_blocks - 1U].len;
+			const uint32_t block_addr = live_watch_block[live_watch_blocks - 1U].addr;
+			const uint32_t block_end = block_addr + *len;
+			if (addr <= block_end + LIVE_WATCH_MERGE_GAP) {
+				if (end > block_end) {
+					used += end - block_end;
+					*len = end - block_addr;
+				}
+				live_watch_offset[i] = live_watch_block[live_watch_blocks - 1U].offset + addr - block_addr;
+				continue;
+			}
+		}
+		live_watch_block[live_watch_blocks].addr = addr;
+		live_watch_block[live_watch_blocks].len = live_watch[i].size;
+		live_watch_block[live_watch_blocks].offset = used;
+		live_watch_offset[i] = used;
+		used += live_watch[i].size;
+		live_watch_blocks++;
+	}
+}
+
+bool live_watch_add(const uint32_t addr, const uint32_t size)
+{
+	if (live_watch_count >= MAX_LIVE_WATCH || (size != 1U && size != 2U && size != 4U && size != 8U))
+		return false;
+	/* keep the list sorted, so merging only has to look at the previous block */
+	uint32_t i = live_watch_count;
+	for (; i > 0 && live_watch[i - 1U].addr > addr; i--)
+		live_watch[i] = live_watch[i - 1U];
+	live_watch[i].addr = addr;
+	live_watch[i].size = size;
+	live_watch_count++;
+	live_watch_plan();
+	live_watch_samples = 0;
+	live_watch_dropped = 0;
+	live_watch_errs = 0;
+	return true;
+}
+
+void live_watch_clear(void)
+{
+	live_watch_count = 0;
+	live_watch_blocks = 0;
+}
+
+static bool live_watch_due(const uint32_t now)
+{
+	if (!live_watch_count || (int32_t)(now - live_watch_next_ms) < 0)
+		return false;
+	/* fixed rate; after a stall, pick up from now rather than sending a burst of late samples */
+	live_watch_next_ms += live_watch_period_ms;
+	if ((int32_t)(now - live_watch_next_ms) >= 0)
+		live_watch_next_ms = now + live_watch_period_ms;
+	return true;
+}
+
+static char *live_watch_hex(char *p, const uint8_t *const value, const uint32_t size)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	/* target is little endian, print most significant byte first */
+	for (uint32_t i = size; i > 0; i--) {
+		*p++ = hexdigits[value[i - 1U] >> 4U];
+		*p++ = hexdigits[value[i - 1U] & 0xfU];
+	}
+	return p;
+}
+
+/* send a line, split over as many transmit buffers as it takes */
+static void live_watch_send(const char *line, uint32_t len)
+{
+	while (len) {
+		uint32_t bytes_free;
+		char *const xmit_buf = rtt_up_reserve(LIVE_WATCH_CHAN, &bytes_free);
+		if (!xmit_buf) {
+			live_watch_partial = true;
+			live_watch_dropped++;
+			return;
+		}
+		const uint32_t chunk = len < bytes_free ? len : bytes_free;
+		memcpy(xmit_buf, line, chunk);
+		if (rtt_up_commit(LIVE_WATCH_CHAN, chunk) != chunk) {
+			live_watch_partial = true;
+			live_watch_dropped++;
+			return;
+		}
+		line += chunk;
+		len -= chunk;
+	}
+	live_watch_samples++;
+}
+
+/* one sample: "<ms> <value> <value> ...", values in hex in address order */
+static void live_watch_sample(target *cur_target, const uint32_t now)
+{
+	for (uint32_t i = 0; i < live_watch_blocks; i++) {
+		if (target_aligned_mem_read(cur_target, live_watch_buf + live_watch_block[i].offset,
+				live_watch_block[i].addr, live_watch_block[i].len)) {
+			live_watch_errs++;
+			return;
+		}
+	}
+
+	char line[2U + 10U + MAX_LIVE_WATCH * 17U + 1U];
+	char *p = line;
+	/* a cut short line is terminated first, so the consumer can throw it away */
+	if (live_watch_partial)
+		*p++ = '\n';
+	live_watch_partial = false;
+	char digits[10];
+	uint32_t n = 0;
+	uint32_t ms = now;
+	do {
+		digits[n++] = '0' + ms % 10U;
+		ms /= 10U;
+	} while (ms);
+	while (n)
+		*p++ = digits[--n];
+	for (uint32_t i = 0; i < live_watch_count; i++) {
+		*p++ = ' ';
+		p = live_watch_hex(p, live_watch_buf + live_watch_offset[i], live_watch[i].size);
+	}
+	*p++ = '\n';
+	live_watch_send(line, p - line);
 }
 
 /*********************************************************************
@@ -384,21 +641,84 @@ bool target_no_background_memory_access(target *cur_target)
 **********************************************************************
 */
 
+/* rtt i/o on all enabled channels */
+static void rtt_poll_channels(target *cur_target)
+{
+	bool rtt_err = false;
+	bool rtt_busy = false;
+
+	if (!rtt_found)
+		/* find rtt control block in target memory */
+		find_rtt(cur_target);
+	/* do rtt i/o if control block found */
+	if (rtt_found) {
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < MAX_RTT_CHAN; i++)
+			if (rtt_channel[i].is_enabled && rtt_channel[i].is_configured)
+				count = i + 1;
+		bool snapshot_ok = rtt_snapshot(cur_target, count);
+		if (!snapshot_ok)
+			rtt_err = true;
+		for (uint32_t i = 0; snapshot_ok && i < count; i++) {
+			rtt_retval v;
+			if (rtt_channel[i].is_enabled && rtt_channel[i].is_configured) {
+				if (rtt_channel[i].is_output)
+					v = print_rtt(cur_target, i);
+				else
+					v = read_rtt(cur_target, i);
+				rtt_stats[i].polls++;
+				if (v == RTT_OK) rtt_busy = true;
+				else if (v == RTT_ERR) rtt_err = true;
+				else rtt_stats[i].empty_polls++;
+			}
+		}
+		if (!rtt_writeback(cur_target))
+			rtt_err = true;
+	}
+
+	/* rtt polling frequency goes up and down with rtt activity */
+	if (rtt_busy && !rtt_err)
+		rtt_poll_ms /= 2;
+	else
+		rtt_poll_ms *= 2;
+
+	if (rtt_poll_ms > rtt_max_poll_ms)
+		rtt_poll_ms = rtt_max_poll_ms;
+	else if (rtt_poll_ms < rtt_min_poll_ms)
+		rtt_poll_ms = rtt_min_poll_ms;
+
+	if (rtt_err) {
+		rtt_report("rtt: err\r\n");
+		rtt_poll_errs++;
+		if (rtt_max_poll_errs != 0 && rtt_poll_errs > rtt_max_poll_errs) {
+			rtt_report("\r\nrtt lost\r\n");
+			rtt_enabled = false;
+		}
+	}
+}
+
 void poll_rtt(target *cur_target)
 {
-	/* rtt off */
-	if (!cur_target || !rtt_enabled)
+	/* rtt and live watch off */
+	if (!cur_target || (!rtt_enabled && !live_watch_count))
 		return;
-	/* target present and rtt enabled */
+#if PC_HOSTED == 1
+	/* a probe that polls rtt itself only has its stream forwarded, live watch stays here */
+	const bool rtt_here =
+		rtt_enabled && (target_no_background_memory_access(cur_target) || !platform_rtt_offload(cur_target));
+#else
+	const bool rtt_here = rtt_enabled;
+#endif
+	/* target present and rtt enabled or variables watched */
 	uint32_t now = platform_time_ms();
-	bool rtt_err = false;
-	bool rtt_busy = false;
+	const bool rtt_due = rtt_here && (last_poll_ms + rtt_poll_ms <= now || now < last_poll_ms);
+	const bool watch_due = live_watch_due(now);
 
-	if (last_poll_ms + poll_ms <= now || now < last_poll_ms) {
+	if (rtt_due || watch_due) {
 		target_addr_t watch;
 		enum target_halt_reason reason;
 		bool resume_target = false;
-		if (!rtt_found)
+		if (!rtt_found || !rtt_enabled)
 			/* check if target needs to be halted during memory access */
 			rtt_halt = target_no_background_memory_access(cur_target);
 		if (rtt_halt && target_halt_poll(cur_target, &watch) == TARGET_HALT_RUNNING) {
@@ -408,49 +728,17 @@ void poll_rtt(target *cur_target)
 				continue;
 			resume_target = reason == TARGET_HALT_REQUEST;
 		}
-		if (!rtt_found)
-			/* find rtt control block in target memory */
-			find_rtt(cur_target);
-		/* do rtt i/o if control block found */
-		if (rtt_found) {
-			for (uint32_t i = 0; i < MAX_RTT_CHAN; i++) {
-				rtt_retval v;
-				if (rtt_channel[i].is_enabled && rtt_channel[i].is_configured) {
-					if (rtt_channel[i].is_output)
-						v = print_rtt(cur_target, i);
-					else
-						v = read_rtt(cur_target, i);
-					if (v == RTT_OK) rtt_busy = true;
-					else if (v == RTT_ERR) rtt_err = true;
-				}
-			}
+		/* sample first, so the sample times are not skewed by rtt i/o */
+		if (watch_due)
+			live_watch_sample(cur_target, now);
+		if (rtt_due) {
+			rtt_poll_channels(cur_target);
+			/* update last poll time */
+			last_poll_ms = now;
 		}
 		/* continue target if halted */
 		if (resume_target)
 			target_halt_resume(cur_target, false);
-
-		/* update last poll time */
-		last_poll_ms = now;
-
-		/* rtt polling frequency goes up and down with rtt activity */
-		if (rtt_busy && !rtt_err)
-			poll_ms /= 2;
-		else
-			poll_ms *= 2;
-
-		if (poll_ms > rtt_max_poll_ms)
-			poll_ms = rtt_max_poll_ms;
-		else if (poll_ms < rtt_min_poll_ms)
-			poll_ms = rtt_min_poll_ms;
-
-		if (rtt_err) {
-			gdb_out("rtt: err\r\n");
-			poll_errs++;
-			if (rtt_max_poll_errs != 0 && poll_errs > rtt_max_poll_errs) {
-				gdb_out("\r\nrtt lost\r\n");
-				rtt_enabled = false;
-			}
-		}
 	}
 	return;
 }
@@ -0,0 +1,257 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This file implements the standalone programmer. The image is captured into
+ * the probe's storage from a known good target with "monitor standalone
+ * capture". From then on, whenever no debugger has a target attached, the
+ * target voltage appearing or the button being pressed starts a cycle: scan,
+ * attach, differential flash of the image and a CRC verify. The error LED
+ * stays dark on a pass and blinks FAIL in morse otherwise.
+ */
+
+#include "general.h"
+#include "standalone.h"
+#include "target_internal.h"
+#include "exception.h"
+#include "gdb_packet.h"
+#include "morse.h"
+#include "crc32.h"
+
+#ifdef PLATFORM_HAS_STANDALONE
+
+#define STANDALONE_IMAGE_OFFSET PLATFORM_STORE_ERASE_SIZE
+#define STANDALONE_CHUNK        256U
+#define STANDALONE_POLL_MS      100U
+/* Target voltage that counts as powered, in 0.1V */
+#define STANDALONE_VOLTAGE_MIN  15U
+
+typedef enum standalone_result {
+	STANDALONE_NONE,
+	STANDALONE_PASS,
+	STANDALONE_NO_IMAGE,
+	STANDALONE_NO_TARGET,
+	STANDALONE_WRONG_TARGET,
+	STANDALONE_FLASH_FAILED,
+	STANDALONE_VERIFY_FAILED,
+} standalone_result_e;
+
+static const char *const standalone_result_str[] = {
+	[STANDALONE_NONE] = "none yet",
+	[STANDALONE_PASS] = "pass",
+	[STANDALONE_NO_IMAGE] = "no image stored",
+	[STANDALONE_NO_TARGET] = "no target found",
+	[STANDALONE_WRONG_TARGET] = "target does not match the image",
+	[STANDALONE_FLASH_FAILED] = "flashing failed",
+	[STANDALONE_VERIFY_FAILED] = "verify failed",
+};
+
+static uint8_t standalone_buf[STANDALONE_CHUNK];
+static standalone_result_e last_result;
+static uint32_t cycles;
+static uint32_t passes;
+static platform_timeout poll_timeout;
+static bool target_powered;
+static bool button_down;
+
+static void standalone_printf(struct target_controller *tc, const char *fmt, va_list ap)
+{
+	(void)tc;
+	(void)fmt;
+	(void)ap;
+}
+
+static struct target_controller standalone_controller = {
+	.printf = standalone_printf,
+};
+
+static uint32_t standalone_check(const standalone_header_s *header)
+{
+	return ~(header->magic ^ header->addr ^ header->size ^ header->crc);
+}
+
+static bool standalone_header_read(standalone_header_s *header)
+{
+	const size_t store_size = platform_store_size();
+	return store_size > STANDALONE_IMAGE_OFFSET && platform_store_read(0, header, sizeof(*header)) &&
+		header->magic == STANDALONE_MAGIC && header->version == STANDALONE_VERSION &&
+		header->check == standalone_check(header) && header->size &&
+		header->size <= store_size - STANDALONE_IMAGE_OFFSET;
+}
+
+static target *standalone_find_target(const standalone_header_s *header)
+{
+	for (target *t = target_list; t; t = t->next) {
+		if (!header->part_id || (t->designer_code == header->designer_code && t->part_id == header->part_id))
+			return t;
+	}
+	return NULL;
+}
+
+static standalone_result_e standalone_flash(target *t, const standalone_header_s *header)
+{
+	t->flash_diff = true;
+	if (!target_flash_erase(t, header->addr, header->size))
+		return STANDALONE_FLASH_FAILED;
+	for (uint32_t offset = 0; offset < header->size; offset += STANDALONE_CHUNK) {
+		const size_t len = MIN(STANDALONE_CHUNK, header->size - offset);
+		if (!platform_store_read(STANDALONE_IMAGE_OFFSET + offset, standalone_buf, len) ||
+			!target_flash_write(t, header->addr + offset, standalone_buf, len))
+			return STANDALONE_FLASH_FAILED;
+	}
+	if (!target_flash_complete(t))
+		return STANDALONE_FLASH_FAILED;
+	uint32_t crc;
+	if (generic_crc32(t, &crc, header->addr, header->size) || crc != header->crc)
+		return STANDALONE_VERIFY_FAILED;
+	return STANDALONE_PASS;
+}
+
+static standalone_result_e standalone_cycle(void)
+{
+	standalone_header_s header;
+	if (!standalone_header_read(&header))
+		return STANDALONE_NO_IMAGE;
+	if (connect_assert_nrst)
+		platform_nrst_set_val(true); /* will be deasserted after attach */
+	/* SW-DP first, as most parts are programmed over it, then JTAG */
+	if (!adiv5_swdp_scan(0) && !jtag_scan(NULL))
+		return STANDALONE_NO_TARGET;
+	target *const found = standalone_find_target(&header);
+	if (!found)
+		return STANDALONE_WRONG_TARGET;
+	target *const t = target_attach(found, &standalone_controller);
+	if (!t)
+		return STANDALONE_NO_TARGET;
+	const standalone_result_e result = standalone_flash(t, &header);
+	if (result == STANDALONE_PASS)
+		target_reset(t);
+	target_detach(t);
+	return result;
+}
+
+bool standalone_program(void)
+{
+	SET_RUN_STATE(1);
+	SET_ERROR_STATE(0);
+	morse(NULL, false);
+	volatile standalone_result_e result = STANDALONE_NO_TARGET;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = standalone_cycle();
+	}
+	target_list_free();
+	platform_target_clk_output_enable(false);
+	platform_nrst_set_val(false);
+	SET_RUN_STATE(0);
+	last_result = result;
+	++cycles;
+	if (result == STANDALONE_PASS) {
+		++passes;
+		return true;
+	}
+	morse("FAIL.", true);
+	return false;
+}
+
+void standalone_poll(void)
+{
+	if (!platform_timeout_is_expired(&poll_timeout))
+		return;
+	platform_timeout_set(&poll_timeout, STANDALONE_POLL_MS);
+	/* A target being plugged in or the button going down starts a cycle, holding either does not */
+	const bool powered = platform_target_voltage_sense() >= STANDALONE_VOLTAGE_MIN;
+	const bool pressed = platform_button_pressed();
+	const bool start = (powered && !target_powered) || (pressed && !button_down);
+	target_powered = powered;
+	button_down = pressed;
+	if (start && platform_store_size())
+		standalone_program();
+}
+
+bool standalone_capture(target *t, const uint32_t addr, const uint32_t size)
+{
+	const size_t store_size = platform_store_size();
+	if (store_size <= STANDALONE_IMAGE_OFFSET || size > store_size - STANDALONE_IMAGE_OFFSET) {
+		gdb_outf("The image does not fit the %u bytes of storage\n", (unsigned)store_size);
+		return false;
+	}
+	const target_flash_s *const f = target_flash_for_addr(t, addr);
+	const uint8_t erased = f ? f->erased : 0xffU;
+	/* The header goes last, so a capture cut short leaves no image behind */
+	if (!platform_store_erase(0, STANDALONE_IMAGE_OFFSET + size))
+		return false;
+	uint32_t used = 0;
+	for (uint32_t offset = 0; offset < size; offset += STANDALONE_CHUNK) {
+		const size_t len = MIN(STANDALONE_CHUNK, size - offset);
+		if (target_mem_read(t, standalone_buf, addr + offset, len) ||
+			!platform_store_write(STANDALONE_IMAGE_OFFSET + offset, standalone_buf, len))
+			return false;
+		for (size_t i = len; i > 0; --i) {
+			if (standalone_buf[i - 1U] != erased) {
+				used = offset + i;
+				break;
+			}
+		}
+	}
+	if (!used) {
+		gdb_out("Nothing but erased memory to capture\n");
+		return false;
+	}
+	standalone_header_s header = {
+		.magic = STANDALONE_MAGIC,
+		.version = STANDALONE_VERSION,
+		.addr = addr,
+		.size = MIN((used + 3U) & ~3U, size),
+		.designer_code = t->designer_code,
+		.part_id = t->part_id,
+	};
+	strncpy(header.driver, t->driver, sizeof(header.driver) - 1U);
+	if (generic_crc32(t, &header.crc, header.addr, header.size))
+		return false;
+	header.check = standalone_check(&header);
+	if (!platform_store_write(0, &header, sizeof(header)))
+		return false;
+	gdb_outf("Stored %" PRIu32 " bytes from 0x%08" PRIx32 " for %s, CRC 0x%08" PRIx32 "\n", header.size,
+		header.addr, header.driver, header.crc);
+	return true;
+}
+
+bool standalone_erase(void)
+{
+	return platform_store_size() && platform_store_erase(0, PLATFORM_STORE_ERASE_SIZE);
+}
+
+void standalone_status(void)
+{
+	const size_t store_size = platform_store_size();
+	if (!store_size) {
+		gdb_out("No image storage fitted\n");
+		return;
+	}
+	gdb_outf("Storage: %u bytes\n", (unsigned)store_size);
+	standalone_header_s header;
+	if (standalone_header_read(&header))
+		gdb_outf("Image: %" PRIu32 " bytes at 0x%08" PRIx32 " for %s, CRC 0x%08" PRIx32 "\n", header.size,
+			header.addr, header.part_id ? header.driver : "any target", header.crc);
+	else
+		gdb_out("Image: none\n");
+	gdb_outf("Cycles: %" PRIu32 ", %" PRIu32 " passed, last: %s\n", cycles, passes,
+		standalone_result_str[last_result]);
+}
+
+#endif /* PLATFORM_HAS_STANDALONE */
@@ -44,6 +44,9 @@
 #define ARM_AP_TYPE_AXI  4
 #define ARM_AP_TYPE_AHB5 5
 
+/* ROM table entries read with a single memory access */
+#define ADIV5_ROM_ENTRY_BATCH 8U
+
 /* ROM table CIDR values */
 #define CIDR0_OFFSET 0xFF0 /* DBGCID0 */
 #define CIDR1_OFFSET 0xFF4 /* DBGCID1 */
@@ -304,21 +307,93 @@ static uint32_t adiv5_mem_read32(ADIv5_AP_t *ap, uint32_t addr)
 	return ret;
 }
 
-static uint32_t adiv5_ap_read_id(ADIv5_AP_t *ap, uint32_t addr)
+/* PIDR4-7 are directly followed by PIDR0-3, so fetch all eight in one access */
+uint64_t adiv5_ap_read_pidr(ADIv5_AP_t *ap, uint32_t addr)
 {
-	uint32_t res = 0;
-	uint8_t data[16];
-	adiv5_mem_read(ap, data, addr, sizeof(data));
-	for (size_t i = 0; i < 4; ++i)
-		res |= (data[4U * i] << (i * 8U));
-	return res;
+	uint8_t data[32];
+	adiv5_mem_read(ap, data, addr + PIDR4_OFFSET, sizeof(data));
+	uint64_t pidr = 0;
+	for (size_t i = 0; i < 8; ++i)
+		pidr |= (uint64_t)data[4U * ((i + 4U) & 7U)] << (i * 8U);
+	return pidr;
 }
 
-uint64_t adiv5_ap_read_pidr(ADIv5_AP_t *ap, uint32_t addr)
+/* Identification registers of a component, from DEVARCH at 0xFBC through CIDR3 at 0xFFC */
+#define ADIV5_COMPONENT_ID_WORDS ((CIDR3_OFFSET + 4U - DEVARCH_OFFSET) / 4U)
+
+typedef struct adiv5_component_ids {
+	uint32_t cidr;
+	uint64_t pidr;
+	uint32_t devtype;
+	uint32_t devarch;
+} adiv5_component_ids_s;
+
+/* Fetch all of a component's identification registers in one block access */
+static void adiv5_component_read_ids(ADIv5_AP_t *ap, uint32_t addr, adiv5_component_ids_s *ids)
 {
-	uint64_t pidr = adiv5_ap_read_id(ap, addr + PIDR4_OFFSET);
-	pidr = pidr << 32 | adiv5_ap_read_id(ap, addr + PIDR0_OFFSET);
-	return pidr;
+	uint32_t data[ADIV5_COMPONENT_ID_WORDS];
+	adiv5_mem_read(ap, data, addr + DEVARCH_OFFSET, sizeof(data));
+	ids->devarch = data[0];
+	ids->devtype = data[(DEVTYPE_OFFSET - DEVARCH_OFFSET) / 4U];
+	/* PIDR4-7 come before PIDR0-3 */
+	const uint32_t *const pidr = data + (PIDR4_OFFSET - DEVARCH_OFFSET) / 4U;
+	ids->pidr = 0;
+	for (size_t i = 0; i < 8U; ++i)
+		ids->pidr |= (uint64_t)(pidr[(i + 4U) & 7U] & 0xffU) << (i * 8U);
+	const uint32_t *const cidr = data + (CIDR0_OFFSET - DEVARCH_OFFSET) / 4U;
+	ids->cidr = 0;
+	for (size_t i = 0; i < 4U; ++i)
+		ids->cidr |= (cidr[i] & 0xffU) << (i * 8U);
+}
+
+/*
+ * ROM table topology found on earlier scans, keyed by the DP and AP identity. A rescan
+ * of the same part only reads back the identification of the AP's root table to check it
+ * is unchanged, then goes straight to the probe routines for the cores found last time.
+ * Walks that faulted part way are not kept, so powered down parts of a SoC are looked
+ * for again.
+ */
+#define ADIV5_TOPOLOGY_CACHE_SIZE 4U
+#define ADIV5_TOPOLOGY_MAX_CORES  4U
+
+typedef struct adiv5_topology {
+	bool valid;
+	/* DP and AP identity */
+	uint16_t dp_designer_code;
+	uint16_t dp_partno;
+	uint16_t target_designer_code;
+	uint16_t target_partno;
+	uint8_t instance;
+	uint8_t apsel;
+	uint32_t idr;
+	uint32_t base;
+	/* root table identification, to revalidate against */
+	uint32_t root_cidr;
+	uint64_t root_pidr;
+	uint16_t designer_code;
+	uint16_t partno;
+	/* the cores found, to probe again */
+	uint8_t core_count;
+	struct {
+		uint8_t arch;
+		uint32_t addr;
+	} cores[ADIV5_TOPOLOGY_MAX_CORES];
+} adiv5_topology_s;
+
+static adiv5_topology_s adiv5_topology_cache[ADIV5_TOPOLOGY_CACHE_SIZE];
+static size_t adiv5_topology_next;
+/* the entry the current walk is being recorded in, if any */
+static adiv5_topology_s *adiv5_topology_recording;
+
+/* A raw access to the AP that SELECT points at, keeping its CSW and TAR shadows up to date */
+static uint32_t adiv5_ap_low_access(ADIv5_AP_t *ap, uint8_t RnW, uint16_t addr, uint32_t value)
+{
+	const uint32_t result = adiv5_dp_low_access(ap->dp, RnW, addr, value);
+	if (RnW == ADIV5_LOW_WRITE)
+		adiv5_ap_shadow_write(ap, addr, value);
+	else
+		adiv5_ap_shadow_read(ap, addr);
+	return result;
 }
 
 /* Halt CortexM
@@ -335,13 +410,23 @@ static uint32_t cortexm_initial_halt(ADIv5_AP_t *ap)
 	const uint32_t dhcsr_valid = CORTEXM_DHCSR_S_HALT | CORTEXM_DHCSR_C_DEBUGEN;
 	const bool use_low_access = !ap->dp->mindp;
 
+	/* A core left halted with debug enabled, by an earlier session say, needs no halt loop */
+	if (!connect_assert_nrst) {
+		uint32_t dhcsr = 0;
+		if (adiv5_mem_read_status(ap, &dhcsr, CORTEXM_DHCSR, sizeof(dhcsr)) == ADIV5_STATUS_OK &&
+			dhcsr != 0xffffffffU && !(dhcsr & 0xf000fff0U) &&
+			!(dhcsr & CORTEXM_DHCSR_S_RESET_ST) && (dhcsr & dhcsr_valid) == dhcsr_valid)
+			return dhcsr;
+		ap->dp->fault = 0;
+	}
+
 	platform_timeout halt_timeout;
 	platform_timeout_set(&halt_timeout, cortexm_wait_timeout);
 
 	if (use_low_access) {
 		/* ap_mem_access_setup() sets ADIV5_AP_CSW_ADDRINC_SINGLE -> unusable!*/
 		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+		adiv5_ap_write(ap, ADIV5_AP_TAR, CORTEXM_DHCSR);
 	}
 
 	/* Workaround for CMSIS-DAP Bulk orbtrace
@@ -357,15 +442,23 @@ static uint32_t cortexm_initial_halt(ADIv5_AP_t *ap)
 		uint32_t dhcsr;
 
 		if (use_low_access) {
-			adiv5_dp_low_access(
-				ap->dp, ADIV5_LOW_WRITE, ADIV5_DP_CTRLSTAT, ctrlstat | (trncnt * ADIV5_DP_CTRLSTAT_TRNCNT));
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, dhcsr_ctl);
+			adiv5_dp_queue_write(ap->dp, ADIV5_DP_CTRLSTAT, ctrlstat | (trncnt * ADIV5_DP_CTRLSTAT_TRNCNT));
+			adiv5_dp_queue_write(ap->dp, ADIV5_AP_DRW, dhcsr_ctl);
+			adiv5_ap_shadow_write(ap, ADIV5_AP_DRW, dhcsr_ctl);
 			if (trncnt < 0xfffU) {
 				trncnt += (platform_time_ms() - start_time) * 8U;
 			} else {
 				trncnt = 0xfffU;
 			}
-			dhcsr = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+#if PC_HOSTED == 1
+			if (ap->dp->queue_flush) {
+				/* The probe resolves the posted read, so each attempt is one round trip */
+				adiv5_dp_queue_read(ap->dp, ADIV5_AP_DRW, &dhcsr);
+				adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
+				adiv5_queue_flush(ap->dp);
+			} else
+#endif
+				dhcsr = adiv5_ap_low_access(ap, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
 		} else {
 			adiv5_mem_write(ap, CORTEXM_DHCSR, &dhcsr_ctl, sizeof(dhcsr_ctl));
 			dhcsr = adiv5_mem_read32(ap, CORTEXM_DHCSR);
@@ -431,6 +524,7 @@ static bool cortexm_prepare(ADIv5_AP_t *ap)
 	platform_timeout reset_timeout;
 	platform_timeout_set(&reset_timeout, cortexm_wait_timeout);
 	platform_nrst_set_val(false);
+	adiv5_shadow_invalidate(ap->dp);
 	while (true) {
 		dhcsr = adiv5_mem_read32(ap, CORTEXM_DHCSR);
 		if (!(dhcsr & CORTEXM_DHCSR_S_RESET_ST))
@@ -443,6 +537,37 @@ static bool cortexm_prepare(ADIv5_AP_t *ap)
 	return true;
 }
 
+/* Stop recording the current walk, it did not see all of the topology */
+static void adiv5_topology_abandon(void)
+{
+	if (adiv5_topology_recording)
+		adiv5_topology_recording->valid = false;
+	adiv5_topology_recording = NULL;
+}
+
+static void adiv5_topology_add(const enum arm_arch arch, const uint32_t addr)
+{
+	adiv5_topology_s *const topology = adiv5_topology_recording;
+	if (!topology)
+		return;
+	if (topology->core_count == ADIV5_TOPOLOGY_MAX_CORES) {
+		adiv5_topology_abandon();
+		return;
+	}
+	topology->cores[topology->core_count].arch = arch;
+	topology->cores[topology->core_count].addr = addr;
+	++topology->core_count;
+}
+
+static bool adiv5_topology_matches(const adiv5_topology_s *const topology, const ADIv5_AP_t *const ap)
+{
+	const ADIv5_DP_t *const dp = ap->dp;
+	return topology->valid && topology->dp_designer_code == dp->designer_code && topology->dp_partno == dp->partno &&
+	       topology->target_designer_code == dp->target_designer_code && topology->target_partno == dp->target_partno &&
+	       topology->instance == dp->instance && topology->apsel == ap->apsel && topology->idr == ap->idr &&
+	       topology->base == ap->base;
+}
+
 /* Return true if we find a debuggable device.*/
 static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t recursion, const uint32_t num_entry)
 {
@@ -452,11 +577,18 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 	if (addr == 0)       /* No rom table on this AP */
 		return;
 
-	const volatile uint32_t cidr = adiv5_ap_read_id(ap, addr + CIDR0_OFFSET);
+	adiv5_component_ids_s ids;
+	adiv5_component_read_ids(ap, addr, &ids);
+	const uint32_t cidr = ids.cidr;
 	if (ap->dp->fault) {
 		DEBUG_WARN("CIDR read timeout on AP%d, aborting.\n", ap->apsel);
+		adiv5_topology_abandon();
 		return;
 	}
+	if (recursion == 0 && adiv5_topology_recording) {
+		adiv5_topology_recording->root_cidr = ids.cidr;
+		adiv5_topology_recording->root_pidr = ids.pidr;
+	}
 	if ((cidr & ~CID_CLASS_MASK) != CID_PREAMBLE)
 		return;
 
@@ -470,6 +602,7 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 
 	if (adiv5_dp_error(ap->dp)) {
 		DEBUG_WARN("%sFault reading ID registers\n", indent);
+		adiv5_topology_abandon();
 		return;
 	}
 
@@ -482,7 +615,7 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 
 	/* Extract Component ID class nibble */
 	const uint32_t cid_class = (cidr & CID_CLASS_MASK) >> CID_CLASS_SHIFT;
-	const uint64_t pidr = adiv5_ap_read_pidr(ap, addr);
+	const uint64_t pidr = ids.pidr;
 
 	uint16_t designer_code;
 	if (pidr & PIDR_JEP106_USED) {
@@ -512,6 +645,10 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 		if (recursion == 0) {
 			ap->designer_code = designer_code;
 			ap->partno = part_number;
+			if (adiv5_topology_recording) {
+				adiv5_topology_recording->designer_code = designer_code;
+				adiv5_topology_recording->partno = part_number;
+			}
 
 			if (ap->designer_code == JEP106_MANUFACTURER_ATMEL && ap->partno == 0xcd0) {
 				uint32_t ctrlstat = adiv5_mem_read32(ap, SAMX5X_DSU_CTRLSTAT);
@@ -520,6 +657,7 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 					 * Handle it here, as access only to limited memory region
 					 * is allowed
 					 */
+					adiv5_topology_add(aa_cortexm, addr);
 					cortexm_probe(ap);
 					return;
 				}
@@ -537,13 +675,25 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 		DEBUG_INFO("ROM: Table BASE=0x%" PRIx32 " SYSMEM=0x%08" PRIx32 ", Manufacturer %3x Partno %3x\n", addr, memtype,
 			designer_code, part_number);
 #endif
+		uint32_t entries[ADIV5_ROM_ENTRY_BATCH];
 		for (size_t i = 0; i < 960; i++) {
-			adiv5_dp_error(ap->dp);
+			const size_t batch_index = i % ADIV5_ROM_ENTRY_BATCH;
+			/* Fetch the entries a batch at a time, falling back to single reads if a batch faults */
+			if (batch_index == 0) {
+				adiv5_dp_error(ap->dp);
+				adiv5_mem_read(ap, entries, addr + i * 4, sizeof(entries));
+				if (adiv5_dp_error(ap->dp))
+					memset(entries, 0xff, sizeof(entries));
+			}
 
-			uint32_t entry = adiv5_mem_read32(ap, addr + i * 4);
-			if (adiv5_dp_error(ap->dp)) {
-				DEBUG_WARN("%sFault reading ROM table entry %d\n", indent, i);
-				break;
+			uint32_t entry = entries[batch_index];
+			if (entry == 0xffffffffU) {
+				entry = adiv5_mem_read32(ap, addr + i * 4);
+				if (adiv5_dp_error(ap->dp)) {
+					DEBUG_WARN("%sFault reading ROM table entry %d\n", indent, i);
+					adiv5_topology_abandon();
+					break;
+				}
 			}
 
 			if (entry == 0)
@@ -571,12 +721,10 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 		uint16_t arch_id = 0;
 		uint8_t dev_type = 0;
 		if (cid_class == cidc_dc) {
-			dev_type = adiv5_mem_read32(ap, addr + DEVTYPE_OFFSET) & DEVTYPE_MASK;
-
-			uint32_t devarch = adiv5_mem_read32(ap, addr + DEVARCH_OFFSET);
+			dev_type = ids.devtype & DEVTYPE_MASK;
 
-			if (devarch & DEVARCH_PRESENT) {
-				arch_id = devarch & DEVARCH_ARCHID_MASK;
+			if (ids.devarch & DEVARCH_PRESENT) {
+				arch_id = ids.devarch & DEVARCH_ARCHID_MASK;
 			}
 		}
 
@@ -601,10 +749,12 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 			switch (arm_component_lut[i].arch) {
 			case aa_cortexm:
 				DEBUG_INFO("%s-> cortexm_probe\n", indent + 1);
+				adiv5_topology_add(aa_cortexm, addr);
 				cortexm_probe(ap);
 				break;
 			case aa_cortexa:
 				DEBUG_INFO("%s-> cortexa_probe\n", indent + 1);
+				adiv5_topology_add(aa_cortexa, addr);
 				cortexa_probe(ap, addr);
 				break;
 			default:
@@ -622,6 +772,55 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 	}
 }
 
+/* Probe the cores behind an AP, from the topology cache when the root table checks out */
+static void adiv5_topology_probe(ADIv5_AP_t *const ap)
+{
+	adiv5_topology_s *topology = NULL;
+	for (size_t i = 0; i < ADIV5_TOPOLOGY_CACHE_SIZE; ++i) {
+		if (adiv5_topology_matches(&adiv5_topology_cache[i], ap)) {
+			topology = &adiv5_topology_cache[i];
+			break;
+		}
+	}
+
+	const uint32_t root = ap->base & 0xfffff000U;
+	if (topology && root) {
+		adiv5_component_ids_s ids;
+		adiv5_component_read_ids(ap, root, &ids);
+		if (!adiv5_dp_error(ap->dp) && ids.cidr == topology->root_cidr && ids.pidr == topology->root_pidr) {
+			DEBUG_INFO("AP %u: ROM table unchanged, probing %u cached cores\n", ap->apsel, topology->core_count);
+			ap->designer_code = topology->designer_code;
+			ap->partno = topology->partno;
+			for (size_t i = 0; i < topology->core_count; ++i) {
+				if (topology->cores[i].arch == aa_cortexm)
+					cortexm_probe(ap);
+				else
+					cortexa_probe(ap, topology->cores[i].addr);
+			}
+			return;
+		}
+	}
+
+	if (!topology) {
+		topology = &adiv5_topology_cache[adiv5_topology_next];
+		adiv5_topology_next = (adiv5_topology_next + 1U) % ADIV5_TOPOLOGY_CACHE_SIZE;
+	}
+	memset(topology, 0, sizeof(*topology));
+	topology->valid = root != 0;
+	topology->dp_designer_code = ap->dp->designer_code;
+	topology->dp_partno = ap->dp->partno;
+	topology->target_designer_code = ap->dp->target_designer_code;
+	topology->target_partno = ap->dp->target_partno;
+	topology->instance = ap->dp->instance;
+	topology->apsel = ap->apsel;
+	topology->idr = ap->idr;
+	topology->base = ap->base;
+	if (topology->valid)
+		adiv5_topology_recording = topology;
+	adiv5_component_probe(ap, ap->base, 0, 0);
+	adiv5_topology_recording = NULL;
+}
+
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 {
 	ADIv5_AP_t *ap, tmpap;
@@ -649,6 +848,14 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 		return NULL;
 	}
 
+	/* Packed transfers are optional, AddrInc only reads back as packed where they
+	 * are implemented. Other AP classes use CSW's slot for their own registers. */
+	if ((tmpap.idr & ADIV5_AP_IDR_CLASS_MASK) == ADIV5_AP_IDR_CLASS_MEM) {
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, tmpap.csw | ADIV5_AP_CSW_ADDRINC_PACKED | ADIV5_AP_CSW_SIZE_HALFWORD);
+		tmpap.packed =
+			(adiv5_ap_read(&tmpap, ADIV5_AP_CSW) & ADIV5_AP_CSW_ADDRINC_MASK) == ADIV5_AP_CSW_ADDRINC_PACKED;
+	}
+
 	/* It's valid to so create a heap copy */
 	ap = malloc(sizeof(*ap));
 	if (!ap) { /* malloc failed: heap exhaustion */
@@ -662,7 +869,8 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 	uint32_t cfg = adiv5_ap_read(ap, ADIV5_AP_CFG);
 	DEBUG_INFO("AP %3d: IDR=%08" PRIx32 " CFG=%08" PRIx32 " BASE=%08" PRIx32 " CSW=%08" PRIx32, apsel, ap->idr, cfg,
 		ap->base, ap->csw);
-	DEBUG_INFO(" (AHB-AP var%" PRIx32 " rev%" PRIx32 ")\n", (ap->idr >> 4) & 0xf, ap->idr >> 28);
+	DEBUG_INFO(" (AHB-AP var%" PRIx32 " rev%" PRIx32 ")%s\n", (ap->idr >> 4) & 0xf, ap->idr >> 28,
+		ap->packed ? " packed" : "");
 #endif
 	adiv5_ap_ref(ap);
 	return ap;
@@ -681,6 +889,146 @@ static void rp_rescue_setup(ADIv5_DP_t *dp)
 	rp_rescue_probe(ap);
 }
 
+/*
+ * Scan result cache: an SWD rescan that finds the same DP, with the same APs behind it,
+ * takes back the targets of the previous scan with their memory maps and flash drivers
+ * instead of walking the ROM tables and running the probe routines again.
+ */
+#define ADIV5_SCAN_CACHE_APS 8U
+
+typedef struct adiv5_scan_key {
+	uint32_t dpidr;
+	uint32_t targetsel;
+	uint8_t ap_count;
+	struct {
+		uint8_t apsel;
+		uint32_t idr;
+		uint32_t base;
+	} aps[ADIV5_SCAN_CACHE_APS];
+} adiv5_scan_key_s;
+
+bool adiv5_scan_cache_enabled = true;
+/* identity of the stashed targets, and the DP they hold references to */
+static adiv5_scan_key_s adiv5_scan_cached;
+static ADIv5_DP_t *adiv5_scan_cached_dp;
+/* identity recorded by the scan in progress */
+static adiv5_scan_key_s adiv5_scan_current;
+static ADIv5_DP_t *adiv5_scan_current_dp;
+static bool adiv5_scan_current_valid;
+static bool adiv5_scan_active;
+static size_t adiv5_scan_dp_count;
+
+void adiv5_scan_cache_begin(void)
+{
+	if (adiv5_scan_cache_enabled)
+		target_list_stash();
+	else
+		target_list_free();
+	adiv5_scan_active = true;
+	adiv5_scan_current_valid = true;
+	adiv5_scan_current_dp = NULL;
+	adiv5_scan_dp_count = 0;
+}
+
+void adiv5_scan_cache_end(void)
+{
+	target_list_stash_free();
+	adiv5_scan_active = false;
+	/* A scan that found more than one DP is not kept, the key only describes one */
+	if (adiv5_scan_cache_enabled && adiv5_scan_current_valid && adiv5_scan_dp_count == 1U && target_list) {
+		adiv5_scan_cached = adiv5_scan_current;
+		adiv5_scan_cached_dp = adiv5_scan_current_dp;
+		target_list_set_cacheable(true);
+	} else
+		adiv5_scan_cached_dp = NULL;
+}
+
+void adiv5_scan_cache_flush(void)
+{
+	target_list_stash_free();
+	adiv5_scan_cached_dp = NULL;
+	/* The current targets are still usable, they are just not taken back by the next scan */
+	target_list_set_cacheable(false);
+}
+
+static void adiv5_scan_record_ap(const ADIv5_AP_t *const ap)
+{
+	if (!adiv5_scan_active)
+		return;
+	adiv5_scan_key_s *const key = &adiv5_scan_current;
+	if (key->ap_count == ADIV5_SCAN_CACHE_APS) {
+		adiv5_scan_current_valid = false;
+		return;
+	}
+	key->aps[key->ap_count].apsel = ap->apsel;
+	key->aps[key->ap_count].idr = ap->idr;
+	key->aps[key->ap_count].base = ap->base;
+	++key->ap_count;
+}
+
+static void adiv5_scan_record_dp(ADIv5_DP_t *const dp, const uint32_t dpidr)
+{
+	if (!adiv5_scan_active)
+		return;
+	adiv5_scan_current.dpidr = dpidr;
+	adiv5_scan_current.targetsel = dp->targetsel;
+	adiv5_scan_current.ap_count = 0;
+	adiv5_scan_current_dp = dp;
+	++adiv5_scan_dp_count;
+}
+
+static bool adiv5_scan_ap_unchanged(ADIv5_DP_t *const dp, const size_t index)
+{
+	ADIv5_AP_t ap;
+	memset(&ap, 0, sizeof(ap));
+	ap.dp = dp;
+	ap.apsel = adiv5_scan_cached.aps[index].apsel;
+	uint32_t idr = 0;
+	uint32_t base = 0;
+	adiv5_dp_errors_defer(dp);
+	idr = adiv5_ap_read(&ap, ADIV5_AP_IDR);
+	base = adiv5_ap_read(&ap, ADIV5_AP_BASE);
+	return adiv5_dp_errors_status(dp) == ADIV5_STATUS_OK && idr == adiv5_scan_cached.aps[index].idr &&
+	       base == adiv5_scan_cached.aps[index].base;
+}
+
+/* Take back the previous scan's targets if this DP and its APs are the ones it found */
+static bool adiv5_scan_cache_restore(ADIv5_DP_t *const dp, const uint32_t dpidr)
+{
+	const adiv5_scan_key_s *const key = &adiv5_scan_cached;
+	if (!adiv5_scan_active || !adiv5_scan_cached_dp || adiv5_scan_dp_count || target_list || connect_assert_nrst)
+		return false;
+#if PC_HOSTED == 1
+	if (dp->ap_setup)
+		return false;
+#endif
+	if (key->dpidr != dpidr || key->targetsel != dp->targetsel)
+		return false;
+
+	for (size_t i = 0; i < key->ap_count; ++i) {
+		if (!adiv5_scan_ap_unchanged(dp, i))
+			return false;
+	}
+
+	ADIv5_DP_t *const cached = adiv5_scan_cached_dp;
+	if (!target_list_unstash())
+		return false;
+	/* The stashed APs keep their DP, give it this connection's state but move its shadow epoch on */
+	const int refcnt = cached->refcnt;
+	const uint32_t shadow_epoch = cached->shadow_epoch;
+	memcpy(cached, dp, sizeof(*cached));
+	cached->refcnt = refcnt;
+	cached->shadow_epoch = shadow_epoch;
+	adiv5_shadow_invalidate(cached);
+	free(dp);
+
+	adiv5_scan_current = *key;
+	adiv5_scan_current_dp = cached;
+	++adiv5_scan_dp_count;
+	DEBUG_INFO("DP and APs unchanged since the last scan, reusing its targets\n");
+	return true;
+}
+
 void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 {
 	/*
@@ -691,13 +1039,10 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 	 *
 	 * for SWD-DP, we are guaranteed to be DP v1 or later.
 	 */
-	volatile uint32_t dpidr = 0;
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_ALL) {
-		if (idcode != JTAG_IDCODE_ARM_DPv0)
-			dpidr = adiv5_dp_read(dp, ADIV5_DP_DPIDR);
-	}
-	if (e.type) {
+	uint32_t dpidr = 0;
+	const adiv5_status_e dpidr_status =
+		idcode != JTAG_IDCODE_ARM_DPv0 ? adiv5_dp_read_status(dp, ADIV5_DP_DPIDR, &dpidr) : ADIV5_STATUS_OK;
+	if (dpidr_status == ADIV5_STATUS_ERROR || dpidr_status == ADIV5_STATUS_TIMEOUT) {
 		DEBUG_WARN("DP not responding!...\n");
 		free(dp);
 		return;
@@ -781,11 +1126,11 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 	dp->mem_write_sized = firmware_mem_write_sized;
 #endif
 
-	volatile uint32_t ctrlstat = 0;
-	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
-	}
-	if (e.type) {
+	uint32_t ctrlstat = 0;
+	const adiv5_status_e ctrlstat_status = adiv5_dp_read_status(dp, ADIV5_DP_CTRLSTAT, &ctrlstat);
+	if (ctrlstat_status == ADIV5_STATUS_ERROR)
+		raise_exception(EXCEPTION_ERROR, "DP not responding");
+	if (ctrlstat_status == ADIV5_STATUS_TIMEOUT) {
 		DEBUG_WARN("DP not responding!  Trying abort sequence...\n");
 		adiv5_dp_abort(dp, ADIV5_DP_ABORT_DAPABORT);
 		ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
@@ -828,6 +1173,12 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 	}
 	/* Write request for debug reset release */
 	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, ctrlstat &= ~ADIV5_DP_CTRLSTAT_CDBGRSTREQ);
+	/* Power-up and the debug reset leave SELECT and the AP registers at their reset values */
+	adiv5_shadow_invalidate(dp);
+
+	if (adiv5_scan_cache_restore(dp, dpidr))
+		return;
+	adiv5_scan_record_dp(dp, dpidr);
 
 	/* Probe for APs on this DP */
 	size_t invalid_aps = 0;
@@ -854,6 +1205,8 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 			continue;
 		}
 
+		adiv5_scan_record_ap(ap);
+
 		kinetis_mdm_probe(ap);
 		nrf51_mdm_probe(ap);
 		efm32_aap_probe(ap);
@@ -866,7 +1219,7 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 		 */
 
 		/* The rest should only be added after checking ROM table */
-		adiv5_component_probe(ap, ap->base, 0, 0);
+		adiv5_topology_probe(ap);
 		adiv5_ap_unref(ap);
 	}
 	/* We halted at least CortexM for Romtable scan.
@@ -884,10 +1237,151 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 
 #define ALIGNOF(x) (((x)&3) == 0 ? ALIGN_WORD : (((x)&1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
-/* Program the CSW and TAR for sequencial access at a given width */
-static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
+/* Narrow accesses shorter than this gain nothing from switching to packed transfers */
+#define ADIV5_PACKED_MIN_LEN 12U
+/* Unaligned accesses with fewer whole words than this in them are left at the narrow width */
+#define ADIV5_SPLIT_MIN_BODY 8U
+
+void adiv5_shadow_invalidate(ADIv5_DP_t *dp)
+{
+	dp->select_valid = false;
+	++dp->shadow_epoch;
+}
+
+bool adiv5_dp_select_shadowed(ADIv5_DP_t *dp, uint32_t select)
+{
+	if (dp->fault) {
+		adiv5_shadow_invalidate(dp);
+		return false;
+	}
+	return dp->select_valid && dp->select == select;
+}
+
+void adiv5_dp_select_shadow(ADIv5_DP_t *dp, uint32_t select)
+{
+	dp->select = select;
+	dp->select_valid = !dp->fault;
+}
+
+/* Drop the AP shadows if the DP has been invalidated since they were taken */
+static void adiv5_ap_shadow_sync(ADIv5_AP_t *ap)
+{
+	if (ap->shadow_epoch != ap->dp->shadow_epoch) {
+		ap->shadow_epoch = ap->dp->shadow_epoch;
+		ap->shadow_valid = 0;
+	}
+}
+
+/* Returns true if CSW or TAR is known to hold value already */
+bool adiv5_ap_shadowed(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
+{
+	if (ap->dp->fault) {
+		adiv5_shadow_invalidate(ap->dp);
+		return false;
+	}
+	adiv5_ap_shadow_sync(ap);
+	if (addr == ADIV5_AP_CSW)
+		return (ap->shadow_valid & ADIV5_AP_SHADOW_CSW) && ap->csw_shadow == value;
+	if (addr == ADIV5_AP_TAR)
+		return (ap->shadow_valid & ADIV5_AP_SHADOW_TAR) && ap->tar_shadow == value;
+	return false;
+}
+
+/* Account for a write to an AP register, DRW accesses move TAR */
+void adiv5_ap_shadow_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
-	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	adiv5_ap_shadow_sync(ap);
+	if (addr == ADIV5_AP_CSW) {
+		ap->csw_shadow = value;
+		ap->shadow_valid |= ADIV5_AP_SHADOW_CSW;
+	} else if (addr == ADIV5_AP_TAR) {
+		ap->tar_shadow = value;
+		ap->shadow_valid |= ADIV5_AP_SHADOW_TAR;
+	} else if (addr == ADIV5_AP_DRW)
+		ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+	if (ap->dp->fault)
+		ap->shadow_valid = 0;
+}
+
+void adiv5_ap_shadow_read(ADIv5_AP_t *ap, uint16_t addr)
+{
+	adiv5_ap_shadow_sync(ap);
+	if (addr == ADIV5_AP_DRW)
+		ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+}
+
+/*
+ * Record TAR after a run of auto-incrementing accesses ending before next.
+ * Only the bottom 10 bits are guaranteed to increment, so TAR is unknown
+ * once the run reaches a 1kiB boundary.
+ */
+void adiv5_ap_shadow_tar_advance(ADIv5_AP_t *ap, uint32_t next)
+{
+	if (next & 0x3ffU)
+		adiv5_ap_shadow_write(ap, ADIV5_AP_TAR, next);
+	else
+		adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
+}
+
+static void firmware_ap_select(ADIv5_AP_t *ap, uint16_t addr)
+{
+	const uint32_t select = ((uint32_t)ap->apsel << 24) | (addr & 0xF0);
+	if (adiv5_dp_select_shadowed(ap->dp, select))
+		return;
+	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT, select);
+	adiv5_dp_select_shadow(ap->dp, select);
+}
+
+/*
+ * Split a narrow access into the bytes up to the next word boundary, a run of
+ * whole words to move as packed transfers, and the rest. Returns the length
+ * of the packed run, or 0 when the AP cannot pack or switching CSW over to
+ * packed mode and back would not pay off.
+ */
+size_t adiv5_packed_split(const ADIv5_AP_t *ap, uint32_t addr, size_t len, enum align align, size_t *head)
+{
+	*head = 0;
+	if (!ap->packed || align >= ALIGN_WORD)
+		return 0;
+	const size_t lead = MIN((4U - (addr & 3U)) & 3U, len);
+	const size_t body = (len - lead) & ~3U;
+	if (body < ADIV5_PACKED_MIN_LEN)
+		return 0;
+	*head = lead;
+	return body;
+}
+
+/*
+ * Split an access that is not word aligned at both ends into a head up to the first word
+ * boundary, a body of whole words, and the tail left. Only the head and tail, under a word
+ * each, then need narrow accesses, rather than all of the access being done at the width
+ * its worst aligned end allows. Returns the length of the body, or 0 when the access is
+ * aligned or too short for the extra CSW changes to pay off.
+ */
+size_t adiv5_align_split(const uint32_t addr, const size_t len, size_t *const head)
+{
+	*head = 0;
+	if (MIN(ALIGNOF(addr), ALIGNOF(len)) >= ALIGN_WORD)
+		return 0;
+	const size_t lead = MIN((4U - (addr & 3U)) & 3U, len);
+	const size_t body = (len - lead) & ~3U;
+	if (body < ADIV5_SPLIT_MIN_BODY)
+		return 0;
+	*head = lead;
+	return body;
+}
+
+/* Width of the next access of a head or tail: a halfword where the address and length allow one */
+enum align adiv5_edge_align(const uint32_t addr, const size_t len)
+{
+	return (addr & 1U) || len < 2U ? ALIGN_BYTE : ALIGN_HALFWORD;
+}
+
+/* Program the CSW and TAR for sequencial access at a given width, packed
+ * transfers carry a whole word of accesses at that width in each DRW access */
+static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align, bool packed)
+{
+	uint32_t csw = ap->csw | (packed ? ADIV5_AP_CSW_ADDRINC_PACKED : ADIV5_AP_CSW_ADDRINC_SINGLE);
 
 	switch (align) {
 	case ALIGN_BYTE:
@@ -901,8 +1395,13 @@ static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
 		csw |= ADIV5_AP_CSW_SIZE_WORD;
 		break;
 	}
-	adiv5_ap_write(ap, ADIV5_AP_CSW, csw);
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr);
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_CSW, csw))
+		adiv5_ap_write(ap, ADIV5_AP_CSW, csw);
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_TAR, addr))
+		adiv5_ap_write(ap, ADIV5_AP_TAR, addr);
+	/* The DRW accesses that follow need bank 0 of this AP selected */
+	firmware_ap_select(ap, ADIV5_AP_DRW);
+	adiv5_ap_shadow_read(ap, ADIV5_AP_DRW);
 }
 
 /* Extract read data from data lane based on align and src address */
@@ -912,96 +1411,526 @@ void *extract(void *dest, uint32_t src, uint32_t val, enum align align)
 	case ALIGN_BYTE:
 		*(uint8_t *)dest = (val >> ((src & 0x3) << 3) & 0xFF);
 		break;
-	case ALIGN_HALFWORD:
-		*(uint16_t *)dest = (val >> ((src & 0x2) << 3) & 0xFFFF);
+	case ALIGN_HALFWORD: {
+		/* The edges of a split access leave the destination only byte aligned */
+		const uint16_t halfword = val >> ((src & 0x2) << 3) & 0xFFFF;
+		memcpy(dest, &halfword, sizeof(halfword));
 		break;
+	}
 	case ALIGN_DWORD:
 	case ALIGN_WORD:
-		*(uint32_t *)dest = val;
+		/* Packed reads need not land on an aligned destination buffer */
+		memcpy(dest, &val, sizeof(val));
 		break;
 	}
 	return (uint8_t *)dest + (1 << align);
 }
 
-void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+/* Read len bytes starting at src in accesses of the given width, or as whole words of packed accesses */
+static void *firmware_mem_read_run(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len, enum align align, bool packed)
 {
 	uint32_t tmp;
 	uint32_t osrc = src;
-	const enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	const enum align data_align = packed ? ALIGN_WORD : align;
 
 	if (len == 0)
-		return;
+		return dest;
 
-	len >>= align;
-	ap_mem_access_setup(ap, src, align);
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	len >>= data_align;
+	ap_mem_access_setup(ap, src, align, packed);
+	adiv5_ap_low_access(ap, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
 	while (--len) {
-		tmp = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
-		dest = extract(dest, src, tmp, align);
+		tmp = adiv5_ap_low_access(ap, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+		dest = extract(dest, src, tmp, data_align);
 
-		src += (1U << align);
+		src += (1U << data_align);
 		/* Check for 10 bit address overflow */
 		if ((src ^ osrc) & 0xfffffc00U) {
 			osrc = src;
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, src);
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+			adiv5_ap_low_access(ap, ADIV5_LOW_WRITE, ADIV5_AP_TAR, src);
+			adiv5_ap_low_access(ap, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
 		}
 	}
 	tmp = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
-	extract(dest, src, tmp, align);
+	dest = extract(dest, src, tmp, data_align);
+	adiv5_ap_shadow_tar_advance(ap, src + (1U << data_align));
+	return dest;
 }
 
-void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+/* Runs of at least this many words on a bit-banged SW-DP go out as overrun detection bursts */
+#define ADIV5_BURST_MIN_LEN 16U
+
+static bool adiv5_burst_usable(ADIv5_DP_t *dp, size_t count)
+{
+	return dp->low_access == firmware_swdp_low_access && count >= ADIV5_BURST_MIN_LEN && !dp->fault;
+}
+
+static void adiv5_burst_begin(ADIv5_DP_t *dp)
+{
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT,
+		ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ | ADIV5_DP_CTRLSTAT_ORUNDETECT);
+	dp->overrun_burst = true;
+}
+
+/* Leave overrun detection mode, false if an access of the burst was not taken */
+static bool adiv5_burst_end(ADIv5_DP_t *dp)
+{
+	dp->overrun_burst = false;
+	const uint32_t ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ);
+	if (!(ctrlstat & (ADIV5_DP_CTRLSTAT_STICKYORUN | ADIV5_DP_CTRLSTAT_STICKYERR)))
+		return true;
+	dp->error(dp);
+	return false;
+}
+
+/* DRW accesses of a burst handed to the SW-DP at a time */
+#define ADIV5_BURST_BATCH 32U
+
+/*
+ * Read one burst chunk, within a TAR auto-increment block, so the DRW reads
+ * can go to the SW-DP back to back in batches.
+ */
+static void *firmware_mem_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len, enum align align, bool packed)
+{
+	const enum align data_align = packed ? ALIGN_WORD : align;
+	uint32_t values[ADIV5_BURST_BATCH];
+
+	ap_mem_access_setup(ap, src, align, packed);
+	/* The first DRW read only posts the access, each one after returns the one before */
+	adiv5_ap_low_access(ap, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	for (size_t count = (len >> data_align) - 1U; count;) {
+		const size_t batch = MIN(count, ADIV5_BURST_BATCH);
+		firmware_swdp_burst_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, values, batch);
+		for (size_t i = 0; i < batch; ++i) {
+			dest = extract(dest, src, values[i], data_align);
+			src += 1U << data_align;
+		}
+		count -= batch;
+	}
+	const uint32_t last = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+	dest = extract(dest, src, last, data_align);
+	adiv5_ap_shadow_tar_advance(ap, src + (1U << data_align));
+	return dest;
+}
+
+/*
+ * Read a run as bursts of up to one TAR auto-increment block each. Reads have
+ * no side effects on memory, so a burst that overran is just read again with
+ * every ACK checked.
+ */
+static void *firmware_mem_read_burst(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len, enum align align, bool packed)
+{
+	const enum align data_align = packed ? ALIGN_WORD : align;
+	if (!adiv5_burst_usable(ap->dp, len >> data_align))
+		return firmware_mem_read_run(ap, dest, src, len, align, packed);
+
+	while (len) {
+		const size_t chunk = MIN(len, 0x400U - (src & 0x3ffU));
+		adiv5_burst_begin(ap->dp);
+		void *const next = firmware_mem_read_block(ap, dest, src, chunk, align, packed);
+		if (!adiv5_burst_end(ap->dp))
+			firmware_mem_read_run(ap, dest, src, chunk, align, packed);
+		dest = next;
+		src += chunk;
+		len -= chunk;
+	}
+	return dest;
+}
+
+/* Read the head or tail of a split access in the widest accesses each part of it allows */
+static void *firmware_mem_read_edge(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	while (len) {
+		const enum align align = adiv5_edge_align(src, len);
+		dest = firmware_mem_read_run(ap, dest, src, 1U << align, align, false);
+		src += 1U << align;
+		len -= 1U << align;
+	}
+	return dest;
+}
+
+void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	size_t head;
+	const size_t words = adiv5_align_split(src, len, &head);
+	if (words) {
+		dest = firmware_mem_read_edge(ap, dest, src, head);
+		dest = firmware_mem_read_burst(ap, dest, src + head, words, ALIGN_WORD, false);
+		firmware_mem_read_edge(ap, dest, src + head + words, len - head - words);
+		return;
+	}
+
+	const enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	const size_t body = adiv5_packed_split(ap, src, len, align, &head);
+
+	if (body) {
+		dest = firmware_mem_read_run(ap, dest, src, head, align, false);
+		dest = firmware_mem_read_burst(ap, dest, src + head, body, align, true);
+		src += head + body;
+		len -= head + body;
+	}
+	firmware_mem_read_burst(ap, dest, src, len, align, false);
+}
+
+/* Pack data into correct data lane */
+static uint32_t deposit(uint32_t dest, const void *src, enum align align)
+{
+	uint32_t val = 0;
+	switch (align) {
+	case ALIGN_BYTE:
+		val = ((uint32_t) * (const uint8_t *)src) << ((dest & 3) << 3);
+		break;
+	case ALIGN_HALFWORD: {
+		uint16_t halfword;
+		memcpy(&halfword, src, sizeof(halfword));
+		val = (uint32_t)halfword << ((dest & 2) << 3);
+		break;
+	}
+	case ALIGN_DWORD:
+	case ALIGN_WORD:
+		/* Packed runs need not start on an aligned source buffer */
+		memcpy(&val, src, sizeof(val));
+		break;
+	}
+	return val;
+}
+
+/* Write len bytes starting at dest in accesses of the given width, or as whole words of packed accesses */
+static const void *firmware_mem_write_run(
+	ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align, bool packed)
 {
 	uint32_t odest = dest;
+	const enum align data_align = packed ? ALIGN_WORD : align;
 
-	len >>= align;
-	ap_mem_access_setup(ap, dest, align);
+	if (len == 0)
+		return src;
+
+	len >>= data_align;
+	ap_mem_access_setup(ap, dest, align, packed);
 	while (len--) {
-		uint32_t tmp = 0;
-		/* Pack data into correct data lane */
-		switch (align) {
-		case ALIGN_BYTE:
-			tmp = ((uint32_t) * (uint8_t *)src) << ((dest & 3) << 3);
-			break;
-		case ALIGN_HALFWORD:
-			tmp = ((uint32_t) * (uint16_t *)src) << ((dest & 2) << 3);
-			break;
-		case ALIGN_DWORD:
-		case ALIGN_WORD:
-			tmp = *(uint32_t *)src;
-			break;
-		}
-		src = (uint8_t *)src + (1 << align);
-		dest += (1 << align);
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, tmp);
+		const uint32_t tmp = deposit(dest, src, data_align);
+		src = (uint8_t *)src + (1 << data_align);
+		dest += (1 << data_align);
+		adiv5_ap_low_access(ap, ADIV5_LOW_WRITE, ADIV5_AP_DRW, tmp);
 
-		/* Check for 10 bit address overflow */
-		if ((dest ^ odest) & 0xfffffc00U) {
+		/* Check for 10 bit address overflow, unless that was the last write */
+		if (len && ((dest ^ odest) & 0xfffffc00U)) {
 			odest = dest;
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, dest);
+			adiv5_ap_low_access(ap, ADIV5_LOW_WRITE, ADIV5_AP_TAR, dest);
+		}
+	}
+	adiv5_ap_shadow_tar_advance(ap, dest);
+	return src;
+}
+
+/* Write one burst chunk, within a TAR auto-increment block, with the DRW writes in batches */
+static void firmware_mem_write_block(
+	ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align, bool packed)
+{
+	const enum align data_align = packed ? ALIGN_WORD : align;
+	uint32_t values[ADIV5_BURST_BATCH];
+
+	ap_mem_access_setup(ap, dest, align, packed);
+	for (size_t count = len >> data_align; count;) {
+		const size_t batch = MIN(count, ADIV5_BURST_BATCH);
+		for (size_t i = 0; i < batch; ++i) {
+			values[i] = deposit(dest, src, data_align);
+			src = (const uint8_t *)src + (1U << data_align);
+			dest += 1U << data_align;
 		}
+		firmware_swdp_burst_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, values, batch);
+		count -= batch;
 	}
+	adiv5_ap_shadow_tar_advance(ap, dest);
+}
+
+/*
+ * Write a run as bursts of up to one TAR auto-increment block each. Writes
+ * must not be repeated, Flash programming for one would fail, so after an
+ * overrun TAR tells which was the first write not taken and the rest of the
+ * block goes again from there with every ACK checked.
+ */
+static const void *firmware_mem_write_burst(
+	ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align, bool packed)
+{
+	const enum align data_align = packed ? ALIGN_WORD : align;
+	if (!adiv5_burst_usable(ap->dp, len >> data_align))
+		return firmware_mem_write_run(ap, dest, src, len, align, packed);
+
+	while (len) {
+		const size_t chunk = MIN(len, 0x400U - (dest & 0x3ffU));
+		adiv5_burst_begin(ap->dp);
+		firmware_mem_write_block(ap, dest, src, chunk, align, packed);
+		if (!adiv5_burst_end(ap->dp)) {
+			const uint32_t tar = adiv5_ap_read(ap, ADIV5_AP_TAR);
+			/* Within the block, the write that overran was never taken */
+			if (tar < dest || tar >= dest + chunk) {
+				ap->dp->fault = 1;
+				return (const uint8_t *)src + len;
+			}
+			firmware_mem_write_run(ap, tar, (const uint8_t *)src + (tar - dest), chunk - (tar - dest), align, packed);
+		}
+		src = (const uint8_t *)src + chunk;
+		dest += chunk;
+		len -= chunk;
+	}
+	return src;
+}
+
+void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+{
+	size_t head;
+	const size_t body = adiv5_packed_split(ap, dest, len, align, &head);
+
+	if (body) {
+		src = firmware_mem_write_run(ap, dest, src, head, align, false);
+		src = firmware_mem_write_burst(ap, dest + head, src, body, align, true);
+		dest += head + body;
+		len -= head + body;
+	}
+	firmware_mem_write_burst(ap, dest, src, len, align, false);
 	/* Make sure this write is complete by doing a dummy read */
 	adiv5_dp_read(ap->dp, ADIV5_DP_RDBUFF);
 }
 
 void firmware_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
-	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24) | (addr & 0xF0));
+	firmware_ap_select(ap, addr);
 	adiv5_dp_write(ap->dp, addr, value);
+	adiv5_ap_shadow_write(ap, addr, value);
 }
 
 uint32_t firmware_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 {
 	uint32_t ret;
-	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24) | (addr & 0xF0));
+	firmware_ap_select(ap, addr);
+	adiv5_ap_shadow_read(ap, addr);
 	ret = adiv5_dp_read(ap->dp, addr);
 	return ret;
 }
 
+/* Write the head or tail of a split access in the widest accesses each part of it allows */
+static void adiv5_mem_write_edge(ADIv5_AP_t *ap, uint32_t dest, const uint8_t *src, size_t len)
+{
+	while (len) {
+		const enum align align = adiv5_edge_align(dest, len);
+		adiv5_mem_write_sized(ap, dest, src, 1U << align, align);
+		dest += 1U << align;
+		src += 1U << align;
+		len -= 1U << align;
+	}
+}
+
 void adiv5_mem_write(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len)
 {
+	size_t head;
+	const size_t words = adiv5_align_split(dest, len, &head);
+	if (words) {
+		const uint8_t *const data = src;
+		adiv5_mem_write_edge(ap, dest, data, head);
+		adiv5_mem_write_sized(ap, dest + head, data + head, words, ALIGN_WORD);
+		adiv5_mem_write_edge(ap, dest + head + words, data + head + words, len - head - words);
+		return;
+	}
 	enum align align = MIN(ALIGNOF(dest), ALIGNOF(len));
 	adiv5_mem_write_sized(ap, dest, src, len, align);
 }
+
+/* For the DP layers: raise the error, or keep it for adiv5_dp_errors_status() */
+void adiv5_dp_raise(ADIv5_DP_t *dp, uint32_t type, const char *msg)
+{
+	adiv5_shadow_invalidate(dp);
+	dp->overrun_burst = false;
+	if (!dp->errors_deferred)
+		raise_exception(type, msg);
+	DEBUG_WARN("%s\n", msg);
+	if (!dp->link_error)
+		dp->link_error = type;
+	if (type == EXCEPTION_ERROR)
+		dp->fault = 1;
+}
+
+void adiv5_dp_errors_defer(ADIv5_DP_t *dp)
+{
+	dp->errors_deferred = true;
+	dp->link_error = 0;
+}
+
+adiv5_status_e adiv5_dp_errors_status(ADIv5_DP_t *dp)
+{
+	dp->errors_deferred = false;
+	const uint32_t link_error = dp->link_error;
+	dp->link_error = 0;
+	if (link_error == EXCEPTION_TIMEOUT)
+		return ADIV5_STATUS_TIMEOUT;
+	if (link_error)
+		return ADIV5_STATUS_ERROR;
+	return dp->fault ? ADIV5_STATUS_FAULT : ADIV5_STATUS_OK;
+}
+
+adiv5_status_e adiv5_dp_read_status(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	adiv5_dp_errors_defer(dp);
+	*value = adiv5_dp_read(dp, addr);
+	return adiv5_dp_errors_status(dp);
+}
+
+adiv5_status_e adiv5_ap_read_status(ADIv5_AP_t *ap, uint16_t addr, uint32_t *value)
+{
+	adiv5_dp_errors_defer(ap->dp);
+	*value = adiv5_ap_read(ap, addr);
+	return adiv5_dp_errors_status(ap->dp);
+}
+
+adiv5_status_e adiv5_mem_read_status(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	adiv5_dp_errors_defer(ap->dp);
+	adiv5_mem_read(ap, dest, src, len);
+	return adiv5_dp_errors_status(ap->dp);
+}
+
+adiv5_status_e adiv5_mem_write_status(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len)
+{
+	adiv5_dp_errors_defer(ap->dp);
+	adiv5_mem_write(ap, dest, src, len);
+	return adiv5_dp_errors_status(ap->dp);
+}
+
+#if PC_HOSTED == 1
+static bool adiv5_queue_push(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value, uint32_t *result)
+{
+	if (!dp->queue_flush)
+		return false;
+	if (dp->queue_len == ADIV5_QUEUE_DEPTH)
+		adiv5_queue_flush(dp);
+	adiv5_transfer_s *const transfer = &dp->queue[dp->queue_len++];
+	transfer->addr = addr;
+	transfer->RnW = RnW;
+	transfer->value = value;
+	transfer->result = result;
+	return true;
+}
+
+/* Queue the SELECT write for an AP access, unless SELECT is left there already */
+static void adiv5_queue_select(ADIv5_AP_t *ap, uint16_t addr)
+{
+	ADIv5_DP_t *const dp = ap->dp;
+	const uint32_t select = ((uint32_t)ap->apsel << 24) | (addr & 0xF0);
+	if (adiv5_dp_select_shadowed(dp, select))
+		return;
+	adiv5_queue_push(dp, ADIV5_LOW_WRITE, ADIV5_DP_SELECT, select, NULL);
+	adiv5_dp_select_shadow(dp, select);
+}
+#endif
+
+void adiv5_dp_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *result)
+{
+#if PC_HOSTED == 1
+	if (adiv5_queue_push(dp, ADIV5_LOW_READ, addr, 0, result))
+		return;
+#endif
+	*result = adiv5_dp_read(dp, addr);
+}
+
+void adiv5_dp_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	if (addr == ADIV5_DP_SELECT)
+		dp->select_valid = false;
+#if PC_HOSTED == 1
+	if (adiv5_queue_push(dp, ADIV5_LOW_WRITE, addr, value, NULL))
+		return;
+#endif
+	adiv5_dp_low_access(dp, ADIV5_LOW_WRITE, addr, value);
+}
+
+void adiv5_ap_queue_read(ADIv5_AP_t *ap, uint16_t addr, uint32_t *result)
+{
+#if PC_HOSTED == 1
+	if (ap->dp->queue_flush) {
+		adiv5_queue_select(ap, addr);
+		adiv5_queue_push(ap->dp, ADIV5_LOW_READ, addr, 0, result);
+		adiv5_ap_shadow_read(ap, addr);
+		return;
+	}
+#endif
+	*result = adiv5_ap_read(ap, addr);
+}
+
+void adiv5_ap_queue_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
+{
+#if PC_HOSTED == 1
+	if (ap->dp->queue_flush) {
+		adiv5_queue_select(ap, addr);
+		adiv5_queue_push(ap->dp, ADIV5_LOW_WRITE, addr, value, NULL);
+		adiv5_ap_shadow_write(ap, addr, value);
+		return;
+	}
+#endif
+	adiv5_ap_write(ap, addr, value);
+}
+
+void adiv5_mem_queue_read32(ADIv5_AP_t *ap, uint32_t addr, uint32_t *result)
+{
+#if PC_HOSTED == 1
+	if (ap->dp->queue_flush) {
+		/* Same CSW as adiv5_mem_read() uses, so either can reuse it */
+		const uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE | ADIV5_AP_CSW_SIZE_WORD;
+		if (!adiv5_ap_shadowed(ap, ADIV5_AP_CSW, csw))
+			adiv5_ap_queue_write(ap, ADIV5_AP_CSW, csw);
+		if (!adiv5_ap_shadowed(ap, ADIV5_AP_TAR, addr))
+			adiv5_ap_queue_write(ap, ADIV5_AP_TAR, addr);
+		adiv5_ap_queue_read(ap, ADIV5_AP_DRW, result);
+		adiv5_ap_shadow_tar_advance(ap, addr + 4U);
+		return;
+	}
+#endif
+	adiv5_mem_read(ap, result, addr, sizeof(*result));
+}
+
+void adiv5_mem_queue_write32(ADIv5_AP_t *ap, uint32_t addr, uint32_t value)
+{
+#if PC_HOSTED == 1
+	if (ap->dp->queue_flush) {
+		const uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE | ADIV5_AP_CSW_SIZE_WORD;
+		if (!adiv5_ap_shadowed(ap, ADIV5_AP_CSW, csw))
+			adiv5_ap_queue_write(ap, ADIV5_AP_CSW, csw);
+		if (!adiv5_ap_shadowed(ap, ADIV5_AP_TAR, addr))
+			adiv5_ap_queue_write(ap, ADIV5_AP_TAR, addr);
+		adiv5_ap_queue_write(ap, ADIV5_AP_DRW, value);
+		adiv5_ap_shadow_tar_advance(ap, addr + 4U);
+		return;
+	}
+#endif
+	adiv5_mem_write(ap, addr, &value, sizeof(value));
+}
+
+/* Matching reads run on the probe where it can, the queue goes out first to keep the order */
+bool adiv5_mem_poll32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t value)
+{
+#if PC_HOSTED == 1
+	if (ap->dp->mem_poll32 && !ap->dp->fault) {
+		adiv5_queue_flush(ap->dp);
+		return ap->dp->mem_poll32(ap, addr, mask, value);
+	}
+#else
+	(void)ap;
+	(void)addr;
+	(void)mask;
+	(void)value;
+#endif
+	return false;
+}
+
+/* Returns false if any of the transfers since the last flush faulted */
+bool adiv5_queue_flush(ADIv5_DP_t *dp)
+{
+#if PC_HOSTED == 1
+	if (dp->queue_len) {
+		const bool result = dp->queue_flush(dp);
+		dp->queue_len = 0;
+		return result && !dp->fault;
+	}
+#endif
+	return !dp->fault;
+}
@@ -125,6 +125,11 @@
 #define ADIV5_AP_BASE ADIV5_AP_REG(0xF8U)
 #define ADIV5_AP_IDR  ADIV5_AP_REG(0xFCU)
 
+/* AP Identification Register (IDR) */
+#define ADIV5_AP_IDR_CLASS_OFFSET 13U
+#define ADIV5_AP_IDR_CLASS_MASK   (0xfU << ADIV5_AP_IDR_CLASS_OFFSET)
+#define ADIV5_AP_IDR_CLASS_MEM    (0x8U << ADIV5_AP_IDR_CLASS_OFFSET)
+
 /* AP Control and Status Word (CSW) */
 #define ADIV5_AP_CSW_DBGSWENABLE (1U << 31U)
 /* Bits 30:24 - Prot, Implementation defined, for Cortex-M3: */
@@ -172,6 +177,8 @@
 #define SWDP_ACK_OK    0x01U
 #define SWDP_ACK_WAIT  0x02U
 #define SWDP_ACK_FAULT 0x04U
+/* Not an ACK, set in a fused transaction's return when its read data failed the parity check */
+#define SWDP_ACK_PARITY 0x08U
 
 /* JEP-106 code list
  * JEP-106 is a JEDEC standard assigning IDs to different manufacturers
@@ -235,6 +242,27 @@ enum align {
 
 typedef struct ADIv5_AP_s ADIv5_AP_t;
 
+#if PC_HOSTED == 1
+#define ADIV5_QUEUE_DEPTH 64U
+
+/* A deferred DP/AP register access, see adiv5_queue_flush() */
+typedef struct adiv5_transfer {
+	uint16_t addr; /* DP register, or AP register with ADIV5_APnDP set */
+	uint8_t RnW;
+	uint32_t value;   /* Data to write */
+	uint32_t *result; /* Where read data is stored by the flush */
+} adiv5_transfer_s;
+#endif
+
+/* SW-DP WAIT accounting for the first few APSELs, see swdp_wait_account() */
+#define ADIV5_WAIT_APS 8U
+
+typedef struct adiv5_ap_wait {
+	uint8_t accesses;
+	uint8_t waits;
+	uint8_t idle_cycles;
+} adiv5_ap_wait_s;
+
 /* Try to keep this somewhat absract for later adding SW-DP */
 typedef struct ADIv5_DP_s {
 	int refcnt;
@@ -243,6 +271,15 @@ typedef struct ADIv5_DP_s {
 	void (*seq_out_parity)(uint32_t tms_states, size_t clock_cycles);
 	uint32_t (*seq_in)(size_t clock_cycles);
 	bool (*seq_in_parity)(uint32_t *ret, size_t clock_cycles);
+	/*
+	 * A whole SW-DP transaction, request to data parity, in one call, returning the ACK.
+	 * The data phase is only clocked on an OK unless data_phase forces it for overrun
+	 * detection. The burst repeats one request count times that way, stopping early at
+	 * an invalid ACK or bad read parity, and returns the transactions done. NULL where
+	 * the probe only has the sequence primitives.
+	 */
+	uint8_t (*swd_transaction)(uint8_t request, uint32_t *data, bool data_phase);
+	size_t (*swd_burst)(uint8_t request, uint32_t *data, size_t count);
 	/* dp_low_write returns true if no OK resonse, but ignores errors */
 	bool (*dp_low_write)(struct ADIv5_DP_s *dp, uint16_t addr, const uint32_t data);
 	uint32_t (*dp_read)(struct ADIv5_DP_s *dp, uint16_t addr);
@@ -259,6 +296,19 @@ typedef struct ADIv5_DP_s {
 	void (*ap_reg_write)(ADIv5_AP_t *ap, int num, uint32_t value);
 	void (*read_block)(uint32_t addr, uint8_t *data, int size);
 	void (*dap_write_block_sized)(uint32_t addr, uint8_t *data, int size, enum align align);
+	/* Issue the queued transfers in as few probe round trips as possible */
+	bool (*queue_flush)(struct ADIv5_DP_s *dp);
+	/*
+	 * Clock out cycles bits of seq, a line reset, the TARGETSEL write if targetsel
+	 * is given and the DPIDR read as one probe command, false if the read failed.
+	 * NULL when the probe can not, see swdp_reset_read().
+	 */
+	bool (*swd_reset_read)(
+		struct ADIv5_DP_s *dp, const uint32_t *seq, size_t cycles, const uint32_t *targetsel, uint32_t *dpidr);
+	/* Read the word at addr on the probe until it matches, see adiv5_mem_poll32(). NULL if the probe can not */
+	bool (*mem_poll32)(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t value);
+	adiv5_transfer_s queue[ADIV5_QUEUE_DEPTH];
+	size_t queue_len;
 #endif
 	uint32_t (*ap_read)(ADIv5_AP_t *ap, uint16_t addr);
 	void (*ap_write)(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
@@ -267,6 +317,18 @@ typedef struct ADIv5_DP_s {
 	void (*mem_write_sized)(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align);
 	uint8_t dp_jd_index;
 	uint8_t fault;
+	/* Between adiv5_dp_errors_defer() and adiv5_dp_errors_status(), see adiv5_dp_raise() */
+	bool errors_deferred;
+	uint32_t link_error;
+
+	/* Shadow of SELECT, and the epoch the AP register shadows must match */
+	uint32_t select;
+	bool select_valid;
+	uint32_t shadow_epoch;
+
+	/* SW-DP: in a MEM-AP burst the ACKs go unchecked until STICKYORUN is read at the end */
+	bool overrun_burst;
+	adiv5_ap_wait_s ap_wait[ADIV5_WAIT_APS];
 
 	/* targetsel DPv2 */
 	uint8_t instance;
@@ -285,6 +347,9 @@ typedef struct ADIv5_DP_s {
 	uint16_t target_partno;
 } ADIv5_DP_t;
 
+#define ADIV5_AP_SHADOW_CSW (1U << 0U)
+#define ADIV5_AP_SHADOW_TAR (1U << 1U)
+
 struct ADIv5_AP_s {
 	int refcnt;
 
@@ -295,6 +360,12 @@ struct ADIv5_AP_s {
 	uint32_t base;
 	uint32_t csw;
 	uint32_t ap_cortexm_demcr; /* Copy of demcr when starting */
+	/* Shadows of CSW and TAR, valid for the ADIV5_AP_SHADOW_* bits set */
+	uint32_t csw_shadow;
+	uint32_t tar_shadow;
+	uint32_t shadow_epoch;
+	uint8_t shadow_valid;
+	bool packed; /* MEM-AP implements packed byte and halfword transfers */
 	uint32_t ap_storage;       /* E.g to hold STM32F7 initial DBGMCU_CR value.*/
 
 	/* AP designer and partno */
@@ -304,6 +375,22 @@ struct ADIv5_AP_s {
 
 uint8_t make_packet_request(uint8_t RnW, uint16_t addr);
 
+/*
+ * Shadow registers: the last values written to SELECT and to each AP's
+ * CSW and TAR, so writes that would not change them can be left out.
+ * Values are recorded as the accesses are issued, so anything that may
+ * have left the real registers elsewhere (faults, line resets, aborts,
+ * target resets, debug power-up) must call adiv5_shadow_invalidate(). No shadow is trusted while
+ * dp->fault is set.
+ */
+void adiv5_shadow_invalidate(ADIv5_DP_t *dp);
+bool adiv5_dp_select_shadowed(ADIv5_DP_t *dp, uint32_t select);
+void adiv5_dp_select_shadow(ADIv5_DP_t *dp, uint32_t select);
+bool adiv5_ap_shadowed(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
+void adiv5_ap_shadow_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
+void adiv5_ap_shadow_read(ADIv5_AP_t *ap, uint16_t addr);
+void adiv5_ap_shadow_tar_advance(ADIv5_AP_t *ap, uint32_t next);
+
 #if PC_HOSTED == 0
 static inline uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
@@ -312,6 +399,7 @@ static inline uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 
 static inline uint32_t adiv5_dp_error(ADIv5_DP_t *dp)
 {
+	adiv5_shadow_invalidate(dp);
 	return dp->error(dp);
 }
 
@@ -322,6 +410,7 @@ static inline uint32_t adiv5_dp_low_access(struct ADIv5_DP_s *dp, uint8_t RnW, u
 
 static inline void adiv5_dp_abort(struct ADIv5_DP_s *dp, uint32_t abort)
 {
+	adiv5_shadow_invalidate(dp);
 	return dp->abort(dp, abort);
 }
 
@@ -347,6 +436,8 @@ static inline void adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const vo
 
 static inline void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
 {
+	if (addr == ADIV5_DP_SELECT)
+		dp->select_valid = false;
 	dp->low_access(dp, ADIV5_LOW_WRITE, addr, value);
 }
 
@@ -363,6 +454,9 @@ void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
 #endif
 
 void adiv5_dp_init(ADIv5_DP_t *dp, uint32_t idcode);
+/* Bracket an SWD scan so adiv5_dp_init() can take back the targets of the last one */
+void adiv5_scan_cache_begin(void);
+void adiv5_scan_cache_end(void);
 void platform_adiv5_dp_defaults(ADIv5_DP_t *dp);
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel);
 void remote_jtag_dev(const jtag_dev_t *jtag_dev);
@@ -375,6 +469,53 @@ int platform_jtag_dp_init(ADIv5_DP_t *dp);
 int swdptap_init(ADIv5_DP_t *dp);
 
 void adiv5_mem_write(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len);
+
+/*
+ * Status-returning accesses, for polling loops that would otherwise need a
+ * TRY_CATCH around each access. Link errors and timeouts that the DP layer
+ * raises are held back as a status instead, a link error also sets
+ * dp->fault so the rest of the accesses are skipped. Any bracket of
+ * accesses can be checked the same way with adiv5_dp_errors_defer() and
+ * adiv5_dp_errors_status(); brackets do not nest.
+ */
+typedef enum adiv5_status {
+	ADIV5_STATUS_OK,
+	ADIV5_STATUS_FAULT,   /* the target answered FAULT, dp->fault is set */
+	ADIV5_STATUS_TIMEOUT, /* the target kept answering WAIT */
+	ADIV5_STATUS_ERROR,   /* no valid answer, the link is in trouble */
+} adiv5_status_e;
+
+void adiv5_dp_raise(ADIv5_DP_t *dp, uint32_t type, const char *msg);
+void adiv5_dp_errors_defer(ADIv5_DP_t *dp);
+adiv5_status_e adiv5_dp_errors_status(ADIv5_DP_t *dp);
+adiv5_status_e adiv5_dp_read_status(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value);
+adiv5_status_e adiv5_ap_read_status(ADIv5_AP_t *ap, uint16_t addr, uint32_t *value);
+adiv5_status_e adiv5_mem_read_status(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
+adiv5_status_e adiv5_mem_write_status(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len);
+
+size_t adiv5_packed_split(const ADIv5_AP_t *ap, uint32_t addr, size_t len, enum align align, size_t *head);
+size_t adiv5_align_split(uint32_t addr, size_t len, size_t *head);
+enum align adiv5_edge_align(uint32_t addr, size_t len);
+
+/*
+ * Deferred accesses: writes are posted and reads only fill in *result once
+ * adiv5_queue_flush() returns. Probes without a queue perform them at once.
+ * Any immediate access flushes the queue first, keeping the order intact.
+ */
+void adiv5_dp_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *result);
+void adiv5_dp_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+void adiv5_ap_queue_read(ADIv5_AP_t *ap, uint16_t addr, uint32_t *result);
+void adiv5_ap_queue_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
+void adiv5_mem_queue_read32(ADIv5_AP_t *ap, uint32_t addr, uint32_t *result);
+void adiv5_mem_queue_write32(ADIv5_AP_t *ap, uint32_t addr, uint32_t value);
+bool adiv5_queue_flush(ADIv5_DP_t *dp);
+/*
+ * Have the probe read the word at addr until (word & mask) == value, up to
+ * its own bound of retries, in one round trip. True on a match. Probes that
+ * can not match reads return false without an access, so a caller polls on
+ * with its usual read loop after this either way.
+ */
+bool adiv5_mem_poll32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t value);
 uint64_t adiv5_ap_read_pidr(ADIv5_AP_t *ap, uint32_t addr);
 void *extract(void *dest, uint32_t src, uint32_t val, enum align align);
 
@@ -383,6 +524,8 @@ void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
 void firmware_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
 uint32_t firmware_ap_read(ADIv5_AP_t *ap, uint16_t addr);
 uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value);
+/* count accesses of one register back to back in an overrun detection burst */
+void firmware_swdp_burst_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t *values, size_t count);
 uint32_t fw_adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value);
 uint32_t firmware_swdp_read(ADIv5_DP_t *dp, uint16_t addr);
 uint32_t fw_adiv5_jtagdp_read(ADIv5_DP_t *dp, uint16_t addr);
@@ -28,6 +28,7 @@
 #include "jtag_scan.h"
 #include "jtagtap.h"
 #include "morse.h"
+#include "perf.h"
 
 #define JTAGDP_ACK_OK   0x02U
 #define JTAGDP_ACK_WAIT 0x01U
@@ -71,8 +72,32 @@ static uint32_t adiv5_jtagdp_error(ADIv5_DP_t *dp)
 	return fw_adiv5_jtagdp_low_access(dp, ADIV5_LOW_WRITE, ADIV5_DP_CTRLSTAT, 0xf0000032U) & 0x32U;
 }
 
+/*
+ * A JTAG-DP hands back the result of an AP read, or the status of an AP write, in the
+ * capture of whichever scan comes next, and RDBUFF itself reads as zero. When the IR
+ * already holds APACC, collecting through a side effect free read of the AP bank that is
+ * selected saves switching the IR to DPACC and back again around each RDBUFF.
+ */
+static uint16_t adiv5_jtagdp_collect_addr(ADIv5_DP_t *dp)
+{
+	if (jtag_devs[dp->dp_jd_index].current_ir != IR_APACC || !dp->select_valid)
+		return ADIV5_DP_RDBUFF;
+	switch (dp->select & 0xf0U) {
+	case 0x00U: /* CSW, next to TAR and DRW */
+		return ADIV5_AP_CSW;
+	case 0xf0U: /* IDR, next to CFG and BASE */
+		return ADIV5_AP_IDR;
+	default:
+		/* Other banks hold banked data or FIFOs, which a read can disturb */
+		return ADIV5_DP_RDBUFF;
+	}
+}
+
 uint32_t fw_adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value)
 {
+	if (addr == ADIV5_DP_RDBUFF && RnW)
+		addr = adiv5_jtagdp_collect_addr(dp);
+
 	const bool APnDP = addr & ADIV5_APnDP;
 	addr &= 0xff;
 
@@ -83,11 +108,18 @@ uint32_t fw_adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr,
 
 	jtag_dev_write_ir(&jtag_proc, dp->dp_jd_index, APnDP ? IR_APACC : IR_DPACC);
 
+	if (APnDP)
+		PERF_COUNT(RnW ? PERF_AP_READ : PERF_AP_WRITE, 1U);
+	else
+		PERF_COUNT(RnW ? PERF_DP_READ : PERF_DP_WRITE, 1U);
+
 	platform_timeout timeout;
 	platform_timeout_set(&timeout, 250);
 	do {
 		jtag_dev_shift_dr(&jtag_proc, dp->dp_jd_index, (uint8_t *)&response, (uint8_t *)&request, 35);
 		ack = response & 0x07;
+		if (ack == JTAGDP_ACK_WAIT)
+			PERF_COUNT(PERF_ACK_WAIT, 1U);
 	} while (!platform_timeout_is_expired(&timeout) && ack == JTAGDP_ACK_WAIT);
 
 	if (ack == JTAGDP_ACK_WAIT) {
@@ -95,8 +127,10 @@ uint32_t fw_adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr,
 		dp->fault = 1;
 		return 0;
 	}
-	if (ack != JTAGDP_ACK_OK)
-		raise_exception(EXCEPTION_ERROR, "JTAG-DP invalid ACK");
+	if (ack != JTAGDP_ACK_OK) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "JTAG-DP invalid ACK");
+		return 0;
+	}
 
 	return (uint32_t)(response >> 3);
 }
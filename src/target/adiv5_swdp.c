@@ -28,6 +28,7 @@
 #include "adiv5.h"
 #include "target.h"
 #include "target_internal.h"
+#include "perf.h"
 
 uint8_t make_packet_request(uint8_t RnW, uint16_t addr)
 {
@@ -50,10 +51,28 @@ uint8_t make_packet_request(uint8_t RnW, uint16_t addr)
 	return request;
 }
 
+/*
+ * On a multi-drop bus the TARGETSEL last written, so accesses only reselect when they are
+ * for another drop. Each drop keeps its own DP and target, letting several of them be
+ * debugged in turn without a rescan.
+ */
+static uint32_t swdp_targetsel;
+static bool swdp_targetsel_valid;
+
+/*
+ * Multi-drop parts whose DPs stay deselected after a line reset, so a plain DPIDR read goes
+ * unanswered. Each is looked for at all 16 instances when nothing else answers.
+ */
+static const uint32_t swdp_multidrop_targetids[] = {
+	0x01002927U, /* Raspberry Pi RP2040, instance 0 and 1 for the cores, 0xf the rescue DP */
+};
+
 /* Provide bare DP access functions without timeout and exception */
 
 static void dp_line_reset(ADIv5_DP_t *dp)
 {
+	adiv5_shadow_invalidate(dp);
+	swdp_targetsel_valid = false;
 	dp->seq_out(0xFFFFFFFFU, 32U);
 	dp->seq_out(0x0FFFFFFFU, 32U);
 }
@@ -67,15 +86,109 @@ bool firmware_dp_low_write(ADIv5_DP_t *dp, uint16_t addr, const uint32_t data)
 	return (res != 1);
 }
 
+/* Dormant to SWD: 8 cycles high at least, the selection alert and the SW-DP activation code */
+static const uint32_t swdp_dormant_to_swd[] = {
+	0xffffffffU,
+	0xffffffffU,
+	/* 128 bit selection alert sequence for SW-DP-V2 */
+	0x6209f392U,
+	0x86852d95U,
+	0xe3ddafe9U,
+	0x19bc0ea2U,
+	/* 4 cycle low, 0x1a Arm CoreSight SW-DP activation sequence */
+	0x1a0U,
+};
+#define SWDP_DORMANT_TO_SWD_CYCLES (6U * 32U + 12U)
+
+/* The deprecated JTAG to SWD switch, at least 50 cycles high first */
+static const uint32_t swdp_jtag_to_swd[] = {
+	0xffffffffU,
+	0xffffffffU,
+	0xe79eU, /* 0b0111100111100111 */
+};
+#define SWDP_JTAG_TO_SWD_CYCLES (2U * 32U + 16U)
+
+static void swdp_seq_out_bits(ADIv5_DP_t *dp, const uint32_t *seq, size_t cycles)
+{
+	for (size_t i = 0; i < cycles; i += 32U)
+		dp->seq_out(seq[i / 32U], MIN(cycles - i, 32U));
+}
+
+/*
+ * Clock out cycles bits of seq, then the line reset, the TARGETSEL write when
+ * targetsel is given, and the DPIDR read that completes them. Probes that can
+ * send all of it as one command do so, the rest get it piece by piece.
+ * Returns DPIDR, or faults or raises like dp_read() when that fails.
+ */
+static uint32_t swdp_reset_read(ADIv5_DP_t *dp, const uint32_t *seq, size_t cycles, const uint32_t *targetsel)
+{
+	if (targetsel) {
+		swdp_targetsel = *targetsel;
+		swdp_targetsel_valid = true;
+	}
+#if PC_HOSTED == 1
+	if (dp->swd_reset_read) {
+		adiv5_shadow_invalidate(dp);
+		uint32_t dpidr = 0;
+		if (!dp->swd_reset_read(dp, seq, cycles, targetsel, &dpidr))
+			dp->fault = 1;
+		return dpidr;
+	}
+#endif
+	swdp_seq_out_bits(dp, seq, cycles);
+	dp_line_reset(dp);
+	if (targetsel) {
+		dp->dp_low_write(dp, ADIV5_DP_TARGETSEL, *targetsel);
+		/* The line reset dropped the selection, the write made it again */
+		swdp_targetsel_valid = true;
+	}
+	return dp->dp_read(dp, ADIV5_DP_DPIDR);
+}
+
+/* Select a drop: line reset, TARGETSEL, then the DPIDR read that completes the selection */
+static void swdp_select(ADIv5_DP_t *dp, const uint32_t targetsel)
+{
+	swdp_reset_read(dp, NULL, 0, &targetsel);
+}
+
+/* Look for the drops of one TARGETID at each instance, setting up a DP for each that answers */
+static void swdp_scan_drops(ADIv5_DP_t *const initial_dp, const uint32_t targetid)
+{
+	for (volatile size_t i = 0; i < 16U; i++) {
+		volatile struct exception e;
+		TRY_CATCH (e, EXCEPTION_ALL) {
+			swdp_select(initial_dp, (i << ADIV5_DP_TARGETSEL_TINSTANCE_OFFSET) |
+				(targetid & (ADIV5_DP_TARGETSEL_TPARTNO_MASK | ADIV5_DP_TARGETSEL_TDESIGNER_MASK | 1U)));
+		}
+		if (e.type || initial_dp->fault) {
+			initial_dp->fault = 0;
+			swdp_targetsel_valid = false;
+			continue;
+		}
+
+		ADIv5_DP_t *dp = calloc(1, sizeof(*dp));
+		if (!dp) { /* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			continue;
+		}
+
+		memcpy(dp, initial_dp, sizeof(ADIv5_DP_t));
+		dp->instance = i;
+
+		adiv5_dp_init(dp, 0);
+	}
+}
+
 /* Try first the dormant to SWD procedure.
  * If target id given, scan DPs 0 .. 15 on that device and return.
- * Otherwise
+ * Otherwise read the DPIDR and, for a DPv2, scan the instances of its TARGETID.
+ * If nothing answers, look for the known multi-drop parts.
  */
 uint32_t adiv5_swdp_scan(uint32_t targetid)
 {
 	volatile struct exception e;
 
-	target_list_free();
+	adiv5_scan_cache_begin();
 
 	ADIv5_DP_t idp = {
 		.dp_low_write = firmware_dp_low_write,
@@ -86,24 +199,15 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 	};
 	ADIv5_DP_t *initial_dp = &idp;
 
-	if (swdptap_init(initial_dp))
+	if (swdptap_init(initial_dp)) {
+		adiv5_scan_cache_end();
 		return 0;
+	}
 
 	platform_target_clk_output_enable(true);
-	/* DORMANT-> SWD sequence*/
-	initial_dp->seq_out(0xFFFFFFFF, 32);
-	initial_dp->seq_out(0xFFFFFFFF, 32);
-	/* 128 bit selection alert sequence for SW-DP-V2 */
-	initial_dp->seq_out(0x6209f392, 32);
-	initial_dp->seq_out(0x86852d95, 32);
-	initial_dp->seq_out(0xe3ddafe9, 32);
-	initial_dp->seq_out(0x19bc0ea2, 32);
-	/* 4 cycle low,
-	 * 0x1a Arm CoreSight SW-DP activation sequence
-	 * 20 bits start of reset another reset sequence*/
-	initial_dp->seq_out(0x1a0, 12);
-
-	bool scan_multidrop = true;
+
+	volatile bool scan_multidrop = true;
+	volatile bool search_multidrop = false;
 	volatile uint32_t dp_targetid = targetid;
 
 	if (!dp_targetid) {
@@ -111,28 +215,28 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 
 		scan_multidrop = false;
 
-		dp_line_reset(initial_dp);
-
-		volatile uint32_t dp_dpidr;
+		volatile uint32_t dp_dpidr = 0;
 		TRY_CATCH (e, EXCEPTION_ALL) {
-			dp_dpidr = initial_dp->dp_read(initial_dp, ADIV5_DP_DPIDR);
+			dp_dpidr = swdp_reset_read(initial_dp, swdp_dormant_to_swd, SWDP_DORMANT_TO_SWD_CYCLES, NULL);
 		}
 		if (e.type || initial_dp->fault) {
 			DEBUG_WARN("Trying old JTAG to SWD sequence\n");
-			initial_dp->seq_out(0xFFFFFFFF, 32);
-			initial_dp->seq_out(0xFFFFFFFF, 32);
-			initial_dp->seq_out(0xE79E, 16); /* 0b0111100111100111 */
-
-			dp_line_reset(initial_dp);
-
 			initial_dp->fault = 0;
 
 			TRY_CATCH (e, EXCEPTION_ALL) {
-				dp_dpidr = initial_dp->dp_read(initial_dp, ADIV5_DP_DPIDR);
+				dp_dpidr = swdp_reset_read(initial_dp, swdp_jtag_to_swd, SWDP_JTAG_TO_SWD_CYCLES, NULL);
 			}
 			if (e.type || initial_dp->fault) {
-				DEBUG_WARN("No usable DP found\n");
-				return 0;
+				initial_dp->fault = 0;
+				dp_dpidr = 0;
+				if (!initial_dp->dp_low_write) {
+					DEBUG_WARN("No usable DP found\n");
+					adiv5_scan_cache_end();
+					return 0;
+				}
+				DEBUG_WARN("No DP answered, looking for multi-drop parts\n");
+				scan_multidrop = true;
+				search_multidrop = true;
 			}
 		}
 
@@ -146,6 +250,9 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 			dp_targetid = adiv5_dp_read(initial_dp, ADIV5_DP_TARGETID);
 			adiv5_dp_write(initial_dp, ADIV5_DP_SELECT, ADIV5_DP_BANK0);
 		}
+	} else {
+		/* The wake-up goes out on its own, each drop is selected with a line reset after it */
+		swdp_seq_out_bits(initial_dp, swdp_dormant_to_swd, SWDP_DORMANT_TO_SWD_CYCLES);
 	}
 
 	if (!initial_dp->dp_low_write) {
@@ -156,33 +263,22 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 
 	DEBUG_WARN("scan_multidrop: %s\n", scan_multidrop ? "true" : "false");
 
-	const volatile size_t max_dp = (scan_multidrop) ? 16U : 1U;
-	for (volatile size_t i = 0; i < max_dp; i++) {
-		if (scan_multidrop) {
-			dp_line_reset(initial_dp);
-
-			initial_dp->dp_low_write(initial_dp, ADIV5_DP_TARGETSEL,
-				(i << ADIV5_DP_TARGETSEL_TINSTANCE_OFFSET) |
-					(dp_targetid & (ADIV5_DP_TARGETSEL_TPARTNO_MASK | ADIV5_DP_TARGETSEL_TDESIGNER_MASK | 1U)));
-
-			TRY_CATCH (e, EXCEPTION_ALL) {
-				initial_dp->dp_read(initial_dp, ADIV5_DP_DPIDR);
-			}
-			if (e.type || initial_dp->fault)
-				continue;
-		}
-
+	if (search_multidrop) {
+		for (size_t i = 0; i < ARRAY_LENGTH(swdp_multidrop_targetids); ++i)
+			swdp_scan_drops(initial_dp, swdp_multidrop_targetids[i]);
+	} else if (scan_multidrop)
+		swdp_scan_drops(initial_dp, dp_targetid);
+	else {
 		ADIv5_DP_t *dp = calloc(1, sizeof(*dp));
 		if (!dp) { /* calloc failed: heap exhaustion */
 			DEBUG_WARN("calloc: failed in %s\n", __func__);
-			continue;
+			adiv5_scan_cache_end();
+			return 0;
 		}
-
 		memcpy(dp, initial_dp, sizeof(ADIv5_DP_t));
-		dp->instance = i;
-
 		adiv5_dp_init(dp, 0);
 	}
+	adiv5_scan_cache_end();
 	return target_list ? 1U : 0U;
 }
 
@@ -201,9 +297,7 @@ uint32_t firmware_swdp_error(ADIv5_DP_t *dp)
 		/* On protocol error target gets deselected.
 		 * With DP Change, another target needs selection.
 		 * => Reselect with right target! */
-		dp_line_reset(dp);
-		dp->dp_low_write(dp, ADIV5_DP_TARGETSEL, dp->targetsel);
-		dp->dp_read(dp, ADIV5_DP_DPIDR);
+		swdp_select(dp, dp->targetsel);
 		/* Exception here is unexpected, so do not catch */
 	}
 	uint32_t err, clr = 0;
@@ -221,29 +315,130 @@ uint32_t firmware_swdp_error(ADIv5_DP_t *dp)
 
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, clr);
 	dp->fault = 0;
+	adiv5_shadow_invalidate(dp);
 
 	return err;
 }
 
+/* An AP whose accesses WAIT at least this often per window gets more idle cycles */
+#define SWDP_WAIT_WINDOW   64U
+#define SWDP_WAIT_FREQUENT 4U
+#define SWDP_IDLE_STEP     4U
+#define SWDP_IDLE_MAX      32U
+
+/* The WAIT accounting of the AP the shadowed SELECT points at, NULL if unknown */
+static adiv5_ap_wait_s *swdp_ap_wait(ADIv5_DP_t *dp, uint16_t addr)
+{
+	if (!(addr & ADIV5_APnDP) || !dp->select_valid || (dp->select >> 24U) >= ADIV5_WAIT_APS)
+		return NULL;
+	return &dp->ap_wait[dp->select >> 24U];
+}
+
+/*
+ * Learn from the WAITs of an AP: while they are frequent, give it more idle
+ * cycles after each access to finish in, and back off again one cycle per
+ * window without any.
+ */
+static void swdp_wait_account(adiv5_ap_wait_s *wait, uint32_t waits)
+{
+	wait->waits = MIN(wait->waits + waits, UINT8_MAX);
+	if (++wait->accesses < SWDP_WAIT_WINDOW)
+		return;
+	if (wait->waits >= SWDP_WAIT_FREQUENT && wait->idle_cycles < SWDP_IDLE_MAX)
+		wait->idle_cycles += SWDP_IDLE_STEP;
+	else if (!wait->waits && wait->idle_cycles)
+		--wait->idle_cycles;
+	wait->accesses = 0;
+	wait->waits = 0;
+}
+
+/*
+ * With CTRL/STAT ORUNDETECT set every access has a data phase, whatever the
+ * ACK, and a WAIT or FAULT sets STICKYORUN for the owner of the burst to find
+ * once at the end. So no per-access retry, and no idle cycles between writes.
+ */
+static uint32_t swdp_overrun_access(ADIv5_DP_t *dp, uint8_t request, uint8_t RnW, uint32_t value)
+{
+	uint32_t response = value;
+	const bool fused = dp->swd_transaction;
+	uint32_t ack;
+	if (fused)
+		ack = dp->swd_transaction(request, &response, true);
+	else {
+		dp->seq_out(request, 8);
+		ack = dp->seq_in(3);
+	}
+	const bool parity_error = ack & SWDP_ACK_PARITY;
+	ack &= ~SWDP_ACK_PARITY;
+	if (ack == SWDP_ACK_WAIT)
+		PERF_COUNT(PERF_ACK_WAIT, 1U);
+	else if (ack == SWDP_ACK_FAULT)
+		PERF_COUNT(PERF_ACK_FAULT, 1U);
+	else if (ack != SWDP_ACK_OK) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP invalid ACK");
+		return 0;
+	}
+
+	if (RnW) {
+		/* Only the data of an OK is meaningful, STICKYORUN covers the rest */
+		if ((fused ? parity_error : dp->seq_in_parity(&response, 32)) && ack == SWDP_ACK_OK) {
+			dp->fault = 1;
+			adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP Parity error");
+			return 0;
+		}
+		return response;
+	}
+	if (!fused)
+		dp->seq_out_parity(value, 32);
+	return 0;
+}
+
 uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value)
 {
 	uint8_t request = make_packet_request(RnW, addr);
-	uint32_t response = 0;
+	uint32_t response = value;
 	uint32_t ack = SWDP_ACK_WAIT;
+	const bool fused = dp->swd_transaction;
 	platform_timeout timeout;
 
+	/* On a multi-drop bus, reselect when the last access was for another drop */
+	if (dp->targetsel && dp->dp_low_write && (!swdp_targetsel_valid || swdp_targetsel != dp->targetsel))
+		swdp_select(dp, dp->targetsel);
+
 	if ((addr & ADIV5_APnDP) && dp->fault)
 		return 0;
 
+	if (addr & ADIV5_APnDP)
+		PERF_COUNT(RnW ? PERF_AP_READ : PERF_AP_WRITE, 1U);
+	else
+		PERF_COUNT(RnW ? PERF_DP_READ : PERF_DP_WRITE, 1U);
+
+	if (dp->overrun_burst)
+		return swdp_overrun_access(dp, request, RnW, value);
+
+	adiv5_ap_wait_s *const wait = swdp_ap_wait(dp, addr);
+	uint32_t waits = 0;
 	platform_timeout_set(&timeout, 250);
 	do {
-		dp->seq_out(request, 8);
-		ack = dp->seq_in(3);
+		/* The fused transaction also does the data phase, as soon as the ACK is OK */
+		if (fused)
+			ack = dp->swd_transaction(request, &response, false);
+		else {
+			dp->seq_out(request, 8);
+			ack = dp->seq_in(3);
+		}
+		if (ack == SWDP_ACK_WAIT) {
+			PERF_COUNT(PERF_ACK_WAIT, 1U);
+			++waits;
+		}
 		if (ack == SWDP_ACK_FAULT) {
+			PERF_COUNT(PERF_ACK_FAULT, 1U);
 			/* On fault, abort the request and repeat */
 			dp->error(dp);
 		}
 	} while ((ack == SWDP_ACK_WAIT || ack == SWDP_ACK_FAULT) && !platform_timeout_is_expired(&timeout));
+	if (wait)
+		swdp_wait_account(wait, waits);
 
 	if (ack == SWDP_ACK_WAIT) {
 		dp->abort(dp, ADIV5_DP_ABORT_DAPABORT);
@@ -256,16 +451,23 @@ uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, ui
 		return 0;
 	}
 
-	if (ack != SWDP_ACK_OK)
-		raise_exception(EXCEPTION_ERROR, "SWDP invalid ACK");
+	const bool parity_error = ack & SWDP_ACK_PARITY;
+	if ((ack & ~SWDP_ACK_PARITY) != SWDP_ACK_OK) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP invalid ACK");
+		return 0;
+	}
 
 	if (RnW) {
-		if (dp->seq_in_parity(&response, 32)) { /* Give up on parity error */
+		/* Give up on parity error */
+		if (fused ? parity_error : dp->seq_in_parity(&response, 32)) {
 			dp->fault = 1;
-			raise_exception(EXCEPTION_ERROR, "SWDP Parity error");
+			adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP Parity error");
+			return 0;
 		}
 	} else {
-		dp->seq_out_parity(value, 32);
+		if (!fused)
+			dp->seq_out_parity(value, 32);
+		response = 0;
 		/* ARM Debug Interface Architecture Specification ADIv5.0 to ADIv5.2
 		 * tells to clock the data through SW-DP to either :
 		 * - immediate start a new transaction
@@ -277,9 +479,32 @@ uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, ui
 		 */
 		dp->seq_out(0, 8);
 	}
+	/* Give an AP that keeps WAITing time to finish before the next request */
+	if (wait && wait->idle_cycles)
+		dp->seq_out(0, wait->idle_cycles);
 	return response;
 }
 
+void firmware_swdp_burst_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t *values, size_t count)
+{
+	if (!dp->swd_burst) {
+		for (size_t i = 0; i < count; ++i) {
+			const uint32_t response = firmware_swdp_low_access(dp, RnW, addr, values[i]);
+			if (RnW)
+				values[i] = response;
+		}
+		return;
+	}
+
+	if ((addr & ADIV5_APnDP) && dp->fault)
+		return;
+	PERF_COUNT(RnW ? PERF_AP_READ : PERF_AP_WRITE, count);
+	if (dp->swd_burst(make_packet_request(RnW, addr), values, count) < count) {
+		dp->fault = 1;
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP invalid ACK or parity error in burst");
+	}
+}
+
 void firmware_swdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
@@ -24,6 +24,9 @@
 	/!\ There is some sort of bus stall/bus arbitration going on that does NOT work when
 	programmed through SWD/jtag
 	The workaround is to wait a few cycles before filling the write buffer. This is performed by reading the flash a few times
+	Pages are therefore programmed by a loader resident in SRAM (flashstub/ch32f1_loader.s), which runs the fast mode
+	sequence from the core where the stall does not happen, while the probe hands it the next page.
+	Whole 1K pages are erased with the standard page erase, 128 bytes pages with the fast one.
 
  */
 
@@ -31,11 +34,17 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flash_loader.h"
+
+static const uint16_t ch32f1_flash_write_stub[] = {
+#include "flashstub/ch32f1_loader.stub"
+};
 
 extern const struct command_s stm32f1_cmd_list[]; // Reuse stm32f1 stuff
 
+static bool ch32f1_flash_prepare(target_flash_s *f);
+static bool ch32f1_flash_done(target_flash_s *f);
 static bool ch32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 
 // these are common with stm32f1/gd32f1/...
 #define FPEC_BASE						0x40022000
@@ -46,6 +55,7 @@ static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void
 #define FLASH_AR						(FPEC_BASE + 0x14)
 #define FLASH_CR_LOCK					(1 << 7)
 #define FLASH_CR_STRT					(1 << 6)
+#define FLASH_CR_PER					(1 << 1)
 #define FLASH_SR_BSY					(1 << 0)
 #define KEY1 							0x45670123
 #define KEY2 							0xCDEF89AB
@@ -64,6 +74,13 @@ static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void
 #define FLASH_CR_BUF_RESET_CH32   		(1 << 19) // Buffer reset
 #define FLASH_SR_EOP			  		(1 << 5)  // End of programming
 #define FLASH_BEGIN_ADDRESS_CH32  		0x8000000
+#define FLASH_PAGE_SIZE_CH32			1024U // standard page erase
+#define SRAM_BASE						0x20000000U
+
+struct ch32f1_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+};
 
 /**
 		\fn ch32f1_add_flash
@@ -71,35 +88,45 @@ static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void
 */
 static void ch32f1_add_flash(target *t, uint32_t addr, size_t length, size_t erasesize)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct ch32f1_flash *cf = calloc(1, sizeof(*cf));
+	if (!cf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	flash_loader_s *loader = &cf->loader;
+	loader->code = ch32f1_flash_write_stub;
+	loader->code_size = sizeof(ch32f1_flash_write_stub);
+	loader->load_addr = SRAM_BASE;
+	loader->buffer_size = erasesize;
+	loader->param = FPEC_BASE;
+
+	target_flash_s *f = &cf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
+	f->large_blocksize = FLASH_PAGE_SIZE_CH32;
+	f->prepare = ch32f1_flash_prepare;
 	f->erase = ch32f1_flash_erase;
-	f->write = ch32f1_flash_write;
-	f->writesize = erasesize;
+	f->done = ch32f1_flash_done;
 	f->erased = 0xff;
+	f->loader = loader;
 	target_add_flash(t, f);
 }
 
 #define WAIT_BUSY() do { \
 	sr = target_mem_read32(t, FLASH_SR); \
 	if (target_check_error(t)) { \
-		DEBUG_WARN("ch32f1 flash write: comm error\n"); \
-		return -1; \
+		DEBUG_WARN("ch32f1 flash erase: comm error\n"); \
+		return false; \
 	} \
 } while (sr & FLASH_SR_BSY);
 
 #define WAIT_EOP() do { \
 	sr = target_mem_read32(t, FLASH_SR); \
 	if (target_check_error(t)) { \
-		DEBUG_WARN("ch32f1 flash write: comm error\n"); \
-		return -1; \
+		DEBUG_WARN("ch32f1 flash erase: comm error\n"); \
+		return false; \
 	} \
 } while (!(sr & FLASH_SR_EOP));
 
@@ -166,7 +193,7 @@ bool ch32f1_probe(target *t)
 	if ((t->cpuid & CPUID_PARTNO_MASK) != CORTEX_M3)
 		return false;
 
-	const uint32_t dbgmcu_idcode = target_mem_read32(t, DBGMCU_IDCODE);
+	const uint32_t dbgmcu_idcode = cortexm_probe_id_read32(t, DBGMCU_IDCODE);
 	const uint32_t device_id = dbgmcu_idcode & 0x00000fffU;
 	const uint32_t revision_id = (dbgmcu_idcode & 0xffff0000U) >> 16;
 
@@ -196,9 +223,25 @@ bool ch32f1_probe(target *t)
 	return true;
 }
 
+/* The flash stays unlocked, fast mode included, for the whole flash session */
+static bool ch32f1_flash_prepare(target_flash_s *f)
+{
+	if (ch32f1_flash_unlock(f->t)) {
+		DEBUG_WARN("CH32: Unlock failed\n");
+		return false;
+	}
+	return true;
+}
+
+static bool ch32f1_flash_done(target_flash_s *f)
+{
+	ch32f1_flash_lock(f->t);
+	return true;
+}
+
 /**
   \fn ch32f1_flash_erase
-  \brief fast erase of CH32
+  \brief fast erase of CH32, or standard erase of whole 1K pages
 */
 bool ch32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
@@ -206,9 +249,20 @@ bool ch32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	target *t = f->t;
 	DEBUG_INFO("CH32: flash erase \n");
 
-	if (ch32f1_flash_unlock(t)) {
-		DEBUG_WARN("CH32: Unlock failed\n");
-		return false;
+	if (len >= FLASH_PAGE_SIZE_CH32) {
+		// Standard 1K page erase, the flash layer only hands us whole pages
+		while (len) {
+			SET_CR(FLASH_CR_PER);
+			target_mem_write32(t, FLASH_AR, addr);
+			SET_CR(FLASH_CR_STRT);
+			WAIT_BUSY();
+			CLEAR_CR(FLASH_CR_PER | FLASH_CR_STRT);
+			if (len > FLASH_PAGE_SIZE_CH32)
+				len -= FLASH_PAGE_SIZE_CH32;
+			else
+				len = 0;
+			addr += FLASH_PAGE_SIZE_CH32;
+		}
 	}
 	// Fast Erase 128 bytes pages (ch32 mode)
 	while (len) {
@@ -228,147 +282,12 @@ bool ch32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 			len = 0;
 		addr += 128;
 	}
+	CLEAR_CR(FLASH_CR_FTER_CH32);
 	sr = target_mem_read32(t, FLASH_SR);
-	ch32f1_flash_lock(t);
 	if (sr & SR_ERROR_MASK) {
 		DEBUG_WARN("ch32f1 flash erase error 0x%" PRIx32 "\n", sr);
+		target_mem_write32(t, FLASH_SR, SR_ERROR_MASK);
 		return false;
 	}
 	return true;
 }
-
-/**
-	\fn ch32f1_wait_flash_ready
-	\brief   Wait a bit for the previous operation to finish
-			As per test result we need a time similar to 10 read operation over SWD
-			We do 32 to have a bit of headroom, then we check we read ffff (erased flash)
-			NB: Just reading fff is not enough as it could be a transient previous operation value
-*/
-
-static bool ch32f1_wait_flash_ready(target *t, uint32_t addr)
-{
-	uint32_t ff = 0;
-	for (size_t i = 0; i < 32; i++)
-		ff = target_mem_read32(t, addr);
-	if (ff != 0xffffffffUL) {
-		DEBUG_WARN("ch32f1 Not erased properly at %" PRIx32 " or flash access issue\n", addr);
-		return false;
-	}
-	return true;
-}
-/**
-  \fn ch32f1_flash_write
-  \brief fast flash for ch32. Load 128 bytes chunk and then flash them
-*/
-
-static int ch32f1_upload(target *t, uint32_t dest, const void *src, uint32_t offset)
-{
-	volatile uint32_t sr, magic;
-	const uint32_t *ss = (const uint32_t *)(src+offset);
-	uint32_t dd = dest + offset;
-
-	SET_CR(FLASH_CR_FTPG_CH32);
-	target_mem_write32(t, dd + 0, ss[0]);
-	target_mem_write32(t, dd + 4, ss[1]);
-	target_mem_write32(t, dd + 8, ss[2]);
-	target_mem_write32(t, dd + 12, ss[3]);
-	SET_CR(FLASH_CR_BUF_LOAD_CH32); /* BUF LOAD */
-	WAIT_EOP();
-	CLEAR_EOP();
-	CLEAR_CR(FLASH_CR_FTPG_CH32);
-	MAGIC(dest + offset);
-	return 0;
-}
-/**
-	\fn ch32f1_buffer_clear
-	\brief clear the write buffer
-*/
-static int ch32f1_buffer_clear(target *t)
-{
-	volatile uint32_t sr;
-	SET_CR(FLASH_CR_FTPG_CH32); // Fast page program 4-
-	SET_CR(FLASH_CR_BUF_RESET_CH32); // BUF_RESET 5-
-	WAIT_BUSY(); // 6-
-	CLEAR_CR(FLASH_CR_FTPG_CH32); // Fast page program 4-
-	return 0;
-}
-//#define CH32_VERIFY
-
-/**
-
-*/
-static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
-{
-	volatile uint32_t sr, magic;
-	target *t = f->t;
-	size_t length = len;
-#ifdef CH32_VERIFY
-	target_addr_t org_dest = dest;
-	const void *org_src = src;
-#endif
-	DEBUG_INFO("CH32: flash write 0x%" PRIx32 " ,size=%" PRIu32 "\n", dest, (uint32_t)len);
-
-	while (length > 0)
-	{
-		if (ch32f1_flash_unlock(t)) {
-			DEBUG_WARN("ch32f1 cannot fast unlock\n");
-			return false;
-		}
-		WAIT_BUSY();
-
-		// Buffer reset...
-		ch32f1_buffer_clear(t);
-		// Load 128 bytes to buffer
-		if (!ch32f1_wait_flash_ready(t,dest))
-			return false;
-
-		for (size_t i = 0; i < 8; i++) {
-			if (ch32f1_upload(t, dest, src, i * 16U)) {
-	  			DEBUG_WARN("Cannot upload to buffer\n");
-				return false;
-			}
-		}
-		// write buffer
-		SET_CR(FLASH_CR_FTPG_CH32);
-		target_mem_write32(t, FLASH_AR, dest); // 10
-		SET_CR(FLASH_CR_STRT); // 11 Start
-		WAIT_EOP(); // 12
-		CLEAR_EOP();
-		CLEAR_CR(FLASH_CR_FTPG_CH32);
-
-		MAGIC(dest);
-
-		// next
-		if (length > 128)
-			length -=128;
-		else
-			length = 0;
-		dest += 128;
-		src += 128;
-
-		sr = target_mem_read32(t, FLASH_SR); // 13
-		ch32f1_flash_lock(t);
-		if (sr & SR_ERROR_MASK) {
-			DEBUG_WARN("ch32f1 flash write error 0x%" PRIx32 "\n", sr);
-			return false;
-		}
-	}
-
-#ifdef CH32_VERIFY
-	DEBUG_INFO("Verifying\n");
-	for (size_t i = 0; i < len; i += 4)
-	{
-		const uint32_t expected = *(uint32_t *)(org_src + i);
-		const uint32_t actual = target_mem_read32(t, org_dest + i);
-		if (expected != actual)
-		{
-			DEBUG_WARN(">>>>write mistmatch at address 0x%" PRIx32 "\n", org_dest + i);
-			DEBUG_WARN(">>>>expected: 0x%" PRIx32 "\n", expected);
-			DEBUG_WARN(">>>>  actual: 0x%" PRIx32 "\n", actual);
-			return false;
-		}
-	}
-#endif
-
-	return true;
-}
@@ -46,6 +46,7 @@ static void cortexa_regs_read(target *t, void *data);
 static void cortexa_regs_write(target *t, const void *data);
 static void cortexa_regs_read_internal(target *t);
 static void cortexa_regs_write_internal(target *t);
+static void cortexa_vfp_read(target *t);
 static ssize_t cortexa_reg_read(target *t, int reg, void *data, size_t max);
 static ssize_t cortexa_reg_write(target *t, int reg, const void *data, size_t max);
 
@@ -65,12 +66,23 @@ static uint32_t read_gpreg(target *t, uint8_t regno);
 struct cortexa_priv {
 	uint32_t base;
 	ADIv5_AP_t *apb;
+	ADIv5_AP_t *sysap; /* system bus MEM-AP for bulk data, NULL to use the DCC */
 	struct {
 		uint32_t r[16];
 		uint32_t cpsr;
 		uint32_t fpscr;
 		uint64_t d[16];
 	} reg_cache;
+	/* The core registers are read on every halt, the rest of the state is read
+	 * once on first use and kept until the core runs again */
+	bool vfp_valid; /* fpscr and d[] in reg_cache hold the core's values */
+	bool vfp_dirty; /* fpscr or d[] changed, only then are they written back */
+	bool sctlr_valid;
+	uint32_t sctlr;
+	/* last virtual to physical page translation */
+	bool page_valid;
+	uint32_t va_page;
+	uint32_t pa_page;
 	unsigned hw_breakpoint_max;
 	uint16_t hw_breakpoint_mask;
 	uint32_t bcr0;
@@ -80,9 +92,21 @@ struct cortexa_priv {
 	bool mmu_fault;
 };
 
-/* This may be specific to Cortex-A9 */
+/* This may be specific to Cortex-A9, longer lines are covered several times over */
 #define CACHE_LINE_LENGTH (8 * 4)
 
+/* Accesses this long and longer go through the system bus MEM-AP if there is one,
+ * shorter ones cost less as DCC transfers than the setup the MEM-AP path needs */
+#define CORTEXA_SYSAP_MIN_LEN 64U
+/* APs looked at for a system bus MEM-AP */
+#define CORTEXA_SYSAP_MAX_APSEL 8U
+/* The smallest MMU mapping, each one is translated on its own */
+#define CORTEXA_PAGE_SIZE 4096U
+
+#define ARM_AP_TYPE_AHB  1U
+#define ARM_AP_TYPE_AXI  4U
+#define ARM_AP_TYPE_AHB5 5U
+
 /* Debug APB registers */
 #define DBGDIDR 0
 
@@ -147,11 +171,19 @@ struct cortexa_priv {
 #define PAR     CPREG(15, 0, 0, 7, 4, 0)
 #define ATS1CPR CPREG(15, 0, 0, 7, 8, 0)
 
+/* System control register CP15 */
+#define SCTLR               CPREG(15, 0, 0, 1, 0, 0)
+#define SCTLR_MMU_ENABLE    (1 << 0)
+#define SCTLR_DCACHE_ENABLE (1 << 2)
+
 /* Cache management registers CP15 */
 #define ICIALLU  CPREG(15, 0, 0, 7, 5, 0)
 #define DCCIMVAC CPREG(15, 0, 0, 7, 14, 1)
 #define DCCMVAC  CPREG(15, 0, 0, 7, 10, 1)
 
+/* add r0, r0, #CACHE_LINE_LENGTH */
+#define ADD_R0_CACHE_LINE (0xe2800000 | CACHE_LINE_LENGTH)
+
 /* Thumb mode bit in CPSR */
 #define CPSR_THUMB (1 << 5)
 
@@ -316,7 +348,7 @@ static void apb_write(target *t, uint16_t reg, uint32_t val)
 	ADIv5_AP_t *ap = priv->apb;
 	uint32_t addr = priv->base + 4 * reg;
 	adiv5_ap_write(ap, ADIV5_AP_TAR, addr);
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, val);
+	adiv5_ap_write(ap, ADIV5_AP_DRW, val);
 }
 
 static uint32_t apb_read(target *t, uint16_t reg)
@@ -325,13 +357,14 @@ static uint32_t apb_read(target *t, uint16_t reg)
 	ADIv5_AP_t *ap = priv->apb;
 	uint32_t addr = priv->base + 4 * reg;
 	adiv5_ap_write(ap, ADIV5_AP_TAR, addr);
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
-	return adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+	return adiv5_ap_read(ap, ADIV5_AP_DRW);
 }
 
 static uint32_t va_to_pa(target *t, uint32_t va)
 {
 	struct cortexa_priv *priv = t->priv;
+	if (priv->page_valid && priv->va_page == (va & ~0xfff))
+		return priv->pa_page | (va & 0xfff);
 	write_gpreg(t, 0, va);
 	apb_write(t, DBGITR, MCR | ATS1CPR);
 	apb_write(t, DBGITR, MRC | PAR);
@@ -340,9 +373,25 @@ static uint32_t va_to_pa(target *t, uint32_t va)
 		priv->mmu_fault = true;
 	uint32_t pa = (par & ~0xfff) | (va & 0xfff);
 	DEBUG_INFO("%s: VA = 0x%08" PRIx32 ", PAR = 0x%08" PRIx32 ", PA = 0x%08" PRIX32 "\n", __func__, va, par, pa);
+	if (!(par & 1)) {
+		priv->va_page = va & ~0xfff;
+		priv->pa_page = par & ~0xfff;
+		priv->page_valid = true;
+	}
 	return pa;
 }
 
+static uint32_t cortexa_sctlr(target *t)
+{
+	struct cortexa_priv *priv = t->priv;
+	if (!priv->sctlr_valid) {
+		apb_write(t, DBGITR, MRC | SCTLR);
+		priv->sctlr = read_gpreg(t, 0);
+		priv->sctlr_valid = true;
+	}
+	return priv->sctlr;
+}
+
 static void cortexa_slow_mem_read(target *t, void *dest, target_addr_t src, size_t len)
 {
 	struct cortexa_priv *priv = t->priv;
@@ -436,14 +485,133 @@ static void cortexa_slow_mem_write(target *t, target_addr_t dest, const void *sr
 	}
 }
 
+/* Clean, and optionally invalidate, the data cache lines holding [addr, addr + len) */
+static void cortexa_cache_clean(target *t, target_addr_t addr, size_t len, bool invalidate)
+{
+	const uint32_t cache_op = MCR | (invalidate ? DCCIMVAC : DCCMVAC);
+	const target_addr_t mem_end = addr + len;
+	addr &= ~(CACHE_LINE_LENGTH - 1U);
+	/* r0 walks the lines, one instruction to operate on each and one to step */
+	write_gpreg(t, 0, addr);
+	for (; addr < mem_end; addr += CACHE_LINE_LENGTH) {
+		apb_write(t, DBGITR, cache_op);
+		apb_write(t, DBGITR, ADD_R0_CACHE_LINE);
+	}
+}
+
+/* Get the caches out of the way of a system bus access to [addr, addr + len), returns SCTLR */
+static uint32_t cortexa_sysap_prepare(target *t, target_addr_t addr, size_t len, bool write)
+{
+	const uint32_t sctlr = cortexa_sctlr(t);
+	/* Dirty lines are written back before the bus is read, and dropped before it is written so
+	 * neither a later eviction nor the core reading them hides the new data */
+	if (sctlr & SCTLR_DCACHE_ENABLE)
+		cortexa_cache_clean(t, addr, len, write);
+	return sctlr;
+}
+
+/* Length of the part of [addr, addr + len) in the same MMU page as addr */
+static size_t cortexa_page_chunk(target_addr_t addr, size_t len)
+{
+	return MIN(len, CORTEXA_PAGE_SIZE - (addr & (CORTEXA_PAGE_SIZE - 1U)));
+}
+
+static void cortexa_mem_read(target *t, void *dest, target_addr_t src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	if (!priv->sysap || len < CORTEXA_SYSAP_MIN_LEN) {
+		cortexa_slow_mem_read(t, dest, src, len);
+		return;
+	}
+
+	const uint32_t sctlr = cortexa_sysap_prepare(t, src, len, false);
+	uint8_t *data = dest;
+	while (len) {
+		const size_t chunk = cortexa_page_chunk(src, len);
+		const uint32_t pa = (sctlr & SCTLR_MMU_ENABLE) ? va_to_pa(t, src) : src;
+		if (priv->mmu_fault)
+			return;
+		adiv5_mem_read(priv->sysap, data, pa, chunk);
+		data += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+}
+
+static void cortexa_mem_write(target *t, target_addr_t dest, const void *src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	if (!priv->sysap || len < CORTEXA_SYSAP_MIN_LEN) {
+		cortexa_slow_mem_write(t, dest, src, len);
+		return;
+	}
+
+	const uint32_t sctlr = cortexa_sysap_prepare(t, dest, len, true);
+	const uint8_t *data = src;
+	while (len) {
+		const size_t chunk = cortexa_page_chunk(dest, len);
+		const uint32_t pa = (sctlr & SCTLR_MMU_ENABLE) ? va_to_pa(t, dest) : dest;
+		if (priv->mmu_fault)
+			return;
+		adiv5_mem_write(priv->sysap, pa, data, chunk);
+		data += chunk;
+		dest += chunk;
+		len -= chunk;
+	}
+}
+
 static bool cortexa_check_error(target *t)
 {
 	struct cortexa_priv *priv = t->priv;
 	bool err = priv->mmu_fault;
 	priv->mmu_fault = false;
+	if (priv->sysap)
+		err |= adiv5_dp_error(priv->sysap->dp) != 0;
 	return err;
 }
 
+/*
+ * Look for a MEM-AP onto the system bus next to the debug APB-AP, AXI preferred to AHB.
+ * Zynq, i.MX6 and STM32MP1 have one, and it moves bulk data far faster than the DCC.
+ */
+static ADIv5_AP_t *cortexa_sysap_find(ADIv5_AP_t *apb)
+{
+#if PC_HOSTED == 1
+	/* Backends that set up their APs one by one only know the ones the scan went through */
+	if (apb->dp->ap_setup)
+		return NULL;
+#endif
+	ADIv5_AP_t *sysap = NULL;
+	for (uint8_t apsel = 0; apsel < CORTEXA_SYSAP_MAX_APSEL; ++apsel) {
+		if (apsel == apb->apsel)
+			continue;
+		ADIv5_AP_t *ap = adiv5_new_ap(apb->dp, apsel);
+		if (!ap)
+			continue;
+		const uint32_t type = ap->idr & 0xfU;
+		const bool system = (ap->idr & ADIV5_AP_IDR_CLASS_MASK) == ADIV5_AP_IDR_CLASS_MEM &&
+			(type == ARM_AP_TYPE_AHB || type == ARM_AP_TYPE_AXI || type == ARM_AP_TYPE_AHB5);
+		if (system && (!sysap || (type == ARM_AP_TYPE_AXI && (sysap->idr & 0xfU) != ARM_AP_TYPE_AXI))) {
+			if (sysap)
+				adiv5_ap_unref(sysap);
+			sysap = ap;
+		} else
+			adiv5_ap_unref(ap);
+	}
+	if (sysap)
+		DEBUG_INFO("Cortex-A: bulk memory access through AP %u\n", sysap->apsel);
+	return sysap;
+}
+
+static void cortexa_priv_free(void *priv)
+{
+	struct cortexa_priv *const cpriv = priv;
+	if (cpriv->sysap)
+		adiv5_ap_unref(cpriv->sysap);
+	adiv5_ap_unref(cpriv->apb);
+	free(priv);
+}
+
 bool cortexa_probe(ADIv5_AP_t *apb, uint32_t debug_base)
 {
 	target *t;
@@ -461,10 +629,11 @@ bool cortexa_probe(ADIv5_AP_t *apb, uint32_t debug_base)
 	}
 
 	t->priv = priv;
-	t->priv_free = free;
+	t->priv_free = cortexa_priv_free;
 	priv->apb = apb;
-	t->mem_read = cortexa_slow_mem_read;
-	t->mem_write = cortexa_slow_mem_write;
+	priv->sysap = cortexa_sysap_find(apb);
+	t->mem_read = cortexa_mem_read;
+	t->mem_write = cortexa_mem_write;
 
 	priv->base = debug_base;
 	/* Set up APB CSW, we won't touch this again */
@@ -538,6 +707,7 @@ bool cortexa_attach(target *t)
 	priv->bcr0 = 0;
 
 	platform_nrst_set_val(false);
+	adiv5_shadow_invalidate(priv->apb->dp);
 
 	return true;
 }
@@ -603,6 +773,7 @@ static void write_gpreg(target *t, uint8_t regno, uint32_t val)
 static void cortexa_regs_read(target *t, void *data)
 {
 	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
+	cortexa_vfp_read(t);
 	memcpy(data, &priv->reg_cache, t->regs_size);
 }
 
@@ -610,6 +781,8 @@ static void cortexa_regs_write(target *t, const void *data)
 {
 	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
 	memcpy(&priv->reg_cache, data, t->regs_size);
+	priv->vfp_valid = true;
+	priv->vfp_dirty = true;
 }
 
 static ssize_t ptr_for_reg(target *t, int reg, void **r)
@@ -635,6 +808,8 @@ static ssize_t ptr_for_reg(target *t, int reg, void **r)
 
 static ssize_t cortexa_reg_read(target *t, int reg, void *data, size_t max)
 {
+	if (reg >= 17)
+		cortexa_vfp_read(t);
 	void *r = NULL;
 	size_t s = ptr_for_reg(t, reg, &r);
 	if (s > max)
@@ -645,11 +820,16 @@ static ssize_t cortexa_reg_read(target *t, int reg, void *data, size_t max)
 
 static ssize_t cortexa_reg_write(target *t, int reg, const void *data, size_t max)
 {
+	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
+	if (reg >= 17)
+		cortexa_vfp_read(t);
 	void *r = NULL;
 	size_t s = ptr_for_reg(t, reg, &r);
 	if (s > max)
 		return -1;
 	memcpy(r, data, s);
+	if (reg >= 17)
+		priv->vfp_dirty = true;
 	return s;
 }
 
@@ -666,6 +846,19 @@ static void cortexa_regs_read_internal(target *t)
 	/* Read CPSR */
 	apb_write(t, DBGITR, 0xE10F0000); /* mrs r0, CPSR */
 	priv->reg_cache.cpsr = read_gpreg(t, 0);
+	priv->reg_cache.r[15] -= (priv->reg_cache.cpsr & CPSR_THUMB) ? 4 : 8;
+	/* The rest is read when first asked for */
+	priv->vfp_valid = false;
+	priv->vfp_dirty = false;
+	priv->sctlr_valid = false;
+	priv->page_valid = false;
+}
+
+static void cortexa_vfp_read(target *t)
+{
+	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
+	if (priv->vfp_valid)
+		return;
 	/* Read FPSCR */
 	apb_write(t, DBGITR, 0xeef10a10); /* vmrs r0, fpscr */
 	priv->reg_cache.fpscr = read_gpreg(t, 0);
@@ -675,21 +868,24 @@ static void cortexa_regs_read_internal(target *t)
 		apb_write(t, DBGITR, 0xEC510B10 | i); /* vmov r0, r1, d0 */
 		priv->reg_cache.d[i] = ((uint64_t)read_gpreg(t, 1) << 32) | read_gpreg(t, 0);
 	}
-	priv->reg_cache.r[15] -= (priv->reg_cache.cpsr & CPSR_THUMB) ? 4 : 8;
+	priv->vfp_valid = true;
 }
 
 static void cortexa_regs_write_internal(target *t)
 {
 	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
-	/* First write back floats */
-	for (int i = 0; i < 16; i++) {
-		write_gpreg(t, 1, priv->reg_cache.d[i] >> 32);
-		write_gpreg(t, 0, priv->reg_cache.d[i]);
-		apb_write(t, DBGITR, 0xec410b10 | i); /* vmov d[i], r0, r1 */
+	/* First write back floats, if they were changed */
+	if (priv->vfp_dirty) {
+		for (int i = 0; i < 16; i++) {
+			write_gpreg(t, 1, priv->reg_cache.d[i] >> 32);
+			write_gpreg(t, 0, priv->reg_cache.d[i]);
+			apb_write(t, DBGITR, 0xec410b10 | i); /* vmov d[i], r0, r1 */
+		}
+		/* Write back FPSCR */
+		write_gpreg(t, 0, priv->reg_cache.fpscr);
+		apb_write(t, DBGITR, 0xeee10a10); /* vmsr fpscr, r0 */
+		priv->vfp_dirty = false;
 	}
-	/* Write back FPSCR */
-	write_gpreg(t, 0, priv->reg_cache.fpscr);
-	apb_write(t, DBGITR, 0xeee10a10); /* vmsr fpscr, r0 */
 	/* Write back the CPSR */
 	write_gpreg(t, 0, priv->reg_cache.cpsr);
 	apb_write(t, DBGITR, 0xe12ff000); /* msr CPSR_fsxc, r0 */
@@ -720,14 +916,17 @@ static void cortexa_reset(target *t)
 	/* Spin until Xilinx reconnects us */
 	platform_timeout timeout;
 	platform_timeout_set(&timeout, 1000);
-	volatile struct exception e;
+	ADIv5_DP_t *dp = ((struct cortexa_priv *)t->priv)->apb->dp;
+	/* The reset takes the debug logic with it, so SELECT, CSW and TAR are no longer known */
+	adiv5_shadow_invalidate(dp);
+	adiv5_status_e status;
 	do {
-		TRY_CATCH (e, EXCEPTION_ALL) {
-			apb_read(t, DBGDIDR);
-		}
-	} while (!platform_timeout_is_expired(&timeout) && e.type == EXCEPTION_ERROR);
-	if (e.type == EXCEPTION_ERROR)
-		raise_exception(e.type, e.msg);
+		adiv5_dp_errors_defer(dp);
+		apb_read(t, DBGDIDR);
+		status = adiv5_dp_errors_status(dp);
+	} while (!platform_timeout_is_expired(&timeout) && status == ADIV5_STATUS_ERROR);
+	if (status == ADIV5_STATUS_ERROR)
+		raise_exception(EXCEPTION_ERROR, "Target lost in reset");
 
 	platform_delay(100);
 
@@ -736,32 +935,31 @@ static void cortexa_reset(target *t)
 
 static void cortexa_halt_request(target *t)
 {
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		apb_write(t, DBGDRCR, DBGDRCR_HRQ);
-	}
-	if (e.type) {
+	ADIv5_DP_t *dp = ((struct cortexa_priv *)t->priv)->apb->dp;
+	adiv5_dp_errors_defer(dp);
+	apb_write(t, DBGDRCR, DBGDRCR_HRQ);
+	const adiv5_status_e status = adiv5_dp_errors_status(dp);
+	if (status == ADIV5_STATUS_TIMEOUT)
 		tc_printf(t, "Timeout sending interrupt, is target in WFI?\n");
-	}
+	else if (status == ADIV5_STATUS_ERROR)
+		raise_exception(EXCEPTION_ERROR, "Halt request failed");
 }
 
 static enum target_halt_reason cortexa_halt_poll(target *t, target_addr_t *watch)
 {
-	volatile uint32_t dbgdscr = 0;
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_ALL) {
-		/* If this times out because the target is in WFI then
-		 * the target is still running. */
-		dbgdscr = apb_read(t, DBGDSCR);
-	}
-	switch (e.type) {
-	case EXCEPTION_ERROR:
+	ADIv5_DP_t *dp = ((struct cortexa_priv *)t->priv)->apb->dp;
+	adiv5_dp_errors_defer(dp);
+	uint32_t dbgdscr = apb_read(t, DBGDSCR);
+	switch (adiv5_dp_errors_status(dp)) {
+	case ADIV5_STATUS_ERROR:
 		/* Oh crap, there's no recovery from this... */
 		target_list_free();
 		return TARGET_HALT_ERROR;
-	case EXCEPTION_TIMEOUT:
+	case ADIV5_STATUS_TIMEOUT:
 		/* Timeout isn't a problem, target could be in WFI */
 		return TARGET_HALT_RUNNING;
+	default:
+		break;
 	}
 
 	if (!(dbgdscr & DBGDSCR_HALTED)) /* Not halted */
@@ -821,8 +1019,11 @@ void cortexa_halt_resume(target *t, bool step)
 		apb_write(t, DBGBCR(0), priv->bcr0);
 	}
 
-	/* Write back register cache */
+	/* Write back register cache, what was read of the rest is stale once the core runs */
 	cortexa_regs_write_internal(t);
+	priv->vfp_valid = false;
+	priv->sctlr_valid = false;
+	priv->page_valid = false;
 
 	apb_write(t, DBGITR, MCR | ICIALLU); /* invalidate cache */
 
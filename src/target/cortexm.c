@@ -65,17 +65,31 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include "json_events.h"
 #endif
 
 static const char cortexm_driver_str[] = "ARM Cortex-M";
 
 static bool cortexm_vector_catch(target *t, int argc, char *argv[]);
+static bool cortexm_profile(target *t, int argc, const char **argv);
+static bool cortexm_watch_value(target *t, int argc, const char **argv);
+static bool cortexm_timeit(target *t, int argc, const char **argv);
+static bool cortexm_fault(target *t, int argc, const char **argv);
 #ifdef PLATFORM_HAS_USBUART
 static bool cortexm_redirect_stdout(target *t, int argc, const char **argv);
 #endif
 
 const struct command_s cortexm_cmd_list[] = {
 	{"vector_catch", (cmd_handler)cortexm_vector_catch, "Catch exception vectors"},
+	{"profile", (cmd_handler)cortexm_profile, "Sample the PC while running: (ms) (samples per second)"},
+	{"watch_value", (cmd_handler)cortexm_watch_value,
+		"Halt when the DWT sees a value accessed: (addr value [1|2|4] [r|w|a]) | (clear [n])"},
+	{"timeit", (cmd_handler)cortexm_timeit, "Time a code region in cycles while running: (start_addr end_addr) | clear"},
+#if PC_HOSTED == 1
+	{"fault", (cmd_handler)cortexm_fault, "Show the state captured at the last fault: [json]"},
+#else
+	{"fault", (cmd_handler)cortexm_fault, "Show the state captured at the last fault"},
+#endif
 #ifdef PLATFORM_HAS_USBUART
 	{"redirect_stdout", (cmd_handler)cortexm_redirect_stdout, "Redirect semihosting stdout to USB UART"},
 #endif
@@ -92,7 +106,10 @@ static uint32_t cortexm_pc_read(target *t);
 static ssize_t cortexm_reg_read(target *t, int reg, void *data, size_t max);
 static ssize_t cortexm_reg_write(target *t, int reg, const void *data, size_t max);
 
+static void cortexm_reg_cache_flush(target *t);
+
 static void cortexm_reset(target *t);
+static bool cortexm_reset_halt(target *t);
 static enum target_halt_reason cortexm_halt_poll(target *t, target_addr_t *watch);
 static void cortexm_halt_resume(target *t, bool step);
 static void cortexm_halt_request(target *t);
@@ -101,14 +118,69 @@ static int cortexm_fault_unwind(target *t);
 static int cortexm_breakwatch_set(target *t, struct breakwatch *);
 static int cortexm_breakwatch_clear(target *t, struct breakwatch *);
 static target_addr_t cortexm_check_watch(target *t);
+static bool cortexm_timeit_hit(target *t);
+static void cortexm_timeit_resume(target *t);
 
 #define CORTEXM_MAX_WATCHPOINTS 4U /* architecture says up to 15, no implementation has > 4 */
 #define CORTEXM_MAX_BREAKPOINTS 8U /* architecture says up to 127, no implementation has > 8 */
+/* each takes a value comparator and the address comparator linked to it */
+#define CORTEXM_MAX_VALUE_WATCHES (CORTEXM_MAX_WATCHPOINTS / 2U)
+
+struct cortexm_value_watch {
+	bool set;
+	enum target_breakwatch type;
+	target_addr_t addr;
+	uint32_t value;
+	size_t size;
+	uint8_t addr_comp;
+	uint8_t value_comp;
+};
+
+/* Cycles from the PC reaching start to it reaching end, see cortexm_timeit() */
+struct cortexm_timeit {
+	bool set;
+	bool in_region;
+	target_addr_t start;
+	target_addr_t end;
+	uint8_t start_comp;
+	uint8_t end_comp;
+	uint32_t dwt_ctrl; /* put back on clear */
+	uint32_t entry_cycles;
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+};
 
 static int cortexm_hostio_request(target *t);
+static bool cortexm_mem_fill(target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len);
+static bool cortexm_mem_find(
+	target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len, target_addr_t *found);
 
 static uint32_t time0_sec = UINT32_MAX; /* sys_clock time origin */
 
+#define CORTEXM_GENERAL_REG_COUNT 20U
+#define CORTEXM_FLOAT_REG_COUNT   33U
+
+/* Stack captured at a fault, from the exception frame on */
+#define CORTEXM_FAULT_STACK_SIZE 128U
+
+/* What the last fault left behind, taken before the exception is unwound */
+struct cortexm_fault {
+	bool valid;
+	uint32_t count;
+	uint32_t cfsr;
+	uint32_t hfsr;
+	uint32_t mmfar;
+	uint32_t bfar;
+	/* Core registers as the core halted, in the handler */
+	uint32_t regs[CORTEXM_GENERAL_REG_COUNT];
+	uint32_t sp;
+	uint32_t stack_len;
+	/* The first 8 words are the frame: r0-r3, r12, lr, pc and xpsr */
+	uint32_t stack[CORTEXM_FAULT_STACK_SIZE / 4U];
+};
+
 struct cortexm_priv {
 	ADIv5_AP_t *ap;
 	bool stepping;
@@ -117,18 +189,52 @@ struct cortexm_priv {
 	bool hw_watchpoint[CORTEXM_MAX_WATCHPOINTS];
 	unsigned flash_patch_revision;
 	unsigned hw_watchpoint_max;
+	/* The v8m DWT, with MATCH and ACTION in place of the v7m function */
+	bool dwt_v2;
+	struct cortexm_value_watch value_watch[CORTEXM_MAX_VALUE_WATCHES];
+	struct cortexm_timeit timeit;
 	/* Breakpoint unit status */
 	bool hw_breakpoint[CORTEXM_MAX_BREAKPOINTS];
 	unsigned hw_breakpoint_max;
+	/* The FPB and DWT sizes above are read once, on the first attach */
+	bool debug_units_sized;
 	/* Copy of DEMCR for vector-catch */
 	uint32_t demcr;
 	/* Cache parameters */
 	bool has_cache;
 	uint32_t dcache_minline;
+	/* Level 1 D-cache geometry for set/way maintenance, from CCSIDR */
+	uint32_t dcache_sets;
+	uint32_t dcache_ways;
+	uint8_t dcache_line_shift;
+	/*
+	 * Set while the core is known to be halted. CCR.DC is then read once
+	 * and nothing but a debugger write to CCR can change it until resume.
+	 */
+	bool halted;
+	bool dcache_state_valid;
+	bool dcache_enabled;
+	/* Hardware CRC unit for the CRC stub, if the driver knows of one */
+	const cortexm_crc_unit_s *crc_unit;
+	/*
+	 * Core registers of the current halt in target_regs_read() order, read
+	 * in one batch on first use. Writes stay here until the core resumes,
+	 * when only the registers marked in reg_cache_dirty go back.
+	 */
+	uint32_t reg_cache[CORTEXM_GENERAL_REG_COUNT + CORTEXM_FLOAT_REG_COUNT];
+	bool reg_cache_valid;
+	uint64_t reg_cache_dirty;
+	struct cortexm_fault fault;
+#if PC_HOSTED == 1
+	/* SP and PC at the last halt, where the next halt's prefetch guesses they are */
+	bool prefetch_known;
+	uint32_t prefetch_sp;
+	uint32_t prefetch_pc;
+#endif
 };
 
 /* Register number tables */
-static const uint32_t regnum_cortex_m[] = {
+static const uint32_t regnum_cortex_m[CORTEXM_GENERAL_REG_COUNT] = {
 	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, /* standard r0-r15 */
 	0x10,                                                 /* xpsr */
 	0x11,                                                 /* msp */
@@ -136,7 +242,7 @@ static const uint32_t regnum_cortex_m[] = {
 	0x14                                                  /* special */
 };
 
-static const uint32_t regnum_cortex_mf[] = {
+static const uint32_t regnum_cortex_mf[CORTEXM_FLOAT_REG_COUNT] = {
 	0x21,                                           /* fpscr */
 	0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, /* s0-s7 */
 	0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f, /* s8-s15 */
@@ -441,6 +547,39 @@ ADIv5_AP_t *cortexm_ap(target *t)
 	return ((struct cortexm_priv *)t->priv)->ap;
 }
 
+/*
+ * Queue a write to one of the cache maintenance registers. The address is
+ * not incremented, so a burst of them needs CSW and TAR set up only once.
+ */
+static void cortexm_cache_op(ADIv5_AP_t *ap, uint32_t reg, uint32_t value)
+{
+	const uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_NONE | ADIV5_AP_CSW_SIZE_WORD;
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_CSW, csw))
+		adiv5_ap_queue_write(ap, ADIV5_AP_CSW, csw);
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_TAR, reg))
+		adiv5_ap_queue_write(ap, ADIV5_AP_TAR, reg);
+	adiv5_ap_queue_write(ap, ADIV5_AP_DRW, value);
+	/* TAR has not moved */
+	adiv5_ap_shadow_write(ap, ADIV5_AP_TAR, reg);
+}
+
+/* False if the D-cache is known to be off, checked once per halt */
+static bool cortexm_dcache_enabled(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	if (!priv->halted)
+		return true;
+	if (!priv->dcache_state_valid) {
+		ADIv5_AP_t *ap = cortexm_ap(t);
+		uint32_t ccr = 0;
+		/* Not through target_mem_read32(), that would come back here */
+		adiv5_mem_read(ap, &ccr, CORTEXM_CCR, sizeof(ccr));
+		priv->dcache_state_valid = !ap->dp->fault;
+		priv->dcache_enabled = !priv->dcache_state_valid || (ccr & CORTEXM_CCR_DC);
+	}
+	return priv->dcache_enabled;
+}
+
 static void cortexm_cache_clean(target *t, target_addr_t addr, size_t len, bool invalidate)
 {
 	struct cortexm_priv *priv = t->priv;
@@ -449,8 +588,9 @@ static void cortexm_cache_clean(target *t, target_addr_t addr, size_t len, bool
 	uint32_t cache_reg = invalidate ? CORTEXM_DCCIMVAC : CORTEXM_DCCMVAC;
 	size_t minline = priv->dcache_minline;
 
-	/* flush data cache for RAM regions that intersect requested region */
+	/* count the lines of the RAM regions that intersect requested region */
 	target_addr_t mem_end = addr + len; /* following code is NOP if wraparound */
+	size_t lines = 0;
 	/* requested region is [src, src_end) */
 	for (struct target_ram *r = t->ram; r; r = r->next) {
 		target_addr_t ram = r->start;
@@ -461,9 +601,39 @@ static void cortexm_cache_clean(target *t, target_addr_t addr, size_t len, bool
 		if (mem_end < ram_end)
 			ram_end = mem_end;
 		/* intersection is [ram, ram_end) */
+		if (ram < ram_end)
+			lines += ((ram_end - 1U) / minline) - (ram / minline) + 1U;
+	}
+	if (!lines || !cortexm_dcache_enabled(t))
+		return;
+
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	const size_t cache_lines = priv->dcache_sets * priv->dcache_ways;
+	if (cache_lines && lines > cache_lines) {
+		/* cheaper to clean the whole cache by set/way than the range by address */
+		cache_reg = invalidate ? CORTEXM_DCCISW : CORTEXM_DCCSW;
+		/* the way number is held in the top bits */
+		const uint8_t way_shift = priv->dcache_ways > 1U ? __builtin_clz(priv->dcache_ways - 1U) : 0U;
+		for (uint32_t way = 0; way < priv->dcache_ways; ++way) {
+			for (uint32_t set = 0; set < priv->dcache_sets; ++set)
+				cortexm_cache_op(ap, cache_reg, (way << way_shift) | (set << priv->dcache_line_shift));
+		}
+		adiv5_queue_flush(ap->dp);
+		return;
+	}
+
+	/* flush data cache for RAM regions that intersect requested region */
+	for (struct target_ram *r = t->ram; r; r = r->next) {
+		target_addr_t ram = r->start;
+		target_addr_t ram_end = r->start + r->length;
+		if (addr > ram)
+			ram = addr;
+		if (mem_end < ram_end)
+			ram_end = mem_end;
 		for (ram &= ~(minline - 1); ram < ram_end; ram += minline)
-			adiv5_mem_write(cortexm_ap(t), cache_reg, &ram, 4);
+			cortexm_cache_op(ap, cache_reg, ram);
 	}
+	adiv5_queue_flush(ap->dp);
 }
 
 static void cortexm_mem_read(target *t, void *dest, target_addr_t src, size_t len)
@@ -474,6 +644,10 @@ static void cortexm_mem_read(target *t, void *dest, target_addr_t src, size_t le
 
 static void cortexm_mem_write(target *t, target_addr_t dest, const void *src, size_t len)
 {
+	struct cortexm_priv *priv = t->priv;
+	/* The debugger may turn the D-cache on itself */
+	if (dest <= CORTEXM_CCR + 3U && dest + len > CORTEXM_CCR)
+		priv->dcache_state_valid = false;
 	cortexm_cache_clean(t, dest, len, true);
 	adiv5_mem_write(cortexm_ap(t), dest, src, len);
 }
@@ -532,6 +706,133 @@ static void cortexm_read_cpuid(target *const t, const ADIv5_AP_t *const ap)
 		(t->cpuid & CPUID_REVISION_MASK) >> 20, t->cpuid & CPUID_PATCH_MASK);
 }
 
+/*
+ * Target probe routines by designer and ROM table part number, tried in order. Only the
+ * entries matching the part run, so attaching does not pay for the ID reads of every
+ * other family. Drivers left out of the build resolve to the nops in target_probe.c.
+ */
+#define CORTEXM_PROBE_ANY_PART 0xffffU
+
+typedef struct cortexm_probe_entry {
+	uint16_t designer_code;
+	uint16_t part_id;
+	bool (*probe)(target *t); /* NULL for parts known to be unsupported */
+	const char *name;
+} cortexm_probe_entry_s;
+
+#define CORTEXM_PROBE(designer, part, probe) {(designer), (part), probe, #probe}
+#define CORTEXM_PROBE_UNHANDLED(designer, name) {(designer), CORTEXM_PROBE_ANY_PART, NULL, (name)}
+
+static const cortexm_probe_entry_s cortexm_probe_table[] = {
+	CORTEXM_PROBE(JEP106_MANUFACTURER_FREESCALE, CORTEXM_PROBE_ANY_PART, kinetis_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_GIGADEVICE, CORTEXM_PROBE_ANY_PART, gd32f1_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32f1_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32f4_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32h7_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32l0_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32l4_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32g0_probe),
+	CORTEXM_PROBE_UNHANDLED(JEP106_MANUFACTURER_CYPRESS, "Cypress"),
+	CORTEXM_PROBE_UNHANDLED(JEP106_MANUFACTURER_INFINEON, "Infineon"),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_NORDIC, CORTEXM_PROBE_ANY_PART, nrf51_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ATMEL, CORTEXM_PROBE_ANY_PART, samx7x_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ATMEL, CORTEXM_PROBE_ANY_PART, sam4l_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ATMEL, CORTEXM_PROBE_ANY_PART, samd_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ATMEL, CORTEXM_PROBE_ANY_PART, samx5x_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ENERGY_MICRO, CORTEXM_PROBE_ANY_PART, efm32_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_TEXAS, CORTEXM_PROBE_ANY_PART, msp432_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_SPECULAR, CORTEXM_PROBE_ANY_PART, lpc11xx_probe), /* LPC845 */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_RASPBERRY, CORTEXM_PROBE_ANY_PART, rp_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_RENESAS, CORTEXM_PROBE_ANY_PART, renesas_probe),
+	/* Parts with ARM's own ROM tables, told apart by the ROM part number */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c0U, lpc11xx_probe), /* Cortex-M0+ ROM, LPC8 */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c3U, lmi_probe),     /* Cortex-M3 ROM */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c3U, ch32f1_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c3U, stm32f1_probe), /* Care for other STM32F1 clones (?) */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c3U, lpc15xx_probe), /* Thanks to JojoS for testing */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x471U, lpc11xx_probe), /* Cortex-M0 ROM, LPC24C11 */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x471U, lpc43xx_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, lmi_probe), /* Cortex-M4 ROM */
+	/*
+	 * The LPC546xx and LPC43xx parts present with the same AP ROM Part Number, so we need to
+	 * probe both. Unfortunately, when probing for the LPC43xx when the target is actually an
+	 * LPC546xx, the memory location checked is illegal for the LPC546xx, and causes a Hard
+	 * Fault or Lockup, requiring a RST pulse to recover. Instead, make sure to probe for the
+	 * LPC546xx first, which experimentally doesn't harm LPC43xx detection.
+	 */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, lpc546xx_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, lpc43xx_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, kinetis_probe), /* Older K-series */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, at32fxx_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4cbU, gd32f1_probe), /* Cortex-M23 ROM, GD32E23x uses GD32F1 peripherals */
+	/*
+	 * These devices enumerate an AP with an empty ascii code,
+	 * and have no available designer code elsewhere
+	 */
+	CORTEXM_PROBE(ASCII_CODE_FLAG, CORTEXM_PROBE_ANY_PART, sam3x_probe),
+	CORTEXM_PROBE(ASCII_CODE_FLAG, CORTEXM_PROBE_ANY_PART, ke04_probe),
+	CORTEXM_PROBE(ASCII_CODE_FLAG, CORTEXM_PROBE_ANY_PART, lpc17xx_probe),
+	CORTEXM_PROBE(ASCII_CODE_FLAG, CORTEXM_PROBE_ANY_PART, lpc11xx_probe), /* LPC1343 */
+};
+
+/*
+ * ID registers read by a probe are remembered for the others, several families reading the
+ * same DBGMCU IDCODE to tell their parts apart. Only side effect free ID registers may go
+ * through cortexm_probe_id_read32().
+ */
+#define CORTEXM_PROBE_ID_CACHE_SIZE 4U
+
+static struct {
+	uint32_t addr;
+	uint32_t value;
+} cortexm_probe_ids[CORTEXM_PROBE_ID_CACHE_SIZE];
+static size_t cortexm_probe_id_count;
+static bool cortexm_probe_id_active;
+
+static void cortexm_probe_id_reset(void)
+{
+	cortexm_probe_id_count = 0;
+	cortexm_probe_id_active = true;
+}
+
+uint32_t cortexm_probe_id_read32(target *t, uint32_t addr)
+{
+	for (size_t i = 0; cortexm_probe_id_active && i < cortexm_probe_id_count; ++i) {
+		if (cortexm_probe_ids[i].addr == addr)
+			return cortexm_probe_ids[i].value;
+	}
+	const uint32_t value = target_mem_read32(t, addr);
+	/* Failed reads are not kept, a later probe may yet get through */
+	if (target_check_error(t) || !cortexm_probe_id_active || cortexm_probe_id_count == CORTEXM_PROBE_ID_CACHE_SIZE)
+		return value;
+	cortexm_probe_ids[cortexm_probe_id_count].addr = addr;
+	cortexm_probe_ids[cortexm_probe_id_count].value = value;
+	++cortexm_probe_id_count;
+	return value;
+}
+
+static bool cortexm_probe_dispatch(target *t)
+{
+	/* Probes that do not match may still have changed these */
+	const uint16_t designer_code = t->designer_code;
+	const uint16_t part_id = t->part_id;
+	for (size_t i = 0; i < ARRAY_LENGTH(cortexm_probe_table); ++i) {
+		const cortexm_probe_entry_s *const entry = &cortexm_probe_table[i];
+		if (entry->designer_code != designer_code ||
+			(entry->part_id != CORTEXM_PROBE_ANY_PART && entry->part_id != part_id))
+			continue;
+		if (!entry->probe) {
+			DEBUG_WARN("Unhandled %s device\n", entry->name);
+			continue;
+		}
+		DEBUG_INFO("Calling %s\n", entry->name);
+		if (entry->probe(t))
+			return true;
+		target_check_error(t);
+	}
+	return false;
+}
+
 bool cortexm_probe(ADIv5_AP_t *ap)
 {
 	target *t;
@@ -588,6 +889,7 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 	t->reg_write = cortexm_reg_write;
 
 	t->reset = cortexm_reset;
+	t->reset_halt = cortexm_reset_halt;
 	t->halt_request = cortexm_halt_request;
 	t->halt_poll = cortexm_halt_poll;
 	t->halt_resume = cortexm_halt_resume;
@@ -595,6 +897,11 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 
 	t->breakwatch_set = cortexm_breakwatch_set;
 	t->breakwatch_clear = cortexm_breakwatch_clear;
+	t->flash_break_instr = 0xbe00U; /* BKPT #0 */
+
+	t->crc32 = cortexm_crc32;
+	t->mem_fill = cortexm_mem_fill;
+	t->mem_find = cortexm_mem_find;
 
 	target_add_commands(t, cortexm_cmd_list, cortexm_driver_str);
 
@@ -611,121 +918,31 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 	if ((ctr >> 29) == 4) {
 		priv->has_cache = true;
 		priv->dcache_minline = 4 << (ctr & 0xf);
+		/* Level 1 data cache */
+		target_mem_write32(t, CORTEXM_CSSELR, 0);
+		const uint32_t ccsidr = target_mem_read32(t, CORTEXM_CCSIDR);
+		priv->dcache_sets = CORTEXM_CCSIDR_NUMSETS(ccsidr);
+		priv->dcache_ways = CORTEXM_CCSIDR_ASSOCIATIVITY(ccsidr);
+		priv->dcache_line_shift = CORTEXM_CCSIDR_LINESIZE(ccsidr);
 	} else {
 		target_check_error(t);
 	}
-#if PC_HOSTED
-#define STRINGIFY(x) #x
-#define PROBE(x)                                  \
-	do {                                          \
-		DEBUG_INFO("Calling " STRINGIFY(x) "\n"); \
-		if ((x)(t))                               \
-			return true;                          \
-		target_check_error(t);                    \
-	} while (0)
-#else
-#define PROBE(x)               \
-	do {                       \
-		if ((x)(t))            \
-			return true;       \
-		target_check_error(t); \
-	} while (0)
-#endif
 
-	switch (t->designer_code) {
-	case JEP106_MANUFACTURER_FREESCALE:
-		PROBE(kinetis_probe);
-		if (t->part_id == 0x88c) {
-			t->driver = "MIMXRT10xx(no flash)";
-			target_halt_resume(t, 0);
-		}
-		break;
-	case JEP106_MANUFACTURER_GIGADEVICE:
-		PROBE(gd32f1_probe);
-		break;
-	case JEP106_MANUFACTURER_STM:
-		PROBE(stm32f1_probe);
-		PROBE(stm32f4_probe);
-		PROBE(stm32h7_probe);
-		PROBE(stm32l0_probe);
-		PROBE(stm32l4_probe);
-		PROBE(stm32g0_probe);
-		break;
-	case JEP106_MANUFACTURER_CYPRESS:
-		DEBUG_WARN("Unhandled Cypress device\n");
-		break;
-	case JEP106_MANUFACTURER_INFINEON:
-		DEBUG_WARN("Unhandled Infineon device\n");
-		break;
-	case JEP106_MANUFACTURER_NORDIC:
-		PROBE(nrf51_probe);
-		break;
-	case JEP106_MANUFACTURER_ATMEL:
-		PROBE(samx7x_probe);
-		PROBE(sam4l_probe);
-		PROBE(samd_probe);
-		PROBE(samx5x_probe);
-		break;
-	case JEP106_MANUFACTURER_ENERGY_MICRO:
-		PROBE(efm32_probe);
-		break;
-	case JEP106_MANUFACTURER_TEXAS:
-		PROBE(msp432_probe);
-		break;
-	case JEP106_MANUFACTURER_SPECULAR:
-		PROBE(lpc11xx_probe); /* LPC845 */
-		break;
-	case JEP106_MANUFACTURER_RASPBERRY:
-		PROBE(rp_probe);
-		break;
-	case JEP106_MANUFACTURER_RENESAS:
-		PROBE(renesas_probe);
-		break;
-	case JEP106_MANUFACTURER_ARM:
-		if (t->part_id == 0x4c0) {        /* Cortex-M0+ ROM */
-			PROBE(lpc11xx_probe);         /* LPC8 */
-		} else if (t->part_id == 0x4c3) { /* Cortex-M3 ROM */
-			PROBE(lmi_probe);
-			PROBE(ch32f1_probe);
-			PROBE(stm32f1_probe);         /* Care for other STM32F1 clones (?) */
-			PROBE(lpc15xx_probe);         /* Thanks to JojoS for testing */
-		} else if (t->part_id == 0x471) { /* Cortex-M0 ROM */
-			PROBE(lpc11xx_probe);         /* LPC24C11 */
-			PROBE(lpc43xx_probe);
-		} else if (t->part_id == 0x4c4) { /* Cortex-M4 ROM */
-			PROBE(lmi_probe);
-			/* The LPC546xx and LPC43xx parts present with the same AP ROM Part
-			Number, so we need to probe both. Unfortunately, when probing for
-			the LPC43xx when the target is actually an LPC546xx, the memory
-			location checked is illegal for the LPC546xx and puts the chip into
-			Lockup, requiring a RST pulse to recover. Instead, make sure to
-			probe for the LPC546xx first, which experimentally doesn't harm
-			LPC43xx detection. */
-			PROBE(lpc546xx_probe);
-			PROBE(lpc43xx_probe);
-			PROBE(kinetis_probe); /* Older K-series */
-			PROBE(at32fxx_probe);
-		} else if (t->part_id == 0x4cb) { /* Cortex-M23 ROM */
-			PROBE(gd32f1_probe);          /* GD32E23x uses GD32F1 peripherals */
-		}
-		break;
-	case ASCII_CODE_FLAG:
-		/*
-		 * these devices enumerate an AP with an empty ascii code,
-		 * and have no available designer code elsewhere
-		 */
-		PROBE(sam3x_probe);
-		PROBE(ke04_probe);
-		PROBE(lpc17xx_probe);
-		PROBE(lpc11xx_probe); /* LPC1343 */
-		break;
+	cortexm_probe_id_reset();
+	const bool found = cortexm_probe_dispatch(t);
+	cortexm_probe_id_active = false;
+	if (found)
+		return true;
+
+	if (t->designer_code == JEP106_MANUFACTURER_FREESCALE && t->part_id == 0x88c) {
+		t->driver = "MIMXRT10xx(no flash)";
+		target_halt_resume(t, 0);
 	}
 #if PC_HOSTED == 0
 	gdb_outf("Please report unknown device with Designer 0x%x Part ID 0x%x\n", t->designer_code, t->part_id);
 #else
 	DEBUG_WARN("Please report unknown device with Designer 0x%x Part ID 0x%x\n", t->designer_code, t->part_id);
 #endif
-#undef PROBE
 	return true;
 }
 
@@ -758,24 +975,30 @@ bool cortexm_attach(target *t)
 	target_check_error(t);
 
 	target_halt_request(t);
+	cortexm_reg_cache_invalidate(t);
 	/* Request halt on reset */
 	target_mem_write32(t, CORTEXM_DEMCR, priv->demcr);
 
 	/* Reset DFSR flags */
 	target_mem_write32(t, CORTEXM_DFSR, CORTEXM_DFSR_RESETALL);
 
-	/* size the break/watchpoint units */
-	priv->hw_breakpoint_max = CORTEXM_MAX_BREAKPOINTS;
-	const uint32_t flash_break_cfg = target_mem_read32(t, CORTEXM_FPB_CTRL);
-	const uint32_t breakpoints = ((flash_break_cfg >> 4U) & 0xf);
-	if (breakpoints < priv->hw_breakpoint_max) /* only look at NUM_COMP1 */
-		priv->hw_breakpoint_max = breakpoints;
-	priv->flash_patch_revision = flash_break_cfg >> 28U;
-
-	priv->hw_watchpoint_max = CORTEXM_MAX_WATCHPOINTS;
-	const uint32_t watchpoints = target_mem_read32(t, CORTEXM_DWT_CTRL);
-	if ((watchpoints >> 28) < priv->hw_watchpoint_max)
-		priv->hw_watchpoint_max = watchpoints >> 28U;
+	/* size the break/watchpoint units, their sizes are fixed in the silicon */
+	if (!priv->debug_units_sized) {
+		priv->hw_breakpoint_max = CORTEXM_MAX_BREAKPOINTS;
+		const uint32_t flash_break_cfg = target_mem_read32(t, CORTEXM_FPB_CTRL);
+		const uint32_t breakpoints = ((flash_break_cfg >> 4U) & 0xf);
+		if (breakpoints < priv->hw_breakpoint_max) /* only look at NUM_COMP1 */
+			priv->hw_breakpoint_max = breakpoints;
+		priv->flash_patch_revision = flash_break_cfg >> 28U;
+
+		priv->hw_watchpoint_max = CORTEXM_MAX_WATCHPOINTS;
+		const uint32_t watchpoints = target_mem_read32(t, CORTEXM_DWT_CTRL);
+		if ((watchpoints >> 28) < priv->hw_watchpoint_max)
+			priv->hw_watchpoint_max = watchpoints >> 28U;
+		const uint32_t dwt_devarch = target_mem_read32(t, CORTEXM_DWT_DEVARCH);
+		priv->dwt_v2 = (dwt_devarch & CORTEXM_DWT_DEVARCH_MASK) == CORTEXM_DWT_DEVARCH_V2;
+		priv->debug_units_sized = !target_check_error(t);
+	}
 
 	/* Clear any stale breakpoints */
 	for (size_t i = 0; i < priv->hw_breakpoint_max; i++) {
@@ -788,6 +1011,9 @@ bool cortexm_attach(target *t)
 		target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
 		priv->hw_watchpoint[i] = 0;
 	}
+	for (size_t i = 0; i < CORTEXM_MAX_VALUE_WATCHES; i++)
+		priv->value_watch[i].set = false;
+	priv->timeit.set = false;
 
 	/* Flash Patch Control Register: set ENABLE */
 	target_mem_write32(t, CORTEXM_FPB_CTRL, CORTEXM_FPB_CTRL_KEY | CORTEXM_FPB_CTRL_ENABLE);
@@ -795,6 +1021,7 @@ bool cortexm_attach(target *t)
 	(void)target_mem_read32(t, CORTEXM_DHCSR);
 	if (target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_RESET_ST) {
 		platform_nrst_set_val(false);
+		adiv5_shadow_invalidate(cortexm_ap(t)->dp);
 		platform_timeout timeout;
 		platform_timeout_set(&timeout, 1000);
 		while (1) {
@@ -831,6 +1058,9 @@ void cortexm_detach(target *t)
 	for (i = 0; i < priv->hw_watchpoint_max; i++)
 		target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
 
+	/* The core keeps running with whatever registers GDB left it */
+	cortexm_reg_cache_flush(t);
+
 	/* Restort DEMCR*/
 	ADIv5_AP_t *ap = cortexm_ap(t);
 	target_mem_write32(t, CORTEXM_DEMCR, ap->ap_cortexm_demcr);
@@ -845,9 +1075,24 @@ enum {
 	DB_DEMCR
 };
 
-static void cortexm_regs_read(target *t, void *data)
+/*
+ * Map the banked data registers (0x10-0x1c) to the debug registers DHCSR,
+ * DCRSR, DCRDR and DEMCR respectively. Banked accesses never move TAR, so
+ * the word CSW memory accesses use serves as well and both skip rewriting
+ * CSW and TAR when they are still set up.
+ */
+static void cortexm_banked_setup(ADIv5_AP_t *ap)
+{
+	const uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE | ADIV5_AP_CSW_SIZE_WORD;
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_CSW, csw))
+		adiv5_ap_queue_write(ap, ADIV5_AP_CSW, csw);
+	if (!adiv5_ap_shadowed(ap, ADIV5_AP_TAR, CORTEXM_DHCSR))
+		adiv5_ap_queue_write(ap, ADIV5_AP_TAR, CORTEXM_DHCSR);
+}
+
+/* Queue the reads of all core registers, they are only valid once the queue is flushed */
+static void cortexm_regs_queue_read(target *t, uint32_t *regs)
 {
-	uint32_t *regs = data;
 	ADIv5_AP_t *ap = cortexm_ap(t);
 	size_t i;
 #if PC_HOSTED == 1
@@ -862,71 +1107,116 @@ static void cortexm_regs_read(target *t, void *data)
 	} else
 #endif
 	{
-		/* FIXME: Describe what's really going on here */
-		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
-
-		/* Map the banked data registers (0x10-0x1c) to the
-		 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+		cortexm_banked_setup(ap);
 
 		/* Walk the regnum_cortex_m array, reading the registers it
-		 * calls out. */
-		adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[0]);
+		 * calls out. The whole walk is queued and goes out in one go. */
+		adiv5_ap_queue_write(ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[0]);
 		/* Required to switch banks */
-		*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+		adiv5_dp_queue_read(ap->dp, ADIV5_AP_DB(DB_DCRDR), regs++);
 		for (i = 1; i < sizeof(regnum_cortex_m) / 4; i++) {
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[i]);
-			*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+			adiv5_dp_queue_write(ap->dp, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[i]);
+			adiv5_dp_queue_read(ap->dp, ADIV5_AP_DB(DB_DCRDR), regs++);
 		}
 		if (t->target_options & TOPT_FLAVOUR_V7MF)
 			for (i = 0; i < sizeof(regnum_cortex_mf) / 4; i++) {
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_mf[i]);
-				*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+				adiv5_dp_queue_write(ap->dp, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_mf[i]);
+				adiv5_dp_queue_read(ap->dp, ADIV5_AP_DB(DB_DCRDR), regs++);
 			}
 	}
 }
 
-static void cortexm_regs_write(target *t, const void *data)
+static void cortexm_regs_read_internal(target *t, uint32_t *regs)
+{
+	cortexm_regs_queue_read(t, regs);
+	adiv5_queue_flush(cortexm_ap(t)->dp);
+}
+
+static int dcrsr_regnum(target *t, unsigned reg)
+{
+	if (reg < sizeof(regnum_cortex_m) / 4U) {
+		return regnum_cortex_m[reg];
+	} else if ((t->target_options & TOPT_FLAVOUR_V7MF) &&
+			   (reg < (sizeof(regnum_cortex_m) + sizeof(regnum_cortex_mf)) / 4)) {
+		return regnum_cortex_mf[reg - sizeof(regnum_cortex_m) / 4U];
+	} else {
+		return -1;
+	}
+}
+
+/* Write the registers marked in dirty, bit n standing for register n in target_regs_read() order */
+static void cortexm_regs_write_internal(target *t, const uint32_t *regs, uint64_t dirty)
 {
-	const uint32_t *regs = data;
 	ADIv5_AP_t *ap = cortexm_ap(t);
+	const size_t count = t->regs_size / 4U;
 #if PC_HOSTED == 1
 	if (ap->dp->ap_reg_write) {
-		for (size_t z = 0; z < sizeof(regnum_cortex_m) / 4; z++) {
-			ap->dp->ap_reg_write(ap, regnum_cortex_m[z], *regs);
-			regs++;
+		for (size_t i = 0; i < count; i++) {
+			if (dirty & (1ULL << i))
+				ap->dp->ap_reg_write(ap, dcrsr_regnum(t, i), regs[i]);
 		}
-		if (t->target_options & TOPT_FLAVOUR_V7MF)
-			for (size_t z = 0; z < sizeof(regnum_cortex_mf) / 4; z++) {
-				ap->dp->ap_reg_write(ap, regnum_cortex_mf[z], *regs);
-				regs++;
-			}
 	} else
 #endif
 	{
-		size_t i;
-
-		/* FIXME: Describe what's really going on here */
-		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
-
-		/* Map the banked data registers (0x10-0x1c) to the
-		 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
-		/* Walk the regnum_cortex_m array, writing the registers it
-		 * calls out. */
-		adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRDR), *regs++);
-		/* Required to switch banks */
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_m[0]);
-		for (i = 1; i < sizeof(regnum_cortex_m) / 4; i++) {
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRDR), *regs++);
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_m[i]);
+		bool first = true;
+
+		cortexm_banked_setup(ap);
+		/* Walk the registers, writing only the ones marked */
+		for (size_t i = 0; i < count; i++) {
+			if (!(dirty & (1ULL << i)))
+				continue;
+			if (first)
+				/* Required to switch banks */
+				adiv5_ap_queue_write(ap, ADIV5_AP_DB(DB_DCRDR), regs[i]);
+			else
+				adiv5_dp_queue_write(ap->dp, ADIV5_AP_DB(DB_DCRDR), regs[i]);
+			adiv5_dp_queue_write(ap->dp, ADIV5_AP_DB(DB_DCRSR), 0x10000 | dcrsr_regnum(t, i));
+			first = false;
 		}
-		if (t->target_options & TOPT_FLAVOUR_V7MF)
-			for (i = 0; i < sizeof(regnum_cortex_mf) / 4; i++) {
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRDR), *regs++);
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_mf[i]);
-			}
+		adiv5_queue_flush(ap->dp);
+	}
+}
+
+/* Returns the register cache, reading the core registers if it does not hold them yet */
+static uint32_t *cortexm_reg_cache(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	if (!priv->reg_cache_valid) {
+		cortexm_regs_read_internal(t, priv->reg_cache);
+		priv->reg_cache_valid = !cortexm_ap(t)->dp->fault;
 	}
+	return priv->reg_cache;
+}
+
+/* Write back registers changed while halted, to be called before the core runs */
+static void cortexm_reg_cache_flush(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	if (priv->reg_cache_dirty)
+		cortexm_regs_write_internal(t, priv->reg_cache, priv->reg_cache_dirty);
+	priv->reg_cache_dirty = 0;
+	priv->reg_cache_valid = false;
+}
+
+/* Forget the cached registers, for when the core changed them itself */
+void cortexm_reg_cache_invalidate(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	priv->reg_cache_dirty = 0;
+	priv->reg_cache_valid = false;
+}
+
+static void cortexm_regs_read(target *t, void *data)
+{
+	memcpy(data, cortexm_reg_cache(t), t->regs_size);
+}
+
+static void cortexm_regs_write(target *t, const void *data)
+{
+	struct cortexm_priv *priv = t->priv;
+	memcpy(priv->reg_cache, data, t->regs_size);
+	priv->reg_cache_valid = true;
+	priv->reg_cache_dirty = UINT64_MAX;
 }
 
 int cortexm_mem_write_sized(target *t, target_addr_t dest, const void *src, size_t len, enum align align)
@@ -936,62 +1226,69 @@ int cortexm_mem_write_sized(target *t, target_addr_t dest, const void *src, size
 	return target_check_error(t);
 }
 
-static int dcrsr_regnum(target *t, unsigned reg)
-{
-	if (reg < sizeof(regnum_cortex_m) / 4U) {
-		return regnum_cortex_m[reg];
-	} else if ((t->target_options & TOPT_FLAVOUR_V7MF) &&
-			   (reg < (sizeof(regnum_cortex_m) + sizeof(regnum_cortex_mf)) / 4)) {
-		return regnum_cortex_mf[reg - sizeof(regnum_cortex_m) / 4U];
-	} else {
-		return -1;
-	}
-}
 static ssize_t cortexm_reg_read(target *t, int reg, void *data, size_t max)
 {
-	if (max < 4)
+	if (max < 4 || dcrsr_regnum(t, reg) < 0)
 		return -1;
 	uint32_t *r = data;
-	target_mem_write32(t, CORTEXM_DCRSR, dcrsr_regnum(t, reg));
-	*r = target_mem_read32(t, CORTEXM_DCRDR);
+	*r = cortexm_reg_cache(t)[reg];
 	return 4;
 }
 
 static ssize_t cortexm_reg_write(target *t, int reg, const void *data, size_t max)
 {
-	if (max < 4)
+	if (max < 4 || dcrsr_regnum(t, reg) < 0)
 		return -1;
 	const uint32_t *r = data;
-	target_mem_write32(t, CORTEXM_DCRDR, *r);
-	target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | dcrsr_regnum(t, reg));
+	cortexm_reg_cache(t)[reg] = *r;
+	((struct cortexm_priv *)t->priv)->reg_cache_dirty |= 1ULL << reg;
 	return 4;
 }
 
 static uint32_t cortexm_pc_read(target *t)
 {
-	target_mem_write32(t, CORTEXM_DCRSR, 0x0F);
-	return target_mem_read32(t, CORTEXM_DCRDR);
+	return cortexm_reg_cache(t)[REG_PC];
 }
 
 static void cortexm_pc_write(target *t, const uint32_t val)
 {
-	target_mem_write32(t, CORTEXM_DCRDR, val);
-	target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | 0x0F);
+	cortexm_reg_cache(t)[REG_PC] = val;
+	((struct cortexm_priv *)t->priv)->reg_cache_dirty |= 1ULL << REG_PC;
 }
 
 /* The following three routines implement target halt/resume
  * using the core debug registers in the NVIC. */
-static void cortexm_reset(target *t)
+/* 10 ms each side, as the NRF52840 needs after nRST and STM32 clocks were once given to start up */
+static const target_reset_profile_s cortexm_reset_default = {
+	.nrst_ms = 10,
+	.startup_ms = 10,
+	.timeout_ms = 1000,
+};
+
+const target_reset_profile_s cortexm_reset_instant = {
+	.nrst_ms = 0,
+	.startup_ms = 0,
+	.timeout_ms = 1000,
+};
+
+/* Reset the system by nRST, or by AIRCR if that is not seen or not allowed, and wait for it to end */
+static void cortexm_reset_run(target *t)
 {
-	/* Read DHCSR here to clear S_RESET_ST bit before reset */
-	target_mem_read32(t, CORTEXM_DHCSR);
+	struct cortexm_priv *priv = t->priv;
+	const target_reset_profile_s *const profile = t->reset_profile ? t->reset_profile : &cortexm_reset_default;
+	priv->halted = false;
+	priv->dcache_state_valid = false;
+	cortexm_reg_cache_invalidate(t);
 	platform_timeout reset_timeout;
 	if ((t->target_options & CORTEXM_TOPT_INHIBIT_NRST) == 0) {
 		platform_nrst_set_val(true);
 		platform_nrst_set_val(false);
+		/* On some parts nRST resets the debug logic too, so trust no SELECT, CSW or TAR from before */
+		adiv5_shadow_invalidate(cortexm_ap(t)->dp);
 		/* Some NRF52840 users saw invalid SWD transaction with
 		 * native/firmware without this delay.*/
-		platform_delay(10);
+		if (profile->nrst_ms)
+			platform_delay(profile->nrst_ms);
 	}
 	uint32_t dhcsr = target_mem_read32(t, CORTEXM_DHCSR);
 	if ((dhcsr & CORTEXM_DHCSR_S_RESET_ST) == 0) {
@@ -1004,8 +1301,9 @@ static void cortexm_reset(target *t)
 	if (t->extended_reset != NULL) {
 		t->extended_reset(t);
 	}
+	adiv5_shadow_invalidate(cortexm_ap(t)->dp);
 	/* Wait for CORTEXM_DHCSR_S_RESET_ST to read 0, meaning reset released.*/
-	platform_timeout_set(&reset_timeout, 1000);
+	platform_timeout_set(&reset_timeout, profile->timeout_ms);
 	while ((target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_RESET_ST) &&
 		   !platform_timeout_is_expired(&reset_timeout))
 		continue;
@@ -1013,53 +1311,206 @@ static void cortexm_reset(target *t)
 	if (platform_timeout_is_expired(&reset_timeout))
 		DEBUG_WARN("Reset seem to be stuck low!\n");
 #endif
-	/* 10 ms delay to ensure that things such as the STM32 HSI clock
-	 * have started up fully. */
-	platform_delay(10);
+	/* Give things such as the STM32 HSI clock time to start up fully */
+	if (profile->startup_ms)
+		platform_delay(profile->startup_ms);
+}
+
+static void cortexm_reset(target *t)
+{
+	/* Read DHCSR here to clear S_RESET_ST bit before reset */
+	target_mem_read32(t, CORTEXM_DHCSR);
+	cortexm_reset_run(t);
 	/* Reset DFSR flags */
 	target_mem_write32(t, CORTEXM_DFSR, CORTEXM_DFSR_RESETALL);
 	/* Make sure we ignore any initial DAP error */
 	target_check_error(t);
 }
 
+/*
+ * Reset and halt at the reset vector whatever vector_catch is set to. The catch goes in with the
+ * read clearing S_RESET_ST, and is put back with the DFSR clear and the read confirming the halt,
+ * each in one batch.
+ */
+static bool cortexm_reset_halt(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	uint32_t dhcsr = 0;
+	adiv5_mem_queue_write32(ap, CORTEXM_DEMCR, priv->demcr | CORTEXM_DEMCR_VC_CORERESET);
+	adiv5_mem_queue_read32(ap, CORTEXM_DHCSR, &dhcsr);
+	adiv5_queue_flush(ap->dp);
+	cortexm_reset_run(t);
+	if (!(priv->demcr & CORTEXM_DEMCR_VC_CORERESET))
+		adiv5_mem_queue_write32(ap, CORTEXM_DEMCR, priv->demcr);
+	adiv5_mem_queue_write32(ap, CORTEXM_DFSR, CORTEXM_DFSR_RESETALL);
+	adiv5_mem_queue_read32(ap, CORTEXM_DHCSR, &dhcsr);
+	adiv5_queue_flush(ap->dp);
+	/* Make sure we ignore any initial DAP error */
+	target_check_error(t);
+	priv->halted = (dhcsr & CORTEXM_DHCSR_S_HALT) != 0;
+	return priv->halted;
+}
+
 static void cortexm_halt_request(target *t)
 {
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		target_mem_write32(t, CORTEXM_DHCSR, CORTEXM_DHCSR_DBGKEY | CORTEXM_DHCSR_C_HALT | CORTEXM_DHCSR_C_DEBUGEN);
-	}
-	if (e.type) {
+	const uint32_t dhcsr = CORTEXM_DHCSR_DBGKEY | CORTEXM_DHCSR_C_HALT | CORTEXM_DHCSR_C_DEBUGEN;
+	const adiv5_status_e status = adiv5_mem_write_status(cortexm_ap(t), CORTEXM_DHCSR, &dhcsr, sizeof(dhcsr));
+	if (status == ADIV5_STATUS_TIMEOUT)
 		tc_printf(t, "Timeout sending interrupt, is target in WFI?\n");
+	else if (status == ADIV5_STATUS_ERROR)
+		raise_exception(EXCEPTION_ERROR, "Halt request failed");
+}
+
+#if PC_HOSTED == 1
+/* Lines read ahead around each of SP and PC at most */
+#define CORTEXM_PREFETCH_LINES 4U
+#define CORTEXM_REG_SP         13U
+#define CORTEXM_REG_PC         15U
+
+/* Guessed windows, then whatever the actual ones add */
+static struct {
+	size_t count;
+	target_addr_t addr[4U * CORTEXM_PREFETCH_LINES];
+	uint32_t data[4U * CORTEXM_PREFETCH_LINES][TARGET_MEM_CACHE_LINE_SIZE / 4U];
+} cortexm_prefetch;
+
+/* Queue the lines of a cortexm_prefetch_size window from base on that are not queued yet */
+static void cortexm_prefetch_window(target *t, target_addr_t base)
+{
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	const size_t lines =
+		MIN((cortexm_prefetch_size + TARGET_MEM_CACHE_LINE_SIZE - 1U) / TARGET_MEM_CACHE_LINE_SIZE, CORTEXM_PREFETCH_LINES);
+	base &= ~(TARGET_MEM_CACHE_LINE_SIZE - 1U);
+	for (size_t i = 0; i < lines; ++i) {
+		const target_addr_t addr = base + i * TARGET_MEM_CACHE_LINE_SIZE;
+		bool queued = false;
+		for (size_t j = 0; j < cortexm_prefetch.count; ++j)
+			queued |= cortexm_prefetch.addr[j] == addr;
+		if (queued || !target_mem_cache_can_fill(t, addr))
+			continue;
+		uint32_t *const data = cortexm_prefetch.data[cortexm_prefetch.count];
+		cortexm_prefetch.addr[cortexm_prefetch.count++] = addr;
+		/* Without a queue the probe does better with a block read */
+		if (!ap->dp->queue_flush) {
+			adiv5_mem_read(ap, data, addr, TARGET_MEM_CACHE_LINE_SIZE);
+			continue;
+		}
+		for (size_t word = 0; word < TARGET_MEM_CACHE_LINE_SIZE / 4U; ++word)
+			adiv5_mem_queue_read32(ap, addr + word * 4U, data + word);
+	}
+}
+
+/* Disassembly and breakpoint checks read on both sides of PC */
+static target_addr_t cortexm_prefetch_pc_base(const uint32_t pc)
+{
+	return pc - MIN(cortexm_prefetch_size, CORTEXM_PREFETCH_LINES * TARGET_MEM_CACHE_LINE_SIZE) / 2U;
+}
+
+/*
+ * GDB follows a halt with reads of the registers and of the memory around SP
+ * and PC. Fetch them in the batch that reads DFSR, with the windows where SP
+ * and PC were at the last halt. returns false if the batch failed, leaving
+ * DFSR to be read the usual way.
+ */
+static bool cortexm_halt_prefetch(target *t, uint32_t *dfsr, bool dfsr_read)
+{
+	struct cortexm_priv *priv = t->priv;
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	cortexm_prefetch.count = 0;
+	/* Registers first, some probes read them in a call of their own which flushes the queue */
+	cortexm_regs_queue_read(t, priv->reg_cache);
+	if (!dfsr_read)
+		adiv5_mem_queue_read32(ap, CORTEXM_DFSR, dfsr);
+	if (priv->prefetch_known) {
+		cortexm_prefetch_window(t, priv->prefetch_sp);
+		cortexm_prefetch_window(t, cortexm_prefetch_pc_base(priv->prefetch_pc));
+	}
+	if (!adiv5_queue_flush(ap->dp)) {
+		ap->dp->fault = 0;
+		cortexm_prefetch.count = 0;
+		return false;
+	}
+	priv->reg_cache_valid = true;
+	return true;
+}
+
+/* Read what the actual windows add in one more batch, and hand it all to the memory cache */
+static void cortexm_halt_prefetch_fill(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	priv->prefetch_sp = priv->reg_cache[CORTEXM_REG_SP];
+	priv->prefetch_pc = priv->reg_cache[CORTEXM_REG_PC];
+	priv->prefetch_known = true;
+	const size_t guessed = cortexm_prefetch.count;
+	cortexm_prefetch_window(t, priv->prefetch_sp);
+	cortexm_prefetch_window(t, cortexm_prefetch_pc_base(priv->prefetch_pc));
+	if (cortexm_prefetch.count > guessed && !adiv5_queue_flush(ap->dp)) {
+		ap->dp->fault = 0;
+		cortexm_prefetch.count = guessed;
 	}
+	for (size_t i = 0; i < cortexm_prefetch.count; ++i)
+		target_mem_cache_fill(t, cortexm_prefetch.addr[i], cortexm_prefetch.data[i]);
+	cortexm_prefetch.count = 0;
 }
+#endif
 
 static enum target_halt_reason cortexm_halt_poll(target *t, target_addr_t *watch)
 {
 	struct cortexm_priv *priv = t->priv;
 
-	volatile uint32_t dhcsr = 0;
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_ALL) {
-		/* If this times out because the target is in WFI then
-		 * the target is still running. */
-		dhcsr = target_mem_read32(t, CORTEXM_DHCSR);
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	uint32_t dhcsr = 0;
+	uint32_t dfsr = 0;
+	bool dfsr_read = false;
+	/* Polled continually while the target runs, so link errors come back as a status */
+	adiv5_dp_errors_defer(ap->dp);
+	if (priv->stepping) {
+		/* A step is done almost at once, so fetch DFSR in the same batch */
+		adiv5_mem_queue_read32(ap, CORTEXM_DHCSR, &dhcsr);
+		adiv5_mem_queue_read32(ap, CORTEXM_DFSR, &dfsr);
+		adiv5_queue_flush(ap->dp);
+		dfsr_read = true;
+	}
+#if PC_HOSTED == 1
+	else if (ap->dp->mem_poll32) {
+		/* The probe reads on until S_HALT shows before it answers, so a run is waited out in fewer round trips */
+		if (adiv5_mem_poll32(ap, CORTEXM_DHCSR, CORTEXM_DHCSR_S_HALT, CORTEXM_DHCSR_S_HALT))
+			dhcsr = CORTEXM_DHCSR_S_HALT;
 	}
-	switch (e.type) {
-	case EXCEPTION_ERROR:
+#endif
+	else
+		adiv5_mem_read(ap, &dhcsr, CORTEXM_DHCSR, sizeof(dhcsr));
+	switch (adiv5_dp_errors_status(ap->dp)) {
+	case ADIV5_STATUS_ERROR:
 		/* Oh crap, there's no recovery from this... */
 		target_list_free();
 		return TARGET_HALT_ERROR;
-	case EXCEPTION_TIMEOUT:
+	case ADIV5_STATUS_TIMEOUT:
 		/* Timeout isn't a problem, target could be in WFI */
 		return TARGET_HALT_RUNNING;
+	default:
+		break;
 	}
 
 	if (!(dhcsr & CORTEXM_DHCSR_S_HALT))
 		return TARGET_HALT_RUNNING;
+	priv->halted = true;
 
 	/* We've halted.  Let's find out why. */
-	uint32_t dfsr = target_mem_read32(t, CORTEXM_DFSR);
+#if PC_HOSTED == 1
+	const bool prefetched = cortexm_prefetch_size && cortexm_halt_prefetch(t, &dfsr, dfsr_read);
+	dfsr_read |= prefetched;
+#endif
+	if (!dfsr_read)
+		dfsr = target_mem_read32(t, CORTEXM_DFSR);
 	target_mem_write32(t, CORTEXM_DFSR, dfsr); /* write back to reset */
+#if PC_HOSTED == 1
+	/* After the DFSR write, as memory writes empty the cache */
+	if (prefetched)
+		cortexm_halt_prefetch_fill(t);
+#endif
 
 	if ((dfsr & CORTEXM_DFSR_VCATCH) && cortexm_fault_unwind(t))
 		return TARGET_HALT_FAULT;
@@ -1083,9 +1534,18 @@ static enum target_halt_reason cortexm_halt_poll(target *t, target_addr_t *watch
 	}
 
 	if (dfsr & CORTEXM_DFSR_DWTTRAP) {
-		if (watch != NULL)
-			*watch = cortexm_check_watch(t);
-		return TARGET_HALT_WATCHPOINT;
+		const bool timed = cortexm_timeit_hit(t);
+		const target_addr_t watch_addr = cortexm_check_watch(t);
+		if (!timed || watch_addr) {
+			if (watch != NULL)
+				*watch = watch_addr;
+			return TARGET_HALT_WATCHPOINT;
+		}
+		/* A halt for the region timing alone is not reported, the core carries on */
+		if (!(dfsr & (CORTEXM_DFSR_BKPT | CORTEXM_DFSR_HALTED))) {
+			cortexm_timeit_resume(t);
+			return TARGET_HALT_RUNNING;
+		}
 	}
 	if (dfsr & CORTEXM_DFSR_BKPT)
 		return TARGET_HALT_BREAKPOINT;
@@ -1119,33 +1579,110 @@ static void cortexm_halt_resume(target *t, bool step)
 	if (priv->has_cache)
 		target_mem_write32(t, CORTEXM_ICIALLU, 0);
 
+	cortexm_reg_cache_flush(t);
+	priv->halted = false;
+	priv->dcache_state_valid = false;
 	target_mem_write32(t, CORTEXM_DHCSR, dhcsr);
 }
 
+/* The fault status registers, and the core registers if this halt has not read them yet, in one batch */
+static bool cortexm_fault_status_read(target *t, struct cortexm_fault *fault)
+{
+	struct cortexm_priv *priv = t->priv;
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	if (!priv->reg_cache_valid)
+		cortexm_regs_queue_read(t, priv->reg_cache);
+	adiv5_mem_queue_read32(ap, CORTEXM_CFSR, &fault->cfsr);
+	adiv5_mem_queue_read32(ap, CORTEXM_HFSR, &fault->hfsr);
+	adiv5_mem_queue_read32(ap, CORTEXM_MMFAR, &fault->mmfar);
+	adiv5_mem_queue_read32(ap, CORTEXM_BFAR, &fault->bfar);
+	if (!adiv5_queue_flush(ap->dp))
+		return false;
+	priv->reg_cache_valid = true;
+	memcpy(fault->regs, priv->reg_cache, sizeof(fault->regs));
+	return true;
+}
+
+/*
+ * Which stack the frame is on comes from EXC_RETURN in the registers, so
+ * the stack is a second batch. It stops at the end of RAM rather than fault.
+ */
+static bool cortexm_fault_stack_read(target *t, struct cortexm_fault *fault)
+{
+	const uint32_t exc_return = fault->regs[REG_LR];
+	fault->sp = exc_return & (1U << 2U) ? fault->regs[REG_PSP] : fault->regs[REG_MSP];
+	fault->stack_len = CORTEXM_FAULT_STACK_SIZE;
+	for (const struct target_ram *r = t->ram; r; r = r->next) {
+		if (fault->sp >= r->start && fault->sp - r->start < r->length) {
+			const uint32_t left = (uint32_t)(r->start + r->length - fault->sp) & ~3U;
+			fault->stack_len = MAX(MIN(fault->stack_len, left), 0x20U);
+			break;
+		}
+	}
+	return !target_mem_read(t, fault->stack, fault->sp, fault->stack_len);
+}
+
+#if PC_HOSTED == 1
+/* The snapshot as JSON members, for "monitor fault json" and the fault event */
+static void cortexm_fault_json(char *buf, size_t size, const struct cortexm_fault *fault)
+{
+	/* The fault addresses are only meaningful with their valid bits set */
+	char mmfar[12] = "null";
+	char bfar[12] = "null";
+	if (fault->cfsr & CORTEXM_CFSR_MMARVALID)
+		snprintf(mmfar, sizeof(mmfar), "%" PRIu32, fault->mmfar);
+	if (fault->cfsr & CORTEXM_CFSR_BFARVALID)
+		snprintf(bfar, sizeof(bfar), "%" PRIu32, fault->bfar);
+	size_t len = snprintf(buf, size,
+		"\"count\":%" PRIu32 ",\"cfsr\":%" PRIu32 ",\"hfsr\":%" PRIu32 ",\"mmfar\":%s,\"bfar\":%s,\"sp\":%" PRIu32
+		",\"regs\":[",
+		fault->count, fault->cfsr, fault->hfsr, mmfar, bfar, fault->sp);
+	for (size_t i = 0; i < CORTEXM_GENERAL_REG_COUNT && len < size; ++i)
+		len += snprintf(buf + len, size - len, "%s%" PRIu32, i ? "," : "", fault->regs[i]);
+	if (len < size)
+		len += snprintf(buf + len, size - len, "],\"stack\":\"");
+	const uint8_t *const stack = (const uint8_t *)fault->stack;
+	for (size_t i = 0; i < fault->stack_len && len < size; ++i)
+		len += snprintf(buf + len, size - len, "%02x", stack[i]);
+	if (len < size)
+		snprintf(buf + len, size - len, "\"");
+}
+#endif
+
 static int cortexm_fault_unwind(target *t)
 {
-	uint32_t hfsr = target_mem_read32(t, CORTEXM_HFSR);
-	uint32_t cfsr = target_mem_read32(t, CORTEXM_CFSR);
-	target_mem_write32(t, CORTEXM_HFSR, hfsr); /* write back to reset */
-	target_mem_write32(t, CORTEXM_CFSR, cfsr); /* write back to reset */
+	struct cortexm_priv *priv = t->priv;
+	struct cortexm_fault *const fault = &priv->fault;
+	if (!cortexm_fault_status_read(t, fault))
+		return 0;
 	/* We check for FORCED in the HardFault Status Register or
 	 * for a configurable fault to avoid catching core resets */
-	if ((hfsr & CORTEXM_HFSR_FORCED) || cfsr) {
+	const bool faulted = (fault->hfsr & CORTEXM_HFSR_FORCED) || fault->cfsr;
+	/* Before the status write back, as memory writes empty the cache the stack may come from */
+	if (faulted && !cortexm_fault_stack_read(t, fault))
+		return 0;
+	target_mem_write32(t, CORTEXM_HFSR, fault->hfsr); /* write back to reset */
+	target_mem_write32(t, CORTEXM_CFSR, fault->cfsr); /* write back to reset */
+	if (faulted) {
+		++fault->count;
+		fault->valid = true;
+#if PC_HOSTED == 1
+		if (json_events_enabled) {
+			char members[896];
+			cortexm_fault_json(members, sizeof(members), fault);
+			json_event("fault", "%s", members);
+		}
+#endif
 		/* Unwind exception */
 		uint32_t regs[t->regs_size / 4];
-		uint32_t stack[8];
-		uint32_t retcode, framesize;
-		/* Read registers for post-exception stack pointer */
+		const uint32_t *const stack = fault->stack;
+		uint32_t framesize;
+		/* Registers as captured, from the cache */
 		target_regs_read(t, regs);
-		/* save retcode currently in lr */
-		retcode = regs[REG_LR];
+		/* The retcode is in lr */
+		const uint32_t retcode = regs[REG_LR];
 		bool spsel = retcode & (1U << 2U);
 		bool fpca = !(retcode & (1U << 4U));
-		/* Read stack for pre-exception registers */
-		uint32_t sp = spsel ? regs[REG_PSP] : regs[REG_MSP];
-		target_mem_read(t, stack, sp, sizeof(stack));
-		if (target_check_error(t))
-			return 0;
 		regs[REG_LR] = stack[5]; /* restore LR to pre-exception state */
 		regs[REG_PC] = stack[6]; /* restore PC to pre-exception state */
 
@@ -1180,63 +1717,483 @@ static int cortexm_fault_unwind(target *t)
 	return 0;
 }
 
-int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+/* Registers the algorithm API sets up itself, these are always saved and restored */
+#define CORTEXM_ALGO_SETUP_REGS                                                                 \
+	((1U << 0U) | (1U << 1U) | (1U << 2U) | (1U << 3U) | (1U << REG_LR) | (1U << REG_PC) | \
+		(1U << REG_XPSR) | (1U << REG_SPECIAL))
+#define CORTEXM_ALGO_DEFAULT_TIMEOUT 5000U
+
+/* Copy the algorithm into target RAM, this only needs doing again if something overwrote it */
+bool cortexm_algo_load(target *t, cortexm_algo_s *algo)
 {
-	uint32_t regs[t->regs_size / 4U];
+	if (algo->code && target_mem_write(t, algo->load_addr, algo->code, algo->code_size))
+		return false;
+	algo->loaded = true;
+	return true;
+}
 
-	memset(regs, 0, sizeof(regs));
-	regs[0] = r0;
-	regs[1] = r1;
-	regs[2] = r2;
-	regs[3] = r3;
-	regs[15] = loadaddr;
-	regs[REG_XPSR] = CORTEXM_XPSR_THUMB;
-	regs[19] = 0;
+/* Point the core at the algorithm with up to four arguments in r0-r3 and set it running */
+static bool cortexm_algo_resume(target *t, cortexm_algo_s *algo, const uint32_t *args, size_t argc)
+{
+	uint32_t *regs = cortexm_reg_cache(t);
+	struct cortexm_priv *priv = t->priv;
+	const uint32_t setup = CORTEXM_ALGO_SETUP_REGS | (algo->stack ? 1U << REG_SP : 0U);
+
+	/* Save what will be overwritten, once per run of calls */
+	if (!algo->context_saved) {
+		algo->saved_mask = setup | algo->clobbers;
+		for (size_t i = 0; i <= REG_SPECIAL; ++i) {
+			if (algo->saved_mask & (1U << i))
+				algo->saved_regs[i] = regs[i];
+		}
+		algo->context_saved = true;
+	}
 
-	cortexm_regs_write(t, regs);
+	for (size_t i = 0; i < 4U; ++i)
+		regs[i] = i < argc ? args[i] : 0;
+	if (algo->stack)
+		regs[REG_SP] = algo->stack;
+	regs[REG_LR] = 0;
+	regs[REG_PC] = algo->entry ? algo->entry : algo->load_addr;
+	regs[REG_XPSR] = CORTEXM_XPSR_THUMB;
+	regs[REG_SPECIAL] = 0;
+	priv->reg_cache_dirty |= setup;
 
 	if (target_check_error(t))
-		return -1;
+		return false;
 
-	/* Execute the stub */
-	enum target_halt_reason reason;
-#if defined(PLATFORM_HAS_DEBUG)
-	uint32_t arm_regs_start[t->regs_size];
-	target_regs_read(t, arm_regs_start);
-#endif
-	cortexm_halt_resume(t, 0);
-	platform_timeout timeout;
-	platform_timeout_set(&timeout, 5000);
-	do {
-		if (platform_timeout_is_expired(&timeout)) {
-			cortexm_halt_request(t);
-#if defined(PLATFORM_HAS_DEBUG)
-			DEBUG_WARN("Stub hangs\n");
-			uint32_t arm_regs[t->regs_size];
-			target_regs_read(t, arm_regs);
-			for (size_t i = 0; i < 20; i++) {
-				DEBUG_WARN("%2d: %08" PRIx32 ", %08" PRIx32 "\n", i, arm_regs_start[i], arm_regs[i]);
-			}
-#endif
-			return -3;
-		}
-	} while ((reason = cortexm_halt_poll(t, NULL)) == TARGET_HALT_RUNNING);
+	cortexm_halt_resume(t, false);
+	platform_timeout_set(&algo->timeout, algo->timeout_ms ? algo->timeout_ms : CORTEXM_ALGO_DEFAULT_TIMEOUT);
+	algo->running = true;
+	return true;
+}
+
+/* Start the algorithm and return without waiting, poll it with cortexm_algo_poll() */
+bool cortexm_algo_start(target *t, cortexm_algo_s *algo, const uint32_t *args, size_t argc)
+{
+	if (algo->running || argc > 4U)
+		return false;
+	if (!algo->loaded && !cortexm_algo_load(t, algo))
+		return false;
+	return cortexm_algo_resume(t, algo, args, argc);
+}
+
+/*
+ * Check on a started algorithm. Returns CORTEXM_ALGO_RUNNING while it runs, the
+ * immediate of the BKPT it stopped on, or a negative CORTEXM_ALGO_* error. A
+ * run past its timeout is halted.
+ */
+int cortexm_algo_poll(target *t, cortexm_algo_s *algo)
+{
+	if (!algo->running)
+		return CORTEXM_ALGO_ERROR;
+	const enum target_halt_reason reason = cortexm_halt_poll(t, NULL);
+	if (reason == TARGET_HALT_RUNNING) {
+		if (!platform_timeout_is_expired(&algo->timeout))
+			return CORTEXM_ALGO_RUNNING;
+		cortexm_halt_request(t);
+		algo->running = false;
+		DEBUG_WARN("Algorithm at %08" PRIx32 " hangs, PC %08" PRIx32 "\n", algo->load_addr, cortexm_pc_read(t));
+		return CORTEXM_ALGO_TIMEOUT;
+	}
+	algo->running = false;
 
 	if (reason == TARGET_HALT_ERROR)
 		raise_exception(EXCEPTION_ERROR, "Target lost in stub");
 
 	if (reason != TARGET_HALT_BREAKPOINT) {
-		DEBUG_WARN(" Reasone %d\n", reason);
-		return -2;
+		DEBUG_WARN("Algorithm stopped for reason %d\n", reason);
+		return CORTEXM_ALGO_FAULT;
 	}
-	uint32_t pc = cortexm_pc_read(t);
-	uint16_t bkpt_instr = target_mem_read16(t, pc);
+	const uint16_t bkpt_instr = target_mem_read16(t, cortexm_pc_read(t));
 	if (bkpt_instr >> 8U != 0xbeU)
-		return -2;
-
+		return CORTEXM_ALGO_FAULT;
 	return bkpt_instr & 0xffU;
 }
 
+/* Wait for a started algorithm to finish, returns as cortexm_algo_poll() */
+int cortexm_algo_wait(target *t, cortexm_algo_s *algo)
+{
+	int result;
+	while ((result = cortexm_algo_poll(t, algo)) == CORTEXM_ALGO_RUNNING)
+		continue;
+	return result;
+}
+
+/*
+ * Run the algorithm once with the parameter block: params goes to algo->param_block,
+ * whose address is passed in r0, and is read back afterwards so results left there
+ * by the algorithm reach the caller.
+ */
+int cortexm_algo_call(target *t, cortexm_algo_s *algo, void *params, size_t params_len)
+{
+	if (params_len > algo->param_size)
+		return CORTEXM_ALGO_ERROR;
+	if (params_len && target_mem_write(t, algo->param_block, params, params_len))
+		return CORTEXM_ALGO_ERROR;
+	const uint32_t arg = algo->param_block;
+	if (!cortexm_algo_start(t, algo, &arg, 1U))
+		return CORTEXM_ALGO_ERROR;
+	const int result = cortexm_algo_wait(t, algo);
+	if (result >= 0 && params_len && target_mem_read(t, params, algo->param_block, params_len))
+		return CORTEXM_ALGO_ERROR;
+	return result;
+}
+
+/* Put back the registers the algorithm runs changed, the core is left halted where it was */
+void cortexm_algo_restore(target *t, cortexm_algo_s *algo)
+{
+	if (algo->running) {
+		cortexm_halt_request(t);
+		while (cortexm_halt_poll(t, NULL) == TARGET_HALT_RUNNING)
+			continue;
+		algo->running = false;
+	}
+	if (!algo->context_saved)
+		return;
+	uint32_t *regs = cortexm_reg_cache(t);
+	for (size_t i = 0; i <= REG_SPECIAL; ++i) {
+		if (algo->saved_mask & (1U << i))
+			regs[i] = algo->saved_regs[i];
+	}
+	((struct cortexm_priv *)t->priv)->reg_cache_dirty |= algo->saved_mask;
+	algo->context_saved = false;
+}
+
+/* Load the registers for a stub and set it running without waiting for it to finish */
+bool cortexm_start_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	cortexm_algo_s algo = {.load_addr = loadaddr, .loaded = true};
+	const uint32_t args[] = {r0, r1, r2, r3};
+	return cortexm_algo_start(t, &algo, args, 4U);
+}
+
+/* Run a stub already in RAM to its BKPT, the registers are left as it left them */
+int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	cortexm_algo_s algo = {.load_addr = loadaddr, .loaded = true};
+	const uint32_t args[] = {r0, r1, r2, r3};
+	if (!cortexm_algo_start(t, &algo, args, 4U))
+		return CORTEXM_ALGO_ERROR;
+	return cortexm_algo_wait(t, &algo);
+}
+
+static const uint16_t cortexm_crc32_stub[] = {
+#include "flashstub/crc32.stub"
+};
+
+static const uint16_t cortexm_crc32_stm32_stub[] = {
+#include "flashstub/crc32_stm32.stub"
+};
+
+/* Largest range handed to a single stub run, so slow clocked parts stay within its timeout */
+#define CRC32_STUB_CHUNK 0x40000U
+
+#define CRC32_STUB_SW_OFFSET 0U
+#define CRC32_STUB_HW_OFFSET ALIGN(sizeof(cortexm_crc32_stub), 4U)
+#define CRC32_STUB_SIZE      (CRC32_STUB_HW_OFFSET + ALIGN(sizeof(cortexm_crc32_stm32_stub), 4U))
+
+void cortexm_set_crc_unit(target *t, const cortexm_crc_unit_s *unit)
+{
+	struct cortexm_priv *priv = t->priv;
+	priv->crc_unit = unit;
+}
+
+/* Prefer the main SRAM for a stub, other RAMs may not be clocked yet */
+static const struct target_ram *cortexm_stub_ram(target *t, size_t size)
+{
+	const struct target_ram *stub_ram = NULL;
+	for (const struct target_ram *ram = t->ram; ram; ram = ram->next) {
+		if (ram->length < size)
+			continue;
+		if (ram->start == 0x20000000U)
+			return ram;
+		stub_ram = ram;
+	}
+	return stub_ram;
+}
+
+#define CRC_UNIT_DR   0x00U
+#define CRC_UNIT_CR   0x08U
+#define CRC_UNIT_INIT 0x10U
+#define CRC_UNIT_POL  0x14U
+
+#define CRC_UNIT_CR_RESET    (1U << 0U)
+#define CRC_UNIT_INIT_RESET  0xffffffffU
+#define CRC_UNIT_POL_DEFAULT 0x04c11db7U
+
+/* What the application left in the CRC unit, put back once the stub is done with it */
+typedef struct cortexm_crc_unit_state {
+	uint32_t dr;
+	uint32_t cr;
+	uint32_t init;
+	uint32_t pol;
+} cortexm_crc_unit_state_s;
+
+/*
+ * Save the unit's registers and give the stub the default polynomial and initial value.
+ * False if the unit can not be put back afterwards and must be left alone.
+ */
+static bool cortexm_crc_unit_save(target *t, const cortexm_crc_unit_s *unit, cortexm_crc_unit_state_s *state)
+{
+	state->dr = target_mem_read32(t, unit->base + CRC_UNIT_DR);
+	state->cr = target_mem_read32(t, unit->base + CRC_UNIT_CR);
+	/* Without INIT the data register can only be taken back to its reset value */
+	if (!unit->programmable)
+		return state->dr == CRC_UNIT_INIT_RESET;
+	state->init = target_mem_read32(t, unit->base + CRC_UNIT_INIT);
+	state->pol = target_mem_read32(t, unit->base + CRC_UNIT_POL);
+	target_mem_write32(t, unit->base + CRC_UNIT_INIT, CRC_UNIT_INIT_RESET);
+	target_mem_write32(t, unit->base + CRC_UNIT_POL, CRC_UNIT_POL_DEFAULT);
+	return true;
+}
+
+static void cortexm_crc_unit_restore(target *t, const cortexm_crc_unit_s *unit, const cortexm_crc_unit_state_s *state)
+{
+	/* A reset loads the data register from INIT, so INIT carries the old value in first */
+	if (unit->programmable)
+		target_mem_write32(t, unit->base + CRC_UNIT_INIT, state->dr);
+	target_mem_write32(t, unit->base + CRC_UNIT_CR, CRC_UNIT_CR_RESET);
+	if (unit->programmable) {
+		target_mem_write32(t, unit->base + CRC_UNIT_INIT, state->init);
+		target_mem_write32(t, unit->base + CRC_UNIT_POL, state->pol);
+	}
+	target_mem_write32(t, unit->base + CRC_UNIT_CR, state->cr & ~CRC_UNIT_CR_RESET);
+}
+
+static bool cortexm_crc32_run(target *t, const cortexm_crc_unit_s *unit, const target_addr_t stub, uint32_t *crc,
+	target_addr_t base, size_t len)
+{
+	/* The CRC unit can only start from its reset value and then keeps the running CRC itself */
+	const bool use_unit = unit && !(base & 3U);
+	bool reset_unit = true;
+
+	while (len) {
+		size_t chunk_len = MIN(len, CRC32_STUB_CHUNK);
+		if (use_unit && chunk_len >= 4U) {
+			chunk_len &= ~3U;
+			if (cortexm_run_stub(t, stub + CRC32_STUB_HW_OFFSET, base, chunk_len, unit->base, reset_unit))
+				return false;
+			reset_unit = false;
+		} else if (cortexm_run_stub(t, stub + CRC32_STUB_SW_OFFSET, base, chunk_len, *crc, 0))
+			return false;
+		if (target_reg_read(t, 0, crc, sizeof(*crc)) != sizeof(*crc))
+			return false;
+		base += chunk_len;
+		len -= chunk_len;
+	}
+	return true;
+}
+
+/*
+ * Compute the CRC of a range with a stub on the target so only the result crosses the debug
+ * link. The RAM holding the stub, the core registers and the CRC unit with its clock are
+ * restored afterwards. Returns false if the stub can not be used and the range must be read back.
+ */
+bool cortexm_crc32(target *t, uint32_t *crc, target_addr_t base, size_t len)
+{
+	const struct target_ram *ram = cortexm_stub_ram(t, CRC32_STUB_SIZE);
+	if (!ram || (base < ram->start + CRC32_STUB_SIZE && ram->start < base + len))
+		return false;
+	if (!(target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_HALT))
+		return false;
+
+	const target_addr_t stub = ram->start;
+	const cortexm_crc_unit_s *const unit = ((struct cortexm_priv *)t->priv)->crc_unit;
+	uint32_t regs[t->regs_size / 4U];
+	uint8_t saved_ram[CRC32_STUB_SIZE];
+	target_regs_read(t, regs);
+	target_mem_read(t, saved_ram, stub, sizeof(saved_ram));
+	const uint32_t clock_enable = unit ? target_mem_read32(t, unit->clock_enable) : 0;
+	if (target_check_error(t))
+		return false;
+
+	cortexm_crc_unit_state_s unit_state = {0};
+	bool use_unit = false;
+	if (unit) {
+		target_mem_write32(t, unit->clock_enable, clock_enable | unit->clock_mask);
+		use_unit = cortexm_crc_unit_save(t, unit, &unit_state);
+	}
+	target_mem_write(t, stub + CRC32_STUB_SW_OFFSET, cortexm_crc32_stub, sizeof(cortexm_crc32_stub));
+	target_mem_write(t, stub + CRC32_STUB_HW_OFFSET, cortexm_crc32_stm32_stub, sizeof(cortexm_crc32_stm32_stub));
+
+	uint32_t result = 0xffffffffU;
+	bool ret = !target_check_error(t) && cortexm_crc32_run(t, use_unit ? unit : NULL, stub, &result, base, len);
+
+	target_mem_write(t, stub, saved_ram, sizeof(saved_ram));
+	target_regs_write(t, regs);
+	if (use_unit)
+		cortexm_crc_unit_restore(t, unit, &unit_state);
+	if (unit)
+		target_mem_write32(t, unit->clock_enable, clock_enable);
+	ret &= !target_check_error(t);
+	if (ret)
+		*crc = result;
+	return ret;
+}
+
+static const uint16_t cortexm_mem_fill_stub[] = {
+#include "flashstub/mem_fill.stub"
+};
+
+static const uint16_t cortexm_mem_find_stub[] = {
+#include "flashstub/mem_find.stub"
+};
+
+/* Entry of the word at a time loop in mem_fill.s */
+#define MEM_FILL_WORDS_OFFSET 0x1aU
+
+/* The pattern follows the stub in RAM */
+#define MEM_STUB_CODE_SIZE ALIGN(MAX(sizeof(cortexm_mem_fill_stub), sizeof(cortexm_mem_find_stub)), 4U)
+#define MEM_STUB_SIZE      (MEM_STUB_CODE_SIZE + TARGET_MEM_PATTERN_MAX)
+
+/* Largest range handed to a single fill or find run, so slow clocked parts stay within the timeout */
+#define MEM_STUB_CHUNK 0x40000U
+
+/*
+ * Load a fill or find stub and its pattern into RAM clear of the range, the caller puts the
+ * RAM back from saved_ram. Returns false if the stub can not be used.
+ */
+static bool cortexm_mem_stub_load(target *t, cortexm_algo_s *algo, uint8_t *saved_ram, target_addr_t base,
+	size_t len, const void *pattern, size_t pattern_len)
+{
+	const struct target_ram *ram = cortexm_stub_ram(t, MEM_STUB_SIZE);
+	if (!ram || !len || !pattern_len || pattern_len > TARGET_MEM_PATTERN_MAX ||
+		(base < ram->start + MEM_STUB_SIZE && ram->start < base + len))
+		return false;
+	if (!(target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_HALT))
+		return false;
+
+	algo->load_addr = ram->start;
+	algo->param_block = ram->start + MEM_STUB_CODE_SIZE;
+	algo->param_size = TARGET_MEM_PATTERN_MAX;
+	/* r4-r7 are the stubs' scratch registers */
+	algo->clobbers = (1U << 4U) | (1U << 5U) | (1U << 6U) | (1U << 7U);
+	target_mem_read(t, saved_ram, ram->start, MEM_STUB_SIZE);
+	if (target_check_error(t))
+		return false;
+	if (!cortexm_algo_load(t, algo) || target_mem_write(t, algo->param_block, pattern, pattern_len)) {
+		target_mem_write(t, ram->start, saved_ram, MEM_STUB_SIZE);
+		return false;
+	}
+	return true;
+}
+
+static void cortexm_mem_stub_unload(target *t, cortexm_algo_s *algo, const uint8_t *saved_ram)
+{
+	cortexm_algo_restore(t, algo);
+	target_mem_write(t, algo->load_addr, saved_ram, MEM_STUB_SIZE);
+}
+
+/* Fill whole words from a word aligned base, the pattern having been turned into one */
+static bool cortexm_mem_fill_words(target *t, cortexm_algo_s *algo, target_addr_t base, size_t len, uint32_t word)
+{
+	algo->entry = algo->load_addr + MEM_FILL_WORDS_OFFSET;
+	while (len) {
+		const size_t chunk_len = MIN(len, MEM_STUB_CHUNK);
+		const uint32_t args[] = {base, chunk_len, word};
+		if (!cortexm_algo_start(t, algo, args, 3U) || cortexm_algo_wait(t, algo) != 0)
+			return false;
+		base += chunk_len;
+		len -= chunk_len;
+	}
+	return true;
+}
+
+static bool cortexm_mem_fill_bytes(target *t, cortexm_algo_s *algo, target_addr_t base, size_t len, size_t pattern_len)
+{
+	/* Chunks are whole repeats of the pattern so each one starts at its beginning */
+	const size_t chunk_max = MEM_STUB_CHUNK - (MEM_STUB_CHUNK % pattern_len);
+	algo->entry = 0;
+	while (len) {
+		const size_t chunk_len = MIN(len, chunk_max);
+		const uint32_t args[] = {base, chunk_len, algo->param_block, pattern_len};
+		if (!cortexm_algo_start(t, algo, args, 4U) || cortexm_algo_wait(t, algo) != 0)
+			return false;
+		base += chunk_len;
+		len -= chunk_len;
+	}
+	return true;
+}
+
+/*
+ * Fill a range with a repeating pattern by a stub on the target, so nothing but the pattern
+ * crosses the debug link. Patterns that divide a word are stored a word at a time, the at most
+ * three bytes either side of the aligned part being written by the probe.
+ */
+static bool cortexm_mem_fill(target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len)
+{
+	cortexm_algo_s algo = {.code = cortexm_mem_fill_stub, .code_size = sizeof(cortexm_mem_fill_stub)};
+	uint8_t saved_ram[MEM_STUB_SIZE];
+	if (!cortexm_mem_stub_load(t, &algo, saved_ram, base, len, pattern, pattern_len))
+		return false;
+
+	bool ret;
+	if (4U % pattern_len == 0) {
+		const uint8_t *const bytes = pattern;
+		uint8_t word[4];
+		uint32_t value;
+		const size_t head = MIN((4U - (base & 3U)) & 3U, len);
+		const size_t tail = (len - head) & 3U;
+		const size_t body = len - head - tail;
+		/* The pattern as it lies in memory from the first aligned address on */
+		for (size_t i = 0; i < 4U; ++i)
+			word[i] = bytes[(head + i) % pattern_len];
+		uint8_t edge[3];
+		for (size_t i = 0; i < head; ++i)
+			edge[i] = bytes[i % pattern_len];
+		ret = !target_mem_write(t, base, edge, head);
+		ret = ret && !target_mem_write(t, base + head + body, word, tail);
+		memcpy(&value, word, sizeof(value));
+		ret = ret && cortexm_mem_fill_words(t, &algo, base + head, body, value);
+	} else
+		ret = cortexm_mem_fill_bytes(t, &algo, base, len, pattern_len);
+
+	cortexm_mem_stub_unload(t, &algo, saved_ram);
+	return ret && !target_check_error(t);
+}
+
+/*
+ * Search a range for a pattern by a stub on the target. found is set to the first match, or to
+ * the end of the range if there is none. Returns false if the stub can not be used.
+ */
+static bool cortexm_mem_find(
+	target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len, target_addr_t *found)
+{
+	cortexm_algo_s algo = {.code = cortexm_mem_find_stub, .code_size = sizeof(cortexm_mem_find_stub)};
+	uint8_t saved_ram[MEM_STUB_SIZE];
+	if (len < pattern_len || !cortexm_mem_stub_load(t, &algo, saved_ram, base, len, pattern, pattern_len))
+		return false;
+
+	const target_addr_t end = base + len;
+	bool ret = true;
+	*found = end;
+	/* Successive windows overlap so a match across their boundary is not missed */
+	while (end - base >= pattern_len) {
+		const size_t window = MIN(end - base, MEM_STUB_CHUNK + pattern_len - 1U);
+		const uint32_t args[] = {base, window, algo.param_block, pattern_len};
+		if (!cortexm_algo_start(t, &algo, args, 4U)) {
+			ret = false;
+			break;
+		}
+		const int result = cortexm_algo_wait(t, &algo);
+		if (result == 0) {
+			uint32_t match = 0;
+			ret = target_reg_read(t, 0, &match, sizeof(match)) == sizeof(match);
+			*found = match;
+			break;
+		}
+		if (result != 1) {
+			ret = false;
+			break;
+		}
+		base += window - (pattern_len - 1U);
+	}
+
+	cortexm_mem_stub_unload(t, &algo, saved_ram);
+	return ret && !target_check_error(t);
+}
+
 /* The following routines implement hardware breakpoints and watchpoints.
  * The Flash Patch and Breakpoint (FPB) and Data Watch and Trace (DWT)
  * systems are used. */
@@ -1255,10 +2212,25 @@ static uint32_t dwt_mask(size_t len)
 	}
 }
 
-static uint32_t dwt_func(target *t, enum target_breakwatch type)
+static uint32_t dwt_func(target *t, enum target_breakwatch type, size_t len)
 {
+	struct cortexm_priv *priv = t->priv;
 	uint32_t x = 0;
 
+	if (priv->dwt_v2) {
+		x = CORTEXM_DWT_FUNC_ACTION_DEBUG | CORTEXM_DWT_FUNC_DATAVSIZE(len);
+		switch (type) {
+		case TARGET_WATCH_WRITE:
+			return CORTEXM_DWT_FUNC_MATCH_WRITE | x;
+		case TARGET_WATCH_READ:
+			return CORTEXM_DWT_FUNC_MATCH_READ | x;
+		case TARGET_WATCH_ACCESS:
+			return CORTEXM_DWT_FUNC_MATCH_ACCESS | x;
+		default:
+			return -1;
+		}
+	}
+
 	if ((t->target_options & TOPT_FLAVOUR_V6M) == 0)
 		x = CORTEXM_DWT_FUNC_DATAVSIZE_WORD;
 
@@ -1314,7 +2286,7 @@ static int cortexm_breakwatch_set(target *t, struct breakwatch *bw)
 
 		target_mem_write32(t, CORTEXM_DWT_COMP(i), val);
 		target_mem_write32(t, CORTEXM_DWT_MASK(i), dwt_mask(bw->size));
-		target_mem_write32(t, CORTEXM_DWT_FUNC(i), dwt_func(t, bw->type));
+		target_mem_write32(t, CORTEXM_DWT_FUNC(i), dwt_func(t, bw->type, bw->size));
 
 		bw->reserved[0] = i;
 		return 0;
@@ -1343,22 +2315,394 @@ static int cortexm_breakwatch_clear(target *t, struct breakwatch *bw)
 	}
 }
 
+/* The value watch comparator i belongs to, NULL if it is not one */
+static const struct cortexm_value_watch *cortexm_value_watch_of(const struct cortexm_priv *priv, unsigned i)
+{
+	for (size_t n = 0; n < CORTEXM_MAX_VALUE_WATCHES; n++) {
+		const struct cortexm_value_watch *vw = &priv->value_watch[n];
+		if (vw->set && (vw->value_comp == i || vw->addr_comp == i))
+			return vw;
+	}
+	return NULL;
+}
+
 static target_addr_t cortexm_check_watch(target *t)
 {
 	struct cortexm_priv *priv = t->priv;
 	unsigned i;
+	const struct cortexm_value_watch *vw = NULL;
 
-	for (i = 0; i < priv->hw_watchpoint_max; i++)
+	for (i = 0; i < priv->hw_watchpoint_max; i++) {
+		if (!priv->hw_watchpoint[i])
+			continue;
+		vw = cortexm_value_watch_of(priv, i);
+		/* the address half of a value watch matches on every access, only the value half halts */
+		if (vw && vw->addr_comp == i)
+			continue;
 		/* if SET and MATCHED then break */
-		if (priv->hw_watchpoint[i] && (target_mem_read32(t, CORTEXM_DWT_FUNC(i)) & CORTEXM_DWT_FUNC_MATCHED))
+		if (target_mem_read32(t, CORTEXM_DWT_FUNC(i)) & CORTEXM_DWT_FUNC_MATCHED)
 			break;
+	}
 
 	if (i == priv->hw_watchpoint_max)
 		return 0;
+	/* the comparator of a value watch holds the value, report the address watched */
+	if (vw)
+		return vw->addr;
 
 	return target_mem_read32(t, CORTEXM_DWT_COMP(i));
 }
 
+/*
+ * Data value watchpoints, for "halt when *addr == value". A value
+ * comparator is linked to an address comparator, so the target checks the
+ * condition itself and halts only on a match, rather than on every access
+ * for GDB to compare. The v7m DWT links any comparator that implements
+ * DATAVMATCH to a free one holding the address, the v8m DWT links a
+ * comparator to the address in the one before it.
+ */
+static bool dwt_value_comp_supported(target *t, unsigned i, uint32_t func)
+{
+	target_mem_write32(t, CORTEXM_DWT_FUNC(i), func);
+	const uint32_t readback = target_mem_read32(t, CORTEXM_DWT_FUNC(i));
+	target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
+	if (target_check_error(t))
+		return false;
+	if (func == CORTEXM_DWT_FUNC_MATCH_LINKED_VALUE)
+		return (readback & CORTEXM_DWT_FUNC_MATCH_MASK) == func;
+	return readback & func;
+}
+
+/* Find and claim comparators for the value watch, false if there are none free that can do it */
+static bool dwt_value_comps_claim(target *t, struct cortexm_value_watch *vw)
+{
+	struct cortexm_priv *priv = t->priv;
+	for (unsigned i = 0; i < priv->hw_watchpoint_max; i++) {
+		if (priv->hw_watchpoint[i])
+			continue;
+		if (priv->dwt_v2) {
+			if (i == 0 || priv->hw_watchpoint[i - 1U] ||
+				!dwt_value_comp_supported(t, i, CORTEXM_DWT_FUNC_MATCH_LINKED_VALUE))
+				continue;
+			vw->addr_comp = i - 1U;
+		} else {
+			if (!dwt_value_comp_supported(t, i, CORTEXM_DWT_FUNC_DATAVMATCH))
+				continue;
+			unsigned j;
+			for (j = 0; j < priv->hw_watchpoint_max; j++)
+				if (j != i && !priv->hw_watchpoint[j])
+					break;
+			if (j == priv->hw_watchpoint_max)
+				return false;
+			vw->addr_comp = j;
+		}
+		vw->value_comp = i;
+		priv->hw_watchpoint[vw->addr_comp] = true;
+		priv->hw_watchpoint[vw->value_comp] = true;
+		return true;
+	}
+	return false;
+}
+
+static bool cortexm_value_watch_set(target *t, struct cortexm_value_watch *vw)
+{
+	struct cortexm_priv *priv = t->priv;
+	if (!dwt_value_comps_claim(t, vw))
+		return false;
+	/* byte and halfword values are compared in every lane of the word */
+	uint32_t value = vw->value;
+	if (vw->size == 1U)
+		value = (value & 0xffU) * 0x01010101U;
+	else if (vw->size == 2U)
+		value = (value & 0xffffU) * 0x00010001U;
+
+	const uint32_t size = CORTEXM_DWT_FUNC_DATAVSIZE(vw->size);
+	target_mem_write32(t, CORTEXM_DWT_COMP(vw->addr_comp), vw->addr);
+	target_mem_write32(t, CORTEXM_DWT_COMP(vw->value_comp), value);
+	if (priv->dwt_v2) {
+		/* the address comparator only triggers its linked value comparator, which halts */
+		target_mem_write32(t, CORTEXM_DWT_FUNC(vw->addr_comp),
+			(dwt_func(t, vw->type, vw->size) & CORTEXM_DWT_FUNC_MATCH_MASK) | size);
+		target_mem_write32(t, CORTEXM_DWT_FUNC(vw->value_comp),
+			CORTEXM_DWT_FUNC_MATCH_LINKED_VALUE | CORTEXM_DWT_FUNC_ACTION_DEBUG | size);
+	} else {
+		/* the address comparator is left disabled, it only supplies the address */
+		target_mem_write32(t, CORTEXM_DWT_MASK(vw->addr_comp), dwt_mask(vw->size));
+		target_mem_write32(t, CORTEXM_DWT_FUNC(vw->addr_comp), 0);
+		target_mem_write32(t, CORTEXM_DWT_MASK(vw->value_comp), 0);
+		target_mem_write32(t, CORTEXM_DWT_FUNC(vw->value_comp),
+			(dwt_func(t, vw->type, vw->size) & CORTEXM_DWT_FUNC_MATCH_MASK) | CORTEXM_DWT_FUNC_DATAVMATCH | size |
+				CORTEXM_DWT_FUNC_DATAVADDR0(vw->addr_comp) | CORTEXM_DWT_FUNC_DATAVADDR1(vw->addr_comp));
+	}
+	vw->set = true;
+	return !target_check_error(t);
+}
+
+static void cortexm_value_watch_clear(target *t, struct cortexm_value_watch *vw)
+{
+	struct cortexm_priv *priv = t->priv;
+	if (!vw->set)
+		return;
+	target_mem_write32(t, CORTEXM_DWT_FUNC(vw->value_comp), 0);
+	target_mem_write32(t, CORTEXM_DWT_FUNC(vw->addr_comp), 0);
+	priv->hw_watchpoint[vw->value_comp] = false;
+	priv->hw_watchpoint[vw->addr_comp] = false;
+	vw->set = false;
+}
+
+static bool cortexm_watch_value(target *t, int argc, const char **argv)
+{
+	struct cortexm_priv *priv = t->priv;
+	static const char type_names[] = {'w', 'r', 'a'};
+
+	if (argc >= 2 && !strcmp(argv[1], "clear")) {
+		if (argc > 2) {
+			const size_t n = strtoul(argv[2], NULL, 0);
+			if (n >= CORTEXM_MAX_VALUE_WATCHES)
+				return false;
+			cortexm_value_watch_clear(t, &priv->value_watch[n]);
+		} else {
+			for (size_t n = 0; n < CORTEXM_MAX_VALUE_WATCHES; n++)
+				cortexm_value_watch_clear(t, &priv->value_watch[n]);
+		}
+		return true;
+	}
+
+	if (argc >= 3) {
+		if (t->target_options & TOPT_FLAVOUR_V6M) {
+			tc_printf(t, "ARMv6-M has no data value matching\n");
+			return false;
+		}
+		size_t n;
+		for (n = 0; n < CORTEXM_MAX_VALUE_WATCHES; n++)
+			if (!priv->value_watch[n].set)
+				break;
+		if (n == CORTEXM_MAX_VALUE_WATCHES) {
+			tc_printf(t, "All value watches in use\n");
+			return false;
+		}
+		struct cortexm_value_watch *vw = &priv->value_watch[n];
+		vw->addr = strtoul(argv[1], NULL, 0);
+		vw->value = strtoul(argv[2], NULL, 0);
+		vw->size = argc > 3 ? strtoul(argv[3], NULL, 0) : 4U;
+		vw->type = TARGET_WATCH_WRITE;
+		if (argc > 4) {
+			if (argv[4][0] == 'r')
+				vw->type = TARGET_WATCH_READ;
+			else if (argv[4][0] == 'a')
+				vw->type = TARGET_WATCH_ACCESS;
+		}
+		if ((vw->size != 1U && vw->size != 2U && vw->size != 4U) || (vw->addr & (vw->size - 1U))) {
+			tc_printf(t, "Size must be 1, 2 or 4 and the address aligned to it\n");
+			return false;
+		}
+		if (!cortexm_value_watch_set(t, vw)) {
+			cortexm_value_watch_clear(t, vw);
+			tc_printf(t, "No free DWT comparators that match values\n");
+			return false;
+		}
+	}
+
+	for (size_t n = 0; n < CORTEXM_MAX_VALUE_WATCHES; n++) {
+		const struct cortexm_value_watch *vw = &priv->value_watch[n];
+		if (vw->set)
+			tc_printf(t, "%zu: 0x%08" PRIx32 " == 0x%" PRIx32 " size %zu %c, comparators %u and %u\n", n, vw->addr,
+				vw->value, vw->size, type_names[vw->type - TARGET_WATCH_WRITE], vw->addr_comp, vw->value_comp);
+	}
+	return true;
+}
+
+/*
+ * Region timing. Two DWT comparators halt the core when the PC reaches the
+ * start and the end of the region, CYCCNT is read at each and the core is
+ * resumed at once without GDB seeing the halt. CYCCNT stops while the core is
+ * halted, so the halts add only the few cycles of debug entry and exit. They
+ * do cost a round trip over the link each though, so a region entered more
+ * than some hundred times a second runs noticeably slower. The v7m DWT has
+ * no trace packet for a PC match, so there is no non-halting variant.
+ */
+static bool cortexm_timeit_hit(target *t)
+{
+	struct cortexm_timeit *ti = &((struct cortexm_priv *)t->priv)->timeit;
+	if (!ti->set)
+		return false;
+	/* Reading FUNCTION clears MATCHED, so each comparator is read only once */
+	const bool start = target_mem_read32(t, CORTEXM_DWT_FUNC(ti->start_comp)) & CORTEXM_DWT_FUNC_MATCHED;
+	const bool end = ti->end_comp == ti->start_comp ?
+		start :
+		target_mem_read32(t, CORTEXM_DWT_FUNC(ti->end_comp)) & CORTEXM_DWT_FUNC_MATCHED;
+	if (!start && !end)
+		return false;
+	const uint32_t cycles = target_mem_read32(t, CORTEXM_DWT_CYCCNT);
+	if (end && ti->in_region) {
+		const uint32_t delta = cycles - ti->entry_cycles;
+		if (!ti->count || delta < ti->min)
+			ti->min = delta;
+		if (delta > ti->max)
+			ti->max = delta;
+		ti->total += delta;
+		++ti->count;
+		ti->in_region = false;
+	}
+	/* With start and end the same, this times the period between executions */
+	if (start) {
+		ti->entry_cycles = cycles;
+		ti->in_region = true;
+	}
+	return true;
+}
+
+static uint32_t cortexm_timeit_func(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	return priv->dwt_v2 ? CORTEXM_DWT_FUNC_MATCH_INSTR | CORTEXM_DWT_FUNC_ACTION_DEBUG : CORTEXM_DWT_FUNC_FUNC_PC;
+}
+
+/* Step past the matched instruction with the comparators off so they do not match again, then run on */
+static void cortexm_timeit_resume(target *t)
+{
+	const struct cortexm_timeit *ti = &((struct cortexm_priv *)t->priv)->timeit;
+	target_mem_write32(t, CORTEXM_DWT_FUNC(ti->start_comp), 0);
+	target_mem_write32(t, CORTEXM_DWT_FUNC(ti->end_comp), 0);
+	cortexm_halt_resume(t, true);
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 100);
+	while (!(target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_HALT)) {
+		if (target_check_error(t) || platform_timeout_is_expired(&timeout))
+			break;
+	}
+	target_mem_write32(t, CORTEXM_DFSR, CORTEXM_DFSR_RESETALL);
+	target_mem_write32(t, CORTEXM_DWT_FUNC(ti->start_comp), cortexm_timeit_func(t));
+	target_mem_write32(t, CORTEXM_DWT_FUNC(ti->end_comp), cortexm_timeit_func(t));
+	cortexm_halt_resume(t, false);
+}
+
+static void cortexm_timeit_clear(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	struct cortexm_timeit *ti = &priv->timeit;
+	if (!ti->set)
+		return;
+	target_mem_write32(t, CORTEXM_DWT_FUNC(ti->start_comp), 0);
+	target_mem_write32(t, CORTEXM_DWT_FUNC(ti->end_comp), 0);
+	target_mem_write32(t, CORTEXM_DWT_CTRL, ti->dwt_ctrl);
+	priv->hw_watchpoint[ti->start_comp] = false;
+	priv->hw_watchpoint[ti->end_comp] = false;
+	ti->set = false;
+}
+
+/* Claim a free comparator and have it match the PC at addr, false if there are none free */
+static bool cortexm_timeit_comp(target *t, target_addr_t addr, uint8_t *comp)
+{
+	struct cortexm_priv *priv = t->priv;
+	for (unsigned i = 0; i < priv->hw_watchpoint_max; i++) {
+		if (priv->hw_watchpoint[i])
+			continue;
+		priv->hw_watchpoint[i] = true;
+		*comp = i;
+		target_mem_write32(t, CORTEXM_DWT_COMP(i), addr);
+		if (!priv->dwt_v2)
+			target_mem_write32(t, CORTEXM_DWT_MASK(i), 0);
+		target_mem_write32(t, CORTEXM_DWT_FUNC(i), cortexm_timeit_func(t));
+		return true;
+	}
+	return false;
+}
+
+static bool cortexm_timeit(target *t, int argc, const char **argv)
+{
+	struct cortexm_priv *priv = t->priv;
+	struct cortexm_timeit *ti = &priv->timeit;
+
+	if (argc == 2 && !strcmp(argv[1], "clear")) {
+		cortexm_timeit_clear(t);
+		return true;
+	}
+
+	if (argc >= 3) {
+		const uint32_t dwt_ctrl = target_mem_read32(t, CORTEXM_DWT_CTRL);
+		if ((t->target_options & TOPT_FLAVOUR_V6M) || (dwt_ctrl & CORTEXM_DWT_CTRL_NOCYCCNT)) {
+			tc_printf(t, "The DWT has no cycle counter\n");
+			return false;
+		}
+		cortexm_timeit_clear(t);
+		memset(ti, 0, sizeof(*ti));
+		/* The Thumb bit of a function's address is not part of the PC */
+		ti->start = strtoul(argv[1], NULL, 0) & ~1U;
+		ti->end = strtoul(argv[2], NULL, 0) & ~1U;
+		ti->dwt_ctrl = dwt_ctrl;
+		if (!cortexm_timeit_comp(t, ti->start, &ti->start_comp)) {
+			tc_printf(t, "No free DWT comparators\n");
+			return false;
+		}
+		ti->end_comp = ti->start_comp;
+		if (ti->end != ti->start && !cortexm_timeit_comp(t, ti->end, &ti->end_comp)) {
+			priv->hw_watchpoint[ti->start_comp] = false;
+			target_mem_write32(t, CORTEXM_DWT_FUNC(ti->start_comp), 0);
+			tc_printf(t, "No free DWT comparators\n");
+			return false;
+		}
+		target_mem_write32(t, CORTEXM_DWT_CTRL, dwt_ctrl | CORTEXM_DWT_CTRL_CYCCNTENA);
+		ti->set = true;
+		return !target_check_error(t);
+	}
+
+	if (!ti->set) {
+		tc_printf(t, "No region is being timed\n");
+		return true;
+	}
+	tc_printf(t, "0x%08" PRIx32 " to 0x%08" PRIx32 ": ", ti->start, ti->end);
+	if (!ti->count)
+		tc_printf(t, "not run yet\n");
+	else
+		tc_printf(t, "count %" PRIu32 ", min %" PRIu32 ", avg %" PRIu32 ", max %" PRIu32 " cycles\n", ti->count,
+			ti->min, (uint32_t)(ti->total / ti->count), ti->max);
+	return true;
+}
+
+static bool cortexm_fault(target *t, int argc, const char **argv)
+{
+	const struct cortexm_fault *const fault = &((struct cortexm_priv *)t->priv)->fault;
+	if (!fault->valid) {
+		tc_printf(t, "No fault caught yet, see monitor vector_catch\n");
+		return true;
+	}
+#if PC_HOSTED == 1
+	if (argc == 2 && !strcmp(argv[1], "json")) {
+		char members[896];
+		cortexm_fault_json(members, sizeof(members), fault);
+		tc_printf(t, "{%s}\n", members);
+		return true;
+	}
+#else
+	(void)argc;
+	(void)argv;
+#endif
+	static const char *const reg_names[CORTEXM_GENERAL_REG_COUNT] = {"r0", "r1", "r2", "r3", "r4", "r5", "r6",
+		"r7", "r8", "r9", "r10", "r11", "r12", "sp", "lr", "pc", "xpsr", "msp", "psp", "special"};
+	static const char *const frame_names[8] = {"r0", "r1", "r2", "r3", "r12", "lr", "pc", "xpsr"};
+	tc_printf(t, "Fault %" PRIu32 ": CFSR 0x%08" PRIx32 " HFSR 0x%08" PRIx32, fault->count, fault->cfsr, fault->hfsr);
+	if (fault->cfsr & CORTEXM_CFSR_MMARVALID)
+		tc_printf(t, " MMFAR 0x%08" PRIx32, fault->mmfar);
+	if (fault->cfsr & CORTEXM_CFSR_BFARVALID)
+		tc_printf(t, " BFAR 0x%08" PRIx32, fault->bfar);
+	tc_printf(t, "\nFrame at 0x%08" PRIx32 ":\n", fault->sp);
+	for (size_t i = 0; i < 8U; ++i)
+		tc_printf(t, "%7s 0x%08" PRIx32 "%s", frame_names[i], fault->stack[i], (i & 3U) == 3U ? "\n" : "");
+	tc_printf(t, "In the handler:\n");
+	for (size_t i = 0; i < CORTEXM_GENERAL_REG_COUNT; ++i)
+		tc_printf(t, "%7s 0x%08" PRIx32 "%s", reg_names[i], fault->regs[i], (i & 3U) == 3U ? "\n" : "");
+	tc_printf(t, "Stack:\n");
+	for (size_t i = 0; i < fault->stack_len / 4U; ++i) {
+		if (!(i & 3U))
+			tc_printf(t, "0x%08" PRIx32 ":", fault->sp + (uint32_t)i * 4U);
+		tc_printf(t, " %08" PRIx32 "%s", fault->stack[i], (i & 3U) == 3U ? "\n" : "");
+	}
+	if ((fault->stack_len / 4U) & 3U)
+		tc_printf(t, "\n");
+	return true;
+}
+
 static bool cortexm_vector_catch(target *t, int argc, char *argv[])
 {
 	struct cortexm_priv *priv = t->priv;
@@ -1399,6 +2743,149 @@ static bool cortexm_vector_catch(target *t, int argc, char *argv[])
 	return true;
 }
 
+/*
+ * PC sampling profiler. The target runs for the given time while its PC is
+ * sampled, from DWT_PCSR where the part implements it, which does not disturb
+ * the core, or else by briefly halting it for each sample. Samples are binned
+ * by PC and the most frequent ones are reported as "pc count" lines, to be
+ * resolved against the image with addr2line or folded into a flame graph.
+ */
+#if PC_HOSTED == 1
+#define CORTEXM_PROFILE_BUCKETS 16384U
+#define CORTEXM_PROFILE_REPORT  64U
+#else
+#define CORTEXM_PROFILE_BUCKETS 256U
+#define CORTEXM_PROFILE_REPORT  16U
+#endif
+#define CORTEXM_PROFILE_PROBES 16U
+/* DWT_PCSR reads this while the core is halted, sleeping or in debug state */
+#define CORTEXM_PCSR_NO_SAMPLE 0xffffffffU
+
+typedef struct cortexm_profile_bucket {
+	uint32_t pc;
+	uint32_t count;
+} cortexm_profile_bucket_s;
+
+typedef struct cortexm_profile {
+	cortexm_profile_bucket_s bucket[CORTEXM_PROFILE_BUCKETS];
+	uint32_t samples;
+	uint32_t not_binned;
+	uint32_t no_sample;
+} cortexm_profile_s;
+
+static void cortexm_profile_add(cortexm_profile_s *const profile, const uint32_t pc)
+{
+	++profile->samples;
+	if (pc == CORTEXM_PCSR_NO_SAMPLE) {
+		++profile->no_sample;
+		return;
+	}
+	uint32_t bucket = ((pc >> 1U) * 2654435761U) % CORTEXM_PROFILE_BUCKETS;
+	for (size_t i = 0; i < CORTEXM_PROFILE_PROBES; ++i, bucket = (bucket + 1U) % CORTEXM_PROFILE_BUCKETS) {
+		cortexm_profile_bucket_s *const entry = &profile->bucket[bucket];
+		if (!entry->count)
+			entry->pc = pc;
+		if (entry->pc == pc) {
+			++entry->count;
+			return;
+		}
+	}
+	++profile->not_binned;
+}
+
+/* Halt, read the PC and resume, false if the core stopped for another reason */
+static bool cortexm_profile_halt_sample(target *t, uint32_t *const pc)
+{
+	cortexm_halt_request(t);
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 100);
+	enum target_halt_reason reason;
+	while ((reason = cortexm_halt_poll(t, NULL)) == TARGET_HALT_RUNNING) {
+		if (platform_timeout_is_expired(&timeout))
+			return false;
+	}
+	if (reason != TARGET_HALT_REQUEST)
+		return false;
+	*pc = cortexm_pc_read(t);
+	cortexm_halt_resume(t, false);
+	return true;
+}
+
+static void cortexm_profile_report(target *t, const cortexm_profile_s *const profile, const bool pcsr)
+{
+	tc_printf(t, "%" PRIu32 " samples by %s, %" PRIu32 " while halted or sleeping, %" PRIu32 " not binned\n",
+		profile->samples, pcsr ? "DWT_PCSR" : "halting", profile->no_sample, profile->not_binned);
+	uint32_t last_count = UINT32_MAX;
+	uint32_t last_pc = 0;
+	for (size_t reported = 0; reported < CORTEXM_PROFILE_REPORT; ++reported) {
+		/* next highest count, ties in PC order */
+		const cortexm_profile_bucket_s *best = NULL;
+		for (size_t i = 0; i < CORTEXM_PROFILE_BUCKETS; ++i) {
+			const cortexm_profile_bucket_s *const entry = &profile->bucket[i];
+			if (!entry->count || entry->count > last_count || (entry->count == last_count && entry->pc <= last_pc))
+				continue;
+			if (!best || entry->count > best->count || (entry->count == best->count && entry->pc < best->pc))
+				best = entry;
+		}
+		if (!best)
+			break;
+		tc_printf(t, "0x%08" PRIx32 " %" PRIu32 "\n", best->pc, best->count);
+		last_count = best->count;
+		last_pc = best->pc;
+	}
+}
+
+static bool cortexm_profile(target *t, int argc, const char **argv)
+{
+	if (argc < 2) {
+		tc_printf(t, "usage: monitor profile <ms> [samples per second]\n");
+		return false;
+	}
+	const uint32_t duration_ms = strtoul(argv[1], NULL, 0);
+	const uint32_t rate = argc > 2 ? strtoul(argv[2], NULL, 0) : 0; /* 0: as fast as the link allows */
+	cortexm_profile_s *const profile = calloc(1, sizeof(*profile));
+	if (!profile) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+
+	const bool was_halted = target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_HALT;
+	if (was_halted)
+		cortexm_halt_resume(t, false);
+
+	/* DWT_PCSR is optional, it reads as zero where it is not implemented */
+	uint32_t pc = target_mem_read32(t, CORTEXM_DWT_PCSR);
+	const bool pcsr = pc != 0;
+	bool running = true;
+	const uint32_t start = platform_time_ms();
+	uint32_t elapsed = 0;
+	while (running && elapsed < duration_ms) {
+		if (rate && profile->samples >= (uint64_t)elapsed * rate / 1000U) {
+			platform_delay(1);
+		} else if (pcsr) {
+			cortexm_profile_add(profile, pc);
+			pc = target_mem_read32(t, CORTEXM_DWT_PCSR);
+		} else if ((running = cortexm_profile_halt_sample(t, &pc)))
+			cortexm_profile_add(profile, pc);
+		elapsed = platform_time_ms() - start;
+	}
+
+	if (!running)
+		tc_printf(t, "Target stopped while profiling\n");
+	else if (was_halted) {
+		cortexm_halt_request(t);
+		platform_timeout timeout;
+		platform_timeout_set(&timeout, 1000);
+		while (cortexm_halt_poll(t, NULL) == TARGET_HALT_RUNNING && !platform_timeout_is_expired(&timeout))
+			continue;
+		/* gdb still holds the registers of the previous halt */
+		tc_printf(t, "Target halted again, use 'flushregs' to refresh gdb's view\n");
+	}
+	cortexm_profile_report(t, profile, pcsr);
+	free(profile);
+	return true;
+}
+
 #ifdef PLATFORM_HAS_USBUART
 static bool cortexm_redirect_stdout(target *t, int argc, const char **argv)
 {
@@ -1433,6 +2920,70 @@ static void probe_mem_write(
 }
 #endif
 
+#if PC_HOSTED == 1
+/*
+ * File data moves between the host file and the target in large blocks, so
+ * the probe link rather than the semihosting call overhead sets the pace
+ * for big fread()/fwrite() calls.
+ */
+#define HOSTIO_CHUNK_SIZE (64U * 1024U)
+
+/* Returns the number of bytes read, or -1 if none could be */
+static ssize_t cortexm_hostio_read(target *t, int fd, target_addr_t buf_taddr, uint32_t buf_len)
+{
+	if (buf_len == 0)
+		return 0;
+	uint8_t *buf = malloc(MIN(buf_len, HOSTIO_CHUNK_SIZE));
+	if (buf == NULL)
+		return -1;
+	uint32_t done = 0;
+	while (done < buf_len) {
+		const size_t len = MIN(buf_len - done, HOSTIO_CHUNK_SIZE);
+		const ssize_t rc = read(fd, buf, len);
+		if (rc <= 0) {
+			if (rc < 0 && !done)
+				done = UINT32_MAX;
+			break;
+		}
+		/* Only what was read goes back to the target */
+		if (target_mem_write(t, buf_taddr + done, buf, rc)) {
+			done = UINT32_MAX;
+			break;
+		}
+		done += rc;
+		/* Short read: end of file, or a pipe or terminal with no more ready */
+		if ((size_t)rc < len)
+			break;
+	}
+	free(buf);
+	return done == UINT32_MAX ? -1 : (ssize_t)done;
+}
+
+/* Returns the number of bytes written, or -1 if none could be */
+static ssize_t cortexm_hostio_write(target *t, int fd, target_addr_t buf_taddr, uint32_t buf_len)
+{
+	if (buf_len == 0)
+		return 0;
+	uint8_t *buf = malloc(MIN(buf_len, HOSTIO_CHUNK_SIZE));
+	if (buf == NULL)
+		return -1;
+	uint32_t done = 0;
+	while (done < buf_len) {
+		const size_t len = MIN(buf_len - done, HOSTIO_CHUNK_SIZE);
+		if (target_mem_read(t, buf, buf_taddr + done, len))
+			break;
+		const ssize_t rc = write(fd, buf, len);
+		if (rc <= 0)
+			break;
+		done += rc;
+		if ((size_t)rc < len)
+			break;
+	}
+	free(buf);
+	return done ? (ssize_t)done : -1;
+}
+#endif
+
 static int cortexm_hostio_request(target *t)
 {
 	uint32_t arm_regs[t->regs_size];
@@ -1511,21 +3062,9 @@ static int cortexm_hostio_request(target *t)
 		uint32_t buf_len = params[2];
 		if (buf_taddr == TARGET_NULL)
 			break;
-		if (buf_len == 0) {
-			ret = 0;
-			break;
-		}
-		uint8_t *buf = malloc(buf_len);
-		if (buf == NULL)
-			break;
-		ssize_t rc = read(params[0] - 1, buf, buf_len);
+		const ssize_t rc = cortexm_hostio_read(t, params[0] - 1, buf_taddr, buf_len);
 		if (rc >= 0)
-			rc = buf_len - rc;
-		target_mem_write(t, buf_taddr, buf, buf_len);
-		free(buf);
-		if (target_check_error(t))
-			break;
-		ret = rc;
+			ret = buf_len - rc;
 		break;
 	}
 
@@ -1535,22 +3074,9 @@ static int cortexm_hostio_request(target *t)
 		uint32_t buf_len = params[2];
 		if (buf_taddr == TARGET_NULL)
 			break;
-		if (buf_len == 0) {
-			ret = 0;
-			break;
-		}
-		uint8_t *buf = malloc(buf_len);
-		if (buf == NULL)
-			break;
-		target_mem_read(t, buf, buf_taddr, buf_len);
-		if (target_check_error(t)) {
-			free(buf);
-			break;
-		}
-		ret = write(params[0] - 1, buf, buf_len);
-		free(buf);
-		if (ret >= 0)
-			ret = buf_len - ret;
+		const ssize_t rc = cortexm_hostio_write(t, params[0] - 1, buf_taddr, buf_len);
+		if (rc >= 0)
+			ret = buf_len - rc;
 		break;
 	}
 
@@ -1570,14 +3096,19 @@ static int cortexm_hostio_request(target *t)
 
 	case SEMIHOSTING_SYS_WRITE0: { /* write0 */
 		ret = -1;
-		uint8_t ch;
+		uint8_t chunk[64];
 		target_addr_t str = arm_regs[1];
 		if (str == TARGET_NULL)
 			break;
-		while ((ch = target_mem_read8(t, str++)) != '\0') {
-			if (target_check_error(t))
+		/* Aligned blocks, so a read never runs past the end of the memory the string is in */
+		for (bool found = false; !found;) {
+			const size_t len = sizeof(chunk) - (str & (sizeof(chunk) - 1U));
+			if (target_mem_read(t, chunk, str, len))
 				break;
-			fputc(ch, stderr);
+			const uint8_t *nul = memchr(chunk, '\0', len);
+			found = nul != NULL;
+			fwrite(chunk, 1, found ? (size_t)(nul - chunk) : len, stderr);
+			str += len;
 		}
 		ret = 0;
 		break;
@@ -1778,10 +3309,15 @@ static int cortexm_hostio_request(target *t)
 		ret = -1;
 		target_addr_t str_begin = arm_regs[1];
 		target_addr_t str_end = str_begin;
-		while (target_mem_read8(t, str_end) != 0) {
-			if (target_check_error(t))
+		/* Find the terminator an aligned block at a time rather than per byte */
+		for (bool found = false; !found;) {
+			uint8_t chunk[64];
+			const size_t chunk_len = sizeof(chunk) - (str_end & (sizeof(chunk) - 1U));
+			if (target_mem_read(t, chunk, str_end, chunk_len))
 				break;
-			str_end++;
+			const uint8_t *nul = memchr(chunk, '\0', chunk_len);
+			found = nul != NULL;
+			str_end += found ? (size_t)(nul - chunk) : chunk_len;
 		}
 		int len = str_end - str_begin;
 		if (len != 0) {
@@ -24,16 +24,32 @@
 #include "adiv5.h"
 
 extern unsigned cortexm_wait_timeout;
+#if PC_HOSTED == 1
+/* Bytes around SP and PC read with the registers at each halt, 0 to not read ahead */
+extern unsigned cortexm_prefetch_size;
+#endif
 /* Private peripheral bus base address */
 #define CORTEXM_PPB_BASE 0xe0000000U
 
 #define CORTEXM_SCS_BASE (CORTEXM_PPB_BASE + 0xe000U)
 
+#define CORTEXM_ITM_BASE CORTEXM_PPB_BASE
+#define CORTEXM_ITM_TCR  (CORTEXM_ITM_BASE + 0xe80U)
+#define CORTEXM_ITM_LAR  (CORTEXM_ITM_BASE + 0xfb0U)
+
+#define CORTEXM_ITM_TCR_ITMENA (1U << 0U)
+#define CORTEXM_ITM_TCR_TSENA  (1U << 1U)
+#define CORTEXM_ITM_TCR_TXENA  (1U << 3U)
+#define CORTEXM_ITM_LAR_UNLOCK 0xc5acce55U
+
 #define CORTEXM_CPUID (CORTEXM_SCS_BASE + 0xd00U)
+#define CORTEXM_VTOR  (CORTEXM_SCS_BASE + 0xd08U)
 #define CORTEXM_AIRCR (CORTEXM_SCS_BASE + 0xd0cU)
 #define CORTEXM_CFSR  (CORTEXM_SCS_BASE + 0xd28U)
 #define CORTEXM_HFSR  (CORTEXM_SCS_BASE + 0xd2cU)
 #define CORTEXM_DFSR  (CORTEXM_SCS_BASE + 0xd30U)
+#define CORTEXM_MMFAR (CORTEXM_SCS_BASE + 0xd34U)
+#define CORTEXM_BFAR  (CORTEXM_SCS_BASE + 0xd38U)
 #define CORTEXM_CPACR (CORTEXM_SCS_BASE + 0xd88U)
 #define CORTEXM_DHCSR (CORTEXM_SCS_BASE + 0xdf0U)
 #define CORTEXM_DCRSR (CORTEXM_SCS_BASE + 0xdf4U)
@@ -49,7 +65,18 @@ extern unsigned cortexm_wait_timeout;
 /* Cache maintenance operations */
 #define CORTEXM_ICIALLU  (CORTEXM_SCS_BASE + 0xf50U)
 #define CORTEXM_DCCMVAC  (CORTEXM_SCS_BASE + 0xf68U)
+#define CORTEXM_DCCSW    (CORTEXM_SCS_BASE + 0xf6cU)
 #define CORTEXM_DCCIMVAC (CORTEXM_SCS_BASE + 0xf70U)
+#define CORTEXM_DCCISW   (CORTEXM_SCS_BASE + 0xf74U)
+
+/* Configuration and Control Register (CCR) */
+#define CORTEXM_CCR    (CORTEXM_SCS_BASE + 0xd14U)
+#define CORTEXM_CCR_DC (1U << 16U)
+
+/* Cache Size ID Register (CCSIDR) */
+#define CORTEXM_CCSIDR_LINESIZE(ccsidr)      (((ccsidr) & 7U) + 4U)
+#define CORTEXM_CCSIDR_ASSOCIATIVITY(ccsidr) ((((ccsidr) >> 3U) & 0x3ffU) + 1U)
+#define CORTEXM_CCSIDR_NUMSETS(ccsidr)       ((((ccsidr) >> 13U) & 0x7fffU) + 1U)
 
 #define CORTEXM_FPB_BASE (CORTEXM_PPB_BASE + 0x2000U)
 
@@ -61,9 +88,16 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_DWT_BASE (CORTEXM_PPB_BASE + 0x1000U)
 
 #define CORTEXM_DWT_CTRL    (CORTEXM_DWT_BASE + 0x000U)
+#define CORTEXM_DWT_CYCCNT  (CORTEXM_DWT_BASE + 0x004U)
+#define CORTEXM_DWT_PCSR    (CORTEXM_DWT_BASE + 0x01cU)
 #define CORTEXM_DWT_COMP(i) (CORTEXM_DWT_BASE + 0x020U + (0x10U * (i)))
 #define CORTEXM_DWT_MASK(i) (CORTEXM_DWT_BASE + 0x024U + (0x10U * (i)))
 #define CORTEXM_DWT_FUNC(i) (CORTEXM_DWT_BASE + 0x028U + (0x10U * (i)))
+#define CORTEXM_DWT_DEVARCH (CORTEXM_DWT_BASE + 0xfbcU) /* v8m only */
+
+#define CORTEXM_DWT_CTRL_NOCYCCNT  (1U << 25U)
+#define CORTEXM_DWT_CTRL_EXCTRCENA (1U << 16U)
+#define CORTEXM_DWT_CTRL_CYCCNTENA (1U << 0U)
 
 /* Application Interrupt and Reset Control Register (AIRCR) */
 #define CORTEXM_AIRCR_VECTKEY (0x05faU << 16U)
@@ -76,6 +110,10 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_AIRCR_VECTCLRACTIVE (1U << 1U)
 #define CORTEXM_AIRCR_VECTRESET     (1U << 0U)
 
+/* Configurable Fault Status Register (CFSR), the fault address valid bits */
+#define CORTEXM_CFSR_MMARVALID (1U << 7U)
+#define CORTEXM_CFSR_BFARVALID (1U << 15U)
+
 /* HardFault Status Register (HFSR) */
 #define CORTEXM_HFSR_DEBUGEVT (1U << 31U)
 #define CORTEXM_HFSR_FORCED   (1U << 30U)
@@ -156,9 +194,26 @@ extern unsigned cortexm_wait_timeout;
 /* Data Watchpoint and Trace Function Register (DWT_FUNCTIONx) */
 #define CORTEXM_DWT_FUNC_MATCHED        (1U << 24U)
 #define CORTEXM_DWT_FUNC_DATAVSIZE_WORD (2U << 10U) /* v7m only */
+#define CORTEXM_DWT_FUNC_FUNC_PC        (4U << 0U)
 #define CORTEXM_DWT_FUNC_FUNC_READ      (5U << 0U)
 #define CORTEXM_DWT_FUNC_FUNC_WRITE     (6U << 0U)
 #define CORTEXM_DWT_FUNC_FUNC_ACCESS    (7U << 0U)
+#define CORTEXM_DWT_FUNC_DATAVMATCH     (1U << 8U) /* v7m only */
+#define CORTEXM_DWT_FUNC_DATAVSIZE(size) (((size) >> 1U) << 10U)
+#define CORTEXM_DWT_FUNC_DATAVADDR0(i)  ((i) << 12U) /* v7m only */
+#define CORTEXM_DWT_FUNC_DATAVADDR1(i)  ((i) << 16U) /* v7m only */
+/* v8m splits the function into MATCH and ACTION */
+#define CORTEXM_DWT_FUNC_MATCH_MASK         (0xfU << 0U)
+#define CORTEXM_DWT_FUNC_MATCH_INSTR        (2U << 0U)
+#define CORTEXM_DWT_FUNC_MATCH_ACCESS       (4U << 0U)
+#define CORTEXM_DWT_FUNC_MATCH_WRITE        (5U << 0U)
+#define CORTEXM_DWT_FUNC_MATCH_READ         (6U << 0U)
+#define CORTEXM_DWT_FUNC_MATCH_LINKED_VALUE (11U << 0U)
+#define CORTEXM_DWT_FUNC_ACTION_DEBUG       (1U << 4U)
+
+/* DWT_DEVARCH of the v8m DWT, ARCHITECT Arm and ARCHID DWT v2 */
+#define CORTEXM_DWT_DEVARCH_MASK 0xffe0ffffU
+#define CORTEXM_DWT_DEVARCH_V2   0x47601a02U
 
 #define REG_SP      13U
 #define REG_LR      14U
@@ -187,8 +242,66 @@ extern unsigned cortexm_wait_timeout;
 
 ADIv5_AP_t *cortexm_ap(target *t);
 
+/* Read an ID register while probing, a value another probe read already is not read again */
+uint32_t cortexm_probe_id_read32(target *t, uint32_t addr);
+
 bool cortexm_attach(target *t);
 void cortexm_detach(target *t);
+/* For parts whose clocks run as soon as the core leaves reset, see target_reset_profile_s */
+extern const struct target_reset_profile cortexm_reset_instant;
+/* Drivers resetting the core without cortexm's reset have to drop its register cache */
+void cortexm_reg_cache_invalidate(target *t);
+/* STM32 style hardware CRC unit the CRC stub can use, see cortexm_set_crc_unit() */
+typedef struct cortexm_crc_unit {
+	target_addr_t base;         /* CRC unit registers */
+	target_addr_t clock_enable; /* RCC register holding the unit's clock enable */
+	uint32_t clock_mask;        /* the unit's clock enable bit */
+	bool programmable;          /* has the INIT and POL registers of the F0 and F3 */
+} cortexm_crc_unit_s;
+
+void cortexm_set_crc_unit(target *t, const cortexm_crc_unit_s *unit);
+bool cortexm_crc32(target *t, uint32_t *crc, target_addr_t base, size_t len);
+
+/*
+ * A target algorithm is code loaded into target RAM once and then called as often as
+ * needed, each call ending on a BKPT whose immediate is the result. Calls can be waited
+ * for or polled while the probe does other work, such as streaming the next data into a
+ * RAM buffer. Only the registers a call sets up, plus those the algorithm is declared
+ * to clobber, are saved beforehand and put back by cortexm_algo_restore().
+ */
+#define CORTEXM_ALGO_RUNNING (-4)
+#define CORTEXM_ALGO_TIMEOUT (-3)
+#define CORTEXM_ALGO_FAULT   (-2)
+#define CORTEXM_ALGO_ERROR   (-1)
+
+typedef struct cortexm_algo {
+	const void *code;           /* image, NULL if it is already in target memory */
+	size_t code_size;           /* size of the image in bytes */
+	target_addr_t load_addr;    /* RAM address the image goes to */
+	target_addr_t entry;        /* where execution starts, 0 for load_addr */
+	target_addr_t stack;        /* initial stack pointer, 0 to run on the current stack */
+	target_addr_t param_block;  /* RAM block for arguments and results, see cortexm_algo_call() */
+	size_t param_size;          /* size of the parameter block */
+	uint32_t clobbers;          /* other core registers the algorithm changes, bit n for register n */
+	uint32_t timeout_ms;        /* run time limit per call, 0 for the 5 s default */
+
+	/* State kept by the API */
+	bool loaded;
+	bool running;
+	bool context_saved;
+	platform_timeout timeout;
+	uint32_t saved_mask;
+	uint32_t saved_regs[REG_SPECIAL + 1U];
+} cortexm_algo_s;
+
+bool cortexm_algo_load(target *t, cortexm_algo_s *algo);
+bool cortexm_algo_start(target *t, cortexm_algo_s *algo, const uint32_t *args, size_t argc);
+int cortexm_algo_poll(target *t, cortexm_algo_s *algo);
+int cortexm_algo_wait(target *t, cortexm_algo_s *algo);
+int cortexm_algo_call(target *t, cortexm_algo_s *algo, void *params, size_t params_len);
+void cortexm_algo_restore(target *t, cortexm_algo_s *algo);
+
+bool cortexm_start_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
 int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
 int cortexm_mem_write_sized(target *t, target_addr_t dest, const void *src, size_t len, enum align align);
 
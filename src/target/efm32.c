@@ -41,16 +41,15 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "adiv5.h"
+#include "flash_loader.h"
 
 #define SRAM_BASE        0x20000000
-#define STUB_BUFFER_BASE ALIGN(SRAM_BASE + sizeof(efm32_flash_write_stub), 4)
 
 static bool efm32_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool efm32_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool efm32_mass_erase(target *t);
 
 static const uint16_t efm32_flash_write_stub[] = {
-#include "flashstub/efm32.stub"
+#include "flashstub/efm32_loader.stub"
 };
 
 static bool efm32_cmd_serial(target *t, int argc, const char **argv);
@@ -494,20 +493,36 @@ static efm32_v2_di_miscchip_t efm32_v2_read_miscchip(target *t, uint8_t di_versi
 /* Shared Functions                                                           */
 /* -------------------------------------------------------------------------- */
 
-static void efm32_add_flash(target *t, target_addr_t addr, size_t length, size_t page_size)
+struct efm32_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+};
+
+static void efm32_add_flash(
+	target *t, target_addr_t addr, size_t length, size_t page_size, uint32_t msc, size_t ram_size)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct efm32_flash *ef = calloc(1, sizeof(*ef));
+	if (!ef) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	flash_loader_s *loader = &ef->loader;
+	loader->code = efm32_flash_write_stub;
+	loader->code_size = sizeof(efm32_flash_write_stub);
+	loader->load_addr = SRAM_BASE;
+	loader->param = msc;
+	/* A page per buffer, unless two of them do not fit the part's SRAM */
+	loader->buffer_size = page_size;
+	while (loader->buffer_size > 256U && flash_loader_ram_size(loader) > ram_size)
+		loader->buffer_size /= 2U;
+
+	target_flash_s *f = &ef->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = page_size;
 	f->erase = efm32_flash_erase;
-	f->write = efm32_flash_write;
-	f->writesize = page_size;
+	f->loader = loader;
 	target_add_flash(t, f);
 }
 
@@ -581,12 +596,12 @@ bool efm32_probe(target *t)
 	tc_printf(t, "flash size %u page size %u\n", flash_size, flash_page_size);
 
 	target_add_ram(t, SRAM_BASE, ram_size);
-	efm32_add_flash(t, 0x00000000, flash_size, flash_page_size);
+	efm32_add_flash(t, 0x00000000, flash_size, flash_page_size, device->msc_addr, ram_size);
 	if (device->user_data_size) { /* optional User Data (UD) section */
-		efm32_add_flash(t, 0x0fe00000, device->user_data_size, flash_page_size);
+		efm32_add_flash(t, 0x0fe00000, device->user_data_size, flash_page_size, device->msc_addr, ram_size);
 	}
 	if (device->bootloader_size) { /* optional Bootloader (BL) section */
-		efm32_add_flash(t, 0x0fe10000, device->bootloader_size, flash_page_size);
+		efm32_add_flash(t, 0x0fe10000, device->bootloader_size, flash_page_size, device->msc_addr, ram_size);
 	}
 
 	target_add_commands(t, efm32_cmd_list, "EFM32");
@@ -635,33 +650,6 @@ static bool efm32_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	return true;
 }
 
-/* Write flash page by page */
-static bool efm32_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
-{
-	(void)len;
-
-	target *t = f->t;
-
-	struct efm32_priv_s *priv_storage = (struct efm32_priv_s *)t->target_storage;
-	if (!priv_storage || !priv_storage->device)
-		return false;
-
-	/* Write flashloader */
-	target_mem_write(t, SRAM_BASE, efm32_flash_write_stub, sizeof(efm32_flash_write_stub));
-	/* Write Buffer */
-	target_mem_write(t, STUB_BUFFER_BASE, src, len);
-	/* Run flashloader */
-	const bool ret = cortexm_run_stub(t, SRAM_BASE, dest, STUB_BUFFER_BASE, len, priv_storage->device->msc_addr) == 0;
-
-#ifdef ENABLE_DEBUG
-	/* Check the MSC_IF */
-	uint32_t msc = priv_storage->device->msc_addr;
-	uint32_t msc_if = target_mem_read32(t, EFM32_MSC_IF(msc));
-	DEBUG_INFO("EFM32: Flash write done MSC_IF=%08" PRIx32 "\n", msc_if);
-#endif
-	return ret;
-}
-
 /* Uses the MSC ERASEMAIN0/1 command to erase the entire flash */
 static bool efm32_mass_erase(target *t)
 {
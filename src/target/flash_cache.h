@@ -0,0 +1,84 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TARGET_FLASH_CACHE_H
+#define TARGET_FLASH_CACHE_H
+
+#include "target_internal.h"
+
+/*
+ * Host side record of what each sector of a part's Flash holds, kept per device unique ID
+ * between runs. Differential flashing asks it before comparing a sector with the target, see
+ * platforms/hosted/flash_cache.c. The firmware has no room for it and builds none of this.
+ */
+#if PC_HOSTED == 1
+/* Record devices not cached yet, set by -K */
+extern bool flash_cache_enabled;
+
+/* Load the device's record when a Flash session starts, and store it back at its end */
+void flash_cache_open(target *t);
+void flash_cache_close(target *t);
+/* The record says the sector holds the data given, or is erased with data NULL */
+bool flash_cache_holds(target_flash_s *f, target_addr_t sector, const uint8_t *data);
+/* The sector now holds the data given, or is erased with data NULL */
+void flash_cache_store(target_flash_s *f, target_addr_t sector, const uint8_t *data);
+/* The range was erased or written to, what it holds is not known any more */
+void flash_cache_forget(target_flash_s *f, target_addr_t addr, size_t len);
+/* All of the Flash was erased outside a session, drop the device's record */
+void flash_cache_drop(target *t);
+#else
+#define flash_cache_enabled false
+
+static inline void flash_cache_open(target *t)
+{
+	(void)t;
+}
+
+static inline void flash_cache_close(target *t)
+{
+	(void)t;
+}
+
+static inline bool flash_cache_holds(target_flash_s *f, target_addr_t sector, const uint8_t *data)
+{
+	(void)f;
+	(void)sector;
+	(void)data;
+	return false;
+}
+
+static inline void flash_cache_store(target_flash_s *f, target_addr_t sector, const uint8_t *data)
+{
+	(void)f;
+	(void)sector;
+	(void)data;
+}
+
+static inline void flash_cache_forget(target_flash_s *f, target_addr_t addr, size_t len)
+{
+	(void)f;
+	(void)addr;
+	(void)len;
+}
+
+static inline void flash_cache_drop(target *t)
+{
+	(void)t;
+}
+#endif
+
+#endif /* TARGET_FLASH_CACHE_H */
@@ -0,0 +1,171 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2022 1BitSquared <info@1bitsquared.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This file implements the probe side of the resident flash loaders,
+ * see flash_loader.h and flashstub/loader.inc
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "cortexm.h"
+#include "flash_loader.h"
+
+/* Number of buffers in the ring, must match flashstub/loader.inc */
+#define LOADER_SLOTS 2U
+/* How long the stub may take to program a single buffer */
+#define LOADER_TIMEOUT 5000U
+
+/* Control block placed right after the stub in target RAM */
+typedef struct loader_ctrl {
+	uint32_t head;   /* chunks queued by the probe */
+	uint32_t tail;   /* chunks completed by the stub */
+	uint32_t status; /* non-zero if the stub failed and stopped */
+	uint32_t reserved;
+	struct {
+		uint32_t dest;
+		uint32_t len;
+	} slot[LOADER_SLOTS];
+} loader_ctrl_s;
+
+static target_addr_t loader_ctrl_addr(const flash_loader_s *loader)
+{
+	return ALIGN(loader->load_addr + loader->code_size, 4U);
+}
+
+static target_addr_t loader_buffer_addr(const flash_loader_s *loader, const uint32_t slot)
+{
+	return loader_ctrl_addr(loader) + sizeof(loader_ctrl_s) + slot * loader->buffer_size;
+}
+
+size_t flash_loader_ram_size(const flash_loader_s *loader)
+{
+	return loader_buffer_addr(loader, LOADER_SLOTS) - loader->load_addr;
+}
+
+static bool flash_loader_start(target_flash_s *f)
+{
+	target *t = f->t;
+	const flash_loader_s *loader = f->loader;
+	const target_addr_t ctrl_addr = loader_ctrl_addr(loader);
+	const loader_ctrl_s ctrl = {0};
+
+	target_mem_write(t, loader->load_addr, loader->code, loader->code_size);
+	target_mem_write(t, ctrl_addr, &ctrl, sizeof(ctrl));
+	if (target_check_error(t))
+		return false;
+
+	if (!cortexm_start_stub(t, loader->load_addr, ctrl_addr, loader_buffer_addr(loader, 0), loader->buffer_size,
+			loader->param))
+		return false;
+	f->loader_head = 0;
+	f->loader_running = true;
+	return true;
+}
+
+/* Wait until at most `queued` chunks are still waiting to be programmed */
+static bool flash_loader_drain(target_flash_s *f, const uint32_t queued)
+{
+	target *t = f->t;
+	const target_addr_t state_addr = loader_ctrl_addr(f->loader) + offsetof(loader_ctrl_s, tail);
+	uint32_t last_tail = UINT32_MAX;
+	platform_timeout timeout;
+
+	while (true) {
+		/* Fetch tail and status in one go */
+		uint32_t state[2];
+		target_mem_read(t, state, state_addr, sizeof(state));
+		if (target_check_error(t))
+			break;
+		if (state[1]) {
+			/* The stub stopped on a breakpoint after reporting the failure */
+			DEBUG_WARN("Flash loader failed with status %" PRIu32 "\n", state[1]);
+			f->loader_running = false;
+			return false;
+		}
+		if (f->loader_head - state[0] <= queued)
+			return true;
+		if (state[0] != last_tail) {
+			last_tail = state[0];
+			platform_timeout_set(&timeout, LOADER_TIMEOUT);
+		} else if (platform_timeout_is_expired(&timeout)) {
+			DEBUG_WARN("Flash loader hangs\n");
+			break;
+		}
+	}
+	flash_loader_stop(f);
+	return false;
+}
+
+bool flash_loader_write(target_flash_s *f, const target_addr_t dest, const void *const src, const size_t len)
+{
+	target *t = f->t;
+	const flash_loader_s *loader = f->loader;
+	if (!f->loader_running && !flash_loader_start(f))
+		return false;
+	/* Wait for a free buffer, the others may still be programming */
+	if (!flash_loader_drain(f, LOADER_SLOTS - 1U))
+		return false;
+
+	const uint32_t slot = f->loader_head % LOADER_SLOTS;
+	const uint32_t desc[2] = {dest, len};
+	target_mem_write(t, loader_buffer_addr(loader, slot), src, len);
+	target_mem_write(t, loader_ctrl_addr(loader) + offsetof(loader_ctrl_s, slot) + slot * sizeof(desc), desc, sizeof(desc));
+	/* Publish the chunk only once its data and descriptor are in place */
+	++f->loader_head;
+	target_mem_write32(t, loader_ctrl_addr(loader) + offsetof(loader_ctrl_s, head), f->loader_head);
+	return !target_check_error(t);
+}
+
+bool flash_loader_wait(target_flash_s *f)
+{
+	if (!f->loader_running)
+		return true;
+	return flash_loader_drain(f, 0);
+}
+
+/* Halt the stub, only to be called once it has been drained or has failed */
+bool flash_loader_stop(target_flash_s *f)
+{
+	if (!f->loader_running)
+		return true;
+	target *t = f->t;
+	f->loader_running = false;
+
+	target_halt_request(t);
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 500);
+	while (target_halt_poll(t, NULL) == TARGET_HALT_RUNNING) {
+		if (platform_timeout_is_expired(&timeout))
+			return false;
+	}
+	return true;
+}
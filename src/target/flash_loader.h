@@ -0,0 +1,60 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2022 1BitSquared <info@1bitsquared.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TARGET_FLASH_LOADER_H
+#define TARGET_FLASH_LOADER_H
+
+#include "target_internal.h"
+
+/*
+ * A resident flash loader is a stub built on flashstub/loader.inc that is started once per
+ * flash session and keeps running in target RAM. Writes queue their data into a ring of
+ * buffers behind the stub's control block and return while the stub programs it, so the next
+ * chunk crosses the debug link while the flash is busy.
+ *
+ * A driver opts in by pointing target_flash_s::loader at a descriptor before calling
+ * target_add_flash(), which then provides the write and wait routines for that flash.
+ */
+typedef struct flash_loader {
+	const uint16_t *code;    /* stub image */
+	size_t code_size;        /* size of the stub image in bytes */
+	target_addr_t load_addr; /* RAM address the stub runs from, control block and buffers follow it */
+	size_t buffer_size;      /* size of each data buffer, this becomes the flash write size */
+	uint32_t param;          /* family specific value handed to the stub */
+} flash_loader_s;
+
+/* RAM the loader takes from load_addr on: stub, control block and buffers */
+size_t flash_loader_ram_size(const flash_loader_s *loader);
+bool flash_loader_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+bool flash_loader_wait(target_flash_s *f);
+bool flash_loader_stop(target_flash_s *f);
+
+#endif /* TARGET_FLASH_LOADER_H */
@@ -0,0 +1,117 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for WCH CH32F1 parts, see loader.inc
+@
+@ The family parameter is the FPEC base address. Each 128 byte page goes
+@ through the fast page program sequence: reset the write buffer, load it 16
+@ bytes at a time, then commit the page. Every operation is followed by the
+@ read of the flash word 0x100 away into the magic register, as WCH's own
+@ code does. Sequenced from the core, the buffer loads do not need the delay
+@ they do from the debug interface. r4-r7 are kept in r12 and r8-r10.
+
+	.include "loader.inc"
+
+	.equ FLASH_SR, 0x0c
+	.equ FLASH_CR, 0x10
+	.equ FLASH_AR, 0x14
+	.equ FLASH_MAGIC, 0x34
+
+	.macro cr_set bit
+	ldr r4, [r3, #FLASH_CR]
+	ldr r5, =\bit
+	orrs r4, r5
+	str r4, [r3, #FLASH_CR]
+	.endm
+
+	.macro cr_clear bit
+	ldr r4, [r3, #FLASH_CR]
+	ldr r5, =\bit
+	bics r4, r5
+	str r4, [r3, #FLASH_CR]
+	.endm
+
+	.macro wait_busy
+1:	ldr r4, [r3, #FLASH_SR]
+	lsrs r4, r4, #1
+	bcs 1b
+	.endm
+
+	@ Wait for and clear EOP
+	.macro wait_eop
+1:	ldr r4, [r3, #FLASH_SR]
+	movs r5, #0x20
+	tst r4, r5
+	beq 1b
+	str r5, [r3, #FLASH_SR]
+	.endm
+
+	.macro magic reg
+	movs r5, #1
+	lsls r5, r5, #8
+	eors r5, \reg
+	ldr r5, [r5]
+	str r5, [r3, #FLASH_MAGIC]
+	.endm
+
+	.thumb_func
+loader_program:
+	mov r12, r4
+	mov r8, r5
+	mov r9, r6
+	mov r10, r7
+program_page:
+	cmp r2, #0
+	beq program_done
+	wait_busy
+	@ FTPG and BUF_RST
+	cr_set 0x10000
+	cr_set 0x80000
+	wait_busy
+	cr_clear 0x10000
+	mov r7, r0
+	movs r6, #8
+program_load:
+	cr_set 0x10000
+	ldr r4, [r1, #0]
+	str r4, [r0, #0]
+	ldr r4, [r1, #4]
+	str r4, [r0, #4]
+	ldr r4, [r1, #8]
+	str r4, [r0, #8]
+	ldr r4, [r1, #12]
+	str r4, [r0, #12]
+	@ BUF_LOAD
+	cr_set 0x40000
+	wait_eop
+	cr_clear 0x10000
+	magic r0
+	adds r0, #16
+	adds r1, #16
+	subs r6, #1
+	bne program_load
+	@ Commit the page with FTPG and STRT
+	cr_set 0x10000
+	str r7, [r3, #FLASH_AR]
+	cr_set 0x40
+	wait_eop
+	cr_clear 0x10000
+	magic r7
+	ldr r4, [r3, #FLASH_SR]
+	movs r5, #0x14
+	tst r4, r5
+	bne program_error
+	subs r2, #128
+	b program_page
+program_error:
+	str r5, [r3, #FLASH_SR]
+	mov r0, r4
+	b program_restore
+program_done:
+	movs r0, #0
+program_restore:
+	mov r4, r12
+	mov r5, r8
+	mov r6, r9
+	mov r7, r10
+	bx lr
+	.ltorg
@@ -0,0 +1,44 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ CRC32 of a memory range, computed the same way as generic_crc32()
+@ (polynomial 0x04C11DB7, MSB first) with a nibble wide table.
+@ r0 = start, r1 = length, r2 = initial CRC; the CRC is returned in r0.
+
+	.syntax unified
+	.thumb
+	.text
+
+	.global crc32_stub
+	.thumb_func
+crc32_stub:
+	cpsid i
+	adr r3, crc32_table
+	adds r1, r0
+crc32_byte:
+	cmp r0, r1
+	beq crc32_done
+	ldrb r4, [r0]
+	adds r0, #1
+	lsls r4, r4, #24
+	eors r2, r4
+	lsrs r4, r2, #28
+	lsls r4, r4, #2
+	ldr r4, [r3, r4]
+	lsls r2, r2, #4
+	eors r2, r4
+	lsrs r4, r2, #28
+	lsls r4, r4, #2
+	ldr r4, [r3, r4]
+	lsls r2, r2, #4
+	eors r2, r4
+	b crc32_byte
+crc32_done:
+	mov r0, r2
+	bkpt #0
+
+	.align 2
+crc32_table:
+	.word 0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9
+	.word 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005
+	.word 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61
+	.word 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd
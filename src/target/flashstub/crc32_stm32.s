@@ -0,0 +1,32 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ CRC32 of a word aligned memory range using an STM32 style CRC unit,
+@ which computes the same CRC as generic_crc32() when fed byte swapped words.
+@ r0 = start, r1 = length in bytes (multiple of 4), r2 = CRC unit base,
+@ r3 = non-zero to reset the unit first; the CRC is returned in r0.
+
+	.syntax unified
+	.thumb
+	.text
+
+	.global crc32_stm32_stub
+	.thumb_func
+crc32_stm32_stub:
+	cpsid i
+	cmp r3, #0
+	beq crc32_start
+	movs r3, #1
+	str r3, [r2, #8]
+crc32_start:
+	adds r1, r0
+crc32_word:
+	cmp r0, r1
+	beq crc32_done
+	ldr r3, [r0]
+	adds r0, #4
+	rev r3, r3
+	str r3, [r2, #0]
+	b crc32_word
+crc32_done:
+	ldr r0, [r2, #0]
+	bkpt #0
@@ -0,0 +1,65 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for Silicon Labs EFM32/EZR32/EFR32 parts, see loader.inc
+@
+@ The family parameter is the MSC base address. The lock register is at 0x3c
+@ on the first generation MSC at 0x400c0000 and at 0x40 everywhere else.
+@ Only ARMv6-M instructions, for the Cortex-M0+ parts. r4 and r5 are kept in
+@ r12 and r8.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r12, r4
+	mov r8, r5
+	movs r4, #0x40
+	ldr r5, =0x400c0000
+	cmp r3, r5
+	bne program_unlock
+	movs r4, #0x3c
+program_unlock:
+	adds r4, r3
+	ldr r5, =0x1b71
+	str r5, [r4]
+	movs r5, #1
+	str r5, [r3, #0x08]
+program_word:
+	cmp r2, #0
+	beq program_done
+	str r0, [r3, #0x10]
+	movs r5, #1
+	str r5, [r3, #0x0c]
+	@ Locked or invalid address
+	ldr r5, [r3, #0x1c]
+	movs r4, #6
+	tst r5, r4
+	bne program_error
+program_ready:
+	ldr r5, [r3, #0x1c]
+	movs r4, #8
+	tst r5, r4
+	beq program_ready
+	ldr r5, [r1]
+	str r5, [r3, #0x18]
+	movs r5, #8
+	str r5, [r3, #0x0c]
+program_busy:
+	ldr r5, [r3, #0x1c]
+	movs r4, #1
+	tst r5, r4
+	bne program_busy
+	adds r0, #4
+	adds r1, #4
+	subs r2, #4
+	b program_word
+program_error:
+	mov r0, r5
+	b program_restore
+program_done:
+	movs r0, #0
+program_restore:
+	mov r4, r12
+	mov r5, r8
+	bx lr
+	.ltorg
@@ -0,0 +1,64 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for NXP Kinetis KE04/KE06 parts, see loader.inc
+@
+@ Each FTMRE Program Flash command takes two longwords, so the buffer is
+@ programmed 8 bytes per launch: command and address in FCCOB 0 and 1, data
+@ halfwords in FCCOB 2 to 5. FCLKDIV is set up by the probe beforehand.
+@ Only ARMv6-M instructions, the KE04 is a Cortex-M0+. r4 and r5 are kept in
+@ r12 and r8.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r12, r4
+	mov r8, r5
+	ldr r3, =0x40020000
+program_unit:
+	cmp r2, #0
+	beq program_done
+	movs r4, #0x30
+	strb r4, [r3, #0x05]
+	movs r4, #0
+	strb r4, [r3, #0x01]
+	lsrs r4, r0, #16
+	movs r5, #0x06
+	lsls r5, r5, #8
+	orrs r4, r5
+	strh r4, [r3, #0x08]
+	movs r4, #1
+	strb r4, [r3, #0x01]
+	uxth r4, r0
+	strh r4, [r3, #0x08]
+	movs r5, #2
+program_data:
+	strb r5, [r3, #0x01]
+	ldrh r4, [r1]
+	strh r4, [r3, #0x08]
+	adds r1, #2
+	adds r5, #1
+	cmp r5, #6
+	bne program_data
+	movs r4, #0x80
+	strb r4, [r3, #0x05]
+program_wait:
+	ldrb r4, [r3, #0x05]
+	lsls r5, r4, #24
+	bpl program_wait
+	movs r5, #0x30
+	tst r4, r5
+	bne program_fail
+	adds r0, #8
+	subs r2, #8
+	b program_unit
+program_fail:
+	mov r0, r4
+	b program_exit
+program_done:
+	movs r0, #0
+program_exit:
+	mov r4, r12
+	mov r5, r8
+	bx lr
+	.ltorg
@@ -0,0 +1,68 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for TI Stellaris/Tiva parts, see loader.inc
+@
+@ The family parameter picks how words are programmed: 0 writes them one at
+@ a time through FMD, as the Stellaris parts need, non-zero fills the 32 word
+@ flash write buffer of the Tiva parts and programs each 128 byte row with
+@ one FMC2 WRBUF command.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	cbz r3, program_words
+	ldr r3, =0x400fd000
+	@ clear the AMISC, VOLTMISC, INVDMISC and PROGMISC flags, checked after each row
+	movw r9, #0x2601
+	str r9, [r3, #0x14]
+	ldr r12, =0xa4420001
+program_row:
+	cbz r2, rows_done
+	bic r8, r0, #0x7f
+	str r8, [r3, #0]
+fill_row:
+	and r8, r0, #0x7c
+	add r8, r3
+	ldr r10, [r1], #4
+	str r10, [r8, #0x100]
+	adds r0, #4
+	subs r2, #4
+	beq commit_row
+	tst r0, #0x7f
+	bne fill_row
+commit_row:
+	str r12, [r3, #0x20]
+row_busy:
+	ldr r8, [r3, #0x20]
+	tst r8, #1
+	bne row_busy
+	ldr r8, [r3, #0x0c]
+	ands r8, r9
+	beq program_row
+	mov r0, r8
+	bx lr
+rows_done:
+	movs r0, #0
+	bx lr
+
+program_words:
+	ldr r3, =0x400fd000
+	ldr r12, =0xa4420001
+program_word:
+	cbz r2, program_done
+	str r0, [r3, #0]
+	ldr r8, [r1], #4
+	str r8, [r3, #4]
+	str r12, [r3, #8]
+program_busy:
+	ldr r8, [r3, #8]
+	tst r8, #1
+	bne program_busy
+	adds r0, #4
+	subs r2, #4
+	b program_word
+program_done:
+	movs r0, #0
+	bx lr
+	.ltorg
@@ -0,0 +1,71 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for the NXP LPC parts programmed through IAP, see loader.inc
+@
+@ The family parameter points at a configuration block the probe places in RAM:
+@   +0  IAP entry point, with the Thumb bit set
+@   +4  stack top for the IAP routines
+@   +8  flash start address
+@   +12 log2 of the sector size
+@   +16 number of the first sector
+@   +20 flash bank
+@   +24 CPU clock in kHz
+@ Every buffer is prepared and copied to flash in one go, the IAP command
+@ and result tables live on the stack. Only ARMv6-M instructions, for the
+@ Cortex-M0 parts.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r12, r3
+	ldr r3, [r3, #4]
+	mov sp, r3
+	mov r3, r12
+	push {r4-r7, lr}
+	sub sp, #44
+	mov r4, r0
+	mov r5, r1
+	mov r6, r2
+	mov r7, r3
+	@ Prepare the sectors the buffer covers
+	ldr r1, [r7, #8]
+	ldr r2, [r7, #12]
+	ldr r3, [r7, #16]
+	subs r0, r4, r1
+	lsrs r0, r2
+	adds r0, r3
+	str r0, [sp, #4]
+	adds r0, r4, r6
+	subs r0, #1
+	subs r0, r1
+	lsrs r0, r2
+	adds r0, r3
+	str r0, [sp, #8]
+	ldr r0, [r7, #20]
+	str r0, [sp, #12]
+	movs r0, #50
+	str r0, [sp, #0]
+	mov r0, sp
+	add r1, sp, #20
+	ldr r2, [r7, #0]
+	blx r2
+	ldr r0, [sp, #20]
+	cmp r0, #0
+	bne program_done
+	@ Copy the buffer to flash
+	movs r0, #51
+	str r0, [sp, #0]
+	str r4, [sp, #4]
+	str r5, [sp, #8]
+	str r6, [sp, #12]
+	ldr r0, [r7, #24]
+	str r0, [sp, #16]
+	mov r0, sp
+	add r1, sp, #20
+	ldr r2, [r7, #0]
+	blx r2
+	ldr r0, [sp, #20]
+program_done:
+	add sp, #44
+	pop {r4-r7, pc}
@@ -0,0 +1,50 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Fill a memory range with a repeating pattern.
+@ r0 = start, r1 = length, r2 = pattern address, r3 = pattern length.
+@ When the pattern is a whole word and the range word aligned the probe
+@ enters at mem_fill_words with the pattern word itself in r2.
+
+	.syntax unified
+	.thumb
+	.text
+
+	.global mem_fill_stub
+	.thumb_func
+mem_fill_stub:
+	cpsid i
+	adds r1, r0
+	movs r4, #0
+mem_fill_byte:
+	cmp r0, r1
+	beq mem_fill_done
+	ldrb r5, [r2, r4]
+	strb r5, [r0]
+	adds r0, #1
+	adds r4, #1
+	cmp r4, r3
+	bne mem_fill_byte
+	movs r4, #0
+	b mem_fill_byte
+
+	.global mem_fill_words
+	.thumb_func
+mem_fill_words:
+	cpsid i
+	adds r1, r0
+	mov r3, r2
+	mov r4, r2
+	mov r5, r2
+mem_fill_block:
+	subs r6, r1, r0
+	cmp r6, #16
+	blo mem_fill_word
+	stmia r0!, {r2, r3, r4, r5}
+	b mem_fill_block
+mem_fill_word:
+	cmp r0, r1
+	beq mem_fill_done
+	stmia r0!, {r2}
+	b mem_fill_word
+mem_fill_done:
+	bkpt #0
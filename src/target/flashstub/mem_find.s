@@ -0,0 +1,42 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Search a memory range for a byte pattern.
+@ r0 = start, r1 = length, r2 = pattern address, r3 = pattern length,
+@ the length being at least the pattern length.
+@ Stops on bkpt #0 with the address of the first match in r0,
+@ or on bkpt #1 if there is none.
+
+	.syntax unified
+	.thumb
+	.text
+
+	.global mem_find_stub
+	.thumb_func
+mem_find_stub:
+	cpsid i
+	adds r1, r0
+	subs r1, r3
+	ldrb r7, [r2]
+mem_find_next:
+	cmp r0, r1
+	bhi mem_find_none
+	ldrb r4, [r0]
+	cmp r4, r7
+	bne mem_find_miss
+	movs r5, #1
+mem_find_cmp:
+	cmp r5, r3
+	beq mem_find_found
+	ldrb r4, [r0, r5]
+	ldrb r6, [r2, r5]
+	cmp r4, r6
+	bne mem_find_miss
+	adds r5, #1
+	b mem_find_cmp
+mem_find_miss:
+	adds r0, #1
+	b mem_find_next
+mem_find_found:
+	bkpt #0
+mem_find_none:
+	bkpt #1
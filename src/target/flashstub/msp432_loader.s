@@ -0,0 +1,30 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for TI MSP432P4 parts, see loader.inc
+@
+@ The family parameter is the address of the ROM's FlashCtl_programMemory,
+@ with the Thumb bit set. It takes the source first and returns true on
+@ success. The stack is the 512 bytes at the start of SRAM the driver keeps
+@ for ROM calls, and lr is kept in r8 across the call.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r8, lr
+	mov r12, r3
+	ldr r3, =0x20000200
+	mov sp, r3
+	mov r3, r0
+	mov r0, r1
+	mov r1, r3
+	blx r12
+	mov lr, r8
+	cmp r0, #0
+	beq program_failed
+	movs r0, #0
+	bx lr
+program_failed:
+	movs r0, #1
+	bx lr
+	.ltorg
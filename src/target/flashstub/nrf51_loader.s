@@ -0,0 +1,35 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for Nordic nRF51/nRF52 parts, see loader.inc
+@
+@ Only ARMv6-M instructions, the nRF51 is a Cortex-M0. r4 is kept in r12.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r12, r4
+	ldr r3, =0x4001e504
+	movs r4, #1
+	str r4, [r3]
+	ldr r3, =0x4001e400
+program_word:
+	ldr r4, [r3]
+	cmp r4, #0
+	beq program_word
+	cmp r2, #0
+	beq program_done
+	ldr r4, [r1]
+	str r4, [r0]
+	adds r0, #4
+	adds r1, #4
+	subs r2, #4
+	b program_word
+program_done:
+	ldr r3, =0x4001e504
+	movs r4, #0
+	str r4, [r3]
+	mov r4, r12
+	movs r0, #0
+	bx lr
+	.ltorg
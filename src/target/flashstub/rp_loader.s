@@ -0,0 +1,24 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for the Raspberry RP2040, see loader.inc
+@
+@ The family parameter is the address of the boot ROM's flash_range_program.
+@ The probe leaves the flash in serial command mode for the whole session,
+@ so every buffer only costs the ROM call. That needs a stack, which the
+@ loader sets up at the top of SCRATCH_Y, and lr is kept in r8 across it.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r8, lr
+	mov r12, r3
+	ldr r3, =0x10000000
+	subs r0, r0, r3
+	ldr r3, =0x20042000
+	mov sp, r3
+	blx r12
+	mov lr, r8
+	movs r0, #0
+	bx lr
+	.ltorg
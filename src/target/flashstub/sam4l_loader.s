@@ -0,0 +1,69 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for Atmel SAM4L parts, see loader.inc
+@
+@ The family parameter is the FLASHCALW base address. Every 512 byte page is
+@ copied into the cleared page buffer with word stores and written with WP.
+@ PROGE and LOCKE clear on reading FSR, so they are gathered over the whole
+@ wait. Only ARMv6-M instructions, r4 to r6 are kept in r12, r8 and r9.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r12, r4
+	mov r8, r5
+	mov r9, r6
+program_page:
+	cmp r2, #0
+	beq program_done
+program_ready:
+	ldr r4, [r3, #0x08]
+	lsrs r4, r4, #1
+	bcc program_ready
+	@ Clear page buffer
+	ldr r5, =0xa5000003
+	str r5, [r3, #0x04]
+program_cleared:
+	ldr r4, [r3, #0x08]
+	lsrs r4, r4, #1
+	bcc program_cleared
+	movs r6, #0
+program_copy:
+	ldr r4, [r1, r6]
+	str r4, [r0, r6]
+	adds r6, #4
+	lsrs r4, r6, #9
+	beq program_copy
+	@ Write page, the page number goes in FCMD[23:8]
+	lsrs r4, r0, #9
+	lsls r4, r4, #8
+	ldr r5, =0xa5000001
+	orrs r4, r5
+	str r4, [r3, #0x04]
+	movs r6, #0
+program_busy:
+	ldr r4, [r3, #0x08]
+	orrs r6, r4
+	lsrs r4, r4, #1
+	bcc program_busy
+	movs r4, #0x0c
+	tst r6, r4
+	bne program_error
+	movs r6, #1
+	lsls r6, r6, #9
+	adds r0, r6
+	adds r1, r6
+	subs r2, r6
+	b program_page
+program_error:
+	mov r0, r6
+	b program_restore
+program_done:
+	movs r0, #0
+program_restore:
+	mov r4, r12
+	mov r5, r8
+	mov r6, r9
+	bx lr
+	.ltorg
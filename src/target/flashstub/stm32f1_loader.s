@@ -0,0 +1,51 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for STM32F0/F1/F3 parts and their clones, see loader.inc
+@
+@ The family parameter is the start of the second bank, halfwords from there
+@ on go through the second set of FPEC registers. It is 0xffffffff for parts
+@ with a single bank. Only ARMv6-M instructions, for the Cortex-M0 parts.
+@ r4-r6 are kept in r12, r8 and r9.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r12, r4
+	mov r8, r5
+	mov r9, r6
+program_half:
+	cmp r2, #0
+	beq program_done
+	ldr r4, =0x40022000
+	cmp r0, r3
+	blo program_bank
+	adds r4, #0x40
+program_bank:
+	movs r5, #1
+	str r5, [r4, #0x10]
+	ldrh r5, [r1]
+	strh r5, [r0]
+program_busy:
+	ldr r5, [r4, #0x0c]
+	movs r6, #1
+	tst r5, r6
+	bne program_busy
+	movs r6, #0x14
+	tst r5, r6
+	bne program_error
+	adds r0, #2
+	adds r1, #2
+	subs r2, #2
+	b program_half
+program_error:
+	mov r0, r5
+	b program_restore
+program_done:
+	movs r0, #0
+program_restore:
+	mov r4, r12
+	mov r5, r8
+	mov r6, r9
+	bx lr
+	.ltorg
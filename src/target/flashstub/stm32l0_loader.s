@@ -0,0 +1,75 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Resident flash loader for STM32L0/L1 parts, see loader.inc
+@
+@ The family parameter is the NVM base address, the L1 one at 0x40023c00
+@ selects 128 byte half pages, the L0 one 64 byte ones. Program flash goes in
+@ half pages written back to back, which the probe can not do in time. Data
+@ EEPROM goes a word at a time with FIX clear, erasing only words that need
+@ it. PECR is rewritten only once idle, as the L1 requires. Only ARMv6-M
+@ instructions, for the Cortex-M0+ parts. r4-r7 are kept in r12 and r8-r10.
+
+	.include "loader.inc"
+
+	.thumb_func
+loader_program:
+	mov r12, r4
+	mov r8, r5
+	mov r9, r6
+	mov r10, r7
+	ldr r6, =0x40023c00
+	ldr r4, =0x08080000
+	cmp r0, r4
+	bhs program_data
+	@ PROG | FPRG, half page programming
+	ldr r4, =0x408
+	movs r5, #64
+	cmp r3, r6
+	bne program_unit
+	movs r5, #128
+	b program_unit
+program_data:
+	@ DATA on the L0, nothing on the L1
+	movs r4, #0x10
+	movs r5, #4
+	cmp r3, r6
+	bne program_unit
+	movs r4, #0
+program_unit:
+	cmp r2, #0
+	beq program_done
+program_ready:
+	ldr r6, [r3, #0x18]
+	lsrs r6, r6, #1
+	bcs program_ready
+	str r4, [r3, #0x04]
+	mov r7, r5
+program_copy:
+	ldr r6, [r1]
+	str r6, [r0]
+	adds r0, #4
+	adds r1, #4
+	subs r2, #4
+	subs r7, #4
+	bne program_copy
+program_busy:
+	ldr r6, [r3, #0x18]
+	movs r7, #1
+	tst r6, r7
+	bne program_busy
+	@ NOTZEROERR | SIZERR | PGAERR | WRPERR
+	ldr r7, =0x10700
+	tst r6, r7
+	beq program_unit
+	str r7, [r3, #0x18]
+	mov r0, r6
+	b program_restore
+program_done:
+	movs r0, #0
+program_restore:
+	mov r4, r12
+	mov r5, r8
+	mov r6, r9
+	mov r7, r10
+	bx lr
+	.ltorg
@@ -28,6 +28,7 @@
 #include "jtagtap.h"
 #include "jtag_scan.h"
 #include "target.h"
+#include "target_internal.h"
 #include "adiv5.h"
 #include "jtag_devs.h"
 
@@ -37,6 +38,48 @@ uint32_t jtag_dev_count = 0;
 /* bucket of ones for don't care TDI */
 static const uint8_t ones[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
+/* Longest IR or DR shift assembled into a single sequence with its bypass padding */
+#define JTAG_PACKED_MAX_BITS ((JTAG_MAX_DEVS + 1U) * JTAG_MAX_IR_LEN)
+
+/* TDO read back in blocks while scanning, rather than one jtagtap_next() per bit */
+typedef struct jtag_scan_reader {
+	uint32_t bits;
+	size_t remaining;
+} jtag_scan_reader_s;
+
+static bool jtag_scan_next_bit(jtag_scan_reader_s *const reader)
+{
+	if (!reader->remaining) {
+		jtag_proc.jtagtap_tdi_tdo_seq((uint8_t *)&reader->bits, false, ones, 32U);
+		reader->remaining = 32U;
+	}
+	const bool bit = reader->bits & 1U;
+	reader->bits >>= 1U;
+	--reader->remaining;
+	return bit;
+}
+
+static void jtag_bits_copy(uint8_t *const dest, size_t dest_bit, const uint8_t *const src, size_t src_bit, const size_t count)
+{
+	for (size_t i = 0; i < count; ++i, ++dest_bit, ++src_bit) {
+		const uint8_t mask = 1U << (dest_bit & 7U);
+		if (src[src_bit >> 3U] & (1U << (src_bit & 7U)))
+			dest[dest_bit >> 3U] |= mask;
+		else
+			dest[dest_bit >> 3U] &= ~mask;
+	}
+}
+
+/* Shift ones for the bypassed devices, in blocks the size of the bucket */
+static void jtag_shift_ones(jtag_proc_t *const jp, const bool final_tms, size_t clock_cycles)
+{
+	while (clock_cycles > sizeof(ones) * 8U) {
+		jp->jtagtap_tdi_seq(false, ones, sizeof(ones) * 8U);
+		clock_cycles -= sizeof(ones) * 8U;
+	}
+	jp->jtagtap_tdi_seq(final_tms, ones, clock_cycles);
+}
+
 #if PC_HOSTED == 0
 void jtag_add_device(const uint32_t dev_index, const jtag_dev_t *jtag_dev)
 {
@@ -66,7 +109,8 @@ void jtag_add_device(const uint32_t dev_index, const jtag_dev_t *jtag_dev)
  */
 uint32_t jtag_scan(const uint8_t *irlens)
 {
-	target_list_free();
+	/* Keep a reusable SWD target list aside should an auto scan go on to SWD */
+	target_list_stash();
 
 	jtag_dev_count = 0;
 	memset(&jtag_devs, 0, sizeof(jtag_devs));
@@ -114,15 +158,16 @@ uint32_t jtag_scan(const uint8_t *irlens)
 		jtagtap_shift_ir();
 
 		DEBUG_INFO("Scanning out IRs\n");
+		jtag_scan_reader_s reader = {0};
 		/* IEEE 1149.1 requires the first bit to be a 1, but not all devices conform (see #1130 on GH) */
-		if (!jtag_proc.jtagtap_next(false, true))
+		if (!jtag_scan_next_bit(&reader))
 			DEBUG_WARN("jtag_scan: Sanity check failed: IR[0] shifted out as 0\n");
 
 		jtag_devs[0].ir_len = 1;
 		size_t device = 0;
 		for (size_t prescan = 1; device <= JTAG_MAX_DEVS && jtag_devs[device].ir_len <= JTAG_MAX_IR_LEN;) {
 			/* If we read out a '1' from TDO, we're at the end of the current device and the start of the next */
-			if (jtag_proc.jtagtap_next(false, true)) {
+			if (jtag_scan_next_bit(&reader)) {
 				/* If the device was not actually a new device, exit */
 				if (jtag_devs[device].ir_len == 1)
 					break;
@@ -160,8 +205,9 @@ uint32_t jtag_scan(const uint8_t *irlens)
 	/* Count device on chain */
 	DEBUG_INFO("Change state to Shift-DR\n");
 	jtagtap_shift_dr();
+	jtag_scan_reader_s reader = {0};
 	size_t device = 0;
-	for (; !jtag_proc.jtagtap_next(false, true) && device <= jtag_dev_count; ++device)
+	for (; !jtag_scan_next_bit(&reader) && device <= jtag_dev_count; ++device)
 		jtag_devs[device].dr_postscan = jtag_dev_count - device - 1;
 
 	if (device != jtag_dev_count) {
@@ -184,15 +230,17 @@ uint32_t jtag_scan(const uint8_t *irlens)
 	jtag_proc.jtagtap_reset();
 	jtagtap_shift_dr();
 	/* Now shift out the ID codes for all the attached devices. */
+	reader.remaining = 0;
 	for (size_t device = 0; device < jtag_dev_count; ++device) {
-		if (!jtag_proc.jtagtap_next(false, true))
+		/* After a reset every IR holds IDCODE or BYPASS, what is cached must be forgotten */
+		jtag_devs[device].current_ir = UINT32_MAX;
+		if (!jtag_scan_next_bit(&reader))
 			continue;
 		jtag_devs[device].jd_idcode = 1U;
 		for (size_t bit = 1; bit < 32; ++bit) {
-			if (jtag_proc.jtagtap_next(false, true))
+			if (jtag_scan_next_bit(&reader))
 				jtag_devs[device].jd_idcode |= 1U << bit;
 		}
-
 	}
 	DEBUG_INFO("Return to Run-Test/Idle\n");
 	jtag_proc.jtagtap_next(true, true);
@@ -239,14 +287,24 @@ void jtag_dev_write_ir(jtag_proc_t *jp, const uint8_t jd_index, const uint32_t i
 	if (ir == d->current_ir)
 		return;
 
+	/* Every other device has BYPASS, all ones, shifted into its IR */
 	for (size_t device = 0; device < jtag_dev_count; device++)
-		jtag_devs[device].current_ir = -1;
+		jtag_devs[device].current_ir = (1U << jtag_devs[device].ir_len) - 1U;
 	d->current_ir = ir;
 
 	jtagtap_shift_ir();
-	jp->jtagtap_tdi_seq(false, ones, d->ir_prescan);
-	jp->jtagtap_tdi_seq(!d->ir_postscan, (const uint8_t *)&ir, d->ir_len);
-	jp->jtagtap_tdi_seq(true, ones, d->ir_postscan);
+	const size_t total = d->ir_prescan + d->ir_len + d->ir_postscan;
+	if (total <= JTAG_PACKED_MAX_BITS) {
+		/* One sequence for the whole chain, the padding costs nothing extra on the probe */
+		uint8_t data[(JTAG_PACKED_MAX_BITS + 7U) / 8U];
+		memset(data, 0xff, sizeof(data));
+		jtag_bits_copy(data, d->ir_prescan, (const uint8_t *)&ir, 0, d->ir_len);
+		jp->jtagtap_tdi_seq(true, data, total);
+	} else {
+		jtag_shift_ones(jp, false, d->ir_prescan);
+		jp->jtagtap_tdi_seq(!d->ir_postscan, (const uint8_t *)&ir, d->ir_len);
+		jtag_shift_ones(jp, true, d->ir_postscan);
+	}
 	jtagtap_return_idle(1);
 }
 
@@ -255,11 +313,24 @@ void jtag_dev_shift_dr(
 {
 	jtag_dev_t *d = &jtag_devs[jd_index];
 	jtagtap_shift_dr();
-	jp->jtagtap_tdi_seq(false, ones, d->dr_prescan);
-	if (dout)
-		jp->jtagtap_tdi_tdo_seq((uint8_t *)dout, !d->dr_postscan, (const uint8_t *)din, clock_cycles);
-	else
-		jp->jtagtap_tdi_seq(!d->dr_postscan, (const uint8_t *)din, clock_cycles);
-	jp->jtagtap_tdi_seq(true, ones, d->dr_postscan);
+	const size_t total = d->dr_prescan + clock_cycles + d->dr_postscan;
+	if ((d->dr_prescan || d->dr_postscan) && total <= JTAG_PACKED_MAX_BITS) {
+		uint8_t data_in[(JTAG_PACKED_MAX_BITS + 7U) / 8U];
+		memset(data_in, 0xff, sizeof(data_in));
+		jtag_bits_copy(data_in, d->dr_prescan, din, 0, clock_cycles);
+		if (dout) {
+			uint8_t data_out[(JTAG_PACKED_MAX_BITS + 7U) / 8U];
+			jp->jtagtap_tdi_tdo_seq(data_out, true, data_in, total);
+			jtag_bits_copy(dout, 0, data_out, d->dr_prescan, clock_cycles);
+		} else
+			jp->jtagtap_tdi_seq(true, data_in, total);
+	} else {
+		jtag_shift_ones(jp, false, d->dr_prescan);
+		if (dout)
+			jp->jtagtap_tdi_tdo_seq((uint8_t *)dout, !d->dr_postscan, (const uint8_t *)din, clock_cycles);
+		else
+			jp->jtagtap_tdi_seq(!d->dr_postscan, (const uint8_t *)din, clock_cycles);
+		jtag_shift_ones(jp, true, d->dr_postscan);
+	}
 	jtagtap_return_idle(1);
 }
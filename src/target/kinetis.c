@@ -74,6 +74,9 @@
 #define FTFx_FSTAT_FPVIOL   (1 << 4)
 #define FTFx_FSTAT_MGSTAT0  (1 << 0)
 
+#define FTFx_FCNFG_RAMRDY (1 << 1)
+#define FTFx_FCNFG_EEERDY (1 << 0)
+
 #define FTFx_FSEC_KEYEN_MSK (0b11 << 6)
 #define FTFx_FSEC_KEYEN     (0b10 << 6)
 
@@ -84,6 +87,7 @@
 /* Part of the FTFE module for K64 */
 #define FTFx_CMD_PROGRAM_PHRASE  0x07
 #define FTFx_CMD_ERASE_SECTOR    0x09
+#define FTFx_CMD_PROGRAM_SECTION 0x0B
 #define FTFx_CMD_CHECK_ERASE_ALL 0x40
 #define FTFx_CMD_READ_ONCE       0x41
 #define FTFx_CMD_PROGRAM_ONCE    0x43
@@ -94,6 +98,12 @@
 /* 8 byte phrases need to be written to the k64 flash */
 #define K64_WRITE_LEN 8
 
+/* FlexRAM doubles as the section program buffer while it is not used for EEPROM */
+#define K64_FLEXRAM      0x14000000U
+#define K64_FLEXRAM_SIZE 0x1000U
+/* Program Section wants 128 bit aligned addresses */
+#define FTFx_SECTION_ALIGN 16U
+
 static bool kinetis_cmd_unsafe(target *t, int argc, char **argv);
 
 const struct command_s kinetis_cmd_list[] = {
@@ -112,12 +122,14 @@ static bool kinetis_cmd_unsafe(target *t, int argc, char **argv)
 }
 
 static bool kinetis_flash_cmd_erase(target_flash_s *f, target_addr_t addr, size_t len);
+static bool kinetis_flash_blank_check(target_flash_s *f, target_addr_t addr, size_t len);
 static bool kinetis_flash_cmd_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool kinetis_flash_done(target_flash_s *f);
 
 struct kinetis_flash {
 	target_flash_s f;
 	uint8_t write_len;
+	size_t flexram_size; /* section program buffer size, 0 if the part has none */
 };
 
 static void kinetis_add_flash(
@@ -136,6 +148,7 @@ static void kinetis_add_flash(
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = kinetis_flash_cmd_erase;
+	f->blank_check = kinetis_flash_blank_check;
 	f->write = kinetis_flash_cmd_write;
 	f->done = kinetis_flash_done;
 	f->erased = 0xff;
@@ -143,6 +156,13 @@ static void kinetis_add_flash(
 	target_add_flash(t, f);
 }
 
+/* All flashes added so far can be programmed section-wise through FlexRAM */
+static void kinetis_add_flexram(target *const t, const size_t size)
+{
+	for (target_flash_s *f = t->flash; f; f = f->next)
+		((struct kinetis_flash *)f)->flexram_size = size;
+}
+
 static void kl_s32k14_setup(
 	target *const t, const uint32_t sram_l, const uint32_t sram_h, const size_t flash_size, const size_t flexmem_size)
 {
@@ -289,6 +309,7 @@ bool kinetis_probe(target *const t)
 		target_add_ram(t, 0x20000000, 0x30000);
 		kinetis_add_flash(t, 0, 0x80000, 0x1000, K64_WRITE_LEN);
 		kinetis_add_flash(t, 0x80000, 0x80000, 0x1000, K64_WRITE_LEN);
+		kinetis_add_flexram(t, K64_FLEXRAM_SIZE);
 		break;
 	case 0x000: /* Older K-series */
 		switch (sdid & 0xff0) {
@@ -448,6 +469,60 @@ static bool kinetis_flash_cmd_erase(target_flash_s *const f, target_addr_t addr,
 	return true;
 }
 
+/* Read 1s Section checks a range at normal read margin, MGSTAT0 is set if any of it is not erased */
+static bool kinetis_flash_blank_check(target_flash_s *const f, target_addr_t addr, size_t len)
+{
+	struct kinetis_flash *const kf = (struct kinetis_flash *)f;
+	target *const t = f->t;
+
+	while (len) {
+		/* FCCOB4-5 hold the number of units of write_len, at most 16 bits of them, FCCOB6 the margin */
+		const size_t chunk = MIN(len, 0x8000U * kf->write_len);
+		const uint32_t count = (uint32_t)(chunk / kf->write_len) << 16U;
+		if (!kinetis_fccob_cmd(t, FTFx_CMD_CHECK_ERASE, addr, &count, 1) ||
+			(target_mem_read8(t, FTFx_FSTAT) & FTFx_FSTAT_MGSTAT0))
+			return false;
+		addr += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+/*
+ * Program Section: the data goes into FlexRAM in one block write and a single command
+ * programs all of it, rather than one FCCOB load, launch and poll per phrase.
+ */
+static bool kinetis_flash_section_write(target_flash_s *f, target_addr_t dest, const uint8_t *src, size_t len)
+{
+	struct kinetis_flash *const kf = (struct kinetis_flash *)f;
+	target *const t = f->t;
+
+	while (len) {
+		const size_t chunk = MIN(len, kf->flexram_size);
+		target_mem_write(t, K64_FLEXRAM, src, chunk);
+		if (target_check_error(t))
+			return false;
+		/* FCCOB4-5 hold the number of phrases, the top half of the second word */
+		const uint32_t count = (uint32_t)(chunk / kf->write_len) << 16U;
+		if (!kinetis_fccob_cmd(t, FTFx_CMD_PROGRAM_SECTION, dest, &count, 1))
+			return false;
+		dest += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+/* FlexRAM can be used for Program Section only while it is plain RAM rather than EEPROM */
+static bool kinetis_flash_section_usable(target_flash_s *f, target_addr_t dest, size_t len)
+{
+	struct kinetis_flash *const kf = (struct kinetis_flash *)f;
+	if (!kf->flexram_size || (dest & (FTFx_SECTION_ALIGN - 1U)) || (len & (FTFx_SECTION_ALIGN - 1U)))
+		return false;
+	const uint8_t fcnfg = target_mem_read8(f->t, FTFx_FCNFG);
+	return (fcnfg & (FTFx_FCNFG_RAMRDY | FTFx_FCNFG_EEERDY)) == FTFx_FCNFG_RAMRDY;
+}
+
 static bool kinetis_flash_cmd_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	struct kinetis_flash *const kf = (struct kinetis_flash *)f;
@@ -457,6 +532,9 @@ static bool kinetis_flash_cmd_write(target_flash_s *f, target_addr_t dest, const
 		((uint8_t *)src)[FLASH_SECURITY_BYTE_ADDRESS - dest] = FLASH_SECURITY_BYTE_UNSECURED;
 	}
 
+	if (kinetis_flash_section_usable(f, dest, len))
+		return kinetis_flash_section_write(f, dest, src, len);
+
 	/* Determine write command based on the alignment. */
 	uint8_t write_cmd;
 	if (kf->write_len == K64_WRITE_LEN)
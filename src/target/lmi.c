@@ -28,9 +28,9 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flash_loader.h"
 
 #define SRAM_BASE            0x20000000
-#define STUB_BUFFER_BASE     ALIGN(SRAM_BASE + sizeof(lmi_flash_write_stub), 4)
 
 #define BLOCK_SIZE           0x400
 
@@ -61,16 +61,32 @@
 #define LMI_FLASH_FMC_WRKEY  0xA4420000
 
 static bool lmi_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool lmi_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool lmi_mass_erase(target *t);
 
 static const char lmi_driver_str[] = "TI Stellaris/Tiva";
 
 static const uint16_t lmi_flash_write_stub[] = {
-#include "flashstub/lmi.stub"
+#include "flashstub/lmi_loader.stub"
 };
 
-static void lmi_add_flash(target *t, size_t length)
+/* Stellaris parts program a word at a time through FMD */
+static const flash_loader_s lmi_flash_loader = {
+	.code = lmi_flash_write_stub,
+	.code_size = sizeof(lmi_flash_write_stub),
+	.load_addr = SRAM_BASE,
+	.buffer_size = BLOCK_SIZE,
+};
+
+/* Tiva parts fill the 32 word flash write buffer and program it a 128 byte row at a time */
+static const flash_loader_s tm4c_flash_loader = {
+	.code = lmi_flash_write_stub,
+	.code_size = sizeof(lmi_flash_write_stub),
+	.load_addr = SRAM_BASE,
+	.buffer_size = BLOCK_SIZE,
+	.param = 1,
+};
+
+static void lmi_add_flash(target *t, size_t length, const flash_loader_s *loader)
 {
 	target_flash_s *f = calloc(1, sizeof(*f));
 	if (!f) {			/* calloc failed: heap exhaustion */
@@ -82,7 +98,7 @@ static void lmi_add_flash(target *t, size_t length)
 	f->length = length;
 	f->blocksize = 0x400;
 	f->erase = lmi_flash_erase;
-	f->write = lmi_flash_write;
+	f->loader = loader;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 }
@@ -95,11 +111,11 @@ bool lm3s_probe(target *const t, const uint16_t did1)
 	case DID1_LM3S3748:
 	case DID1_LM3S5732:
 		target_add_ram(t, 0x20000000U, 0x10000U);
-		lmi_add_flash(t, 0x20000U);
+		lmi_add_flash(t, 0x20000U, &lmi_flash_loader);
 		break;
 	case DID1_LM3S8962:
 		target_add_ram(t, 0x2000000U, 0x10000U);
-		lmi_add_flash(t, 0x40000U);
+		lmi_add_flash(t, 0x40000U, &lmi_flash_loader);
 		break;
 	default:
 		t->driver = driver;
@@ -116,7 +132,7 @@ bool tm4c_probe(target *const t, const uint16_t did1)
 	switch (did1) {
 	case DID1_TM4C123GH6PM:
 		target_add_ram(t, 0x20000000, 0x10000);
-		lmi_add_flash(t, 0x80000);
+		lmi_add_flash(t, 0x80000, &tm4c_flash_loader);
 		/* On Tiva targets, asserting nRST results in the debug
 		 * logic also being reset.  We can't assert nRST and must
 		 * only use the AIRCR SYSRESETREQ. */
@@ -124,12 +140,12 @@ bool tm4c_probe(target *const t, const uint16_t did1)
 		break;
 	case DID1_TM4C1230C3PM:
 		target_add_ram(t, 0x20000000, 0x6000);
-		lmi_add_flash(t, 0x10000);
+		lmi_add_flash(t, 0x10000, &tm4c_flash_loader);
 		t->target_options |= CORTEXM_TOPT_INHIBIT_NRST;
 		break;
 	case DID1_TM4C1294NCPDT:
 		target_add_ram(t, 0x20000000, 0x40000);
-		lmi_add_flash(t, 0x100000);
+		lmi_add_flash(t, 0x100000, &tm4c_flash_loader);
 		t->target_options |= CORTEXM_TOPT_INHIBIT_NRST;
 		break;
 	default:
@@ -182,18 +198,6 @@ static bool lmi_flash_erase(target_flash_s *f, target_addr_t addr, const size_t
 	return true;
 }
 
-static bool lmi_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
-{
-	target  *t = f->t;
-	target_check_error(t);
-	target_mem_write(t, SRAM_BASE, lmi_flash_write_stub, sizeof(lmi_flash_write_stub));
-	target_mem_write(t, STUB_BUFFER_BASE, src, len);
-	if (target_check_error(t))
-		return false;
-
-	return cortexm_run_stub(t, SRAM_BASE, dest, STUB_BUFFER_BASE, len, 0) == 0;
-}
-
 static bool lmi_mass_erase(target *t)
 {
 	return lmi_flash_erase(t->flash, t->flash->start, t->flash->length);
@@ -68,8 +68,11 @@ static void lpc11xx_add_flash(target *t, const uint32_t addr, const size_t len,
 	lf->f.write = lpc_flash_write_magic_vect;
 	lf->iap_entry = iap_entry;
 	lf->iap_ram = IAP_RAM_BASE;
-	lf->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
+	/* The part's RAM has just been added, the loader makes use of all of it */
+	const size_t ram_size = t->ram ? t->ram->length : MIN_RAM_SIZE;
+	lf->iap_msp = IAP_RAM_BASE + ram_size - RAM_USAGE_FOR_IAP_ROUTINES;
 	lf->reserved_pages = reserved_pages;
+	lpc_flash_add_loader(lf);
 }
 
 bool lpc11xx_probe(target *t)
@@ -27,7 +27,6 @@
 
 #define IAP_PGM_CHUNKSIZE	512	/* should fit in RAM on any device */
 
-#define MIN_RAM_SIZE            1024
 #define RAM_USAGE_FOR_IAP_ROUTINES	32	/* IAP routines use 32 bytes at top of ram */
 
 #define IAP_ENTRYPOINT	0x03000205
@@ -55,7 +54,7 @@ const struct command_s lpc15xx_cmd_list[] = {
 	{NULL, NULL, NULL}
 };
 
-static void lpc15xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize)
+static void lpc15xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize, size_t ram_size)
 {
 	struct lpc_flash *lf = lpc_add_flash(t, addr, len);
 	lf->f.blocksize = erasesize;
@@ -63,7 +62,8 @@ static void lpc15xx_add_flash(target *t, uint32_t addr, size_t len, size_t erase
 	lf->f.write = lpc_flash_write_magic_vect;
 	lf->iap_entry = IAP_ENTRYPOINT;
 	lf->iap_ram = IAP_RAM_BASE;
-	lf->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
+	lf->iap_msp = IAP_RAM_BASE + ram_size - RAM_USAGE_FOR_IAP_ROUTINES;
+	lpc_flash_add_loader(lf);
 }
 
 bool
@@ -92,7 +92,7 @@ lpc15xx_probe(target *t)
 	if (ram_size) {
 		t->driver = "LPC15xx";
 		target_add_ram(t, 0x02000000, ram_size);
-		lpc15xx_add_flash(t, 0x00000000, 0x40000, 0x1000);
+		lpc15xx_add_flash(t, 0x00000000, 0x40000, 0x1000, ram_size);
 		target_add_commands(t, lpc15xx_cmd_list, "LPC15xx");
 		return true;
 	}
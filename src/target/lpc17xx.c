@@ -45,9 +45,11 @@ struct flash_param {
 
 static void lpc17xx_extended_reset(target *t);
 static bool lpc17xx_mass_erase(target *t);
+static size_t lpc17xx_local_ram_size(uint32_t part_id);
 enum iap_status lpc17xx_iap_call(target *t, struct flash_param *param, enum iap_cmd cmd, ...);
 
-static void lpc17xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize, unsigned int base_sector)
+static void lpc17xx_add_flash(
+	target *t, uint32_t addr, size_t len, size_t erasesize, unsigned int base_sector, size_t ram_size)
 {
 	struct lpc_flash *lf = lpc_add_flash(t, addr, len);
 	lf->f.blocksize = erasesize;
@@ -56,7 +58,8 @@ static void lpc17xx_add_flash(target *t, uint32_t addr, size_t len, size_t erase
 	lf->f.write = lpc_flash_write_magic_vect;
 	lf->iap_entry = IAP_ENTRYPOINT;
 	lf->iap_ram = IAP_RAM_BASE;
-	lf->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
+	lf->iap_msp = IAP_RAM_BASE + ram_size - RAM_USAGE_FOR_IAP_ROUTINES;
+	lpc_flash_add_loader(lf);
 }
 
 bool
@@ -79,6 +82,8 @@ lpc17xx_probe(target *t)
 			return false;
 		}
 
+		size_t ram_size;
+
 		switch (param.result[1]) {
 			case 0x26113F37: /* LPC1769 */
 			case 0x26013F37: /* LPC1768 */
@@ -100,8 +105,9 @@ lpc17xx_probe(target *t)
 				target_add_ram(t, 0x10000000, 0x8000);
 				target_add_ram(t, 0x2007C000, 0x4000);
 				target_add_ram(t, 0x20080000, 0x4000);
-				lpc17xx_add_flash(t, 0x00000000, 0x10000, 0x1000, 0);
-				lpc17xx_add_flash(t, 0x00010000, 0x70000, 0x8000, 16);
+				ram_size = lpc17xx_local_ram_size(param.result[1]);
+				lpc17xx_add_flash(t, 0x00000000, 0x10000, 0x1000, 0, ram_size);
+				lpc17xx_add_flash(t, 0x00010000, 0x70000, 0x8000, 16, ram_size);
 
 				return true;
 		}
@@ -109,6 +115,22 @@ lpc17xx_probe(target *t)
 	return false;
 }
 
+/* Size of the local SRAM at IAP_RAM_BASE, from the part ID */
+static size_t lpc17xx_local_ram_size(const uint32_t part_id)
+{
+	switch (part_id) {
+	case 0x25001118: /* LPC1751 */
+	case 0x25001110: /* LPC1751 (No CRP) */
+		return MIN_RAM_SIZE;
+	case 0x25011723: /* LPC1756 */
+	case 0x25011722: /* LPC1754 */
+	case 0x25001121: /* LPC1752 */
+		return 0x4000;
+	default:
+		return 0x8000;
+	}
+}
+
 static bool lpc17xx_mass_erase(target *t)
 {
 	struct flash_param param;
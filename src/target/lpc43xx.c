@@ -73,6 +73,7 @@ static void lpc43xx_add_flash(
 	lf->iap_ram = IAP_RAM_BASE;
 	lf->iap_msp = IAP_RAM_BASE + IAP_RAM_SIZE;
 	lf->wdt_kick = lpc43xx_wdt_pet;
+	lpc_flash_add_loader(lf);
 }
 
 bool lpc43xx_probe(target *t)
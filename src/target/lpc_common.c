@@ -33,6 +33,27 @@ struct flash_param {
 	uint32_t result[4];
 } __attribute__((aligned(4)));
 
+/* Configuration block of the resident loader, see flashstub/lpc_loader.s */
+struct lpc_loader_config {
+	uint32_t iap_entry;
+	uint32_t iap_msp;
+	uint32_t flash_start;
+	uint32_t sector_shift;
+	uint32_t base_sector;
+	uint32_t bank;
+	uint32_t cpu_clk_khz;
+};
+
+/* Copy RAM to flash sizes all the parts accept, largest first */
+static const uint16_t lpc_iap_program_sizes[] = {4096, 1024, 512, 256};
+
+/* Stack the loader and the IAP routines need below iap_msp */
+#define LPC_LOADER_STACK 256U
+
+static const uint16_t lpc_loader_stub[] = {
+#include "flashstub/lpc_loader.stub"
+};
+
 char *iap_error[] = {
 	"CMD_SUCCESS",
 	"Invalid command",
@@ -113,6 +134,10 @@ enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd
 		.status = 0xdeadbeef, // to help us see if the IAP didn't execute
 	};
 
+	/* The loader owns the core while it runs, it has to be idle and stopped for a call of our own */
+	if (f->f.loader_running && (!flash_loader_wait(&f->f) || !flash_loader_stop(&f->f)))
+		return IAP_STATUS_BUSY;
+
 	/* Pet WDT before each IAP call, if it is on */
 	if (f->wdt_kick)
 		f->wdt_kick(t);
@@ -221,9 +246,63 @@ bool lpc_flash_erase(target_flash_s *tf, target_addr_t addr, size_t len)
 	return true;
 }
 
+/*
+ * Run the IAP programming from target RAM when there is room for the loader and two buffers.
+ * The loader prepares and copies each buffer on its own, while the next one crosses the link,
+ * so the chunk size only depends on the RAM free between iap_ram and the IAP stack.
+ */
+void lpc_flash_add_loader(struct lpc_flash *f)
+{
+	target_flash_s *tf = &f->f;
+	/* The loader finds sectors by shifting, and LPC80x has to skip its reserved pages */
+	if (f->reserved_pages || (tf->blocksize & (tf->blocksize - 1U)))
+		return;
+
+	flash_loader_s *loader = &f->loader;
+	loader->code = lpc_loader_stub;
+	loader->code_size = sizeof(lpc_loader_stub);
+	loader->load_addr = ALIGN(f->iap_ram + sizeof(struct lpc_loader_config), 4);
+	loader->param = f->iap_ram;
+	for (size_t i = 0; i < ARRAY_LENGTH(lpc_iap_program_sizes); ++i) {
+		loader->buffer_size = lpc_iap_program_sizes[i];
+		if (loader->buffer_size > tf->blocksize ||
+			loader->load_addr + flash_loader_ram_size(loader) + LPC_LOADER_STACK > f->iap_msp)
+			continue;
+		tf->loader = loader;
+		tf->wait = flash_loader_wait;
+		tf->writesize = loader->buffer_size;
+		tf->writebufsize = MAX(tf->writebufsize, tf->writesize);
+		return;
+	}
+	DEBUG_WARN("Not enough RAM for the LPC flash loader\n");
+}
+
+static bool lpc_flash_loader_write(struct lpc_flash *f, target_addr_t dest, const void *src, size_t len)
+{
+	target *t = f->f.t;
+	if (!f->f.loader_running) {
+		const struct lpc_loader_config config = {
+			.iap_entry = f->iap_entry | 1U,
+			.iap_msp = f->iap_msp,
+			.flash_start = f->f.start,
+			.sector_shift = __builtin_ctz(f->f.blocksize),
+			.base_sector = f->base_sector,
+			.bank = f->bank,
+			.cpu_clk_khz = CPU_CLK_KHZ,
+		};
+		target_mem_write(t, f->iap_ram, &config, sizeof(config));
+	}
+	/* The loader gives the core no chance to pet the WDT itself */
+	if (f->wdt_kick)
+		f->wdt_kick(t);
+	return flash_loader_write(&f->f, dest, src, len);
+}
+
 static bool lpc_flash_write(target_flash_s *tf, target_addr_t dest, const void *src, size_t len)
 {
 	struct lpc_flash *f = (struct lpc_flash *)tf;
+	if (tf->loader)
+		return lpc_flash_loader_write(f, dest, src, len);
 	/* prepare... */
 	uint32_t sector = lpc_sector_for_addr(f, dest);
 	if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, sector, sector, f->bank)) {
@@ -20,6 +20,8 @@
 #ifndef TARGET_LPC_COMMON_H
 #define TARGET_LPC_COMMON_H
 
+#include "flash_loader.h"
+
 enum iap_cmd {
 	IAP_CMD_READ_FACTORY_SETTINGS = 40,
 	IAP_CMD_INIT = 49,
@@ -78,10 +80,13 @@ struct lpc_flash {
 	uint32_t iap_entry;
 	uint32_t iap_ram;
 	uint32_t iap_msp;
+	/* Programs through IAP from target RAM, set up by lpc_flash_add_loader() */
+	flash_loader_s loader;
 };
 
 struct lpc_flash *lpc_add_flash(target *t, target_addr_t addr, size_t length);
 enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...);
+void lpc_flash_add_loader(struct lpc_flash *f);
 bool lpc_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 bool lpc_flash_write_magic_vect(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 
@@ -36,6 +36,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flash_loader.h"
 
 /* TLV: Device info tag, address and expected value */
 #define DEVINFO_TAG_ADDR 0x00201004u
@@ -88,11 +89,10 @@
 #define P401M_SRAM_SIZE 0x00008000u /* Size of SRAM, M: 32KB */
 #define P401R_SRAM_SIZE 0x00010000u /* Size of SRAM, R: 64KB */
 
-/* Flash write buffer and stack */
+/* Flash loader and stack */
 #define SRAM_STACK_OFFSET 0x00000200u /* A bit less than 512 stack room */
 #define SRAM_STACK_PTR (SRAM_BASE + SRAM_STACK_OFFSET)
-#define SRAM_WRITE_BUFFER SRAM_STACK_PTR /* Buffer right above stack */
-#define SRAM_WRITE_BUF_SIZE 0x00000400u  /* Write 1024 bytes at a tima */
+#define SRAM_LOADER_BASE SRAM_STACK_PTR /* Loader and its buffers right above stack */
 
 /* Watchdog */
 #define WDT_A_WTDCTL 0x4000480Cu /* Control register for watchdog */
@@ -104,12 +104,19 @@ struct msp432_flash {
 	target_addr_t flash_protect_register; /* Address of the WEPROT register*/
 	target_addr_t FlashCtl_eraseSector;   /* Erase flash sector routine in ROM*/
 	target_addr_t FlashCtl_programMemory; /* Flash programming routine in ROM */
+	uint32_t saved_protect;               /* WEPROT while the flash session has it cleared */
+	flash_loader_s loader;                /* Calls FlashCtl_programMemory for each buffer */
+};
+
+static const uint16_t msp432_flash_write_stub[] = {
+#include "flashstub/msp432_loader.stub"
 };
 
 /* Flash operations */
 static bool msp432_sector_erase(target_flash_s *f, target_addr_t addr);
 static bool msp432_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool msp432_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool msp432_flash_prepare(target_flash_s *f);
+static bool msp432_flash_done(target_flash_s *f);
 
 /* Utility functions */
 /* Find the the target flash that conatins a specific address */
@@ -143,7 +150,7 @@ const struct command_s msp432_cmd_list[] = {
 	{"sector_erase", (cmd_handler)msp432_cmd_sector_erase, "Erase sector containing given address"},
 	{NULL, NULL, NULL}};
 
-static void msp432_add_flash(target *t, uint32_t addr, size_t length, target_addr_t prot_reg)
+static void msp432_add_flash(target *t, uint32_t addr, size_t length, target_addr_t prot_reg, size_t ram_size)
 {
 	struct msp432_flash *mf = calloc(1, sizeof(*mf));
 	target_flash_s *f;
@@ -157,15 +164,26 @@ static void msp432_add_flash(target *t, uint32_t addr, size_t length, target_add
 	f->length = length;
 	f->blocksize = SECTOR_SIZE;
 	f->erase = msp432_flash_erase;
-	f->write = msp432_flash_write;
-	f->writesize = SRAM_WRITE_BUF_SIZE;
+	f->prepare = msp432_flash_prepare;
+	f->done = msp432_flash_done;
 	f->erased = 0xff;
-	target_add_flash(t, f);
 	/* Initialize ROM call pointers. Silicon rev B is not supported */
 	uint32_t flashctltable = target_mem_read32(t, ROM_APITABLE + OFS_FLASHCTLTABLE);
 	mf->FlashCtl_eraseSector = target_mem_read32(t, flashctltable + OFS_FlashCtl_eraseSector);
 	mf->FlashCtl_programMemory = target_mem_read32(t, flashctltable + OFS_FlashCtl_programMemory);
 	mf->flash_protect_register = prot_reg;
+
+	/* Hand the ROM whole sectors, unless two of them do not fit the SRAM above the stack */
+	flash_loader_s *loader = &mf->loader;
+	loader->code = msp432_flash_write_stub;
+	loader->code_size = sizeof(msp432_flash_write_stub);
+	loader->load_addr = SRAM_LOADER_BASE;
+	loader->param = mf->FlashCtl_programMemory | 1U;
+	loader->buffer_size = SECTOR_SIZE;
+	while (loader->buffer_size > 1024U && SRAM_STACK_OFFSET + flash_loader_ram_size(loader) > ram_size)
+		loader->buffer_size /= 2U;
+	f->loader = loader;
+	target_add_flash(t, f);
 }
 
 bool msp432_probe(target *t)
@@ -206,17 +224,18 @@ bool msp432_probe(target *t)
 		return false;
 	}
 	/* SRAM region, SRAM zone */
-	target_add_ram(t, SRAM_BASE, target_mem_read32(t, SYS_SRAM_SIZE));
+	const uint32_t ram_size = target_mem_read32(t, SYS_SRAM_SIZE);
+	target_add_ram(t, SRAM_BASE, ram_size);
 	/* Flash bank size */
 	uint32_t banksize = target_mem_read32(t, SYS_FLASH_SIZE) / 2;
 	/* Main Flash Bank 0 */
-	msp432_add_flash(t, MAIN_FLASH_BASE, banksize, MAIN_BANK0_WEPROT);
+	msp432_add_flash(t, MAIN_FLASH_BASE, banksize, MAIN_BANK0_WEPROT, ram_size);
 	/* Main Flash Bank 1 */
-	msp432_add_flash(t, MAIN_FLASH_BASE + banksize, banksize, MAIN_BANK1_WEPROT);
+	msp432_add_flash(t, MAIN_FLASH_BASE + banksize, banksize, MAIN_BANK1_WEPROT, ram_size);
 	/* Info Flash Bank 0 */
-	msp432_add_flash(t, INFO_FLASH_BASE, INFO_BANK_SIZE, INFO_BANK0_WEPROT);
+	msp432_add_flash(t, INFO_FLASH_BASE, INFO_BANK_SIZE, INFO_BANK0_WEPROT, ram_size);
 	/* Info Flash Bank 1 */
-	msp432_add_flash(t, INFO_FLASH_BASE + INFO_BANK_SIZE, INFO_BANK_SIZE, INFO_BANK1_WEPROT);
+	msp432_add_flash(t, INFO_FLASH_BASE + INFO_BANK_SIZE, INFO_BANK_SIZE, INFO_BANK1_WEPROT, ram_size);
 
 	/* Connect the optional commands */
 	target_add_commands(t, msp432_cmd_list, "MSP432P401x");
@@ -232,6 +251,10 @@ static bool msp432_sector_erase(target_flash_s *f, target_addr_t addr)
 	target *t = f->t;
 	struct msp432_flash *mf = (struct msp432_flash *)f;
 
+	/* The loader owns the core while it runs, it has to be idle and stopped for a ROM call */
+	if (f->loader_running && (!flash_loader_wait(f) || !flash_loader_stop(f)))
+		return false;
+
 	/* Unprotect sector */
 	uint32_t old_prot = msp432_sector_unprotect(mf, addr);
 	DEBUG_WARN("Flash protect: 0x%08"PRIX32"\n",
@@ -274,39 +297,22 @@ static bool msp432_flash_erase(target_flash_s *f, target_addr_t addr, size_t len
 	return ret;
 }
 
-/* Program flash */
-static bool msp432_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+/* The loader runs for the whole flash session, with the bank unprotected and the watchdog held */
+static bool msp432_flash_prepare(target_flash_s *f)
 {
 	struct msp432_flash *mf = (struct msp432_flash *)f;
 	target *t = f->t;
+	target_mem_write16(t, WDT_A_WTDCTL, WDT_A_HOLD);
+	mf->saved_protect = target_mem_read32(t, mf->flash_protect_register);
+	target_mem_write32(t, mf->flash_protect_register, 0);
+	return !target_check_error(t);
+}
 
-	/* Prepare RAM buffer in target */
-	target_mem_write(t, SRAM_WRITE_BUFFER, src, len);
-
-	/* Unprotect sector, len is always < SECTOR_SIZE */
-	uint32_t old_prot = msp432_sector_unprotect(mf, dest);
-
-	DEBUG_WARN("Flash protect: 0x%08"PRIX32"\n",
-			   target_mem_read32(t, mf->flash_protect_register));
-
-	/* Prepare input data */
-	uint32_t regs[t->regs_size / sizeof(uint32_t)]; // Use of VLA
-	target_regs_read(t, regs);
-	regs[0] = SRAM_WRITE_BUFFER; // Address of buffer to be flashed in R0
-	regs[1] = dest;              // Flash address to be write to in R1
-	regs[2] = len;               // Size of buffer to be flashed in R2
-
-	DEBUG_INFO("Writing 0x%04" PRIX32 " bytes at 0x%08zu\n", dest, len);
-	/* Call ROM */
-	msp432_call_ROM(t, mf->FlashCtl_programMemory, regs);
-
-	/* Restore original protection */
-	target_mem_write32(t, mf->flash_protect_register, old_prot);
-
-	DEBUG_INFO("ROM return value: %"PRIu32"\n", regs[0]);
-
-	// Result value in R0 is true for success
-	return !!regs[0];
+static bool msp432_flash_done(target_flash_s *f)
+{
+	struct msp432_flash *mf = (struct msp432_flash *)f;
+	target_mem_write32(f->t, mf->flash_protect_register, mf->saved_protect);
+	return !target_check_error(f->t);
 }
 
 /* Optional commands handlers */
@@ -26,9 +26,10 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "adiv5.h"
+#include "flash_loader.h"
 
 static bool nrf51_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool nrf51_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool nrf51_flash_mass_erase(target_flash_s *f);
 static bool nrf51_mass_erase(target *t);
 
 static bool nrf51_cmd_erase_uicr(target *t, int argc, const char **argv);
@@ -36,6 +37,7 @@ static bool nrf51_cmd_protect_flash(target *t, int argc, const char **argv);
 static bool nrf51_cmd_read_hwid(target *t, int argc, const char **argv);
 static bool nrf51_cmd_read_fwid(target *t, int argc, const char **argv);
 static bool nrf51_cmd_read_deviceid(target *t, int argc, const char **argv);
+static size_t nrf51_unique_id(target *t, uint8_t *uid);
 static bool nrf51_cmd_read_deviceaddr(target *t, int argc, const char **argv);
 static bool nrf51_cmd_read_deviceinfo(target *t, int argc, const char **argv);
 static bool nrf51_cmd_read_help(target *t, int argc, const char **argv);
@@ -69,6 +71,13 @@ const struct command_s nrf51_read_cmd_list[] = {
 #define NRF51_NVMC_CONFIG_WEN		0x1						// Write enable
 #define NRF51_NVMC_CONFIG_EEN		0x2						// Erase enable
 
+/* NVMC timings: the typical is that of the quickest part, the maximum that of the slowest */
+#define NRF51_NVMC_WRITE_MAX_MS			1U
+#define NRF51_NVMC_ERASEPAGE_TYPICAL_MS	2U
+#define NRF51_NVMC_ERASEPAGE_MAX_MS		90U
+#define NRF51_NVMC_ERASEALL_TYPICAL_MS	20U
+#define NRF51_NVMC_ERASEALL_MAX_MS		180U
+
 /* Factory Information Configuration Registers (FICR) */
 #define NRF51_FICR				0x10000000
 #define NRF51_FICR_CODEPAGESIZE			(NRF51_FICR + 0x010)
@@ -100,6 +109,27 @@ const struct command_s nrf51_read_cmd_list[] = {
 #define NRF51_PAGE_SIZE 1024
 #define NRF52_PAGE_SIZE 4096
 
+#define NRF51_SRAM_BASE 0x20000000
+
+static const uint16_t nrf51_flash_write_stub[] = {
+#include "flashstub/nrf51_loader.stub"
+};
+
+/* The loader programs one page worth of data per buffer while the probe fills the other one */
+static const flash_loader_s nrf51_flash_loader = {
+	.code = nrf51_flash_write_stub,
+	.code_size = sizeof(nrf51_flash_write_stub),
+	.load_addr = NRF51_SRAM_BASE,
+	.buffer_size = NRF51_PAGE_SIZE,
+};
+
+static const flash_loader_s nrf52_flash_loader = {
+	.code = nrf51_flash_write_stub,
+	.code_size = sizeof(nrf51_flash_write_stub),
+	.load_addr = NRF51_SRAM_BASE,
+	.buffer_size = NRF52_PAGE_SIZE,
+};
+
 static void nrf51_add_flash(target *t,
                             uint32_t addr, size_t length, size_t erasesize)
 {
@@ -113,7 +143,10 @@ static void nrf51_add_flash(target *t,
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = nrf51_flash_erase;
-	f->write = nrf51_flash_write;
+	/* ERASEALL wipes the UICR as well, it is only used for the code array which preserves it */
+	if (addr != NRF51_UICR)
+		f->mass_erase = nrf51_flash_mass_erase;
+	f->loader = erasesize >= NRF52_PAGE_SIZE ? &nrf52_flash_loader : &nrf51_flash_loader;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 }
@@ -134,6 +167,7 @@ bool nrf51_probe(target *t)
 		(uid0 ==  0) || (uid1 ==  0))
 		return false;
 	t->mass_erase = nrf51_mass_erase;
+	t->unique_id = nrf51_unique_id;
 	/* Test for NRF52 device*/
 	uint32_t info_part = target_mem_read32(t, NRF52_PART_INFO);
 	if ((info_part != 0xffffffff) && (info_part != 0) &&
@@ -141,7 +175,7 @@ bool nrf51_probe(target *t)
 		uint32_t ram_size = target_mem_read32(t, NRF52_INFO_RAM);
 		t->driver = "Nordic nRF52";
 		t->target_options |= CORTEXM_TOPT_INHIBIT_NRST;
-		target_add_ram(t, 0x20000000, ram_size * 1024);
+		target_add_ram(t, NRF51_SRAM_BASE, ram_size * 1024);
 		nrf51_add_flash(t, 0, page_size * code_size, page_size);
 		nrf51_add_flash(t, NRF51_UICR, page_size, page_size);
 		target_add_commands(t, nrf51_cmd_list, "nRF52");
@@ -150,7 +184,7 @@ bool nrf51_probe(target *t)
 		/* Use the biggest RAM size seen in NRF51 fammily.
 		 * IDCODE is kept as '0', as deciphering is hard and
 		 * there is later no usage.*/
-		target_add_ram(t, 0x20000000, 0x8000);
+		target_add_ram(t, NRF51_SRAM_BASE, 0x8000);
 		t->target_options |= CORTEXM_TOPT_INHIBIT_NRST;
 		nrf51_add_flash(t, 0, page_size * code_size, page_size);
 		nrf51_add_flash(t, NRF51_UICR, page_size, page_size);
@@ -159,16 +193,28 @@ bool nrf51_probe(target *t)
 	return true;
 }
 
+static flash_poll_result_e nrf51_nvmc_poll(target *t, void *ctx)
+{
+	(void)ctx;
+	const uint32_t ready = target_mem_read32(t, NRF51_NVMC_READY);
+	if (target_check_error(t))
+		return FLASH_POLL_ERROR;
+	return ready ? FLASH_POLL_DONE : FLASH_POLL_BUSY;
+}
+
+static bool nrf51_wait_ready(target *t, target_flash_s *f, uint32_t typical_ms, uint32_t max_ms)
+{
+	return target_flash_poll(t, f, nrf51_nvmc_poll, NULL, typical_ms, max_ms);
+}
+
 static bool nrf51_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
 	target *t = f->t;
 	/* Enable erase */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
 
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
-		if(target_check_error(t))
-			return false;
+	if (!nrf51_wait_ready(t, f, 0, NRF51_NVMC_WRITE_MAX_MS))
+		return false;
 
 	while (len) {
 		if (addr == NRF51_UICR) // Special Case
@@ -178,11 +224,8 @@ static bool nrf51_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 			/* Write address of first word in page to erase it */
 			target_mem_write32(t, NRF51_NVMC_ERASEPAGE, addr);
 
-		/* Poll for NVMC_READY */
-		while (target_mem_read32(t, NRF51_NVMC_READY) == 0) {
-			if (target_check_error(t))
-				return false;
-		}
+		if (!nrf51_wait_ready(t, f, NRF51_NVMC_ERASEPAGE_TYPICAL_MS, NRF51_NVMC_ERASEPAGE_MAX_MS))
+			return false;
 
 		addr += f->blocksize;
 		if (len > f->blocksize)
@@ -193,34 +236,65 @@ static bool nrf51_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 
 	/* Return to read-only */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_REN);
+	return nrf51_wait_ready(t, f, 0, NRF51_NVMC_WRITE_MAX_MS);
+}
 
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0) {
-		if (target_check_error(t))
+/* Program the saved UICR words back, those still erased need no writing */
+static bool nrf51_uicr_restore(target *t, const uint32_t *uicr, size_t len)
+{
+	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
+	if (!nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS))
+		return false;
+	for (size_t i = 0; i < len / 4U; ++i) {
+		if (uicr[i] == 0xffffffffU)
+			continue;
+		target_mem_write32(t, NRF51_UICR + i * 4U, uicr[i]);
+		if (!nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS))
 			return false;
 	}
-
-	return true;
+	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_REN);
+	return nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS);
 }
 
-static bool nrf51_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+/*
+ * The whole code array is being reprogrammed: one ERASEALL is much quicker than erasing it page
+ * by page, but also clears the UICR, so that is read beforehand and written back afterwards.
+ */
+static bool nrf51_flash_mass_erase(target_flash_s *f)
 {
 	target *t = f->t;
-
-	/* Enable write */
-	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
-		if(target_check_error(t))
+	target_flash_s *uicr_flash = t->flash;
+	while (uicr_flash && uicr_flash->start != NRF51_UICR)
+		uicr_flash = uicr_flash->next;
+	const size_t uicr_len = uicr_flash ? uicr_flash->length : 0;
+	uint32_t *uicr = NULL;
+	if (uicr_len) {
+		uicr = malloc(uicr_len);
+		if (!uicr) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
 			return false;
-	target_mem_write(t, dest, src, len);
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
-		if(target_check_error(t))
+		}
+		target_mem_read(t, uicr, NRF51_UICR, uicr_len);
+		if (target_check_error(t)) {
+			free(uicr);
 			return false;
-	/* Return to read-only */
+		}
+	}
+
+	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
+	bool ret = nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS);
+	if (ret) {
+		target_mem_write32(t, NRF51_NVMC_ERASEALL, 1);
+		ret = nrf51_wait_ready(t, f, NRF51_NVMC_ERASEALL_TYPICAL_MS, NRF51_NVMC_ERASEALL_MAX_MS);
+	}
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_REN);
-	return true;
+	ret = nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS) && ret;
+	if (uicr) {
+		/* Put the UICR back even if the erase failed part way */
+		ret = nrf51_uicr_restore(t, uicr, uicr_len) && ret;
+		free(uicr);
+	}
+	return ret;
 }
 
 static bool nrf51_mass_erase(target *t)
@@ -229,26 +303,12 @@ static bool nrf51_mass_erase(target *t)
 
 	/* Enable erase */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
+	if (!nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS))
+		return false;
 
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0) {
-		if (target_check_error(t))
-			return false;
-	}
-
-	platform_timeout timeout = {};
-	platform_timeout_set(&timeout, 500);
 	/* Erase all */
 	target_mem_write32(t, NRF51_NVMC_ERASEALL, 1);
-
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0) {
-		if (target_check_error(t))
-			return false;
-		target_print_progress(&timeout);
-	}
-
-	return true;
+	return nrf51_wait_ready(t, NULL, NRF51_NVMC_ERASEALL_TYPICAL_MS, NRF51_NVMC_ERASEALL_MAX_MS);
 }
 
 static bool nrf51_cmd_erase_uicr(target *t, int argc, const char **argv)
@@ -259,21 +319,12 @@ static bool nrf51_cmd_erase_uicr(target *t, int argc, const char **argv)
 
 	/* Enable erase */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
-
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
-		if(target_check_error(t))
-			return false;
+	if (!nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS))
+		return false;
 
 	/* Erase UICR */
 	target_mem_write32(t, NRF51_NVMC_ERASEUICR, 1);
-
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
-		if(target_check_error(t))
-			return false;
-
-	return true;
+	return nrf51_wait_ready(t, NULL, NRF51_NVMC_ERASEPAGE_TYPICAL_MS, NRF51_NVMC_ERASEPAGE_MAX_MS);
 }
 
 static bool nrf51_cmd_protect_flash(target *t, int argc, const char **argv)
@@ -284,22 +335,11 @@ static bool nrf51_cmd_protect_flash(target *t, int argc, const char **argv)
 
 	/* Enable write */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
+	if (!nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS))
+		return false;
 
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0) {
-		if(target_check_error(t))
-			return false;
-	}
-	
 	target_mem_write32(t, NRF51_APPROTECT, 0xFFFFFF00);
-
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0) {
-		if(target_check_error(t))
-			return false;
-	}
-
-	return true;
+	return nrf51_wait_ready(t, NULL, 0, NRF51_NVMC_WRITE_MAX_MS);
 }
 
 static bool nrf51_cmd_read_hwid(target *t, int argc, const char **argv)
@@ -332,6 +372,18 @@ static bool nrf51_cmd_read_deviceid(target *t, int argc, const char **argv)
 	return true;
 }
 
+/* The 64 bit device ID, in the order it is printed */
+static size_t nrf51_unique_id(target *t, uint8_t *uid)
+{
+	const uint32_t deviceid_low = target_mem_read32(t, NRF51_FICR_DEVICEID_LOW);
+	const uint32_t deviceid_high = target_mem_read32(t, NRF51_FICR_DEVICEID_HIGH);
+	for (size_t i = 0; i < 4U; ++i) {
+		uid[i] = deviceid_high >> (24U - i * 8U);
+		uid[i + 4U] = deviceid_low >> (24U - i * 8U);
+	}
+	return 8U;
+}
+
 static bool nrf51_cmd_read_deviceinfo(target *t, int argc, const char **argv)
 {
 	(void)argc;
@@ -39,6 +39,7 @@
 #include "general.h"
 #include "target.h"
 #include "target_internal.h"
+#include "flash_loader.h"
 
 /* KE04 registers and constants */
 
@@ -99,9 +100,11 @@
 #define CMD_SET_USER_MARGIN_LEVEL      0x0Du /* Unused */
 #define CMD_SET_FACTORY_MARGIN_LEVEL   0x0Eu /* Unused */
 
-/* Flash Memory Module write and erase sizes */
+/* Flash Memory Module write and erase sizes, Program Flash takes at most two longwords per launch */
 #define KE04_WRITE_LEN   8
 #define KE04_SECTOR_SIZE 0x200u
+/* Smallest loader buffer worth the trouble, the KE04Z8 only has 768 bytes above RAM_BASE_ADDR */
+#define KE04_LOADER_BUFFER_MIN 0x100u
 
 /* Security byte */
 #define FLASH_SECURITY_BYTE_ADDRESS   0x0000040Eu
@@ -114,7 +117,18 @@
 static const uint8_t cmdLen[] = {
     4, 1, 2, 3, 6, 0, 6, 6, 1, 2, 2, 1, 5, 3, 3};
 
+static const uint16_t ke04_flash_write_stub[] = {
+#include "flashstub/ke04_loader.stub"
+};
+
+struct ke04_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+};
+
 /* Flash routines */
+static void ke04_clock_setup(target *t);
+static bool ke04_launch(target *t, uint8_t cmd, uint32_t addr, const uint8_t data[8]);
 static bool ke04_command(target *t, uint8_t cmd, uint32_t addr, const uint8_t data[8]);
 static bool ke04_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool ke04_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
@@ -223,12 +237,23 @@ bool ke04_probe(target *t)
 	target_add_ram(t, RAM_BASE_ADDR, ramsize);           /* Higher RAM */
 
 	/* Add flash, all KE04 have same write and erase size */
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct ke04_flash *kf = calloc(1, sizeof(*kf));
+	if (!kf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return false;
 	}
 
+	/* The loader runs from the higher RAM, its buffers a sector each unless two of them do not fit */
+	flash_loader_s *loader = &kf->loader;
+	loader->code = ke04_flash_write_stub;
+	loader->code_size = sizeof(ke04_flash_write_stub);
+	loader->load_addr = RAM_BASE_ADDR;
+	loader->buffer_size = KE04_SECTOR_SIZE;
+	while (loader->buffer_size > KE04_LOADER_BUFFER_MIN && flash_loader_ram_size(loader) > ramsize)
+		loader->buffer_size /= 2U;
+	const bool use_loader = flash_loader_ram_size(loader) <= ramsize;
+
+	target_flash_s *f = &kf->f;
 	f->start     = FLASH_BASE_ADDR;
 	f->length    = flashsize;
 	f->blocksize = KE04_SECTOR_SIZE;
@@ -236,7 +261,14 @@ bool ke04_probe(target *t)
 	f->write     = ke04_flash_write;
 	f->done      = ke04_flash_done;
 	f->erased    = 0xFFu;
+	if (use_loader)
+		f->writesize = loader->buffer_size;
 	target_add_flash(t, f);
+	/* Set after target_add_flash() so ke04_flash_write() stays in front of the loader for the security byte */
+	if (use_loader) {
+		f->loader = loader;
+		f->wait = flash_loader_wait;
+	}
 
 	/* Add target specific commands */
 	target_add_commands(t, ke_cmd_list, t->driver);
@@ -253,20 +285,29 @@ static bool ke04_mass_erase(target *t)
 	return true;
 }
 
-static bool ke04_command(target *t, uint8_t cmd, uint32_t addr, const uint8_t data[8])
+static void ke04_clock_setup(target *t)
 {
-	uint8_t fstat;
-
 	/* Set FCLKDIV to 0x17 for 24MHz (default at reset) */
 	uint8_t fclkdiv = target_mem_read8(t, FTMRE_FCLKDIV);
 	if( (fclkdiv & 0x1Fu) != 0x17u ) {
 		/* Wait for CCIF to be high */
-		do {
-			fstat = target_mem_read8(t, FTMRE_FSTAT);
-		} while (!(fstat & FTMRE_FSTAT_CCIF));
+		while (!(target_mem_read8(t, FTMRE_FSTAT) & FTMRE_FSTAT_CCIF))
+			continue;
 		/* Write correct value */
 		target_mem_write8(t, FTMRE_FCLKDIV, 0x17u);
 	}
+}
+
+static bool ke04_command(target *t, uint8_t cmd, uint32_t addr, const uint8_t data[8])
+{
+	ke04_clock_setup(t);
+	return ke04_launch(t, cmd, addr, data);
+}
+
+/* Run a command with FCLKDIV already set up */
+static bool ke04_launch(target *t, uint8_t cmd, uint32_t addr, const uint8_t data[8])
+{
+	uint8_t fstat;
 
 	/* clear errors unconditionally, so we can start a new operation */
 	target_mem_write8(t,FTMRE_FSTAT,(FTMRE_FSTAT_ACCERR | FTMRE_FSTAT_FPVIOL));
@@ -346,8 +387,17 @@ static bool ke04_flash_write(target_flash_s *f, target_addr_t dest, const void *
 		    FLASH_SECURITY_BYTE_UNSECURED;
 	}
 
+	/* The loader programs whole buffers from RAM while the next one crosses the link */
+	if (f->loader) {
+		if (!f->loader_running)
+			ke04_clock_setup(t);
+		return flash_loader_write(f, dest, src, len);
+	}
+
+	/* FCLKDIV holds for the whole write, so only the FCCOB loads remain per launch */
+	ke04_clock_setup(t);
 	while (len) {
-		if (!ke04_command(f->t, CMD_PROGRAM_FLASH, dest, src))
+		if (!ke04_launch(t, CMD_PROGRAM_FLASH, dest, src))
 			return false;
 
 		len  -= KE04_WRITE_LEN;
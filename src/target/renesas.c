@@ -261,6 +261,7 @@ typedef enum {
 #define RV40_FSTATR_ILGCOMERR (1U << 23U) /* Illegal Command Error */
 
 #define RV40_FSADDR (RV40_BASE + 0x30U)
+#define RV40_FEADDR (RV40_BASE + 0x34U)
 
 #define RV40_FMEPROT        (RV40_BASE + 0x44U)
 #define RV40_FMEPROT_LOCK   (0xD901U)
@@ -272,6 +273,10 @@ typedef enum {
 #define RV40_FENTRYR_PE_CF      (1U)
 #define RV40_FENTRYR_PE_DF      (1U << 7U)
 
+#define RV40_FBCCNT (RV40_BASE + 0xD0U) /* Blank Check Control */
+#define RV40_FBCSTAT (RV40_BASE + 0xD4U) /* Blank Check Status */
+#define RV40_FBCSTAT_BCST (1U) /* Not blank */
+
 #define RV40_FCPSR         (RV40_BASE + 0xE0U)
 #define RV40_FCPSR_ESUSPMD 1U
 
@@ -439,7 +444,7 @@ static bool renesas_rv40_error_check(target *t, uint32_t error_bits)
 {
 	bool error = false;
 
-	uint8_t fstatr = target_mem_read32(t, RV40_FSTATR);
+	const uint32_t fstatr = target_mem_read32(t, RV40_FSTATR);
 
 	/* see "Recovery from the Command-Locked State": Section 47.9.3.6 of the RA6M4 manual R01UH0890EJ0100.*/
 	if (target_mem_read8(t, RV40_FASTAT) & RV40_FASTAT_CMDLK) {
@@ -504,7 +509,45 @@ static bool renesas_rv40_done(target_flash_s *f)
 	return renesas_rv40_pe_mode(t, PE_MODE_READ);
 }
 
-/* !TODO: implement blank check */
+static bool renesas_rv40_wait_ready(target *t, const uint32_t timeout_ms)
+{
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+
+	/* Read FRDY bit until it has been set to 1 indicating that the current operation is complete.*/
+	while (!(target_mem_read32(t, RV40_FSTATR) & RV40_FSTATR_RDY)) {
+		if (target_check_error(t) || platform_timeout_is_expired(&timeout))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Blank check a block with the sequencer, data flash can not be blank checked by reading it back
+ * as its erased state reads undefined. False if the block is not blank or the check failed.
+ */
+static bool renesas_rv40_block_is_blank(target *t, target_addr_t addr, size_t len)
+{
+	target_mem_write32(t, RV40_FBCCNT, 0);
+	target_mem_write32(t, RV40_FSADDR, addr);
+	target_mem_write32(t, RV40_FEADDR, addr + len - 1U);
+
+	/* Issue two part Blank Check commands */
+	target_mem_write8(t, RV40_CMD, RV40_CMD_BLANK_CHECK);
+	target_mem_write8(t, RV40_CMD, RV40_CMD_FINAL);
+
+	/* a 32K block takes well under 10ms at a FCLK of 4MHz */
+	if (!renesas_rv40_wait_ready(t, 100) || renesas_rv40_error_check(t, RV40_FSTATR_ILGLERR))
+		return false;
+
+	return !(target_mem_read32(t, RV40_FBCSTAT) & RV40_FBCSTAT_BCST);
+}
+
+static bool renesas_rv40_flash_blank_check(target_flash_s *f, target_addr_t addr, size_t len)
+{
+	return renesas_rv40_block_is_blank(f->t, addr, len);
+}
+
 static bool renesas_rv40_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
 	target *t = f->t;
@@ -516,9 +559,6 @@ static bool renesas_rv40_flash_erase(target_flash_s *f, target_addr_t addr, size
 	target_mem_write16(t, RV40_FCPSR, RV40_FCPSR_ESUSPMD);
 
 	while (len) {
-		/* Set block start address*/
-		target_mem_write32(t, RV40_FSADDR, addr);
-
 		/* increment block address */
 		uint16_t block_size;
 		if (code_flash)
@@ -526,9 +566,15 @@ static bool renesas_rv40_flash_erase(target_flash_s *f, target_addr_t addr, size
 		else
 			block_size = RV40_DF_BLOCK_SIZE;
 
+		const target_addr_t block_addr = addr;
 		addr += block_size;
 		len -= block_size;
 
+		/* Blocks already blank are left alone, erasing them only costs time and endurance */
+		if (renesas_rv40_block_is_blank(t, block_addr, block_size))
+			continue;
+		target_mem_write32(t, RV40_FSADDR, block_addr);
+
 		/* Issue two part Block Erase commands */
 		target_mem_write8(t, RV40_CMD, RV40_CMD_BLOCK_ERASE);
 		target_mem_write8(t, RV40_CMD, RV40_CMD_FINAL);
@@ -536,15 +582,8 @@ static bool renesas_rv40_flash_erase(target_flash_s *f, target_addr_t addr, size
 		/* according to reference manual the max erase time for a 32K block is around 1040ms
 		 * this is with a FCLK of 4MHz
 		 */
-		platform_timeout timeout;
-		platform_timeout_set(&timeout, 1100);
-
-		/* Wait until the operation has completed or timeout */
-		/* Read FRDY bit until it has been set to 1 indicating that the current  operation is complete.*/
-		while (!(target_mem_read32(t, RV40_FSTATR) & RV40_FSTATR_RDY)) {
-			if (target_check_error(t) || platform_timeout_is_expired(&timeout))
-				return false;
-		}
+		if (!renesas_rv40_wait_ready(t, 1100))
+			return false;
 
 		if (renesas_rv40_error_check(t, RV40_FSTATR_ERSERR | RV40_FSTATR_ILGLERR))
 			return false;
@@ -553,6 +592,12 @@ static bool renesas_rv40_flash_erase(target_flash_s *f, target_addr_t addr, size
 	return true;
 }
 
+/*
+ * The sequencer programs one unit per command, 128 bytes of code flash or 4 of data flash, and
+ * only takes the next command once FRDY is set. The units of a whole write buffer are issued
+ * back to back, and the last one is left programming while the next buffer arrives from the host,
+ * the status is only checked once the flash layer waits.
+ */
 static bool renesas_rv40_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	target *t = f->t;
@@ -564,6 +609,10 @@ static bool renesas_rv40_flash_write(target_flash_s *f, target_addr_t dest, cons
 	const uint8_t write_size = code_flash ? RV40_CF_WRITE_SIZE : RV40_DF_WRITE_SIZE;
 
 	while (len) {
+		/* a unit should take less than 1 msec at a FCLK of 4MHz, the previous one may still be busy */
+		if (!renesas_rv40_wait_ready(t, 10))
+			return false;
+
 		/* set block start address */
 		target_mem_write32(t, RV40_FSADDR, dest);
 
@@ -575,14 +624,8 @@ static bool renesas_rv40_flash_write(target_flash_s *f, target_addr_t dest, cons
 		target_mem_write8(t, RV40_CMD, RV40_CMD_PROGRAM);
 		target_mem_write8(t, RV40_CMD, (uint8_t)(write_size / 2U));
 
-		/* according to reference manual the data buffer full time for 2 bytes is 2 usec.
-		 * this is with a FCLK of 4MHz
-		 * a complete should take less than 1 msec.
-		 */
-		platform_timeout timeout;
-		platform_timeout_set(&timeout, 10);
-
-		/* write one chunk */
+		/* write one chunk, according to reference manual the data buffer full time for 2 bytes is
+		 * 2 usec, longer than a write over the link takes */
 		for (size_t i = 0U; i < (write_size / 2U); i++) {
 			/* copy data from source address to destination */
 			target_mem_write16(t, RV40_CMD, *(uint16_t *)src);
@@ -593,16 +636,15 @@ static bool renesas_rv40_flash_write(target_flash_s *f, target_addr_t dest, cons
 
 		/* issue write end command */
 		target_mem_write8(t, RV40_CMD, RV40_CMD_FINAL);
-
-		/* wait until the operation has completed or timeout */
-		/* read FRDY bit until it has been set to 1 indicating that the current operation is complete.*/
-		while (!(target_mem_read32(t, RV40_FSTATR) & RV40_FSTATR_RDY)) {
-			if (target_check_error(t) || platform_timeout_is_expired(&timeout))
-				return false;
-		}
 	}
 
-	return !renesas_rv40_error_check(t, RV40_FSTATR_PRGERR | RV40_FSTATR_ILGLERR);
+	return !target_check_error(t);
+}
+
+static bool renesas_rv40_flash_wait(target_flash_s *f)
+{
+	target *t = f->t;
+	return renesas_rv40_wait_ready(t, 10) && !renesas_rv40_error_check(t, RV40_FSTATR_PRGERR | RV40_FSTATR_ILGLERR);
 }
 
 static void renesas_add_rv40_flash(target *t, target_addr_t addr, size_t length)
@@ -617,18 +659,20 @@ static void renesas_add_rv40_flash(target *t, target_addr_t addr, size_t length)
 	f->length = length;
 	f->erased = 0xffU;
 	f->erase = renesas_rv40_flash_erase;
+	f->blank_check = renesas_rv40_flash_blank_check;
 	f->write = renesas_rv40_flash_write;
+	f->wait = renesas_rv40_flash_wait;
 	f->prepare = renesas_rv40_prepare;
 	f->done = renesas_rv40_done;
 
 	if (code_flash) {
 		f->blocksize = RV40_CF_REGION1_BLOCK_SIZE;
-		f->writebufsize = RV40_CF_WRITE_SIZE * 8U;
-		f->writesize = RV40_CF_WRITE_SIZE;
+		f->writebufsize = MAX(RV40_CF_WRITE_SIZE * 8U, FLASH_WRITEBUF_MAX_SIZE);
+		f->writesize = f->writebufsize;
 	} else {
 		f->blocksize = RV40_DF_BLOCK_SIZE;
 		f->writebufsize = RV40_DF_BLOCK_SIZE * 8U;
-		f->writesize = RV40_DF_WRITE_SIZE;
+		f->writesize = RV40_DF_BLOCK_SIZE;
 	}
 
 	target_add_flash(t, f);
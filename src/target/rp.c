@@ -45,6 +45,7 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "sfdp.h"
+#include "flash_loader.h"
 
 #define RP_ID                 "Raspberry RP2040"
 #define RP_MAX_TABLE_SIZE     0x80U
@@ -102,6 +103,7 @@
 #define RP_SSI_XIP_SPI_CTRL0_ADDRESS_LENGTH(x) (((x)*2U) << 2U)
 #define RP_SSI_XIP_SPI_CTRL0_INSTR_LENGTH_8b   (2U << 8U)
 #define RP_SSI_XIP_SPI_CTRL0_WAIT_CYCLES(x)    (((x)*8U) << 11U)
+#define RP_SSI_XIP_SPI_CTRL0_WAIT_CLOCKS(x)    ((x) << 11U)
 #define RP_SSI_XIP_SPI_CTRL0_XIP_CMD_SHIFT     24U
 #define RP_SSI_XIP_SPI_CTRL0_XIP_CMD(x)        ((x) << RP_SSI_XIP_SPI_CTRL0_XIP_CMD_SHIFT)
 #define RP_SSI_XIP_SPI_CTRL0_TRANS_1C1A        (0U << 0U)
@@ -175,6 +177,7 @@ typedef struct rp_priv {
 	uint16_t rom_reset_usb_boot;
 	bool is_prepared;
 	bool is_monitor;
+	flash_loader_s loader; /* calls flash_range_program, so the ROM address is filled in on attach */
 	uint32_t regs[0x20]; /* Register playground*/
 } rp_priv_s;
 
@@ -182,6 +185,10 @@ typedef struct rp_flash {
 	target_flash_s f;
 	uint32_t page_size;
 	uint8_t sector_erase_opcode;
+	uint8_t block_erase_opcode; /* for f.large_blocksize sized erases */
+	uint32_t sector_erase_ms;   /* typical erase times from SFDP, 0 if unknown */
+	uint32_t block_erase_ms;
+	spi_read_mode_s xip_read;   /* read command XIP is set up for after programming, 03h if none */
 } rp_flash_s;
 
 static bool rp_cmd_erase_sector(target *t, int argc, const char **argv);
@@ -194,7 +201,10 @@ const struct command_s rp_cmd_list[] = {
 };
 
 static bool rp_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool rp_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+
+static const uint16_t rp_flash_write_stub[] = {
+#include "flashstub/rp_loader.stub"
+};
 
 static bool rp_read_rom_func_table(target *t);
 static bool rp_attach(target *t);
@@ -206,7 +216,7 @@ static bool rp_mass_erase(target *t);
 
 // Our own implementation of bootloader functions for handling flash chip
 static void rp_flash_exit_xip(target *const t);
-static void rp_flash_enter_xip(target *const t);
+static void rp_flash_enter_xip(target *const t, const spi_read_mode_s *read_mode);
 #if 0
 static void rp_flash_connect_internal(target *const t);
 static void rp_flash_flush_cache(target *const t);
@@ -230,13 +240,24 @@ static void rp_add_flash(target *t)
 	spi_parameters_s spi_parameters;
 	if (!sfdp_read_parameters(t, &spi_parameters, rp_spi_read_sfdp)) {
 		/* SFDP readout failed, so make some assumptions and hope for the best. */
+		memset(&spi_parameters, 0, sizeof(spi_parameters));
 		spi_parameters.page_size = 256U;
 		spi_parameters.sector_size = 4096U;
 		spi_parameters.capacity = rp_get_flash_length(t);
 		spi_parameters.sector_erase_opcode = SPI_FLASH_CMD_SECTOR_ERASE;
+		spi_parameters.erase_types[0].size = FLASHSIZE_4K_SECTOR;
+		spi_parameters.erase_types[0].opcode = SPI_FLASH_CMD_SECTOR_ERASE;
+		spi_parameters.erase_types[1].size = FLASHSIZE_64K_BLOCK;
+		spi_parameters.erase_types[1].opcode = FLASHCMD_BLOCK64K_ERASE;
 	}
 
-	rp_flash_enter_xip(t);
+	/*
+	 * Dual output reads need no quad enable bit, so any part that has them can be read back
+	 * with them. Quad modes are left alone as enabling them is vendor specific.
+	 */
+	if (spi_parameters.dual_output.opcode)
+		flash->xip_read = spi_parameters.dual_output;
+	rp_flash_enter_xip(t, &flash->xip_read);
 
 	DEBUG_INFO("Flash size: %uMiB\n", spi_parameters.capacity / (1024U * 1024U));
 
@@ -244,9 +265,29 @@ static void rp_add_flash(target *t)
 	f->start = RP_XIP_FLASH_BASE;
 	f->length = spi_parameters.capacity;
 	f->blocksize = spi_parameters.sector_size;
+	/* Whole blocks of the largest erase type take one command, the ROM handles the rest sector-wise */
+	const spi_erase_type_s *const block = sfdp_largest_erase_type(&spi_parameters, f->length);
+	if (block && block->size > f->blocksize && !(f->length & (block->size - 1U))) {
+		f->large_blocksize = block->size;
+		flash->block_erase_opcode = block->opcode;
+		flash->block_erase_ms = block->typical_ms;
+	}
+	for (size_t i = 0; i < SPI_ERASE_TYPES; ++i) {
+		if (spi_parameters.erase_types[i].opcode == spi_parameters.sector_erase_opcode)
+			flash->sector_erase_ms = spi_parameters.erase_types[i].typical_ms;
+	}
 	f->erase = rp_flash_erase;
-	f->write = rp_flash_write;
-	f->writesize = MAX_WRITE_CHUNK; /* Max buffer size used otherwise */
+	/*
+	 * The resident loader keeps programming one SRAM buffer while the next crosses the link,
+	 * the flash stays in serial command mode until the session ends and XIP is re-entered
+	 */
+	rp_priv_s *const ps = (rp_priv_s *)t->target_storage;
+	ps->loader.code = rp_flash_write_stub;
+	ps->loader.code_size = sizeof(rp_flash_write_stub);
+	ps->loader.load_addr = RP_SRAM_BASE;
+	ps->loader.buffer_size = MAX_WRITE_CHUNK;
+	ps->loader.param = ps->rom_flash_range_program | 1U;
+	f->loader = &ps->loader;
 	f->erased = 0xffU;
 	target_add_flash(t, f);
 
@@ -430,8 +471,10 @@ static bool rp_flash_resume(target *t)
 		DEBUG_INFO("rp_flash_resume\n");
 		/* flush */
 		result &= rp_rom_call(t, ps->regs, ps->rom_flash_flush_cache, 100);
-		/* enter_cmd_xip */
+		/* enter_cmd_xip, then switch from its 03h reads to the fastest mode found */
 		result &= rp_rom_call(t, ps->regs, ps->rom_flash_enter_xip, 100);
+		if (t->flash)
+			rp_flash_enter_xip(t, &((rp_flash_s *)t->flash)->xip_read);
 		ps->is_prepared = false;
 	}
 	return result;
@@ -444,6 +487,13 @@ static bool rp_flash_resume(target *t)
  * chip erase       5000/25000 ms
  * page programm       0.4/  3 ms
  */
+/* Allow 16 times the typical erase time, or the worst case of the table above if SFDP has none */
+static uint32_t rp_erase_timeout(const uint32_t typical_ms, const bool block, const uint32_t count)
+{
+	const uint32_t unit_ms = typical_ms ? typical_ms * 16U : (block ? 2000U : 400U);
+	return count * unit_ms + 100U;
+}
+
 static bool rp_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
 	DEBUG_INFO("Erase addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, (uint32_t)len);
@@ -457,6 +507,9 @@ static bool rp_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 		DEBUG_WARN("Address is invalid\n");
 		return false;
 	}
+	/* The loader owns the core while it runs, it has to be idle and stopped for a ROM call */
+	if (f->loader_running && (!flash_loader_wait(f) || !flash_loader_stop(f)))
+		return false;
 	addr -= f->start;
 	len = ALIGN(len, f->blocksize);
 	len = MIN(len, f->length - addr);
@@ -466,38 +519,21 @@ static bool rp_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	platform_timeout_set(&timeout, 500);
 
 	/* erase */
+	rp_flash_s *const flash = (rp_flash_s *)f;
 	bool result = false;
 	while (len) {
-		if (len >= FLASHSIZE_64K_BLOCK) {
-			const uint32_t chunk = len & FLASHSIZE_64K_BLOCK_MASK;
-			ps->regs[0] = addr;
-			ps->regs[1] = chunk;
-			ps->regs[2] = FLASHSIZE_64K_BLOCK;
-			ps->regs[3] = FLASHCMD_BLOCK64K_ERASE;
-			DEBUG_WARN("64k_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, chunk);
-			result = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, 25100);
-			len -= chunk;
-			addr += chunk;
-		} else if (len >= FLASHSIZE_32K_BLOCK) {
-			const uint32_t chunk = len & FLASHSIZE_32K_BLOCK_MASK;
-			ps->regs[0] = addr;
-			ps->regs[1] = chunk;
-			ps->regs[2] = FLASHSIZE_32K_BLOCK;
-			ps->regs[3] = FLASHCMD_BLOCK32K_ERASE;
-			DEBUG_WARN("32k_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, chunk);
-			result = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, 1700);
-			len -= chunk;
-			addr += chunk;
-		} else {
-			rp_flash_s *flash = (rp_flash_s *)f;
-			ps->regs[0] = addr;
-			ps->regs[1] = len;
-			ps->regs[2] = f->blocksize;
-			ps->regs[3] = flash->sector_erase_opcode;
-			DEBUG_WARN("Sector_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, (uint32_t)len);
-			result = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, 410);
-			len = 0;
-		}
+		const bool block = f->large_blocksize && len >= f->large_blocksize;
+		const uint32_t unit = block ? f->large_blocksize : f->blocksize;
+		const uint32_t chunk = block ? len & ~(f->large_blocksize - 1U) : len;
+		ps->regs[0] = addr;
+		ps->regs[1] = chunk;
+		ps->regs[2] = unit;
+		ps->regs[3] = block ? flash->block_erase_opcode : flash->sector_erase_opcode;
+		DEBUG_WARN("%s_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", block ? "Block" : "Sector", addr, chunk);
+		result = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase,
+			rp_erase_timeout(block ? flash->block_erase_ms : flash->sector_erase_ms, block, chunk / unit));
+		len -= chunk;
+		addr += chunk;
 		if (!result) {
 			DEBUG_WARN("Erase failed!\n");
 			break;
@@ -509,42 +545,6 @@ static bool rp_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	return result;
 }
 
-static bool rp_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
-{
-	DEBUG_INFO("RP Write 0x%08" PRIx32 " len 0x%" PRIx32 "\n", dest, (uint32_t)len);
-	target *t = f->t;
-	if ((dest & 0xff) || (len & 0xff)) {
-		DEBUG_WARN("Unaligned write\n");
-		return false;
-	}
-	dest -= f->start;
-	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
-	/* Write payload to target ram */
-	bool result = true;
-	while (len) {
-		uint32_t chunksize = (len <= MAX_WRITE_CHUNK) ? len : MAX_WRITE_CHUNK;
-		target_mem_write(t, RP_SRAM_BASE, src, chunksize);
-		/* Programm range */
-		ps->regs[0] = dest;
-		ps->regs[1] = RP_SRAM_BASE;
-		ps->regs[2] = chunksize;
-		/* Loading takes 3 ms per 256 byte page
-		 * however it takes much longer if the XOSC is not enabled
-		 * so lets give ourselves a little bit more time (x10)
-		 */
-		result = rp_rom_call(t, ps->regs, ps->rom_flash_range_program, (3 * chunksize * 10) >> 8);
-		if (!result) {
-			DEBUG_WARN("Write failed!\n");
-			break;
-		}
-		len -= chunksize;
-		src += chunksize;
-		dest += chunksize;
-	}
-	DEBUG_INFO("Write done!\n");
-	return result;
-}
-
 static bool rp_mass_erase(target *t)
 {
 	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
@@ -796,22 +796,38 @@ static void rp_flash_flush_cache(target *const t)
 #endif
 
 // Put the SSI into a mode where XIP accesses translate to standard
-// serial 03h read commands. The flash remains in its default serial command
-// state, so will still respond to other commands.
-static void rp_flash_enter_xip(target *const t)
+// serial 03h read commands, or the dual output read given. The flash remains
+// in its default serial command state, so will still respond to other commands.
+static void rp_flash_enter_xip(target *const t, const spi_read_mode_s *const read_mode)
 {
 	target_mem_write32(t, RP_SSI_ENABLE, 0);
-	target_mem_write32(t, RP_SSI_CTRL0,
-		RP_SSI_CTRL0_FRF_SERIAL |        // Standard 1-bit SPI serial frames
-			RP_SSI_CTRL0_DATA_BITS(32) | // 32 clocks per data frame
-			RP_SSI_CTRL0_TMOD_EEPROM     // Send instr + addr, receive data
-	);
-	target_mem_write32(t, RP_SSI_XIP_SPI_CTRL0,
-		RP_SSI_XIP_SPI_CTRL0_XIP_CMD(0x03) |            // Standard 03h read
-			RP_SSI_XIP_SPI_CTRL0_INSTR_LENGTH_8b |      // 8-bit instruction prefix
-			RP_SSI_XIP_SPI_CTRL0_ADDRESS_LENGTH(0x03) | // 24-bit addressing for 03h commands
-			RP_SSI_XIP_SPI_CTRL0_TRANS_1C1A             // Command and address both in serial format
-	);
+	if (read_mode && read_mode->opcode) {
+		target_mem_write32(t, RP_SSI_CTRL0,
+			RP_SSI_CTRL0_FRF_DUAL |              // Data comes back two bits at a time
+				RP_SSI_CTRL0_DATA_BITS(32) |     // 32 clocks per data frame
+				RP_SSI_CTRL0_TMOD_EEPROM         // Send instr + addr, receive data
+		);
+		target_mem_write32(t, RP_SSI_CTRL1, 0);
+		target_mem_write32(t, RP_SSI_XIP_SPI_CTRL0,
+			RP_SSI_XIP_SPI_CTRL0_XIP_CMD(read_mode->opcode) |                 // 1-1-2 read from SFDP
+				RP_SSI_XIP_SPI_CTRL0_INSTR_LENGTH_8b |                        // 8-bit instruction prefix
+				RP_SSI_XIP_SPI_CTRL0_ADDRESS_LENGTH(0x03) |                   // 24-bit addressing
+				RP_SSI_XIP_SPI_CTRL0_WAIT_CLOCKS(read_mode->dummy_cycles) | // Dummy clocks from SFDP
+				RP_SSI_XIP_SPI_CTRL0_TRANS_1C1A                               // Command and address serial
+		);
+	} else {
+		target_mem_write32(t, RP_SSI_CTRL0,
+			RP_SSI_CTRL0_FRF_SERIAL |        // Standard 1-bit SPI serial frames
+				RP_SSI_CTRL0_DATA_BITS(32) | // 32 clocks per data frame
+				RP_SSI_CTRL0_TMOD_EEPROM     // Send instr + addr, receive data
+		);
+		target_mem_write32(t, RP_SSI_XIP_SPI_CTRL0,
+			RP_SSI_XIP_SPI_CTRL0_XIP_CMD(0x03) |            // Standard 03h read
+				RP_SSI_XIP_SPI_CTRL0_INSTR_LENGTH_8b |      // 8-bit instruction prefix
+				RP_SSI_XIP_SPI_CTRL0_ADDRESS_LENGTH(0x03) | // 24-bit addressing for 03h commands
+				RP_SSI_XIP_SPI_CTRL0_TRANS_1C1A             // Command and address both in serial format
+		);
+	}
 	target_mem_write32(t, RP_SSI_ENABLE, RP_SSI_ENABLE_SSI);
 }
 
@@ -870,6 +886,8 @@ static bool rp_rescue_do_reset(target *t)
 	ADIv5_AP_t *ap = (ADIv5_AP_t *)t->priv;
 	uint32_t ctrlstat = ap->dp->low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_CTRLSTAT, 0);
 	ap->dp->low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_DP_CTRLSTAT, ctrlstat | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ);
+	/* The rescue DP resets the whole chip, debug logic included */
+	adiv5_shadow_invalidate(ap->dp);
 	platform_timeout timeout;
 	platform_timeout_set(&timeout, 100);
 	while (true) {
@@ -31,6 +31,7 @@
 static bool sam_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool sam3_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool sam_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool sam_flash_wait(target_flash_s *f);
 
 static int sam_gpnvm_get(target *t, uint32_t base, uint32_t *gpnvm);
 
@@ -76,6 +77,8 @@ const struct command_s sam_cmd_list[] = {
 
 #define SAM_SMALL_PAGE_SIZE 256
 #define SAM_LARGE_PAGE_SIZE 512
+/* The SAM4S and SAMx7x planes start with two 8K small sectors, the only place EWP works */
+#define SAM_SMALL_SECTORS_SIZE 0x4000U
 
 /* CHIPID Register Map */
 #define SAM_CHIPID_CIDR	0x400E0940
@@ -174,6 +177,8 @@ enum sam_driver {
 struct sam_flash {
 	target_flash_s f;
 	uint32_t eefc_base;
+	target_addr_t plane_start; /* page numbers count from here */
+	uint16_t page_size;
 	uint8_t write_cmd;
 };
 
@@ -191,46 +196,72 @@ struct sam_priv_s {
 	char sam_variant_string[16];
 };
 
-static void sam3_add_flash(target *t, uint32_t eefc_base, uint32_t addr, size_t length)
+static struct sam_flash *sam_flash_alloc(
+	uint32_t eefc_base, target_addr_t plane_start, target_addr_t addr, size_t length, uint16_t page_size)
 {
 	struct sam_flash *sf = calloc(1, sizeof(*sf));
-	target_flash_s *f;
-
 	if (!sf) {			/* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
-		return;
+		return NULL;
 	}
 
-	f = &sf->f;
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
+	f->write = sam_flash_write;
+	f->wait = sam_flash_wait;
+	sf->eefc_base = eefc_base;
+	sf->plane_start = plane_start;
+	sf->page_size = page_size;
+	return sf;
+}
+
+static void sam3_add_flash(target *t, uint32_t eefc_base, uint32_t addr, size_t length)
+{
+	struct sam_flash *sf = sam_flash_alloc(eefc_base, addr, addr, length, SAM_SMALL_PAGE_SIZE);
+	if (!sf)
+		return;
+
+	target_flash_s *f = &sf->f;
 	f->blocksize = SAM_SMALL_PAGE_SIZE;
 	f->erase = sam3_flash_erase;
-	f->write = sam_flash_write;
 	f->writesize = SAM_SMALL_PAGE_SIZE;
-	sf->eefc_base = eefc_base;
+	f->write_erases = true;
 	sf->write_cmd = EEFC_FCR_FCMD_EWP;
 	target_add_flash(t, f);
 }
 
+/*
+ * The small sectors at the start of the plane are written with EWP, which
+ * saves erasing them separately. The rest is erased 16 pages at a time where
+ * a request covers them, 8 otherwise, and written with WP.
+ */
 static void sam_add_flash(target *t, uint32_t eefc_base, uint32_t addr, size_t length)
 {
-	struct sam_flash *sf = calloc(1, sizeof(*sf));
-	target_flash_s *f;
+	const size_t small_length = MIN(length, SAM_SMALL_SECTORS_SIZE);
+	struct sam_flash *sf = sam_flash_alloc(eefc_base, addr, addr, small_length, SAM_LARGE_PAGE_SIZE);
+	if (!sf)
+		return;
 
-	if (!sf) {			/* calloc failed: heap exhaustion */
-		DEBUG_WARN("calloc: failed in %s\n", __func__);
+	target_flash_s *f = &sf->f;
+	f->blocksize = SAM_LARGE_PAGE_SIZE;
+	f->erase = sam3_flash_erase;
+	f->writesize = SAM_LARGE_PAGE_SIZE;
+	f->write_erases = true;
+	sf->write_cmd = EEFC_FCR_FCMD_EWP;
+	target_add_flash(t, f);
+
+	if (length == small_length)
+		return;
+	sf = sam_flash_alloc(eefc_base, addr, addr + small_length, length - small_length, SAM_LARGE_PAGE_SIZE);
+	if (!sf)
 		return;
-	}
 
 	f = &sf->f;
-	f->start = addr;
-	f->length = length;
 	f->blocksize = SAM_LARGE_PAGE_SIZE * 8;
+	f->large_blocksize = SAM_LARGE_PAGE_SIZE * 16;
 	f->erase = sam_flash_erase;
-	f->write = sam_flash_write;
-	f->writesize = SAM_LARGE_PAGE_SIZE;
-	sf->eefc_base = eefc_base;
+	f->writesize = SAM_LARGE_PAGE_SIZE * 8;
 	sf->write_cmd = EEFC_FCR_FCMD_WP;
 	target_add_flash(t, f);
 }
@@ -514,6 +545,20 @@ static bool sam_flash_cmd(target *t, uint32_t base, uint8_t cmd, uint16_t arg)
 	return !(target_mem_read32(t, EEFC_FSR(base)) & EEFC_FSR_ERROR);
 }
 
+/* Wait for the command in progress to finish, errors may have been cleared by the read that saw it */
+static bool sam_flash_ready(target *t, uint32_t base)
+{
+	uint32_t status = 0;
+	uint32_t fsr;
+	do {
+		fsr = target_mem_read32(t, EEFC_FSR(base));
+		status |= fsr;
+		if (target_check_error(t))
+			return false;
+	} while (!(fsr & EEFC_FSR_FRDY));
+	return !(status & EEFC_FSR_ERROR);
+}
+
 static enum sam_driver sam_driver(target *t)
 {
 	if (strcmp(t->driver, "Atmel SAM3X") == 0) {
@@ -534,33 +579,37 @@ static enum sam_driver sam_driver(target *t)
 static bool sam_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
 	target *t = f->t;
-	uint32_t base = ((struct sam_flash *)f)->eefc_base;
-	uint32_t offset = addr - f->start;
+	struct sam_flash *sf = (struct sam_flash *)f;
+	uint32_t base = sf->eefc_base;
+	uint32_t offset = addr - sf->plane_start;
 
 	/* The SAM4S is the only supported device with a page erase command.
-	 * Erasing is done in 8-page chunks. arg[15:2] contains the page
-	 * number and arg[1:0] contains 0x1, indicating 8-page chunks.
+	 * Erasing is done in 16 or 8-page chunks. arg[15:2] contains the page
+	 * number and arg[1:0] contains 0x2 or 0x1, indicating 16 or 8-page chunks.
 	 */
 	unsigned chunk = offset / SAM_LARGE_PAGE_SIZE;
 
 	while (len) {
-		int16_t arg = chunk | 0x1;
+		const bool large = len >= f->large_blocksize;
+		int16_t arg = chunk | (large ? 0x2 : 0x1);
 		if(!sam_flash_cmd(t, base, EEFC_FCR_FCMD_EPA, arg))
 			return false;
 
-		if (len > f->blocksize)
-			len -= f->blocksize;
+		const size_t erased = large ? f->large_blocksize : f->blocksize;
+		if (len > erased)
+			len -= erased;
 		else
 			len = 0;
-		chunk += 8;
+		chunk += erased / SAM_LARGE_PAGE_SIZE;
 	}
 	return true;
 }
 
 static bool sam3_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
-	/* The SAM3X/SAM3N don't really have a page erase function.
-	 * We do nothing here and use Erase/Write page in flash_write.
+	/* The SAM3X/SAM3N don't really have a page erase function, nor do the
+	 * small sectors of the others. We do nothing here and use Erase/Write
+	 * page in flash_write.
 	 */
 	(void)f;
 	(void)addr;
@@ -574,11 +623,23 @@ static bool sam_flash_write(target_flash_s *f, target_addr_t dest, const void *s
 	target *t = f->t;
 	struct sam_flash *sf = (struct sam_flash *)f;
 	uint32_t base = sf->eefc_base;
-	unsigned chunk = (dest - f->start) / f->writesize;
+	const uint8_t *data = src;
 
-	target_mem_write(t, dest, src, len);
+	/* Each page is latched and its command started without waiting for
+	 * it, so the last one programs while the host sends the next chunk */
+	for (size_t offset = 0; offset < len; offset += sf->page_size) {
+		if (!sam_flash_ready(t, base))
+			return false;
+		target_mem_write(t, dest + offset, data + offset, sf->page_size);
+		const uint32_t page = (dest + offset - sf->plane_start) / sf->page_size;
+		target_mem_write32(t, EEFC_FCR(base), EEFC_FCR_FKEY | sf->write_cmd | (page << 8));
+	}
+	return !target_check_error(t);
+}
 
-	return sam_flash_cmd(t, base, sf->write_cmd, chunk);
+static bool sam_flash_wait(target_flash_s *f)
+{
+	return sam_flash_ready(f->t, ((struct sam_flash *)f)->eefc_base);
 }
 
 static int sam_gpnvm_get(target *t, uint32_t base, uint32_t *gpnvm)
@@ -28,6 +28,13 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flash_loader.h"
+
+static const uint16_t sam4l_flash_write_stub[] = {
+#include "flashstub/sam4l_loader.stub"
+};
+
+#define SRAM_BASE 0x20000000U
 
 /*
  * Flash Controller defines
@@ -104,7 +111,6 @@
 
 static void sam4l_extended_reset(target *t);
 static bool sam4l_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool sam4l_flash_write_buf(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 
 /* why Atmel couldn't make it sequential ... */
 static const size_t __ram_size[16] = {
@@ -161,25 +167,40 @@ static const size_t __nvp_size[16] = {
 /* Arbitrary time to wait for FLASH controller to be ready */
 #define FLASH_TIMEOUT	1000 /* ms */
 
+struct sam4l_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+};
+
 /*
  * Populate a target_flash struct with the necessary function pointers
  * and constants to describe our flash.
+ *
+ * Pages are written by a loader resident in SRAM, which fills the page
+ * buffer from its own buffer and issues WP while the next page comes in.
  */
 static void sam4l_add_flash(target *t, uint32_t addr, size_t length)
 {
-	target_flash_s *f = calloc(1, sizeof(target_flash_s));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct sam4l_flash *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	flash_loader_s *loader = &sf->loader;
+	loader->code = sam4l_flash_write_stub;
+	loader->code_size = sizeof(sam4l_flash_write_stub);
+	loader->load_addr = SRAM_BASE;
+	loader->buffer_size = SAM4L_PAGE_SIZE;
+	loader->param = FLASHCALW_BASE;
+
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = SAM4L_PAGE_SIZE;
 	f->erase = sam4l_flash_erase;
-	f->write = sam4l_flash_write_buf;
-	f->writesize = SAM4L_PAGE_SIZE;
 	f->erased = 0xff;
+	f->loader = loader;
 	/* add it into the target structures flash chain */
 	target_add_flash(t, f);
 }
@@ -322,49 +343,6 @@ static bool sam4l_flash_command(target *t, uint32_t page, uint32_t cmd)
 	return true;
 }
 
-/*
- * Write data from 'src' into flash using the algorithim provided by
- * Atmel in their data sheet.
- */
-static bool sam4l_flash_write_buf(target_flash_s *f, target_addr_t addr, const void *src, size_t len)
-{
-	target *t = f->t;
-	uint32_t *src_data = (uint32_t *)src;
-
-	DEBUG_INFO("\nSAM4L: sam4l_flash_write_buf: addr = 0x%08" PRIx32 ", len %d\n", addr, len);
-
-	/* This will fail with unaligned writes, the write_buf version */
-	const uint16_t page = addr / SAM4L_PAGE_SIZE;
-
-	if (len != SAM4L_PAGE_SIZE)
-		return false;
-
-	/* clear the page buffer */
-	if (!sam4l_flash_command(t, 0, FLASH_CMD_CPB))
-		return false;
-
-	/* Now fill page buffer with our 512 bytes of data */
-
-	/* I did try to use target_mem_write however that resulted in the
-	 * last 64 bits (8 bytes) to be incorrect on even pages (0, 2, 4, ...)
-	 * since it works this way I've not investigated further.
-	 */
-	for (size_t ndx = 0; ndx < SAM4L_PAGE_SIZE; ndx += 4) {
-		/*
- 		 * the page buffer overlaps flash, its only 512 bytes long
-		 * and no matter where you write it from it goes to the page
-		 * you point it to. So we don't need the specific address here
-		 * instead we just write 0 - pagelen (512) and that fills our
-		 * buffer correctly.
-		 */
-		target_mem_write32(t, addr + ndx, *src_data);
-		src_data++;
-	}
-
-	/* write the page */
-	return sam4l_flash_command(t, page, FLASH_CMD_WP);
-}
-
 /*
  * Erase flash across the addresses specified by addr and len
  */
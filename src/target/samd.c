@@ -41,6 +41,9 @@
 
 static bool samd_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool samd_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool samd_flash_prepare(target_flash_s *f);
+static bool samd_flash_wait(target_flash_s *f);
+static bool samd_flash_done(target_flash_s *f);
 bool samd_mass_erase(target *t);
 
 static bool samd_cmd_lock_flash(target *t, int argc, const char **argv);
@@ -49,6 +52,8 @@ static bool samd_cmd_unlock_bootprot(target *t, int argc, const char **argv);
 static bool samd_cmd_lock_bootprot(target *t, int argc, const char **argv);
 static bool samd_cmd_read_userrow(target *t, int argc, const char **argv);
 static bool samd_cmd_serial(target *t, int argc, const char **argv);
+static size_t samd_unique_id(target *t, uint8_t *uid);
+static bool samd_crc32_ieee(target *t, uint32_t *crc, target_addr_t base, size_t len);
 static bool samd_cmd_mbist(target *t, int argc, const char **argv);
 static bool samd_cmd_ssb(target *t, int argc, const char **argv);
 
@@ -92,8 +97,27 @@ const struct command_s samd_cmd_list[] = {
 #define SAMD_CTRLA_CMD_SSB             0x0045U
 #define SAMD_CTRLA_CMD_INVALL          0x0046U
 
+/* Control B Register (CTRLB) */
+#define SAMD_CTRLB_MANW (1U << 7U)
+
 /* Interrupt Flag Register (INTFLAG) */
 #define SAMD_NVMC_READY (1U << 0U)
+#define SAMD_NVMC_ERROR (1U << 1U)
+
+/* NVM timings: row erase and page write maximums, commands other than those are near instant */
+#define SAMD_NVMC_CMD_MAX_MS        1U
+#define SAMD_NVMC_WRITE_MAX_MS      3U
+#define SAMD_NVMC_ERASE_TYPICAL_MS  2U
+#define SAMD_NVMC_ERASE_MAX_MS      6U
+
+/* Status Register (STATUS) */
+#define SAMD_STATUS_PROGE (1U << 2U)
+#define SAMD_STATUS_LOCKE (1U << 3U)
+#define SAMD_STATUS_NVME  (1U << 4U)
+#define SAMD_STATUS_ERRORS (SAMD_STATUS_PROGE | SAMD_STATUS_LOCKE | SAMD_STATUS_NVME)
+
+/* The main array is split into this many lock regions */
+#define SAMD_LOCK_REGIONS 16U
 
 /* Non-Volatile Memory Calibration and Auxiliary Registers */
 #define SAMD_NVM_USER_ROW_LOW  0x00804000U
@@ -110,6 +134,7 @@ const struct command_s samd_cmd_list[] = {
 #define SAMD_DSU_CTRLSTAT   (SAMD_DSU_EXT_ACCESS + 0x0U)
 #define SAMD_DSU_ADDRESS    (SAMD_DSU_EXT_ACCESS + 0x4U)
 #define SAMD_DSU_LENGTH     (SAMD_DSU_EXT_ACCESS + 0x8U)
+#define SAMD_DSU_DATA       (SAMD_DSU_EXT_ACCESS + 0xcU)
 #define SAMD_DSU_DID        (SAMD_DSU_EXT_ACCESS + 0x018U)
 #define SAMD_DSU_PID        (SAMD_DSU + 0x1000U)
 #define SAMD_DSU_CID        (SAMD_DSU + 0x1010U)
@@ -223,6 +248,7 @@ static const struct samd_part samd_l22_parts[] = {
  */
 void samd_reset(target *t)
 {
+	cortexm_reg_cache_invalidate(t);
 	/*
 	 * nRST is not asserted here as it appears to reset the adiv5
 	 * logic, meaning that subsequent adiv5_* calls PLATFORM_FATAL_ERROR.
@@ -443,20 +469,31 @@ struct samd_descr samd_parse_device_id(uint32_t did)
 	return samd;
 }
 
+struct samd_flash {
+	target_flash_s f;
+	uint32_t ctrlb;    /* CTRLB as found, restored when done */
+	uint16_t unlocked; /* lock regions unlocked during this session */
+};
+
 static void samd_add_flash(target *t, uint32_t addr, size_t length)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct samd_flash *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = SAMD_ROW_SIZE;
+	f->prepare = samd_flash_prepare;
 	f->erase = samd_flash_erase;
 	f->write = samd_flash_write;
-	f->writesize = SAMD_PAGE_SIZE;
+	f->wait = samd_flash_wait;
+	f->done = samd_flash_done;
+	/* A whole row at a time, each page commits on its own once its last word is written */
+	f->writesize = SAMD_ROW_SIZE;
 	target_add_flash(t, f);
 }
 
@@ -513,6 +550,8 @@ bool samd_probe(target *t)
 	/* Setup Target */
 	t->driver = priv_storage->samd_variant_string;
 	t->reset = samd_reset;
+	/* The cortexm reset and halt would pull nRST, which breaks ADIv5 here, and not exit CRSTEXT */
+	t->reset_halt = NULL;
 
 	if (samd.series == 20 && samd.revision == 'B') {
 		/*
@@ -542,6 +581,8 @@ bool samd_probe(target *t)
 
 	target_add_ram(t, 0x20000000, samd.ram_size);
 	samd_add_flash(t, 0x00000000, samd.flash_size);
+	t->unique_id = samd_unique_id;
+	t->crc32_ieee = samd_crc32_ieee;
 	target_add_commands(t, samd_cmd_list, "SAMD");
 
 	/* If we're not in reset here */
@@ -560,20 +601,79 @@ bool samd_probe(target *t)
 	return true;
 }
 
+static flash_poll_result_e samd_nvmc_poll(target *t, void *ctx)
+{
+	(void)ctx;
+	const uint32_t intflag = target_mem_read32(t, SAMD_NVMC_INTFLAG);
+	if (target_check_error(t))
+		return FLASH_POLL_ERROR;
+	return (intflag & SAMD_NVMC_READY) ? FLASH_POLL_DONE : FLASH_POLL_BUSY;
+}
+
+static bool samd_wait_ready(target *t, target_flash_s *f, uint32_t typical_ms, uint32_t max_ms)
+{
+	return target_flash_poll(t, f, samd_nvmc_poll, NULL, typical_ms, max_ms);
+}
+
 /*
- * Temporary (until next reset) flash memory locking / unlocking
+ * Temporary (until next reset) flash memory locking / unlocking, one command
+ * covers the whole lock region the address lies in
  */
-static void samd_lock_current_address(target *t)
+static bool samd_lock_command(target *t, target_addr_t addr, uint32_t cmd)
 {
-	/* Issue the unlock command */
-	target_mem_write32(t, SAMD_NVMC_CTRLA,
-	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_LOCK);
+	/* Must be shifted right for 16-bit address, see Datasheet §20.8.8 Address */
+	target_mem_write32(t, SAMD_NVMC_ADDRESS, addr >> 1U);
+	target_mem_write32(t, SAMD_NVMC_CTRLA, SAMD_CTRLA_CMD_KEY | cmd);
+	return samd_wait_ready(t, target_flash_for_addr(t, addr), 0, SAMD_NVMC_CMD_MAX_MS);
 }
-static void samd_unlock_current_address(target *t)
+
+static size_t samd_lock_region_size(const target_flash_s *f)
 {
-	/* Issue the unlock command */
-	target_mem_write32(t, SAMD_NVMC_CTRLA,
-	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_UNLOCK);
+	return f->length / SAMD_LOCK_REGIONS;
+}
+
+/* Unlock the region holding addr, once per flash session */
+static bool samd_unlock_region(target_flash_s *f, target_addr_t addr)
+{
+	struct samd_flash *sf = (struct samd_flash *)f;
+	const uint32_t region = (addr - f->start) / samd_lock_region_size(f);
+	if (sf->unlocked & (1U << region))
+		return true;
+	if (!samd_lock_command(f->t, addr, SAMD_CTRLA_CMD_UNLOCK))
+		return false;
+	sf->unlocked |= 1U << region;
+	return true;
+}
+
+/*
+ * Select automatic page writes, a page is then programmed as soon as its
+ * last word reaches the page buffer without a WRITEPAGE command
+ */
+static bool samd_flash_prepare(target_flash_s *f)
+{
+	struct samd_flash *sf = (struct samd_flash *)f;
+	target *t = f->t;
+	sf->unlocked = 0;
+	sf->ctrlb = target_mem_read32(t, SAMD_NVMC_CTRLB);
+	target_mem_write32(t, SAMD_NVMC_CTRLB, sf->ctrlb & ~SAMD_CTRLB_MANW);
+	target_mem_write32(t, SAMD_NVMC_STATUS, SAMD_STATUS_ERRORS);
+	target_mem_write32(t, SAMD_NVMC_CTRLA, SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_PAGEBUFFERCLEAR);
+	return samd_wait_ready(t, f, 0, SAMD_NVMC_CMD_MAX_MS);
+}
+
+/* Restore the write mode and relock the regions unlocked during the session */
+static bool samd_flash_done(target_flash_s *f)
+{
+	struct samd_flash *sf = (struct samd_flash *)f;
+	target *t = f->t;
+	bool ret = true;
+	for (uint32_t region = 0; region < SAMD_LOCK_REGIONS; ++region) {
+		if (sf->unlocked & (1U << region))
+			ret &= samd_lock_command(t, f->start + region * samd_lock_region_size(f), SAMD_CTRLA_CMD_LOCK);
+	}
+	sf->unlocked = 0;
+	target_mem_write32(t, SAMD_NVMC_CTRLB, sf->ctrlb);
+	return ret;
 }
 
 /*
@@ -583,23 +683,18 @@ static bool samd_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
 	target *t = f->t;
 	while (len) {
+		if (!samd_unlock_region(f, addr))
+			return false;
+
 		/* Write address of first word in row to erase it */
 		/* Must be shifted right for 16-bit address, see Datasheet §20.8.8 Address */
 		target_mem_write32(t, SAMD_NVMC_ADDRESS, addr >> 1);
 
-		/* Unlock */
-		samd_unlock_current_address(t);
-
 		/* Issue the erase command */
 		target_mem_write32(t, SAMD_NVMC_CTRLA,
 		                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_ERASEROW);
-		/* Poll for NVM Ready */
-		while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
-			if (target_check_error(t))
-				return false;
-
-		/* Lock */
-		samd_lock_current_address(t);
+		if (!samd_wait_ready(t, f, SAMD_NVMC_ERASE_TYPICAL_MS, SAMD_NVMC_ERASE_MAX_MS))
+			return false;
 
 		addr += f->blocksize;
 		if (len > f->blocksize)
@@ -612,31 +707,32 @@ static bool samd_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 }
 
 /*
- * Write flash page by page
+ * Write flash a row at a time. Each page commits on the write of its last
+ * word, and the NVMC stalls the bus when the next page arrives while the
+ * previous one is still programming, so there is nothing to poll per page.
  */
 static bool samd_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	target *t = f->t;
-
-	/* Write within a single page. This may be part or all of the page */
+	if (!samd_unlock_region(f, dest))
+		return false;
 	target_mem_write(t, dest, src, len);
+	return !target_check_error(t);
+}
 
-	/* Unlock */
-	samd_unlock_current_address(t);
-
-	/* Issue the write page command */
-	target_mem_write32(t, SAMD_NVMC_CTRLA,
-	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_WRITEPAGE);
-
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
-		if (target_check_error(t))
-			return false;
-
-	/* Lock */
-	samd_lock_current_address(t);
-
-	return true;
+/* Wait for the last page to finish programming and check nothing failed */
+static bool samd_flash_wait(target_flash_s *f)
+{
+	target *t = f->t;
+	if (!samd_wait_ready(t, f, 0, SAMD_NVMC_WRITE_MAX_MS))
+		return false;
+	if (!(target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_ERROR))
+		return true;
+	const uint32_t status = target_mem_read32(t, SAMD_NVMC_STATUS) & SAMD_STATUS_ERRORS;
+	DEBUG_WARN("NVM error, status 0x%04" PRIx32 "\n", status);
+	target_mem_write32(t, SAMD_NVMC_STATUS, SAMD_STATUS_ERRORS);
+	target_mem_write32(t, SAMD_NVMC_INTFLAG, SAMD_NVMC_ERROR);
+	return false;
 }
 
 /*
@@ -698,10 +794,8 @@ static bool samd_set_flashlock(target *t, uint16_t value, const char **argv)
 	target_mem_write32(t, SAMD_NVMC_CTRLA,
 	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_ERASEAUXROW);
 
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
-		if (target_check_error(t))
-			return -1;
+	if (!samd_wait_ready(t, NULL, SAMD_NVMC_ERASE_TYPICAL_MS, SAMD_NVMC_ERASE_MAX_MS))
+		return false;
 
 	/* Modify the high byte of the user row */
 	high = (high & 0x0000FFFF) | ((value << 16) & 0xFFFF0000);
@@ -780,10 +874,8 @@ static bool samd_set_bootprot(target *t, uint16_t value, const char **argv)
 	target_mem_write32(t, SAMD_NVMC_CTRLA,
 	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_ERASEAUXROW);
 
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
-		if (target_check_error(t))
-			return -1;
+	if (!samd_wait_ready(t, NULL, SAMD_NVMC_ERASE_TYPICAL_MS, SAMD_NVMC_ERASE_MAX_MS))
+		return false;
 
 	/* Modify the low word of the user row */
 	low = (low & 0xFFFFFFF8) | ((value << 0 ) & 0x00000007);
@@ -841,6 +933,17 @@ static bool samd_cmd_read_userrow(target *t, int argc, const char **argv)
 	return true;
 }
 
+/* The 128 bit serial number, in the order it is printed */
+static size_t samd_unique_id(target *t, uint8_t *uid)
+{
+	for (uint32_t i = 0; i < 4U; ++i) {
+		const uint32_t word = target_mem_read32(t, SAMD_NVM_SERIAL(i));
+		for (size_t j = 0; j < 4U; ++j)
+			uid[i * 4U + j] = word >> (24U - j * 8U);
+	}
+	return 16U;
+}
+
 /*
  * Reads the 128-bit serial number from the NVM
  */
@@ -874,6 +977,34 @@ static uint32_t samd_flash_size(target *t)
 	return (0x40000 >> (devsel % 5));
 }
 
+/*
+ * Computes the CRC32 of a range with the DSU, which runs without the core and
+ * reads at the bus' speed. It works on whole words and not on a protected part.
+ */
+static bool samd_crc32_ieee(target *t, uint32_t *crc, target_addr_t base, size_t len)
+{
+	if (!len || ((base | len) & 3U))
+		return false;
+	target_mem_write32(t, SAMD_DSU_ADDRESS, base);
+	target_mem_write32(t, SAMD_DSU_LENGTH, len);
+	target_mem_write32(t, SAMD_DSU_DATA, 0xffffffffU);
+
+	/* Clear the status bits, then start */
+	target_mem_write32(t, SAMD_DSU_CTRLSTAT, SAMD_STATUSA_DONE | SAMD_STATUSA_PERR | SAMD_STATUSA_BERR);
+	target_mem_write32(t, SAMD_DSU_CTRLSTAT, SAMD_CTRL_CRC);
+
+	uint32_t status;
+	while (((status = target_mem_read32(t, SAMD_DSU_CTRLSTAT)) &
+		(SAMD_STATUSA_DONE | SAMD_STATUSA_PERR | SAMD_STATUSA_BERR)) == 0) {
+		if (target_check_error(t))
+			return false;
+	}
+	if (status & (SAMD_STATUSA_PERR | SAMD_STATUSA_BERR))
+		return false;
+	*crc = target_mem_read32(t, SAMD_DSU_DATA);
+	return !target_check_error(t);
+}
+
 /*
  * Runs the Memory Built In Self Test (MBIST)
  */
@@ -925,10 +1056,8 @@ static bool samd_cmd_ssb(target *t, int argc, const char **argv)
 	target_mem_write32(t, SAMD_NVMC_CTRLA,
 	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_SSB);
 
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
-		if (target_check_error(t))
-			return -1;
+	if (!samd_wait_ready(t, NULL, 0, SAMD_NVMC_CMD_MAX_MS))
+		return false;
 
 	tc_printf(t, "Security bit set!\nScan again, attach and issue 'monitor erase_mass' to reset.\n");
 
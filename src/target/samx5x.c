@@ -40,6 +40,9 @@
 
 static bool samx5x_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool samx5x_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool samx5x_flash_prepare(target_flash_s *f);
+static bool samx5x_flash_wait(target_flash_s *f);
+static bool samx5x_flash_done(target_flash_s *f);
 static bool samx5x_cmd_lock_flash(target *t, int argc, const char **argv);
 static bool samx5x_cmd_unlock_flash(target *t, int argc, const char **argv);
 static bool samx5x_cmd_unlock_bootprot(target *t, int argc, const char **argv);
@@ -110,6 +113,10 @@ const struct command_s samx5x_cmd_list[] = {
 #define SAMX5X_NVMC_ADDRESS			(SAMX5X_NVMC + 0x14)
 #define SAMX5X_NVMC_RUNLOCK			(SAMX5X_NVMC + 0x18)
 
+/* Control A Register (CTRLA) */
+#define SAMX5X_CTRLA_WMODE_MASK			(3 << 4)
+#define SAMX5X_CTRLA_WMODE_AP			(3 << 4)
+
 /* Control B Register (CTRLB) */
 #define SAMX5X_CTRLB_CMD_KEY			0xA500
 #define SAMX5X_CTRLB_CMD_ERASEPAGE		0x0000
@@ -315,19 +322,30 @@ struct samx5x_descr samx5x_parse_device_id(uint32_t did)
 	return samd;
 }
 
+struct samx5x_flash {
+	target_flash_s f;
+	uint16_t ctrla;    /* CTRLA as found, restored when done */
+	uint32_t unlocked; /* lock regions unlocked during this session */
+	uint32_t region_size;
+};
+
 static void samx5x_add_flash(target *t, uint32_t addr, size_t length, size_t erase_block_size, size_t write_page_size)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct samx5x_flash *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_INFO("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erase_block_size;
+	f->prepare = samx5x_flash_prepare;
 	f->erase = samx5x_flash_erase;
 	f->write = samx5x_flash_write;
+	f->wait = samx5x_flash_wait;
+	f->done = samx5x_flash_done;
 	f->writesize = write_page_size;
 	target_add_flash(t, f);
 }
@@ -336,6 +354,36 @@ struct samx5x_priv_s {
 	char samx5x_variant_string[60];
 };
 
+/**
+ * Computes the CRC32 of a range with the DSU, which runs without the core and
+ * reads at the bus' speed. It works on whole words and not on a protected part.
+ */
+static bool samx5x_crc32_ieee(target *t, uint32_t *crc, target_addr_t base, size_t len)
+{
+	if (!len || ((base | len) & 3U))
+		return false;
+	target_mem_write32(t, SAMX5X_DSU_ADDRESS, base);
+	target_mem_write32(t, SAMX5X_DSU_LENGTH, len);
+	target_mem_write32(t, SAMX5X_DSU_DATA, 0xffffffffU);
+
+	/* Clear the status bits, then start */
+	target_mem_write32(t, SAMX5X_DSU_CTRLSTAT, SAMX5X_STATUSA_DONE |
+			   SAMX5X_STATUSA_PERR | SAMX5X_STATUSA_BERR);
+	target_mem_write32(t, SAMX5X_DSU_CTRLSTAT, SAMX5X_CTRL_CRC);
+
+	uint32_t status;
+	while (((status = target_mem_read32(t, SAMX5X_DSU_CTRLSTAT)) &
+		(SAMX5X_STATUSA_DONE | SAMX5X_STATUSA_PERR |
+		 SAMX5X_STATUSA_BERR)) == 0)
+		if (target_check_error(t))
+			return false;
+
+	if (status & (SAMX5X_STATUSA_PERR | SAMX5X_STATUSA_BERR))
+		return false;
+	*crc = target_mem_read32(t, SAMX5X_DSU_DATA);
+	return !target_check_error(t);
+}
+
 bool samx5x_probe(target *t)
 {
 	ADIv5_AP_t *ap = cortexm_ap(t);
@@ -382,6 +430,9 @@ bool samx5x_probe(target *t)
 	t->mass_erase = samx5x_mass_erase;
 	t->driver = priv_storage->samx5x_variant_string;
 	t->reset = samx5x_reset;
+	/* The cortexm reset and halt would leave the part in the extended reset (CRSTEXT) */
+	t->reset_halt = NULL;
+	t->crc32_ieee = samx5x_crc32_ieee;
 
 	if (protected) {
 		/**
@@ -444,6 +495,42 @@ static void samx5x_unlock_current_address(target *t)
 			   SAMX5X_CTRLB_CMD_KEY | SAMX5X_CTRLB_CMD_UNLOCK);
 }
 
+static bool samx5x_wait_ready(target *t)
+{
+	while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) & SAMX5X_STATUS_READY) == 0) {
+		if (target_check_error(t))
+			return false;
+	}
+	return true;
+}
+
+/* There are 32 lock regions over the whole array */
+static uint32_t samx5x_lock_region_size(target *t)
+{
+	const uint32_t flash_size = (target_mem_read32(t, SAMX5X_NVMC_PARAM) & 0xffff) * SAMX5X_PAGE_SIZE;
+	return flash_size >> 5;
+}
+
+/**
+ * Unlock the region holding addr, once per flash session
+ */
+static bool samx5x_unlock_region(target_flash_s *f, target_addr_t addr)
+{
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
+	target *t = f->t;
+	const uint32_t region = addr / sf->region_size;
+	if (sf->unlocked & (1U << region))
+		return true;
+	if (!samx5x_wait_ready(t))
+		return false;
+	target_mem_write32(t, SAMX5X_NVMC_ADDRESS, addr);
+	samx5x_unlock_current_address(t);
+	if (!samx5x_wait_ready(t))
+		return false;
+	sf->unlocked |= 1U << region;
+	return true;
+}
+
 /**
  * Check for NVM errors and print debug messages
  */
@@ -487,6 +574,45 @@ static int samx5x_check_nvm_error(target *t)
 	return -1;
 }
 
+/**
+ * Select automatic page writes for the session, so no WRITEPAGE command
+ * and poll is needed per page
+ */
+static bool samx5x_flash_prepare(target_flash_s *f)
+{
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
+	target *t = f->t;
+	sf->unlocked = 0;
+	sf->region_size = samx5x_lock_region_size(t);
+	if (!sf->region_size)
+		return false;
+	samx5x_clear_nvm_error(t);
+	sf->ctrla = target_mem_read16(t, SAMX5X_NVMC_CTRLA);
+	target_mem_write16(t, SAMX5X_NVMC_CTRLA, (sf->ctrla & ~SAMX5X_CTRLA_WMODE_MASK) | SAMX5X_CTRLA_WMODE_AP);
+	target_mem_write32(t, SAMX5X_NVMC_CTRLB, SAMX5X_CTRLB_CMD_KEY | SAMX5X_CTRLB_CMD_PAGEBUFFERCLEAR);
+	return samx5x_wait_ready(t);
+}
+
+/**
+ * Relock the regions unlocked during the session and restore the write mode
+ */
+static bool samx5x_flash_done(target_flash_s *f)
+{
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
+	target *t = f->t;
+	bool ret = true;
+	for (uint32_t region = 0; region < 32U; ++region) {
+		if (!(sf->unlocked & (1U << region)))
+			continue;
+		target_mem_write32(t, SAMX5X_NVMC_ADDRESS, region * sf->region_size);
+		samx5x_lock_current_address(t);
+		ret &= samx5x_wait_ready(t);
+	}
+	sf->unlocked = 0;
+	target_mem_write16(t, SAMX5X_NVMC_CTRLA, sf->ctrla);
+	return ret;
+}
+
 #define NVM_ERROR_BITS_MSG						\
 	"Warning: Found NVM error bits set while preparing to %s\n"	\
 	"         flash block at 0x%08"PRIx32" (length 0x%zx).\n"	\
@@ -526,11 +652,10 @@ static bool samx5x_flash_erase(target_flash_s *f, target_addr_t addr, size_t len
         }
 
 	while (len) {
+		if (!samx5x_unlock_region(f, addr))
+			return false;
 		target_mem_write32(t, SAMX5X_NVMC_ADDRESS, addr);
 
-		/* Unlock */
-		samx5x_unlock_current_address(t);
-
 		/* Issue the erase command */
 		target_mem_write32(t, SAMX5X_NVMC_CTRLB,
 				   SAMX5X_CTRLB_CMD_KEY |
@@ -549,9 +674,6 @@ static bool samx5x_flash_erase(target_flash_s *f, target_addr_t addr, size_t len
                     return false;
                 }
 
-		/* Lock */
-		samx5x_lock_current_address(t);
-
 		addr += f->blocksize;
 		len -= f->blocksize;
 	}
@@ -560,47 +682,33 @@ static bool samx5x_flash_erase(target_flash_s *f, target_addr_t addr, size_t len
 }
 
 /**
- * Write flash page by page
+ * Write flash page by page. In automatic page mode the page commits on the
+ * write of its last word, the wait routine checks the result before the next.
  */
 static bool samx5x_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	target *t = f->t;
-	bool error = false;
-	uint16_t errs = samx5x_read_nvm_error(t);
-	if (errs) {
-		DEBUG_INFO(NVM_ERROR_BITS_MSG, "write", dest, len);
-		samx5x_print_nvm_error(errs);
-		samx5x_clear_nvm_error(t);
-	}
-
-	/* Unlock */
-	target_mem_write32(t, SAMX5X_NVMC_ADDRESS, dest);
-	samx5x_unlock_current_address(t);
+	if (!samx5x_unlock_region(f, dest))
+		return false;
 
 	/* Write within a single page. This may be part or all of the page */
 	target_mem_write(t, dest, src, len);
+	return !target_check_error(t);
+}
 
-	/* Issue the write page command */
-	target_mem_write32(t, SAMX5X_NVMC_CTRLB,
-			   SAMX5X_CTRLB_CMD_KEY | SAMX5X_CTRLB_CMD_WRITEPAGE);
-
+static bool samx5x_flash_wait(target_flash_s *f)
+{
+	target *t = f->t;
 	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) &
-		SAMX5X_STATUS_READY) == 0)
-		if (target_check_error(t) || samx5x_check_nvm_error(t)) {
-			error = true;
-			break;
-		}
-
-	if (error || target_check_error(t) || samx5x_check_nvm_error(t)) {
-		DEBUG_WARN("Error writing flash page at 0x%08"PRIx32
-		      " (len 0x%08zx)\n",  dest, len);
+	while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) & SAMX5X_STATUS_READY) == 0) {
+		if (target_check_error(t))
+			return false;
+	}
+	if (target_check_error(t) || samx5x_check_nvm_error(t)) {
+		DEBUG_WARN("Error writing flash page\n");
+		samx5x_clear_nvm_error(t);
 		return false;
 	}
-
-	/* Lock */
-	samx5x_lock_current_address(t);
-
 	return true;
 }
 
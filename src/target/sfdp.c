@@ -64,24 +64,69 @@ static inline size_t sfdp_memory_density_to_capacity_bits(const uint8_t *const d
 		return SFDP_DENSITY_VALUE(density) + 1U;
 }
 
+static void sfdp_read_mode(spi_read_mode_s *const mode, const timings_and_opcode_s *const source, const bool supported)
+{
+	if (!supported)
+		return;
+	mode->opcode = source->opcode;
+	mode->dummy_cycles = SFDP_READ_DUMMY_CYCLES(source->timings);
+}
+
+/* Typical erase times are given as a count in units of 1ms, 16ms, 128ms or 1s */
+static uint32_t sfdp_erase_time_ms(const uint32_t timing, const size_t erase_type)
+{
+	static const uint16_t units_ms[] = {1U, 16U, 128U, 1000U};
+	return SFDP_ERASE_TIMING_COUNT(timing, erase_type) * units_ms[SFDP_ERASE_TIMING_UNIT(timing, erase_type)];
+}
+
 static spi_parameters_s sfdp_read_basic_parameter_table(target *const t, const uint32_t address, const size_t length,
 	const read_sfdp_func sfdp_read)
 {
 	sfdp_basic_parameter_table_s parameter_table;
+	memset(&parameter_table, 0, sizeof(parameter_table));
 	const size_t table_length = MIN(sizeof(sfdp_basic_parameter_table_s), length);
 	sfdp_read(t, address, &parameter_table, table_length);
 
 	spi_parameters_s result;
+	memset(&result, 0, sizeof(result));
 	result.capacity = sfdp_memory_density_to_capacity_bits(parameter_table.memory_density) >> 3U;
+	/* Erase times only exist from JESD216 revision A on, older tables stop before them */
+	const bool have_erase_timing = table_length >= SFDP_ERASE_TIMING_OFFSET + sizeof(parameter_table.erase_timing);
 	for (size_t i = 0; i < SFDP_ERASE_TYPES; ++i) {
 		erase_parameters_s *erase_type = &parameter_table.erase_types[i];
-		if (erase_type->opcode == parameter_table.sector_erase_opcode) {
+		if (!erase_type->erase_size_exponent)
+			continue;
+		result.erase_types[i].size = SFDP_ERASE_SIZE(erase_type);
+		result.erase_types[i].opcode = erase_type->opcode;
+		if (have_erase_timing)
+			result.erase_types[i].typical_ms = sfdp_erase_time_ms(parameter_table.erase_timing, i);
+		if (!result.sector_size && erase_type->opcode == parameter_table.sector_erase_opcode) {
 			result.sector_erase_opcode = erase_type->opcode;
 			result.sector_size = SFDP_ERASE_SIZE(erase_type);
-			break;
 		}
 	}
 	result.page_size = SFDP_PAGE_SIZE(parameter_table);
+
+	/* Plain fast read is mandatory, the multi-bit modes are flagged in DWORD1 */
+	const uint8_t flags = parameter_table.value2;
+	result.fast_read.opcode = SFDP_FAST_READ_OPCODE;
+	result.fast_read.dummy_cycles = SFDP_FAST_READ_DUMMY_CYCLES;
+	sfdp_read_mode(&result.dual_output, &parameter_table.fast_dual_output, flags & SFDP_SUPPORTS_1_1_2);
+	sfdp_read_mode(&result.dual_io, &parameter_table.fast_dual_io, flags & SFDP_SUPPORTS_1_2_2);
+	sfdp_read_mode(&result.quad_output, &parameter_table.fast_quad_output, flags & SFDP_SUPPORTS_1_1_4);
+	sfdp_read_mode(&result.quad_io, &parameter_table.fast_quad_io, flags & SFDP_SUPPORTS_1_4_4);
+
+	switch (flags & SFDP_ADDRESS_BYTES_MASK) {
+	case SFDP_ADDRESS_BYTES_3_OR_4:
+		result.address_mode = SPI_ADDRESS_3B_OR_4B;
+		break;
+	case SFDP_ADDRESS_BYTES_4:
+		result.address_mode = SPI_ADDRESS_4B;
+		break;
+	default:
+		result.address_mode = SPI_ADDRESS_3B;
+		break;
+	}
 	return result;
 }
 
@@ -107,3 +152,14 @@ bool sfdp_read_parameters(target *const t, spi_parameters_s *params, const read_
 	}
 	return false;
 }
+
+const spi_erase_type_s *sfdp_largest_erase_type(const spi_parameters_s *const params, const uint32_t max_size)
+{
+	const spi_erase_type_s *result = NULL;
+	for (size_t i = 0; i < SPI_ERASE_TYPES; ++i) {
+		const spi_erase_type_s *const erase_type = &params->erase_types[i];
+		if (erase_type->size && erase_type->size <= max_size && (!result || erase_type->size > result->size))
+			result = erase_type;
+	}
+	return result;
+}
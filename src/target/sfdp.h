@@ -46,15 +46,43 @@ typedef struct spi_flash_id {
 	uint8_t capacity;
 } spi_flash_id_s;
 
+#define SPI_ERASE_TYPES 4U
+
+typedef struct spi_erase_type {
+	uint32_t size;       /* 0 if this erase type is not defined */
+	uint32_t typical_ms; /* typical time for one erase, 0 if not known */
+	uint8_t opcode;
+} spi_erase_type_s;
+
+typedef struct spi_read_mode {
+	uint8_t opcode;       /* 0 if the mode is not supported */
+	uint8_t dummy_cycles; /* wait states and mode clocks between address and data */
+} spi_read_mode_s;
+
+typedef enum spi_address_mode {
+	SPI_ADDRESS_3B,
+	SPI_ADDRESS_3B_OR_4B,
+	SPI_ADDRESS_4B,
+} spi_address_mode_e;
+
 typedef struct spi_parameters {
 	uint32_t page_size;
 	uint32_t sector_size;
 	size_t capacity;
 	uint8_t sector_erase_opcode;
+	spi_erase_type_s erase_types[SPI_ERASE_TYPES];
+	spi_read_mode_s fast_read;   /* 1-1-1, 0Bh */
+	spi_read_mode_s dual_output; /* 1-1-2 */
+	spi_read_mode_s dual_io;     /* 1-2-2 */
+	spi_read_mode_s quad_output; /* 1-1-4 */
+	spi_read_mode_s quad_io;     /* 1-4-4 */
+	spi_address_mode_e address_mode;
 } spi_parameters_s;
 
 typedef void (*read_sfdp_func)(target *t, uint32_t address, void *buffer, size_t length);
 
 bool sfdp_read_parameters(target *t, spi_parameters_s *params, read_sfdp_func sfdp_read);
+/* The largest erase type no bigger than max_size, NULL if there is none */
+const spi_erase_type_s *sfdp_largest_erase_type(const spi_parameters_s *params, uint32_t max_size);
 
 #endif /* TARGET_SFDP_H */
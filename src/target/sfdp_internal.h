@@ -52,11 +52,32 @@
 #define SFDP_DENSITY_VALUE(density) \
 	((((density)[3] & 0x7FU) << 24U) | ((density)[2] << 16U) | ((density)[1] << 8U) | (density)[0])
 
-#define SFDP_ERASE_TYPES            4U
+#define SFDP_ERASE_TYPES            SPI_ERASE_TYPES
 #define SFDP_ERASE_SIZE(erase_type) (1U << ((erase_type)->erase_size_exponent))
 #define SFDP_PAGE_SIZE(parameter_table) \
 	(1U << ((parameter_table).programming_and_chip_erase_timing.programming_timing_ratio_and_page_size >> 4U))
 
+/* DWORD1 bits 23:16 */
+#define SFDP_SUPPORTS_1_1_2         (1U << 0U)
+#define SFDP_ADDRESS_BYTES_SHIFT    1U
+#define SFDP_ADDRESS_BYTES_MASK     (3U << SFDP_ADDRESS_BYTES_SHIFT)
+#define SFDP_ADDRESS_BYTES_3_OR_4   (1U << SFDP_ADDRESS_BYTES_SHIFT)
+#define SFDP_ADDRESS_BYTES_4        (2U << SFDP_ADDRESS_BYTES_SHIFT)
+#define SFDP_SUPPORTS_1_2_2         (1U << 4U)
+#define SFDP_SUPPORTS_1_4_4         (1U << 5U)
+#define SFDP_SUPPORTS_1_1_4         (1U << 6U)
+
+/* Read mode timings byte: wait states in bits 4:0, mode clocks in bits 7:5 */
+#define SFDP_READ_DUMMY_CYCLES(timings) (((timings)&0x1fU) + ((timings) >> 5U))
+
+/* DWORD10 erase timings, typical time for erase type n as a count and a unit */
+#define SFDP_ERASE_TIMING_COUNT(timing, n) ((((timing) >> (4U + 7U * (n))) & 0x1fU) + 1U)
+#define SFDP_ERASE_TIMING_UNIT(timing, n)  (((timing) >> (9U + 7U * (n))) & 0x3U)
+#define SFDP_ERASE_TIMING_OFFSET           offsetof(sfdp_basic_parameter_table_s, erase_timing)
+
+#define SFDP_FAST_READ_OPCODE       0x0bU
+#define SFDP_FAST_READ_DUMMY_CYCLES 8U
+
 typedef struct sfdp_header {
 	char magic[4];
 	uint8_t version_minor;
@@ -38,6 +38,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flash_loader.h"
 
 static bool stm32f1_cmd_option(target *t, int argc, const char **argv);
 
@@ -47,8 +48,8 @@ const struct command_s stm32f1_cmd_list[] = {
 };
 
 static bool stm32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool stm32f1_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool stm32f1_mass_erase(target *t);
+static bool stm32f1_flash_mass_erase(target_flash_s *f);
 
 /* Flash Program ad Erase Controller Register Map */
 #define FPEC_BASE     0x40022000
@@ -91,23 +92,57 @@ static bool stm32f1_mass_erase(target *t);
 #define DBGMCU_IDCODE    0xE0042000
 #define DBGMCU_IDCODE_F0 0x40015800
 
+#define SRAM_BASE 0x20000000
+
 #define FLASHSIZE    0x1FFFF7E0
 #define FLASHSIZE_F0 0x1FFFF7CC
 
+/* CRC units of the genuine parts, the clones are left to the software CRC */
+static const cortexm_crc_unit_s stm32f1_crc_unit = {
+	.base = 0x40023000U,
+	.clock_enable = 0x40021014U, /* RCC_AHBENR */
+	.clock_mask = 1U << 6U,      /* CRCEN */
+};
+
+static const cortexm_crc_unit_s stm32f0_crc_unit = {
+	.base = 0x40023000U,
+	.clock_enable = 0x40021014U, /* RCC_AHBENR */
+	.clock_mask = 1U << 6U,      /* CRCEN */
+	.programmable = true,
+};
+
+static const uint16_t stm32f1_flash_write_stub[] = {
+#include "flashstub/stm32f1_loader.stub"
+};
+
+struct stm32f1_flash {
+	target_flash_s f;
+	/* Programs a page per buffer, each flash has its own as the page size differs */
+	flash_loader_s loader;
+};
+
 static void stm32f1_add_flash(target *t, uint32_t addr, size_t length, size_t erasesize)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct stm32f1_flash *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	sf->loader.code = stm32f1_flash_write_stub;
+	sf->loader.code_size = sizeof(stm32f1_flash_write_stub);
+	sf->loader.load_addr = SRAM_BASE;
+	sf->loader.buffer_size = erasesize;
+	/* XL density parts switch to the second bank's registers on their own */
+	sf->loader.param = t->part_id == 0x430 ? FLASH_BANK_SPLIT : UINT32_MAX;
+
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = stm32f1_flash_erase;
-	f->write = stm32f1_flash_write;
-	f->writesize = erasesize;
+	f->mass_erase = stm32f1_flash_mass_erase;
+	f->loader = &sf->loader;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 }
@@ -120,9 +155,9 @@ bool gd32f1_probe(target *t)
 {
 	uint16_t device_id;
 	if ((t->cpuid & CPUID_PARTNO_MASK) == CORTEX_M23)
-		device_id = target_mem_read32(t, DBGMCU_IDCODE_F0) & 0xfff;
+		device_id = cortexm_probe_id_read32(t, DBGMCU_IDCODE_F0) & 0xfff;
 	else
-		device_id = target_mem_read32(t, DBGMCU_IDCODE) & 0xfff;
+		device_id = cortexm_probe_id_read32(t, DBGMCU_IDCODE) & 0xfff;
 
 	uint32_t signature = target_mem_read32(t, FLASHSIZE);
 	uint32_t flashSize = signature & 0xFFFF;
@@ -161,7 +196,7 @@ bool at32fxx_probe(target *t)
 	if ((t->cpuid & CPUID_PARTNO_MASK) != CORTEX_M4)
 		return false;
 	// Artery chips use the complete idcode word for identification ()
-	const uint32_t idcode = target_mem_read32(t, DBGMCU_IDCODE);
+	const uint32_t idcode = cortexm_probe_id_read32(t, DBGMCU_IDCODE);
 	// AT32F415 Series?
 	if ((idcode & 0xfffff000U) == 0x70030000) {
 		switch(idcode &0x00000FFF) {
@@ -243,11 +278,13 @@ bool stm32f1_probe(target *t)
 {
 	uint16_t device_id;
 	if ((t->cpuid & CPUID_PARTNO_MASK) == CORTEX_M0)
-		device_id = target_mem_read32(t, DBGMCU_IDCODE_F0) & 0xfff;
+		device_id = cortexm_probe_id_read32(t, DBGMCU_IDCODE_F0) & 0xfff;
 	else
-		device_id = target_mem_read32(t, DBGMCU_IDCODE) & 0xfff;
+		device_id = cortexm_probe_id_read32(t, DBGMCU_IDCODE) & 0xfff;
 
 	t->mass_erase = stm32f1_mass_erase;
+	/* The HSI the part runs from out of reset starts in microseconds */
+	t->reset_profile = &cortexm_reset_instant;
 	size_t flash_size;
 	size_t block_size = 0x400;
 
@@ -266,6 +303,8 @@ bool stm32f1_probe(target *t)
 			DEBUG_WARN("Detected clone STM32F1\n");
 		} else {
 			t->driver = "STM32F1 medium density";
+			if (device_id != 0x29b)
+				cortexm_set_crc_unit(t, &stm32f1_crc_unit);
 		}
 		t->part_id = device_id;
 		return true;
@@ -278,6 +317,7 @@ bool stm32f1_probe(target *t)
 		target_add_ram(t, 0x20000000, 0x10000);
 		stm32f1_add_flash(t, 0x8000000, 0x80000, 0x800);
 		target_add_commands(t, stm32f1_cmd_list, "STM32 HF/CL/VL-HD");
+		cortexm_set_crc_unit(t, &stm32f1_crc_unit);
 		return true;
 
 	case 0x430: /* XL-density */
@@ -287,6 +327,7 @@ bool stm32f1_probe(target *t)
 		stm32f1_add_flash(t, 0x8000000, 0x80000, 0x800);
 		stm32f1_add_flash(t, 0x8080000, 0x80000, 0x800);
 		target_add_commands(t, stm32f1_cmd_list, "STM32 XL/VL-XL");
+		cortexm_set_crc_unit(t, &stm32f1_crc_unit);
 		return true;
 
 	case 0x438: /* STM32F303x6/8 and STM32F328 */
@@ -302,6 +343,7 @@ bool stm32f1_probe(target *t)
 		target_add_ram(t, 0x20000000, 0x10000);
 		stm32f1_add_flash(t, 0x8000000, 0x80000, 0x800);
 		target_add_commands(t, stm32f1_cmd_list, "STM32F3");
+		cortexm_set_crc_unit(t, &stm32f0_crc_unit);
 		return true;
 
 	case 0x444: /* STM32F03 RM0091 Rev.7, STM32F030x[4|6] RM0360 Rev. 4*/
@@ -338,6 +380,7 @@ bool stm32f1_probe(target *t)
 	target_add_ram(t, 0x20000000, 0x5000);
 	stm32f1_add_flash(t, 0x8000000, flash_size, block_size);
 	target_add_commands(t, stm32f1_cmd_list, "STM32F0");
+	cortexm_set_crc_unit(t, &stm32f0_crc_unit);
 
 	t->part_id = device_id;
 
@@ -359,9 +402,10 @@ static int stm32f1_flash_unlock(target *t, uint32_t bank_offset)
 
 static bool stm32f1_flash_busy_wait(target *t, uint32_t bank_offset)
 {
-	/* Read FLASH_SR to poll for BSY bit */
+	/* Read FLASH_SR to poll for BSY bit, the probe waiting for it to clear by itself where it can */
 	uint32_t sr;
 	do {
+		adiv5_mem_poll32(cortexm_ap(t), FLASH_SR + bank_offset, FLASH_SR_BSY, 0);
 		sr = target_mem_read32(t, FLASH_SR + bank_offset);
 		if ((sr & SR_ERROR_MASK) || !(sr & SR_EOP) || target_check_error(t)) {
 			DEBUG_WARN("stm32f1 flash error 0x%" PRIx32 "\n", sr);
@@ -412,86 +456,52 @@ static bool stm32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 	return true;
 }
 
-static bool stm32f1_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+static bool stm32f1_mass_erase_bank(target *t, const uint32_t bank_offset, platform_timeout *const timeout)
 {
-	target *t = f->t;
-	size_t length = 0;
-
-	if (dest < FLASH_BANK_SPLIT) {
-		if ((dest + len - 1) >= FLASH_BANK_SPLIT)
-			length = FLASH_BANK_SPLIT - dest;
-		else
-			length = len;
-
-		target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
-		cortexm_mem_write_sized(t, dest, src, length, ALIGN_HALFWORD);
-
-		/* Wait for completion or an error */
-		if (!stm32f1_flash_busy_wait(t, 0))
-			return false;
-
-		dest += length;
-		src += length;
-	}
-
-	length = len - length;
-	if (t->part_id == 0x430 && length) { /* Write on bank 2 */
-		target_mem_write32(t, FLASH_CR + FLASH_BANK2_OFFSET, FLASH_CR_PG);
-		cortexm_mem_write_sized(t, dest, src, length, ALIGN_HALFWORD);
-
-		/* Wait for completion or an error */
-		if (!stm32f1_flash_busy_wait(t, FLASH_BANK2_OFFSET))
-			return false;
-	}
-
-	return true;
-}
-
-static bool stm32f1_mass_erase(target *t)
-{
-	if (stm32f1_flash_unlock(t, 0))
+	if (stm32f1_flash_unlock(t, bank_offset))
 		return false;
 
-	uint32_t sr;
-	platform_timeout timeout;
-	platform_timeout_set(&timeout, 500);
-
 	/* Flash mass erase start instruction */
-	target_mem_write32(t, FLASH_CR, FLASH_CR_MER);
-	target_mem_write32(t, FLASH_CR, FLASH_CR_STRT | FLASH_CR_MER);
+	target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_MER);
+	target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_STRT | FLASH_CR_MER);
 
 	/* Wait for completion or an error */
+	uint32_t sr;
 	do {
-		sr = target_mem_read32(t, FLASH_SR);
+		sr = target_mem_read32(t, FLASH_SR + bank_offset);
 		if ((sr & SR_ERROR_MASK) || !(sr & SR_EOP) || target_check_error(t)) {
 			DEBUG_WARN("stm32f1 flash error 0x%" PRIx32 "\n", sr);
 			return false;
 		}
-		target_print_progress(&timeout);
+		target_print_progress(timeout);
 	} while (sr & FLASH_SR_BSY);
 
-	if (t->part_id == 0x430) {
-		if (stm32f1_flash_unlock(t, FLASH_BANK2_OFFSET))
-			return false;
-
-		/* Flash mass erase start instruction on bank 2*/
-		target_mem_write32(t, FLASH_CR + FLASH_BANK2_OFFSET, FLASH_CR_MER);
-		target_mem_write32(t, FLASH_CR + FLASH_BANK2_OFFSET, FLASH_CR_STRT | FLASH_CR_MER);
+	return true;
+}
 
-		/* Wait for completion or an error */
-		do {
-			sr = target_mem_read32(t, FLASH_SR + FLASH_BANK2_OFFSET);
-			if ((sr & SR_ERROR_MASK) || !(sr & SR_EOP) || target_check_error(t)) {
-				DEBUG_WARN("stm32f1 flash error 0x%" PRIx32 "\n", sr);
-				return false;
-			}
-			target_print_progress(&timeout);
-		} while (sr & FLASH_SR_BSY);
-	}
+static bool stm32f1_mass_erase(target *t)
+{
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 500);
 
+	if (!stm32f1_mass_erase_bank(t, 0, &timeout))
+		return false;
+	if (t->part_id == 0x430)
+		return stm32f1_mass_erase_bank(t, FLASH_BANK2_OFFSET, &timeout);
 	return true;
 }
 
+/* On XL density parts each flash region is one bank, everywhere else there is just the one */
+static bool stm32f1_flash_mass_erase(target_flash_s *f)
+{
+	target *t = f->t;
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 500);
+
+	const uint32_t bank_offset = t->part_id == 0x430 && f->start >= FLASH_BANK_SPLIT ? FLASH_BANK2_OFFSET : 0;
+	return stm32f1_mass_erase_bank(t, bank_offset, &timeout);
+}
+
 static bool stm32f1_option_erase(target *t)
 {
 	/* Erase option bytes instruction */
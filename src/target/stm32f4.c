@@ -42,13 +42,16 @@ static bool stm32f4_cmd_psize(target *t, int argc, char **argv);
 
 const struct command_s stm32f4_cmd_list[] = {
 	{"option", (cmd_handler)stm32f4_cmd_option, "Manipulate option bytes"},
-	{"psize", (cmd_handler)stm32f4_cmd_psize, "Configure flash write parallelism: (x8|x16|x32(default)|x64)"},
+	{"psize", (cmd_handler)stm32f4_cmd_psize, "Configure flash write parallelism: (x8|x16|x32|x64|auto(default))"},
 	{NULL, NULL, NULL}
 };
 
 static bool stm32f4_attach(target *t);
 static bool stm32f4_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32f4_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool stm32f4_flash_wait(target_flash_s *f);
+static bool stm32f4_flash_erase_start(target_flash_s *f, target_addr_t addr);
+static flash_poll_result_e stm32f4_flash_status(target_flash_s *f);
 static bool stm32f4_mass_erase(target *t);
 
 /* Flash Program and Erase Controller Register Map */
@@ -118,6 +121,8 @@ struct stm32f4_flash {
 
 struct stm32f4_priv_s {
 	uint32_t dbgmcu_cr;
+	bool psize_forced; /* set with monitor psize, kept over attaches */
+	enum align psize;
 };
 
 enum IDS_STM32F247 {
@@ -137,6 +142,13 @@ enum IDS_STM32F247 {
 	ID_STM32F413  = 0x463
 };
 
+/* CRC unit of the F2 and F4 families */
+static const cortexm_crc_unit_s stm32f4_crc_unit = {
+	.base = 0x40023000U,
+	.clock_enable = 0x40023830U, /* RCC_AHB1ENR */
+	.clock_mask = 1U << 12U,     /* CRCEN */
+};
+
 static void stm32f4_add_flash(
 	target *t, uint32_t addr, size_t length, size_t blocksize, unsigned int base_sector, int split)
 {
@@ -154,7 +166,13 @@ static void stm32f4_add_flash(
 	f->blocksize = blocksize;
 	f->erase = stm32f4_flash_erase;
 	f->write = stm32f4_flash_write;
-	f->writesize = 1024;
+	f->wait = stm32f4_flash_wait;
+	/* Sectors take up to seconds each, so they are erased while the data arrives */
+	f->erase_start = stm32f4_flash_erase_start;
+	f->status = stm32f4_flash_status;
+	/* A whole buffer is handed over before FLASH_SR is polled, sectors are at least 16KiB */
+	f->writesize = MIN(FLASH_WRITEBUF_MAX_SIZE, blocksize);
+	f->writebufsize = f->writesize;
 	f->erased = 0xff;
 	sf->base_sector = base_sector;
 	sf->bank_split = split;
@@ -162,6 +180,31 @@ static void stm32f4_add_flash(
 	target_add_flash(t, f);
 }
 
+/*
+ * Widest parallelism the target supply allows without VPP, RM0090 table 6.
+ * x64 needs an external VPP, so it is only used when asked for. Probes that
+ * can not measure VTref keep x32, right for the usual 3.3V.
+ */
+static enum align stm32f4_psize_for_voltage(void)
+{
+#ifdef PLATFORM_HAS_POWER_SWITCH
+	const uint32_t vtref = platform_target_voltage_sense(); /* in tenths of a volt */
+	if (vtref && vtref < 21U)
+		return ALIGN_BYTE;
+	if (vtref && vtref < 27U)
+		return ALIGN_HALFWORD;
+#endif
+	return ALIGN_WORD;
+}
+
+static void stm32f4_set_psize(target *t, const enum align psize)
+{
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (f->write == stm32f4_flash_write)
+			((struct stm32f4_flash *)f)->psize = psize;
+	}
+}
+
 static char *stm32f4_get_chip_name(uint32_t device_id)
 {
 	switch (device_id) {
@@ -207,7 +250,7 @@ static void stm32f4_detach(target *t)
 
 bool stm32f4_probe(target *t)
 {
-	uint16_t mcu_idcode = target_mem_read32(t, DBGMCU_IDCODE) & 0xfffU;
+	uint16_t mcu_idcode = cortexm_probe_id_read32(t, DBGMCU_IDCODE) & 0xfffU;
 
 	if (mcu_idcode == ID_STM32F20X) {
 		/* F405 revision A have a wrong IDCODE, use ARM_CPUID to make the
@@ -234,6 +277,8 @@ bool stm32f4_probe(target *t)
 		t->attach = stm32f4_attach;
 		t->detach = stm32f4_detach;
 		t->mass_erase = stm32f4_mass_erase;
+		/* The HSI the part runs from out of reset starts in microseconds */
+		t->reset_profile = &cortexm_reset_instant;
 		t->driver = stm32f4_get_chip_name(t->part_id);
 		t->part_id = mcu_idcode;
 		target_add_commands(t, stm32f4_cmd_list, t->driver);
@@ -303,7 +348,9 @@ static bool stm32f4_attach(target *t)
 	}
 	bool use_dual_bank = false;
 	/* Save DBGMCU_CR to restore it when detaching*/
-	struct stm32f4_priv_s *priv_storage = calloc(1, sizeof(*priv_storage));
+	struct stm32f4_priv_s *priv_storage = t->target_storage;
+	if (!priv_storage)
+		priv_storage = calloc(1, sizeof(*priv_storage));
 	if (!priv_storage) {			/* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return false;
@@ -326,6 +373,8 @@ static bool stm32f4_attach(target *t)
 			use_dual_bank =  !(optcr & FLASH_OPTCR_nDBANK);
 		}
 	} else {
+		/* The F7 unit has a programmable polynomial and initial value, only use the fixed one */
+		cortexm_set_crc_unit(t, &stm32f4_crc_unit);
 		if (has_ccmram)
 			target_add_ram(t, 0x10000000, 0x10000); /* 64 k CCM Ram*/
 		target_add_ram(t, 0x20000000, 0x50000);     /* 320 k RAM */
@@ -381,6 +430,7 @@ static bool stm32f4_attach(target *t)
 			stm32f4_add_flash(t, bk2 + 0x20000, remains, 0x20000, 21, split);
 		}
 	}
+	stm32f4_set_psize(t, priv_storage->psize_forced ? priv_storage->psize : stm32f4_psize_for_voltage());
 	return true;
 }
 
@@ -395,9 +445,10 @@ static void stm32f4_flash_unlock(target *t)
 
 static bool stm32f4_flash_busy_wait(target *t)
 {
-	/* Read FLASH_SR to poll for BSY bit */
+	/* Read FLASH_SR to poll for BSY bit, the probe waiting for it to clear by itself where it can */
 	uint32_t sr;
 	do {
+		adiv5_mem_poll32(cortexm_ap(t), FLASH_SR, FLASH_SR_BSY, 0);
 		sr = target_mem_read32(t, FLASH_SR);
 		if ((sr & SR_ERROR_MASK) || target_check_error(t)) {
 			DEBUG_WARN("stm32f4 flash error 0x%" PRIx32 "\n", sr);
@@ -408,6 +459,22 @@ static bool stm32f4_flash_busy_wait(target *t)
 	return true;
 }
 
+static void stm32f4_flash_sector_start(target *t, uint8_t sector)
+{
+	enum align psize = ALIGN_WORD;
+	for (target_flash_s *currf = t->flash; currf; currf = currf->next) {
+		if (currf->write == stm32f4_flash_write) {
+			psize = ((struct stm32f4_flash *)currf)->psize;
+		}
+	}
+	uint32_t cr = FLASH_CR_EOPIE | FLASH_CR_ERRIE | FLASH_CR_SER |
+		(psize * FLASH_CR_PSIZE16) | (sector << 3);
+	/* Flash page erase instruction */
+	target_mem_write32(t, FLASH_CR, cr);
+	/* write address to FMA */
+	target_mem_write32(t, FLASH_CR, cr | FLASH_CR_STRT);
+}
+
 static bool stm32f4_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
 	target *t = f->t;
@@ -417,19 +484,8 @@ static bool stm32f4_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 	uint8_t sector = sf->base_sector + (addr - f->start)/f->blocksize;
 	stm32f4_flash_unlock(t);
 
-	enum align psize = ALIGN_WORD;
-	for (target_flash_s *currf = t->flash; currf; currf = currf->next) {
-		if (currf->write == stm32f4_flash_write) {
-			psize = ((struct stm32f4_flash *)currf)->psize;
-		}
-	}
 	while(len) {
-		uint32_t cr = FLASH_CR_EOPIE | FLASH_CR_ERRIE | FLASH_CR_SER |
-			(psize * FLASH_CR_PSIZE16) | (sector << 3);
-		/* Flash page erase instruction */
-		target_mem_write32(t, FLASH_CR, cr);
-		/* write address to FMA */
-		target_mem_write32(t, FLASH_CR, cr | FLASH_CR_STRT);
+		stm32f4_flash_sector_start(t, sector);
 
 		/* Wait for completion or an error */
 		if (!stm32f4_flash_busy_wait(t))
@@ -447,6 +503,29 @@ static bool stm32f4_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 	return true;
 }
 
+/* Start erasing the sector at addr, stm32f4_flash_status() tells when it is done */
+static bool stm32f4_flash_erase_start(target_flash_s *f, target_addr_t addr)
+{
+	target *t = f->t;
+	struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
+	const uint8_t sector = sf->base_sector + (addr - f->start)/f->blocksize;
+	stm32f4_flash_unlock(t);
+	if (!stm32f4_flash_busy_wait(t))
+		return false;
+	stm32f4_flash_sector_start(t, sector);
+	return !target_check_error(t);
+}
+
+static flash_poll_result_e stm32f4_flash_status(target_flash_s *f)
+{
+	const uint32_t sr = target_mem_read32(f->t, FLASH_SR);
+	if ((sr & SR_ERROR_MASK) || target_check_error(f->t)) {
+		DEBUG_WARN("stm32f4 flash error 0x%" PRIx32 "\n", sr);
+		return FLASH_POLL_ERROR;
+	}
+	return (sr & FLASH_SR_BSY) ? FLASH_POLL_BUSY : FLASH_POLL_DONE;
+}
+
 static bool stm32f4_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	/* Translate ITCM addresses to AXIM */
@@ -455,12 +534,22 @@ static bool stm32f4_flash_write(target_flash_s *f, target_addr_t dest, const voi
 	}
 	target *t = f->t;
 
+	/* The previous chunk may still be programming */
+	if (!stm32f4_flash_busy_wait(t))
+		return false;
+
 	enum align psize = ((struct stm32f4_flash *)f)->psize;
 	target_mem_write32(t, FLASH_CR, (psize * FLASH_CR_PSIZE16) | FLASH_CR_PG);
 	cortexm_mem_write_sized(t, dest, src, len, psize);
 
+	/* Completion is waited for in stm32f4_flash_wait() so the next chunk can be fetched meanwhile */
+	return !target_check_error(t);
+}
+
+static bool stm32f4_flash_wait(target_flash_s *f)
+{
 	/* Wait for completion or an error */
-	return stm32f4_flash_busy_wait(t);
+	return stm32f4_flash_busy_wait(f->t);
 }
 
 static bool stm32f4_mass_erase(target *t)
@@ -480,6 +569,7 @@ static bool stm32f4_mass_erase(target *t)
 	/* Read FLASH_SR to poll for BSY bit */
 	uint32_t sr;
 	do {
+		adiv5_mem_poll32(cortexm_ap(t), FLASH_SR, FLASH_SR_BSY, 0);
 		sr = target_mem_read32(t, FLASH_SR);
 		if ((sr & SR_ERROR_MASK) || target_check_error(t))
 			return false;
@@ -703,6 +793,7 @@ static bool stm32f4_cmd_option(target *t, int argc, char *argv[])
 
 static bool stm32f4_cmd_psize(target *t, int argc, char *argv[])
 {
+	struct stm32f4_priv_s *ps = (struct stm32f4_priv_s *)t->target_storage;
 	if (argc == 1) {
 		enum align psize = ALIGN_WORD;
 		for (target_flash_s *f = t->flash; f; f = f->next) {
@@ -710,10 +801,11 @@ static bool stm32f4_cmd_psize(target *t, int argc, char *argv[])
 				psize = ((struct stm32f4_flash *)f)->psize;
 			}
 		}
-		tc_printf(t, "Flash write parallelism: %s\n",
+		tc_printf(t, "Flash write parallelism: %s%s\n",
 		          psize == ALIGN_DWORD ? "x64" :
 		          psize == ALIGN_WORD ? "x32" :
-				  psize == ALIGN_HALFWORD ? "x16" : "x8");
+				  psize == ALIGN_HALFWORD ? "x16" : "x8",
+				  ps && ps->psize_forced ? "" : " (auto)");
 	} else {
 		enum align psize;
 		if (!strcmp(argv[1], "x8")) {
@@ -724,15 +816,17 @@ static bool stm32f4_cmd_psize(target *t, int argc, char *argv[])
 			psize = ALIGN_WORD;
 		} else if (!strcmp(argv[1], "x64")) {
 			psize = ALIGN_DWORD;
+		} else if (!strcmp(argv[1], "auto")) {
+			psize = stm32f4_psize_for_voltage();
 		} else {
-			tc_printf(t, "usage: monitor psize (x8|x16|x32|x32)\n");
+			tc_printf(t, "usage: monitor psize (x8|x16|x32|x64|auto)\n");
 			return false;
 		}
-		for (target_flash_s *f = t->flash; f; f = f->next) {
-			if (f->write == stm32f4_flash_write) {
-				((struct stm32f4_flash *)f)->psize = psize;
-			}
+		if (ps) {
+			ps->psize_forced = strcmp(argv[1], "auto") != 0;
+			ps->psize = psize;
 		}
+		stm32f4_set_psize(t, psize);
 	}
 	return true;
 }
@@ -39,6 +39,7 @@
 
 /* static bool stm32h7_cmd_option(target *t, int argc, char *argv[]); */
 static bool stm32h7_uid(target *t, int argc, const char **argv);
+static size_t stm32h7_unique_id(target *t, uint8_t *uid);
 static bool stm32h7_crc(target *t, int argc, const char **argv);
 static bool stm32h7_cmd_psize(target *t, int argc, char *argv[]);
 static bool stm32h7_cmd_rev(target *t, int argc, const char **argv);
@@ -55,6 +56,8 @@ const struct command_s stm32h7_cmd_list[] = {
 static bool stm32h7_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32h7_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool stm32h7_mass_erase(target *t);
+static bool stm32h7_flash_mass_erase(target_flash_s *f);
+static bool stm32h7_flash_wait(target_flash_s *f);
 
 static const char stm32h7_driver_str[] = "STM32H7";
 
@@ -123,6 +126,12 @@ enum stm32h7_regs {
 #define KEY1 0x45670123
 #define KEY2 0xCDEF89AB
 
+/* Erase times from the datasheet, typical at x64 parallelism and maximum at x8 */
+#define SECTOR_ERASE_TYPICAL_MS 1000U
+#define SECTOR_ERASE_MAX_MS     4000U
+#define BANK_ERASE_TYPICAL_MS   8000U
+#define BANK_ERASE_MAX_MS       32000U
+
 #define OPTKEY1 0x08192A3B
 #define OPTKEY2 0x4C5D6E7F
 
@@ -158,6 +167,8 @@ struct stm32h7_flash {
 
 struct stm32h7_priv_s {
 	uint32_t dbg_cr;
+	bool psize_forced; /* set with monitor psize, kept over attaches */
+	enum align psize;
 };
 
 static void stm32h7_add_flash(target *t, uint32_t addr, size_t length, size_t blocksize)
@@ -173,7 +184,11 @@ static void stm32h7_add_flash(target *t, uint32_t addr, size_t length, size_t bl
 	f->length = length;
 	f->blocksize = blocksize;
 	f->erase = stm32h7_flash_erase;
+	f->mass_erase = stm32h7_flash_mass_erase;
 	f->write = stm32h7_flash_write;
+	/* The banks have a controller each, erase and program both at once */
+	f->wait = stm32h7_flash_wait;
+	f->concurrent = true;
 	f->writesize = 2048;
 	f->erased = 0xff;
 	sf->regbase = FPEC1_BASE;
@@ -183,6 +198,14 @@ static void stm32h7_add_flash(target *t, uint32_t addr, size_t length, size_t bl
 	target_add_flash(t, f);
 }
 
+static void stm32h7_set_psize(target *t, const enum align psize)
+{
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (f->write == stm32h7_flash_write)
+			((struct stm32h7_flash *)f)->psize = psize;
+	}
+}
+
 static bool stm32h7_attach(target *t)
 {
 	if (!cortexm_attach(t))
@@ -210,6 +233,9 @@ static bool stm32h7_attach(target *t)
 	/* Add the flash to memory map. */
 	stm32h7_add_flash(t, 0x8000000, 0x100000, FLASH_SECTOR_SIZE);
 	stm32h7_add_flash(t, 0x8100000, 0x100000, FLASH_SECTOR_SIZE);
+	const struct stm32h7_priv_s *ps = (struct stm32h7_priv_s *)t->target_storage;
+	if (ps->psize_forced)
+		stm32h7_set_psize(t, ps->psize);
 	return true;
 }
 
@@ -228,6 +254,7 @@ bool stm32h7_probe(target *t)
 		t->driver = stm32h7_driver_str;
 		t->attach = stm32h7_attach;
 		t->detach = stm32h7_detach;
+		t->unique_id = stm32h7_unique_id;
 		target_add_commands(t, stm32h7_cmd_list, stm32h7_driver_str);
 		/* Save private storage */
 		struct stm32h7_priv_s *priv_storage = calloc(1, sizeof(*priv_storage));
@@ -243,19 +270,23 @@ bool stm32h7_probe(target *t)
 	return false;
 }
 
-static bool stm32h7_flash_busy_wait(target *t, uint32_t regbase)
+static flash_poll_result_e stm32h7_flash_poll(target *t, void *ctx)
 {
-	uint32_t sr;
-	do {
-		sr = target_mem_read32(t, regbase + FLASH_SR);
-		if ((sr & FLASH_SR_ERROR_MASK) || target_check_error(t)) {
-			DEBUG_WARN("stm32h7_flash_write: error sr %08" PRIx32 "\n", sr);
-			target_mem_write32(t, regbase + FLASH_CCR, sr & FLASH_SR_ERROR_MASK);
-			return false;
-		}
-	} while (sr & (FLASH_SR_BSY | FLASH_SR_QW));
+	const uint32_t regbase = *(const uint32_t *)ctx;
+	const uint32_t sr = target_mem_read32(t, regbase + FLASH_SR);
+	if ((sr & FLASH_SR_ERROR_MASK) || target_check_error(t)) {
+		DEBUG_WARN("stm32h7_flash_write: error sr %08" PRIx32 "\n", sr);
+		target_mem_write32(t, regbase + FLASH_CCR, sr & FLASH_SR_ERROR_MASK);
+		return FLASH_POLL_ERROR;
+	}
+	return (sr & (FLASH_SR_BSY | FLASH_SR_QW)) ? FLASH_POLL_BUSY : FLASH_POLL_DONE;
+}
 
-	return true;
+/* Without a typical time the wait may be for anything, up to a whole bank erase left running */
+static bool stm32h7_flash_busy_wait(target *t, target_flash_s *f, uint32_t regbase, uint32_t typical_ms)
+{
+	return target_flash_poll(t, f, stm32h7_flash_poll, &regbase, typical_ms,
+		typical_ms ? SECTOR_ERASE_MAX_MS : BANK_ERASE_MAX_MS);
 }
 
 static bool stm32h7_flash_unlock(target *t, const uint32_t addr)
@@ -264,7 +295,7 @@ static bool stm32h7_flash_unlock(target *t, const uint32_t addr)
 	if (addr >= BANK2_START)
 		regbase = FPEC2_BASE;
 
-	if (!stm32h7_flash_busy_wait(t, regbase))
+	if (!stm32h7_flash_busy_wait(t, target_flash_for_addr(t, addr), regbase, 0))
 		return false;
 
 	if (target_mem_read32(t, regbase + FLASH_CR) & FLASH_CR_LOCK) {
@@ -288,7 +319,13 @@ static bool stm32h7_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 	const size_t end_sector = (addr + len - 1) / FLASH_SECTOR_SIZE;
 
 	enum align psize = ((struct stm32h7_flash *)f)->psize;
+	/* Unlock waited for whatever was running, from here on it is this erase's previous sector */
+	bool erasing = false;
 	while (start_sector <= end_sector) {
+		/* Each erase waits for the previous one, the last is left to stm32h7_flash_wait() */
+		if (erasing && !stm32h7_flash_busy_wait(t, f, sf->regbase, SECTOR_ERASE_TYPICAL_MS))
+			return false;
+		erasing = true;
 		uint32_t ctrl_reg = (psize * FLASH_CR_PSIZE16) | FLASH_CR_SER | (start_sector * FLASH_CR_SNB_1);
 		target_mem_write32(t, sf->regbase + FLASH_CR, ctrl_reg);
 		ctrl_reg |= FLASH_CR_START;
@@ -297,9 +334,6 @@ static bool stm32h7_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 			target_mem_read32(t, sf->regbase + FLASH_CR),
 			target_mem_read32(t, sf->regbase + FLASH_SR));
 
-		if (!stm32h7_flash_busy_wait(t, sf->regbase))
-			return false;
-
 		++start_sector;
 	}
 	return true;
@@ -319,14 +353,19 @@ static bool stm32h7_flash_write(target_flash_s *f, target_addr_t dest, const voi
 	/* does H7 stall?*/
 
 	target_mem_write(t, dest, src, len);
+	/* Programming continues while the other bank, or the host, gets on with something else */
+	return true;
+}
 
-	if (!stm32h7_flash_busy_wait(t, sf->regbase))
-		return false;
-
+/* Wait for what erase or write left this bank doing */
+static bool stm32h7_flash_wait(target_flash_s *f)
+{
+	target *t = f->t;
+	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	const bool ret = stm32h7_flash_busy_wait(t, f, sf->regbase, 0);
 	/* Close write windows.*/
 	target_mem_write32(t, sf->regbase + FLASH_CR, 0);
-
-	return true;
+	return ret;
 }
 
 static bool stm32h7_erase_bank(target *const t, const enum align psize,
@@ -343,16 +382,20 @@ static bool stm32h7_erase_bank(target *const t, const enum align psize,
 	return true;
 }
 
-static bool stm32h7_wait_erase_bank(target *const t, platform_timeout *timeout, const uint32_t reg_base)
+static flash_poll_result_e stm32h7_erase_bank_poll(target *t, void *ctx)
 {
-	while (target_mem_read32(t, reg_base + FLASH_SR) & FLASH_SR_QW) {
-		if (target_check_error(t)) {
-			DEBUG_WARN("mass erase bank: comm failed\n");
-			return false;
-		}
-		target_print_progress(timeout);
+	const uint32_t reg_base = *(const uint32_t *)ctx;
+	const uint32_t sr = target_mem_read32(t, reg_base + FLASH_SR);
+	if (target_check_error(t)) {
+		DEBUG_WARN("mass erase bank: comm failed\n");
+		return FLASH_POLL_ERROR;
 	}
-	return true;
+	return (sr & FLASH_SR_QW) ? FLASH_POLL_BUSY : FLASH_POLL_DONE;
+}
+
+static bool stm32h7_wait_erase_bank(target *const t, uint32_t typical_ms, uint32_t reg_base)
+{
+	return target_flash_poll(t, NULL, stm32h7_erase_bank_poll, &reg_base, typical_ms, BANK_ERASE_MAX_MS);
 }
 
 static bool stm32h7_check_bank(target *const t, const uint32_t reg_base)
@@ -363,6 +406,13 @@ static bool stm32h7_check_bank(target *const t, const uint32_t reg_base)
 	return !(status & FLASH_SR_ERROR_MASK);
 }
 
+/* Each flash region is one bank, erase it with a single bank erase left running for the other bank's sake */
+static bool stm32h7_flash_mass_erase(target_flash_s *f)
+{
+	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	return stm32h7_erase_bank(f->t, sf->psize, f->start, sf->regbase);
+}
+
 /* Both banks are erased in parallel.*/
 static bool stm32h7_mass_erase(target *t)
 {
@@ -373,20 +423,36 @@ static bool stm32h7_mass_erase(target *t)
 	}
 	/* Send mass erase Flash start instruction */
 	if (!stm32h7_erase_bank(t, psize, BANK1_START, FPEC1_BASE) ||
-		stm32h7_erase_bank(t, psize, BANK2_START, FPEC2_BASE))
+		!stm32h7_erase_bank(t, psize, BANK2_START, FPEC2_BASE))
 		return false;
 
-	platform_timeout timeout;
-	platform_timeout_set(&timeout, 500);
-	/* Wait for the banks to finish erasing */
-	if (!stm32h7_wait_erase_bank(t, &timeout, FPEC1_BASE) ||
-		!stm32h7_wait_erase_bank(t, &timeout, FPEC2_BASE))
+	/* Wait for the banks to finish erasing, the second ran alongside the first */
+	if (!stm32h7_wait_erase_bank(t, BANK_ERASE_TYPICAL_MS, FPEC1_BASE) ||
+		!stm32h7_wait_erase_bank(t, 0, FPEC2_BASE))
 		return false;
 
 	/* Check the banks for final errors */
 	return stm32h7_check_bank(t, FPEC1_BASE) && stm32h7_check_bank(t, FPEC2_BASE);
 }
 
+/* The 96 bit unique device ID, in the order it is printed */
+static size_t stm32h7_unique_id(target *t, uint8_t *uid)
+{
+	uint32_t uid_addr = 0x1ff1e800;
+	if (t->part_id == ID_STM32H7Bx) {
+		uid_addr = 0x08fff800;  /* 7B3/7A3/7B0 */
+	}
+
+	for (size_t i = 0; i < 12U; i += 4U) {
+		const uint32_t val = target_mem_read32(t, uid_addr + i);
+		uid[i + 0U] = val >> 24U;
+		uid[i + 1U] = val >> 16U;
+		uid[i + 2U] = val >> 8U;
+		uid[i + 3U] = val;
+	}
+	return 12U;
+}
+
 /* Print the Unique device ID.
  * Can be reused for other STM32 devices With uid as parameter.
  */
@@ -395,20 +461,11 @@ static bool stm32h7_uid(target *t, int argc, const char **argv)
 	(void)argc;
 	(void)argv;
 
-	uint32_t uid = 0x1ff1e800;
-	if (t->part_id == ID_STM32H7Bx) {
-		uid = 0x08fff800;  /* 7B3/7A3/7B0 */
-	}
-
-	int i;
+	uint8_t uid[12];
+	const size_t uid_len = stm32h7_unique_id(t, uid);
 	tc_printf(t, "0x");
-	for (i = 0; i < 12; i = i + 4) {
-		uint32_t val = target_mem_read32(t, uid + i);
-		tc_printf(t, "%02X", (val >> 24) & 0xff);
-		tc_printf(t, "%02X", (val >> 16) & 0xff);
-		tc_printf(t, "%02X", (val >>  8) & 0xff);
-		tc_printf(t, "%02X", (val >>  0) & 0xff);
-	}
+	for (size_t i = 0; i < uid_len; ++i)
+		tc_printf(t, "%02X", uid[i]);
 	tc_printf(t, "\n");
 	return true;
 }
@@ -483,11 +540,10 @@ static bool stm32h7_cmd_psize(target *t, int argc, char *argv[])
 			tc_printf(t, "usage: monitor psize (x8|x16|x32|x64)\n");
 			return false;
 		}
-		for (target_flash_s *f = t->flash; f; f = f->next) {
-			if (f->write == stm32h7_flash_write) {
-				((struct stm32h7_flash *)f)->psize = psize;
-			}
-		}
+		struct stm32h7_priv_s *ps = (struct stm32h7_priv_s *)t->target_storage;
+		ps->psize_forced = true;
+		ps->psize = psize;
+		stm32h7_set_psize(t, psize);
 	}
 	return true;
 }
@@ -72,12 +72,25 @@
 	o On the STM32L1xx, PECR can only be changed when the NVM
 		hardware is idle.  The STM32L0xx allows the PECR to be updated
 		while an operation is in progress.
+
+	o Program flash and data EEPROM are written by a loader resident in
+		SRAM.  Half page programming needs its words to arrive back to
+		back, which writes through the debug interface can not always
+		manage.  Data EEPROM words are written with FIX clear, which
+		erases them as needed, so they are not erased separately.
 */
 
 #include "general.h"
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flash_loader.h"
+
+static const uint16_t stm32l0_flash_write_stub[] = {
+#include "flashstub/stm32l0_loader.stub"
+};
+
+#define SRAM_BASE 0x20000000U
 
 #define STM32Lx_NVM_PECR(p)    ((p) + 0x04U)
 #define STM32Lx_NVM_PEKEYR(p)  ((p) + 0x0cU)
@@ -143,11 +156,10 @@
 #define STM32L1_NVM_OPTR_BOR_LEV_M  (0xfU)
 #define STM32L1_NVM_OPTR_SPRMOD     (1U << 8U)
 
+static bool stm32lx_nvm_prepare(target_flash_s *f);
+static bool stm32lx_nvm_done(target_flash_s *f);
 static bool stm32lx_nvm_prog_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool stm32lx_nvm_prog_write(target_flash_s *f, target_addr_t destination, const void *src, size_t size);
-
 static bool stm32lx_nvm_data_erase(target_flash_s *f, target_addr_t addr, size_t len);
-static bool stm32lx_nvm_data_write(target_flash_s *f, target_addr_t destination, const void *source, size_t size);
 
 static bool stm32lx_cmd_option(target *t, int argc, char **argv);
 static bool stm32lx_cmd_eeprom(target *t, int argc, char **argv);
@@ -218,36 +230,57 @@ static uint32_t stm32lx_nvm_option_size(target *t)
 	}
 }
 
-static void stm32l_add_flash(target *t, uint32_t addr, size_t length, size_t erasesize)
+struct stm32lx_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+};
+
+static struct stm32lx_flash *stm32lx_flash_alloc(target *t, uint32_t addr, size_t length, size_t blocksize)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct stm32lx_flash *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
-		return;
+		return NULL;
 	}
 
+	flash_loader_s *loader = &sf->loader;
+	loader->code = stm32l0_flash_write_stub;
+	loader->code_size = sizeof(stm32l0_flash_write_stub);
+	loader->load_addr = SRAM_BASE;
+	loader->buffer_size = blocksize;
+	loader->param = stm32lx_nvm_phys(t);
+
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
-	f->blocksize = erasesize;
-	f->erase = stm32lx_nvm_prog_erase;
-	f->write = stm32lx_nvm_prog_write;
-	f->writesize = erasesize / 2;
-	target_add_flash(t, f);
+	f->blocksize = blocksize;
+	f->prepare = stm32lx_nvm_prepare;
+	f->done = stm32lx_nvm_done;
+	f->loader = loader;
+	return sf;
 }
 
-static void stm32l_add_eeprom(target *t, uint32_t addr, size_t length)
+static void stm32l_add_flash(target *t, uint32_t addr, size_t length, size_t erasesize)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
-		DEBUG_WARN("calloc: failed in %s\n", __func__);
+	struct stm32lx_flash *sf = stm32lx_flash_alloc(t, addr, length, erasesize);
+	if (!sf)
 		return;
-	}
+	sf->f.erase = stm32lx_nvm_prog_erase;
+	target_add_flash(t, &sf->f);
+}
 
-	f->start = addr;
-	f->length = length;
-	f->blocksize = 4;
+/* Data EEPROM is written in chunks of STM32Lx_NVM_EEPROM_CHUNK, its erased state is all zeros */
+#define STM32Lx_NVM_EEPROM_CHUNK 128U
+
+static void stm32l_add_eeprom(target *t, uint32_t addr, size_t length)
+{
+	struct stm32lx_flash *sf = stm32lx_flash_alloc(t, addr, length, STM32Lx_NVM_EEPROM_CHUNK);
+	if (!sf)
+		return;
+	target_flash_s *f = &sf->f;
 	f->erase = stm32lx_nvm_data_erase;
-	f->write = stm32lx_nvm_data_write;
+	f->erased = 0;
+	f->write_erases = true;
 	target_add_flash(t, f);
 }
 
@@ -332,100 +365,49 @@ static bool stm32lx_nvm_busy_wait(target *t, uint32_t nvm)
 	return (!((sr & STM32Lx_NVM_SR_ERR_M) || !(sr & STM32Lx_NVM_SR_EOP)));
 }
 
-/** Erase a region of program flash using operations through the debug
-    interface.  This is slower than stubbed versions(see NOTES).  The
-    flash array is erased for all pages from addr to addr+len
-    inclusive.  NVM register file address chosen from target. */
-static bool stm32lx_nvm_prog_erase(target_flash_s *f, target_addr_t addr, size_t len)
+/** PECR stays unlocked for the flash session, for the erases and the
+    loader alike. */
+static bool stm32lx_nvm_prepare(target_flash_s *f)
 {
 	target *t = f->t;
-	const size_t page_size = f->blocksize;
 	const uint32_t nvm = stm32lx_nvm_phys(t);
 
 	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
 		return false;
-
-	/* Flash page erase instruction */
-	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), STM32Lx_NVM_PECR_ERASE | STM32Lx_NVM_PECR_PROG);
-
-	const uint32_t pecr = target_mem_read32(t, STM32Lx_NVM_PECR(nvm));
-	if ((pecr & (STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_ERASE)) != (STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_ERASE))
-		return false;
-
-	/* Clear errors.  Note that this only works when we wait for the NVM
-	   block to complete the last operation. */
+	/* Clear errors left over by anything before us */
 	target_mem_write32(t, STM32Lx_NVM_SR(nvm), STM32Lx_NVM_SR_ERR_M);
-
-	while (len > 0) {
-		/* Write first word of page to 0 */
-		target_mem_write32(t, addr, 0);
-		if (len > page_size)
-			len -= page_size;
-		else
-			len = 0;
-		addr += page_size;
-	}
-
-	/* Disable further programming by locking PECR */
-	stm32lx_nvm_lock(t, nvm);
-
-	/* Wait for completion or an error */
-	return stm32lx_nvm_busy_wait(t, nvm);
+	return true;
 }
 
-/** Write to program flash using operations through the debug
-    interface. */
-static bool stm32lx_nvm_prog_write(target_flash_s *f, target_addr_t dest, const void *src, size_t size)
+static bool stm32lx_nvm_done(target_flash_s *f)
 {
-	target *t = f->t;
-	const uint32_t nvm = stm32lx_nvm_phys(t);
-
-	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
-		return false;
-
-	/* Wait for BSY to clear because we cannot write the PECR until
-	   the previous operation completes on STM32Lxxx. */
-	if (!stm32lx_nvm_busy_wait(t, nvm))
-		return false;
-
-	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_FPRG);
-	target_mem_write(t, dest, src, size);
-
-	/* Disable further programming by locking PECR */
-	stm32lx_nvm_lock(t, nvm);
-
-	/* Wait for completion or an error */
-	return stm32lx_nvm_busy_wait(t, nvm);
+	stm32lx_nvm_lock(f->t, stm32lx_nvm_phys(f->t));
+	return true;
 }
 
-/** Erase a region of data flash using operations through the debug
-    interface .  The flash is erased for all pages from addr to
-    addr+len, inclusive, on a word boundary.  NVM register file
-    address chosen from target. */
-static bool stm32lx_nvm_data_erase(target_flash_s *f, target_addr_t addr, size_t len)
+/** Erase a region of program flash using operations through the debug
+    interface.  The flash array is erased for all pages from addr to
+    addr+len inclusive.  NVM register file address chosen from target. */
+static bool stm32lx_nvm_prog_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
 	target *t = f->t;
 	const size_t page_size = f->blocksize;
 	const uint32_t nvm = stm32lx_nvm_phys(t);
 
-	/* Word align */
-	len += (addr & 3);
-	addr &= ~3;
+	/* Flash page erase instruction */
+	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), STM32Lx_NVM_PECR_ERASE | STM32Lx_NVM_PECR_PROG);
 
-	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
+	const uint32_t pecr = target_mem_read32(t, STM32Lx_NVM_PECR(nvm));
+	if ((pecr & (STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_ERASE)) != (STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_ERASE))
 		return false;
 
-	/* Flash data erase instruction */
-	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), STM32Lx_NVM_PECR_ERASE | STM32Lx_NVM_PECR_DATA);
-
-	uint32_t pecr = target_mem_read32(t, STM32Lx_NVM_PECR(nvm));
-	if ((pecr & (STM32Lx_NVM_PECR_ERASE | STM32Lx_NVM_PECR_DATA)) != (STM32Lx_NVM_PECR_ERASE | STM32Lx_NVM_PECR_DATA))
-		return false;
+	/* Clear errors.  Note that this only works when we wait for the NVM
+	   block to complete the last operation. */
+	target_mem_write32(t, STM32Lx_NVM_SR(nvm), STM32Lx_NVM_SR_ERR_M);
 
 	while (len > 0) {
 		/* Write first word of page to 0 */
 		target_mem_write32(t, addr, 0);
-
 		if (len > page_size)
 			len -= page_size;
 		else
@@ -433,44 +415,17 @@ static bool stm32lx_nvm_data_erase(target_flash_s *f, target_addr_t addr, size_t
 		addr += page_size;
 	}
 
-	/* Disable further programming by locking PECR */
-	stm32lx_nvm_lock(t, nvm);
-
 	/* Wait for completion or an error */
 	return stm32lx_nvm_busy_wait(t, nvm);
 }
 
-/** Write to data flash using operations through the debug interface.
-    NVM register file address chosen from target.  Unaligned
-    destination writes are supported (though unaligned sources are
-    not). */
-static bool stm32lx_nvm_data_write(target_flash_s *f, target_addr_t destination, const void *src, size_t size)
+/** Data EEPROM words are erased by the writes that need it, see NOTES. */
+static bool stm32lx_nvm_data_erase(target_flash_s *f, target_addr_t addr, size_t len)
 {
-	target *t = f->t;
-	const uint32_t nvm = stm32lx_nvm_phys(t);
-	const bool is_stm32l1 = stm32lx_is_stm32l1(t);
-	uint32_t *source = (uint32_t *)src;
-
-	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
-		return false;
-
-	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), is_stm32l1 ? 0 : STM32Lx_NVM_PECR_DATA);
-
-	while (size) {
-		size -= 4;
-		uint32_t v = *source++;
-		target_mem_write32(t, destination, v);
-		destination += 4;
-
-		if (target_check_error(t))
-			return false;
-	}
-
-	/* Disable further programming by locking PECR */
-	stm32lx_nvm_lock(t, nvm);
-
-	/* Wait for completion or an error */
-	return stm32lx_nvm_busy_wait(t, nvm);
+	(void)f;
+	(void)addr;
+	(void)len;
+	return true;
 }
 
 /** Write one option word.  The address is the physical address of the
@@ -56,6 +56,8 @@ const struct command_s stm32l4_cmd_list[] = {
 static bool stm32l4_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32l4_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool stm32l4_mass_erase(target *t);
+static bool stm32l4_flash_mass_erase(target_flash_s *f);
+static bool stm32l4_exit_flash_mode(target *t);
 
 /* Flash Program ad Erase Controller Register Map */
 #define L4_FPEC_BASE			0x40022000
@@ -98,8 +100,18 @@ static bool stm32l4_mass_erase(target *t);
 #define FLASH_SR_ERROR_MASK	0xC3FA
 #define FLASH_SR_BSY		(1 << 16)
 
+/* Program and erase times, typical of the quickest family and maximum of the slowest */
+#define FLASH_PROGRAM_MAX_MS		5U
+#define FLASH_ERASE_TYPICAL_MS		20U
+#define FLASH_ERASE_MAX_MS			25U
+#define FLASH_MASS_ERASE_MAX_MS		50U
+#define FLASH_OPTION_MAX_MS			50U
+
 #define FLASH_SIZE_MAX_G4_CAT4  (512U * 1024U)   // 512 kiB
 
+/* Fast programming writes rows of 32 double words */
+#define FLASH_ROW_SIZE 256U
+
 #define KEY1 0x45670123
 #define KEY2 0xCDEF89AB
 
@@ -130,6 +142,9 @@ enum {
 struct stm32l4_flash {
 	target_flash_s f;
 	uint32_t bank1_start;
+	/* writesize chunks left erased by a bank mass erase this flash session, the only ones fast programming takes */
+	uint8_t *erased_chunks;
+	bool fast_disabled; /* rows were not written in time, use standard programming */
 };
 
 struct stm32l4_priv_s {
@@ -377,6 +392,7 @@ static void stm32l4_add_flash(target *t, uint32_t addr, size_t length, size_t bl
 	f->length = length;
 	f->blocksize = blocksize;
 	f->erase = stm32l4_flash_erase;
+	f->mass_erase = stm32l4_flash_mass_erase;
 	f->write = stm32l4_flash_write;
 	f->writesize = 2048;
 	f->erased = 0xff;
@@ -519,7 +535,7 @@ bool stm32l4_probe(target *t)
 		/* FIXME: we probaly want to check if this is a C-M33 via cpuid */
 		if (ap->dp->partno == 0xbe)
 			idcode_reg = STM32L5_DBGMCU_IDCODE_PHYS;
-		device_id = target_mem_read32(t, idcode_reg) & 0xfffU;
+		device_id = cortexm_probe_id_read32(t, idcode_reg) & 0xfffU;
 		DEBUG_INFO("Idcode %08" PRIx32 "\n", device_id);
 	}
 
@@ -556,6 +572,7 @@ bool stm32l4_probe(target *t)
 	t->mass_erase = stm32l4_mass_erase;
 	t->attach = stm32l4_attach;
 	t->detach = stm32l4_detach;
+	t->exit_flash_mode = stm32l4_exit_flash_mode;
 	target_add_commands(t, stm32l4_cmd_list, chip->designator);
 	return true;
 }
@@ -569,18 +586,68 @@ static void stm32l4_flash_unlock(target *t)
 	}
 }
 
-static bool stm32l4_flash_busy_wait(target *t)
+/* Reads FLASH_SR into ctx until BSY clears, errors are left to the caller */
+static flash_poll_result_e stm32l4_flash_poll(target *t, void *ctx)
 {
-	/* Read FLASH_SR to poll for BSY bit */
-	uint32_t sr;
-	do {
-		sr = stm32l4_flash_read32(t, FLASH_SR);
-		if ((sr & FLASH_SR_ERROR_MASK) || target_check_error(t)) {
-			DEBUG_WARN("stm32l4 flash error: sr 0x%" PRIx32 "\n", sr);
-			return false;
-		}
-	} while (sr & FLASH_SR_BSY);
+	uint32_t *const sr = (uint32_t *)ctx;
+	*sr = stm32l4_flash_read32(t, FLASH_SR);
+	if (target_check_error(t))
+		return FLASH_POLL_ERROR;
+	return (*sr & FLASH_SR_BSY) ? FLASH_POLL_BUSY : FLASH_POLL_DONE;
+}
 
+static bool stm32l4_flash_busy_wait(target *t, target_flash_s *f, uint32_t typical_ms, uint32_t max_ms)
+{
+	uint32_t sr = 0;
+	if (!target_flash_poll(t, f, stm32l4_flash_poll, &sr, typical_ms, max_ms))
+		return false;
+	if (sr & FLASH_SR_ERROR_MASK) {
+		DEBUG_WARN("stm32l4 flash error: sr 0x%" PRIx32 "\n", sr);
+		return false;
+	}
+	return true;
+}
+
+/* Record a range as erased, or as no longer erased once programmed */
+static void stm32l4_mark_erased(target_flash_s *f, target_addr_t addr, size_t len, bool erased)
+{
+	struct stm32l4_flash *const sf = (struct stm32l4_flash *)f;
+	if (!sf->erased_chunks) {
+		if (!erased)
+			return;
+		/* Without the record nothing counts as erased, everything takes standard programming */
+		sf->erased_chunks = calloc((f->length / f->writesize + 7U) / 8U, 1U);
+		if (!sf->erased_chunks)
+			return;
+	}
+	for (size_t offset = 0; offset < len; offset += f->writesize) {
+		const size_t chunk = (addr + offset - f->start) / f->writesize;
+		if (erased)
+			sf->erased_chunks[chunk / 8U] |= 1U << (chunk % 8U);
+		else
+			sf->erased_chunks[chunk / 8U] &= ~(1U << (chunk % 8U));
+	}
+}
+
+static bool stm32l4_chunk_erased(target_flash_s *f, target_addr_t addr)
+{
+	const struct stm32l4_flash *const sf = (struct stm32l4_flash *)f;
+	const size_t chunk = (addr - f->start) / f->writesize;
+	return sf->erased_chunks && (sf->erased_chunks[chunk / 8U] & (1U << (chunk % 8U)));
+}
+
+/* The target may run after this and program its own flash, forget what was erased */
+static bool stm32l4_exit_flash_mode(target *t)
+{
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (f->write != stm32l4_flash_write)
+			continue;
+		struct stm32l4_flash *const sf = (struct stm32l4_flash *)f;
+		free(sf->erased_chunks);
+		sf->erased_chunks = NULL;
+		sf->fast_disabled = false;
+	}
+	target_reset(t);
 	return true;
 }
 
@@ -589,7 +656,7 @@ static bool stm32l4_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 	target *t = f->t;
 	stm32l4_flash_unlock(t);
 
-	if (!stm32l4_flash_busy_wait(t))
+	if (!stm32l4_flash_busy_wait(t, f, 0, FLASH_MASS_ERASE_MAX_MS))
 		return false;
 
 	/* Fixme: OPTVER always set after reset! Wrong option defaults?*/
@@ -607,7 +674,7 @@ static bool stm32l4_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 		ctrl_reg |= FLASH_CR_STRT;
 		stm32l4_flash_write32(t, FLASH_CR, ctrl_reg);
 
-		if (!stm32l4_flash_busy_wait(t))
+		if (!stm32l4_flash_busy_wait(t, f, FLASH_ERASE_TYPICAL_MS, FLASH_ERASE_MAX_MS))
 			return false;
 
 		if (len > blocksize)
@@ -621,14 +688,100 @@ static bool stm32l4_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 	return true;
 }
 
-static bool stm32l4_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+static bool stm32l4_flash_write_standard(target *t, target_addr_t dest, const void *src, size_t len)
 {
-	target *t = f->t;
 	stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_PG);
 	target_mem_write(t, dest, src, len);
 
 	/* Wait for completion or an error */
-	return stm32l4_flash_busy_wait(t);
+	return stm32l4_flash_busy_wait(t, target_flash_for_addr(t, dest), 0, FLASH_PROGRAM_MAX_MS);
+}
+
+enum stm32l4_fast_result {
+	STM32L4_FAST_OK,
+	STM32L4_FAST_MISSED, /* the double words did not arrive in time or the bank was not taken as mass erased */
+	STM32L4_FAST_ERROR,
+};
+
+/* Program len bytes of erased flash row by row with FSTPG, about twice as fast as PG */
+static enum stm32l4_fast_result stm32l4_flash_write_fast(target *t, target_addr_t dest, const uint8_t *src, size_t len)
+{
+	stm32l4_flash_write32(t, FLASH_SR, stm32l4_flash_read32(t, FLASH_SR));
+	enum stm32l4_fast_result result = STM32L4_FAST_OK;
+	for (size_t offset = 0; offset < len && result == STM32L4_FAST_OK; offset += FLASH_ROW_SIZE) {
+		stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_FSTPG);
+		target_mem_write(t, dest + offset, src + offset, FLASH_ROW_SIZE);
+		uint32_t sr = 0;
+		if (!target_flash_poll(t, target_flash_for_addr(t, dest), stm32l4_flash_poll, &sr, 0, FLASH_PROGRAM_MAX_MS))
+			result = STM32L4_FAST_ERROR;
+		else if (sr & (FLASH_SR_FASTERR | FLASH_SR_MSERR))
+			result = STM32L4_FAST_MISSED;
+		/* The controller refuses the sequence with PGSERR when it does not count the bank as mass erased */
+		else if (offset == 0 && (sr & FLASH_SR_PGSERR))
+			result = STM32L4_FAST_MISSED;
+		else if (sr & FLASH_SR_ERROR_MASK) {
+			DEBUG_WARN("stm32l4 flash error: sr 0x%" PRIx32 "\n", sr);
+			result = STM32L4_FAST_ERROR;
+		}
+	}
+	stm32l4_flash_write32(t, FLASH_CR, 0);
+	return result;
+}
+
+/*
+ * A row fast programming gave up on may be partly programmed and can only be
+ * written again once erased. Erase its page, putting back what this session
+ * already wrote to the rest of the page, and leave dest to the caller.
+ */
+static bool stm32l4_flash_recover_page(target_flash_s *f, const target_addr_t dest)
+{
+	target *t = f->t;
+	const target_addr_t page = dest - ((dest - f->start) % f->blocksize);
+	uint8_t *const data = malloc(f->blocksize);
+	if (!data) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	/* Chunks of the page already written, every other one is still erased */
+	uint32_t written = 0;
+	for (size_t chunk = 0; chunk < f->blocksize / f->writesize; ++chunk) {
+		const target_addr_t addr = page + chunk * f->writesize;
+		if (addr != dest && !stm32l4_chunk_erased(f, addr))
+			written |= 1U << chunk;
+	}
+	bool ret = !written || !target_mem_read(t, data, page, f->blocksize);
+	ret = ret && stm32l4_flash_erase(f, page, f->blocksize);
+	for (size_t chunk = 0; ret && written; ++chunk, written >>= 1U) {
+		if (!(written & 1U))
+			continue;
+		const size_t offset = chunk * f->writesize;
+		ret = stm32l4_flash_write_standard(t, page + offset, data + offset, f->writesize);
+		stm32l4_mark_erased(f, page + offset, f->writesize, false);
+	}
+	free(data);
+	return ret;
+}
+
+static bool stm32l4_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+{
+	target *t = f->t;
+	struct stm32l4_flash *const sf = (struct stm32l4_flash *)f;
+	/* The reference manuals only allow fast programming after a mass erase of the bank (MER1/MER2) */
+	if (!sf->fast_disabled && stm32l4_chunk_erased(f, dest)) {
+		const enum stm32l4_fast_result result = stm32l4_flash_write_fast(t, dest, src, len);
+		if (result == STM32L4_FAST_OK) {
+			stm32l4_mark_erased(f, dest, len, false);
+			return true;
+		}
+		if (result == STM32L4_FAST_ERROR)
+			return false;
+		DEBUG_WARN("stm32l4: fast programming failed, using standard programming\n");
+		sf->fast_disabled = true;
+		if (!stm32l4_flash_recover_page(f, dest))
+			return false;
+	}
+	stm32l4_mark_erased(f, dest, len, false);
+	return stm32l4_flash_write_standard(t, dest, src, len);
 }
 
 static bool stm32l4_cmd_erase(target *const t, const uint32_t action)
@@ -639,19 +792,7 @@ static bool stm32l4_cmd_erase(target *const t, const uint32_t action)
 	stm32l4_flash_write32(t, FLASH_CR, action);
 	stm32l4_flash_write32(t, FLASH_CR, action | FLASH_CR_STRT);
 
-	/* Read FLASH_SR to poll for BSY bit */
-	uint32_t sr;
-	platform_timeout timeout;
-	platform_timeout_set(&timeout, 500);
-	do {
-		sr = stm32l4_flash_read32(t, FLASH_SR);
-		if ((sr & FLASH_SR_ERROR_MASK) || target_check_error(t))
-			return false;
-		target_print_progress(&timeout);
-	} while (sr & FLASH_SR_BSY);
-
-	/* Check for error */
-	return true;
+	return stm32l4_flash_busy_wait(t, NULL, FLASH_ERASE_TYPICAL_MS, FLASH_MASS_ERASE_MAX_MS);
 }
 
 static bool stm32l4_mass_erase(target *const t)
@@ -659,6 +800,18 @@ static bool stm32l4_mass_erase(target *const t)
 	return stm32l4_cmd_erase(t, FLASH_CR_MER1 | FLASH_CR_MER2);
 }
 
+/* Erase the bank, or both of them on single bank devices, that this flash region maps */
+static bool stm32l4_flash_mass_erase(target_flash_s *const f)
+{
+	const uint32_t bank1_start = ((struct stm32l4_flash *)f)->bank1_start;
+	const uint32_t action = bank1_start == UINT32_MAX ? FLASH_CR_MER1 | FLASH_CR_MER2 :
+		f->start < bank1_start ? FLASH_CR_MER1 : FLASH_CR_MER2;
+	if (!stm32l4_cmd_erase(f->t, action))
+		return false;
+	stm32l4_mark_erased(f, f->start, f->length, true);
+	return true;
+}
+
 static bool stm32l4_cmd_erase_bank1(target *const t, const int argc, const char **const argv)
 {
 	(void)argc;
@@ -698,12 +851,12 @@ static bool stm32l4_option_write(
 	stm32l4_flash_unlock(t);
 	stm32l4_flash_write32(t, FLASH_OPTKEYR, OPTKEY1);
 	stm32l4_flash_write32(t, FLASH_OPTKEYR, OPTKEY2);
-	if (!stm32l4_flash_busy_wait(t))
+	if (!stm32l4_flash_busy_wait(t, NULL, 0, FLASH_MASS_ERASE_MAX_MS))
 		return true;
 	for (int i = 0; i < len; i++)
 		target_mem_write32(t, fpec_base + i2offset[i], values[i]);
 	stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_OPTSTRT);
-	if (!stm32l4_flash_busy_wait(t))
+	if (!stm32l4_flash_busy_wait(t, NULL, 0, FLASH_OPTION_MAX_MS))
 		return false;
 	stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_OBL_LAUNCH);
 	while (stm32l4_flash_read32(t, FLASH_CR) & FLASH_CR_OBL_LAUNCH)
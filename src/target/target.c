@@ -21,6 +21,11 @@
 #include "general.h"
 #include "target_internal.h"
 #include "gdb_packet.h"
+#include "hex_utils.h"
+#include "command.h"
+#include "flash_loader.h"
+#include "flash_cache.h"
+#include "perf.h"
 
 #include <stdarg.h>
 #include <unistd.h>
@@ -31,10 +36,20 @@ target *target_list = NULL;
 
 static bool target_cmd_mass_erase(target *t, int argc, const char **argv);
 static bool target_cmd_range_erase(target *t, int argc, const char **argv);
+static bool target_cmd_flash_diff(target *t, int argc, const char **argv);
+static bool target_cmd_mem_cache(target *t, int argc, const char **argv);
+static bool target_cmd_mem_fill(target *t, int argc, const char **argv);
+static bool target_cmd_mem_find(target *t, int argc, const char **argv);
+static bool target_cmd_flash_breaks(target *t, int argc, const char **argv);
 
 const struct command_s target_cmd_list[] = {
 	{"erase_mass", (cmd_handler)target_cmd_mass_erase, "Erase whole device Flash"},
 	{"erase_range", (cmd_handler)target_cmd_range_erase, "Erase a range of memory on a device"},
+	{"flash_diff", (cmd_handler)target_cmd_flash_diff, "Only erase and write Flash sectors that change: (enable|disable)"},
+	{"mem_cache", (cmd_handler)target_cmd_mem_cache, "Cache RAM and Flash reads while halted: (enable|disable)"},
+	{"fill", (cmd_handler)target_cmd_mem_fill, "Fill memory with a repeating pattern: <address> <length> <hex bytes>"},
+	{"find", (cmd_handler)target_cmd_mem_find, "Search memory for a pattern: <address> <length> <hex bytes>"},
+	{"flash_breaks", (cmd_handler)target_cmd_flash_breaks, "Patch breakpoints into Flash once the hardware ones run out: (enable|disable)"},
 	{NULL, NULL, NULL}
 };
 
@@ -78,8 +93,11 @@ target *target_new(void)
 	t->halt_poll = (void*)nop_function;
 	t->halt_resume = (void*)nop_function;
 	t->check_error = (void*)false_function;
+	/* The host's flash cache only spares the target reads when flashing differentially */
+	t->flash_diff = flash_cache_enabled;
 
 	t->target_storage = NULL;
+	t->mem_cache_enabled = true;
 
 	target_add_commands(t, target_cmd_list, "Target");
 	return t;
@@ -103,46 +121,138 @@ void target_ram_map_free(target *t) {
 	}
 }
 
+static void target_flash_index_invalidate(target *t)
+{
+	free(t->flash_index);
+	t->flash_index = NULL;
+	t->flash_index_len = 0;
+}
+
 void target_flash_map_free(target *t) {
+	target_flash_buffer_free(t);
+	target_flash_index_invalidate(t);
+	t->flash_active = NULL;
 	while (t->flash) {
 		void * next = t->flash->next;
-		if (t->flash->buf)
-			free(t->flash->buf);
+		free(t->flash->erase_pending);
 		free(t->flash);
 		t->flash = next;
 	}
 }
 
+static void target_mem_map_invalidate(target *t)
+{
+	free(t->mem_map);
+	t->mem_map = NULL;
+}
+
 void target_mem_map_free(target *t)
 {
+	target_mem_map_invalidate(t);
 	target_ram_map_free(t);
 	target_flash_map_free(t);
 }
 
-void target_list_free(void)
+static void target_free(target *t)
 {
 	struct target_command_s *tc;
 
+	if (t->tc && t->tc->destroy_callback)
+		t->tc->destroy_callback(t->tc, t);
+	if (t->priv)
+		t->priv_free(t->priv);
+	while (t->commands) {
+		tc = t->commands->next;
+		free(t->commands);
+		t->commands = tc;
+	}
+	free(t->target_storage);
+	free(t->mem_cache);
+	flash_cache_close(t);
+	target_flash_break_free(t);
+	target_mem_map_free(t);
+	while (t->bw_list) {
+		void * next = t->bw_list->next;
+		free(t->bw_list);
+		t->bw_list = next;
+	}
+	free(t);
+}
+
+/*
+ * Targets of the previous scan, held while a rescan checks whether it found the same part.
+ * Only a list the scan marked reusable with target_list_set_cacheable() is kept.
+ */
+static target *target_list_stashed;
+static bool target_list_cacheable;
+
+void target_list_free(void)
+{
 	while (target_list) {
 		target *t = target_list->next;
-		if (target_list->tc && target_list->tc->destroy_callback)
-			target_list->tc->destroy_callback(target_list->tc, target_list);
-		if (target_list->priv)
-			target_list->priv_free(target_list->priv);
-		while (target_list->commands) {
-			tc = target_list->commands->next;
-			free(target_list->commands);
-			target_list->commands = tc;
+		target_free(target_list);
+		target_list = t;
+	}
+	target_list_cacheable = false;
+}
+
+void target_list_set_cacheable(const bool cacheable)
+{
+	target_list_cacheable = cacheable && target_list;
+}
+
+void target_list_stash(void)
+{
+	if (!target_list)
+		return;
+	if (!target_list_cacheable) {
+		target_list_free();
+		return;
+	}
+	target_list_stash_free();
+	for (target *t = target_list; t; t = t->next) {
+		if (t->tc && t->tc->destroy_callback)
+			t->tc->destroy_callback(t->tc, t);
+		t->tc = NULL;
+		t->attached = false;
+		free(t->mem_cache);
+		t->mem_cache = NULL;
+		while (t->bw_list) {
+			void *next = t->bw_list->next;
+			free(t->bw_list);
+			t->bw_list = next;
 		}
-		free(target_list->target_storage);
-		target_mem_map_free(target_list);
-		while (target_list->bw_list) {
-			void * next = target_list->bw_list->next;
-			free(target_list->bw_list);
-			target_list->bw_list = next;
+		/* Any flash session in progress died with the connection */
+		target_flash_buffer_free(t);
+		for (target_flash_s *f = t->flash; f; f = f->next) {
+			free(f->erase_pending);
+			f->erase_pending = NULL;
+			f->ready = false;
+			f->write_pending = false;
+			f->loader_running = false;
+			f->loader_head = 0;
 		}
-		free(target_list);
-		target_list = t;
+	}
+	target_list_stashed = target_list;
+	target_list = NULL;
+	target_list_cacheable = false;
+}
+
+bool target_list_unstash(void)
+{
+	if (!target_list_stashed || target_list)
+		return false;
+	target_list = target_list_stashed;
+	target_list_stashed = NULL;
+	return true;
+}
+
+void target_list_stash_free(void)
+{
+	while (target_list_stashed) {
+		target *t = target_list_stashed->next;
+		target_free(target_list_stashed);
+		target_list_stashed = t;
 	}
 }
 
@@ -183,6 +293,8 @@ target *target_attach(target *t, struct target_controller *tc)
 
 	t->tc = tc;
 	platform_target_clk_output_enable(true);
+	target_mem_cache_invalidate(t);
+	target_mem_map_invalidate(t);
 
 	if (!t->attach(t)) {
 		platform_target_clk_output_enable(false);
@@ -190,6 +302,7 @@ target *target_attach(target *t, struct target_controller *tc)
 	}
 
 	t->attached = true;
+	t->running = false;
 	return t;
 }
 
@@ -205,10 +318,16 @@ void target_add_ram(target *t, target_addr_t start, uint32_t len)
 	ram->length = len;
 	ram->next = t->ram;
 	t->ram = ram;
+	target_mem_map_invalidate(t);
 }
 
 void target_add_flash(target *t, target_flash_s *f)
 {
+	if (f->loader) {
+		f->write = flash_loader_write;
+		f->wait = flash_loader_wait;
+		f->writesize = f->loader->buffer_size;
+	}
 	if (f->writesize == 0)
 		f->writesize = f->blocksize;
 	if (f->writebufsize == 0)
@@ -216,42 +335,68 @@ void target_add_flash(target *t, target_flash_s *f)
 	f->t = t;
 	f->next = t->flash;
 	t->flash = f;
+	target_flash_index_invalidate(t);
+	target_mem_map_invalidate(t);
+}
+
+/* Where the next part of the map goes, NULL once the buffer is full or when only sizing it */
+static char *map_pos(char *buf, size_t len, size_t offset)
+{
+	return offset < len ? buf + offset : NULL;
+}
+
+static size_t map_left(size_t len, size_t offset)
+{
+	return offset < len ? len - offset : 0U;
 }
 
-static ssize_t map_ram(char *buf, size_t len, struct target_ram *ram)
+static size_t map_ram(char *buf, size_t len, struct target_ram *ram)
 {
 	return snprintf(buf, len, "<memory type=\"ram\" start=\"0x%08"PRIx32
 	                          "\" length=\"0x%"PRIx32"\"/>",
 	                          ram->start, (uint32_t)ram->length);
 }
 
-static ssize_t map_flash(char *buf, size_t len, target_flash_s *f)
+static size_t map_flash(char *buf, size_t len, target_flash_s *f)
 {
-	int i = 0;
-	i += snprintf(&buf[i], len - i, "<memory type=\"flash\" start=\"0x%08"PRIx32
-	                                "\" length=\"0x%"PRIx32"\">",
-	                                f->start, (uint32_t)f->length);
-	i += snprintf(&buf[i], len - i, "<property name=\"blocksize\">0x%"PRIx32
-	                            "</property></memory>",
-	                            (uint32_t)f->blocksize);
-	return i;
+	return snprintf(buf, len, "<memory type=\"flash\" start=\"0x%08"PRIx32
+	                          "\" length=\"0x%"PRIx32"\">"
+	                          "<property name=\"blocksize\">0x%"PRIx32
+	                          "</property></memory>",
+	                          f->start, (uint32_t)f->length, (uint32_t)f->blocksize);
 }
 
-bool target_mem_map(target *t, char *tmp, size_t len)
+/* Like snprintf(), the length of the whole map whatever fitted into buf */
+static size_t target_mem_map_print(target *t, char *buf, size_t len)
 {
-	size_t i = 0;
-	i = snprintf(&tmp[i], len - i, "<memory-map>");
+	size_t i = snprintf(buf, len, "<memory-map>");
 	/* Map each defined RAM */
 	for (struct target_ram *r = t->ram; r; r = r->next)
-		i += map_ram(&tmp[i], len - i, r);
+		i += map_ram(map_pos(buf, len, i), map_left(len, i), r);
 	/* Map each defined Flash */
 	for (target_flash_s *f = t->flash; f; f = f->next)
-		i += map_flash(&tmp[i], len - i, f);
-	i += snprintf(&tmp[i], len - i, "</memory-map>");
+		i += map_flash(map_pos(buf, len, i), map_left(len, i), f);
+	i += snprintf(map_pos(buf, len, i), map_left(len, i), "</memory-map>");
+	return i;
+}
 
-	if (i > (len -2))
-		return false;
-	return true;
+/*
+ * GDB reads the map in many small pieces, so it is printed once into a
+ * buffer of the right size and served from there until the next attach
+ * or change of the RAM and Flash lists.
+ */
+const char *target_mem_map(target *t)
+{
+	if (!t->mem_map) {
+		const size_t len = target_mem_map_print(t, NULL, 0) + 1U;
+		t->mem_map = malloc(len);
+		if (!t->mem_map) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return NULL;
+		}
+		target_mem_map_print(t, t->mem_map, len);
+	}
+	return t->mem_map;
 }
 
 void target_print_progress(platform_timeout *const timeout)
@@ -265,6 +410,8 @@ void target_print_progress(platform_timeout *const timeout)
 /* Wrapper functions */
 void target_detach(target *t)
 {
+	target_flash_break_release(t);
+	target_mem_cache_invalidate(t);
 	t->detach(t);
 	platform_target_clk_output_enable(false);
 	t->attached = false;
@@ -281,19 +428,222 @@ bool target_check_error(target *t) {
 
 bool target_attached(target *t) { return t->attached; }
 
+/*
+ * Halted-state memory cache.
+ *
+ * While the target is halted GDB reads the same stack and data again and
+ * again, after every step. Lines of RAM and Flash are kept until anything
+ * could change them: resuming or resetting the target, writing memory, flash
+ * operations and monitor commands. Ranges outside the memory map may be
+ * peripherals and are never cached.
+ *
+ * Those that leave the target halted only drop the lines, so caching goes on
+ * with the next read. Resuming, resetting, attaching and detaching also stop
+ * caching until the target is seen halted again.
+ */
+void target_mem_cache_drop(target *t)
+{
+	if (!t->mem_cache)
+		return;
+	for (size_t i = 0; i < TARGET_MEM_CACHE_LINES; ++i)
+		t->mem_cache->lines[i].valid = false;
+}
+
+void target_mem_cache_invalidate(target *t)
+{
+	target_mem_cache_drop(t);
+	if (t->mem_cache)
+		t->mem_cache->halted = false;
+}
+
+/* Lines may only be cached whole from a single RAM or Flash region */
+static bool target_mem_cacheable(target *t, target_addr_t addr)
+{
+	const target_addr_t end = addr + TARGET_MEM_CACHE_LINE_SIZE - 1U;
+	for (struct target_ram *r = t->ram; r; r = r->next) {
+		if (addr >= r->start && end <= r->start + r->length - 1U)
+			return true;
+	}
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (addr >= f->start && end <= f->start + f->length - 1U)
+			return true;
+	}
+	return false;
+}
+
+bool target_mem_cache_can_fill(target *t, target_addr_t addr)
+{
+	return t->mem_cache_enabled && !(addr & (TARGET_MEM_CACHE_LINE_SIZE - 1U)) && target_mem_cacheable(t, addr);
+}
+
+/* The line holding addr if there is one, otherwise the next one to replace, marked invalid */
+static target_mem_cache_line_s *target_mem_cache_slot(target_mem_cache_s *const cache, const target_addr_t addr)
+{
+	for (size_t i = 0; i < TARGET_MEM_CACHE_LINES; ++i) {
+		if (cache->lines[i].valid && cache->lines[i].addr == addr)
+			return &cache->lines[i];
+	}
+	target_mem_cache_line_s *const line = &cache->lines[cache->next];
+	cache->next = (cache->next + 1U) % TARGET_MEM_CACHE_LINES;
+	line->valid = false;
+	return line;
+}
+
+/*
+ * Take a line the driver read at a halt before anything asked for it. It is
+ * served once target_halt_poll() has seen the halt.
+ */
+void target_mem_cache_fill(target *t, target_addr_t addr, const void *data)
+{
+	if (!target_mem_cache_can_fill(t, addr))
+		return;
+	if (!t->mem_cache)
+		t->mem_cache = calloc(1, sizeof(*t->mem_cache));
+	if (!t->mem_cache)
+		return;
+	target_mem_cache_line_s *const line = target_mem_cache_slot(t->mem_cache, addr);
+	memcpy(line->data, data, TARGET_MEM_CACHE_LINE_SIZE);
+	line->addr = addr;
+	line->valid = true;
+}
+
+static target_mem_cache_line_s *target_mem_cache_line(target *t, target_addr_t addr)
+{
+	target_mem_cache_line_s *const line = target_mem_cache_slot(t->mem_cache, addr);
+	if (line->valid)
+		return line;
+	t->mem_read(t, line->data, addr, TARGET_MEM_CACHE_LINE_SIZE);
+	if (target_check_error(t))
+		return NULL;
+	line->addr = addr;
+	line->valid = true;
+	return line;
+}
+
+/* Serve a read from the cache, returns false if it must go to the target instead */
+static bool target_mem_cache_read(target *t, void *dest, target_addr_t src, size_t len)
+{
+	if (!t->mem_cache || !t->mem_cache->halted || t->flash_mode || !len ||
+		len > TARGET_MEM_CACHE_LINES * TARGET_MEM_CACHE_LINE_SIZE / 2U)
+		return false;
+	/* Reads wrapping around the end of the address space are left alone */
+	const target_addr_t end = src + len - 1U;
+	if (end < src)
+		return false;
+	const target_addr_t first = src & ~(TARGET_MEM_CACHE_LINE_SIZE - 1U);
+	const target_addr_t last = end & ~(TARGET_MEM_CACHE_LINE_SIZE - 1U);
+	for (target_addr_t addr = first;; addr += TARGET_MEM_CACHE_LINE_SIZE) {
+		if (!target_mem_cacheable(t, addr))
+			return false;
+		if (addr == last)
+			break;
+	}
+	uint8_t *data = dest;
+	for (target_addr_t addr = first; len; addr += TARGET_MEM_CACHE_LINE_SIZE) {
+		const target_mem_cache_line_s *const line = target_mem_cache_line(t, addr);
+		if (!line)
+			return false;
+		const size_t offset = src - addr;
+		const size_t amount = MIN(len, TARGET_MEM_CACHE_LINE_SIZE - offset);
+		memcpy(data, line->data + offset, amount);
+		data += amount;
+		src += amount;
+		len -= amount;
+	}
+	return true;
+}
+
 /* Memory access functions */
 int target_mem_read(target *t, void *dest, target_addr_t src, size_t len)
 {
+	if (target_mem_cache_read(t, dest, src, len)) {
+		target_flash_break_shadow(t, dest, src, len);
+		return 0;
+	}
+	PERF_BEGIN(start);
 	t->mem_read(t, dest, src, len);
-	return target_check_error(t);
+	const int ret = target_check_error(t);
+	PERF_END(PERF_TARGET_MEM_READ, start);
+	target_flash_break_shadow(t, dest, src, len);
+	return ret;
 }
 
 int target_mem_write(target *t, target_addr_t dest, const void *src, size_t len)
 {
+	target_mem_cache_drop(t);
 	t->mem_write(t, dest, src, len);
 	return target_check_error(t);
 }
 
+bool target_no_background_memory_access(target *t)
+{
+	/* If reads fail while running ('rtt: read fail at'), add the target to the expression below.
+	   As a first approximation, assume all arm processors allow memory access while running, and no riscv does. */
+	return t && t->core && strstr(t->core, "RVDBG");
+}
+
+/* Block size for filling and searching over the link, when the target can not do it itself */
+#define TARGET_MEM_BLOCK_SIZE 128U
+
+bool target_mem_fill(target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len)
+{
+	if (!pattern_len || pattern_len > TARGET_MEM_PATTERN_MAX)
+		return false;
+	if (!len)
+		return true;
+	if (t->mem_fill && t->mem_fill(t, base, len, pattern, pattern_len)) {
+		target_mem_cache_drop(t);
+		return true;
+	}
+
+	/* Whole repeats of the pattern, so each block starts at its beginning */
+	uint8_t block[TARGET_MEM_BLOCK_SIZE];
+	const size_t block_len = sizeof(block) - (sizeof(block) % pattern_len);
+	for (size_t i = 0; i < block_len; ++i)
+		block[i] = ((const uint8_t *)pattern)[i % pattern_len];
+	while (len) {
+		const size_t chunk_len = MIN(len, block_len);
+		if (target_mem_write(t, base, block, chunk_len))
+			return false;
+		base += chunk_len;
+		len -= chunk_len;
+	}
+	return true;
+}
+
+/* found is set to the first match, or to the end of the range if there is none */
+bool target_mem_find(
+	target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len, target_addr_t *found)
+{
+	const target_addr_t end = base + len;
+	*found = end;
+	if (!pattern_len || pattern_len > TARGET_MEM_PATTERN_MAX)
+		return false;
+	if (len < pattern_len)
+		return true;
+	if (t->mem_find && t->mem_find(t, base, len, pattern, pattern_len, found))
+		return true;
+
+	uint8_t block[TARGET_MEM_BLOCK_SIZE];
+	*found = end;
+	while (end - base >= pattern_len) {
+		const size_t window = MIN(end - base, sizeof(block));
+		if (target_mem_read(t, block, base, window))
+			return false;
+		for (size_t i = 0; i + pattern_len <= window; ++i) {
+			if (!memcmp(block + i, pattern, pattern_len)) {
+				*found = base + i;
+				return true;
+			}
+		}
+		if (window == end - base)
+			break;
+		/* Blocks overlap so a match across their boundary is not missed */
+		base += window - (pattern_len - 1U);
+	}
+	return true;
+}
+
 /* Register access functions */
 ssize_t target_reg_read(target *t, int reg, void *data, size_t max)
 {
@@ -327,14 +677,55 @@ void target_regs_write(target *t, const void *data)
 }
 
 /* Halt/resume functions */
-void target_reset(target *t) { t->reset(t); }
+void target_reset(target *t)
+{
+	target_mem_cache_invalidate(t);
+	t->running = true;
+	t->reset(t);
+}
+
+bool target_reset_halt(target *t)
+{
+	target_mem_cache_invalidate(t);
+	t->running = true;
+	if (t->reset_halt) {
+		t->running = !t->reset_halt(t);
+		return !t->running;
+	}
+	/* Without a primitive of its own the target runs on briefly before it is stopped */
+	t->reset(t);
+	t->halt_request(t);
+	enum target_halt_reason reason;
+	const uint32_t start_time = platform_time_ms();
+	while ((reason = target_halt_poll(t, NULL)) == TARGET_HALT_RUNNING && platform_time_ms() - start_time < 1000U)
+		continue;
+	return reason != TARGET_HALT_RUNNING && reason != TARGET_HALT_ERROR;
+}
+
 void target_halt_request(target *t) { t->halt_request(t); }
 enum target_halt_reason target_halt_poll(target *t, target_addr_t *watch)
 {
-	return t->halt_poll(t, watch);
+	const enum target_halt_reason reason = t->halt_poll(t, watch);
+	if (reason != TARGET_HALT_RUNNING && reason != TARGET_HALT_ERROR)
+		t->running = false;
+	/* Only start caching memory once the target is known to sit still */
+	if (reason != TARGET_HALT_RUNNING && reason != TARGET_HALT_ERROR && t->mem_cache_enabled) {
+		if (!t->mem_cache)
+			t->mem_cache = calloc(1, sizeof(*t->mem_cache));
+		if (t->mem_cache)
+			t->mem_cache->halted = true;
+	}
+	return reason;
 }
 
-void target_halt_resume(target *t, bool step) { t->halt_resume(t, step); }
+void target_halt_resume(target *t, bool step)
+{
+	if (!target_flash_break_commit(t, step))
+		DEBUG_WARN("Flash breakpoints could not all be updated\n");
+	target_mem_cache_invalidate(t);
+	t->running = true;
+	t->halt_resume(t, step);
+}
 
 /* Command line for semihosting get_cmdline */
 void target_set_cmdline(target *t, char *cmdline) {
@@ -368,6 +759,9 @@ int target_breakwatch_set(target *t,
 
 	if (t->breakwatch_set)
 		ret = t->breakwatch_set(t, &bw);
+	/* Out of hardware breakpoints, or none for this kind, patch it into Flash instead */
+	if (ret != 0 && target_flash_break_set(t, &bw))
+		ret = 0;
 
 	if (ret == 0) {
 		/* Success, make a heap copy */
@@ -386,6 +780,17 @@ int target_breakwatch_set(target *t,
 	return ret;
 }
 
+bool target_breakwatch_present(target *t,
+                               enum target_breakwatch type, target_addr_t addr, size_t len)
+{
+	for (struct breakwatch *bw = t->bw_list; bw; bw = bw->next)
+		if ((bw->type == type) &&
+		    (bw->addr == addr) &&
+		    (bw->size == len))
+			return true;
+	return false;
+}
+
 int target_breakwatch_clear(target *t,
                             enum target_breakwatch type, target_addr_t addr, size_t len)
 {
@@ -400,7 +805,10 @@ int target_breakwatch_clear(target *t,
 	if (bw == NULL)
 		return -1;
 
-	if (t->breakwatch_clear)
+	/* A Flash breakpoint is taken out by the next target_flash_break_commit() */
+	if (bw->flash)
+		ret = 0;
+	else if (t->breakwatch_clear)
 		ret = t->breakwatch_clear(t, bw);
 
 	if (ret == 0) {
@@ -424,6 +832,8 @@ static bool target_cmd_mass_erase(target *const t, const int argc, const char **
 		return true;
 	}
 	gdb_out("Erasing device Flash: ");
+	target_flash_break_forget(t, 0, SIZE_MAX);
+	flash_cache_drop(t);
 	const bool result = t->mass_erase(t);
 	gdb_out("done\n");
 	return result;
@@ -440,7 +850,97 @@ static bool target_cmd_range_erase(target *const t, const int argc, const char *
 	const uint32_t addr = strtoul(argv[1], NULL, 0);
 	const uint32_t length = strtoul(argv[2], NULL, 0);
 
-	return target_flash_erase(t, addr, length);
+	/* There is no data to compare against here, so the erase must not be deferred */
+	const bool flash_diff = t->flash_diff;
+	t->flash_diff = false;
+	const bool result = target_flash_erase(t, addr, length);
+	t->flash_diff = flash_diff;
+	return result;
+}
+
+static bool target_cmd_flash_diff(target *const t, const int argc, const char **const argv)
+{
+	if (argc == 2 && !parse_enable_or_disable(argv[1], &t->flash_diff))
+		return false;
+	gdb_outf("Differential flashing: %s\n", t->flash_diff ? "enabled" : "disabled");
+	return true;
+}
+
+static bool target_cmd_mem_cache(target *const t, const int argc, const char **const argv)
+{
+	if (argc == 2 && !parse_enable_or_disable(argv[1], &t->mem_cache_enabled))
+		return false;
+	if (!t->mem_cache_enabled) {
+		free(t->mem_cache);
+		t->mem_cache = NULL;
+	}
+	gdb_outf("Halted memory cache: %s\n", t->mem_cache_enabled ? "enabled" : "disabled");
+	return true;
+}
+
+static bool target_cmd_flash_breaks(target *const t, const int argc, const char **const argv)
+{
+	if (argc == 2 && !parse_enable_or_disable(argv[1], &t->flash_break_enabled))
+		return false;
+	if (!t->flash_break_instr) {
+		gdb_out("Flash breakpoints: not supported for this core\n");
+		return true;
+	}
+	gdb_outf("Flash breakpoints: %s, %" PRIu32 " block rewrites since attach\n",
+		t->flash_break_enabled ? "enabled" : "disabled", t->flash_break_rewrites);
+	target_flash_break_status(t);
+	return true;
+}
+
+/* Parse a pattern given as hex bytes, returns its length or 0 if it is not valid */
+static size_t target_parse_pattern(const char *const hex, uint8_t *const pattern)
+{
+	const size_t len = strlen(hex);
+	if (!len || (len & 1U) || len / 2U > TARGET_MEM_PATTERN_MAX || strspn(hex, "0123456789abcdefABCDEF") != len) {
+		gdb_outf("Pattern must be 1 to %u bytes as hex digits\n", TARGET_MEM_PATTERN_MAX);
+		return 0;
+	}
+	unhexify(pattern, hex, len / 2U);
+	return len / 2U;
+}
+
+static bool target_cmd_mem_fill(target *const t, const int argc, const char **const argv)
+{
+	if (argc != 4) {
+		gdb_out("usage: monitor fill <address> <length> <pattern>\n");
+		gdb_out("\t<pattern> is the bytes to repeat as hex, such as 00 or deadbeef\n");
+		return true;
+	}
+	uint8_t pattern[TARGET_MEM_PATTERN_MAX];
+	const size_t pattern_len = target_parse_pattern(argv[3], pattern);
+	if (!pattern_len)
+		return false;
+	const uint32_t addr = strtoul(argv[1], NULL, 0);
+	const uint32_t length = strtoul(argv[2], NULL, 0);
+	return target_mem_fill(t, addr, length, pattern, pattern_len);
+}
+
+static bool target_cmd_mem_find(target *const t, const int argc, const char **const argv)
+{
+	if (argc != 4) {
+		gdb_out("usage: monitor find <address> <length> <pattern>\n");
+		gdb_out("\t<pattern> is the bytes to look for as hex, in memory order\n");
+		return true;
+	}
+	uint8_t pattern[TARGET_MEM_PATTERN_MAX];
+	const size_t pattern_len = target_parse_pattern(argv[3], pattern);
+	if (!pattern_len)
+		return false;
+	const uint32_t addr = strtoul(argv[1], NULL, 0);
+	const uint32_t length = strtoul(argv[2], NULL, 0);
+	target_addr_t found;
+	if (!target_mem_find(t, addr, length, pattern, pattern_len, &found))
+		return false;
+	if (found == addr + length)
+		gdb_out("Pattern not found\n");
+	else
+		gdb_outf("Pattern found at 0x%08" PRIx32 "\n", (uint32_t)found);
+	return true;
 }
 
 /* Accessor functions */
@@ -483,6 +983,7 @@ uint32_t target_mem_read32(target *t, uint32_t addr)
 
 void target_mem_write32(target *t, uint32_t addr, uint32_t value)
 {
+	target_mem_cache_drop(t);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -495,6 +996,7 @@ uint16_t target_mem_read16(target *t, uint32_t addr)
 
 void target_mem_write16(target *t, uint32_t addr, uint16_t value)
 {
+	target_mem_cache_drop(t);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -507,6 +1009,7 @@ uint8_t target_mem_read8(target *t, uint32_t addr)
 
 void target_mem_write8(target *t, uint32_t addr, uint8_t value)
 {
+	target_mem_cache_drop(t);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -521,6 +1024,8 @@ void target_command_help(target *t)
 
 int target_command(target *t, int argc, const char *argv[])
 {
+	/* Monitor commands can change memory behind the cache's back */
+	target_mem_cache_drop(t);
 	for (struct target_command_s *tc = t->commands; tc; tc = tc->next)
 		for(const struct command_s *c = tc->cmds; c->cmd; c++)
 			if(!strncmp(argv[0], c->cmd, strlen(argv[0])))
@@ -563,27 +1068,76 @@ int tc_close(target *t, int fd)
 
 int tc_read(target *t, int fd, target_addr_t buf, unsigned int count)
 {
+#if PC_HOSTED == 0
+	/* Let a prompt out before the target waits on input */
+	target_stdout_drain(t);
+#endif
 	if (t->tc->read == NULL)
 		return 0;
 	return t->tc->read(t->tc, fd, buf, count);
 }
 
-int tc_write(target *t, int fd, target_addr_t buf, unsigned int count)
+#if PC_HOSTED == 0
+/*
+ * Semihosted stdout and stderr are gathered here so the target can be resumed
+ * at once, and sent on to GDB or the USB UART while it runs.
+ */
+#define STDOUT_RING_SIZE	1024U
+
+static uint8_t stdout_ring[STDOUT_RING_SIZE];
+static size_t stdout_ring_head;
+static size_t stdout_ring_tail;
+
+void target_stdout_drain(target *t)
 {
+	while (stdout_ring_tail != stdout_ring_head) {
+		const size_t begin = stdout_ring_tail % STDOUT_RING_SIZE;
+		size_t len = MIN(stdout_ring_head - stdout_ring_tail, STDOUT_RING_SIZE - begin);
 #ifdef PLATFORM_HAS_USBUART
-	if (t->stdout_redirected && (fd == STDOUT_FILENO || fd == STDERR_FILENO)) {
-		while (count) {
-			uint8_t tmp[STDOUT_READ_BUF_SIZE];
-			unsigned int cnt = sizeof(tmp);
-			if (cnt > count)
-				cnt = count;
-			target_mem_read(t, tmp, buf, cnt);
-			debug_serial_send_stdout(tmp, cnt);
-			count -= cnt;
-			buf += cnt;
+		if (t && t->stdout_redirected) {
+			debug_serial_send_stdout(stdout_ring + begin, len);
+			stdout_ring_tail += len;
+			continue;
 		}
-		return 0;
+#else
+		(void)t;
+#endif
+		char hex[STDOUT_READ_BUF_SIZE * 2U];
+		len = MIN(len, STDOUT_READ_BUF_SIZE);
+		hexify(hex, stdout_ring + begin, len);
+		gdb_putpacket2("O", 1, hex, len * 2U);
+		stdout_ring_tail += len;
+	}
+	stdout_ring_head = 0;
+	stdout_ring_tail = 0;
+}
+
+static int tc_write_stdout(target *t, target_addr_t buf, unsigned int count)
+{
+	for (unsigned int done = 0; done < count;) {
+		if (stdout_ring_head - stdout_ring_tail == STDOUT_RING_SIZE)
+			target_stdout_drain(t);
+		const size_t begin = stdout_ring_head % STDOUT_RING_SIZE;
+		const size_t space = STDOUT_RING_SIZE - (stdout_ring_head - stdout_ring_tail);
+		const size_t len = MIN(MIN(space, STDOUT_RING_SIZE - begin), count - done);
+		/* Read as much as fits in one block, straight into the ring */
+		if (target_mem_read(t, stdout_ring + begin, buf + done, len)) {
+			t->tc->errno_ = TARGET_EFAULT;
+			return done ? (int)done : -1;
+		}
+		stdout_ring_head += len;
+		done += len;
 	}
+	return count;
+}
+#endif
+
+int tc_write(target *t, int fd, target_addr_t buf, unsigned int count)
+{
+#if PC_HOSTED == 0
+	if (fd == STDOUT_FILENO || fd == STDERR_FILENO)
+		return tc_write_stdout(t, buf, count);
+	target_stdout_drain(t);
 #endif
 
 	if (t->tc->write == NULL)
@@ -37,16 +37,127 @@
 
 #include "general.h"
 #include "target_internal.h"
+#include "gdb_packet.h"
+#include "flash_loader.h"
+#include "flash_cache.h"
+#include "perf.h"
+#include "crc32.h"
+
+#if PC_HOSTED == 1
+#define FLASH_COMPARE_BUF_SIZE 4096U
+#else
+#define FLASH_COMPARE_BUF_SIZE 128U
+#endif
+
+/* Status polls back off to this, and a wait only fails this long after the datasheet maximum */
+#define FLASH_POLL_MAX_INTERVAL_MS 100U
+#define FLASH_POLL_SLACK_MS        250U
+/* A block erased in the background is given up on after this */
+#define FLASH_ERASE_BLOCK_MAX_MS   10000U
 
 static bool flash_buffered_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool flash_buffered_flush(target_flash_s *f);
+static bool flash_erase_pending(target_flash_s *f);
+static bool flash_erase_needed(target_flash_s *f, target_addr_t addr, size_t len);
 
-target_flash_s *target_flash_for_addr(target *t, uint32_t addr)
+static int flash_index_compare(const void *const a, const void *const b)
+{
+	const target_flash_s *const flash_a = *(target_flash_s *const *)a;
+	const target_flash_s *const flash_b = *(target_flash_s *const *)b;
+	if (flash_a->start == flash_b->start)
+		return 0;
+	return flash_a->start < flash_b->start ? -1 : 1;
+}
+
+static bool flash_index_build(target *t)
 {
+	size_t count = 0;
 	for (target_flash_s *f = t->flash; f; f = f->next)
-		if ((f->start <= addr) && (addr < (f->start + f->length)))
-			return f;
-	return NULL;
+		++count;
+	t->flash_index = malloc(count * sizeof(*t->flash_index));
+	if (!t->flash_index) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	count = 0;
+	for (target_flash_s *f = t->flash; f; f = f->next)
+		t->flash_index[count++] = f;
+	qsort(t->flash_index, count, sizeof(*t->flash_index), flash_index_compare);
+	t->flash_index_len = count;
+	return true;
+}
+
+target_flash_s *target_flash_for_addr(target *t, uint32_t addr)
+{
+	/* Runs of Flash operations mostly stay within the one region */
+	target_flash_s *const active = t->flash_active;
+	if (active && active->start <= addr && addr - active->start < active->length)
+		return active;
+
+	if (!t->flash)
+		return NULL;
+	if (!t->flash_index && !flash_index_build(t)) {
+		for (target_flash_s *f = t->flash; f; f = f->next)
+			if ((f->start <= addr) && (addr < (f->start + f->length)))
+				return f;
+		return NULL;
+	}
+
+	/* The last region starting at or below addr is the only one that can hold it */
+	size_t low = 0;
+	size_t high = t->flash_index_len;
+	while (low < high) {
+		const size_t mid = low + (high - low) / 2U;
+		if (t->flash_index[mid]->start <= addr)
+			low = mid + 1U;
+		else
+			high = mid;
+	}
+	if (!low)
+		return NULL;
+	target_flash_s *const f = t->flash_index[low - 1U];
+	return addr - f->start < f->length ? f : NULL;
+}
+
+/*
+ * Wait for a controller operation the datasheet gives typical_ms and max_ms for. The status is
+ * first read once the typical time is up, then at an eighth of the time already waited, so a
+ * long erase does not keep the link busy with reads that can only say "busy". f, if not NULL,
+ * has the reads and the time taken added to its stats.
+ */
+bool target_flash_poll(target *t, target_flash_s *f, flash_poll_func poll, void *ctx, const uint32_t typical_ms,
+	const uint32_t max_ms)
+{
+	const uint32_t start_time = platform_time_ms();
+	if (typical_ms)
+		platform_delay(typical_ms);
+	platform_timeout progress;
+	platform_timeout_set(&progress, 500);
+	uint32_t polls = 0;
+	uint32_t elapsed = 0;
+	flash_poll_result_e result;
+	while (true) {
+		result = poll(t, ctx);
+		++polls;
+		elapsed = platform_time_ms() - start_time;
+		if (result != FLASH_POLL_BUSY)
+			break;
+		if (elapsed > max_ms + FLASH_POLL_SLACK_MS) {
+			DEBUG_WARN("Flash operation timed out after %" PRIu32 " ms\n", elapsed);
+			result = FLASH_POLL_ERROR;
+			break;
+		}
+		target_print_progress(&progress);
+		const uint32_t interval = MIN(elapsed / 8U, FLASH_POLL_MAX_INTERVAL_MS);
+		if (interval)
+			platform_delay(interval);
+	}
+	if (f) {
+		f->stats.status_polls += polls;
+		if (elapsed > f->stats.busy_max_ms)
+			f->stats.busy_max_ms = elapsed;
+	}
+	return result == FLASH_POLL_DONE;
 }
 
 static bool target_enter_flash_mode(target *t)
@@ -54,6 +165,8 @@ static bool target_enter_flash_mode(target *t)
 	if (t->flash_mode)
 		return true;
 
+	target_mem_cache_invalidate(t);
+
 	bool ret = true;
 	if (t->enter_flash_mode)
 		ret = t->enter_flash_mode(t);
@@ -62,8 +175,18 @@ static bool target_enter_flash_mode(target *t)
 		/* This saves us if we're interrupted in IRQ context */
 		target_reset(t);
 
-	if (ret == true)
+	if (ret == true) {
 		t->flash_mode = true;
+		t->flash_active = NULL;
+		for (target_flash_s *f = t->flash; f; f = f->next) {
+			memset(&f->stats, 0, sizeof(f->stats));
+			f->erase_next = f->erase_end;
+			f->erase_busy = false;
+			f->erase_failed = false;
+		}
+		t->flash_request_end = platform_time_ms();
+		flash_cache_open(t);
+	}
 
 	return ret;
 }
@@ -81,6 +204,10 @@ static bool target_exit_flash_mode(target *t)
 		target_reset(t);
 
 	t->flash_mode = false;
+	flash_cache_close(t);
+	target_flash_buffer_free(t);
+	/* Leaving flash mode usually resets the target */
+	target_mem_cache_invalidate(t);
 
 	return ret;
 }
@@ -91,8 +218,10 @@ static bool flash_prepare(target_flash_s *f)
 		return true;
 
 	bool ret = true;
+	const uint32_t start_time = platform_time_ms();
 	if (f->prepare)
 		ret = f->prepare(f);
+	f->stats.prepare_done_ms += platform_time_ms() - start_time;
 
 	if (ret == true)
 		f->ready = true;
@@ -100,29 +229,394 @@ static bool flash_prepare(target_flash_s *f)
 	return ret;
 }
 
+/*
+ * Drivers that provide a wait routine return from write as soon as the data has been handed
+ * to the target, leaving the flash controller busy. This lets the next chunk of data arrive
+ * from the host while the controller is programming the previous one. Such a write must cope
+ * with being called again while busy, and we only wait for completion before erasing, reading
+ * back or finishing.
+ *
+ * A concurrent flash has a controller of its own. Its erases are left in progress the same way,
+ * and it is not finished when another flash is used, so both controllers can work at once. It
+ * is finished with the flash session, or waited for when it is used again.
+ */
+static bool flash_wait(target_flash_s *f)
+{
+	if (!f->write_pending)
+		return true;
+	f->write_pending = false;
+	const uint32_t start_time = platform_time_ms();
+	const bool ret = f->wait(f);
+	f->stats.write_ms += platform_time_ms() - start_time;
+	/* Whichever operation was left in progress failed, it may have been anywhere */
+	if (!ret)
+		flash_cache_forget(f, f->start, f->length);
+	return ret;
+}
+
+static bool flash_erase(target_flash_s *f, const target_addr_t addr)
+{
+	flash_cache_forget(f, addr, f->blocksize);
+	const uint32_t start_time = platform_time_ms();
+	const bool ret = f->erase(f, addr, f->blocksize);
+	f->write_pending = f->concurrent;
+	f->stats.erase_ms += platform_time_ms() - start_time;
+	++f->stats.sectors_erased;
+	return ret;
+}
+
+/* Erase a large_blocksize sized, aligned range in one go */
+static bool flash_erase_large(target_flash_s *f, const target_addr_t addr)
+{
+	flash_cache_forget(f, addr, f->large_blocksize);
+	const uint32_t start_time = platform_time_ms();
+	const bool ret = f->erase(f, addr, f->large_blocksize);
+	f->write_pending = f->concurrent;
+	f->stats.erase_ms += platform_time_ms() - start_time;
+	f->stats.sectors_erased += f->large_blocksize / f->blocksize;
+	return ret;
+}
+
+static bool flash_mass_erase(target_flash_s *f)
+{
+	flash_cache_forget(f, f->start, f->length);
+	const uint32_t start_time = platform_time_ms();
+	const bool ret = f->mass_erase(f);
+	f->write_pending = f->concurrent;
+	f->stats.erase_ms += platform_time_ms() - start_time;
+	f->stats.sectors_erased += f->length / f->blocksize;
+	return ret;
+}
+
+/*
+ * Background erase. A flash with erase_start and status has the blocks of an erase request
+ * queued and the request answered at once. They are then erased in address order while GDB
+ * sends the data, moved on between packets by target_flash_background(), and a write waits only
+ * until the erase is past the blocks it lands in. The controller does one thing at a time: no
+ * block is started while a write is in progress, and no write while a block is being erased.
+ */
+static bool flash_erase_queued(const target_flash_s *f)
+{
+	return f->erase_busy || f->erase_next != f->erase_end;
+}
+
+/* Move the background erase on without waiting, starting no block at or past limit */
+static bool flash_erase_step(target_flash_s *f, const target_addr_t limit)
+{
+	if (f->erase_busy) {
+		const uint32_t elapsed = platform_time_ms() - f->erase_started;
+		flash_poll_result_e result = f->status(f);
+		++f->stats.status_polls;
+		if (result == FLASH_POLL_BUSY && elapsed > FLASH_ERASE_BLOCK_MAX_MS) {
+			DEBUG_WARN("Background erase timed out after %" PRIu32 " ms\n", elapsed);
+			result = FLASH_POLL_ERROR;
+		}
+		if (result == FLASH_POLL_BUSY)
+			return true;
+		f->erase_busy = false;
+		f->stats.erase_ms += elapsed;
+		if (elapsed > f->stats.busy_max_ms)
+			f->stats.busy_max_ms = elapsed;
+		f->erase_failed |= result == FLASH_POLL_ERROR;
+	}
+
+	while (!f->erase_failed && f->erase_next != f->erase_end && f->erase_next < limit) {
+		const target_addr_t addr = f->erase_next;
+		f->erase_next += f->blocksize;
+		if (!flash_erase_needed(f, addr, f->blocksize))
+			continue;
+		if (!flash_wait(f)) {
+			f->erase_failed = true;
+			break;
+		}
+		flash_cache_forget(f, addr, f->blocksize);
+		++f->stats.sectors_erased;
+		f->erase_started = platform_time_ms();
+		f->erase_busy = f->erase_start(f, addr);
+		f->erase_failed = !f->erase_busy;
+		break;
+	}
+
+	/* What is left queued after a failure is dropped, the failure is what gets reported */
+	if (f->erase_failed)
+		f->erase_next = f->erase_end;
+	return !f->erase_failed;
+}
+
+/* Wait until the background erase is past [addr, addr + len) and has left the controller free */
+static bool flash_erase_wait(target_flash_s *f, const target_addr_t addr, const size_t len)
+{
+	if (!flash_erase_queued(f))
+		return !f->erase_failed;
+
+	const target_addr_t end = addr + len;
+	const uint32_t start_time = platform_time_ms();
+	platform_timeout progress;
+	platform_timeout_set(&progress, 500);
+	while (f->erase_busy || (f->erase_next != f->erase_end && f->erase_next < end)) {
+		if (!flash_erase_step(f, end))
+			break;
+		if (f->erase_busy) {
+			target_print_progress(&progress);
+			platform_delay(1);
+		}
+	}
+	f->stats.erase_wait_ms += platform_time_ms() - start_time;
+	return !f->erase_failed;
+}
+
+static bool flash_erase_drain(target_flash_s *f)
+{
+	return flash_erase_wait(f, f->start, f->length);
+}
+
+/* Queue the block at addr for erasing in the background, false if it has to be erased now */
+static bool flash_erase_queue(target_flash_s *f, const target_addr_t addr)
+{
+	if (!f->erase_start || f->t->flash_diff || !flash_prepare(f))
+		return false;
+	/* Only one run of blocks is queued, what does not carry it on waits for it to finish */
+	if (flash_erase_queued(f) && addr != f->erase_end && !flash_erase_drain(f))
+		return false;
+	if (!flash_erase_queued(f))
+		f->erase_next = addr;
+	f->erase_end = addr + f->blocksize;
+	return true;
+}
+
+bool target_flash_background(target *t)
+{
+	if (!t->flash_mode)
+		return false;
+	bool busy = false;
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (!flash_erase_queued(f))
+			continue;
+		flash_erase_step(f, f->erase_end);
+		busy |= flash_erase_queued(f);
+	}
+	return busy;
+}
+
+static void flash_account_host_wait(target *t, const target_addr_t addr)
+{
+	target_flash_s *f = target_flash_for_addr(t, addr);
+	if (f)
+		f->stats.host_wait_ms += platform_time_ms() - t->flash_request_end;
+}
+
 static bool flash_done(target_flash_s *f)
 {
 	if (!f->ready)
 		return true;
 
-	bool ret = true;
+	bool ret = flash_erase_drain(f);
+	ret &= flash_wait(f);
+	const uint32_t start_time = platform_time_ms();
+	if (f->loader)
+		ret &= flash_loader_stop(f);
 	if (f->done)
-		ret = f->done(f);
+		ret &= f->done(f);
+	f->stats.prepare_done_ms += platform_time_ms() - start_time;
 
-	if (f->buf) {
-		free(f->buf);
-		f->buf = NULL;
-	}
+	/* The staging buffer stays allocated for the next region until Flash mode ends */
+	if (f->t->flash_buf_owner == f)
+		f->t->flash_buf_owner = NULL;
+	f->buf = NULL;
 
 	f->ready = false;
 
 	return ret;
 }
 
+/*
+ * Operations moved on to region f: the buffered data of the others is written out and they are
+ * finished, unless both have controllers of their own. Only done when the region changes, so
+ * runs of operations in one region do not walk the list, and writes that alternate between two
+ * concurrent regions do not go through prepare and done each time.
+ */
+static bool flash_region_change(target *t, target_flash_s *f)
+{
+	if (t->flash_active == f)
+		return true;
+	t->flash_active = f;
+
+	bool ret = true; /* catch false returns with &= */
+	for (target_flash_s *other = t->flash; other; other = other->next) {
+		if (other == f)
+			continue;
+		ret &= flash_buffered_flush(other);
+		if (!(f->concurrent && other->concurrent))
+			ret &= flash_done(other);
+	}
+	return ret;
+}
+
+/*
+ * Differential flashing: when enabled, erasing a sector is only recorded here. The sector is
+ * erased once the data for it has been received and turns out to differ from what the target
+ * already holds, so unchanged sectors are neither erased nor written again.
+ */
+static bool flash_defer_erase(target_flash_s *f, const target_addr_t addr)
+{
+	if (!f->erase_pending) {
+		/* Make sure any buffered data is written using the buffer size for normal mode */
+		if (!flash_buffered_flush(f) || !flash_done(f))
+			return false;
+		const size_t sectors = f->length / f->blocksize;
+		f->erase_pending = calloc((sectors + 3U) / 4U, 1U);
+		if (!f->erase_pending) { /* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			return false;
+		}
+	}
+
+	const size_t bit = (addr - f->start) / f->blocksize * 2U;
+	f->erase_pending[bit / 8U] |= 1U << (bit % 8U);
+	return true;
+}
+
+static bool flash_erase_is_pending(const target_flash_s *f, const target_addr_t addr)
+{
+	const size_t bit = (addr - f->start) / f->blocksize * 2U;
+	return f->erase_pending && (f->erase_pending[bit / 8U] & (1U << (bit % 8U)));
+}
+
+/* The sector's deferred erase is settled by its first flush, which is remembered for any later one */
+static void flash_erase_clear_pending(target_flash_s *f, const target_addr_t addr)
+{
+	const size_t bit = (addr - f->start) / f->blocksize * 2U;
+	f->erase_pending[bit / 8U] &= ~(1U << (bit % 8U));
+	f->erase_pending[bit / 8U] |= 2U << (bit % 8U);
+}
+
+static bool flash_sector_was_flushed(const target_flash_s *f, const target_addr_t addr)
+{
+	const size_t bit = (addr - f->start) / f->blocksize * 2U;
+	return f->erase_pending[bit / 8U] & (2U << (bit % 8U));
+}
+
+static bool flash_data_is_erased(const target_flash_s *f, const uint8_t *const data, const size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		if (data[i] != f->erased)
+			return false;
+	}
+	return true;
+}
+
+/* Check whether a sector already holds the given data, or is erased if data is NULL */
+static bool flash_sector_matches(target_flash_s *f, const target_addr_t addr, const uint8_t *const data)
+{
+	uint32_t crc;
+	crc32_kind_e kind;
+	/* Only the checksum crosses the link if the target computes it, a running loader holds the stub RAM */
+	if (data && !f->loader_running && target_crc32(f->t, addr, f->blocksize, &crc, &kind))
+		return crc == crc32_kind_buffer(kind, 0xffffffffU, data, f->blocksize);
+	uint8_t buf[FLASH_COMPARE_BUF_SIZE];
+	for (size_t offset = 0; offset < f->blocksize; offset += sizeof(buf)) {
+		const size_t len = MIN(sizeof(buf), f->blocksize - offset);
+		if (target_mem_read(f->t, buf, addr + offset, len))
+			return false;
+		if (data ? memcmp(buf, data + offset, len) != 0 : !flash_data_is_erased(f, buf, len))
+			return false;
+	}
+	return true;
+}
+
+/* The controller's blank check if it has one, else the CRC by the target or reading the range back */
+static bool flash_range_is_blank(target_flash_s *f, const target_addr_t addr, const size_t len)
+{
+	if (f->blank_check)
+		return f->blank_check(f, addr, len);
+	uint32_t crc;
+	crc32_kind_e kind;
+	/* A running loader holds the RAM the CRC stub would use */
+	if (!f->loader_running && target_crc32(f->t, addr, len, &crc, &kind)) {
+		uint8_t erased[FLASH_COMPARE_BUF_SIZE];
+		memset(erased, f->erased, sizeof(erased));
+		uint32_t expected = 0xffffffffU;
+		for (size_t offset = 0; offset < len; offset += sizeof(erased))
+			expected = crc32_kind_buffer(kind, expected, erased, MIN(sizeof(erased), len - offset));
+		return crc == expected;
+	}
+	for (size_t offset = 0; offset < len; offset += f->blocksize) {
+		if (!flash_sector_matches(f, addr + offset, NULL))
+			return false;
+	}
+	return true;
+}
+
+bool target_flash_sector_crc(target_flash_s *f, const target_addr_t sector, uint32_t *const crc)
+{
+	target *const t = f->t;
+	if (!f->loader_running && t->crc32 && t->crc32(t, crc, sector, f->blocksize))
+		return true;
+	uint8_t buf[FLASH_COMPARE_BUF_SIZE];
+	*crc = 0xffffffffU;
+	for (size_t offset = 0; offset < f->blocksize; offset += sizeof(buf)) {
+		const size_t len = MIN(sizeof(buf), f->blocksize - offset);
+		if (target_mem_read(t, buf, sector + offset, len))
+			return false;
+		*crc = crc32_buffer(*crc, buf, len);
+	}
+	return true;
+}
+
+/* Controllers with a blank check skip erasing what is blank already, as all of a factory fresh part is */
+static bool flash_erase_needed(target_flash_s *f, const target_addr_t addr, const size_t len)
+{
+	if (!f->blank_check || !f->blank_check(f, addr, len))
+		return true;
+	f->stats.sectors_blank += len / f->blocksize;
+	return false;
+}
+
+/* Erase all sectors still marked for erase that were not written and are not blank already */
+static bool flash_erase_pending(target_flash_s *f)
+{
+	if (!f->erase_pending)
+		return true;
+
+	bool ret = flash_wait(f);
+	for (target_addr_t addr = f->start; addr < f->start + f->length; addr += f->blocksize) {
+		if (!flash_erase_is_pending(f, addr))
+			continue;
+		/* The controller may only do its blank check once prepared */
+		if (!flash_prepare(f)) {
+			ret = false;
+			break;
+		}
+		if (flash_cache_holds(f, addr, NULL) || flash_range_is_blank(f, addr, f->blocksize)) {
+			++f->stats.sectors_blank;
+			flash_cache_store(f, addr, NULL);
+			continue;
+		}
+		if (flash_erase(f, addr))
+			flash_cache_store(f, addr, NULL);
+		else
+			ret = false;
+	}
+
+	free(f->erase_pending);
+	f->erase_pending = NULL;
+	return ret;
+}
+
+/* In differential mode whole sectors must be buffered so they can be compared before erasing */
+static size_t flash_buffer_size(const target_flash_s *f)
+{
+	if (f->erase_pending)
+		return MAX(f->blocksize, f->writebufsize);
+	return f->writebufsize;
+}
+
 bool target_flash_erase(target *t, target_addr_t addr, size_t len)
 {
 	if (!target_enter_flash_mode(t))
 		return false;
+	target_flash_break_forget(t, addr, len);
+	flash_account_host_wait(t, addr);
 
 	bool ret = true; /* catch false returns with &= */
 	while (len) {
@@ -133,25 +627,46 @@ bool target_flash_erase(target *t, target_addr_t addr, size_t len)
 		}
 
 		/* terminate flash operations if we're not in the same target flash */
-		for (target_flash_s *target_f = t->flash; target_f; target_f = target_f->next)
-			if (target_f != f)
-				ret &= flash_done(target_f);
+		ret &= flash_region_change(t, f);
 
 		const target_addr_t local_start_addr = addr & ~(f->blocksize - 1U);
-		const target_addr_t local_end_addr = local_start_addr + f->blocksize;
+		target_addr_t local_end_addr = local_start_addr + f->blocksize;
 
-		if (!flash_prepare(f))
-			return false;
+		if (!t->flash_diff && f->mass_erase && local_start_addr == f->start && addr + len >= f->start + f->length) {
+			/* The request covers all of this flash, use the bank erase rather than going sector by sector */
+			if (!flash_prepare(f) || !flash_erase_drain(f) || !flash_wait(f))
+				return false;
+
+			if (flash_erase_needed(f, f->start, f->length))
+				ret &= flash_mass_erase(f);
+			local_end_addr = f->start + f->length;
+		} else if (!t->flash_diff && f->large_blocksize && !((local_start_addr - f->start) & (f->large_blocksize - 1U)) &&
+			addr + len >= local_start_addr + f->large_blocksize &&
+			local_start_addr + f->large_blocksize <= f->start + f->length) {
+			/* The request covers a whole large block, erase it with one command */
+			if (!flash_prepare(f) || !flash_erase_drain(f) || !flash_wait(f))
+				return false;
+
+			if (flash_erase_needed(f, local_start_addr, f->large_blocksize))
+				ret &= flash_erase_large(f, local_start_addr);
+			local_end_addr = local_start_addr + f->large_blocksize;
+		} else if (!flash_erase_queue(f, local_start_addr) &&
+			(!t->flash_diff || !flash_defer_erase(f, local_start_addr))) {
+			if (!flash_prepare(f) || !flash_erase_drain(f) || !flash_wait(f))
+				return false;
 
-		ret &= f->erase(f, local_start_addr, f->blocksize);
+			if (flash_erase_needed(f, local_start_addr, f->blocksize))
+				ret &= flash_erase(f, local_start_addr);
+		}
 
 		len -= MIN(local_end_addr - addr, len);
 		addr = local_end_addr;
 
-		/* Issue flash done on last operation */
-		if (len == 0)
+		/* Issue flash done on last operation, a concurrent flash or a background erase keeps erasing meanwhile */
+		if (len == 0 && !f->concurrent && !flash_erase_queued(f))
 			ret &= flash_done(f);
 	}
+	t->flash_request_end = platform_time_ms();
 	return ret;
 }
 
@@ -159,6 +674,8 @@ bool target_flash_write(target *t, target_addr_t dest, const void *src, size_t l
 {
 	if (!target_enter_flash_mode(t))
 		return false;
+	target_flash_break_forget(t, dest, len);
+	flash_account_host_wait(t, dest);
 
 	bool ret = true; /* catch false returns with &= */
 	while (len) {
@@ -167,16 +684,12 @@ bool target_flash_write(target *t, target_addr_t dest, const void *src, size_t l
 			return false;
 
 		/* terminate flash operations if we're not in the same target flash */
-		for (target_flash_s *target_f = t->flash; target_f; target_f = target_f->next) {
-			if (target_f != f) {
-				ret &= flash_buffered_flush(target_f);
-				ret &= flash_done(target_f);
-			}
-		}
+		ret &= flash_region_change(t, f);
 
 		const target_addr_t local_end_addr = MIN(dest + len, f->start + f->length);
 		const target_addr_t local_length = local_end_addr - dest;
 
+		f->stats.bytes_received += local_length;
 		ret &= flash_buffered_write(f, dest, src, local_length);
 
 		dest = local_end_addr;
@@ -189,6 +702,7 @@ bool target_flash_write(target *t, target_addr_t dest, const void *src, size_t l
 			ret &= flash_done(f);
 		}
 	}
+	t->flash_request_end = platform_time_ms();
 	return ret;
 }
 
@@ -200,6 +714,7 @@ bool target_flash_complete(target *t)
 	bool ret = true; /* catch false returns with &= */
 	for (target_flash_s *f = t->flash; f; f = f->next) {
 		ret &= flash_buffered_flush(f);
+		ret &= flash_erase_pending(f);
 		ret &= flash_done(f);
 	}
 
@@ -207,12 +722,72 @@ bool target_flash_complete(target *t)
 	return ret;
 }
 
+void target_flash_buffer_free(target *t)
+{
+	for (target_flash_s *f = t->flash; f; f = f->next)
+		f->buf = NULL;
+	free(t->flash_buf);
+	t->flash_buf = NULL;
+	t->flash_buf_size = 0;
+	t->flash_buf_owner = NULL;
+}
+
+/* Write out what a region still holds in the staging buffer and take it back */
+static bool flash_buffer_release(target *t)
+{
+	target_flash_s *const owner = t->flash_buf_owner;
+	if (!owner)
+		return true;
+	const bool ret = flash_buffered_flush(owner);
+	owner->buf = NULL;
+	t->flash_buf_owner = NULL;
+	return ret;
+}
+
+/*
+ * Hand the target's staging buffer to f. It is allocated once per Flash
+ * session at the size the largest region needs, rather than a buffer per
+ * region, so repeated sessions do not fragment the probe's heap.
+ */
+static bool flash_buffer_claim(target_flash_s *f)
+{
+	target *t = f->t;
+	const size_t size = flash_buffer_size(f);
+	if (t->flash_buf_size < size) {
+		size_t largest = size;
+		for (target_flash_s *region = t->flash; region; region = region->next)
+			largest = MAX(largest, region->writebufsize);
+		free(t->flash_buf);
+		t->flash_buf = malloc(largest);
+		t->flash_buf_size = t->flash_buf ? largest : 0;
+		/* Settle for what this region needs when the largest size does not fit */
+		if (!t->flash_buf && largest > size) {
+			t->flash_buf = malloc(size);
+			t->flash_buf_size = t->flash_buf ? size : 0;
+		}
+		if (!t->flash_buf)
+			return false;
+	}
+
+	f->buf = t->flash_buf;
+	t->flash_buf_owner = f;
+	return true;
+}
+
 static bool flash_buffered_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
+	bool ret = true; /* catch false returns with &= */
 	if (f->buf == NULL) {
-		/* Allocate buffer */
-		f->buf = malloc(f->writebufsize);
-		if (!f->buf) { /* malloc failed: heap exhaustion */
+		/* Take the staging buffer */
+		ret &= flash_buffer_release(f->t);
+		bool claimed = flash_buffer_claim(f);
+		if (!claimed && f->erase_pending) {
+			/* Not enough memory to buffer whole sectors, fall back to erasing them all now */
+			DEBUG_WARN("Not enough memory for differential flashing, erasing all sectors\n");
+			ret &= flash_erase_pending(f);
+			claimed = flash_buffer_claim(f);
+		}
+		if (!claimed) { /* malloc failed: heap exhaustion */
 			DEBUG_WARN("malloc: failed in %s\n", __func__);
 			return false;
 		}
@@ -221,9 +796,9 @@ static bool flash_buffered_write(target_flash_s *f, target_addr_t dest, const vo
 		f->buf_addr_high = 0;
 	}
 
-	bool ret = true; /* catch false returns with &= */
+	const size_t buf_size = flash_buffer_size(f);
 	while (len) {
-		const target_addr_t base_addr = dest & ~(f->writebufsize - 1U);
+		const target_addr_t base_addr = dest & ~(buf_size - 1U);
 
 		/* check for base address change */
 		if (base_addr != f->buf_addr_base) {
@@ -231,11 +806,11 @@ static bool flash_buffered_write(target_flash_s *f, target_addr_t dest, const vo
 
 			/* Setup buffer */
 			f->buf_addr_base = base_addr;
-			memset(f->buf, f->erased, f->writebufsize);
+			memset(f->buf, f->erased, buf_size);
 		}
 
-		const size_t offset = dest % f->writebufsize;
-		const size_t local_len = MIN(f->writebufsize - offset, len);
+		const size_t offset = dest % buf_size;
+		const size_t local_len = MIN(buf_size - offset, len);
 
 		/* Copy chunk into sector buffer */
 		memcpy(f->buf + offset, src, local_len);
@@ -251,28 +826,466 @@ static bool flash_buffered_write(target_flash_s *f, target_addr_t dest, const vo
 	return ret;
 }
 
+/*
+ * Write len bytes from src to flash at aligned_addr in writesize chunks.
+ * Chunks that hold nothing but the erased value are skipped: programming them would leave the
+ * flash as it is, and as they stay writesize aligned the drivers' alignment rules still hold.
+ * That does not hold for flashes whose write also does the erasing.
+ */
+static bool flash_write_chunks(target_flash_s *f, const target_addr_t aligned_addr, const uint8_t *src, const size_t len)
+{
+	if (!flash_erase_wait(f, aligned_addr, len))
+		return false;
+	bool ret = true; /* catch false returns with &= */
+	flash_cache_forget(f, aligned_addr, len);
+	for (size_t offset = 0; offset < len; offset += f->writesize) {
+		if (!f->write_erases && flash_data_is_erased(f, src + offset, f->writesize))
+			continue;
+		const uint32_t start_time = platform_time_ms();
+		ret &= f->write(f, aligned_addr + offset, src + offset, f->writesize);
+		f->write_pending = f->wait != NULL;
+		f->stats.write_ms += platform_time_ms() - start_time;
+		f->stats.bytes_programmed += f->writesize;
+	}
+	return ret;
+}
+
+/* Write the buffered range [low, high) to flash */
+static bool flash_buffered_write_range(target_flash_s *f, const target_addr_t low, const target_addr_t high)
+{
+	const target_addr_t aligned_addr = low & ~(f->writesize - 1U);
+	return flash_write_chunks(f, aligned_addr, f->buf + (aligned_addr - f->buf_addr_base), high - aligned_addr);
+}
+
+/* Differential mode: erase and write only the buffered sectors that differ from the target */
+/*
+ * More data for a sector an earlier flush already settled. What that flush left on the target is
+ * read into the rest of the buffer, and the sector is erased and written as a whole if it differs,
+ * so no chunk programmed before is programmed again without an erase.
+ */
+static bool flash_sector_merge(target_flash_s *f, const target_addr_t sector, const target_addr_t low,
+	const target_addr_t high)
+{
+	uint8_t *const data = f->buf + (sector - f->buf_addr_base);
+	const target_addr_t end = sector + f->blocksize;
+	if (!flash_wait(f) || (low > sector && target_mem_read(f->t, data, sector, low - sector)) ||
+		(high < end && target_mem_read(f->t, data + (high - sector), high, end - high)))
+		return false;
+	if (flash_cache_holds(f, sector, data)) {
+		++f->stats.sectors_cached;
+		return true;
+	}
+	if (!flash_sector_matches(f, sector, data) &&
+		(!flash_erase(f, sector) || !flash_buffered_write_range(f, sector, end)))
+		return false;
+	flash_cache_store(f, sector, data);
+	return true;
+}
+
+static bool flash_buffered_flush_diff(target_flash_s *f)
+{
+	bool ret = true; /* catch false returns with &= */
+	const target_addr_t buf_end = MIN(f->buf_addr_base + flash_buffer_size(f), f->start + f->length);
+	for (target_addr_t sector = f->buf_addr_base; sector < buf_end; sector += f->blocksize) {
+		const target_addr_t low = MAX(sector, f->buf_addr_low);
+		const target_addr_t high = MIN(sector + f->blocksize, f->buf_addr_high);
+		if (low >= high)
+			continue;
+
+		if (flash_erase_is_pending(f, sector)) {
+			/* The sector is erased before writing, so it ends up holding the buffer as a whole */
+			const uint8_t *const data = f->buf + (sector - f->buf_addr_base);
+			flash_erase_clear_pending(f, sector);
+			ret &= flash_wait(f);
+			if (flash_cache_holds(f, sector, data)) {
+				++f->stats.sectors_cached;
+				continue;
+			}
+			if (!flash_sector_matches(f, sector, data)) {
+				if (!flash_erase(f, sector) || !flash_buffered_write_range(f, low, high)) {
+					ret = false;
+					continue;
+				}
+			}
+			flash_cache_store(f, sector, data);
+			continue;
+		}
+		if (flash_sector_was_flushed(f, sector))
+			ret &= flash_sector_merge(f, sector, low, high);
+		else
+			ret &= flash_buffered_write_range(f, low, high);
+	}
+	return ret;
+}
+
 static bool flash_buffered_flush(target_flash_s *f)
 {
 	bool ret = true; /* catch false returns with &= */
 	if (f->buf && f->buf_addr_base != UINT32_MAX && f->buf_addr_low != UINT32_MAX &&
 		f->buf_addr_low < f->buf_addr_high) {
 		/* Write buffer to flash */
+		PERF_BEGIN(start);
 
 		if (!flash_prepare(f))
 			return false;
 
-		target_addr_t aligned_addr = f->buf_addr_low & ~(f->writesize - 1U);
-
-		const uint8_t *src = f->buf + (aligned_addr - f->buf_addr_base);
-		uint32_t len = f->buf_addr_high - aligned_addr;
-
-		for (size_t offset = 0; offset < len; offset += f->writesize)
-			ret &= f->write(f, aligned_addr + offset, src + offset, f->writesize);
+		if (f->erase_pending)
+			ret = flash_buffered_flush_diff(f);
+		else
+			ret = flash_buffered_write_range(f, f->buf_addr_low, f->buf_addr_high);
 
 		f->buf_addr_base = UINT32_MAX;
 		f->buf_addr_low = UINT32_MAX;
 		f->buf_addr_high = 0;
+		PERF_END(PERF_FLASH_FLUSH, start);
+	}
+
+	return ret;
+}
+
+/*
+ * Flash breakpoints.
+ *
+ * Once the breakpoint unit is used up a breakpoint in Flash can still be had by patching a
+ * breakpoint instruction into the erase block holding it. Inserting and removing one only
+ * updates bw_list, the blocks are erased and written when the target is resumed, each at most
+ * once however many of its breakpoints changed. GDB takes all its breakpoints out at every stop
+ * and puts them back on resume, which so costs nothing while the set stays the same.
+ *
+ * The contents of a block without breakpoints are read once and kept, so restoring it needs no
+ * read back, and target_mem_read() returns them so GDB never sees the patched instructions.
+ */
+
+#if PC_HOSTED == 1
+#define FLASH_BREAK_BLOCK_MAX_SIZE 0x20000U
+#define FLASH_BREAK_PAGES_MAX      32U
+#else
+#define FLASH_BREAK_BLOCK_MAX_SIZE 0x1000U
+#define FLASH_BREAK_PAGES_MAX      2U
+#endif
+/* Erases of one block for breakpoints, well short of the usual 10k cycle endurance */
+#define FLASH_BREAK_REWRITES_MAX 1000U
+
+struct target_flash_break_page {
+	target_flash_s *f;
+	target_addr_t addr; /* start of the erase block */
+	uint32_t rewrites;  /* times erased for breakpoints since attach */
+	uint8_t *patched;   /* bitmap of the halfwords the flash holds a breakpoint in now */
+	target_flash_break_page_s *next;
+	uint8_t original[]; /* block contents without any breakpoints */
+};
+
+/* RAM the flash drivers wrote while rewriting blocks, put back afterwards newest first */
+typedef struct flash_break_saved_ram {
+	struct flash_break_saved_ram *next;
+	target_addr_t addr;
+	size_t len;
+	uint8_t data[];
+} flash_break_saved_ram_s;
+
+static void (*flash_break_mem_write)(target *t, target_addr_t dest, const void *src, size_t len);
+static flash_break_saved_ram_s *flash_break_saved_ram;
+
+static size_t flash_break_bitmap_len(const target_flash_s *f)
+{
+	return (f->blocksize / 2U + 7U) / 8U;
+}
+
+static bool flash_break_page_holds(const target_flash_break_page_s *page, const target_addr_t addr)
+{
+	return addr >= page->addr && addr - page->addr < page->f->blocksize;
+}
+
+static target_flash_break_page_s *flash_break_page_find(target *t, const target_addr_t addr)
+{
+	for (target_flash_break_page_s *page = t->flash_break_pages; page; page = page->next) {
+		if (flash_break_page_holds(page, addr))
+			return page;
+	}
+	return NULL;
+}
+
+static bool flash_break_page_in_use(target *t, const target_flash_break_page_s *page)
+{
+	for (size_t i = 0; i < flash_break_bitmap_len(page->f); ++i) {
+		if (page->patched[i])
+			return true;
+	}
+	for (const struct breakwatch *bw = t->bw_list; bw; bw = bw->next) {
+		if (bw->flash && flash_break_page_holds(page, bw->addr))
+			return true;
+	}
+	return false;
+}
+
+/* The image of the block holding addr, read from the target the first time it is needed */
+static target_flash_break_page_s *flash_break_page_get(target *t, const target_addr_t addr)
+{
+	target_flash_break_page_s *page = flash_break_page_find(t, addr);
+	if (page)
+		return page;
+
+	target_flash_s *f = target_flash_for_addr(t, addr);
+	/* Parts that need a Flash mode of their own can not be programmed behind the program's back */
+	if (!f || t->enter_flash_mode || f->blocksize > FLASH_BREAK_BLOCK_MAX_SIZE)
+		return NULL;
+
+	/* Make room by dropping the image of a block that holds no breakpoints any more */
+	size_t pages = 0;
+	target_flash_break_page_s **unused = NULL;
+	for (target_flash_break_page_s **p = &t->flash_break_pages; *p; p = &(*p)->next) {
+		++pages;
+		if (!flash_break_page_in_use(t, *p))
+			unused = p;
+	}
+	if (pages >= FLASH_BREAK_PAGES_MAX) {
+		if (!unused)
+			return NULL;
+		target_flash_break_page_s *const next = (*unused)->next;
+		free(*unused);
+		*unused = next;
+	}
+
+	const size_t bitmap_len = flash_break_bitmap_len(f);
+	page = calloc(1, sizeof(*page) + f->blocksize + bitmap_len);
+	if (!page) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return NULL;
+	}
+	page->f = f;
+	page->addr = addr - ((addr - f->start) % f->blocksize);
+	page->patched = page->original + f->blocksize;
+	if (target_mem_read(t, page->original, page->addr, f->blocksize)) {
+		free(page);
+		return NULL;
+	}
+	page->next = t->flash_break_pages;
+	t->flash_break_pages = page;
+	return page;
+}
+
+/* Take a breakpoint the driver had no room for as a Flash breakpoint, true if it could be */
+bool target_flash_break_set(target *t, struct breakwatch *bw)
+{
+	if (!t->flash_break_enabled || !t->flash_break_instr || (bw->addr & 1U) ||
+		(bw->type != TARGET_BREAK_SOFT && bw->type != TARGET_BREAK_HARD))
+		return false;
+
+	const target_flash_break_page_s *const page = flash_break_page_get(t, bw->addr);
+	if (!page) {
+		DEBUG_WARN("No Flash breakpoint possible at 0x%08" PRIx32 "\n", bw->addr);
+		return false;
+	}
+	if (page->rewrites >= FLASH_BREAK_REWRITES_MAX) {
+		DEBUG_WARN("Flash block at 0x%08" PRIx32 " was rewritten %" PRIu32 " times, no more breakpoints in it\n",
+			page->addr, page->rewrites);
+		return false;
+	}
+	bw->flash = true;
+	return true;
+}
+
+/* Stands in for mem_write while blocks are rewritten, keeping what it overwrites in RAM */
+static void flash_break_ram_write(target *t, target_addr_t dest, const void *src, size_t len)
+{
+	for (const struct target_ram *ram = t->ram; ram; ram = ram->next) {
+		const target_addr_t start = MAX(dest, ram->start);
+		const target_addr_t end = MIN(dest + len, ram->start + ram->length);
+		if (start >= end)
+			continue;
+
+		bool saved = false;
+		for (const flash_break_saved_ram_s *entry = flash_break_saved_ram; entry && !saved; entry = entry->next)
+			saved = start >= entry->addr && end <= entry->addr + entry->len;
+		if (saved)
+			continue;
+
+		flash_break_saved_ram_s *const entry = malloc(sizeof(*entry) + (end - start));
+		if (!entry) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("RAM at 0x%08" PRIx32 " can not be restored after a Flash breakpoint update\n", start);
+			continue;
+		}
+		entry->addr = start;
+		entry->len = end - start;
+		t->mem_read(t, entry->data, start, entry->len);
+		entry->next = flash_break_saved_ram;
+		flash_break_saved_ram = entry;
+	}
+	flash_break_mem_write(t, dest, src, len);
+}
+
+static void flash_break_ram_restore(target *t)
+{
+	t->mem_write = flash_break_mem_write;
+	while (flash_break_saved_ram) {
+		flash_break_saved_ram_s *const entry = flash_break_saved_ram;
+		target_mem_write(t, entry->addr, entry->data, entry->len);
+		flash_break_saved_ram = entry->next;
+		free(entry);
+	}
+}
+
+static bool flash_break_page_write(target *t, target_flash_break_page_s *page, const uint8_t *wanted)
+{
+	target_flash_s *const f = page->f;
+	uint8_t *const image = malloc(f->blocksize);
+	if (!image) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	memcpy(image, page->original, f->blocksize);
+	for (size_t offset = 0; offset < f->blocksize; offset += 2U) {
+		if (wanted[offset / 16U] & (1U << ((offset / 2U) % 8U))) {
+			image[offset] = t->flash_break_instr & 0xffU;
+			image[offset + 1U] = t->flash_break_instr >> 8U;
+		}
+	}
+
+	bool ret = flash_prepare(f) && flash_wait(f);
+	ret = ret && flash_erase(f, page->addr);
+	ret = ret && flash_wait(f) && flash_write_chunks(f, page->addr, image, f->blocksize);
+	ret &= flash_done(f);
+	free(image);
+
+	++page->rewrites;
+	++t->flash_break_rewrites;
+	if (!ret) {
+		DEBUG_WARN("Rewriting Flash block at 0x%08" PRIx32 " for breakpoints failed\n", page->addr);
+		return false;
 	}
+	memcpy(page->patched, wanted, flash_break_bitmap_len(f));
+	return true;
+}
 
+/*
+ * Bring the blocks in line with the Flash breakpoints in bw_list, before resuming. A single step
+ * runs one instruction so breakpoints are only taken out then, any new ones wait for the next
+ * resume. The registers and the RAM the flash drivers use are put back afterwards.
+ */
+bool target_flash_break_commit(target *t, const bool step)
+{
+	/* Blocks flashed since their breakpoints were set need their image again */
+	for (const struct breakwatch *bw = t->bw_list; bw && !step; bw = bw->next) {
+		if (bw->flash && !flash_break_page_get(t, bw->addr))
+			DEBUG_WARN("Flash breakpoint at 0x%08" PRIx32 " could not be inserted\n", bw->addr);
+	}
+
+	bool ret = true;
+	uint8_t *regs = NULL;
+	for (target_flash_break_page_s *page = t->flash_break_pages; page; page = page->next) {
+		const size_t bitmap_len = flash_break_bitmap_len(page->f);
+		uint8_t wanted[bitmap_len];
+		memset(wanted, 0, bitmap_len);
+		for (const struct breakwatch *bw = t->bw_list; bw; bw = bw->next) {
+			if (!bw->flash || !flash_break_page_holds(page, bw->addr))
+				continue;
+			const size_t halfword = (bw->addr - page->addr) / 2U;
+			wanted[halfword / 8U] |= 1U << (halfword % 8U);
+		}
+		for (size_t i = 0; step && i < bitmap_len; ++i)
+			wanted[i] &= page->patched[i];
+		if (!memcmp(wanted, page->patched, bitmap_len))
+			continue;
+
+		if (!regs) {
+			regs = malloc(t->regs_size);
+			if (!regs) { /* malloc failed: heap exhaustion */
+				DEBUG_WARN("malloc: failed in %s\n", __func__);
+				return false;
+			}
+			target_regs_read(t, regs);
+			flash_break_mem_write = t->mem_write;
+			t->mem_write = flash_break_ram_write;
+		}
+		ret &= flash_break_page_write(t, page, wanted);
+	}
+
+	if (regs) {
+		flash_break_ram_restore(t);
+		target_regs_write(t, regs);
+		free(regs);
+		target_mem_cache_drop(t);
+	}
 	return ret;
 }
+
+/* Reads of patched blocks return what they hold without the breakpoints */
+void target_flash_break_shadow(target *t, void *dest, const target_addr_t src, const size_t len)
+{
+	for (const target_flash_break_page_s *page = t->flash_break_pages; page; page = page->next) {
+		const target_addr_t start = MAX(src, page->addr);
+		const target_addr_t end = MIN(src + len, page->addr + page->f->blocksize);
+		if (start < end)
+			memcpy((uint8_t *)dest + (start - src), page->original + (start - page->addr), end - start);
+	}
+}
+
+/* The blocks in [addr, addr + len) are being erased or written, their images no longer hold */
+void target_flash_break_forget(target *t, const target_addr_t addr, const size_t len)
+{
+	for (target_flash_break_page_s **p = &t->flash_break_pages; *p;) {
+		target_flash_break_page_s *const page = *p;
+		if (page->addr < addr + len && addr < page->addr + page->f->blocksize) {
+			*p = page->next;
+			free(page);
+		} else
+			p = &page->next;
+	}
+}
+
+/* Take all Flash breakpoints out and drop the block images, on detach */
+/* Stop the running target so its Flash can be written, false if it does not halt */
+static bool flash_break_halt(target *t)
+{
+	target_halt_request(t);
+	enum target_halt_reason reason;
+	const uint32_t start_time = platform_time_ms();
+	while ((reason = target_halt_poll(t, NULL)) == TARGET_HALT_RUNNING && platform_time_ms() - start_time < 1000U)
+		continue;
+	return reason != TARGET_HALT_RUNNING && reason != TARGET_HALT_ERROR;
+}
+
+void target_flash_break_release(target *t)
+{
+	/* Putting the instructions back needs the target halted, one that was running is resumed after */
+	bool resume = false;
+	if (t->flash_break_pages && t->running) {
+		resume = flash_break_halt(t);
+		if (!resume)
+			DEBUG_WARN("Target did not halt, flash breakpoints are left in Flash\n");
+	}
+	for (struct breakwatch **p = &t->bw_list; *p;) {
+		struct breakwatch *const bw = *p;
+		if (bw->flash) {
+			*p = bw->next;
+			free(bw);
+		} else
+			p = &bw->next;
+	}
+	if (!t->running && !target_flash_break_commit(t, false))
+		DEBUG_WARN("Flash breakpoints could not all be taken out\n");
+	target_flash_break_free(t);
+	t->flash_break_rewrites = 0;
+	if (resume)
+		target_halt_resume(t, false);
+}
+
+void target_flash_break_free(target *t)
+{
+	while (t->flash_break_pages) {
+		target_flash_break_page_s *const next = t->flash_break_pages->next;
+		free(t->flash_break_pages);
+		t->flash_break_pages = next;
+	}
+}
+
+void target_flash_break_status(target *t)
+{
+	for (const target_flash_break_page_s *page = t->flash_break_pages; page; page = page->next) {
+		size_t breakpoints = 0;
+		for (const struct breakwatch *bw = t->bw_list; bw; bw = bw->next)
+			breakpoints += bw->flash && flash_break_page_holds(page, bw->addr);
+		gdb_outf("  0x%08" PRIx32 "+0x%" PRIx32 ": %zu breakpoints, %" PRIu32 " rewrites\n", page->addr,
+			(uint32_t)page->f->blocksize, breakpoints, page->rewrites);
+	}
+}
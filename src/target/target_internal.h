@@ -26,6 +26,14 @@
 extern target *target_list;
 target *target_new(void);
 
+/* Set the target list aside detached across a rescan, so a scan of the same part can take it back */
+void target_list_stash(void);
+/* Make the stashed targets the target list again, false if there are none or the scan found some */
+bool target_list_unstash(void);
+void target_list_stash_free(void);
+/* Whether the target list just scanned may be stashed and taken back by the next scan */
+void target_list_set_cacheable(bool cacheable);
+
 struct target_ram {
 	target_addr_t start;
 	size_t length;
@@ -34,28 +42,109 @@ struct target_ram {
 
 typedef struct target_flash target_flash_s;
 
+/* Largest flash write buffer drivers ask for, FLASH_WRITEBUF_MAX_SIZE, comes from the memory profile */
+
 typedef bool (*flash_prepare_func)(target_flash_s *f);
 typedef bool (*flash_erase_func)(target_flash_s *f, target_addr_t addr, size_t len);
 typedef bool (*flash_write_func)(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 typedef bool (*flash_done_func)(target_flash_s *f);
+typedef bool (*flash_wait_func)(target_flash_s *f);
+typedef bool (*flash_mass_erase_func)(target_flash_s *f);
+typedef bool (*flash_blank_check_func)(target_flash_s *f, target_addr_t addr, size_t len);
+typedef bool (*flash_erase_start_func)(target_flash_s *f, target_addr_t addr);
+
+/* Counters for the current or last flash session, see monitor flash_stats */
+typedef struct flash_stats {
+	uint32_t bytes_received;   /* data handed over for this flash */
+	uint32_t bytes_programmed; /* data actually sent to the write routine */
+	uint32_t sectors_erased;
+	uint32_t sectors_blank;    /* erases skipped as the sector was blank already */
+	uint32_t sectors_cached;   /* compares with the target skipped as the host cache knew the contents */
+	uint32_t erase_ms;
+	uint32_t write_ms;         /* includes waiting for writes in progress */
+	uint32_t prepare_done_ms;
+	uint32_t host_wait_ms;     /* time between flash requests, spent waiting for the host */
+	uint32_t status_polls;     /* controller status reads made by target_flash_poll() */
+	uint32_t busy_max_ms;      /* longest single controller operation waited for */
+	uint32_t erase_wait_ms;    /* writes held up by the background erase */
+} flash_stats_s;
+
+/* One read of a flash controller's status for target_flash_poll() */
+typedef enum flash_poll_result {
+	FLASH_POLL_BUSY,
+	FLASH_POLL_DONE,
+	FLASH_POLL_ERROR,
+} flash_poll_result_e;
+
+typedef flash_poll_result_e (*flash_poll_func)(target *t, void *ctx);
+typedef flash_poll_result_e (*flash_status_func)(target_flash_s *f);
+
+/* How long a part takes over a reset, the core's default is used if a driver gives none */
+typedef struct target_reset_profile {
+	uint16_t nrst_ms;    /* after releasing nRST, before the first access */
+	uint16_t startup_ms; /* once out of reset, for the clocks to start up */
+	uint16_t timeout_ms; /* longest the reset is waited for */
+} target_reset_profile_s;
+
+/* Target memory read while halted is kept in lines of this size, see target_mem_read() */
+#define TARGET_MEM_CACHE_LINE_SIZE 64U
+#if PC_HOSTED == 1
+#define TARGET_MEM_CACHE_LINES 32U
+#else
+#define TARGET_MEM_CACHE_LINES 8U
+#endif
+
+typedef struct target_mem_cache_line {
+	target_addr_t addr;
+	bool valid;
+	uint8_t data[TARGET_MEM_CACHE_LINE_SIZE];
+} target_mem_cache_line_s;
+
+typedef struct target_mem_cache {
+	bool halted; /* a halt has been seen and the target cannot have run since */
+	uint8_t next; /* line to replace on the next miss */
+	target_mem_cache_line_s lines[TARGET_MEM_CACHE_LINES];
+} target_mem_cache_s;
 
 struct target_flash {
 	target *t;                   /* Target this flash is attached to */
 	target_addr_t start;         /* start address of flash */
 	size_t length;               /* flash length */
 	size_t blocksize;            /* erase block size */
+	size_t large_blocksize;      /* optional bigger erase unit, erase() is handed whole aligned ones when
+	                              * a request covers them */
 	size_t writesize;            /* write operation size, must be <= blocksize/writebufsize */
 	size_t writebufsize;         /* size of write buffer */
 	uint8_t erased;              /* byte erased state */
+	bool write_erases;           /* write erases the page itself and erase does nothing, so chunks of the
+	                              * erased value are still written */
 	bool ready;                  /* true if flash is in flash mode/prepared */
 	flash_prepare_func prepare;  /* prepare for flash operations */
 	flash_erase_func erase;      /* erase a range of flash */
+	flash_mass_erase_func mass_erase; /* erase the whole of this flash in one go, optional */
+	flash_blank_check_func blank_check; /* true if a range is erased, checked by the controller, optional */
 	flash_write_func write;      /* write to flash */
 	flash_done_func done;        /* finish flash operations */
+	flash_wait_func wait;        /* wait for writes left in progress, write returns early if set */
+	bool write_pending;          /* true if the last write may still be in progress */
+	bool concurrent;             /* own controller: erase may be left in progress too, and other flashes
+	                              * are used meanwhile, needs wait */
+	flash_erase_start_func erase_start; /* start erasing one block and return, optional, needs status */
+	flash_status_func status;    /* one read of whether the started erase is done */
+	target_addr_t erase_next;    /* background erase: next block to start */
+	target_addr_t erase_end;     /* end of the blocks queued, erase_next when nothing is */
+	uint32_t erase_started;      /* time the block before erase_next was started */
+	bool erase_busy;             /* the block before erase_next is being erased */
+	bool erase_failed;           /* a background erase failed, reported by the next write or done */
+	const struct flash_loader *loader; /* resident RAM loader programming this flash, if any */
+	uint32_t loader_head;        /* chunks queued to the loader this session */
+	bool loader_running;         /* true while the loader is running on the target */
 	void *buf;                   /* buffer for flash operations */
 	target_addr_t buf_addr_base; /* address of block this buffer is for */
 	target_addr_t buf_addr_low;  /* address of lowest byte written */
 	target_addr_t buf_addr_high; /* address of highest byte written */
+	uint8_t *erase_pending;      /* differential mode, two bits a sector: erase deferred, flushed since */
+	flash_stats_s stats;         /* timing and throughput counters */
 	target_flash_s *next;        /* next flash in list */
 };
 
@@ -78,9 +167,16 @@ struct breakwatch {
 	enum target_breakwatch type;
 	target_addr_t addr;
 	size_t size;
+	bool flash;           /* held by a breakpoint instruction patched into Flash, see target_flash_break_set() */
 	uint32_t reserved[4]; /* for use by the implementing driver */
 };
 
+typedef struct target_flash_break_page target_flash_break_page_s;
+typedef struct flash_cache flash_cache_s;
+
+/* Longest device unique ID a driver's unique_id hook returns */
+#define TARGET_UID_MAX 16U
+
 #define MAX_CMDLINE 81
 
 struct target_s {
@@ -99,6 +195,8 @@ struct target_s {
 	/* Register access functions */
 	size_t regs_size;
 	char *tdesc;
+	/* Memory map XML, see target_mem_map() */
+	char *mem_map;
 	void (*regs_read)(target *t, void *data);
 	void (*regs_write)(target *t, const void *data);
 	ssize_t (*reg_read)(target *t, int reg, void *data, size_t max);
@@ -107,6 +205,12 @@ struct target_s {
 	/* Halt/resume functions */
 	void (*reset)(target *t);
 	void (*extended_reset)(target *t);
+	/*
+	 * Reset and stay halted at the reset vector, false if the halt was not seen, optional.
+	 * It resets the way the architecture does, so a driver replacing reset has to clear it.
+	 */
+	bool (*reset_halt)(target *t);
+	const target_reset_profile_s *reset_profile;
 	void (*halt_request)(target *t);
 	enum target_halt_reason (*halt_poll)(target *t, target_addr_t *watch);
 	void (*halt_resume)(target *t, bool step);
@@ -115,14 +219,52 @@ struct target_s {
 	int (*breakwatch_set)(target *t, struct breakwatch *);
 	int (*breakwatch_clear)(target *t, struct breakwatch *);
 	struct breakwatch *bw_list;
+	/* Breakpoints patched into Flash once the driver's run out, see target_flash_break_commit() */
+	bool flash_break_enabled;
+	uint16_t flash_break_instr; /* breakpoint instruction to patch in, 0 if the core has none */
+	target_flash_break_page_s *flash_break_pages;
+	uint32_t flash_break_rewrites; /* blocks erased for breakpoints since attach */
 
 	/* Recovery functions */
 	bool (*mass_erase)(target *t);
 
+	/* Read the part's unique device ID, returns its length up to TARGET_UID_MAX, 0 if it has none */
+	size_t (*unique_id)(target *t, uint8_t *uid);
+
+	/* Compute the CRC of a range on the target itself, returns false if the range must be read back */
+	bool (*crc32)(target *t, uint32_t *crc, target_addr_t base, size_t len);
+	/* The same with a hardware unit computing the reflected IEEE 802.3 CRC32, see target_crc32() */
+	bool (*crc32_ieee)(target *t, uint32_t *crc, target_addr_t base, size_t len);
+	/* Fill or search a range on the target itself, these return false if it must be done over the link */
+	bool (*mem_fill)(target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len);
+	bool (*mem_find)(
+		target *t, target_addr_t base, size_t len, const void *pattern, size_t pattern_len, target_addr_t *found);
+
 	/* Flash functions */
 	bool (*enter_flash_mode)(target *t);
 	bool (*exit_flash_mode)(target *t);
 	bool flash_mode;
+	/* One staging buffer for all Flash regions, held by flash_buf_owner, see flash_buffered_write() */
+	uint8_t *flash_buf;
+	size_t flash_buf_size;
+	target_flash_s *flash_buf_owner;
+	/* The region Flash operations last went to, see flash_region_change() */
+	target_flash_s *flash_active;
+	/* The regions sorted by start address for target_flash_for_addr(), built on first use */
+	target_flash_s **flash_index;
+	size_t flash_index_len;
+	bool flash_diff; /* skip erasing and writing sectors that already hold the data */
+	uint32_t flash_request_end; /* time the last flash request returned, to account for waiting on the host */
+#if PC_HOSTED == 1
+	flash_cache_s *flash_cache; /* what the host knows the Flash holds, for the current session */
+#endif
+
+	/* Resumed or reset and no halt seen since, so it may be running */
+	bool running;
+
+	/* Halted-state read cache, allocated on first use */
+	bool mem_cache_enabled;
+	target_mem_cache_s *mem_cache;
 
 	/* target-defined options */
 	unsigned target_options;
@@ -167,8 +309,28 @@ void target_mem_map_free(target *t);
 void target_add_commands(target *t, const struct command_s *cmds, const char *name);
 void target_add_ram(target *t, target_addr_t start, uint32_t len);
 void target_add_flash(target *t, target_flash_s *f);
+/* Drop the cached lines, and for invalidate also stop caching until the next halt is seen */
+void target_mem_cache_drop(target *t);
+void target_mem_cache_invalidate(target *t);
+/* For a driver reading ahead at a halt: whether the line at addr would be cached, and taking it */
+bool target_mem_cache_can_fill(target *t, target_addr_t addr);
+void target_mem_cache_fill(target *t, target_addr_t addr, const void *data);
 
 target_flash_s *target_flash_for_addr(target *t, uint32_t addr);
+bool target_flash_poll(target *t, target_flash_s *f, flash_poll_func poll, void *ctx, uint32_t typical_ms,
+	uint32_t max_ms);
+void target_flash_buffer_free(target *t);
+/* CRC32 of a sector, by the target if it can, else read back */
+bool target_flash_sector_crc(target_flash_s *f, target_addr_t sector, uint32_t *crc);
+
+/* Flash breakpoints, the blocks holding them are only rewritten by target_flash_break_commit() */
+bool target_flash_break_set(target *t, struct breakwatch *bw);
+bool target_flash_break_commit(target *t, bool step);
+void target_flash_break_shadow(target *t, void *dest, target_addr_t src, size_t len);
+void target_flash_break_forget(target *t, target_addr_t addr, size_t len);
+void target_flash_break_release(target *t);
+void target_flash_break_free(target *t);
+void target_flash_break_status(target *t);
 
 /* Convenience function for MMIO access */
 uint32_t target_mem_read32(target *t, uint32_t addr);
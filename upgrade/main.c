@@ -35,14 +35,27 @@
 
 #define LOAD_ADDRESS 0x8002000
 
+/* DFU functional descriptor, wTransferSize at offset 5 */
+#define DFU_FUNCTIONAL 0x21
+#define DFU_DEFAULT_TRANSFER_SIZE 1024
+
+/* Enough for 1 kiB pages over 128 kiB of Flash */
+#define CRC_TABLE_ENTRIES 128
+#define CRC_TABLE_MAX_UNIT 0x20000
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return ((uint32_t)p[3] << 24) + ((uint32_t)p[2] << 16) + (p[1] << 8) + p[0];
+}
+
 void banner(void)
 {
 	puts("\nBlack Magic Probe -- Firmware Upgrade Utility -- Version " VERSION);
 	puts("Copyright (C) 2022 Black Magic Debug Project");
 	puts("License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>\n");
 	puts("");
-	puts("** WARNING: This utility has been deprecated in favour of bmputil")
-	puts("   Please see https://github.com/blackmagic-debug/bmputil")
+	puts("** WARNING: This utility has been deprecated in favour of bmputil");
+	puts("   Please see https://github.com/blackmagic-debug/bmputil");
 }
 
 
@@ -123,6 +136,41 @@ usb_dev_handle * get_dfu_interface(struct usb_device *dev, uint16_t *interface)
 	return NULL;
 }
 
+/* Block size from the DFU functional descriptor of the interface */
+uint16_t get_transfer_size(struct usb_device *dev, uint16_t interface)
+{
+	int i, j, k;
+
+	for(i = 0; i < dev->descriptor.bNumConfigurations; i++) {
+		struct usb_config_descriptor *config = &dev->config[i];
+		for(j = 0; j < config->bNumInterfaces; j++) {
+			for(k = 0; k < config->interface[j].num_altsetting; k++) {
+				struct usb_interface_descriptor *iface = &config->interface[j].altsetting[k];
+				if ((iface->bInterfaceNumber != interface) || (iface->extralen < 7) ||
+				    (iface->extra[1] != DFU_FUNCTIONAL))
+					continue;
+				return iface->extra[5] | (iface->extra[6] << 8);
+			}
+		}
+	}
+	return DFU_DEFAULT_TRANSFER_SIZE;
+}
+
+/*
+ * Number of entries in the table of erase unit sizes and CRCs, 0 when the
+ * bootloader has none we can use and every unit is rewritten.
+ */
+int check_crc_table(const uint8_t *table, int len, uint16_t transfer_size)
+{
+	int entries = len / 8;
+	for (int i = 0; i < entries; i++) {
+		uint32_t size = get_le32(table + i * 8);
+		if (!size || (size % transfer_size) || (size > CRC_TABLE_MAX_UNIT))
+			return 0;
+	}
+	return entries;
+}
+
 int main(void)
 {
 	struct usb_device *dev;
@@ -130,6 +178,10 @@ int main(void)
 	uint16_t iface;
 	int state;
 	uint32_t offset;
+	uint16_t transfer_size;
+	uint8_t crc_table[CRC_TABLE_ENTRIES * 8];
+	int entries, entry = 0;
+	uint32_t skipped = 0;
 
 	banner();
 	usb_init();
@@ -160,13 +212,38 @@ retry:
 
 	dfu_makeidle(handle, iface);
 
-	for(offset = 0; offset < bindatalen; offset += 1024) {
+	transfer_size = get_transfer_size(dev, iface);
+	entries = stm32_mem_crc_table(handle, iface, LOAD_ADDRESS, crc_table, sizeof(crc_table));
+	entries = entries > 0 ? check_crc_table(crc_table, entries, transfer_size) : 0;
+	dfu_makeidle(handle, iface);
+
+	/* Erase units that already hold the image are left alone, the rest are erased and written */
+	for(offset = 0; offset < bindatalen;) {
+		uint32_t unit_size = transfer_size;
+		int unchanged = 0;
+		if (entry < entries) {
+			unit_size = get_le32(crc_table + entry * 8);
+			/* A unit the image ends in keeps old bytes past its end, it is always rewritten */
+			unchanged = (offset + unit_size <= bindatalen) &&
+				(stm32_crc32(&bindata[offset], unit_size) == get_le32(crc_table + entry * 8 + 4));
+			entry++;
+		}
 		printf("Progress: %d%%\r", (offset*100)/bindatalen);
 		fflush(stdout);
-		assert(stm32_mem_erase(handle, iface, LOAD_ADDRESS + offset) == 0);
-		stm32_mem_write(handle, iface, (void*)&bindata[offset], 1024, LOAD_ADDRESS + offset);
+		if (unchanged) {
+			skipped += unit_size;
+			offset += unit_size;
+			continue;
+		}
+		for (uint32_t end = offset + unit_size; (offset < end) && (offset < bindatalen); offset += transfer_size) {
+			uint32_t len = bindatalen - offset < transfer_size ? bindatalen - offset : transfer_size;
+			assert(stm32_mem_erase(handle, iface, LOAD_ADDRESS + offset) == 0);
+			stm32_mem_write(handle, iface, (void*)&bindata[offset], len, LOAD_ADDRESS + offset);
+		}
 	}
 	stm32_mem_manifest(handle, iface);
+	if (skipped)
+		printf("%u bytes unchanged and not rewritten\n", skipped);
 
 	usb_release_interface(handle, iface);
 	usb_close(handle);
@@ -34,6 +34,9 @@
 #define STM32_CMD_SETADDRESSPOINTER	0x21
 #define STM32_CMD_ERASE			0x41
 
+/* Upload block of the Black Magic bootloader with erase unit sizes and CRCs */
+#define BMP_CRC_TABLE_BLOCK		1
+
 static int stm32_download(usb_dev_handle *dev, uint16_t iface, 
 			  uint16_t wBlockNum, void *data, int size)
 {
@@ -79,6 +82,36 @@ int stm32_mem_write(usb_dev_handle *dev, uint16_t iface, void *data, int size, u
 	return stm32_download(dev, iface, 2, data, size);
 }
 
+/*
+ * Read the size and CRC-32 of each erase unit from addr, returns the
+ * length of the table or < 0 on error. Bootloaders without the table
+ * return something that fails the checks of the caller.
+ */
+int stm32_mem_crc_table(usb_dev_handle *dev, uint16_t iface, uint32_t addr, void *table, int size)
+{
+	uint8_t request[5];
+	int i;
+
+	request[0] = STM32_CMD_SETADDRESSPOINTER;
+	memcpy(request+1, &addr, sizeof(addr));
+	if((i = stm32_download(dev, iface, 0, request, sizeof(request))) < 0) return i;
+	i = dfu_upload(dev, iface, BMP_CRC_TABLE_BLOCK, table, size);
+	dfu_abort(dev, iface);
+	return i;
+}
+
+/* Same CRC as the bootloader computes */
+uint32_t stm32_crc32(const uint8_t *data, uint32_t len)
+{
+	uint32_t crc = 0xffffffff;
+	while (len--) {
+		crc ^= *data++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
 int stm32_mem_manifest(usb_dev_handle *dev, uint16_t iface)
 {
 	dfu_status status;
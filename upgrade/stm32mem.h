@@ -30,5 +30,7 @@
 int stm32_mem_erase(usb_dev_handle *dev, uint16_t iface, uint32_t addr);
 int stm32_mem_write(usb_dev_handle *dev, uint16_t iface, void *data, int size, uint32_t addr);
 int stm32_mem_manifest(usb_dev_handle *dev, uint16_t iface);
+int stm32_mem_crc_table(usb_dev_handle *dev, uint16_t iface, uint32_t addr, void *table, int size);
+uint32_t stm32_crc32(const uint8_t *data, uint32_t len);
 
 #endif /* STM32MEM_H */